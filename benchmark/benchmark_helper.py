@@ -51,7 +51,9 @@ def run_model(model,
         time_consume = t.elapsed
     else:
         end.record()
-        torch.cuda.synchronize()
+        # The GPU models run on the current stream, turbo_transformers within
+        # a cuda_stream_guard, so the events time them all.
+        end.synchronize()
         torch_elapsed = start.elapsed_time(end) / 1e3
         qps = num_iter / torch_elapsed
         time_consume = torch_elapsed
@@ -148,3 +150,105 @@ def onnxruntime_benchmark_creator(backend: str):
             }))
 
     return _impl_
+
+
+def load_length_histogram(filename: str):
+    """
+    The lengths and the weights of a histogram file, see
+    length_histogram.txt. A line is a length and its weight, separated by a
+    comma or spaces, and '#' starts a comment.
+    """
+    lengths, weights = [], []
+    with open(filename) as f:
+        for line in f:
+            fields = line.split('#')[0].replace(',', ' ').split()
+            if not fields:
+                continue
+            if len(fields) != 2:
+                raise ValueError(
+                    f"A line of {filename} should be a length and a weight: "
+                    f"{line}")
+            lengths.append(int(fields[0]))
+            weights.append(float(fields[1]))
+    if not lengths:
+        raise ValueError(f"{filename} has no lengths")
+    return lengths, weights
+
+
+def run_scenario(model,
+                 use_cuda,
+                 batches,
+                 batch_size,
+                 seq_len,
+                 framework_name,
+                 thread_num=1,
+                 warmup=10,
+                 slo_ms=0.0,
+                 padding_ratio=0.0,
+                 valid_tokens=0):
+    """
+    Run the batches of every client concurrently, `batches[i]` being the
+    batches of the i-th client, each passed to `model`, and print the QPS,
+    the latency percentiles and the goodput, the batches per second done
+    within `slo_ms` (all of them if 0). `valid_tokens` are the unpadded
+    tokens of all the batches.
+    """
+    import torch
+    import json
+    import threading
+    import time
+
+    def call(batch):
+        model(batch)
+        if use_cuda:
+            torch.cuda.current_stream().synchronize()
+
+    for i in range(warmup):
+        call(batches[0][i % len(batches[0])])
+
+    client_ms = [[] for _ in batches]
+    barrier = threading.Barrier(len(batches) + 1)
+
+    def client(i):
+        barrier.wait()
+        for batch in batches[i]:
+            start = time.perf_counter()
+            call(batch)
+            client_ms[i].append((time.perf_counter() - start) * 1e3)
+
+    threads = [
+        threading.Thread(target=client, args=(i, ))
+        for i in range(len(batches))
+    ]
+    for t in threads:
+        t.start()
+    barrier.wait()
+    start = time.perf_counter()
+    for t in threads:
+        t.join()
+    elapsed = time.perf_counter() - start
+
+    ms = sorted(m for c in client_ms for m in c)
+
+    def percentile(q):
+        return ms[min(int(q * (len(ms) - 1) + 0.5), len(ms) - 1)]
+
+    good = len([m for m in ms if m <= slo_ms]) if slo_ms > 0 else len(ms)
+    print(
+        json.dumps({
+            "QPS": len(ms) / elapsed,
+            "elapsed": elapsed,
+            "n": len(ms),
+            "batch_size": batch_size,
+            "seq_len": seq_len,
+            "framework": framework_name,
+            "thread_num": thread_num,
+            "clients": len(batches),
+            "mean_ms": sum(ms) / len(ms),
+            "p50_ms": percentile(0.5),
+            "p90_ms": percentile(0.9),
+            "p99_ms": percentile(0.99),
+            "goodput": good / elapsed,
+            "tokens_per_second": valid_tokens / elapsed,
+            "padding_ratio": padding_ratio,
+        }))
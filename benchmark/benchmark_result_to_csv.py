@@ -21,13 +21,11 @@ def main():
     results = collections.OrderedDict()
 
     for i, line in enumerate(sys.stdin):
-        length = len(line.split(','))
         line = json.loads(line)
-        if length == 7:
-            if "thread_num" in line:
-                task = f'{line["thread_num"]},{line["batch_size"]},{line["seq_len"]}'
-            elif "n_threads" in line:
-                task = f'{line["n_threads"]},{line["batch_size"]},{line["seq_len"]}'
+        if "thread_num" in line:
+            task = f'{line["thread_num"]},{line["batch_size"]},{line["seq_len"]}'
+        elif "n_threads" in line:
+            task = f'{line["n_threads"]},{line["batch_size"]},{line["seq_len"]}'
         else:
             task = f'{line["batch_size"]},{line["seq_len"]}'
         framework = line["framework"]
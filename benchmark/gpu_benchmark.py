@@ -69,8 +69,9 @@ def benchmark_turbo_transformers(model: str, seq_len: int, batch_size: int,
                               device=test_device)
     model = turbo_transformers.BertModel.from_torch(model)
 
-    benchmark_helper.run_model(lambda: model(input_ids), True, n, batch_size,
-                               seq_len, "turbo")
+    with turbo_transformers.cuda_stream_guard():
+        benchmark_helper.run_model(lambda: model(input_ids), True, n,
+                                   batch_size, seq_len, "turbo")
 
 
 def benchmark_torch(model: str, seq_len: int, batch_size: int, n: int):
@@ -0,0 +1,127 @@
+# Copyright (C) 2020 THL A29 Limited, a Tencent company.
+# All rights reserved.
+# Licensed under the BSD 3-Clause License (the "License"); you may
+# not use this file except in compliance with the License. You may
+# obtain a copy of the License at
+# https://opensource.org/licenses/BSD-3-Clause
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" basis,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+# implied. See the License for the specific language governing
+# permissions and limitations under the License.
+# See the AUTHORS file for names of contributors.
+"""
+turbo-transformers Benchmark of serving scenarios. The sequences of a batch
+draw their lengths from a histogram file, see length_histogram.txt, and
+several client threads share one model. See also
+example/cpp/bert_model_benchmark for the C++ path.
+
+Usage:
+    scenario_benchmark <model> --length_histogram=<file> [--framework=<f>] [--batch_size=<int>] [-n <int>] [--num_threads=<int>] [--clients=<int>] [--slo_ms=<float>] [--use_gpu] [--ragged]
+
+Options:
+    --framework=<f>          The framework to test in (torch, turbo-transformers)
+                                [default: turbo-transformers].
+    --length_histogram=<file>  The lengths of the sequences and their weights.
+    --batch_size=<int>       The batch size [default: 1].
+    -n <int>                 The batches per client [default: 100].
+    --num_threads=<int>      The CPU thread count [default: 1].
+    --clients=<int>          The concurrent client threads [default: 1].
+    --slo_ms=<float>         The latency bound of the goodput, 0 for none [default: 0].
+    --use_gpu                Run on the GPU.
+    --ragged                 Run turbo-transformers on the unpadded sequences,
+                                see BertModel.run_ragged.
+"""
+
+import docopt
+
+
+def make_batches(lengths, weights, batch_size: int, n: int, n_clients: int,
+                 vocab_size: int):
+    import numpy
+    rng = numpy.random.RandomState(0)
+    probs = numpy.array(weights) / numpy.sum(weights)
+    batches = []
+    valid_tokens = padded_tokens = 0
+    for _ in range(n_clients):
+        client = []
+        for _ in range(n):
+            seq_lens = rng.choice(lengths, size=batch_size, p=probs)
+            client.append([
+                rng.randint(0, vocab_size - 1, size=l).tolist()
+                for l in seq_lens
+            ])
+            valid_tokens += int(seq_lens.sum())
+            padded_tokens += batch_size * int(seq_lens.max())
+        batches.append(client)
+    return batches, valid_tokens, padded_tokens
+
+
+def pad(batch, device):
+    import torch
+    max_len = max(len(ids) for ids in batch)
+    input_ids = torch.zeros(len(batch), max_len, dtype=torch.long)
+    attention_mask = torch.zeros(len(batch), max_len, dtype=torch.float32)
+    for i, ids in enumerate(batch):
+        input_ids[i, :len(ids)] = torch.tensor(ids)
+        attention_mask[i, :len(ids)] = 1
+    return input_ids.to(device), attention_mask.to(device)
+
+
+def main():
+    import torch
+    import transformers
+    import benchmark_helper
+    args = docopt.docopt(__doc__)
+    framework = args['--framework']
+    use_gpu = args['--use_gpu']
+    ragged = args['--ragged']
+    num_threads = int(args['--num_threads'])
+    device = torch.device('cuda:0' if use_gpu else 'cpu:0')
+    torch.set_grad_enabled(False)
+    torch.set_num_threads(num_threads)
+
+    model = transformers.BertModel.from_pretrained(
+        args['<model>'])  # type: transformers.BertModel
+    model.eval()
+    model.to(device)
+    vocab_size = model.config.vocab_size
+
+    lengths, weights = benchmark_helper.load_length_histogram(
+        args['--length_histogram'])
+    batch_size = int(args['--batch_size'])
+    batches, valid_tokens, padded_tokens = make_batches(
+        lengths, weights, batch_size, int(args['-n']), int(args['--clients']),
+        vocab_size)
+
+    if framework == 'turbo-transformers':
+        import turbo_transformers
+        turbo_transformers.set_num_threads(num_threads)
+        model = turbo_transformers.BertModel.from_torch(model, device)
+        if ragged:
+            # The packed sequences compute the valid tokens only.
+            padded_tokens = valid_tokens
+            run = lambda batch: model.run_ragged(sequences=batch)
+        else:
+            run = lambda batch: model(*pad(batch, device))
+        framework = 'turbo-ragged' if ragged else 'turbo'
+    elif framework == 'torch':
+        run = lambda batch: model(*pad(batch, device))
+    else:
+        raise RuntimeError(f"Not supportted framework {framework}")
+
+    benchmark_helper.run_scenario(
+        run,
+        use_gpu,
+        batches,
+        batch_size,
+        args['--length_histogram'],
+        framework,
+        num_threads,
+        slo_ms=float(args['--slo_ms']),
+        padding_ratio=1 - valid_tokens / padded_tokens,
+        valid_tokens=valid_tokens)
+
+
+if __name__ == '__main__':
+    main()
@@ -13,7 +13,9 @@
 
 #pragma once
 #include <chrono>
+#include <memory>
 #include <string>
+#include <utility>
 
 #include "loguru.hpp"
 #include "turbo_transformers/layers/kernels/common.h"
@@ -69,9 +71,10 @@ class CPUTimer : public Timer {
   std::chrono::time_point<std::chrono::system_clock> start_;
 };
 
+// The seconds of a call of `func`, averaged over `step` calls after a warm up
+// call.
 template <typename Func>
-float TestFuncSpeed(Func&& func, int step, const std::string& infor,
-                    double g_bytes, DLDeviceType dev) {
+double TestFuncElapse(Func&& func, int step, DLDeviceType dev) {
   func();
   std::unique_ptr<Timer> timer;
   if (dev == kDLCPU) {
@@ -90,11 +93,54 @@ float TestFuncSpeed(Func&& func, int step, const std::string& infor,
   for (int i = 0; i < step; ++i) {
     func();
   }
-  auto elapse = timer->ElapseSecond() / step;
+  return timer->ElapseSecond() / step;
+}
 
-  auto ret = g_bytes / elapse;
-  return ret;
+template <typename Func>
+float TestFuncSpeed(Func&& func, int step, const std::string& infor,
+                    double g_bytes, DLDeviceType dev) {
+  return g_bytes / TestFuncElapse(std::forward<Func>(func), step, dev);
 }
 
+// The floating point operations and the bytes read or written from memory by
+// a kernel call, to place its speed under the roofline of the device.
+struct KernelCost {
+  double flops;
+  double bytes;
+};
+
+// The peak GFLOP/s and GB/s of a device, read from the environment variables
+// TT_CPU_PEAK_GFLOPS and TT_CPU_PEAK_GBPS, or TT_GPU_PEAK_GFLOPS and
+// TT_GPU_PEAK_GBPS, e.g. 15700 and 900 for a V100 in fp32. An unset peak is
+// 0, and the percentage of it is not printed.
+struct DevicePeak {
+  double gflops;
+  double gbps;
+};
+DevicePeak GetDevicePeak(DLDeviceType dev);
+
+// Print the achieved GFLOP/s and GB/s of a call taking `elapse` seconds, and
+// the percentage of the peaks of `dev`. The kernel is bound by the memory if
+// its flops per byte are below the ridge gflops / gbps of the device.
+void PrintRoofline(const std::string& info, const KernelCost& cost,
+                   double elapse, DLDeviceType dev);
+
+// Time `func` as TestFuncElapse and print its roofline metrics.
+template <typename Func>
+double TestFuncRoofline(Func&& func, int step, const std::string& info,
+                        const KernelCost& cost, DLDeviceType dev) {
+  auto elapse = TestFuncElapse(std::forward<Func>(func), step, dev);
+  PrintRoofline(info, cost, elapse, dev);
+  return elapse;
+}
+
+// Print the result of `n_step` calls taking `elapse` seconds each as a JSON
+// line with the fields of the Python benchmarks, the name of the layer or of
+// the kernel being the framework. benchmark/benchmark_result_to_csv.py turns
+// the lines into a table of the configurations by the frameworks.
+void PrintJsonResult(const std::string& framework, int64_t batch_size,
+                     int64_t seq_len, int thread_num, double elapse,
+                     int n_step);
+
 }  // namespace benchmark
 }  // namespace turbo_transformers
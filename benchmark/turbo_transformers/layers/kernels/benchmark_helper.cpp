@@ -12,3 +12,61 @@
 // See the AUTHORS file for names of contributors.
 
 #include "benchmark_help.h"
+
+#include <cstdlib>
+#include <iostream>
+
+#include "absl/strings/str_format.h"
+
+namespace turbo_transformers {
+namespace benchmark {
+
+static double GetEnvDouble(const char* name) {
+  auto* value = std::getenv(name);
+  return value == nullptr ? 0 : std::atof(value);
+}
+
+DevicePeak GetDevicePeak(DLDeviceType dev) {
+  if (dev == kDLGPU) {
+    return {GetEnvDouble("TT_GPU_PEAK_GFLOPS"),
+            GetEnvDouble("TT_GPU_PEAK_GBPS")};
+  }
+  return {GetEnvDouble("TT_CPU_PEAK_GFLOPS"), GetEnvDouble("TT_CPU_PEAK_GBPS")};
+}
+
+void PrintRoofline(const std::string& info, const KernelCost& cost,
+                   double elapse, DLDeviceType dev) {
+  auto gflops = cost.flops / elapse / 1e9;
+  auto gbps = cost.bytes / elapse / 1e9;
+  auto peak = GetDevicePeak(dev);
+  auto line = absl::StrFormat("%s: %.2f us, %.2f GFLOP/s, %.2f GB/s", info,
+                              elapse * 1e6, gflops, gbps);
+  if (peak.gflops > 0) {
+    absl::StrAppendFormat(&line, ", %.1f%% of peak flops",
+                          100 * gflops / peak.gflops);
+  }
+  if (peak.gbps > 0) {
+    absl::StrAppendFormat(&line, ", %.1f%% of peak bandwidth",
+                          100 * gbps / peak.gbps);
+  }
+  if (peak.gflops > 0 && peak.gbps > 0) {
+    bool memory_bound = cost.flops / cost.bytes < peak.gflops / peak.gbps;
+    absl::StrAppend(&line, memory_bound ? ", memory bound" : ", compute bound");
+  }
+  std::cout << line << std::endl;
+}
+
+void PrintJsonResult(const std::string& framework, int64_t batch_size,
+                     int64_t seq_len, int thread_num, double elapse,
+                     int n_step) {
+  std::cout << absl::StrFormat(
+                   "{\"QPS\": %g, \"elapsed\": %g, \"n\": %d, "
+                   "\"batch_size\": %d, \"seq_len\": %d, "
+                   "\"framework\": \"%s\", \"thread_num\": %d}",
+                   1 / elapse, elapse * n_step, n_step, batch_size, seq_len,
+                   framework, thread_num)
+            << std::endl;
+}
+
+}  // namespace benchmark
+}  // namespace turbo_transformers
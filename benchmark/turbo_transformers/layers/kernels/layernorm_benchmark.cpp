@@ -29,7 +29,7 @@ static void LayerNormBenmarkHelper(int batch_size, int hidden_size,
                                    int seq_length, bool is_add_bias,
                                    const std::string& info, DLDeviceType dev,
                                    int n_step) {
-  auto g_bytes = batch_size * seq_length * hidden_size * sizeof(float) / 1e9;
+  double n_elems = 1.0 * batch_size * seq_length * hidden_size;
   auto input = common::CreateTensorAndFillRandom<float>(
       {batch_size, seq_length, hidden_size}, dev, 0);
   auto bias = common::CreateTensorAndFillRandom<float>({hidden_size}, dev, 0);
@@ -38,13 +38,18 @@ static void LayerNormBenmarkHelper(int batch_size, int hidden_size,
   auto out = common::CreateTensorAndFillRandom<float>(
       {batch_size, seq_length, hidden_size}, dev, 0);
 
+  // The mean, the variance, the normalization and the affine transform cost
+  // about 8 flops an element, and the bias and the residual 2 more.
+  // AddBiasLayerNorm reads the input and the output and writes the output,
+  // LayerNorm works in place.
   if (is_add_bias) {
-    benchmark::TestFuncSpeed(
+    benchmark::TestFuncRoofline(
         [&]() { AddBiasLayerNorm<float>(input, bias, gamma, beta, &out); },
-        n_step, info, g_bytes, dev);
+        n_step, info, {10 * n_elems, 3 * n_elems * sizeof(float)}, dev);
   } else {
-    benchmark::TestFuncSpeed([&]() { LayerNorm<float>(gamma, beta, &out); },
-                             n_step, info, g_bytes, dev);
+    benchmark::TestFuncRoofline(
+        [&]() { LayerNorm<float>(gamma, beta, &out); }, n_step, info,
+        {8 * n_elems, 2 * n_elems * sizeof(float)}, dev);
   }
 }
 
@@ -61,10 +66,10 @@ TEST_CASE("layernorm-cpu-benchmark") {
         std::stringstream ss;
         ss << "CPU LayerNorm " << batch_size << ", " << seq_length << ", "
            << hidden_size;
-        LayerNormBenmarkHelper(batch_size, hidden_size, seq_length, true,
+        LayerNormBenmarkHelper(batch_size, hidden_size, seq_length, false,
                                ss.str(), kDLCPU, n_step);
         ss << " AddBias";
-        LayerNormBenmarkHelper(batch_size, hidden_size, seq_length, false,
+        LayerNormBenmarkHelper(batch_size, hidden_size, seq_length, true,
                                ss.str(), kDLCPU, n_step);
       }  // for
     }
@@ -85,10 +90,10 @@ TEST_CASE("layernorm-gpu-benchmark") {
       std::stringstream ss;
       ss << "GPU LayerNorm " << batch_size << ", " << seq_length << ", "
          << hidden_size;
-      LayerNormBenmarkHelper(batch_size, hidden_size, seq_length, true,
+      LayerNormBenmarkHelper(batch_size, hidden_size, seq_length, false,
                              ss.str(), kDLGPU, n_step);
       ss << " AddBias";
-      LayerNormBenmarkHelper(batch_size, hidden_size, seq_length, false,
+      LayerNormBenmarkHelper(batch_size, hidden_size, seq_length, true,
                              ss.str(), kDLGPU, n_step);
     }  // for
 }
@@ -26,8 +26,8 @@ using layers::kernels::common::FillRandom;
 
 static void MatmulBenchmarkHelper(DLDeviceType device_type, bool trans_weight,
                                   std::initializer_list<int64_t> weight_shape,
-                                  std::vector<int64_t> m_list) {
-  constexpr int n_step = 1000;
+                                  std::vector<int64_t> m_list,
+                                  int n_step = 1000) {
   const std::string device_name = device_type == kDLCPU ? "CPU" : "GPU";
   const std::string trans_name = trans_weight ? "Tran" : "NoTrans";
 
@@ -59,29 +59,44 @@ static void MatmulBenchmarkHelper(DLDeviceType device_type, bool trans_weight,
 
     std::stringstream ss;
     ss << device_name << " " << trans_name << " MatMul " << m << ", " << k
-       << ", " << n << " ";
-    auto g_flops = m * n * k * 2 / 1e9;
+       << ", " << n;
+    // The output is written only, as beta is 0.
+    benchmark::KernelCost cost{2.0 * m * n * k,
+                               (m * k + k * n + m * n) * sizeof(float) * 1.0};
+    benchmark::TestFuncRoofline(
+        [&]() {
+          layers::kernels::MatMul(input_tensor, false, weight_tensor,
+                                  trans_weight, 1.0, output_tensor, 0.0);
+        },
+        n_step, ss.str(), cost, device_type);
+  }
+}
 
-    if (device_type == kDLGPU) {
-#ifdef TT_WITH_CUDA
-      auto flops = benchmark::TestFuncSpeed(
-          [&]() {
-            layers::kernels::MatMul(input_tensor, false, weight_tensor,
-                                    trans_weight, 1.0, &output_tensor, 0.0);
-          },
-          n_step, ss.str(), g_flops, device_type);
-
-      std::cout << ss.str() << " flops: " << flops << std::endl;
-#endif
-    } else {
-      benchmark::TestFuncSpeed(
-          [&]() {
-            layers::kernels::MatMul(input_tensor, false, weight_tensor,
-                                    trans_weight, 1.0, &output_tensor, 0.0);
-          },
-          n_step, ss.str(), g_flops, device_type);
+// The GEMMs of a BERT-base encoder layer, the qkv projection, the attention
+// output, the intermediate and the output dense, on batch x seq tokens.
+static void EncoderMatmulBenchmark(DLDeviceType device_type) {
+  constexpr int64_t hidden_size = 768, intermediate_size = 3072;
+  constexpr int n_step = 20;
+  std::vector<int64_t> m_list;
+  for (int64_t batch_size : {1, 20}) {
+    for (int64_t seq_len : {10, 40, 100, 200, 500}) {
+      m_list.push_back(batch_size * seq_len);
     }
   }
+  MatmulBenchmarkHelper(device_type, false, {hidden_size, 3 * hidden_size},
+                        m_list, n_step);
+  MatmulBenchmarkHelper(device_type, false, {hidden_size, hidden_size}, m_list,
+                        n_step);
+  MatmulBenchmarkHelper(device_type, false, {hidden_size, intermediate_size},
+                        m_list, n_step);
+  MatmulBenchmarkHelper(device_type, false, {intermediate_size, hidden_size},
+                        m_list, n_step);
+}
+
+TEST_CASE("matmul-cpu-encoder-roofline") {
+  std::cout << "=================================" << std::endl;
+  std::cout << "CPU Encoder MatMul Roofline" << std::endl;
+  EncoderMatmulBenchmark(kDLCPU);
 }
 
 TEST_CASE("matmal-cpu-benchmark") {
@@ -151,6 +166,12 @@ TEST_CASE("matmal-gpu-fused-gemm-benchmark") {
   MatmulBenchmarkHelper(kDLGPU, false, {k, n}, m_list);
 }
 
+TEST_CASE("matmul-gpu-encoder-roofline") {
+  std::cout << "=================================" << std::endl;
+  std::cout << "GPU Encoder MatMul Roofline" << std::endl;
+  EncoderMatmulBenchmark(kDLGPU);
+}
+
 #endif
 
 }  // namespace kernels
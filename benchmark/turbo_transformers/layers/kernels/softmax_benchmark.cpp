@@ -29,19 +29,25 @@ static void SoftmaxBenchmarkHelper(int batch_size, int seq_length,
                                    int num_attention_heads, DLDeviceType dev,
                                    int n_step) {
   constexpr float scaler = 1.;
-  auto g_bytes = batch_size * num_attention_heads * seq_length * seq_length *
-                 sizeof(float) / 1e9;
+  double n_elems = 1.0 * batch_size * num_attention_heads * seq_length *
+                   seq_length;
+  // Scale, mask, max, exp, sum and divide every score, which is read and
+  // written in place, and read the mask once.
+  benchmark::KernelCost cost{
+      6 * n_elems, (2 * n_elems + 1.0 * batch_size * seq_length) *
+                       sizeof(float)};
   core::Tensor qk_buf_tensor(core::NewDLPackTensorT<float>(
       {batch_size, num_attention_heads, seq_length, seq_length}, dev, 0));
   common::FillRandom<float>(qk_buf_tensor);
   core::Tensor attr_mask_tensor(
       core::NewDLPackTensorT<float>({batch_size, seq_length}, dev, 0));
   common::FillRandom<float>(attr_mask_tensor);
-  auto res = benchmark::TestFuncSpeed(
-      [&]() { ApplyMaskAndSoftmax(&qk_buf_tensor, attr_mask_tensor, scaler); },
-      n_step, "", g_bytes, dev);
-  std::cout << "GPU Softmax " << batch_size << ", " << seq_length << " " << res
-            << " GB/s";
+  std::stringstream ss;
+  ss << (dev == kDLCPU ? "CPU" : "GPU") << " Softmax " << batch_size << ", "
+     << seq_length;
+  benchmark::TestFuncRoofline(
+      [&]() { ApplyMaskAndSoftmax(qk_buf_tensor, attr_mask_tensor, scaler); },
+      n_step, ss.str(), cost, dev);
 }
 
 TEST_CASE("softmax-cpu-benchmark") {
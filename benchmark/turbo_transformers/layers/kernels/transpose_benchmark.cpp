@@ -29,8 +29,9 @@ static void SplitAddTransposeBenchmarkHelper(int batch_size, int seq_length,
                                              int num_attention_heads,
                                              const std::string& info,
                                              DLDeviceType dev, int n_step) {
-  auto g_bytes = batch_size * num_attention_heads * 3 * seq_length * 64 *
-                 sizeof(float) / 1e9;
+  // Add the bias to every element, read once and written once.
+  double n_elems = 3.0 * batch_size * num_attention_heads * seq_length * 64;
+  benchmark::KernelCost cost{n_elems, 2 * n_elems * sizeof(float)};
   core::Tensor input_tensor(core::NewDLPackTensorT<float>(
       {batch_size, seq_length, 3, num_attention_heads, 64}, dev, 0));
   common::FillRandom<float>(input_tensor);
@@ -41,15 +42,15 @@ static void SplitAddTransposeBenchmarkHelper(int batch_size, int seq_length,
       turbo_transformers::core::NewDLPackTensorT<float>(
           {3, batch_size, num_attention_heads, seq_length, 64}, dev, 0));
 
-  auto res = benchmark::TestFuncSpeed(
+  std::stringstream ss;
+  ss << info << (dev == kDLCPU ? "CPU" : "GPU") << " SplitAddTranspose "
+     << batch_size << ", " << seq_length;
+  benchmark::TestFuncRoofline(
       [&]() {
-        SplitAddBiasTransposeForScore(&output_tensor, input_tensor,
+        SplitAddBiasTransposeForScore(output_tensor, input_tensor,
                                       bias_tensor);
       },
-      n_step, info, g_bytes, dev);
-
-  std::cout << "GPU SplitAddTranspose " << batch_size << ", " << seq_length
-            << " , " << res << " GB/s" << std::endl;
+      n_step, ss.str(), cost, dev);
 }
 
 TEST_CASE("transpose-cpu-benchmark") {
@@ -0,0 +1,210 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+// The layers of a BERT-base encoder timed as units, with random weights, over
+// the batch sizes, the sequence lengths and, on the CPU, the threads. Every
+// configuration prints a JSON line, see benchmark::PrintJsonResult, e.g.
+//   ./layers_benchmark "[layers]" | grep '^{' |
+//       python benchmark/benchmark_result_to_csv.py
+#include <string>
+#include <vector>
+
+#include "benchmark_help.h"
+#include "catch2/catch.hpp"
+#include "turbo_transformers/core/config.h"
+#include "turbo_transformers/layers/bert_attention.h"
+#include "turbo_transformers/layers/bert_embedding.h"
+#include "turbo_transformers/layers/bert_intermediate.h"
+#include "turbo_transformers/layers/bert_output.h"
+#include "turbo_transformers/layers/bert_pooler.h"
+#include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/sequence_pool.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+using kernels::common::CreateTensorAndFillConstant;
+using kernels::common::CreateTensorAndFillRandom;
+
+constexpr int64_t kHiddenSize = 768;
+constexpr int64_t kNumAttentionHeads = 12;
+constexpr int64_t kIntermediateSize = 3072;
+constexpr int64_t kVocabSize = 30522;
+constexpr int64_t kMaxPositions = 512;
+constexpr int kSteps = 50;
+
+static std::vector<DLDeviceType> Devices() {
+#ifdef TT_WITH_CUDA
+  return {kDLCPU, kDLGPU};
+#else
+  return {kDLCPU};
+#endif
+}
+
+static std::string LayerName(const std::string& layer, DLDeviceType dev) {
+  return layer + (dev == kDLCPU ? "-CPU" : "-GPU");
+}
+
+// Runs `time_layer(batch_size, seq_len)`, which returns the seconds of a call
+// of the layer, for every configuration and prints its result.
+template <typename Func>
+static void SweepLayer(const std::string& layer, DLDeviceType dev,
+                       const std::vector<int64_t>& seq_len_list,
+                       Func&& time_layer) {
+  std::vector<int> thread_num_list{1};
+  if (dev == kDLCPU) {
+    thread_num_list = {1, 4, 8};
+  }
+  for (auto thread_num : thread_num_list) {
+    if (dev == kDLCPU) {
+      core::SetNumThreads(thread_num);
+    }
+    for (int64_t batch_size : {1, 20}) {
+      for (auto seq_len : seq_len_list) {
+        auto elapse = time_layer(batch_size, seq_len);
+        benchmark::PrintJsonResult(LayerName(layer, dev), batch_size, seq_len,
+                                   thread_num, elapse, kSteps);
+      }
+    }
+  }
+}
+
+static const std::vector<int64_t> kSeqLenList{10, 20, 40, 80, 128, 200, 500};
+
+TEST_CASE("bert_embedding-benchmark", "[layers]") {
+  for (auto dev : Devices()) {
+    BERTEmbedding embedding(
+        CreateTensorAndFillRandom<float>({kVocabSize, kHiddenSize}, dev, 0),
+        CreateTensorAndFillRandom<float>({kMaxPositions, kHiddenSize}, dev,
+                                         0),
+        CreateTensorAndFillRandom<float>({2, kHiddenSize}, dev, 0),
+        CreateTensorAndFillRandom<float>({kHiddenSize}, dev, 0),
+        CreateTensorAndFillRandom<float>({kHiddenSize}, dev, 0));
+    SweepLayer("BERTEmbedding", dev, kSeqLenList,
+               [&](int64_t batch_size, int64_t seq_len) {
+                 // The ids 0, 1, ... spread the lookups over the table.
+                 auto input_ids = kernels::common::CreateTensor<int64_t>(
+                     {batch_size, seq_len}, dev, 0);
+                 kernels::common::Sequence(input_ids.mutableData<int64_t>(),
+                                           input_ids.numel(), dev);
+                 auto token_type_ids = CreateTensorAndFillConstant<int64_t>(
+                     {batch_size, seq_len}, dev, 0, 0);
+                 core::Tensor position_ids(nullptr), output(nullptr);
+                 return benchmark::TestFuncElapse(
+                     [&]() {
+                       embedding(input_ids, position_ids, token_type_ids,
+                                 &output);
+                     },
+                     kSteps, dev);
+               });
+  }
+}
+
+TEST_CASE("bert_attention-benchmark", "[layers]") {
+  for (auto dev : Devices()) {
+    BertAttention attention(
+        CreateTensorAndFillRandom<float>({kHiddenSize, 3 * kHiddenSize}, dev,
+                                         0),
+        CreateTensorAndFillRandom<float>({3 * kHiddenSize}, dev, 0),
+        CreateTensorAndFillRandom<float>({kHiddenSize, kHiddenSize}, dev, 0),
+        CreateTensorAndFillRandom<float>({kHiddenSize}, dev, 0),
+        CreateTensorAndFillRandom<float>({kHiddenSize}, dev, 0),
+        CreateTensorAndFillRandom<float>({kHiddenSize}, dev, 0),
+        kNumAttentionHeads);
+    SweepLayer("BertAttention", dev, kSeqLenList,
+               [&](int64_t batch_size, int64_t seq_len) {
+                 auto input = CreateTensorAndFillRandom<float>(
+                     {batch_size, seq_len, kHiddenSize}, dev, 0);
+                 auto mask = CreateTensorAndFillConstant<float>(
+                     {batch_size, 1, 1, seq_len}, dev, 0, 0.f);
+                 core::Tensor output(nullptr);
+                 return benchmark::TestFuncElapse(
+                     [&]() { attention(input, mask, &output); }, kSteps, dev);
+               });
+  }
+}
+
+TEST_CASE("bert_intermediate-benchmark", "[layers]") {
+  for (auto dev : Devices()) {
+    BertIntermediate intermediate(
+        CreateTensorAndFillRandom<float>({kHiddenSize, kIntermediateSize}, dev,
+                                         0),
+        CreateTensorAndFillRandom<float>({kIntermediateSize}, dev, 0));
+    SweepLayer("BertIntermediate", dev, kSeqLenList,
+               [&](int64_t batch_size, int64_t seq_len) {
+                 auto input = CreateTensorAndFillRandom<float>(
+                     {batch_size, seq_len, kHiddenSize}, dev, 0);
+                 core::Tensor output(nullptr);
+                 return benchmark::TestFuncElapse(
+                     [&]() { intermediate(input, &output); }, kSteps, dev);
+               });
+  }
+}
+
+TEST_CASE("bert_output-benchmark", "[layers]") {
+  for (auto dev : Devices()) {
+    BertOutput bert_output(
+        CreateTensorAndFillRandom<float>({kIntermediateSize, kHiddenSize}, dev,
+                                         0),
+        CreateTensorAndFillRandom<float>({kHiddenSize}, dev, 0),
+        CreateTensorAndFillRandom<float>({kHiddenSize}, dev, 0),
+        CreateTensorAndFillRandom<float>({kHiddenSize}, dev, 0));
+    SweepLayer("BertOutput", dev, kSeqLenList,
+               [&](int64_t batch_size, int64_t seq_len) {
+                 auto hidden_states = CreateTensorAndFillRandom<float>(
+                     {batch_size, seq_len, kIntermediateSize}, dev, 0);
+                 auto input = CreateTensorAndFillRandom<float>(
+                     {batch_size, seq_len, kHiddenSize}, dev, 0);
+                 core::Tensor output(nullptr);
+                 return benchmark::TestFuncElapse(
+                     [&]() { bert_output(hidden_states, input, &output); },
+                     kSteps, dev);
+               });
+  }
+}
+
+TEST_CASE("bert_pooler-benchmark", "[layers]") {
+  for (auto dev : Devices()) {
+    BertPooler pooler(
+        CreateTensorAndFillRandom<float>({kHiddenSize, kHiddenSize}, dev, 0),
+        CreateTensorAndFillRandom<float>({kHiddenSize}, dev, 0));
+    // The pooler takes a row per sequence, whatever its length.
+    SweepLayer("BertPooler", dev, {1},
+               [&](int64_t batch_size, int64_t) {
+                 auto input = CreateTensorAndFillRandom<float>(
+                     {batch_size, kHiddenSize}, dev, 0);
+                 core::Tensor output(nullptr);
+                 return benchmark::TestFuncElapse(
+                     [&]() { pooler(input, &output); }, kSteps, dev);
+               });
+  }
+}
+
+TEST_CASE("sequence_pool-benchmark", "[layers]") {
+  for (auto dev : Devices()) {
+    for (auto pool_type : {"First", "Mean", "Max"}) {
+      SequencePool pool(pool_type);
+      SweepLayer(std::string("SequencePool") + pool_type, dev, kSeqLenList,
+                 [&](int64_t batch_size, int64_t seq_len) {
+                   auto input = CreateTensorAndFillRandom<float>(
+                       {batch_size, seq_len, kHiddenSize}, dev, 0);
+                   core::Tensor output(nullptr);
+                   return benchmark::TestFuncElapse(
+                       [&]() { pool(input, &output); }, kSteps, dev);
+                 });
+    }
+  }
+}
+
+}  // namespace layers
+}  // namespace turbo_transformers
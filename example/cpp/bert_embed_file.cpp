@@ -0,0 +1,183 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+// Embed a token id file offline on all the given devices, see
+// EmbeddingPipeline, and print the throughput as a json line:
+//
+//   ./bert_embed_file bert.npz corpus.ids corpus.embeds --devices=gpu:0,gpu:1
+//       --max_batch_size=64 --pooling=mean
+//
+// tools/token_id_file.py writes the input and reads the output in Python.
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "turbo_transformers/core/config.h"
+#include "turbo_transformers/serving/embedding_pipeline.h"
+
+using namespace turbo_transformers;
+using namespace turbo_transformers::serving;
+
+namespace {
+
+struct Options {
+  std::string model_path;
+  std::string input_file;
+  std::string output_file;
+  // A model per device, "cpu" or "gpu:<id>".
+  std::vector<std::string> devices{"cpu"};
+  // Read from the model file if 0, see BertModel.
+  int64_t n_layers{0};
+  int64_t n_heads{0};
+  EmbeddingPipeline::Options pipeline;
+};
+
+bool ParsePooling(const std::string &value, PoolType *pooling) {
+  if (value == "first") {
+    *pooling = PoolType::kFirst;
+  } else if (value == "last") {
+    *pooling = PoolType::kLast;
+  } else if (value == "mean") {
+    *pooling = PoolType::kMean;
+  } else if (value == "max") {
+    *pooling = PoolType::kMax;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseOptions(int argc, char *argv[], Options *options) {
+  if (argc < 4) {
+    return false;
+  }
+  options->model_path = argv[1];
+  options->input_file = argv[2];
+  options->output_file = argv[3];
+  auto &pipeline = options->pipeline;
+  for (int i = 4; i < argc; ++i) {
+    std::vector<std::string> flag = absl::StrSplit(argv[i], '=');
+    if (flag.size() != 2) {
+      return false;
+    }
+    auto &name = flag[0];
+    auto &value = flag[1];
+    if (name == "--devices") {
+      options->devices = absl::StrSplit(value, ',', absl::SkipEmpty());
+    } else if (name == "--n_layers") {
+      options->n_layers = std::stoll(value);
+    } else if (name == "--n_heads") {
+      options->n_heads = std::stoll(value);
+    } else if (name == "--max_batch_size") {
+      pipeline.max_batch_size = std::stoull(value);
+    } else if (name == "--max_batch_tokens") {
+      pipeline.max_batch_tokens = std::stoll(value);
+    } else if (name == "--max_seq_len") {
+      pipeline.max_seq_len = std::stoll(value);
+    } else if (name == "--sort_window") {
+      pipeline.sort_window = std::stoull(value);
+    } else if (name == "--batches_per_call") {
+      pipeline.batches_per_call = std::stoull(value);
+    } else if (name == "--pooling") {
+      if (!ParsePooling(value, &pipeline.pooling)) {
+        return false;
+      }
+    } else if (name == "--use_pooler") {
+      pipeline.use_pooler = value == "1" || value == "true";
+    } else {
+      return false;
+    }
+  }
+  return !options->devices.empty() && pipeline.max_batch_size > 0 &&
+         pipeline.max_seq_len > 0;
+}
+
+bool ParseDevice(const std::string &device, DLDeviceType *device_type,
+                 int *device_id) {
+  *device_id = 0;
+  if (device == "cpu") {
+    *device_type = kDLCPU;
+    return true;
+  }
+  if (device.compare(0, 3, "gpu") != 0) {
+    return false;
+  }
+  *device_type = kDLGPU;
+  if (device.size() > 3) {
+    if (device[3] != ':') {
+      return false;
+    }
+    *device_id = std::stoi(device.substr(4));
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    std::cerr << "./bert_embed_file model_path input.ids output.embeds "
+                 "[--devices=cpu,gpu:0] [--n_layers=12 --n_heads=12] "
+                 "[--max_batch_size=64] [--max_batch_tokens=16384] "
+                 "[--max_seq_len=512] [--sort_window=8192] "
+                 "[--batches_per_call=4] [--pooling=first|last|mean|max] "
+                 "[--use_pooler=1]"
+              << std::endl;
+    return -1;
+  }
+  std::vector<std::shared_ptr<BertModel>> models;
+  for (auto &device : options.devices) {
+    DLDeviceType device_type;
+    int device_id;
+    if (!ParseDevice(device, &device_type, &device_id)) {
+      std::cerr << "Unknown device " << device << std::endl;
+      return -1;
+    }
+    if (device_type == kDLGPU && !core::IsCompiledWithCUDA()) {
+      std::cerr << "turbo_transformers is not compiled with CUDA." << std::endl;
+      return -1;
+    }
+    if (options.n_layers > 0) {
+      models.push_back(std::make_shared<BertModel>(
+          options.model_path, device_type, options.n_layers, options.n_heads,
+          device_id));
+    } else {
+      models.push_back(std::make_shared<BertModel>(options.model_path,
+                                                   device_type, device_id));
+    }
+    // The activations of the largest batch are allocated once.
+    models.back()->PlanMemory(options.pipeline.max_batch_size,
+                              options.pipeline.max_seq_len);
+  }
+  EmbeddingPipeline pipeline(std::move(models), options.pipeline);
+  auto stats = pipeline.Run(options.input_file, options.output_file);
+  std::cout << absl::StrFormat(
+                   "{\"sequences\": %d, \"batches\": %d, \"tokens\": %d, "
+                   "\"padding_ratio\": %.4f, \"elapsed\": %.3f, "
+                   "\"sequences_per_second\": %.2f, \"devices\": \"%s\"}",
+                   stats.sequences, stats.batches, stats.tokens,
+                   stats.padded_tokens > 0
+                       ? 1.0 - static_cast<double>(stats.tokens) /
+                                   stats.padded_tokens
+                       : 0.0,
+                   stats.seconds,
+                   stats.seconds > 0 ? stats.sequences / stats.seconds : 0.0,
+                   absl::StrJoin(options.devices, ","))
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,358 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+// Time the C++ BertModel end to end, without Python in the loop. Every
+// configuration of the sweep prints a json line in the format of
+// benchmark/benchmark_helper.py, so that benchmark_result_to_csv.py tabulates
+// it along with the other frameworks:
+//
+//   ./bert_model_benchmark bert.npz --n_layers=12 --n_heads=12
+//       --batch_sizes=1,2 --seq_lens=10,20,40 --num_threads=4,8 --n=150
+//       | python benchmark_result_to_csv.py
+//
+// With --length_histogram, the sequences of a batch draw their lengths from
+// the histogram instead, see benchmark/length_histogram.txt, so that the
+// padding of uneven batches is paid as in serving. --clients threads then
+// share the model, each running --n batches back to back, which reports the
+// tail latency and the goodput under contention.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "turbo_transformers/core/config.h"
+#include "turbo_transformers/core/cpu_allocator.h"
+#include "turbo_transformers/core/enforce.h"
+#include "turbo_transformers/core/memory_tracker.h"
+#include "turbo_transformers/serving/bert_model.h"
+
+using namespace turbo_transformers;
+using namespace turbo_transformers::serving;
+
+namespace {
+
+struct Options {
+  std::string model_path;
+  DLDeviceType device_type{kDLCPU};
+  std::vector<int64_t> batch_sizes{1};
+  std::vector<int64_t> seq_lens{10, 20, 40, 60, 80, 100, 120, 200, 300, 400,
+                                500};
+  std::string length_histogram;
+  std::vector<int64_t> num_threads{4};
+  int64_t clients{1};
+  // n batches per client.
+  int64_t n{150};
+  int64_t warmup{10};
+  // The latency bound of the goodput, every batch counts if 0.
+  double slo_ms{0};
+  // Read from the model file if 0, see BertModel.
+  int64_t n_layers{0};
+  int64_t n_heads{0};
+  bool use_pooler{false};
+  bool packing{false};
+  // Back the weights and the activations by 2 MB pages on the CPU.
+  bool huge_pages{false};
+};
+
+std::vector<int64_t> ParseList(const std::string &value) {
+  std::vector<int64_t> list;
+  for (auto &item : absl::StrSplit(value, ',', absl::SkipEmpty())) {
+    list.push_back(std::stoll(std::string(item)));
+  }
+  return list;
+}
+
+bool ParseBool(const std::string &value) {
+  return value == "1" || value == "true";
+}
+
+bool ParseOptions(int argc, char *argv[], Options *options) {
+  if (argc < 2) {
+    return false;
+  }
+  options->model_path = argv[1];
+  for (int i = 2; i < argc; ++i) {
+    std::vector<std::string> flag = absl::StrSplit(argv[i], '=');
+    if (flag.size() != 2) {
+      return false;
+    }
+    auto &name = flag[0];
+    auto &value = flag[1];
+    if (name == "--device") {
+      if (value != "cpu" && value != "gpu") {
+        return false;
+      }
+      options->device_type = value == "gpu" ? kDLGPU : kDLCPU;
+    } else if (name == "--batch_sizes") {
+      options->batch_sizes = ParseList(value);
+    } else if (name == "--seq_lens") {
+      options->seq_lens = ParseList(value);
+    } else if (name == "--length_histogram") {
+      options->length_histogram = value;
+    } else if (name == "--num_threads") {
+      options->num_threads = ParseList(value);
+    } else if (name == "--clients") {
+      options->clients = std::stoll(value);
+    } else if (name == "--n") {
+      options->n = std::stoll(value);
+    } else if (name == "--warmup") {
+      options->warmup = std::stoll(value);
+    } else if (name == "--slo_ms") {
+      options->slo_ms = std::stod(value);
+    } else if (name == "--n_layers") {
+      options->n_layers = std::stoll(value);
+    } else if (name == "--n_heads") {
+      options->n_heads = std::stoll(value);
+    } else if (name == "--use_pooler") {
+      options->use_pooler = ParseBool(value);
+    } else if (name == "--packing") {
+      options->packing = ParseBool(value);
+    } else if (name == "--huge_pages") {
+      options->huge_pages = ParseBool(value);
+    } else {
+      return false;
+    }
+  }
+  return options->n > 0 && options->warmup >= 0 && options->clients > 0;
+}
+
+// The lengths of the sequences and their weights, e.g. counted from the
+// requests of a service.
+struct LengthHistogram {
+  std::vector<int64_t> lengths;
+  std::vector<double> weights;
+};
+
+// A line of the file is a length and its weight, separated by a comma or
+// spaces, and '#' starts a comment.
+LengthHistogram LoadLengthHistogram(const std::string &filename) {
+  std::ifstream in(filename);
+  TT_ENFORCE(in.good(), "Can not open the length histogram %s", filename);
+  LengthHistogram histogram;
+  std::string line;
+  while (std::getline(in, line)) {
+    auto text = absl::StripAsciiWhitespace(
+        absl::string_view(line).substr(0, line.find('#')));
+    if (text.empty()) {
+      continue;
+    }
+    std::vector<std::string> fields =
+        absl::StrSplit(text, absl::ByAnyChar(", \t"), absl::SkipEmpty());
+    TT_ENFORCE_EQ(fields.size(), 2,
+                  "A line of %s should be a length and a weight: %s",
+                  filename, line);
+    histogram.lengths.push_back(std::stoll(fields[0]));
+    histogram.weights.push_back(std::stod(fields[1]));
+    TT_ENFORCE(histogram.lengths.back() > 0 && histogram.weights.back() >= 0,
+               "Invalid line of %s: %s", filename, line);
+  }
+  TT_ENFORCE(!histogram.lengths.empty(), "%s has no lengths", filename);
+  return histogram;
+}
+
+// The q-th quantile of the sorted `ms`, 0 <= q <= 1.
+double Percentile(const std::vector<double> &ms, double q) {
+  auto i = static_cast<size_t>(q * (ms.size() - 1) + 0.5);
+  return ms[std::min(i, ms.size() - 1)];
+}
+
+// The peak bytes of the tensors on the device of the model since the tracking
+// was reset, including the activations kept from the previous shapes.
+size_t PeakMemoryBytes(DLDeviceType device_type) {
+  for (auto &usage : core::GetMemoryUsages()) {
+    if (usage.tag.empty() && usage.device_type == device_type) {
+      return usage.peak_live_bytes;
+    }
+  }
+  return 0;
+}
+
+using Batch = std::vector<std::vector<int64_t>>;
+
+// `n` batches of `batch_size` random sequences whose lengths follow
+// `histogram`.
+std::vector<Batch> MakeBatches(const LengthHistogram &histogram,
+                               int64_t batch_size, int64_t n, int seed) {
+  std::mt19937 generator(seed);
+  std::discrete_distribution<size_t> lengths(histogram.weights.begin(),
+                                             histogram.weights.end());
+  // Within the vocabulary of any BERT.
+  std::uniform_int_distribution<int64_t> ids(0, 999);
+  std::vector<Batch> batches(n);
+  for (auto &batch : batches) {
+    for (int64_t i = 0; i < batch_size; ++i) {
+      batch.emplace_back(histogram.lengths[lengths(generator)]);
+      for (auto &id : batch.back()) {
+        id = ids(generator);
+      }
+    }
+  }
+  return batches;
+}
+
+// Run the batches of every client concurrently, and print their latencies.
+// `seq_len` is the json value of the lengths of the batches.
+void Run(const BertModel &model, const Options &options,
+         const LengthHistogram &histogram, const std::string &seq_len,
+         int64_t batch_size, int64_t n_threads) {
+  std::vector<std::vector<Batch>> batches;
+  int64_t valid_tokens = 0, padded_tokens = 0;
+  for (int64_t client = 0; client < options.clients; ++client) {
+    batches.push_back(MakeBatches(histogram, batch_size, options.n, client));
+    for (auto &batch : batches.back()) {
+      size_t max_len = 0;
+      for (auto &sequence : batch) {
+        valid_tokens += sequence.size();
+        max_len = std::max(max_len, sequence.size());
+      }
+      padded_tokens += batch.size() * max_len;
+    }
+  }
+  auto run = [&](const Batch &batch) {
+    model(batch, {}, {}, PoolType::kFirst, options.use_pooler);
+  };
+
+  core::ResetMemoryTracking();
+  for (int64_t i = 0; i < options.warmup; ++i) {
+    run(batches[0][i % options.n]);
+  }
+  // The outputs are copied back to the host, so a call is timed to the end
+  // of its kernels on the GPU too.
+  std::vector<std::vector<double>> client_ms(options.clients);
+  std::atomic<bool> go{false};
+  std::vector<std::thread> clients;
+  for (int64_t client = 0; client < options.clients; ++client) {
+    clients.emplace_back([&, client] {
+      while (!go) {
+        std::this_thread::yield();
+      }
+      auto &ms = client_ms[client];
+      ms.reserve(options.n);
+      for (auto &batch : batches[client]) {
+        auto call_start = std::chrono::steady_clock::now();
+        run(batch);
+        ms.push_back(std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - call_start)
+                         .count());
+      }
+    });
+  }
+  auto start = std::chrono::steady_clock::now();
+  go = true;
+  for (auto &client : clients) {
+    client.join();
+  }
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  std::vector<double> ms;
+  for (auto &client : client_ms) {
+    ms.insert(ms.end(), client.begin(), client.end());
+  }
+  std::sort(ms.begin(), ms.end());
+  auto n = static_cast<int64_t>(ms.size());
+  auto good = options.slo_ms > 0
+                  ? std::upper_bound(ms.begin(), ms.end(), options.slo_ms) -
+                        ms.begin()
+                  : n;
+  double mean = std::accumulate(ms.begin(), ms.end(), 0.0) / n;
+  // The packed batches compute the valid tokens only.
+  double padding_ratio =
+      options.packing ? 0 : 1 - static_cast<double>(valid_tokens) /
+                                    padded_tokens;
+  std::cout << absl::StrFormat(
+                   "{\"QPS\": %f, \"elapsed\": %f, \"n\": %d, "
+                   "\"batch_size\": %d, \"seq_len\": %s, "
+                   "\"framework\": \"turbo-transformers-cxx\", "
+                   "\"thread_num\": %d, \"clients\": %d, \"device\": \"%s\", "
+                   "\"mean_ms\": %f, \"p50_ms\": %f, \"p90_ms\": %f, "
+                   "\"p99_ms\": %f, \"goodput\": %f, "
+                   "\"tokens_per_second\": %f, \"padding_ratio\": %f, "
+                   "\"peak_memory_bytes\": %d}",
+                   n / elapsed, elapsed, n, batch_size, seq_len, n_threads,
+                   options.clients,
+                   options.device_type == kDLGPU ? "gpu" : "cpu", mean,
+                   Percentile(ms, 0.5), Percentile(ms, 0.9),
+                   Percentile(ms, 0.99), good / elapsed,
+                   valid_tokens / elapsed, padding_ratio,
+                   PeakMemoryBytes(options.device_type))
+            << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    std::cerr << "./bert_model_benchmark model_path [--device=cpu|gpu] "
+                 "[--batch_sizes=1,2] [--seq_lens=10,20] "
+                 "[--length_histogram=lengths.txt] [--num_threads=4,8] "
+                 "[--clients=1] [--n=150] [--warmup=10] [--slo_ms=0] "
+                 "[--n_layers=12 --n_heads=12] [--use_pooler=1] "
+                 "[--packing=1] [--huge_pages=1]"
+              << std::endl;
+    return -1;
+  }
+  if (options.device_type == kDLGPU && !core::IsCompiledWithCUDA()) {
+    std::cerr << "turbo_transformers is not compiled with CUDA." << std::endl;
+    return -1;
+  }
+  core::CPUAllocator::GetInstance().set_huge_pages(options.huge_pages);
+  std::unique_ptr<BertModel> model;
+  if (options.n_layers > 0) {
+    model.reset(new BertModel(options.model_path, options.device_type,
+                              options.n_layers, options.n_heads));
+  } else {
+    model.reset(new BertModel(options.model_path, options.device_type));
+  }
+  model->EnablePacking(options.packing);
+  // A fixed length is a histogram of one length.
+  std::vector<std::pair<LengthHistogram, std::string>> scenarios;
+  if (!options.length_histogram.empty()) {
+    scenarios.emplace_back(LoadLengthHistogram(options.length_histogram),
+                           absl::StrFormat("\"%s\"", options.length_histogram));
+  } else {
+    for (auto seq_len : options.seq_lens) {
+      scenarios.emplace_back(LengthHistogram{{seq_len}, {1}},
+                             std::to_string(seq_len));
+    }
+  }
+  // The weights are allocated before, so only the activations are counted.
+  core::EnableMemoryTracking();
+  // The threads only apply to the CPU kernels, a GPU sweep runs each shape
+  // once.
+  auto num_threads = options.device_type == kDLGPU
+                         ? std::vector<int64_t>{1}
+                         : options.num_threads;
+  for (auto n_threads : num_threads) {
+    model->SetNumThreads(static_cast<int>(n_threads));
+    for (auto batch_size : options.batch_sizes) {
+      for (auto &scenario : scenarios) {
+        Run(*model, options, scenario.first, scenario.second, batch_size,
+            n_threads);
+      }
+    }
+  }
+  return 0;
+}
@@ -11,7 +11,7 @@
 // permissions and limitations under the License.
 // See the AUTHORS file for names of contributors.
 
-#include "bert_model.h"
+#include "turbo_transformers/serving/bert_model.h"
 
 #include <cassert>
 #include <cmath>
@@ -22,6 +22,9 @@
 
 #include "turbo_transformers/core/config.h"
 
+using turbo_transformers::serving::BertModel;
+using turbo_transformers::serving::PoolType;
+
 static bool test(const std::string &model_path, bool use_cuda = false) {
   // construct a bert model using n_layers and n_heads,
   // the hidden_size can be infered from the parameters
@@ -57,6 +60,8 @@ bool test_multiple_threads(const std::string &model_path, bool only_input,
                            int n_threads) {
   std::shared_ptr<BertModel> model_ptr =
       std::make_shared<BertModel>(model_path, DLDeviceType::kDLCPU, 12, 12);
+  // Run the concurrent calls on preallocated arenas.
+  model_ptr->PlanMemory(2, 4);
   std::vector<std::vector<int64_t>> input_ids{{12166, 10699, 16752, 4454},
                                               {5342, 16471, 817, 16022}};
   std::vector<std::vector<int64_t>> position_ids{{1, 0, 0, 0}, {1, 1, 1, 0}};
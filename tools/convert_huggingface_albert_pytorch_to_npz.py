@@ -0,0 +1,90 @@
+# Copyright (C) 2020 THL A29 Limited, a Tencent company.
+# All rights reserved.
+# Licensed under the BSD 3-Clause License (the "License"); you may
+# not use this file except in compliance with the License. You may
+# obtain a copy of the License at
+# https://opensource.org/licenses/BSD-3-Clause
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" basis,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+# implied. See the License for the specific language governing
+# permissions and limitations under the License.
+# See the AUTHORS file for names of contributors.
+
+from transformers.modeling_albert import AlbertModel
+import sys
+import numpy
+import torch
+
+# The shared layer is stored once as "encoder.albert_layer", with the names of
+# a BERT layer, and the embedding projection as
+# "encoder.embedding_hidden_mapping_in".
+# Attention: weight of dense layers should be stored as (:, hidden_dim)
+# While pytorch store them as (hidden_dim, :)
+
+layer_prefix = 'encoder.albert_layer_groups.0.albert_layers.0.'
+layer_names = {
+    'attention.dense': 'attention.output.dense',
+    'attention.LayerNorm': 'attention.output.LayerNorm',
+    'ffn': 'intermediate.dense',
+    'ffn_output': 'output.dense',
+    'full_layer_layer_norm': 'output.LayerNorm',
+}
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(
+            "Usage: \n"
+            "    convert_huggingface_albert_to_npz model_name (albert-base-v2) output_file"
+        )
+        exit(0)
+    torch.set_grad_enabled(False)
+
+    model_name = sys.argv[1]
+    model = AlbertModel.from_pretrained(model_name)
+    if model.config.num_hidden_groups != 1 or model.config.inner_group_num != 1:
+        print("Only ALBERT models sharing a single layer are supported")
+        exit(1)
+    arrays = {k: v.detach() for k, v in model.named_parameters()}
+
+    numpy_dict = {}
+    for k, v in arrays.items():
+        if k.startswith('embeddings.'):
+            numpy_dict[k] = v.numpy()
+        elif k == 'encoder.embedding_hidden_mapping_in.weight':
+            numpy_dict[k] = torch.clone(torch.t(v)).numpy()
+        elif k == 'encoder.embedding_hidden_mapping_in.bias':
+            numpy_dict[k] = v.numpy()
+        elif k.startswith('pooler.'):
+            name = 'pooler.dense.' + k[len('pooler.'):]
+            numpy_dict[name] = (torch.clone(torch.t(v))
+                                if name.endswith('weight') else v).numpy()
+        elif k.startswith(layer_prefix):
+            name = k[len(layer_prefix):]
+            if any(
+                    name.startswith('attention.' + qkv)
+                    for qkv in ('query', 'key', 'value')):
+                continue
+            module, param = name.rsplit('.', 1)
+            name = 'encoder.albert_layer.' + layer_names[module] + '.' + param
+            if param == 'weight' and not module.endswith('LayerNorm') and \
+                    module != 'full_layer_layer_norm':
+                v = torch.clone(torch.t(v))
+            numpy_dict[name] = v.numpy()
+
+    for param in ('weight', 'bias'):
+        qkv = torch.cat([
+            arrays[layer_prefix + f'attention.{name}.{param}']
+            for name in ('query', 'key', 'value')
+        ], 0)
+        if param == 'weight':
+            qkv = torch.clone(torch.t(qkv))
+        numpy_dict[f'encoder.albert_layer.attention.qkv.{param}'] = qkv.numpy()
+    del arrays
+    del model
+    numpy.savez_compressed(sys.argv[2], **numpy_dict)
+
+
+if __name__ == '__main__':
+    main()
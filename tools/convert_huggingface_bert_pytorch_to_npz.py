@@ -20,17 +20,9 @@ import torch
 # While pytorch store them as (hidden_dim, :)
 
 
-def main():
-    if len(sys.argv) != 3:
-        print(
-            "Usage: \n"
-            "    convert_huggingface_bert_to_npz model_name (bert-base-uncased) output_file"
-        )
-        exit(0)
-    torch.set_grad_enabled(False)
-
-    model_name = sys.argv[1]
-    model = BertModel.from_pretrained(model_name)
+def convert(model):
+    """Returns the weights of `model` fused and transposed as the runtime
+    loads them."""
     arrays = {k: v.detach() for k, v in model.named_parameters()}
 
     q_weight_key = 'self.query.weight'
@@ -68,7 +60,21 @@ def main():
             numpy_dict[k] = torch.clone(torch.t(arrays[k])).numpy()
         else:
             numpy_dict[k] = arrays[k].numpy()
-    del arrays
+    return numpy_dict
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(
+            "Usage: \n"
+            "    convert_huggingface_bert_to_npz model_name (bert-base-uncased) output_file"
+        )
+        exit(0)
+    torch.set_grad_enabled(False)
+
+    model_name = sys.argv[1]
+    model = BertModel.from_pretrained(model_name)
+    numpy_dict = convert(model)
     del model
     numpy.savez_compressed(sys.argv[2], **numpy_dict)
 
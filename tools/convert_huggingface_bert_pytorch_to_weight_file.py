@@ -0,0 +1,52 @@
+# Copyright (C) 2020 THL A29 Limited, a Tencent company.
+# All rights reserved.
+# Licensed under the BSD 3-Clause License (the "License"); you may
+# not use this file except in compliance with the License. You may
+# obtain a copy of the License at
+# https://opensource.org/licenses/BSD-3-Clause
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" basis,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+# implied. See the License for the specific language governing
+# permissions and limitations under the License.
+# See the AUTHORS file for names of contributors.
+
+from transformers.modeling_bert import BertModel
+import sys
+import torch
+from convert_huggingface_bert_pytorch_to_npz import convert
+from weight_file import save_weight_file
+
+# Converts a huggingface BERT to a model file of
+# turbo_transformers/loaders/weight_file.h: the weights are stored fused and
+# transposed as the runtime runs on them, along with the config of the model,
+# so BertModel(filename, device_type) maps the file without converting
+# anything. Packing the weights for the BLAS of the host stays a step of
+# loading, as packed weights only fit the machine and library packing them.
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(
+            "Usage: \n"
+            "    convert_huggingface_bert_pytorch_to_weight_file model_name (bert-base-uncased) output_file"
+        )
+        exit(0)
+    torch.set_grad_enabled(False)
+
+    model = BertModel.from_pretrained(sys.argv[1])
+    config = {
+        'model_type': 'bert',
+        'num_hidden_layers': model.config.num_hidden_layers,
+        'num_attention_heads': model.config.num_attention_heads,
+        'hidden_size': model.config.hidden_size,
+        'intermediate_size': model.config.intermediate_size,
+        'hidden_act': model.config.hidden_act,
+    }
+    arrays = convert(model)
+    del model
+    save_weight_file(sys.argv[2], arrays, config)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,32 @@
+# Copyright (C) 2020 THL A29 Limited, a Tencent company.
+# All rights reserved.
+# Licensed under the BSD 3-Clause License (the "License"); you may
+# not use this file except in compliance with the License. You may
+# obtain a copy of the License at
+# https://opensource.org/licenses/BSD-3-Clause
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" basis,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+# implied. See the License for the specific language governing
+# permissions and limitations under the License.
+# See the AUTHORS file for names of contributors.
+
+import sys
+import numpy
+from weight_file import save_weight_file
+
+# Converts an npz archive to the uncompressed weight file of
+# turbo_transformers/loaders/weight_file.h, which BertModel maps instead of
+# reading it.
+
+
+def main():
+    if len(sys.argv) != 3:
+        print("Usage: \n"
+              "    convert_npz_to_weight_file input.npz output_file")
+        exit(0)
+    save_weight_file(sys.argv[2], dict(numpy.load(sys.argv[1])))
+
+
+if __name__ == '__main__':
+    main()
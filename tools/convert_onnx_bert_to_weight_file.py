@@ -0,0 +1,423 @@
+# Copyright (C) 2020 THL A29 Limited, a Tencent company.
+# All rights reserved.
+# Licensed under the BSD 3-Clause License (the "License"); you may
+# not use this file except in compliance with the License. You may
+# obtain a copy of the License at
+# https://opensource.org/licenses/BSD-3-Clause
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" basis,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+# implied. See the License for the specific language governing
+# permissions and limitations under the License.
+# See the AUTHORS file for names of contributors.
+
+import sys
+import numpy
+import onnx
+from onnx import numpy_helper
+from weight_file import save_weight_file
+
+# Converts the BERT encoder of an ONNX model, whatever framework exported it,
+# to a model file of turbo_transformers/loaders/weight_file.h, or to an npz
+# archive if the output file ends with ".npz". The weights are found by the
+# structure of the graph rather than by their names, which exporters do not
+# keep: the embeddings are the sum of three Gathers followed by a LayerNorm,
+# every layer is the q, k and v products of its input, the Softmax attention,
+# and the dense, intermediate (Gelu) and output products with their residual
+# LayerNorms, as by torch.onnx.export of a huggingface BertModel. LayerNorm
+# and Gelu may be decomposed into their elementary operators. The tanh pooler
+# after the last layer is converted if there is one, the heads after it are
+# not. If any part does not match, the script stops with the node it could
+# not map, and the model should keep running as it is, e.g. on onnxruntime.
+
+# The operators moving the data without computing, which the matching looks
+# through.
+MOVES = ('Reshape', 'Transpose', 'Squeeze', 'Unsqueeze', 'Identity', 'Cast',
+         'Dropout', 'Flatten')
+
+
+class UnsupportedPattern(Exception):
+    pass
+
+
+class Matcher:
+    def __init__(self, graph):
+        self.producers = {}
+        self.constants = {
+            init.name: numpy_helper.to_array(init)
+            for init in graph.initializer
+        }
+        for node in graph.node:
+            for output in node.output:
+                self.producers[output] = node
+            if node.op_type == 'Constant':
+                for attr in node.attribute:
+                    if attr.name == 'value':
+                        self.constants[node.output[0]] = \
+                            numpy_helper.to_array(attr.t)
+
+    def producer(self, name, *op_types):
+        node = self.producers.get(name)
+        if node is not None and node.op_type in op_types:
+            return node
+        return None
+
+    def constant(self, name):
+        """The value of `name` if it is an initializer or a constant, seen
+        through Identity, Cast and Transpose."""
+        if name in self.constants:
+            return self.constants[name]
+        node = self.producer(name, 'Identity', 'Cast', 'Transpose')
+        if node is None:
+            return None
+        value = self.constant(node.input[0])
+        if value is None or node.op_type != 'Transpose':
+            return value
+        perm = [attr.ints for attr in node.attribute if attr.name == 'perm']
+        return numpy.transpose(value, *perm)
+
+    def split_constant(self, node):
+        """(constant, other input) of a binary `node` having one constant
+        input, else None."""
+        a, b = node.input[0], node.input[1]
+        if self.constant(b) is not None and self.constant(a) is None:
+            return self.constant(b), a
+        if self.constant(a) is not None and self.constant(b) is None:
+            return self.constant(a), b
+        return None
+
+    def skip(self, name, op_types=MOVES):
+        """The tensor read by the chain of `op_types` producing `name`, taking
+        the non-constant input of binary operators."""
+        while True:
+            node = self.producer(name, *op_types)
+            if node is None:
+                return name
+            if len(node.input) > 1 and node.op_type not in MOVES:
+                split = self.split_constant(node)
+                name = split[1] if split is not None else node.input[0]
+            else:
+                name = node.input[0]
+
+    def linear(self, name):
+        """(input, weight [in, out], bias) of x * weight + bias producing
+        `name`, else None."""
+        node = self.producer(name, 'Add', 'Gemm')
+        if node is None:
+            return None
+        if node.op_type == 'Gemm':
+            weight = self.constant(node.input[1])
+            bias = self.constant(node.input[2]) if len(node.input) > 2 \
+                else None
+            attrs = {attr.name: attr for attr in node.attribute}
+            if weight is None or bias is None or 'transA' in attrs and \
+                    attrs['transA'].i:
+                return None
+            if 'transB' in attrs and attrs['transB'].i:
+                weight = weight.T
+            for key in ('alpha', 'beta'):
+                if key in attrs and attrs[key].f != 1.0:
+                    return None
+            return node.input[0], weight, bias
+        split = self.split_constant(node)
+        if split is None or split[0].ndim != 1:
+            return None
+        bias, product = split
+        mat_mul = self.producer(product, 'MatMul')
+        if mat_mul is None:
+            return None
+        weight = self.constant(mat_mul.input[1])
+        if weight is None or weight.ndim != 2:
+            return None
+        return mat_mul.input[0], weight, bias
+
+    def layer_norm(self, name):
+        """(input, gamma, beta) of the LayerNorm producing `name`, else
+        None."""
+        node = self.producer(name, 'LayerNormalization')
+        if node is not None:
+            gamma = self.constant(node.input[1])
+            beta = self.constant(node.input[2])
+            if gamma is None or beta is None:
+                return None
+            return node.input[0], gamma, beta
+        # Decomposed: (x - mean(x)) / sqrt(var(x) + eps) * gamma + beta.
+        add = self.producer(name, 'Add')
+        split = add and self.split_constant(add)
+        mul = split and self.producer(split[1], 'Mul')
+        scale = mul and self.split_constant(mul)
+        div = scale and self.producer(scale[1], 'Div')
+        sub = div and self.producer(div.input[0], 'Sub')
+        mean = sub and self.producer(sub.input[1], 'ReduceMean')
+        if mean is None or mean.input[0] != sub.input[0]:
+            return None
+        return sub.input[0], scale[0], split[0]
+
+    def gelu(self, name):
+        """The input of the Gelu producing `name`, else None."""
+        node = self.producer(name, 'Gelu', 'FastGelu')
+        if node is not None:
+            return node.input[0]
+        # Decomposed: x * 0.5 * (1 + erf(x / sqrt(2))), or its tanh form,
+        # whose Erf or Tanh is a few operators above the output.
+        frontier = [name]
+        for _ in range(4):
+            nodes = [self.producers.get(t) for t in frontier]
+            nodes = [n for n in nodes if n is not None]
+            for n in nodes:
+                if n.op_type == 'Erf':
+                    scaled = self.producer(n.input[0], 'Div', 'Mul')
+                    split = scaled and self.split_constant(scaled)
+                    return split[1] if split else None
+                if n.op_type == 'Tanh':
+                    return self._tanh_gelu_input(n)
+            frontier = [t for n in nodes for t in n.input]
+        return None
+
+    def _tanh_gelu_input(self, tanh):
+        # tanh(sqrt(2 / pi) * (x + 0.044715 * x^3))
+        mul = self.producer(tanh.input[0], 'Mul')
+        split = mul and self.split_constant(mul)
+        add = split and self.producer(split[1], 'Add')
+        if add is None:
+            return None
+        for a, b in ((add.input[0], add.input[1]), (add.input[1],
+                                                    add.input[0])):
+            if self.producer(b, 'Mul') is not None:
+                return a
+        return None
+
+    def residual(self, name):
+        """(residual, product) of the Add producing the LayerNorm input
+        `name`, the residual being the output of a LayerNorm and the product
+        a linear, else None."""
+        node = self.producer(name, 'Add')
+        if node is None:
+            return None
+        for a, b in ((node.input[0], node.input[1]), (node.input[1],
+                                                      node.input[0])):
+            product = self.linear(b)
+            if product is not None and self.layer_norm(a) is not None:
+                return a, product
+        return None
+
+    def num_heads(self, name):
+        """The heads of the Reshape to [batch, seq, heads, size_per_head]
+        in the chain of moves producing `name`."""
+        while True:
+            node = self.producer(name, *MOVES)
+            if node is None:
+                return None
+            if node.op_type == 'Reshape':
+                shape = self.constant(node.input[1])
+                concat = self.producer(node.input[1], 'Concat')
+                if shape is None and concat is not None and \
+                        len(concat.input) == 4:
+                    part = self.constant(concat.input[2])
+                    shape = [0, 0, int(part.reshape(-1)[0])] \
+                        if part is not None else None
+                if shape is not None and len(shape) == 4 and shape[2] > 0:
+                    return int(shape[2])
+            name = node.input[0]
+
+    def attention(self, context, hidden):
+        """The q, k and v linears of `hidden` and the heads of the attention
+        producing `context`, else None."""
+        mat_mul = self.producer(self.skip(context), 'MatMul')
+        softmax = mat_mul and self.producer(self.skip(mat_mul.input[0]),
+                                            'Softmax')
+        # The scores are scaled and masked between the product and the
+        # softmax.
+        scores = softmax and self.producer(
+            self.skip(softmax.input[0],
+                      MOVES + ('Add', 'Sub', 'Mul', 'Div')),
+            'MatMul')
+        if scores is None:
+            return None
+        value = mat_mul.input[1]
+        query, key = scores.input[0], scores.input[1]
+        scaling = MOVES + ('Mul', 'Div')
+        linears = [
+            self.linear(self.skip(t, scaling)) for t in (query, key, value)
+        ]
+        if any(linear is None or linear[0] != hidden for linear in linears):
+            return None
+        # The key may be transposed by a Reshape of its own, so the heads
+        # come from the query.
+        num_heads = self.num_heads(query) or self.num_heads(value)
+        return linears, num_heads
+
+    def layer(self, name):
+        """The input and the weights of the encoder layer producing `name`,
+        else None."""
+        output = self.layer_norm(name)
+        residual = output and self.residual(output[0])
+        if residual is None:
+            return None
+        attention_output, (intermediate, output_weight, output_bias) = residual
+        gelu = self.gelu(intermediate)
+        gelu_linear = gelu and self.linear(gelu)
+        if gelu_linear is None or gelu_linear[0] != attention_output:
+            return None
+        attention_norm = self.layer_norm(attention_output)
+        attention_residual = attention_norm and self.residual(
+            attention_norm[0])
+        if attention_residual is None:
+            return None
+        hidden, (context, dense_weight, dense_bias) = attention_residual
+        attention = self.attention(context, hidden)
+        if attention is None:
+            return None
+        (q, k, v), num_heads = attention
+        weights = {
+            'attention.qkv.weight':
+            numpy.concatenate([q[1], k[1], v[1]], axis=1),
+            'attention.qkv.bias': numpy.concatenate([q[2], k[2], v[2]]),
+            'attention.output.dense.weight': dense_weight,
+            'attention.output.dense.bias': dense_bias,
+            'attention.output.LayerNorm.weight': attention_norm[1],
+            'attention.output.LayerNorm.bias': attention_norm[2],
+            'intermediate.dense.weight': gelu_linear[1],
+            'intermediate.dense.bias': gelu_linear[2],
+            'output.dense.weight': output_weight,
+            'output.dense.bias': output_bias,
+            'output.LayerNorm.weight': output[1],
+            'output.LayerNorm.bias': output[2],
+        }
+        return hidden, weights, num_heads
+
+    def embeddings(self, name):
+        """The word, position and token type embeddings and the LayerNorm
+        of the embeddings producing `name`, else None."""
+        norm = self.layer_norm(name)
+        if norm is None:
+            return None
+        tables = []
+        pending = [norm[0]]
+        while pending:
+            t = pending.pop()
+            add = self.producer(t, 'Add')
+            if add is not None:
+                pending.extend(add.input)
+                continue
+            gather = self.producer(self.skip(t), 'Gather')
+            table = gather and self.constant(gather.input[0])
+            if table is None or table.ndim != 2:
+                return None
+            tables.append(table)
+        if len(tables) != 3:
+            return None
+        # The token types are the fewest rows, the words the most.
+        token_type, position, word = sorted(tables, key=lambda t: t.shape[0])
+        return {
+            'embeddings.word_embeddings.weight': word,
+            'embeddings.position_embeddings.weight': position,
+            'embeddings.token_type_embeddings.weight': token_type,
+            'embeddings.LayerNorm.weight': norm[1],
+            'embeddings.LayerNorm.bias': norm[2],
+        }
+
+    def pooler(self, graph, hidden):
+        """The weights of the tanh pooler of the first token of `hidden`, if
+        there is one."""
+        for node in graph.node:
+            if node.op_type != 'Tanh':
+                continue
+            linear = self.linear(node.input[0])
+            if linear is None:
+                continue
+            first = self.producer(self.skip(linear[0]), 'Gather', 'Slice')
+            if first is not None and self.skip(first.input[0]) == hidden:
+                return {
+                    'pooler.dense.weight': linear[1],
+                    'pooler.dense.bias': linear[2],
+                }
+        return {}
+
+
+def convert(model, num_heads=None):
+    """Returns the weights of the BERT encoder of the ONNX `model` fused as
+    the runtime loads them, and its config. Raises UnsupportedPattern if the
+    graph does not match."""
+    graph = model.graph
+    matcher = Matcher(graph)
+    # The last layer is the last tensor of the graph produced by a layer.
+    last = None
+    for node in reversed(graph.node):
+        if matcher.layer(node.output[0]) is not None:
+            last = node.output[0]
+            break
+    if last is None:
+        raise UnsupportedPattern("no BERT encoder layer found")
+
+    layers = []
+    hidden = last
+    while True:
+        layer = matcher.layer(hidden)
+        if layer is None:
+            break
+        hidden, weights, heads = layer
+        layers.append((weights, heads))
+    layers.reverse()
+    embeddings = matcher.embeddings(hidden)
+    if embeddings is None:
+        node = matcher.producers.get(hidden)
+        raise UnsupportedPattern(
+            "the input of the first layer, %s, is not a LayerNorm of the sum "
+            "of the word, position and token type embeddings" %
+            (node.name if node is not None else hidden))
+    if num_heads is None:
+        heads = {h for _, h in layers if h is not None}
+        if len(heads) != 1:
+            raise UnsupportedPattern(
+                "cannot tell the number of heads %s, pass it by --num-heads" %
+                sorted(heads))
+        num_heads = heads.pop()
+
+    arrays = dict(embeddings)
+    for i, (weights, _) in enumerate(layers):
+        for key, value in weights.items():
+            arrays[f'encoder.layer.{i}.{key}'] = value
+    arrays.update(matcher.pooler(graph, last))
+    arrays = {
+        key: numpy.ascontiguousarray(value, dtype=numpy.float32)
+        for key, value in arrays.items()
+    }
+    hidden_size = arrays['embeddings.LayerNorm.weight'].shape[0]
+    config = {
+        'model_type': 'bert',
+        'num_hidden_layers': len(layers),
+        'num_attention_heads': num_heads,
+        'hidden_size': hidden_size,
+        'intermediate_size':
+        arrays['encoder.layer.0.intermediate.dense.weight'].shape[1],
+        'hidden_act': 'gelu',
+    }
+    return arrays, config
+
+
+def main():
+    args = [arg for arg in sys.argv[1:] if not arg.startswith('--')]
+    options = dict(
+        arg[2:].split('=', 1) for arg in sys.argv[1:] if arg.startswith('--'))
+    if len(args) != 2:
+        print("Usage: \n"
+              "    convert_onnx_bert_to_weight_file model.onnx output_file "
+              "[--num-heads=N]")
+        exit(0)
+    num_heads = int(options['num-heads']) if 'num-heads' in options else None
+    try:
+        arrays, config = convert(onnx.load(args[0]), num_heads)
+    except UnsupportedPattern as e:
+        print(f"{args[0]} is not supported: {e}", file=sys.stderr)
+        exit(1)
+    print(f"converted {config['num_hidden_layers']} layers of "
+          f"{config['num_attention_heads']} heads")
+    if args[1].endswith('.npz'):
+        numpy.savez_compressed(args[1], **arrays)
+    else:
+        save_weight_file(args[1], arrays, config)
+
+
+if __name__ == '__main__':
+    main()
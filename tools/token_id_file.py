@@ -0,0 +1,52 @@
+# Copyright (C) 2020 THL A29 Limited, a Tencent company.
+# All rights reserved.
+# Licensed under the BSD 3-Clause License (the "License"); you may
+# not use this file except in compliance with the License. You may
+# obtain a copy of the License at
+# https://opensource.org/licenses/BSD-3-Clause
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" basis,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+# implied. See the License for the specific language governing
+# permissions and limitations under the License.
+# See the AUTHORS file for names of contributors.
+
+import struct
+import numpy
+
+# Writes the token id files which turbo_transformers/serving/embedding_pipeline.h maps, and
+# reads the embedding files it writes.
+
+VERSION = 1
+
+
+def save_token_id_file(filename, sequences):
+    """Writes the token ids `sequences`, a list of lists of ints, e.g. the
+    "input_ids" of a tokenizer, to `filename`."""
+    lengths = numpy.array([len(ids) for ids in sequences], dtype='<i8')
+    offsets = numpy.zeros(len(sequences) + 1, dtype='<i8')
+    numpy.cumsum(lengths, out=offsets[1:])
+    with open(filename, 'wb') as f:
+        f.write(b'TTTOKIDS')
+        f.write(struct.pack('<IIQ', VERSION, 0, len(sequences)))
+        f.write(offsets.tobytes())
+        for ids in sequences:
+            f.write(numpy.asarray(ids, dtype='<i4').tobytes())
+
+
+def load_embedding_file(filename):
+    """Returns the embeddings [n, hidden_size] of an embedding file as a
+    float32 numpy array, memory mapped rather than read."""
+    with open(filename, 'rb') as f:
+        magic = f.read(8)
+        if magic != b'TTEMBEDS':
+            raise ValueError(f"{filename} is no embedding file")
+        version, hidden_size, size = struct.unpack('<IIQ', f.read(16))
+    if version != VERSION:
+        raise ValueError(
+            f"{filename} has the unsupported version {version}")
+    return numpy.memmap(filename,
+                        dtype='<f4',
+                        mode='r',
+                        offset=24,
+                        shape=(size, hidden_size))
@@ -0,0 +1,75 @@
+# Copyright (C) 2020 THL A29 Limited, a Tencent company.
+# All rights reserved.
+# Licensed under the BSD 3-Clause License (the "License"); you may
+# not use this file except in compliance with the License. You may
+# obtain a copy of the License at
+# https://opensource.org/licenses/BSD-3-Clause
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" basis,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+# implied. See the License for the specific language governing
+# permissions and limitations under the License.
+# See the AUTHORS file for names of contributors.
+
+import struct
+import numpy
+
+# Writes the uncompressed weight file of
+# turbo_transformers/loaders/weight_file.h, which BertModel maps instead of
+# reading it.
+
+VERSION = 2
+ALIGNMENT = 64
+# The DLPack type codes.
+TYPE_CODES = {'i': 0, 'u': 1, 'f': 2}
+
+
+def align(offset):
+    return (offset + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT
+
+
+def pack_string(value):
+    encoded = value.encode()
+    return struct.pack('<I', len(encoded)) + encoded
+
+
+def save_weight_file(filename, arrays, config=None):
+    """Writes the numpy `arrays` by name and the string `config` of their
+    model, e.g. "num_hidden_layers", to `filename`."""
+    config = config or {}
+    header = [
+        pack_string(key) + pack_string(str(value))
+        for key, value in config.items()
+    ]
+    for name, array in arrays.items():
+        if array.dtype.kind not in TYPE_CODES:
+            raise ValueError(f"{name} has the unsupported type {array.dtype}")
+        header.append(pack_string(name))
+        header.append(
+            struct.pack('<BBH', TYPE_CODES[array.dtype.kind],
+                        array.dtype.itemsize * 8, array.ndim))
+        header.append(struct.pack(f'<{array.ndim}q', *array.shape))
+        # The offset and size of the data, filled in below.
+        header.append(None)
+
+    header_size = 8 + 4 + 4 + 4 + 8 + \
+        sum(16 if part is None else len(part) for part in header)
+    offset = align(header_size)
+    arrays_left = iter(arrays.values())
+    for i, part in enumerate(header):
+        if part is None:
+            array = next(arrays_left)
+            header[i] = struct.pack('<QQ', offset, array.nbytes)
+            offset = align(offset + array.nbytes)
+
+    with open(filename, 'wb') as f:
+        f.write(b'TTWEIGHT')
+        f.write(
+            struct.pack('<IIIQ', VERSION, len(arrays), len(config),
+                        header_size))
+        for part in header:
+            f.write(part)
+        for array in arrays.values():
+            f.write(b'\0' * (align(f.tell()) - f.tell()))
+            little_endian = array.astype(array.dtype.newbyteorder('<'))
+            f.write(numpy.ascontiguousarray(little_endian).tobytes())
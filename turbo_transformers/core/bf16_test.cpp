@@ -0,0 +1,53 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/core/bfloat16.h"
+
+#include <cmath>
+#include <limits>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/core/tensor.h"
+
+namespace turbo_transformers {
+namespace core {
+
+TEST_CASE("bfloat16-conversion", "[BFloat16]") {
+  // The floats of an 8 bit mantissa are exact.
+  for (float value : {0.f, 1.f, -2.5f, 12.f, 1099511627776.f, -3.0517578e-05f}) {
+    REQUIRE(static_cast<float>(BFloat16(value)) == value);
+  }
+  // 1 + 2^-8 is halfway between 1 and 1 + 2^-7, and rounds to the even 1,
+  // anything above it rounds up.
+  REQUIRE(static_cast<float>(BFloat16(1.00390625f)) == 1.f);
+  REQUIRE(static_cast<float>(BFloat16(1.005f)) == 1.0078125f);
+  REQUIRE(static_cast<float>(BFloat16(1.01171875f)) == 1.015625f);
+  REQUIRE(std::isinf(static_cast<float>(
+      BFloat16(std::numeric_limits<float>::infinity()))));
+  REQUIRE(std::isnan(static_cast<float>(
+      BFloat16(std::numeric_limits<float>::quiet_NaN()))));
+}
+
+TEST_CASE("bfloat16-tensor", "[BFloat16]") {
+  // A tensor of bfloat16 is neither a half nor a float one.
+  Tensor tensor(nullptr);
+  auto* data = tensor.Reshape<BFloat16>({2, 3}, kDLCPU, 0);
+  data[5] = 0.5f;
+  REQUIRE(tensor.IsType<BFloat16>());
+  REQUIRE(!tensor.IsType<Half>());
+  REQUIRE(!tensor.IsType<float>());
+  REQUIRE(static_cast<float>(tensor.data<BFloat16>()[5]) == 0.5f);
+}
+
+}  // namespace core
+}  // namespace turbo_transformers
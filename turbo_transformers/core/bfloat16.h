@@ -0,0 +1,61 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+namespace turbo_transformers {
+namespace core {
+
+// The bfloat16 type, the upper 16 bits of a float: it has the range of a
+// float with an 8 bit mantissa. The CPUs with AVX512-BF16 or AMX multiply
+// it natively, and it halves the weights read by a GEMM.
+struct alignas(2) BFloat16 {
+  std::uint16_t x;
+
+  BFloat16() = default;
+
+  BFloat16(const BFloat16 &f) = default;
+
+  BFloat16 &operator=(const BFloat16 &f) = default;
+
+  BFloat16 &operator=(BFloat16 &&f) = default;
+
+  ~BFloat16() = default;
+
+  // Rounds to the nearest even, NaNs stay quiet NaNs.
+  BFloat16(float other) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &other, sizeof(bits));
+    if ((bits & 0x7fffffffu) > 0x7f800000u) {
+      x = static_cast<std::uint16_t>((bits >> 16) | 0x40u);
+    } else {
+      bits += 0x7fffu + ((bits >> 16) & 1u);
+      x = static_cast<std::uint16_t>(bits >> 16);
+    }
+  }
+
+  template <class T>
+  BFloat16(const T &other) : BFloat16(static_cast<float>(other)) {}
+
+  inline operator float() const {
+    std::uint32_t bits = static_cast<std::uint32_t>(x) << 16;
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+  }
+};
+
+}  // namespace core
+}  // namespace turbo_transformers
@@ -12,11 +12,27 @@
 // See the AUTHORS file for names of contributors.
 
 #include "blas.h"
-#define EIGEN_DONT_PARALLELIZE
 
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+#define EIGEN_DONT_PARALLELIZE
 #include "unsupported/Eigen/CXX11/Tensor"
 
+namespace {
+// Below this many multiply-adds, a GEMM gains little from the threads of
+// OpenBLAS, e.g. the per-head products of the attention.
+constexpr int64_t kSmallGemmMacs = 128 * 128 * 128;
+}  // namespace
+
 extern "C" {
+// Unlike the one of MKL, OpenBLAS has no batched GEMM. The GEMMs of the batch
+// are split among the OpenMP threads, each running single threaded, unless
+// they are few and large enough to be threaded by OpenBLAS itself.
 void cblas_sgemm_batch(const CBLAS_ORDER Layout,
                        const CBLAS_TRANSPOSE* transa_array,
                        const CBLAS_TRANSPOSE* transb_array,
@@ -27,16 +43,42 @@ void cblas_sgemm_batch(const CBLAS_ORDER Layout,
                        const float* beta_array, float** c_array,
                        const blasint* ldc_array, const blasint group_count,
                        const blasint* group_size) {
-  int idx = 0;
-  for (int i = 0; i < group_count; ++i) {
-    auto alpha = alpha_array[i];
-    auto beta = beta_array[i];
-    for (int j = 0; j < group_size[i]; ++j) {
-      cblas_sgemm(Layout, transa_array[i], transb_array[i], m_array[i],
-                  n_array[i], k_array[i], alpha, a_array[idx], lda_array[i],
-                  b_array[idx], ldb_array[i], beta, c_array[idx], ldc_array[i]);
-      ++idx;
+  // The group of every GEMM of the batch.
+  std::vector<blasint> groups;
+  int64_t max_macs = 0;
+  for (blasint i = 0; i < group_count; ++i) {
+    groups.insert(groups.end(), group_size[i], i);
+    max_macs = std::max(max_macs, static_cast<int64_t>(m_array[i]) *
+                                      n_array[i] * k_array[i]);
+  }
+  auto count = static_cast<int64_t>(groups.size());
+  auto gemm = [&](int64_t idx) {
+    auto i = groups[idx];
+    cblas_sgemm(Layout, transa_array[i], transb_array[i], m_array[i],
+                n_array[i], k_array[i], alpha_array[i], a_array[idx],
+                lda_array[i], b_array[idx], ldb_array[i], beta_array[i],
+                c_array[idx], ldc_array[i]);
+  };
+
+#ifdef _OPENMP
+  int n_threads = omp_get_max_threads();
+  if (count > 1 && n_threads > 1 && !omp_in_parallel() &&
+      (max_macs < kSmallGemmMacs || count >= n_threads)) {
+    // The OpenMP build of OpenBLAS resets the OpenMP threads as well, so
+    // both are restored afterwards in the order of core::SetNumThreads.
+    int blas_threads = openblas_get_num_threads();
+    openblas_set_num_threads(1);
+#pragma omp parallel for num_threads(n_threads) schedule(dynamic)
+    for (int64_t idx = 0; idx < count; ++idx) {
+      gemm(idx);
     }
+    openblas_set_num_threads(blas_threads);
+    omp_set_num_threads(n_threads);
+    return;
+  }
+#endif
+  for (int64_t idx = 0; idx < count; ++idx) {
+    gemm(idx);
   }
 }
 
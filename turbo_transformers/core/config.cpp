@@ -12,11 +12,16 @@
 // See the AUTHORS file for names of contributors.
 
 #include "turbo_transformers/core/config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #ifdef _OPENMP
 #include "omp.h"
 #endif
 #include "blas.h"
 #include "turbo_transformers/core/blas.h"
+#include "turbo_transformers/core/enforce.h"
 
 namespace turbo_transformers {
 namespace core {
@@ -32,6 +37,78 @@ void SetNumThreads(int n_th) {
 #endif
 }
 
+void SetLocalNumThreads(int n_th) {
+#ifdef TT_BLAS_USE_MKL
+  mkl_set_num_threads_local(n_th);
+#endif
+#ifdef _OPENMP
+  omp_set_num_threads(n_th);
+#endif
+}
+
+int GetLocalNumThreads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+namespace {
+std::atomic<int64_t> &MinParallelWork() {
+  static std::atomic<int64_t> work([] {
+    const char *env = std::getenv("TT_MIN_PARALLEL_WORK");
+    return env == nullptr ? static_cast<int64_t>(8192) : std::atoll(env);
+  }());
+  return work;
+}
+}  // namespace
+
+int64_t GetMinParallelWork() {
+  return MinParallelWork().load(std::memory_order_relaxed);
+}
+
+void SetMinParallelWork(int64_t work) {
+  TT_ENFORCE_GE(work, 0, "The work of a thread should not be negative");
+  MinParallelWork().store(work, std::memory_order_relaxed);
+}
+
+int ParallelThreadsFor(int64_t work) {
+  int n_th = GetLocalNumThreads();
+  int64_t min_work = GetMinParallelWork();
+  if (min_work == 0) {
+    return n_th;
+  }
+  return static_cast<int>(
+      std::max<int64_t>(1, std::min<int64_t>(n_th, work / min_work)));
+}
+
+NumThreadsGuard::NumThreadsGuard(int n_th) {
+  if (n_th <= 0) {
+    return;
+  }
+  prev_n_th_ = GetLocalNumThreads();
+#ifdef TT_BLAS_USE_MKL
+  // 0 is the global setting.
+  prev_blas_n_th_ = mkl_set_num_threads_local(n_th);
+#endif
+#ifdef _OPENMP
+  omp_set_num_threads(n_th);
+#endif
+}
+
+NumThreadsGuard::~NumThreadsGuard() {
+  if (prev_n_th_ == 0) {
+    return;
+  }
+#ifdef TT_BLAS_USE_MKL
+  mkl_set_num_threads_local(prev_blas_n_th_);
+#endif
+#ifdef _OPENMP
+  omp_set_num_threads(prev_n_th_);
+#endif
+}
+
 BlasProvider GetBlasProvider() {
 #ifdef TT_BLAS_USE_MKL
   return BlasProvider::MKL;
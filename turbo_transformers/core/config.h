@@ -12,6 +12,10 @@
 // See the AUTHORS file for names of contributors.
 
 #pragma once
+#include <cstdint>
+
+#include "turbo_transformers/core/macros.h"
+
 namespace turbo_transformers {
 namespace core {
 enum class BlasProvider {
@@ -23,6 +27,44 @@ BlasProvider GetBlasProvider();
 
 void SetNumThreads(int n_th);
 
+// Sets the OpenMP threads of the calling thread only, e.g. of a worker whose
+// pool is bound to a NUMA node, see core/numa.h. MKL takes the number as
+// the thread local setting of the BLAS too, OpenBLAS keeps its global one.
+void SetLocalNumThreads(int n_th);
+
+// The OpenMP threads the calling thread runs its kernels with.
+int GetLocalNumThreads();
+
+// The OpenMP threads of a CPU kernel loop over `work` units, roughly the
+// floats it reads and writes: a thread per GetMinParallelWork units, up to
+// the local threads. The loops over the few rows of a batch-1 request thus
+// run serially instead of spending more on the fork and join of a parallel
+// region than on the work.
+int ParallelThreadsFor(int64_t work);
+
+// The work a thread of a kernel loop gets at least, 8192 by default or the
+// environment variable TT_MIN_PARALLEL_WORK. 0 runs every loop on all the
+// local threads.
+int64_t GetMinParallelWork();
+void SetMinParallelWork(int64_t work);
+
+// Runs the kernels and the BLAS calls of the calling thread with `n_th`
+// threads for a scope, e.g. a call of a model with a thread count of its own,
+// and restores the previous setting afterwards. As SetLocalNumThreads, it
+// leaves the global pool of OpenBLAS alone, which an OpenMP build of
+// OpenBLAS sizes by the OpenMP threads of the caller. A non-positive
+// `n_th` keeps the current setting.
+class NumThreadsGuard {
+ public:
+  explicit NumThreadsGuard(int n_th);
+  ~NumThreadsGuard();
+
+ private:
+  int prev_n_th_{0};
+  int prev_blas_n_th_{0};
+  DISABLE_COPY_AND_ASSIGN(NumThreadsGuard);
+};
+
 constexpr bool IsCompiledWithCUDA() {
 #ifdef TT_WITH_CUDA
   return true;
@@ -0,0 +1,72 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/core/config.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "catch2/catch.hpp"
+
+namespace turbo_transformers {
+namespace core {
+
+TEST_CASE("config-num-threads-guard", "[config]") {
+  int n_th = GetLocalNumThreads();
+  {
+    NumThreadsGuard guard(3);
+#ifdef _OPENMP
+    REQUIRE(GetLocalNumThreads() == 3);
+#endif
+    {
+      // A non-positive count keeps the setting.
+      NumThreadsGuard keep(0);
+#ifdef _OPENMP
+      REQUIRE(GetLocalNumThreads() == 3);
+#endif
+    }
+  }
+  REQUIRE(GetLocalNumThreads() == n_th);
+}
+
+TEST_CASE("config-local-num-threads", "[config]") {
+  int n_th = GetLocalNumThreads();
+  int thread_n_th = 0;
+  std::thread thread([&] {
+    SetLocalNumThreads(2);
+    thread_n_th = GetLocalNumThreads();
+  });
+  thread.join();
+#ifdef _OPENMP
+  REQUIRE(thread_n_th == 2);
+#endif
+  // The setting of another thread leaves this one alone.
+  REQUIRE(GetLocalNumThreads() == n_th);
+}
+
+TEST_CASE("config-parallel-threads", "[config]") {
+  NumThreadsGuard guard(4);
+  int64_t min_work = GetMinParallelWork();
+  SetMinParallelWork(1000);
+  int n_th = GetLocalNumThreads();
+  REQUIRE(ParallelThreadsFor(10) == 1);
+  REQUIRE(ParallelThreadsFor(2500) == std::min(n_th, 2));
+  REQUIRE(ParallelThreadsFor(1000000) == n_th);
+  SetMinParallelWork(0);
+  REQUIRE(ParallelThreadsFor(10) == n_th);
+  REQUIRE_THROWS(SetMinParallelWork(-1));
+  SetMinParallelWork(min_work);
+}
+
+}  // namespace core
+}  // namespace turbo_transformers
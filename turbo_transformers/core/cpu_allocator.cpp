@@ -0,0 +1,353 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/core/cpu_allocator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "turbo_transformers/core/enforce.h"
+#include "turbo_transformers/core/metrics.h"
+
+namespace turbo_transformers {
+namespace core {
+
+namespace {
+constexpr size_t kAlignment = 64;
+// Every block starts with a header recording its size class, the user
+// pointer lies right behind it so it keeps the 64 bytes alignment.
+constexpr size_t kHeaderSize = kAlignment;
+constexpr uint32_t kMagic = 0x54544d41;  // "TTMA"
+constexpr int kUncachedClass = -1;
+constexpr size_t kMinBlockBytes = 256;
+constexpr size_t kMaxBlockBytes = size_t(256) << 20;
+
+struct ThreadCache;
+
+struct BlockHeader {
+  uint32_t magic;
+  int32_t size_class;
+  size_t block_bytes;
+  // The bytes mapped by MAP_HUGETLB, 0 for the blocks of posix_memalign.
+  size_t mapped_bytes;
+  // The cache of the thread which allocated the block, which receives it
+  // back when another thread frees it.
+  ThreadCache *owner;
+};
+static_assert(sizeof(BlockHeader) <= kHeaderSize, "header overflows");
+
+// Size classes 2^k * {4/4, 5/4, 6/4, 7/4}, which bounds the internal
+// fragmentation by 25% while keeping the classes few.
+std::vector<size_t> InitSizeClasses() {
+  std::vector<size_t> classes;
+  for (size_t base = kMinBlockBytes; base <= kMaxBlockBytes; base <<= 1) {
+    for (size_t quarter = 4; quarter < 8; ++quarter) {
+      size_t bytes = base / 4 * quarter;
+      if (bytes > kMaxBlockBytes) {
+        break;
+      }
+      classes.push_back(bytes);
+    }
+  }
+  return classes;
+}
+
+const std::vector<size_t> &SizeClasses() {
+  static const std::vector<size_t> classes = InitSizeClasses();
+  return classes;
+}
+
+BlockHeader *HeaderOf(void *memory) {
+  return reinterpret_cast<BlockHeader *>(reinterpret_cast<char *>(memory) -
+                                         kHeaderSize);
+}
+
+// Kept outside of the singleton, as the cache limit below.
+std::atomic<bool> g_huge_pages{false};
+std::atomic<size_t> g_huge_page_min_bytes{CPUAllocator::kHugePageBytes};
+
+// Allocates `bytes` on huge pages, returning the bytes mapped by MAP_HUGETLB
+// in `*mapped_bytes`, or 0 if the block was aligned and advised instead.
+// Returns null if the alignment failed, and the block is allocated as usual.
+void *HugePageAlloc(size_t bytes, size_t *mapped_bytes) {
+  constexpr size_t kPage = CPUAllocator::kHugePageBytes;
+  size_t rounded = (bytes + kPage - 1) / kPage * kPage;
+  *mapped_bytes = 0;
+#ifdef __linux__
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_2MB
+  flags |= MAP_HUGE_2MB;
+#endif
+  void *mapped =
+      mmap(nullptr, rounded, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (mapped != MAP_FAILED) {
+    AddToCounter(Counter::kHugePageBytes, rounded);
+    *mapped_bytes = rounded;
+    return mapped;
+  }
+  // No pool of huge pages, or an exhausted one.
+  void *base = nullptr;
+  if (posix_memalign(&base, kPage, bytes) != 0) {
+    return nullptr;
+  }
+  // Without transparent huge pages the advice fails, and the aligned block
+  // keeps the pages of 4 KB.
+  if (madvise(base, bytes, MADV_HUGEPAGE) == 0) {
+    AddToCounter(Counter::kHugePageBytes, bytes);
+  }
+  return base;
+#else
+  (void)rounded;
+  return nullptr;
+#endif
+}
+
+void *SystemAlloc(size_t block_bytes, int size_class) {
+  void *base = nullptr;
+  size_t mapped_bytes = 0;
+  size_t bytes = block_bytes + kHeaderSize;
+  if (g_huge_pages.load(std::memory_order_relaxed) &&
+      bytes >= g_huge_page_min_bytes.load(std::memory_order_relaxed)) {
+    base = HugePageAlloc(bytes, &mapped_bytes);
+  }
+  if (base == nullptr && posix_memalign(&base, kAlignment, bytes) != 0) {
+    return nullptr;
+  }
+  auto *header = reinterpret_cast<BlockHeader *>(base);
+  header->magic = kMagic;
+  header->size_class = size_class;
+  header->block_bytes = block_bytes;
+  header->mapped_bytes = mapped_bytes;
+  header->owner = nullptr;
+  return reinterpret_cast<char *>(base) + kHeaderSize;
+}
+
+void SystemFree(void *memory) {
+  BlockHeader *header = HeaderOf(memory);
+#ifdef __linux__
+  if (header->mapped_bytes != 0) {
+    munmap(header, header->mapped_bytes);
+    return;
+  }
+#endif
+  std::free(header);
+}
+
+// Kept outside of the singleton, since tensors owned by static objects may be
+// released after the allocator itself has been destroyed.
+std::atomic<size_t> g_max_cached_bytes{size_t(1) << 30};
+
+// The live caches of the threads, which the frees of the other threads and
+// free_all_cache reach. The mutex is taken before those of the caches.
+struct CacheRegistry {
+  std::mutex mutex;
+  std::unordered_set<ThreadCache *> caches;
+};
+
+CacheRegistry &Registry() {
+  // Leaked, as the caches of the threads may outlive the static objects.
+  static auto *registry = new CacheRegistry;
+  return *registry;
+}
+
+struct ThreadCache {
+  ThreadCache() : free_lists(SizeClasses().size()) {
+    auto &registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.caches.insert(this);
+  }
+
+  ~ThreadCache() {
+    auto &registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.caches.erase(this);
+    Clear();
+  }
+
+  // Returns a cached block of `size_class`, or null.
+  void *Pop(int size_class) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &blocks = free_lists[size_class];
+    if (blocks.empty()) {
+      return nullptr;
+    }
+    void *block = blocks.back();
+    blocks.pop_back();
+    cached_bytes -= HeaderOf(block)->block_bytes;
+    return block;
+  }
+
+  // Caches `block` unless the cache is full, and returns whether it did.
+  bool Push(void *block) {
+    BlockHeader *header = HeaderOf(block);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (cached_bytes + header->block_bytes >
+        g_max_cached_bytes.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    free_lists[header->size_class].push_back(block);
+    cached_bytes += header->block_bytes;
+    return true;
+  }
+
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &blocks : free_lists) {
+      for (void *block : blocks) {
+        SystemFree(block);
+      }
+      blocks.clear();
+    }
+    cached_bytes = 0;
+  }
+
+  // Uncontended but for the frees of the other threads and free_all_cache.
+  std::mutex mutex;
+  std::vector<std::vector<void *>> free_lists;
+  size_t cached_bytes{0};
+};
+
+// The flag is trivially destructible, so it is still readable when tensors
+// owned by static objects are released after the thread cache is gone.
+thread_local bool tls_cache_destroyed = false;
+
+struct ThreadCacheHolder {
+  ~ThreadCacheHolder() { tls_cache_destroyed = true; }
+  ThreadCache cache;
+};
+
+ThreadCache *GetThreadCache() {
+  if (tls_cache_destroyed) {
+    return nullptr;
+  }
+  static thread_local ThreadCacheHolder holder;
+  return &holder.cache;
+}
+}  // namespace
+
+struct CPUAllocator::AllocatorImpl {
+  static void *alloc(size_t size) {
+    auto &classes = SizeClasses();
+    auto iter = std::lower_bound(classes.begin(), classes.end(), size);
+    if (iter == classes.end()) {
+      AddToCounter(Counter::kAllocatorMisses, 1);
+      return SystemAlloc(size, kUncachedClass);
+    }
+    int size_class = static_cast<int>(iter - classes.begin());
+    ThreadCache *cache = GetThreadCache();
+    void *block = cache == nullptr ? nullptr : cache->Pop(size_class);
+    if (block != nullptr) {
+      AddToCounter(Counter::kAllocatorHits, 1);
+    } else {
+      AddToCounter(Counter::kAllocatorMisses, 1);
+      block = SystemAlloc(*iter, size_class);
+    }
+    if (block != nullptr) {
+      HeaderOf(block)->owner = cache;
+    }
+    return block;
+  }
+
+  static void free(void *memory) {
+    BlockHeader *header = HeaderOf(memory);
+    TT_ENFORCE_EQ(header->magic, kMagic,
+                  "The memory is not allocated by CPUAllocator");
+    if (header->size_class == kUncachedClass || header->owner == nullptr) {
+      SystemFree(memory);
+      return;
+    }
+    if (header->owner == GetThreadCache()) {
+      if (!header->owner->Push(memory)) {
+        SystemFree(memory);
+      }
+      return;
+    }
+    // Another thread allocated the block, e.g. the output of a serving
+    // worker freed by the caller. It goes back to the cache of that thread,
+    // so that a thread which only frees does not hoard the blocks, unless
+    // the thread has exited.
+    {
+      auto &registry = Registry();
+      std::lock_guard<std::mutex> lock(registry.mutex);
+      if (registry.caches.count(header->owner) != 0 &&
+          header->owner->Push(memory)) {
+        return;
+      }
+    }
+    SystemFree(memory);
+  }
+
+  static void free_all_cache() {
+    auto &registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (ThreadCache *cache : registry.caches) {
+      cache->Clear();
+    }
+  }
+};
+
+// Defined for the references taken to it before C++17.
+constexpr size_t CPUAllocator::kHugePageBytes;
+
+CPUAllocator::CPUAllocator() : allocator_(new AllocatorImpl()) {}
+
+CPUAllocator::~CPUAllocator() = default;
+
+void *CPUAllocator::allocate(size_t size) {
+  void *memory = AllocatorImpl::alloc(size);
+  if (memory == nullptr) {
+    AllocatorImpl::free_all_cache();
+    memory = AllocatorImpl::alloc(size);
+  }
+  if (memory == nullptr) {
+    TT_THROW_OUT_OF_MEMORY("Cannot allocate %d bytes of host memory", size);
+  }
+  return memory;
+}
+
+void CPUAllocator::free(void *memory) {
+  if (memory == nullptr) {
+    return;
+  }
+  AllocatorImpl::free(memory);
+}
+
+void CPUAllocator::free_all_cache() { AllocatorImpl::free_all_cache(); }
+
+void CPUAllocator::set_max_cached_bytes_per_thread(size_t bytes) {
+  g_max_cached_bytes.store(bytes, std::memory_order_relaxed);
+}
+
+size_t CPUAllocator::max_cached_bytes_per_thread() const {
+  return g_max_cached_bytes.load(std::memory_order_relaxed);
+}
+
+void CPUAllocator::set_huge_pages(bool enable, size_t min_bytes) {
+  g_huge_page_min_bytes.store(min_bytes, std::memory_order_relaxed);
+  g_huge_pages.store(enable, std::memory_order_relaxed);
+}
+
+bool CPUAllocator::huge_pages() const {
+  return g_huge_pages.load(std::memory_order_relaxed);
+}
+
+}  // namespace core
+}  // namespace turbo_transformers
@@ -0,0 +1,73 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cstddef>
+#include <memory>
+
+#include "macros.h"
+
+namespace turbo_transformers {
+namespace core {
+
+// A caching allocator for host memory, the CPU counterpart of CUDAAllocator.
+// Requests are rounded up to a size class (four classes per power of two) and
+// freed blocks are kept in a per-thread free list, so the steady-state
+// inference loop does not hit posix_memalign/free or fault in fresh pages.
+// A block freed by another thread than the one which allocated it returns to
+// the list of that thread. Blocks larger than the biggest size class are not
+// cached.
+class CPUAllocator {
+ public:
+  ~CPUAllocator();
+
+  static CPUAllocator &GetInstance() {
+    static CPUAllocator instance;
+    return instance;
+  }
+
+  // The returned memory is aligned to 64 bytes.
+  void *allocate(size_t size);
+
+  void free(void *memory);
+
+  // Release the blocks cached by all the threads back to the system.
+  void free_all_cache();
+
+  // The upper bound of bytes each thread may keep in its cache.
+  void set_max_cached_bytes_per_thread(size_t bytes);
+  size_t max_cached_bytes_per_thread() const;
+
+  // Back the blocks of at least `min_bytes` by 2 MB pages, which saves the
+  // GEMMs streaming through the weights and the activation arena most of
+  // their TLB misses. A block is mapped from the pool of huge pages reserved
+  // by vm.nr_hugepages with MAP_HUGETLB, or else aligned to 2 MB and advised
+  // by madvise(MADV_HUGEPAGE) to the transparent huge pages, or else
+  // allocated as usual. It applies to the blocks allocated afterwards, so it
+  // should be enabled before the models are loaded.
+  void set_huge_pages(bool enable, size_t min_bytes = kHugePageBytes);
+  bool huge_pages() const;
+
+  static constexpr size_t kHugePageBytes = size_t(2) << 20;
+
+ private:
+  CPUAllocator();
+
+  struct AllocatorImpl;
+  std::unique_ptr<AllocatorImpl> allocator_;
+
+  DISABLE_COPY_AND_ASSIGN(CPUAllocator);
+};
+
+}  // namespace core
+}  // namespace turbo_transformers
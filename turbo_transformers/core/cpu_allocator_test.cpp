@@ -0,0 +1,143 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+#include "turbo_transformers/core/cpu_allocator.h"
+
+#include <cstdint>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/tensor.h"
+
+namespace turbo_transformers {
+namespace core {
+
+TEST_CASE("cpu_allocator-reuse", "[cpu_allocator]") {
+  auto &allocator = CPUAllocator::GetInstance();
+  allocator.free_all_cache();
+  void *first = allocator.allocate(1000);
+  REQUIRE(reinterpret_cast<uintptr_t>(first) % 64 == 0);
+  allocator.free(first);
+  // 1000 and 1020 bytes fall into the same size class.
+  void *second = allocator.allocate(1020);
+  REQUIRE(second == first);
+  allocator.free(second);
+  allocator.free_all_cache();
+}
+
+TEST_CASE("cpu_allocator-cache_limit", "[cpu_allocator]") {
+  auto &allocator = CPUAllocator::GetInstance();
+  auto old_limit = allocator.max_cached_bytes_per_thread();
+  allocator.free_all_cache();
+  allocator.set_max_cached_bytes_per_thread(0);
+  void *memory = allocator.allocate(4096);
+  std::fill_n(reinterpret_cast<char *>(memory), 4096, 1);
+  allocator.free(memory);
+  allocator.set_max_cached_bytes_per_thread(old_limit);
+}
+
+TEST_CASE("cpu_allocator-tensor_reuse", "[cpu_allocator]") {
+  CPUAllocator::GetInstance().free_all_cache();
+  const void *data = nullptr;
+  {
+    Tensor tensor(NewDLPackTensorT<float>({128, 768}));
+    data = tensor.data<float>();
+  }
+  Tensor tensor(NewDLPackTensorT<float>({128, 768}));
+  REQUIRE(tensor.data<float>() == data);
+}
+
+TEST_CASE("cpu_allocator-huge_pages", "[cpu_allocator]") {
+  auto &allocator = CPUAllocator::GetInstance();
+  allocator.free_all_cache();
+  allocator.set_huge_pages(true);
+  REQUIRE(allocator.huge_pages());
+  size_t size = 3 * CPUAllocator::kHugePageBytes;
+  auto *memory = reinterpret_cast<char *>(allocator.allocate(size));
+  // The block is mapped or aligned to a huge page, and starts after the
+  // header of the allocator in it.
+  REQUIRE(reinterpret_cast<uintptr_t>(memory) % 64 == 0);
+  REQUIRE(reinterpret_cast<uintptr_t>(memory) %
+              CPUAllocator::kHugePageBytes ==
+          64);
+  std::fill_n(memory, size, 1);
+  allocator.free(memory);
+  // The small blocks keep the pages of 4 KB.
+  void *small = allocator.allocate(4096);
+  REQUIRE(reinterpret_cast<uintptr_t>(small) % 64 == 0);
+  allocator.free(small);
+  allocator.free_all_cache();
+  allocator.set_huge_pages(false);
+  REQUIRE(!allocator.huge_pages());
+}
+
+TEST_CASE("cpu_allocator-multiple_threads", "[cpu_allocator]") {
+  auto &allocator = CPUAllocator::GetInstance();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&allocator, t] {
+      for (int i = 0; i < 100; ++i) {
+        size_t size = (i % 17 + 1) * 1024 + t;
+        auto *memory = reinterpret_cast<char *>(allocator.allocate(size));
+        memory[0] = memory[size - 1] = static_cast<char>(i);
+        allocator.free(memory);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+TEST_CASE("cpu_allocator-cross_thread_free", "[cpu_allocator]") {
+  auto &allocator = CPUAllocator::GetInstance();
+  allocator.free_all_cache();
+  // Freed by another thread, the block returns to the cache of this one.
+  void *memory = allocator.allocate(1000);
+  std::thread([&allocator, memory] { allocator.free(memory); }).join();
+  void *reused = allocator.allocate(1000);
+  REQUIRE(reused == memory);
+  allocator.free(reused);
+
+  // Allocated by a thread which has exited, the block goes to the system.
+  void *orphan = nullptr;
+  std::thread([&allocator, &orphan] { orphan = allocator.allocate(2000); })
+      .join();
+  allocator.free(orphan);
+  allocator.free_all_cache();
+}
+
+TEST_CASE("cpu_allocator-free_all_threads", "[cpu_allocator]") {
+  auto &allocator = CPUAllocator::GetInstance();
+  std::promise<void> cached, cleared;
+  int64_t misses = 0;
+  std::thread worker([&] {
+    allocator.free(allocator.allocate(3000));
+    cached.set_value();
+    cleared.get_future().wait();
+    // The block cached by the worker was released by the main thread.
+    int64_t before = GetMetrics().allocator_misses;
+    allocator.free(allocator.allocate(3000));
+    misses = GetMetrics().allocator_misses - before;
+  });
+  cached.get_future().wait();
+  allocator.free_all_cache();
+  cleared.set_value();
+  worker.join();
+  REQUIRE(misses == 1);
+}
+
+}  // namespace core
+}  // namespace turbo_transformers
@@ -0,0 +1,100 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/core/cpu_isa.h"
+
+#include <atomic>
+#include <cstdlib>
+
+#include "turbo_transformers/core/enforce.h"
+
+namespace turbo_transformers {
+namespace core {
+
+namespace {
+constexpr CPUIsa kAllIsas[] = {CPUIsa::kScalar, CPUIsa::kNEON, CPUIsa::kAVX2,
+                               CPUIsa::kAVX512};
+
+CPUIsa DetectCPUIsa() {
+#if defined(__GNUC__) && defined(__x86_64__)
+  if (__builtin_cpu_supports("avx512f")) {
+    return CPUIsa::kAVX512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return CPUIsa::kAVX2;
+  }
+  return CPUIsa::kScalar;
+#elif defined(__aarch64__)
+  return CPUIsa::kNEON;
+#else
+  return CPUIsa::kScalar;
+#endif
+}
+
+std::atomic<CPUIsa> &SelectedCPUIsa() {
+  static std::atomic<CPUIsa> isa([] {
+    if (const char *name = std::getenv("TT_CPU_ISA")) {
+      auto isa = ParseCPUIsa(name);
+      TT_ENFORCE(IsCPUIsaSupported(isa),
+                 "TT_CPU_ISA=%s is not supported by this CPU", name);
+      return isa;
+    }
+    return DetectCPUIsa();
+  }());
+  return isa;
+}
+}  // namespace
+
+bool IsCPUIsaSupported(CPUIsa isa) {
+  static const CPUIsa best = DetectCPUIsa();
+  if (isa == CPUIsa::kScalar || isa == best) {
+    return true;
+  }
+  // AVX-512 implies AVX2, the ARM and x86 ISAs exclude each other.
+  return isa == CPUIsa::kAVX2 && best == CPUIsa::kAVX512;
+}
+
+CPUIsa GetCPUIsa() { return SelectedCPUIsa().load(std::memory_order_relaxed); }
+
+void SetCPUIsa(CPUIsa isa) {
+  TT_ENFORCE(IsCPUIsaSupported(isa), "The CPU does not support %s",
+             CPUIsaName(isa));
+  SelectedCPUIsa().store(isa, std::memory_order_relaxed);
+}
+
+const char *CPUIsaName(CPUIsa isa) {
+  switch (isa) {
+    case CPUIsa::kScalar:
+      return "scalar";
+    case CPUIsa::kNEON:
+      return "neon";
+    case CPUIsa::kAVX2:
+      return "avx2";
+    case CPUIsa::kAVX512:
+      return "avx512";
+  }
+  return "unknown";
+}
+
+CPUIsa ParseCPUIsa(const std::string &name) {
+  for (auto isa : kAllIsas) {
+    if (name == CPUIsaName(isa)) {
+      return isa;
+    }
+  }
+  TT_THROW("Unknown CPU ISA %s, expected scalar, neon, avx2 or avx512",
+           name.c_str());
+}
+
+}  // namespace core
+}  // namespace turbo_transformers
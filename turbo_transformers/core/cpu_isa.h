@@ -0,0 +1,47 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <string>
+
+namespace turbo_transformers {
+namespace core {
+
+// The instruction sets the hand-vectorized CPU kernels are compiled for, see
+// layers/kernels/cpu_vector_kernels.h. The binary itself may be built for an
+// older CPU, the kernels of the selected ISA are picked at runtime.
+enum class CPUIsa {
+  kScalar = 0,  // portable C++, vectorized as far as the build flags allow
+  kNEON = 1,    // aarch64
+  kAVX2 = 2,    // x86-64 with AVX2 and FMA
+  kAVX512 = 3,  // x86-64 with AVX-512F
+};
+
+// The ISA the CPU kernels use, by default the best one of this CPU. It can be
+// lowered with the environment variable TT_CPU_ISA, which takes "scalar",
+// "neon", "avx2" or "avx512", e.g. to compare the results or the speed.
+CPUIsa GetCPUIsa();
+
+// Overrides the ISA for the following calls. It throws if the CPU does not
+// support `isa`.
+void SetCPUIsa(CPUIsa isa);
+
+bool IsCPUIsaSupported(CPUIsa isa);
+
+const char *CPUIsaName(CPUIsa isa);
+
+// The inverse of CPUIsaName, which throws for unknown names.
+CPUIsa ParseCPUIsa(const std::string &name);
+
+}  // namespace core
+}  // namespace turbo_transformers
@@ -0,0 +1,46 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/core/cpu_isa.h"
+
+#include "catch2/catch.hpp"
+
+namespace turbo_transformers {
+namespace core {
+
+TEST_CASE("cpu_isa-names", "[cpu_isa]") {
+  for (auto isa :
+       {CPUIsa::kScalar, CPUIsa::kNEON, CPUIsa::kAVX2, CPUIsa::kAVX512}) {
+    REQUIRE(ParseCPUIsa(CPUIsaName(isa)) == isa);
+  }
+  REQUIRE_THROWS(ParseCPUIsa("sse2"));
+}
+
+TEST_CASE("cpu_isa-select", "[cpu_isa]") {
+  auto selected = GetCPUIsa();
+  REQUIRE(IsCPUIsaSupported(selected));
+  REQUIRE(IsCPUIsaSupported(CPUIsa::kScalar));
+  for (auto isa :
+       {CPUIsa::kScalar, CPUIsa::kNEON, CPUIsa::kAVX2, CPUIsa::kAVX512}) {
+    if (IsCPUIsaSupported(isa)) {
+      SetCPUIsa(isa);
+      REQUIRE(GetCPUIsa() == isa);
+    } else {
+      REQUIRE_THROWS(SetCPUIsa(isa));
+    }
+  }
+  SetCPUIsa(selected);
+}
+
+}  // namespace core
+}  // namespace turbo_transformers
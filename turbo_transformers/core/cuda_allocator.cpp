@@ -13,63 +13,260 @@
 #include "turbo_transformers/core/cuda_allocator.h"
 #include <cuda_runtime.h>
 
-#include <cub/util_allocator.cuh>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "turbo_transformers/core/cuda_device_context.h"
+#include "turbo_transformers/core/cuda_enforce.cuh"
+#include "turbo_transformers/core/enforce.h"
+#include "turbo_transformers/core/metrics.h"
 
 namespace turbo_transformers {
 namespace core {
 
-struct BadAlloc : public std::exception {
-  explicit BadAlloc(std::string err_msg) : err_str_(err_msg) {}
-
-  const char *what() const noexcept override { return err_str_.c_str(); }
+namespace {
+struct Block {
+  void *data;
+  size_t size;
+  // The stream of the allocation. The event is recorded on it when the
+  // block is freed, so that other streams know when it is safe to reuse.
+  cudaStream_t stream;
+  cudaEvent_t event;
+};
 
-  std::string err_str_;
+struct DeviceCache {
+  std::unordered_map<void *, Block> live_blocks;
+  std::multimap<size_t, Block> free_blocks;
+  CUDAMemoryStats stats;
 };
+}  // namespace
 
 struct CUDAAllocator::AllocatorImpl {
-  void *alloc(size_t size) {
-    static auto stream = core::CUDADeviceContext::GetInstance().stream();
-    void *data = nullptr;
-    cudaError_t result = cub_allocator.DeviceAllocate(&data, size, stream);
-    if (result != cudaSuccess) {
-      throw BadAlloc("DeviceAllocate failed.");
+  AllocatorImpl() { SetConfig(CUDAAllocatorConfig()); }
+
+  void SetConfig(const CUDAAllocatorConfig &config) {
+    TT_ENFORCE_GE(config.bin_growth, 2u, "The bin growth should be at least 2");
+    TT_ENFORCE_LE(config.min_bin, config.max_bin,
+                  "The min bin %d is larger than the max bin %d",
+                  config.min_bin, config.max_bin);
+    std::vector<size_t> bin_sizes;
+    size_t bin_size = 1;
+    for (unsigned int k = 0; k <= config.max_bin; ++k) {
+      if (k >= config.min_bin) {
+        bin_sizes.push_back(bin_size);
+      }
+      TT_ENFORCE_LE(bin_size, SIZE_MAX / config.bin_growth,
+                    "The max bin %d is too large", config.max_bin);
+      bin_size *= config.bin_growth;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    config_ = config;
+    bin_sizes_ = std::move(bin_sizes);
+  }
+
+  CUDAAllocatorConfig GetConfig() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return config_;
+  }
+
+  void *alloc(size_t size, int device_id) {
+    auto stream = CUDADeviceContext::GetInstance(device_id).stream();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &cache = devices_[device_id];
+    size_t block_size = GetBlockSize(size);
+
+    auto range = cache.free_blocks.equal_range(block_size);
+    auto found = std::find_if(range.first, range.second, [&](const auto &b) {
+      return b.second.stream == stream;
+    });
+    if (found == range.second) {
+      found = std::find_if(range.first, range.second, [](const auto &b) {
+        return cudaEventQuery(b.second.event) == cudaSuccess;
+      });
+    }
+    Block block;
+    if (found != range.second) {
+      block = found->second;
+      block.stream = stream;
+      cache.free_blocks.erase(found);
+      cache.stats.cached_bytes -= block_size;
+      AddToCounter(Counter::kAllocatorHits, 1);
+    } else {
+      block = NewBlockLocked(&cache, block_size, device_id, stream);
+      AddToCounter(Counter::kAllocatorMisses, 1);
+    }
+    cache.live_blocks.emplace(block.data, block);
+    auto &stats = cache.stats;
+    stats.allocated_bytes += block_size;
+    stats.peak_allocated_bytes =
+        std::max(stats.peak_allocated_bytes, stats.allocated_bytes);
+    return block.data;
+  }
+
+  void free(void *data, int device_id) {
+    CUDADeviceContext::GetInstance(device_id);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &cache = devices_[device_id];
+    auto iter = cache.live_blocks.find(data);
+    TT_ENFORCE(iter != cache.live_blocks.end(),
+               "The memory is not allocated by CUDAAllocator on the GPU %d",
+               device_id);
+    Block block = iter->second;
+    cache.live_blocks.erase(iter);
+    cache.stats.allocated_bytes -= block.size;
+    cudaError_t result;
+    if (IsBinSize(block.size) &&
+        cache.stats.cached_bytes + block.size <= config_.max_cached_bytes) {
+      result = cudaEventRecord(block.event, block.stream);
+      cache.free_blocks.emplace(block.size, block);
+      cache.stats.cached_bytes += block.size;
+    } else {
+      cudaEventDestroy(block.event);
+      result = cudaFree(block.data);
+    }
+    // The runtime may have been unloaded when the static tensors are freed at
+    // exit.
+    if (result != cudaErrorCudartUnloading) {
+      TT_ENFORCE_CUDA_SUCCESS(result);
     }
-    return data;
   }
 
-  void free(void *data) {
-    try {
-      cudaError_t result = cub_allocator.DeviceFree(data);
-      if (result != cudaErrorCudartUnloading && result != cudaSuccess) {
-        throw std::runtime_error("DeviceFree failed ");
+  CUDAMemoryStats GetStats(int device_id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = devices_.find(device_id);
+    return iter == devices_.end() ? CUDAMemoryStats() : iter->second.stats;
+  }
+
+  void ResetPeakStats(int device_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &stats = devices_[device_id].stats;
+    stats.peak_allocated_bytes = stats.allocated_bytes;
+  }
+
+  void free_all_cache() {
+    std::vector<int> device_ids;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto &device : devices_) {
+        device_ids.push_back(device.first);
       }
-    } catch (...) {
+    }
+    for (int device_id : device_ids) {
+      CUDADeviceContext::GetInstance(device_id);
+      std::lock_guard<std::mutex> lock(mutex_);
+      FreeCacheLocked(&devices_[device_id]);
     }
   }
 
-  void free_all_cache() { cub_allocator.FreeAllCached(); }
+  ~AllocatorImpl() {
+    // The CUDA runtime may have been unloaded, ignore the errors.
+    for (auto &device : devices_) {
+      cudaSetDevice(device.first);
+      for (auto &free_block : device.second.free_blocks) {
+        cudaEventDestroy(free_block.second.event);
+        cudaFree(free_block.second.data);
+      }
+    }
+  }
 
-  ~AllocatorImpl() { cub_allocator.FreeAllCached(); }
+ private:
+  size_t GetBlockSize(size_t size) const {
+    auto iter = std::lower_bound(bin_sizes_.begin(), bin_sizes_.end(), size);
+    return iter == bin_sizes_.end() ? size : *iter;
+  }
 
-  cub::CachingDeviceAllocator cub_allocator;
+  // Only the blocks of the current bins are cached, the blocks of the
+  // oversized requests or of a previous config are not.
+  bool IsBinSize(size_t size) const {
+    return std::binary_search(bin_sizes_.begin(), bin_sizes_.end(), size);
+  }
+
+  Block NewBlockLocked(DeviceCache *cache, size_t size, int device_id,
+                       cudaStream_t stream) {
+    auto &stats = cache->stats;
+    if (config_.memory_limit != 0 &&
+        stats.allocated_bytes + stats.cached_bytes + size >
+            config_.memory_limit) {
+      FreeCacheLocked(cache);
+    }
+    if (config_.memory_limit != 0 &&
+        stats.allocated_bytes + size > config_.memory_limit) {
+      TT_THROW_OUT_OF_MEMORY(
+          "Allocating %d bytes on the GPU %d exceeds the memory limit, %d of "
+          "%d bytes are in use",
+          size, device_id, stats.allocated_bytes, config_.memory_limit);
+    }
+
+    Block block{nullptr, size, stream, nullptr};
+    if (cudaMalloc(&block.data, size) != cudaSuccess) {
+      // Clear the error, and retry after returning the cache to the driver.
+      cudaGetLastError();
+      FreeCacheLocked(cache);
+      auto status = cudaMalloc(&block.data, size);
+      if (status == cudaErrorMemoryAllocation) {
+        cudaGetLastError();
+        TT_THROW_OUT_OF_MEMORY("Cannot allocate %d bytes on the GPU %d, %d "
+                               "bytes are in use",
+                               size, device_id, stats.allocated_bytes);
+      }
+      TT_ENFORCE_CUDA_SUCCESS(status);
+    }
+    TT_ENFORCE_CUDA_SUCCESS(
+        cudaEventCreateWithFlags(&block.event, cudaEventDisableTiming));
+    ++stats.num_device_allocs;
+    return block;
+  }
+
+  // The current device should be the device of `cache`.
+  void FreeCacheLocked(DeviceCache *cache) {
+    for (auto &free_block : cache->free_blocks) {
+      TT_ENFORCE_CUDA_SUCCESS(cudaEventDestroy(free_block.second.event));
+      TT_ENFORCE_CUDA_SUCCESS(cudaFree(free_block.second.data));
+    }
+    cache->free_blocks.clear();
+    cache->stats.cached_bytes = 0;
+  }
+
+  mutable std::mutex mutex_;
+  CUDAAllocatorConfig config_;
+  // The ascending sizes of the bins.
+  std::vector<size_t> bin_sizes_;
+  std::map<int, DeviceCache> devices_;
 };
 
 CUDAAllocator::CUDAAllocator() : allocator_(new AllocatorImpl()) {}
 
 CUDAAllocator::~CUDAAllocator() = default;
 
-void *CUDAAllocator::allocate(size_t size) {
-  try {
-    return allocator_->alloc(size);
-  } catch (BadAlloc &) {
-    allocator_->free_all_cache();
-    return allocator_->alloc(size);
-  }
+void *CUDAAllocator::allocate(size_t size, int device_id) {
+  return allocator_->alloc(size, device_id);
+}
+
+void CUDAAllocator::free(void *memory, int device_id) {
+  allocator_->free(memory, device_id);
+}
+
+void CUDAAllocator::set_config(const CUDAAllocatorConfig &config) {
+  allocator_->SetConfig(config);
+  allocator_->free_all_cache();
+}
+
+CUDAAllocatorConfig CUDAAllocator::config() const {
+  return allocator_->GetConfig();
+}
+
+CUDAMemoryStats CUDAAllocator::stats(int device_id) const {
+  return allocator_->GetStats(device_id);
+}
+
+void CUDAAllocator::reset_peak_stats(int device_id) {
+  allocator_->ResetPeakStats(device_id);
 }
 
-void CUDAAllocator::free(void *memory) { allocator_->free(memory); }
+void CUDAAllocator::free_all_cache() { allocator_->free_all_cache(); }
 
 }  // namespace core
 }  // namespace turbo_transformers
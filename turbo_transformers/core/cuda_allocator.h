@@ -14,6 +14,7 @@
 #pragma once
 #include <memory.h>
 
+#include <cstddef>
 #include <map>
 #include <memory>
 
@@ -22,6 +23,33 @@
 namespace turbo_transformers {
 namespace core {
 
+// How CUDAAllocator caches the device memory. A request is rounded up to the
+// nearest bin of bin_growth^k bytes, min_bin <= k <= max_bin, so that a freed
+// block serves the later requests of similar sizes. The requests larger than
+// the largest bin are served with blocks of their exact size. A smaller
+// bin_growth wastes less memory, at the cost of fewer cache hits.
+struct CUDAAllocatorConfig {
+  unsigned int bin_growth{8};
+  unsigned int min_bin{3};
+  unsigned int max_bin{7};
+  // The bytes kept for reuse per device, the blocks freed beyond it are
+  // returned to the driver.
+  size_t max_cached_bytes{3 * 2097152 - 1};
+  // The limit of the allocated and cached bytes per device, 0 for no limit.
+  // The cache is emptied before an allocation exceeds it, and the allocation
+  // fails afterwards.
+  size_t memory_limit{0};
+};
+
+// Bytes are counted in the sizes of the blocks, i.e. after the rounding.
+struct CUDAMemoryStats {
+  size_t allocated_bytes{0};
+  size_t cached_bytes{0};
+  size_t peak_allocated_bytes{0};
+  // The calls of cudaMalloc, i.e. the allocations not served by the cache.
+  size_t num_device_allocs{0};
+};
+
 class CUDAAllocator {
  public:
   ~CUDAAllocator();
@@ -31,9 +59,22 @@ class CUDAAllocator {
     return instance;
   }
 
-  void *allocate(size_t size);
+  // The memory is associated with the current stream of `device_id`, see
+  // CUDADeviceContext. Once freed, it is reused by the other streams only
+  // after the work queued on that stream has completed.
+  void *allocate(size_t size, int device_id);
+
+  void free(void *memory, int device_id);
+
+  // The blocks in use keep their sizes, the cache is emptied.
+  void set_config(const CUDAAllocatorConfig &config);
+  CUDAAllocatorConfig config() const;
+
+  CUDAMemoryStats stats(int device_id) const;
+  void reset_peak_stats(int device_id);
 
-  void free(void *memory);
+  // Return the cached blocks of all the devices to the driver.
+  void free_all_cache();
 
  private:
   CUDAAllocator();
@@ -0,0 +1,73 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#ifdef TT_WITH_CUDA
+#include "turbo_transformers/core/cuda_allocator.h"
+#endif
+#include "catch2/catch.hpp"
+
+namespace turbo_transformers {
+namespace core {
+
+#ifdef TT_WITH_CUDA
+TEST_CASE("cuda_allocator-bins", "[cuda_allocator]") {
+  auto &allocator = CUDAAllocator::GetInstance();
+  auto old_config = allocator.config();
+  CUDAAllocatorConfig config;
+  config.bin_growth = 2;
+  config.min_bin = 10;
+  config.max_bin = 20;
+  config.max_cached_bytes = 1 << 20;
+  allocator.set_config(config);
+  allocator.reset_peak_stats(0);
+  auto base = allocator.stats(0);
+
+  void *first = allocator.allocate(1500, 0);
+  REQUIRE(allocator.stats(0).allocated_bytes == base.allocated_bytes + 2048);
+  allocator.free(first, 0);
+  REQUIRE(allocator.stats(0).cached_bytes == 2048);
+  // 1500 and 2000 bytes fall into the same bin.
+  void *second = allocator.allocate(2000, 0);
+  REQUIRE(second == first);
+  REQUIRE(allocator.stats(0).cached_bytes == 0);
+  allocator.free(second, 0);
+
+  // Larger than the max bin, it is not cached.
+  void *large = allocator.allocate((1 << 20) + 1, 0);
+  allocator.free(large, 0);
+  auto stats = allocator.stats(0);
+  REQUIRE(stats.cached_bytes == 2048);
+  REQUIRE(stats.allocated_bytes == base.allocated_bytes);
+  REQUIRE(stats.peak_allocated_bytes ==
+          base.allocated_bytes + (1 << 20) + 1);
+
+  allocator.free_all_cache();
+  REQUIRE(allocator.stats(0).cached_bytes == 0);
+  allocator.set_config(old_config);
+}
+
+TEST_CASE("cuda_allocator-memory_limit", "[cuda_allocator]") {
+  auto &allocator = CUDAAllocator::GetInstance();
+  auto old_config = allocator.config();
+  CUDAAllocatorConfig config;
+  config.memory_limit = allocator.stats(0).allocated_bytes + (1 << 20);
+  allocator.set_config(config);
+  REQUIRE_THROWS_AS(allocator.allocate(2 << 20, 0), OutOfMemory);
+  void *memory = allocator.allocate(1 << 16, 0);
+  allocator.free(memory, 0);
+  allocator.set_config(old_config);
+}
+#endif
+
+}  // namespace core
+}  // namespace turbo_transformers
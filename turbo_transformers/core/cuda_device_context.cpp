@@ -13,6 +13,12 @@
 
 #include "turbo_transformers/core/cuda_device_context.h"
 
+#include <cuda.h>
+
+#include <memory>
+#include <mutex>
+#include <utility>
+
 #include "turbo_transformers/core/cuda_enforce.cuh"
 #include "turbo_transformers/core/enforce.h"
 #include "turbo_transformers/core/memory.h"
@@ -20,11 +26,144 @@
 namespace turbo_transformers {
 namespace core {
 
-CUDADeviceContext::CUDADeviceContext() {
-  TT_ENFORCE_CUDA_SUCCESS(cudaStreamCreate(&stream_));
+namespace {
+thread_local int tls_device_id = 0;
+thread_local int tls_stream_id = 0;
+// The context last returned to this thread, which saves the lookup in the
+// registry for consecutive kernels.
+thread_local CUDADeviceContext *tls_last_context = nullptr;
+
+void SetDevice(int device_id) {
+  int current = -1;
+  TT_ENFORCE_CUDA_SUCCESS(cudaGetDevice(&current));
+  if (current != device_id) {
+    TT_ENFORCE_CUDA_SUCCESS(cudaSetDevice(device_id));
+  }
+}
+}  // namespace
+
+struct CUDADeviceContext::Registry {
+  std::mutex mutex;
+  std::map<std::pair<int, int>, std::unique_ptr<CUDADeviceContext>> contexts;
+  // The stream ids not of the normal priority.
+  std::map<int, StreamPriority> priorities{
+      {kHighPriorityStreamId, StreamPriority::kHigh},
+      {kLowPriorityStreamId, StreamPriority::kLow}};
+  // The external streams by device, and their contexts to be created.
+  std::map<std::pair<int, cudaStream_t>, int> external_ids;
+  std::map<std::pair<int, int>, cudaStream_t> external_streams;
+  int next_external_id{kFirstExternalStreamId};
+
+  static Registry &Get() {
+    static Registry registry;
+    return registry;
+  }
+};
+
+CUDADeviceContext::CUDADeviceContext(int device_id, int stream_id,
+                                     StreamPriority priority,
+                                     const cudaStream_t *external_stream)
+    : device_id_(device_id),
+      stream_id_(stream_id),
+      priority_(priority),
+      owns_stream_(external_stream == nullptr) {
+  SetDevice(device_id);
+  if (external_stream != nullptr) {
+    stream_ = *external_stream;
+  } else {
+    // The greatest priority is the lowest number, 0 is the default one.
+    int least = 0, greatest = 0;
+    TT_ENFORCE_CUDA_SUCCESS(
+        cudaDeviceGetStreamPriorityRange(&least, &greatest));
+    int cuda_priority = 0;
+    if (priority == StreamPriority::kHigh) {
+      cuda_priority = greatest;
+    } else if (priority == StreamPriority::kLow) {
+      cuda_priority = least;
+    }
+    TT_ENFORCE_CUDA_SUCCESS(cudaStreamCreateWithPriority(
+        &stream_, cudaStreamDefault, cuda_priority));
+  }
   TT_ENFORCE_CUDA_SUCCESS(cublasCreate(&handle_));
   TT_ENFORCE_CUDA_SUCCESS(cublasSetStream(handle_, stream_));
-  TT_ENFORCE_CUDA_SUCCESS(cudaGetDeviceProperties(&device_prop_, 0));
+#if CUDA_VERSION >= 9010
+  // Set once for the handle, so the GEMMs may run on the tensor cores without
+  // switching the mode around every call.
+  TT_ENFORCE_CUDA_SUCCESS(cublasSetMathMode(handle_, CUBLAS_TENSOR_OP_MATH));
+#endif
+  TT_ENFORCE_CUDA_SUCCESS(cudaGetDeviceProperties(&device_prop_, device_id));
+}
+
+CUDADeviceContext &CUDADeviceContext::GetInstance(int device_id,
+                                                  int stream_id) {
+  auto *context = tls_last_context;
+  if (context == nullptr || context->device_id_ != device_id ||
+      context->stream_id_ != stream_id) {
+    TT_ENFORCE_GE(device_id, 0, "Invalid device id %d", device_id);
+    TT_ENFORCE_GE(stream_id, 0, "Invalid stream id %d", stream_id);
+    auto &registry = Registry::Get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto &slot = registry.contexts[std::make_pair(device_id, stream_id)];
+    if (slot == nullptr) {
+      auto it = registry.priorities.find(stream_id);
+      auto external =
+          registry.external_streams.find(std::make_pair(device_id, stream_id));
+      slot.reset(new CUDADeviceContext(
+          device_id, stream_id,
+          it == registry.priorities.end() ? StreamPriority::kNormal
+                                          : it->second,
+          external == registry.external_streams.end() ? nullptr
+                                                      : &external->second));
+    }
+    context = slot.get();
+    tls_last_context = context;
+  }
+  SetDevice(device_id);
+  return *context;
+}
+
+int CUDADeviceContext::current_device_id() { return tls_device_id; }
+
+int CUDADeviceContext::current_stream_id() { return tls_stream_id; }
+
+void CUDADeviceContext::SetStreamPriority(int stream_id,
+                                          StreamPriority priority) {
+  TT_ENFORCE_GE(stream_id, 0, "Invalid stream id %d", stream_id);
+  auto &registry = Registry::Get();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (auto &entry : registry.contexts) {
+    TT_ENFORCE(entry.first.second != stream_id || entry.second == nullptr,
+               "The streams of the stream id %d exist already", stream_id);
+  }
+  if (priority == StreamPriority::kNormal) {
+    registry.priorities.erase(stream_id);
+  } else {
+    registry.priorities[stream_id] = priority;
+  }
+}
+
+StreamPriority CUDADeviceContext::stream_priority(int stream_id) {
+  auto &registry = Registry::Get();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  auto it = registry.priorities.find(stream_id);
+  return it == registry.priorities.end() ? StreamPriority::kNormal
+                                         : it->second;
+}
+
+int CUDADeviceContext::ExternalStreamId(int device_id, cudaStream_t stream) {
+  TT_ENFORCE_GE(device_id, 0, "Invalid device id %d", device_id);
+  auto &registry = Registry::Get();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  auto key = std::make_pair(device_id, stream);
+  auto it = registry.external_ids.find(key);
+  if (it != registry.external_ids.end()) {
+    return it->second;
+  }
+  int stream_id = registry.next_external_id--;
+  TT_ENFORCE_GT(stream_id, 0, "Too many external streams");
+  registry.external_ids[key] = stream_id;
+  registry.external_streams[std::make_pair(device_id, stream_id)] = stream;
+  return stream_id;
 }
 
 void CUDADeviceContext::Wait() const {
@@ -40,9 +179,86 @@ cublasHandle_t CUDADeviceContext::cublas_handle() const { return handle_; }
 int CUDADeviceContext::compute_major() const { return device_prop_.major; }
 
 CUDADeviceContext::~CUDADeviceContext() {
-  Wait();
+  SetDevice(device_id_);
+  // An external stream may be gone already at exit.
+  if (owns_stream_) {
+    Wait();
+  }
   TT_ENFORCE_CUDA_SUCCESS(cublasDestroy(handle_));
-  TT_ENFORCE_CUDA_SUCCESS(cudaStreamDestroy(stream_));
+  if (owns_stream_) {
+    TT_ENFORCE_CUDA_SUCCESS(cudaStreamDestroy(stream_));
+  }
+}
+
+CUDAStreamGuard::CUDAStreamGuard(int device_id, int stream_id)
+    : prev_device_id_(tls_device_id), prev_stream_id_(tls_stream_id) {
+  CUDADeviceContext::GetInstance(device_id, stream_id);
+  tls_device_id = device_id;
+  tls_stream_id = stream_id;
+}
+
+CUDAStreamGuard::CUDAStreamGuard(int device_id, cudaStream_t stream)
+    : CUDAStreamGuard(device_id,
+                      CUDADeviceContext::ExternalStreamId(device_id, stream)) {
+}
+
+CUDAStreamGuard::~CUDAStreamGuard() {
+  tls_device_id = prev_device_id_;
+  tls_stream_id = prev_stream_id_;
+  cudaSetDevice(prev_device_id_);
+}
+
+CUDAEvent::CUDAEvent(int device_id, bool timing) : device_id_(device_id) {
+  SetDevice(device_id);
+  TT_ENFORCE_CUDA_SUCCESS(cudaEventCreateWithFlags(
+      &event_, timing ? cudaEventDefault : cudaEventDisableTiming));
+}
+
+CUDAEvent::~CUDAEvent() {
+  SetDevice(device_id_);
+  cudaEventDestroy(event_);
+}
+
+void CUDAEvent::Record() {
+  auto stream = CUDADeviceContext::GetInstance(device_id_).stream();
+  TT_ENFORCE_CUDA_SUCCESS(cudaEventRecord(event_, stream));
+}
+
+void CUDAEvent::Wait(int device_id) const {
+  auto stream = CUDADeviceContext::GetInstance(device_id).stream();
+  TT_ENFORCE_CUDA_SUCCESS(cudaStreamWaitEvent(stream, event_, 0));
+}
+
+void CUDAEvent::Synchronize() const {
+  TT_ENFORCE_CUDA_SUCCESS(cudaEventSynchronize(event_));
+}
+
+float CUDAEvent::ElapsedMs(const CUDAEvent &start) const {
+  Synchronize();
+  float ms = 0;
+  TT_ENFORCE_CUDA_SUCCESS(cudaEventElapsedTime(&ms, start.event_, event_));
+  return ms;
+}
+
+bool EnablePeerAccess(int device_id, int peer_device_id) {
+  if (device_id == peer_device_id) {
+    return true;
+  }
+  int can_access = 0;
+  TT_ENFORCE_CUDA_SUCCESS(
+      cudaDeviceCanAccessPeer(&can_access, device_id, peer_device_id));
+  if (!can_access) {
+    return false;
+  }
+  SetDevice(device_id);
+  auto result = cudaDeviceEnablePeerAccess(peer_device_id, 0);
+  if (result == cudaErrorPeerAccessAlreadyEnabled) {
+    // Clear the error, which is sticky for cudaGetLastError.
+    cudaGetLastError();
+    return true;
+  }
+  TT_ENFORCE_CUDA_SUCCESS(result);
+  return true;
 }
 
 }  // namespace core
@@ -16,6 +16,7 @@
 #include <cuda_runtime.h>
 #include <memory.h>
 
+#include <limits>
 #include <map>
 
 #include "macros.h"
@@ -23,17 +24,68 @@
 namespace turbo_transformers {
 namespace core {
 
+// The priority of the streams of a stream id. When the kernels of several
+// streams are ready, the GPU schedules the blocks of the higher priority
+// first, so latency-sensitive work overtakes the kernels of a long batch
+// queued on a lower priority stream at the block granularity.
+enum class StreamPriority { kNormal = 0, kHigh, kLow };
+
+// The stream and the cuBLAS handle of one (device, stream id) pair. Contexts
+// are created on first use and live until the end of the process.
+//
+// The kernels use the context of the device of their tensors together with
+// the current stream of the calling thread, which is the stream 0 unless it
+// is changed by a CUDAStreamGuard. Independent requests can therefore
+// overlap on one device by running them in threads with different streams.
 class CUDADeviceContext {
  public:
-  CUDADeviceContext();
+  // A stream id reserved for capturing CUDA graphs, which must not share
+  // their stream with the kernels of other threads.
+  static constexpr int kCaptureStreamId = std::numeric_limits<int>::max();
+  // A stream id reserved for uploading weights, see loaders::WeightUploader.
+  static constexpr int kUploadStreamId = kCaptureStreamId - 1;
+  // Stream ids reserved for the requests of a high and a low priority, whose
+  // streams are created with these priorities.
+  static constexpr int kHighPriorityStreamId = kUploadStreamId - 1;
+  static constexpr int kLowPriorityStreamId = kUploadStreamId - 2;
+  // The ids of the external streams are allocated downwards from here, see
+  // ExternalStreamId.
+  static constexpr int kFirstExternalStreamId = kUploadStreamId - 3;
 
   ~CUDADeviceContext();
 
+  // The context of the current device and stream of the calling thread.
   static CUDADeviceContext& GetInstance() {
-    static CUDADeviceContext instance;
-    return instance;
+    return GetInstance(current_device_id(), current_stream_id());
+  }
+
+  static CUDADeviceContext& GetInstance(int device_id) {
+    return GetInstance(device_id, current_stream_id());
   }
 
+  // It also makes `device_id` the current CUDA device of the calling thread,
+  // so the kernels launched with this context run on its device.
+  static CUDADeviceContext& GetInstance(int device_id, int stream_id);
+
+  // The device and stream ids used by the calling thread, as set by the
+  // innermost CUDAStreamGuard.
+  static int current_device_id();
+  static int current_stream_id();
+
+  // Create the streams of `stream_id` with `priority` on every device. It
+  // throws if a stream of the id exists already, since a CUDA stream keeps
+  // the priority it was created with.
+  static void SetStreamPriority(int stream_id, StreamPriority priority);
+  static StreamPriority stream_priority(int stream_id);
+
+  // The stream id whose context on `device_id` runs on `stream`, a stream
+  // created by another library, e.g. torch.cuda.current_stream().cuda_stream,
+  // so the kernels are ordered with the work that library queues on it. The
+  // same stream always maps to the same id. The stream is not owned: it must
+  // outlive the work queued through the context, which is never synchronized
+  // or destroyed by it.
+  static int ExternalStreamId(int device_id, cudaStream_t stream);
+
   void Wait() const;
 
   cudaStream_t stream() const;
@@ -42,12 +94,78 @@ class CUDADeviceContext {
 
   int compute_major() const;
 
+  int device_id() const { return device_id_; }
+  int stream_id() const { return stream_id_; }
+  StreamPriority priority() const { return priority_; }
+
  private:
+  // Runs on `external_stream` if it is not null, see ExternalStreamId.
+  CUDADeviceContext(int device_id, int stream_id, StreamPriority priority,
+                    const cudaStream_t *external_stream = nullptr);
+
+  struct Registry;
+
+  int device_id_;
+  int stream_id_;
+  StreamPriority priority_;
   cudaStream_t stream_;
+  bool owns_stream_;
   cublasHandle_t handle_;
   cudaDeviceProp device_prop_;
   DISABLE_COPY_AND_ASSIGN(CUDADeviceContext);
 };
 
+// Selects the device and the stream of the calling thread for its scope, e.g.
+//
+//   CUDAStreamGuard guard(/*device_id=*/1, /*stream_id=*/2);
+//   model(inputs);  // runs on the stream 2 of the GPU 1.
+class CUDAStreamGuard {
+ public:
+  CUDAStreamGuard(int device_id, int stream_id);
+  // Selects the external `stream`, see CUDADeviceContext::ExternalStreamId.
+  CUDAStreamGuard(int device_id, cudaStream_t stream);
+  ~CUDAStreamGuard();
+
+ private:
+  int prev_device_id_;
+  int prev_stream_id_;
+  DISABLE_COPY_AND_ASSIGN(CUDAStreamGuard);
+};
+
+// An event of the current stream of a device, which the streams of other
+// devices wait on without blocking the host, e.g. the stages of a pipeline
+// on several GPUs.
+class CUDAEvent {
+ public:
+  // A `timing` event also records when the work is done, see ElapsedMs.
+  explicit CUDAEvent(int device_id, bool timing = false);
+  ~CUDAEvent();
+
+  // Marks the work queued so far on the current stream of the device.
+  void Record();
+
+  // The work queued afterwards on the current stream of `device_id` waits for
+  // the work marked by the last Record.
+  void Wait(int device_id) const;
+
+  // Blocks the host until the work marked by the last Record is done.
+  void Synchronize() const;
+
+  // The milliseconds the device spent from the work marked by `start` to the
+  // work marked by this event, both timing events. It blocks until the work
+  // is done.
+  float ElapsedMs(const CUDAEvent &start) const;
+
+ private:
+  int device_id_;
+  cudaEvent_t event_;
+  DISABLE_COPY_AND_ASSIGN(CUDAEvent);
+};
+
+// Lets `device_id` access the memory of `peer_device_id` directly. Returns
+// false if the devices are no peers, the copies between them then go
+// through the host.
+bool EnablePeerAccess(int device_id, int peer_device_id);
+
 }  // namespace core
 }  // namespace turbo_transformers
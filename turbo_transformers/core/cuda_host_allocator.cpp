@@ -0,0 +1,130 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+#include "turbo_transformers/core/cuda_host_allocator.h"
+
+#include <cuda_runtime.h>
+
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+#include "turbo_transformers/core/cuda_device_context.h"
+#include "turbo_transformers/core/cuda_enforce.cuh"
+#include "turbo_transformers/core/enforce.h"
+
+namespace turbo_transformers {
+namespace core {
+
+namespace {
+constexpr size_t kPageSize = 4096;
+
+struct Block {
+  size_t size;
+  // Recorded on the current stream of the freeing thread. An event belongs
+  // to a device, it is recreated when the block is freed on another one.
+  cudaEvent_t event;
+  int event_device;
+};
+}  // namespace
+
+struct CUDAHostAllocator::AllocatorImpl {
+  void *alloc(size_t size) {
+    size = (size + kPageSize - 1) / kPageSize * kPageSize;
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Do not hand out a block more than twice as large as requested.
+    for (auto iter = free_blocks_.lower_bound(size);
+         iter != free_blocks_.end() && iter->first <= 2 * size; ++iter) {
+      auto &block = blocks_[iter->second];
+      if (cudaEventQuery(block.event) == cudaSuccess) {
+        void *data = iter->second;
+        free_blocks_.erase(iter);
+        return data;
+      }
+    }
+
+    void *data = nullptr;
+    if (cudaHostAlloc(&data, size, cudaHostAllocDefault) != cudaSuccess) {
+      FreeAllCacheLocked();
+      TT_ENFORCE_CUDA_SUCCESS(cudaHostAlloc(&data, size, cudaHostAllocDefault));
+    }
+    blocks_.emplace(data, Block{size, nullptr, -1});
+    return data;
+  }
+
+  void free(void *data) {
+    auto &context = core::CUDADeviceContext::GetInstance();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = blocks_.find(data);
+    TT_ENFORCE(iter != blocks_.end(),
+               "The memory is not allocated by CUDAHostAllocator");
+    auto &block = iter->second;
+    if (block.event_device != context.device_id()) {
+      if (block.event != nullptr) {
+        TT_ENFORCE_CUDA_SUCCESS(cudaEventDestroy(block.event));
+      }
+      TT_ENFORCE_CUDA_SUCCESS(
+          cudaEventCreateWithFlags(&block.event, cudaEventDisableTiming));
+      block.event_device = context.device_id();
+    }
+    TT_ENFORCE_CUDA_SUCCESS(cudaEventRecord(block.event, context.stream()));
+    free_blocks_.emplace(block.size, data);
+  }
+
+  void free_all_cache() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    FreeAllCacheLocked();
+  }
+
+  ~AllocatorImpl() {
+    // The CUDA runtime may have been unloaded, ignore the errors.
+    for (auto &free_block : free_blocks_) {
+      auto iter = blocks_.find(free_block.second);
+      cudaEventSynchronize(iter->second.event);
+      cudaEventDestroy(iter->second.event);
+      cudaFreeHost(free_block.second);
+    }
+  }
+
+ private:
+  void FreeAllCacheLocked() {
+    for (auto &free_block : free_blocks_) {
+      auto iter = blocks_.find(free_block.second);
+      TT_ENFORCE_CUDA_SUCCESS(cudaEventSynchronize(iter->second.event));
+      TT_ENFORCE_CUDA_SUCCESS(cudaEventDestroy(iter->second.event));
+      TT_ENFORCE_CUDA_SUCCESS(cudaFreeHost(free_block.second));
+      blocks_.erase(iter);
+    }
+    free_blocks_.clear();
+  }
+
+  std::mutex mutex_;
+  // All the blocks, in use or cached.
+  std::unordered_map<void *, Block> blocks_;
+  // The cached blocks by size.
+  std::multimap<size_t, void *> free_blocks_;
+};
+
+CUDAHostAllocator::CUDAHostAllocator() : allocator_(new AllocatorImpl()) {}
+
+CUDAHostAllocator::~CUDAHostAllocator() = default;
+
+void *CUDAHostAllocator::allocate(size_t size) {
+  return allocator_->alloc(size);
+}
+
+void CUDAHostAllocator::free(void *memory) { allocator_->free(memory); }
+
+void CUDAHostAllocator::free_all_cache() { allocator_->free_all_cache(); }
+
+}  // namespace core
+}  // namespace turbo_transformers
@@ -0,0 +1,57 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cstddef>
+#include <memory>
+
+#include "macros.h"
+
+namespace turbo_transformers {
+namespace core {
+
+// A caching allocator for page-locked host memory, which backs the
+// kDLCPUPinned tensors. Copies between pinned memory and the device are truly
+// asynchronous, so the host staging buffers of an inference should be
+// allocated here and copied with MemcpyAsync.
+//
+// cudaHostAlloc is much slower than malloc, the freed blocks are therefore
+// cached. A freed block is only reused after the work queued on the stream of
+// CUDADeviceContext at the time of freeing has completed, since an
+// asynchronous copy may still be reading it.
+class CUDAHostAllocator {
+ public:
+  ~CUDAHostAllocator();
+
+  static CUDAHostAllocator &GetInstance() {
+    static CUDAHostAllocator instance;
+    return instance;
+  }
+
+  void *allocate(size_t size);
+
+  void free(void *memory);
+
+  void free_all_cache();
+
+ private:
+  CUDAHostAllocator();
+
+  struct AllocatorImpl;
+  std::unique_ptr<AllocatorImpl> allocator_;
+
+  DISABLE_COPY_AND_ASSIGN(CUDAHostAllocator);
+};
+
+}  // namespace core
+}  // namespace turbo_transformers
@@ -11,8 +11,12 @@
 // permissions and limitations under the License.
 // See the AUTHORS file for names of contributors.
 
+#include <vector>
 #ifdef TT_WITH_CUDA
 #include "turbo_transformers/core/cuda_device_context.h"
+#include "turbo_transformers/core/memory.h"
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/tensor_copy.h"
 #endif
 #include "catch2/catch.hpp"
 
@@ -25,6 +29,106 @@ TEST_CASE("CUDADeviceContext", "init") {
   cuda_ctx.Wait();
 }
 
+TEST_CASE("CUDADeviceContext-streams", "[device_context]") {
+  auto& default_ctx = CUDADeviceContext::GetInstance(0);
+  REQUIRE(&default_ctx == &CUDADeviceContext::GetInstance(0, 0));
+  REQUIRE(default_ctx.device_id() == 0);
+  REQUIRE(default_ctx.stream_id() == 0);
+
+  auto& other_ctx = CUDADeviceContext::GetInstance(0, 1);
+  REQUIRE(&other_ctx != &default_ctx);
+  REQUIRE(other_ctx.stream() != default_ctx.stream());
+  REQUIRE(other_ctx.cublas_handle() != default_ctx.cublas_handle());
+
+  {
+    CUDAStreamGuard guard(0, 1);
+    REQUIRE(CUDADeviceContext::current_stream_id() == 1);
+    REQUIRE(&CUDADeviceContext::GetInstance() == &other_ctx);
+    REQUIRE(&CUDADeviceContext::GetInstance(0) == &other_ctx);
+  }
+  REQUIRE(CUDADeviceContext::current_stream_id() == 0);
+  REQUIRE(&CUDADeviceContext::GetInstance() == &default_ctx);
+}
+
+TEST_CASE("CUDADeviceContext-priorities", "[device_context]") {
+  REQUIRE(CUDADeviceContext::GetInstance(0).priority() ==
+          StreamPriority::kNormal);
+  auto& high_ctx = CUDADeviceContext::GetInstance(
+      0, CUDADeviceContext::kHighPriorityStreamId);
+  REQUIRE(high_ctx.priority() == StreamPriority::kHigh);
+  int cuda_priority = 0;
+  REQUIRE(cudaStreamGetPriority(high_ctx.stream(), &cuda_priority) ==
+          cudaSuccess);
+  int least = 0, greatest = 0;
+  REQUIRE(cudaDeviceGetStreamPriorityRange(&least, &greatest) == cudaSuccess);
+  REQUIRE(cuda_priority == greatest);
+
+  CUDADeviceContext::SetStreamPriority(7, StreamPriority::kLow);
+  REQUIRE(CUDADeviceContext::stream_priority(7) == StreamPriority::kLow);
+  REQUIRE(CUDADeviceContext::GetInstance(0, 7).priority() ==
+          StreamPriority::kLow);
+  // The stream exists, so it keeps its priority.
+  REQUIRE_THROWS(
+      CUDADeviceContext::SetStreamPriority(7, StreamPriority::kHigh));
+}
+
+TEST_CASE("CUDADeviceContext-external_stream", "[device_context]") {
+  cudaStream_t stream;
+  REQUIRE(cudaStreamCreate(&stream) == cudaSuccess);
+  int stream_id = CUDADeviceContext::ExternalStreamId(0, stream);
+  REQUIRE(CUDADeviceContext::ExternalStreamId(0, stream) == stream_id);
+  REQUIRE(stream_id <= CUDADeviceContext::kFirstExternalStreamId);
+  {
+    CUDAStreamGuard guard(0, stream);
+    REQUIRE(CUDADeviceContext::current_stream_id() == stream_id);
+    auto& ctx = CUDADeviceContext::GetInstance();
+    REQUIRE(ctx.stream() == stream);
+    cudaStream_t cublas_stream;
+    REQUIRE(cublasGetStream(ctx.cublas_handle(), &cublas_stream) ==
+            CUBLAS_STATUS_SUCCESS);
+    REQUIRE(cublas_stream == stream);
+    ctx.Wait();
+  }
+  REQUIRE(CUDADeviceContext::current_stream_id() == 0);
+  // The legacy default stream is a stream of its own.
+  int default_id = CUDADeviceContext::ExternalStreamId(0, nullptr);
+  REQUIRE(default_id != stream_id);
+  REQUIRE(CUDADeviceContext::GetInstance(0, default_id).stream() == nullptr);
+  REQUIRE(cudaStreamDestroy(stream) == cudaSuccess);
+}
+
+TEST_CASE("CUDAEvent-peer_copy", "[device_context]") {
+  int n_devices = 0;
+  REQUIRE(cudaGetDeviceCount(&n_devices) == cudaSuccess);
+  // Between two GPUs if there are, as the stages of a pipeline, else within
+  // the first one.
+  int src_device = 0, dst_device = n_devices - 1;
+  EnablePeerAccess(src_device, dst_device);
+  EnablePeerAccess(dst_device, src_device);
+  std::vector<float> host(1024);
+  for (size_t i = 0; i < host.size(); ++i) {
+    host[i] = static_cast<float>(i);
+  }
+  Tensor src(NewDLPackTensorT<float>({1024}, kDLGPU, src_device));
+  Tensor dst(NewDLPackTensorT<float>({1024}, kDLGPU, dst_device));
+  Copy(host.data(), host.size(), kDLCPU, src);
+
+  CUDAEvent written(src_device, true), start(src_device, true);
+  start.Record();
+  written.Record();
+  REQUIRE(written.ElapsedMs(start) >= 0.f);
+  // The copy waits on the device for the write, not on the host.
+  written.Wait(dst_device);
+  MemcpyPeerAsync(dst.mutableData<float>(), dst_device, src.data<float>(),
+                  src_device, host.size() * sizeof(float));
+  CUDAEvent copied(dst_device);
+  copied.Record();
+  copied.Synchronize();
+  std::vector<float> result(host.size());
+  Copy(dst, result);
+  REQUIRE(result == host);
+}
+
 #endif
 
 }  // namespace core
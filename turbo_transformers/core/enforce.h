@@ -54,6 +54,13 @@ class EnforceNotMet : public std::exception {
 };
 }  // namespace details
 
+// Thrown by the allocators when the memory of a device is exhausted, so that
+// the callers can tell it from the other errors and retry with less memory.
+class OutOfMemory : public details::EnforceNotMet {
+ public:
+  using details::EnforceNotMet::EnforceNotMet;
+};
+
 #if !defined(_WIN32)
 #define TT_UNLIKELY(condition) __builtin_expect(static_cast<bool>(condition), 0)
 #else
@@ -66,6 +73,12 @@ class EnforceNotMet : public std::exception {
         absl::StrFormat(__VA_ARGS__));                        \
   } while (false)
 
+#define TT_THROW_OUT_OF_MEMORY(...)                  \
+  do {                                               \
+    throw ::turbo_transformers::core::OutOfMemory(   \
+        absl::StrFormat(__VA_ARGS__));               \
+  } while (false)
+
 #define TT_ENFORCE(cond, ...)                                            \
   do {                                                                   \
     if (TT_UNLIKELY(!(cond))) {                                          \
@@ -30,4 +30,13 @@ TEST_CASE("Enforce", "[enforce]") {
     ok = true;
   }
   REQUIRE(ok);
+
+  // The out of memory errors are enforce errors as well.
+  ok = false;
+  try {
+    TT_THROW_OUT_OF_MEMORY("Cannot allocate %d bytes", 16);
+  } catch (turbo_transformers::core::details::EnforceNotMet &e) {
+    ok = dynamic_cast<turbo_transformers::core::OutOfMemory *>(&e) != nullptr;
+  }
+  REQUIRE(ok);
 }
@@ -16,6 +16,7 @@
 #include <cstring>
 #include <vector>
 #ifdef TT_WITH_CUDA
+#include "turbo_transformers/core/cuda_device_context.h"
 #include "turbo_transformers/core/cuda_enforce.cuh"
 #endif
 
@@ -53,10 +54,37 @@ static std::vector<MemcpyFuncTypes> InitMemcpyFuncs() {
   return results;
 }
 
-void Memcpy(void *dst_data, const void *src_data, size_t data_size,
-            MemcpyFlag flag) {
-  if (data_size <= 0) return;
-  static auto memcpyFuncs = InitMemcpyFuncs();
+using MemcpyAsyncFuncTypes =
+    std::function<void *(void *, const void *, size_t, int)>;
+
+static std::vector<MemcpyAsyncFuncTypes> InitMemcpyAsyncFuncs() {
+  std::vector<MemcpyAsyncFuncTypes> results(
+      static_cast<size_t>(MemcpyFlag::kNUM_MEMCPY_FLAGS));
+  results[static_cast<size_t>(MemcpyFlag::kCPU2CPU)] =
+      [](void *dst, const void *src, size_t n, int) -> void * {
+    return std::memcpy(dst, src, n);
+  };
+
+#ifdef TT_WITH_CUDA
+  for (auto &pair : std::vector<std::pair<MemcpyFlag, cudaMemcpyKind>>{
+           {MemcpyFlag::kCPU2GPU, cudaMemcpyHostToDevice},
+           {MemcpyFlag::kGPU2CPU, cudaMemcpyDeviceToHost},
+           {MemcpyFlag::kGPU2GPU, cudaMemcpyDeviceToDevice}}) {
+    auto flag = pair.second;
+    results[static_cast<size_t>(pair.first)] =
+        [flag](void *dst, const void *src, size_t n, int device_id) -> void * {
+      auto stream = CUDADeviceContext::GetInstance(device_id).stream();
+      TT_ENFORCE_CUDA_SUCCESS(cudaMemcpyAsync(dst, src, n, flag, stream));
+      return dst;
+    };
+  }
+#endif
+  return results;
+}
+
+template <typename Func>
+static const Func &GetMemcpyFunc(const std::vector<Func> &memcpyFuncs,
+                                 MemcpyFlag flag) {
   auto f = static_cast<size_t>(flag);
   if (f >= memcpyFuncs.size()) {
     TT_THROW("The MemcpyFlag %d is not support now.", f);
@@ -68,15 +96,75 @@ void Memcpy(void *dst_data, const void *src_data, size_t data_size,
         "compiled with this device support",
         f);
   }
-  func(dst_data, src_data, data_size);
+  return func;
+}
+
+void MemcpyAsync(void *dst_data, const void *src_data, size_t data_size,
+                 MemcpyFlag flag, int device_id) {
+  if (data_size <= 0) return;
+  static auto memcpyFuncs = InitMemcpyAsyncFuncs();
+  GetMemcpyFunc(memcpyFuncs, flag)(dst_data, src_data, data_size, device_id);
+}
+
+void Memcpy2DAsync(void *dst_data, size_t dst_pitch, const void *src_data,
+                   size_t src_pitch, size_t width, size_t height,
+                   MemcpyFlag flag, int device_id) {
+  if (width == 0 || height == 0) return;
+  if (flag == MemcpyFlag::kCPU2CPU) {
+    for (size_t i = 0; i < height; ++i) {
+      std::memcpy(static_cast<char *>(dst_data) + i * dst_pitch,
+                  static_cast<const char *>(src_data) + i * src_pitch, width);
+    }
+    return;
+  }
+#ifdef TT_WITH_CUDA
+  cudaMemcpyKind kind;
+  switch (flag) {
+    case MemcpyFlag::kCPU2GPU:
+      kind = cudaMemcpyHostToDevice;
+      break;
+    case MemcpyFlag::kGPU2CPU:
+      kind = cudaMemcpyDeviceToHost;
+      break;
+    default:
+      kind = cudaMemcpyDeviceToDevice;
+      break;
+  }
+  auto stream = CUDADeviceContext::GetInstance(device_id).stream();
+  TT_ENFORCE_CUDA_SUCCESS(cudaMemcpy2DAsync(dst_data, dst_pitch, src_data,
+                                            src_pitch, width, height, kind,
+                                            stream));
+#else
+  TT_THROW(
+      "The MemcpyFlag %d is not support since turbo transformers is not "
+      "compiled with this device support",
+      static_cast<int>(flag));
+#endif
+}
+
+void MemcpyPeerAsync(void *dst_data, int dst_device_id, const void *src_data,
+                     int src_device_id, size_t data_size) {
+  if (data_size == 0) return;
+#ifdef TT_WITH_CUDA
+  auto stream = CUDADeviceContext::GetInstance(dst_device_id).stream();
+  TT_ENFORCE_CUDA_SUCCESS(cudaMemcpyPeerAsync(
+      dst_data, dst_device_id, src_data, src_device_id, data_size, stream));
+#else
+  TT_THROW("The current code is not compiled with CUDA.");
+#endif
+}
+
+void Memcpy(void *dst_data, const void *src_data, size_t data_size,
+            MemcpyFlag flag) {
+  if (data_size <= 0) return;
+  static auto memcpyFuncs = InitMemcpyFuncs();
+  GetMemcpyFunc(memcpyFuncs, flag)(dst_data, src_data, data_size);
 }
 MemcpyFlag ToMemcpyFlag(DLDeviceType dst, DLDeviceType src) {
-  if (dst == DLDeviceType::kDLCPU) {
-    return src == DLDeviceType::kDLCPU ? MemcpyFlag::kCPU2CPU
-                                       : MemcpyFlag::kGPU2CPU;
+  if (IsHostDevice(dst)) {
+    return IsHostDevice(src) ? MemcpyFlag::kCPU2CPU : MemcpyFlag::kGPU2CPU;
   } else {
-    return src == DLDeviceType::kDLCPU ? MemcpyFlag::kCPU2GPU
-                                       : MemcpyFlag::kGPU2GPU;
+    return IsHostDevice(src) ? MemcpyFlag::kCPU2GPU : MemcpyFlag::kGPU2GPU;
   }
 }
 
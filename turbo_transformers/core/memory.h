@@ -35,6 +35,34 @@ enum class MemcpyFlag {
 extern void Memcpy(void *dst_data, const void *src_data, size_t data_size,
                    MemcpyFlag flag);
 
+// Enqueues the copy on the current stream of the GPU `device_id`, see
+// CUDADeviceContext, and returns without waiting for it. The host must call
+// CUDADeviceContext::Wait before reading the copied data. A copy between the
+// device and the host only overlaps with the host when the host memory is
+// pinned, i.e. allocated as kDLCPUPinned. kCPU2CPU copies are done
+// synchronously.
+extern void MemcpyAsync(void *dst_data, const void *src_data,
+                        size_t data_size, MemcpyFlag flag, int device_id);
+
+// Copies `height` rows of `width` bytes, which start `src_pitch` bytes apart
+// in the source and `dst_pitch` bytes apart in the destination, in a single
+// call. It is queued like MemcpyAsync.
+extern void Memcpy2DAsync(void *dst_data, size_t dst_pitch,
+                          const void *src_data, size_t src_pitch, size_t width,
+                          size_t height, MemcpyFlag flag, int device_id);
+
+// Copies between the memory of two GPUs, queued like MemcpyAsync on the
+// current stream of the destination `dst_device_id`. The copy goes through
+// the host unless EnablePeerAccess made the devices peers.
+extern void MemcpyPeerAsync(void *dst_data, int dst_device_id,
+                            const void *src_data, int src_device_id,
+                            size_t data_size);
+
+// kDLCPUPinned is host memory as well.
+inline bool IsHostDevice(DLDeviceType device) {
+  return device == kDLCPU || device == kDLCPUPinned;
+}
+
 extern MemcpyFlag ToMemcpyFlag(DLDeviceType dst, DLDeviceType src);
 
 }  // namespace core
@@ -0,0 +1,111 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/core/memory_planner.h"
+
+#include <algorithm>
+
+#include "turbo_transformers/core/enforce.h"
+
+namespace turbo_transformers {
+namespace core {
+
+void MemoryPlanner::AddUsage(const std::string &name, size_t size,
+                             int64_t first_op, int64_t last_op) {
+  TT_ENFORCE_LE(first_op, last_op,
+                "The tensor %s is released before it is produced", name);
+  auto &usage = usages_[name];
+  usage.size = std::max(usage.size, size);
+  usage.lifetimes.emplace_back(first_op, last_op);
+}
+
+namespace {
+using Lifetimes = std::vector<std::pair<int64_t, int64_t>>;
+
+bool IsOverlapped(const Lifetimes &a, const Lifetimes &b) {
+  for (auto &x : a) {
+    for (auto &y : b) {
+      if (x.first <= y.second && y.first <= x.second) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+size_t AlignUp(size_t size, size_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+}  // namespace
+
+MemoryPlan MemoryPlanner::Plan(size_t alignment) const {
+  std::vector<std::pair<const std::string *, const Usage *>> order;
+  order.reserve(usages_.size());
+  for (auto &usage : usages_) {
+    order.emplace_back(&usage.first, &usage.second);
+  }
+  // Place the largest tensors first, they are the hardest to fit.
+  std::stable_sort(order.begin(), order.end(),
+                   [](const auto &a, const auto &b) {
+                     return a.second->size > b.second->size;
+                   });
+
+  struct Placed {
+    MemoryBlock block;
+    const Usage *usage;
+  };
+  std::vector<Placed> placed;
+  MemoryPlan plan;
+  for (auto &item : order) {
+    size_t size = AlignUp(std::max<size_t>(item.second->size, 1), alignment);
+
+    // Blocks of the placed tensors which are alive at the same time.
+    std::vector<MemoryBlock> conflicts;
+    for (auto &p : placed) {
+      if (IsOverlapped(p.usage->lifetimes, item.second->lifetimes)) {
+        conflicts.push_back(p.block);
+      }
+    }
+    std::sort(conflicts.begin(), conflicts.end(),
+              [](const MemoryBlock &a, const MemoryBlock &b) {
+                return a.offset < b.offset;
+              });
+
+    // Choose the smallest gap which is large enough.
+    size_t best_offset = 0;
+    size_t best_gap = SIZE_MAX;
+    size_t prev_end = 0;
+    for (auto &block : conflicts) {
+      if (block.offset >= prev_end) {
+        size_t gap = block.offset - prev_end;
+        if (gap >= size && gap < best_gap) {
+          best_gap = gap;
+          best_offset = prev_end;
+        }
+      }
+      prev_end = std::max(prev_end, block.offset + block.size);
+    }
+    if (best_gap == SIZE_MAX) {
+      best_offset = prev_end;
+    }
+
+    MemoryBlock block{best_offset, size};
+    placed.push_back({block, item.second});
+    plan.blocks.emplace(*item.first, block);
+    plan.total_size = std::max(plan.total_size, best_offset + size);
+  }
+  return plan;
+}
+
+}  // namespace core
+}  // namespace turbo_transformers
@@ -0,0 +1,60 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace turbo_transformers {
+namespace core {
+
+struct MemoryBlock {
+  size_t offset;
+  size_t size;
+};
+
+// The result of the planning, every tensor is assigned a block inside one
+// arena of `total_size` bytes.
+struct MemoryPlan {
+  std::map<std::string, MemoryBlock> blocks;
+  size_t total_size{0};
+};
+
+// Plans the activations of a whole model statically. Every intermediate
+// tensor is declared with its size and the range of operators
+// [first_op, last_op] between which it is alive. Tensors whose lifetimes do
+// not overlap are packed at the same offsets, following the greedy by size
+// strategy of "Efficient Memory Management for Deep Neural Net Inference".
+class MemoryPlanner {
+ public:
+  // A name may be declared several times, e.g. once per encoder layer, all
+  // the declared lifetimes then share one buffer of the largest size.
+  void AddUsage(const std::string &name, size_t size, int64_t first_op,
+                int64_t last_op);
+
+  MemoryPlan Plan(size_t alignment = 64) const;
+
+ private:
+  struct Usage {
+    size_t size{0};
+    std::vector<std::pair<int64_t, int64_t>> lifetimes;
+  };
+  std::map<std::string, Usage> usages_;
+};
+
+}  // namespace core
+}  // namespace turbo_transformers
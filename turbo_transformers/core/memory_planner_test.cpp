@@ -0,0 +1,68 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+#include "turbo_transformers/core/memory_planner.h"
+
+#include "catch2/catch.hpp"
+
+namespace turbo_transformers {
+namespace core {
+
+static bool IsDisjoint(const MemoryBlock &a, const MemoryBlock &b) {
+  return a.offset + a.size <= b.offset || b.offset + b.size <= a.offset;
+}
+
+TEST_CASE("memory_planner-share", "[memory_planner]") {
+  MemoryPlanner planner;
+  planner.AddUsage("a", 1024, 0, 1);
+  planner.AddUsage("b", 512, 1, 2);
+  planner.AddUsage("c", 1024, 2, 3);
+  auto plan = planner.Plan();
+  auto &a = plan.blocks.at("a");
+  auto &b = plan.blocks.at("b");
+  auto &c = plan.blocks.at("c");
+  REQUIRE(IsDisjoint(a, b));
+  REQUIRE(IsDisjoint(b, c));
+  // a and c are never alive at the same time.
+  REQUIRE(a.offset == c.offset);
+  REQUIRE(plan.total_size == 1536);
+}
+
+TEST_CASE("memory_planner-repeated", "[memory_planner]") {
+  MemoryPlanner planner;
+  planner.AddUsage("hidden", 256, 0, 9);
+  for (int64_t layer = 0; layer < 3; ++layer) {
+    planner.AddUsage("scratch", 100, layer * 3 + 1, layer * 3 + 2);
+    planner.AddUsage("out", 300, layer * 3 + 2, layer * 3 + 3);
+  }
+  auto plan = planner.Plan();
+  REQUIRE(plan.blocks.size() == 3);
+  REQUIRE(plan.blocks.at("out").size == 320);
+  REQUIRE(plan.blocks.at("scratch").size == 128);
+  REQUIRE(IsDisjoint(plan.blocks.at("out"), plan.blocks.at("scratch")));
+  REQUIRE(IsDisjoint(plan.blocks.at("out"), plan.blocks.at("hidden")));
+  REQUIRE(plan.total_size == 256 + 320 + 128);
+}
+
+TEST_CASE("memory_planner-best_fit", "[memory_planner]") {
+  MemoryPlanner planner;
+  planner.AddUsage("big", 4096, 0, 0);
+  planner.AddUsage("left", 1024, 1, 3);
+  planner.AddUsage("right", 1024, 1, 3);
+  planner.AddUsage("small", 1024, 2, 2);
+  auto plan = planner.Plan();
+  // "big" dies before the others are produced, so everything fits in it.
+  REQUIRE(plan.total_size == 4096);
+}
+
+}  // namespace core
+}  // namespace turbo_transformers
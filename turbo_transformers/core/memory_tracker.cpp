@@ -0,0 +1,187 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/core/memory_tracker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+#include "absl/strings/str_format.h"
+
+namespace turbo_transformers {
+namespace core {
+
+namespace {
+struct Counter {
+  size_t live_bytes{0};
+  size_t peak_live_bytes{0};
+  size_t num_allocs{0};
+
+  void Add(size_t bytes) {
+    live_bytes += bytes;
+    peak_live_bytes = std::max(peak_live_bytes, live_bytes);
+    ++num_allocs;
+  }
+};
+
+// A tensor holds the counter of its tag, the counter of its device is found
+// through `device`.
+struct TaggedCounter {
+  Counter counter;
+  Counter *device;
+};
+
+// The handle of a tracked tensor, which keeps the bytes charged to its tag
+// since a Reshape may shrink the tensor in place before it is freed.
+struct TrackedAllocation {
+  TaggedCounter *tagged;
+  size_t bytes;
+};
+
+using DeviceKey = std::pair<int, int>;  // device type, device id
+
+struct Tracker {
+  std::atomic<bool> enabled{false};
+  std::mutex mutex;
+  // The counters are never erased, since the live tensors point to them.
+  std::map<DeviceKey, Counter> devices;
+  std::map<std::pair<std::string, DeviceKey>, TaggedCounter> tags;
+};
+
+Tracker &GetTracker() {
+  // Never destroyed, the static tensors may be freed after it at exit.
+  static auto *tracker = new Tracker();
+  return *tracker;
+}
+
+thread_local std::string tls_tag;
+}  // namespace
+
+void EnableMemoryTracking() { GetTracker().enabled = true; }
+
+void DisableMemoryTracking() { GetTracker().enabled = false; }
+
+bool IsMemoryTrackingEnabled() { return GetTracker().enabled; }
+
+void ResetMemoryTracking() {
+  auto &tracker = GetTracker();
+  std::lock_guard<std::mutex> lock(tracker.mutex);
+  auto reset = [](Counter *counter) {
+    counter->peak_live_bytes = counter->live_bytes;
+    counter->num_allocs = 0;
+  };
+  for (auto &device : tracker.devices) {
+    reset(&device.second);
+  }
+  for (auto &tag : tracker.tags) {
+    reset(&tag.second.counter);
+  }
+}
+
+std::vector<MemoryUsage> GetMemoryUsages() {
+  auto &tracker = GetTracker();
+  std::lock_guard<std::mutex> lock(tracker.mutex);
+  std::vector<MemoryUsage> usages;
+  auto add = [&](const std::string &tag, const DeviceKey &device,
+                 const Counter &counter) {
+    usages.push_back({tag, static_cast<DLDeviceType>(device.first),
+                      device.second, counter.live_bytes,
+                      counter.peak_live_bytes, counter.num_allocs});
+  };
+  for (auto &device : tracker.devices) {
+    add("", device.first, device.second);
+  }
+  for (auto &tag : tracker.tags) {
+    add(tag.first.first, tag.first.second, tag.second.counter);
+  }
+  return usages;
+}
+
+static const char *DeviceName(DLDeviceType device_type) {
+  switch (device_type) {
+    case kDLCPU:
+      return "cpu";
+    case kDLGPU:
+      return "gpu";
+    case kDLCPUPinned:
+      return "pinned";
+    default:
+      return "unknown";
+  }
+}
+
+std::string GetMemoryReport() {
+  std::string report = absl::StrFormat("%-48s %-10s %14s %14s %10s\n", "tag",
+                                       "device", "live bytes", "peak bytes",
+                                       "allocs");
+  for (auto &usage : GetMemoryUsages()) {
+    auto device = absl::StrFormat("%s:%d", DeviceName(usage.device_type),
+                                  usage.device_id);
+    absl::StrAppendFormat(&report, "%-48s %-10s %14d %14d %10d\n",
+                          usage.tag.empty() ? "(all)" : usage.tag, device,
+                          usage.live_bytes, usage.peak_live_bytes,
+                          usage.num_allocs);
+  }
+  return report;
+}
+
+MemoryTagGuard::MemoryTagGuard(absl::string_view tag)
+    : prev_size_(tls_tag.size()) {
+  if (!tls_tag.empty()) {
+    tls_tag.push_back('.');
+  }
+  tls_tag.append(tag.data(), tag.size());
+}
+
+MemoryTagGuard::~MemoryTagGuard() { tls_tag.resize(prev_size_); }
+
+namespace details {
+void *TrackAllocation(DLContext ctx, size_t bytes) {
+  auto &tracker = GetTracker();
+  if (!tracker.enabled.load(std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  DeviceKey device(ctx.device_type, ctx.device_id);
+  std::lock_guard<std::mutex> lock(tracker.mutex);
+  auto iter = tracker.tags.find(std::make_pair(tls_tag, device));
+  if (iter == tracker.tags.end()) {
+    iter = tracker.tags
+               .emplace(std::make_pair(tls_tag, device),
+                        TaggedCounter{Counter(), &tracker.devices[device]})
+               .first;
+  }
+  auto &tagged = iter->second;
+  tagged.counter.Add(bytes);
+  tagged.device->Add(bytes);
+  return new TrackedAllocation{&tagged, bytes};
+}
+
+void TrackDeallocation(void *handle) {
+  if (handle == nullptr) {
+    return;
+  }
+  std::unique_ptr<TrackedAllocation> allocation(
+      static_cast<TrackedAllocation *>(handle));
+  auto &tracker = GetTracker();
+  std::lock_guard<std::mutex> lock(tracker.mutex);
+  allocation->tagged->counter.live_bytes -= allocation->bytes;
+  allocation->tagged->device->live_bytes -= allocation->bytes;
+}
+}  // namespace details
+
+}  // namespace core
+}  // namespace turbo_transformers
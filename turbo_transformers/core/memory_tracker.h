@@ -0,0 +1,84 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <dlpack/dlpack.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "turbo_transformers/core/macros.h"
+
+namespace turbo_transformers {
+namespace core {
+
+// Accounting of the tensors allocated by NewDLPackTensor, by device and by
+// tag. The tag of a tensor is the one of the calling thread when it is
+// allocated, see MemoryTagGuard, and its bytes are released from the tag when
+// it is freed, wherever that happens. Views and tensors imported through
+// DLPack are not counted.
+//
+// The tracking is off by default; when off, the allocations only pay for
+// one atomic load.
+struct MemoryUsage {
+  std::string tag;
+  DLDeviceType device_type;
+  int device_id;
+  size_t live_bytes;
+  size_t peak_live_bytes;
+  // The tensors allocated since the tracking is enabled or reset.
+  size_t num_allocs;
+};
+
+void EnableMemoryTracking();
+void DisableMemoryTracking();
+bool IsMemoryTrackingEnabled();
+
+// Restart the peaks from the live bytes and the counts of allocations from 0.
+void ResetMemoryTracking();
+
+// One usage per device with an empty tag, which counts all the tensors of
+// the device, followed by one usage per (tag, device).
+std::vector<MemoryUsage> GetMemoryUsages();
+
+// The usages formatted as a table.
+std::string GetMemoryReport();
+
+// Tags the tensors allocated by the calling thread within its scope. The
+// nested tags are joined by dots, e.g.
+//
+//   MemoryTagGuard layer("encoder.layer.3");
+//   MemoryTagGuard attention("attention");  // encoder.layer.3.attention
+class MemoryTagGuard {
+ public:
+  explicit MemoryTagGuard(absl::string_view tag);
+  ~MemoryTagGuard();
+
+ private:
+  size_t prev_size_;
+  DISABLE_COPY_AND_ASSIGN(MemoryTagGuard);
+};
+
+namespace details {
+// Called by NewDLPackTensor and its deleter, the returned handle is stored
+// in DLManagedTensor::manager_ctx. It is null if the tracking is off. The
+// deallocation releases the bytes given to the allocation, whatever the
+// shape of the tensor has become.
+void *TrackAllocation(DLContext ctx, size_t bytes);
+void TrackDeallocation(void *handle);
+}  // namespace details
+
+}  // namespace core
+}  // namespace turbo_transformers
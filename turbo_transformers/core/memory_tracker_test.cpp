@@ -0,0 +1,82 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/core/memory_tracker.h"
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/core/tensor.h"
+
+namespace turbo_transformers {
+namespace core {
+
+static MemoryUsage FindUsage(const std::string &tag) {
+  for (auto &usage : GetMemoryUsages()) {
+    if (usage.tag == tag && usage.device_type == kDLCPU) {
+      return usage;
+    }
+  }
+  return MemoryUsage{tag, kDLCPU, 0, 0, 0, 0};
+}
+
+TEST_CASE("memory_tracker-tags", "[memory_tracker]") {
+  EnableMemoryTracking();
+  ResetMemoryTracking();
+  auto all_before = FindUsage("");
+  {
+    MemoryTagGuard layer("test.layer");
+    Tensor weight(NewDLPackTensorT<float>({256}));
+    {
+      MemoryTagGuard attention("attention");
+      Tensor activation(NewDLPackTensorT<float>({1024}));
+      auto usage = FindUsage("test.layer.attention");
+      REQUIRE(usage.live_bytes == 4096);
+      REQUIRE(usage.num_allocs == 1);
+    }
+    REQUIRE(FindUsage("test.layer").live_bytes == 1024);
+    auto attention = FindUsage("test.layer.attention");
+    REQUIRE(attention.live_bytes == 0);
+    REQUIRE(attention.peak_live_bytes == 4096);
+    REQUIRE(FindUsage("").live_bytes == all_before.live_bytes + 1024);
+  }
+  REQUIRE(FindUsage("test.layer").live_bytes == 0);
+  REQUIRE(GetMemoryReport().find("test.layer.attention") != std::string::npos);
+
+  // Views are not counted.
+  float data[16];
+  Tensor view(NewDLPackTensorViewT<float>(data, {16}));
+  REQUIRE(FindUsage("").live_bytes == all_before.live_bytes);
+  DisableMemoryTracking();
+}
+
+TEST_CASE("memory_tracker-reshape", "[memory_tracker]") {
+  EnableMemoryTracking();
+  {
+    MemoryTagGuard tag("test.reshape");
+    Tensor tensor(NewDLPackTensorT<float>({1024}));
+    // Shrunk in place, the tensor still holds the bytes it was allocated.
+    tensor.Reshape<float>({2, 16}, kDLCPU, 0);
+    REQUIRE(FindUsage("test.reshape").live_bytes == 4096);
+  }
+  REQUIRE(FindUsage("test.reshape").live_bytes == 0);
+  DisableMemoryTracking();
+}
+
+TEST_CASE("memory_tracker-disabled", "[memory_tracker]") {
+  DisableMemoryTracking();
+  MemoryTagGuard tag("test.disabled");
+  Tensor tensor(NewDLPackTensorT<float>({256}));
+  REQUIRE(FindUsage("test.disabled").num_allocs == 0);
+}
+
+}  // namespace core
+}  // namespace turbo_transformers
@@ -0,0 +1,119 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/core/metrics.h"
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace turbo_transformers {
+namespace core {
+
+namespace details {
+std::atomic<int64_t> gCounters[static_cast<int>(Counter::kNumCounters)];
+
+struct LayerTimeSlot {
+  std::atomic<int64_t> calls{0};
+  std::atomic<int64_t> total_ns{0};
+};
+}  // namespace details
+
+namespace {
+struct LayerSlots {
+  std::mutex mutex;
+  std::map<std::string, std::unique_ptr<details::LayerTimeSlot>> slots;
+};
+
+LayerSlots &GetLayerSlots() {
+  // Never destroyed, the timers of other threads may end after it at exit.
+  static auto *slots = new LayerSlots();
+  return *slots;
+}
+
+int64_t Load(Counter counter) {
+  return details::gCounters[static_cast<int>(counter)].load(
+      std::memory_order_relaxed);
+}
+
+details::LayerTimeSlot *FindLayerSlot(const char *name) {
+  // The names are mostly literals, so a thread looks up a name by its
+  // address without locking after the first time.
+  static thread_local std::unordered_map<const char *, details::LayerTimeSlot *>
+      tls_slots;
+  auto iter = tls_slots.find(name);
+  if (iter != tls_slots.end()) {
+    return iter->second;
+  }
+  auto &layer_slots = GetLayerSlots();
+  std::lock_guard<std::mutex> lock(layer_slots.mutex);
+  auto &slot = layer_slots.slots[name];
+  if (slot == nullptr) {
+    slot.reset(new details::LayerTimeSlot());
+  }
+  tls_slots.emplace(name, slot.get());
+  return slot.get();
+}
+}  // namespace
+
+LayerTimer::LayerTimer(const char *name)
+    : slot_(FindLayerSlot(name)), start_(std::chrono::steady_clock::now()) {}
+
+LayerTimer::~LayerTimer() {
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start_)
+                .count();
+  slot_->calls.fetch_add(1, std::memory_order_relaxed);
+  slot_->total_ns.fetch_add(ns, std::memory_order_relaxed);
+}
+
+Metrics GetMetrics() {
+  Metrics metrics;
+  metrics.batches = Load(Counter::kBatches);
+  metrics.sequences = Load(Counter::kSequences);
+  metrics.tokens = Load(Counter::kTokens);
+  metrics.padded_tokens = Load(Counter::kPaddedTokens);
+  metrics.allocator_hits = Load(Counter::kAllocatorHits);
+  metrics.allocator_misses = Load(Counter::kAllocatorMisses);
+  metrics.allocated_bytes = Load(Counter::kAllocatedBytes);
+  metrics.gemm_flops = Load(Counter::kGemmFlops);
+  metrics.predicted_batch_splits = Load(Counter::kPredictedBatchSplits);
+  metrics.out_of_memory_batch_splits = Load(Counter::kOutOfMemoryBatchSplits);
+  metrics.huge_page_bytes = Load(Counter::kHugePageBytes);
+  metrics.preempting_batches = Load(Counter::kPreemptingBatches);
+  metrics.spilled_batches = Load(Counter::kSpilledBatches);
+  auto &layer_slots = GetLayerSlots();
+  std::lock_guard<std::mutex> lock(layer_slots.mutex);
+  for (auto &slot : layer_slots.slots) {
+    auto &time = metrics.layer_times[slot.first];
+    time.calls = slot.second->calls.load(std::memory_order_relaxed);
+    time.total_ms =
+        slot.second->total_ns.load(std::memory_order_relaxed) / 1e6;
+  }
+  return metrics;
+}
+
+void ResetMetrics() {
+  for (auto &counter : details::gCounters) {
+    counter.store(0, std::memory_order_relaxed);
+  }
+  auto &layer_slots = GetLayerSlots();
+  std::lock_guard<std::mutex> lock(layer_slots.mutex);
+  for (auto &slot : layer_slots.slots) {
+    slot.second->calls.store(0, std::memory_order_relaxed);
+    slot.second->total_ns.store(0, std::memory_order_relaxed);
+  }
+}
+
+}  // namespace core
+}  // namespace turbo_transformers
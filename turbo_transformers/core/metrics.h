@@ -0,0 +1,124 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "turbo_transformers/core/macros.h"
+
+namespace turbo_transformers {
+namespace core {
+
+// Always-on counters of the runtime, cheap enough for production: every
+// update is a relaxed atomic addition. A monitoring system reads them with
+// GetMetrics, and derives the rates from the differences of two snapshots.
+enum class Counter {
+  // The batches run by the models, a bucketed batch counting each of its
+  // sub-batches, and their sequences.
+  kBatches = 0,
+  kSequences,
+  // The tokens computed, padding included, and the padding among them.
+  kTokens,
+  kPaddedTokens,
+  // The allocations served by the cache of the CPU or the GPU allocator,
+  // and the ones going to the system or the driver.
+  kAllocatorHits,
+  kAllocatorMisses,
+  // The bytes of the tensors allocated by NewDLPackTensor.
+  kAllocatedBytes,
+  // The floating point operations of the dense and the int8 GEMMs.
+  kGemmFlops,
+  // The batches the models split in halves, as their activations were
+  // predicted to exceed the workspace budget, or as their allocations failed.
+  kPredictedBatchSplits,
+  kOutOfMemoryBatchSplits,
+  // The bytes of the host blocks mapped by MAP_HUGETLB or advised to the
+  // transparent huge pages, see CPUAllocator::set_huge_pages.
+  kHugePageBytes,
+  // The batches run between the layers of a batch of a lower priority, see
+  // serving::BertModel::EnablePreemption.
+  kPreemptingBatches,
+  // The batches serving::BertBatcher ran on a CPU model, as a GPU model
+  // would have finished them later.
+  kSpilledBatches,
+  kNumCounters
+};
+
+namespace details {
+extern std::atomic<int64_t>
+    gCounters[static_cast<int>(Counter::kNumCounters)];
+struct LayerTimeSlot;
+}  // namespace details
+
+inline void AddToCounter(Counter counter, int64_t value) {
+  details::gCounters[static_cast<int>(counter)].fetch_add(
+      value, std::memory_order_relaxed);
+}
+
+// Counts a batch of `sequences` computed on `tokens` tokens, of which
+// `padded_tokens` are padding.
+inline void RecordBatch(int64_t sequences, int64_t tokens,
+                        int64_t padded_tokens) {
+  AddToCounter(Counter::kBatches, 1);
+  AddToCounter(Counter::kSequences, sequences);
+  AddToCounter(Counter::kTokens, tokens);
+  AddToCounter(Counter::kPaddedTokens, padded_tokens);
+}
+
+struct Metrics {
+  int64_t batches{0};
+  int64_t sequences{0};
+  int64_t tokens{0};
+  int64_t padded_tokens{0};
+  int64_t allocator_hits{0};
+  int64_t allocator_misses{0};
+  int64_t allocated_bytes{0};
+  int64_t gemm_flops{0};
+  int64_t predicted_batch_splits{0};
+  int64_t out_of_memory_batch_splits{0};
+  int64_t huge_page_bytes{0};
+  int64_t preempting_batches{0};
+  int64_t spilled_batches{0};
+  struct LayerTime {
+    int64_t calls{0};
+    double total_ms{0};
+  };
+  // By layer type, see LayerTimer.
+  std::map<std::string, LayerTime> layer_times;
+};
+
+Metrics GetMetrics();
+
+// Restart every counter from 0.
+void ResetMetrics();
+
+// Adds the host time of its scope to the layer type `name`, which must
+// outlive the scope, e.g. a string literal. On the GPU, it is the time to
+// launch the kernels of the layer unless the layer waits for them.
+class LayerTimer {
+ public:
+  explicit LayerTimer(const char* name);
+  ~LayerTimer();
+
+ private:
+  details::LayerTimeSlot* slot_;
+  std::chrono::steady_clock::time_point start_;
+  DISABLE_COPY_AND_ASSIGN(LayerTimer);
+};
+
+}  // namespace core
+}  // namespace turbo_transformers
@@ -0,0 +1,58 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/core/metrics.h"
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/core/tensor.h"
+
+namespace turbo_transformers {
+namespace core {
+
+TEST_CASE("metrics-snapshot", "[metrics]") {
+  ResetMetrics();
+  RecordBatch(2, 16, 5);
+  RecordBatch(1, 8, 0);
+  AddToCounter(Counter::kGemmFlops, 1024);
+  AddToCounter(Counter::kOutOfMemoryBatchSplits, 2);
+  {
+    Tensor tensor(NewDLPackTensorT<float>({4, 8}));
+  }
+  for (int i = 0; i < 3; ++i) {
+    LayerTimer timer("TestLayer");
+  }
+
+  auto metrics = GetMetrics();
+  REQUIRE(metrics.batches == 2);
+  REQUIRE(metrics.sequences == 3);
+  REQUIRE(metrics.tokens == 24);
+  REQUIRE(metrics.padded_tokens == 5);
+  REQUIRE(metrics.gemm_flops == 1024);
+  REQUIRE(metrics.predicted_batch_splits == 0);
+  REQUIRE(metrics.out_of_memory_batch_splits == 2);
+  REQUIRE(metrics.allocated_bytes >= 4 * 8 * 4);
+  REQUIRE(metrics.allocator_hits + metrics.allocator_misses >= 1);
+  REQUIRE(metrics.layer_times.count("TestLayer") == 1);
+  REQUIRE(metrics.layer_times["TestLayer"].calls == 3);
+  REQUIRE(metrics.layer_times["TestLayer"].total_ms >= 0);
+
+  ResetMetrics();
+  metrics = GetMetrics();
+  REQUIRE(metrics.batches == 0);
+  REQUIRE(metrics.tokens == 0);
+  REQUIRE(metrics.allocated_bytes == 0);
+  REQUIRE(metrics.layer_times["TestLayer"].calls == 0);
+}
+
+}  // namespace core
+}  // namespace turbo_transformers
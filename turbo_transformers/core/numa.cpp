@@ -0,0 +1,135 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/core/numa.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+#include "turbo_transformers/core/enforce.h"
+
+namespace turbo_transformers {
+namespace core {
+
+namespace {
+// The CPUs the process may run on, e.g. within the limits of a container.
+std::vector<int> AllowedCPUs() {
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+#endif
+  if (cpus.empty()) {
+    int n = std::max(1u, std::thread::hardware_concurrency());
+    for (int cpu = 0; cpu < n; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+}  // namespace
+
+std::vector<int> ParseCPUList(const std::string &list) {
+  std::vector<int> cpus;
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    if (range.find_first_not_of(" \n") == std::string::npos) {
+      continue;
+    }
+    int first = 0, last = 0;
+    char dash = 0;
+    std::stringstream rs(range);
+    rs >> first;
+    TT_ENFORCE(!rs.fail(), "Invalid CPU list %s", list);
+    if (rs >> dash) {
+      TT_ENFORCE(dash == '-' && (rs >> last) && last >= first,
+                 "Invalid CPU list %s", list);
+    } else {
+      last = first;
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+std::vector<std::vector<int>> GetNumaNodeCPUs() {
+  auto allowed = AllowedCPUs();
+  std::vector<std::vector<int>> nodes;
+#ifdef __linux__
+  const std::string root = "/sys/devices/system/node/";
+  std::vector<int> node_ids;
+  if (DIR *dir = opendir(root.c_str())) {
+    while (dirent *entry = readdir(dir)) {
+      std::string name = entry->d_name;
+      if (name.compare(0, 4, "node") == 0 && name.size() > 4 &&
+          std::all_of(name.begin() + 4, name.end(), ::isdigit)) {
+        node_ids.push_back(std::stoi(name.substr(4)));
+      }
+    }
+    closedir(dir);
+  }
+  std::sort(node_ids.begin(), node_ids.end());
+  for (auto node_id : node_ids) {
+    std::ifstream file(root + "node" + std::to_string(node_id) + "/cpulist");
+    std::string list;
+    std::getline(file, list);
+    std::vector<int> cpus;
+    for (auto cpu : ParseCPUList(list)) {
+      if (std::binary_search(allowed.begin(), allowed.end(), cpu)) {
+        cpus.push_back(cpu);
+      }
+    }
+    // A node without CPUs holds memory only.
+    if (!cpus.empty()) {
+      nodes.push_back(std::move(cpus));
+    }
+  }
+#endif
+  if (nodes.empty()) {
+    nodes.push_back(std::move(allowed));
+  }
+  return nodes;
+}
+
+void BindThreadToCPUs(const std::vector<int> &cpus) {
+  TT_ENFORCE(!cpus.empty(), "The thread should be bound to a CPU at least");
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto cpu : cpus) {
+    TT_ENFORCE(cpu >= 0 && cpu < CPU_SETSIZE, "Invalid CPU %d", cpu);
+    CPU_SET(cpu, &set);
+  }
+  TT_ENFORCE_EQ(sched_setaffinity(0, sizeof(set), &set), 0,
+                "Can not bind the thread to the CPUs");
+#endif
+}
+
+}  // namespace core
+}  // namespace turbo_transformers
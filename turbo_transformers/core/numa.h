@@ -12,30 +12,24 @@
 // See the AUTHORS file for names of contributors.
 
 #pragma once
-#include <functional>
-#include <memory>
 #include <string>
 #include <vector>
 
-#include "dlpack/dlpack.h"
-#include "turbo_transformers/layers/types.h"
+namespace turbo_transformers {
+namespace core {
 
-using namespace turbo_transformers;
-using PoolType = layers::types::PoolType;
+// The CPUs of every NUMA node this process may run on, read from
+// /sys/devices/system/node. A host without NUMA information is a single node
+// of all the CPUs of the process.
+std::vector<std::vector<int>> GetNumaNodeCPUs();
 
-class BertModel {
- public:
-  BertModel(const std::string &filename, DLDeviceType device_type,
-            size_t n_layers, int64_t n_heads);
-  ~BertModel();
+// Pins the calling thread to `cpus`. The OpenMP threads it starts afterwards
+// inherit the affinity, and the memory it first touches is taken from the
+// node of the CPUs by the default policy of Linux.
+void BindThreadToCPUs(const std::vector<int> &cpus);
 
-  std::vector<float> operator()(
-      const std::vector<std::vector<int64_t>> &inputs,
-      const std::vector<std::vector<int64_t>> &poistion_ids,
-      const std::vector<std::vector<int64_t>> &segment_ids,
-      PoolType pooling = PoolType::kFirst, bool use_pooler = false) const;
+// Parses a CPU list of sysfs such as "0-3,8,10-11".
+std::vector<int> ParseCPUList(const std::string &list);
 
- private:
-  struct Impl;
-  std::unique_ptr<Impl> m_;
-};
+}  // namespace core
+}  // namespace turbo_transformers
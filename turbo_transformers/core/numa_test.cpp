@@ -0,0 +1,55 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/core/numa.h"
+
+#include <algorithm>
+#include <thread>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "catch2/catch.hpp"
+
+namespace turbo_transformers {
+namespace core {
+
+TEST_CASE("numa-parse-cpu-list", "[numa]") {
+  REQUIRE(ParseCPUList("0-3,8,10-11\n") ==
+          std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+  REQUIRE(ParseCPUList("").empty());
+  REQUIRE_THROWS(ParseCPUList("3-1"));
+  REQUIRE_THROWS(ParseCPUList("a"));
+}
+
+TEST_CASE("numa-bind-thread", "[numa]") {
+  auto nodes = GetNumaNodeCPUs();
+  REQUIRE(!nodes.empty());
+  for (auto &cpus : nodes) {
+    REQUIRE(!cpus.empty());
+  }
+  // The thread is bound to the first CPU of the last node.
+  int cpu = nodes.back().front();
+  std::thread thread([&] {
+    BindThreadToCPUs({nodes.back().front()});
+#ifdef __linux__
+    cpu = sched_getcpu();
+#endif
+  });
+  thread.join();
+  REQUIRE(cpu == nodes.back().front());
+  REQUIRE_THROWS(BindThreadToCPUs({}));
+}
+
+}  // namespace core
+}  // namespace turbo_transformers
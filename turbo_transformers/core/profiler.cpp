@@ -13,8 +13,28 @@
 
 #include "profiler.h"
 
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
 #include "enforce.h"
 #include "loguru.hpp"
+#include "tensor.h"
+#include "tensor_view.h"
+#ifdef TT_WITH_CUDA
+#include "cuda_device_context.h"
+#include "cuda_enforce.cuh"
+#endif
+#ifdef TT_WITH_NVTX
+#include "nvToolsExt.h"
+#endif
 
 #ifdef WITH_GPERFTOOLS
 #include "gperftools/profiler.h"
@@ -47,5 +67,202 @@ void DisableGperf() {
 #endif
 }
 
+namespace {
+using OpKey = std::pair<std::string, std::string>;  // path, input shape
+
+#ifdef TT_WITH_CUDA
+struct PendingTiming {
+  OpKey op;
+  std::unique_ptr<CUDAEvent> start;
+  std::unique_ptr<CUDAEvent> stop;
+};
+
+// The GPU timings are read once this many are queued, so that profiling a
+// long run does not hold on to an event pair per kernel.
+constexpr size_t kMaxPendingTimings = 4096;
+#endif
+
+struct Profiler {
+  std::atomic<bool> enabled{false};
+  std::mutex mutex;
+  // The milliseconds of every call of an op.
+  std::map<OpKey, std::vector<float>> timings;
+#ifdef TT_WITH_CUDA
+  std::vector<PendingTiming> pending;
+#endif
+};
+
+Profiler &GetProfiler() {
+  // Never destroyed, the scopes of other threads may end after it at exit.
+  static auto *profiler = new Profiler();
+  return *profiler;
+}
+
+thread_local std::string tls_path;
+
+std::atomic<bool> gNVTXEnabled{false};
+
+#ifdef TT_WITH_CUDA
+// Called with the mutex of the profiler held.
+void ReadPendingTimings(Profiler *profiler) {
+  for (auto &timing : profiler->pending) {
+    profiler->timings[timing.op].push_back(
+        timing.stop->ElapsedMs(*timing.start));
+  }
+  profiler->pending.clear();
+}
+#endif
+}  // namespace
+
+void EnableProfiler() { GetProfiler().enabled = true; }
+
+void DisableProfiler() { GetProfiler().enabled = false; }
+
+bool IsProfilerEnabled() {
+  return GetProfiler().enabled.load(std::memory_order_relaxed);
+}
+
+void ResetProfiler() {
+  auto &profiler = GetProfiler();
+  std::lock_guard<std::mutex> lock(profiler.mutex);
+  profiler.timings.clear();
+#ifdef TT_WITH_CUDA
+  profiler.pending.clear();
+#endif
+}
+
+std::string GetProfileReport() {
+  auto &profiler = GetProfiler();
+  std::lock_guard<std::mutex> lock(profiler.mutex);
+#ifdef TT_WITH_CUDA
+  ReadPendingTimings(&profiler);
+#endif
+  std::string report =
+      absl::StrFormat("%-48s %-20s %8s %12s %10s %10s\n", "op", "shape",
+                      "count", "total ms", "mean ms", "p99 ms");
+  // The map is sorted by path, so the ops follow their parents.
+  for (auto &op : profiler.timings) {
+    auto &path = op.first.first;
+    auto depth = std::count(path.begin(), path.end(), '/');
+    auto name = std::string(2 * depth, ' ') + path.substr(path.rfind('/') + 1);
+    auto ms = op.second;
+    double total = std::accumulate(ms.begin(), ms.end(), 0.0);
+    size_t p99 = (ms.size() * 99 + 99) / 100 - 1;
+    std::nth_element(ms.begin(), ms.begin() + p99, ms.end());
+    absl::StrAppendFormat(&report, "%-48s %-20s %8d %12.3f %10.3f %10.3f\n",
+                          name, op.first.second, ms.size(), total,
+                          total / ms.size(), ms[p99]);
+  }
+  return report;
+}
+
+void EnableNVTX() {
+#ifdef TT_WITH_NVTX
+  gNVTXEnabled = true;
+#else
+  LOG_S(WARNING) << "turbo_transformers is not compiled with NVTX.";
+#endif
+}
+
+void DisableNVTX() { gNVTXEnabled = false; }
+
+bool IsNVTXEnabled() { return gNVTXEnabled.load(std::memory_order_relaxed); }
+
+struct ProfileScope::GPUTimer {
+#ifdef TT_WITH_CUDA
+  int device_id;
+  std::unique_ptr<CUDAEvent> start;
+#endif
+};
+
+ProfileScope::ProfileScope(const char *name, const Tensor &input,
+                           int index) {
+  if ((IsProfilerEnabled() || IsNVTXEnabled()) && !input.is_null()) {
+    Start(name, input, index);
+  }
+}
+
+ProfileScope::ProfileScope(const char *name, const TensorView &input,
+                           int index) {
+  if (IsProfilerEnabled() || IsNVTXEnabled()) {
+    Start(name, input, index);
+  }
+}
+
+template <typename TensorT>
+void ProfileScope::Start(const char *name, const TensorT &input, int index) {
+  std::vector<int64_t> shape;
+  for (size_t i = 0; i < input.n_dim(); ++i) {
+    shape.push_back(input.shape(i));
+  }
+  shape_ = absl::StrCat("[", absl::StrJoin(shape, ","), "]");
+#ifdef TT_WITH_NVTX
+  if (IsNVTXEnabled()) {
+    auto message = index < 0 ? absl::StrCat(name, " ", shape_)
+                             : absl::StrCat(name, " ", index, " ", shape_);
+    nvtxRangePushA(message.c_str());
+    nvtx_pushed_ = true;
+  }
+#endif
+  if (!IsProfilerEnabled()) {
+    return;
+  }
+#ifdef TT_WITH_CUDA
+  if (input.device_type() == kDLGPU) {
+    // The events of a stream being captured into a CUDA graph can not be
+    // timed.
+    cudaStreamCaptureStatus status;
+    TT_ENFORCE_CUDA_SUCCESS(cudaStreamIsCapturing(
+        CUDADeviceContext::GetInstance(input.device_id()).stream(), &status));
+    if (status != cudaStreamCaptureStatusNone) {
+      return;
+    }
+    gpu_timer_.reset(new GPUTimer{
+        input.device_id(),
+        std::unique_ptr<CUDAEvent>(new CUDAEvent(input.device_id(), true))});
+    gpu_timer_->start->Record();
+  }
+#endif
+  active_ = true;
+  prev_path_size_ = tls_path.size();
+  if (!tls_path.empty()) {
+    tls_path.push_back('/');
+  }
+  tls_path.append(name);
+  start_ = std::chrono::steady_clock::now();
+}
+
+ProfileScope::~ProfileScope() {
+#ifdef TT_WITH_NVTX
+  if (nvtx_pushed_) {
+    nvtxRangePop();
+  }
+#endif
+  if (!active_) {
+    return;
+  }
+  auto &profiler = GetProfiler();
+  OpKey op(tls_path, std::move(shape_));
+  tls_path.resize(prev_path_size_);
+#ifdef TT_WITH_CUDA
+  if (gpu_timer_ != nullptr) {
+    std::unique_ptr<CUDAEvent> stop(new CUDAEvent(gpu_timer_->device_id, true));
+    stop->Record();
+    std::lock_guard<std::mutex> lock(profiler.mutex);
+    profiler.pending.push_back(
+        {std::move(op), std::move(gpu_timer_->start), std::move(stop)});
+    if (profiler.pending.size() >= kMaxPendingTimings) {
+      ReadPendingTimings(&profiler);
+    }
+    return;
+  }
+#endif
+  float ms = std::chrono::duration<float, std::milli>(
+                 std::chrono::steady_clock::now() - start_)
+                 .count();
+  std::lock_guard<std::mutex> lock(profiler.mutex);
+  profiler.timings[op].push_back(ms);
+}
+
 }  // namespace core
 }  // namespace turbo_transformers
@@ -13,13 +13,75 @@
 
 #pragma once
 
+#include <dlpack/dlpack.h>
+
+#include <chrono>
+#include <memory>
 #include <string>
 
+#include "turbo_transformers/core/macros.h"
+
 namespace turbo_transformers {
 namespace core {
 
 void EnableGperf(const std::string& profile_file);
 void DisableGperf();
 
+// The op profiler times the layers and the kernels wrapped by a ProfileScope,
+// by CUDA events on the GPU and by the steady clock on the CPU. The timings
+// are aggregated by the path of the enclosing scopes of the calling thread,
+// e.g. "BertLayer/BertAttention/MatMul", and by the input shape.
+//
+// The profiler is off by default; when off, a scope only pays for one atomic
+// load.
+void EnableProfiler();
+void DisableProfiler();
+bool IsProfilerEnabled();
+
+// Drop the timings collected so far.
+void ResetProfiler();
+
+// The call tree of the ops, with the count, total, mean and 99th percentile
+// milliseconds per op and input shape, the children of an op indented below
+// it. It waits for the GPU timings not done yet.
+std::string GetProfileReport();
+
+// The same scopes push NVTX ranges, which name the kernels on the timelines
+// of Nsight Systems, once the library is built WITH_NVTX and the ranges are
+// enabled. A range is named by the op, the index of its scope if any, and
+// the input shape, e.g. "Layer 3 [1,128,768]". Without NVTX, EnableNVTX only
+// logs a warning.
+void EnableNVTX();
+void DisableNVTX();
+bool IsNVTXEnabled();
+
+class Tensor;
+class TensorView;
+
+// Times its scope as the op `name`, whose shape and device are the ones of
+// `input`. `name` must outlive the scope, e.g. a string literal. A
+// non-negative `index`, e.g. the layer of an encoder, only shows in the NVTX
+// range, the profiler adds up the calls of all the indices.
+class ProfileScope {
+ public:
+  ProfileScope(const char* name, const Tensor& input, int index = -1);
+  ProfileScope(const char* name, const TensorView& input, int index = -1);
+  ~ProfileScope();
+
+ private:
+  struct GPUTimer;
+
+  template <typename TensorT>
+  void Start(const char* name, const TensorT& input, int index);
+
+  bool active_{false};
+  bool nvtx_pushed_{false};
+  size_t prev_path_size_{0};
+  std::string shape_;
+  std::chrono::steady_clock::time_point start_;
+  std::unique_ptr<GPUTimer> gpu_timer_;
+  DISABLE_COPY_AND_ASSIGN(ProfileScope);
+};
+
 }  // namespace core
 }  // namespace turbo_transformers
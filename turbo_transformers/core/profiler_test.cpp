@@ -0,0 +1,65 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/core/profiler.h"
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/core/tensor.h"
+
+namespace turbo_transformers {
+namespace core {
+
+TEST_CASE("profiler-call_tree", "[profiler]") {
+  Tensor input(NewDLPackTensorT<float>({2, 8}));
+  {
+    // Not recorded while the profiler is off.
+    ProfileScope scope("Off", input);
+  }
+  EnableProfiler();
+  ResetProfiler();
+  for (int i = 0; i < 3; ++i) {
+    ProfileScope layer("TestLayer", input);
+    ProfileScope kernel("TestKernel", input);
+  }
+  DisableProfiler();
+
+  auto report = GetProfileReport();
+  REQUIRE(report.find("Off") == std::string::npos);
+  auto layer = report.find("\nTestLayer ");
+  auto kernel = report.find("\n  TestKernel ");
+  REQUIRE(layer != std::string::npos);
+  REQUIRE(kernel != std::string::npos);
+  REQUIRE(layer < kernel);
+  REQUIRE(report.find("[2,8]") != std::string::npos);
+  auto line = report.substr(kernel + 1, report.find('\n', kernel + 1) - kernel);
+  REQUIRE(line.find(" 3 ") != std::string::npos);
+
+  ResetProfiler();
+  REQUIRE(GetProfileReport().find("TestLayer") == std::string::npos);
+}
+
+TEST_CASE("profiler-nvtx", "[profiler]") {
+  Tensor input(NewDLPackTensorT<float>({2, 8}));
+  EnableNVTX();
+  {
+    // The NVTX ranges alone do not record timings.
+    ProfileScope layer("Layer", input, 3);
+    ProfileScope kernel("TestKernel", input);
+  }
+  DisableNVTX();
+  REQUIRE(!IsNVTXEnabled());
+  REQUIRE(GetProfileReport().find("TestKernel") == std::string::npos);
+}
+
+}  // namespace core
+}  // namespace turbo_transformers
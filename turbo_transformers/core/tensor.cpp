@@ -13,24 +13,40 @@
 
 #include "tensor.h"
 
+#include "turbo_transformers/core/cpu_allocator.h"
+#include "turbo_transformers/core/memory_tracker.h"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/tensor_view.h"
 #ifdef TT_WITH_CUDA
 #include "turbo_transformers/core/cuda_allocator.h"
 #include "turbo_transformers/core/cuda_device_context.h"
+#include "turbo_transformers/core/cuda_host_allocator.h"
 #endif
 
 namespace turbo_transformers {
 namespace core {
+// The enforce messages of TensorView take kMaxDims by reference, which needs
+// a definition before C++17.
+constexpr int TensorView::kMaxDims;
+
 static void DLManagedTensorDeletor(DLManagedTensor *self) {
   if (self == nullptr) {
     return;
   }
+  details::TrackDeallocation(self->manager_ctx);
   if (self->dl_tensor.data != nullptr) {
     if (self->dl_tensor.ctx.device_type == kDLCPU) {
-      free(self->dl_tensor.data);
+      CPUAllocator &cpu_allocator = CPUAllocator::GetInstance();
+      cpu_allocator.free(self->dl_tensor.data);
     } else if (self->dl_tensor.ctx.device_type == kDLGPU) {
 #ifdef TT_WITH_CUDA
       CUDAAllocator &cuda_allocator = CUDAAllocator::GetInstance();
-      cuda_allocator.free(self->dl_tensor.data);
+      cuda_allocator.free(self->dl_tensor.data,
+                          self->dl_tensor.ctx.device_id);
+#endif
+    } else if (self->dl_tensor.ctx.device_type == kDLCPUPinned) {
+#ifdef TT_WITH_CUDA
+      CUDAHostAllocator::GetInstance().free(self->dl_tensor.data);
 #endif
     }
   }
@@ -39,10 +55,26 @@ static void DLManagedTensorDeletor(DLManagedTensor *self) {
   delete self;
 }
 
-DLManagedTensor *NewDLPackTensor(const std::vector<int64_t> &shape_list,
-                                 DLDeviceType device, int device_id,
-                                 uint8_t data_type_code, size_t bits,
-                                 size_t lanes) {
+static void DLManagedTensorViewDeletor(DLManagedTensor *self) {
+  if (self == nullptr) {
+    return;
+  }
+  delete[] self->dl_tensor.shape;
+  delete self;
+}
+
+static void DLManagedTensorOwnerDeletor(DLManagedTensor *self) {
+  if (self == nullptr) {
+    return;
+  }
+  delete static_cast<std::shared_ptr<const void> *>(self->manager_ctx);
+  delete[] self->dl_tensor.shape;
+  delete self;
+}
+
+static DLManagedTensor *NewDLPackTensorMeta(
+    const std::vector<int64_t> &shape_list, DLDeviceType device,
+    int device_id, uint8_t data_type_code, size_t bits, size_t lanes) {
   TT_ENFORCE_NE(shape_list.size(), 0, "Shape list should not be empty");
   auto *newTensor = new DLManagedTensor();
 
@@ -56,23 +88,102 @@ DLManagedTensor *NewDLPackTensor(const std::vector<int64_t> &shape_list,
       static_cast<uint8_t>(data_type_code), static_cast<uint8_t>(bits),
       static_cast<uint16_t>(lanes)};  // code, bits, lanes
 
-  newTensor->dl_tensor.strides = nullptr;  // TODO
+  newTensor->dl_tensor.strides = nullptr;  // compact row major
   newTensor->dl_tensor.byte_offset = 0;
+  return newTensor;
+}
+
+DLManagedTensor *NewDLPackTensorView(void *data,
+                                     const std::vector<int64_t> &shape_list,
+                                     DLDeviceType device, int device_id,
+                                     uint8_t data_type_code, size_t bits,
+                                     size_t lanes) {
+  auto *newTensor = NewDLPackTensorMeta(shape_list, device, device_id,
+                                        data_type_code, bits, lanes);
+  newTensor->dl_tensor.data = data;
+  newTensor->deleter = DLManagedTensorViewDeletor;
+  return newTensor;
+}
+
+DLManagedTensor *NewDLPackTensorView(void *data,
+                                     const std::vector<int64_t> &shape_list,
+                                     DLDeviceType device, int device_id,
+                                     uint8_t data_type_code, size_t bits,
+                                     size_t lanes,
+                                     std::shared_ptr<const void> owner) {
+  auto *newTensor = NewDLPackTensorMeta(shape_list, device, device_id,
+                                        data_type_code, bits, lanes);
+  newTensor->dl_tensor.data = data;
+  newTensor->manager_ctx = new std::shared_ptr<const void>(std::move(owner));
+  newTensor->deleter = DLManagedTensorOwnerDeletor;
+  return newTensor;
+}
+
+DLManagedTensor *Tensor::ToSharedDLPack() {
+  TT_ENFORCE(absl::holds_alternative<details::DLManagedTensorPtr>(tensor_),
+             "Must own dltensor");
+  auto &ptr = absl::get<details::DLManagedTensorPtr>(tensor_);
+  TT_ENFORCE(ptr->deleter != DLManagedTensorViewDeletor,
+             "A view does not own the data to share");
+  auto new_view = [](const DLTensor &dl_tensor,
+                     std::shared_ptr<const void> owner) {
+    return NewDLPackTensorView(
+        static_cast<char *>(dl_tensor.data) + dl_tensor.byte_offset,
+        std::vector<int64_t>(dl_tensor.shape, dl_tensor.shape + dl_tensor.ndim),
+        dl_tensor.ctx.device_type, dl_tensor.ctx.device_id,
+        dl_tensor.dtype.code, dl_tensor.dtype.bits, dl_tensor.dtype.lanes,
+        std::move(owner));
+  };
+  if (ptr->deleter != DLManagedTensorOwnerDeletor) {
+    std::shared_ptr<DLManagedTensor> owner(
+        ptr.release(), details::DLPackManagedTensorDeleter());
+    ptr.reset(new_view(owner->dl_tensor, owner));
+  }
+  return new_view(ptr->dl_tensor,
+                  *static_cast<std::shared_ptr<const void> *>(ptr->manager_ctx));
+}
+
+bool Tensor::is_view() const {
+  if (!absl::holds_alternative<details::DLManagedTensorPtr>(tensor_)) {
+    return false;
+  }
+  auto deleter = absl::get<details::DLManagedTensorPtr>(tensor_)->deleter;
+  return deleter == DLManagedTensorViewDeletor ||
+         deleter == DLManagedTensorOwnerDeletor;
+}
+
+DLManagedTensor *NewDLPackTensor(const std::vector<int64_t> &shape_list,
+                                 DLDeviceType device, int device_id,
+                                 uint8_t data_type_code, size_t bits,
+                                 size_t lanes) {
+  auto *newTensor = NewDLPackTensorMeta(shape_list, device, device_id,
+                                        data_type_code, bits, lanes);
 
   size_t numel = std::accumulate(shape_list.begin(), shape_list.end(), 1,
                                  std::multiplies<int64_t>());
   if (device == kDLCPU) {
-    newTensor->dl_tensor.data = align_alloc(numel * (bits / 8));
+    CPUAllocator &cpu_allocator = CPUAllocator::GetInstance();
+    newTensor->dl_tensor.data = cpu_allocator.allocate(numel * (bits / 8));
   } else if (device == kDLGPU) {
 #ifdef TT_WITH_CUDA
     CUDAAllocator &cuda_allocator = CUDAAllocator::GetInstance();
     size_t size = numel * (bits / 8);
-    newTensor->dl_tensor.data = cuda_allocator.allocate(size);
+    newTensor->dl_tensor.data = cuda_allocator.allocate(size, device_id);
+#endif
+  } else if (device == kDLCPUPinned) {
+#ifdef TT_WITH_CUDA
+    newTensor->dl_tensor.data =
+        CUDAHostAllocator::GetInstance().allocate(numel * (bits / 8));
+#else
+    TT_THROW("pinned memory is not supported without CUDA!");
 #endif
   } else {
     TT_THROW("only cpu and gpu are supported!");
   }
 
+  AddToCounter(Counter::kAllocatedBytes, numel * (bits / 8));
+  newTensor->manager_ctx = details::TrackAllocation(newTensor->dl_tensor.ctx,
+                                                    numel * (bits / 8));
   newTensor->deleter = DLManagedTensorDeletor;
   return newTensor;
 }
@@ -20,6 +20,7 @@
 #include <vector>
 
 #include "absl/types/variant.h"
+#include "turbo_transformers/core/bfloat16.h"
 #include "turbo_transformers/core/blas.h"
 #include "turbo_transformers/core/enforce.h"
 #include "turbo_transformers/core/half.h"
@@ -52,6 +53,16 @@ struct DataTypeTrait<int> {
   enum { DLPackTypeCode = kDLInt };
 };
 
+template <>
+struct DataTypeTrait<uint8_t> {
+  enum { DLPackTypeCode = kDLUInt };
+};
+
+template <>
+struct DataTypeTrait<int8_t> {
+  enum { DLPackTypeCode = kDLInt };
+};
+
 template <>
 struct DataTypeTrait<int64_t> {
   enum { DLPackTypeCode = kDLInt };
@@ -62,6 +73,12 @@ struct DataTypeTrait<core::Half> {
   enum { DLPackTypeCode = kDLFloat };
 };
 
+// kDLBfloat of DLPack 0.3, whose kDLFloat of 16 bits is a half.
+template <>
+struct DataTypeTrait<core::BFloat16> {
+  enum { DLPackTypeCode = 4 };
+};
+
 template <typename T>
 static inline bool IsDataType(DLDataType dt) {
   return DataTypeTrait<T>::DLPackTypeCode == dt.code &&
@@ -110,6 +127,30 @@ inline DLManagedTensor *NewDLPackTensorT(const std::vector<int64_t> &shape_list,
                          sizeof(T) * 8, 1);
 }
 
+// Wraps memory owned by someone else, e.g. a workspace arena. Destroying the
+// returned tensor only releases its meta data.
+extern DLManagedTensor *NewDLPackTensorView(
+    void *data, const std::vector<int64_t> &shape_list, DLDeviceType device,
+    int device_id, uint8_t data_type_code, size_t bits, size_t lanes);
+
+template <typename T>
+inline DLManagedTensor *NewDLPackTensorViewT(
+    T *data, const std::vector<int64_t> &shape_list,
+    DLDeviceType device = kDLCPU, int device_id = 0) {
+  return NewDLPackTensorView(data, shape_list, device, device_id,
+                             details::DataTypeTrait<T>::DLPackTypeCode,
+                             sizeof(T) * 8, 1);
+}
+
+// As NewDLPackTensorView, but the returned tensor keeps `owner` of the
+// memory, e.g. a mapped file, alive until it is destroyed.
+extern DLManagedTensor *NewDLPackTensorView(
+    void *data, const std::vector<int64_t> &shape_list, DLDeviceType device,
+    int device_id, uint8_t data_type_code, size_t bits, size_t lanes,
+    std::shared_ptr<const void> owner);
+
+class TensorView;
+
 class Tensor {
  public:
   explicit Tensor(DLManagedTensor *tensor) {
@@ -126,6 +167,23 @@ class Tensor {
     return absl::get<details::DLManagedTensorPtr>(tensor_).release();
   }
 
+  // A view of the data, which this tensor keeps owning. It is valid until the
+  // tensor is destroyed or reallocated by a Reshape to more elements.
+  DLManagedTensor *ToDLPackView() const {
+    auto &dl_tensor = to_dl_tensor();
+    return NewDLPackTensorView(
+        static_cast<char *>(dl_tensor.data) + dl_tensor.byte_offset,
+        std::vector<int64_t>(dl_tensor.shape, dl_tensor.shape + dl_tensor.ndim),
+        dl_tensor.ctx.device_type, dl_tensor.ctx.device_id,
+        dl_tensor.dtype.code, dl_tensor.dtype.bits, dl_tensor.dtype.lanes);
+  }
+
+  // A view of the data which shares its ownership with this tensor, e.g. to
+  // hand a reused output buffer to torch. The data stays valid as long as
+  // the view lives, even once the tensor is destroyed or reallocated by a
+  // Reshape to more elements. The tensor becomes a view of the shared data.
+  DLManagedTensor *ToSharedDLPack();
+
   size_t n_dim() const {
     auto &dl_tensor = to_dl_tensor();
     return dl_tensor.ndim;
@@ -153,18 +211,23 @@ class Tensor {
   T *Reshape(std::initializer_list<int64_t> shape_list,
              DLDeviceType device_type, int device_id) {
     // if Need Realloc
-    if (absl::visit(ReshapeNeedRealloc(shape_list), tensor_)) {
+    if (absl::visit(ReshapeNeedRealloc<T>(shape_list), tensor_)) {
       tensor_ = details::DLManagedTensorPtr(
           NewDLPackTensorT<T>(shape_list, device_type, device_id));
     }
     return this->template mutableData<T>();
   }
 
+  // The kernels reading the raw data assume the dense row major layout, so
+  // strided tensors have to go through TensorView.
   template <typename T>
   const T *data() const {
     auto &dltensor = to_dl_tensor();
     EnforceDataType<T>(dltensor);
-    return reinterpret_cast<T *>(dltensor.data);
+    TT_ENFORCE(IsContiguous(dltensor),
+               "The tensor is not contiguous, use a TensorView to access it");
+    return reinterpret_cast<const T *>(
+        reinterpret_cast<const char *>(dltensor.data) + dltensor.byte_offset);
   }
 
   template <typename T>
@@ -172,6 +235,17 @@ class Tensor {
     return const_cast<T *>(data<T>());
   }
 
+  // The element type and the bytes of the elements, e.g. to store a tensor
+  // whatever its type is.
+  DLDataType dtype() const { return to_dl_tensor().dtype; }
+  const void *raw_data() const {
+    auto &dltensor = to_dl_tensor();
+    TT_ENFORCE(IsContiguous(dltensor),
+               "The tensor is not contiguous, use a TensorView to access it");
+    return reinterpret_cast<const char *>(dltensor.data) +
+           dltensor.byte_offset;
+  }
+
   DLDeviceType device_type() const {
     auto &dltensor = to_dl_tensor();
     return dltensor.ctx.device_type;
@@ -190,6 +264,20 @@ class Tensor {
     return absl::holds_alternative<absl::monostate>(tensor_);
   }
 
+  bool is_contiguous() const { return IsContiguous(to_dl_tensor()); }
+
+  // Whether the data is owned by someone else, i.e. the tensor was made by
+  // NewDLPackTensorView, e.g. a weight of a mapped file or one shared by the
+  // models through the WeightStore.
+  bool is_view() const;
+
+  // Whether the elements are of type T, e.g. to dispatch a kernel on float or
+  // core::Half.
+  template <typename T>
+  bool IsType() const {
+    return details::IsDataType<T>(to_dl_tensor().dtype);
+  }
+
   template <typename T>
   void Print(std::ostream &os) const {
     auto &dl_tensor = to_dl_tensor();
@@ -211,16 +299,21 @@ class Tensor {
     int cnt = 10;
     double sum = 0.;
 
-    if (device_type() == kDLCPU) {
+    // Print the elements in their memory order, which also works for the
+    // strided tensors.
+    EnforceDataType<T>(dl_tensor);
+    const T *raw_data = reinterpret_cast<const T *>(
+        reinterpret_cast<const char *>(dl_tensor.data) + dl_tensor.byte_offset);
+    if (IsHostDevice(device_type())) {
       for (int i = 0; i < numel(); ++i) {
-        sum += data<T>()[i];
-        if (cnt-- >= 0) os << data<T>()[i] << ", ";
+        sum += raw_data[i];
+        if (cnt-- >= 0) os << raw_data[i] << ", ";
       }
     } else if (device_type() == kDLGPU) {
 #ifdef TT_WITH_CUDA
       auto n = numel();
       std::unique_ptr<T[]> cpu_data(new T[n]);
-      Memcpy(cpu_data.get(), data<T>(), n * sizeof(T), MemcpyFlag::kGPU2CPU);
+      Memcpy(cpu_data.get(), raw_data, n * sizeof(T), MemcpyFlag::kGPU2CPU);
       for (int i = 0; i < n; ++i) {
         sum += cpu_data[i];
         if (cnt-- >= 0) os << cpu_data[i] << ", ";
@@ -236,6 +329,8 @@ class Tensor {
   Tensor operator[](int64_t n) {
     auto &dl_tensor = to_dl_tensor();
     TT_ENFORCE_GT(dl_tensor.ndim, 1, "operator[] needs ndim > 1");
+    TT_ENFORCE(IsContiguous(dl_tensor),
+               "operator[] needs a contiguous tensor, use TensorView instead");
     details::DLTensorPtr result(new DLTensor());
     result->dtype = dl_tensor.dtype;
     result->byte_offset = 0;
@@ -282,22 +377,44 @@ class Tensor {
     os << ")";
   }
 
-  template <typename T>
-  static void EnforceDataType(DLTensor t) {
-    TT_ENFORCE_EQ(t.byte_offset, 0, "byte_offset must be zero");
+  // Null strides mean the compact row major layout in DLPack. Dims of size
+  // one may have any stride.
+  static bool IsContiguous(const DLTensor &t) {
+    if (t.strides == nullptr) {
+      return true;
+    }
+    int64_t expected = 1;
+    for (int i = t.ndim - 1; i >= 0; --i) {
+      if (t.shape[i] != 1 && t.strides[i] != expected) {
+        return false;
+      }
+      expected *= t.shape[i];
+    }
+    return true;
+  }
 
+  template <typename T>
+  static void EnforceDataType(const DLTensor &t) {
     TT_ENFORCE(details::IsDataType<T>(t.dtype),
                "data type mismatch, request %s, actual (%d,%d)",
                typeid(T).name(), t.dtype.code, t.dtype.bits);
   }
 
  private:
+  template <typename DType>
   struct ReshapeNeedRealloc {
    public:
     ReshapeNeedRealloc(const std::initializer_list<int64_t> &shape_list)
         : shape_list_(shape_list) {}
 
     bool operator()(details::DLManagedTensorPtr &ptr) const {
+      // A strided tensor can not be reused in the dense layout, nor can a
+      // tensor of another data type, e.g. a float output reused by a half
+      // model.
+      if (!details::IsDataType<DType>(ptr->dl_tensor.dtype) ||
+          !IsContiguous(ptr->dl_tensor)) {
+        return true;
+      }
       int64_t numel = std::accumulate(
           ptr->dl_tensor.shape, ptr->dl_tensor.shape + ptr->dl_tensor.ndim, 1,
           std::multiplies<int64_t>());
@@ -310,6 +427,9 @@ class Tensor {
         }
         std::copy(shape_list_.begin(), shape_list_.end(), ptr->dl_tensor.shape);
         ptr->dl_tensor.ndim = shape_list_.size();
+        // The strides of the old shape are stale, fall back to the dense
+        // layout. The strides array belongs to the producer of the tensor.
+        ptr->dl_tensor.strides = nullptr;
         return false;
       }
       return true;
@@ -324,6 +444,8 @@ class Tensor {
     const std::initializer_list<int64_t> &shape_list_;
   };
 
+  friend class TensorView;
+
   const DLTensor &to_dl_tensor() const {
     return absl::visit(details::VisitDLTensor(), tensor_);
   }
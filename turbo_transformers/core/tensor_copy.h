@@ -46,5 +46,25 @@ static inline void Copy(const core::Tensor &src, core::Tensor &dst) {
                flag);
 }
 
+// The asynchronous counterparts of Copy, see MemcpyAsync.
+// The copy is queued on the device of the GPU side.
+template <typename T>
+static inline void CopyAsync(const T *data, size_t size,
+                             DLDeviceType srcDevice, core::Tensor &dst) {
+  auto flag = core::ToMemcpyFlag(dst.device_type(), srcDevice);
+  core::MemcpyAsync(dst.mutableData<T>(), data, sizeof(T) * size, flag,
+                    dst.device_id());
+}
+template <typename T>
+static inline void CopyAsync(const core::Tensor &src, core::Tensor &dst) {
+  TT_ENFORCE_EQ(dst.numel(), src.numel(),
+                "Copy two tensors should have the same size");
+  auto flag = core::ToMemcpyFlag(dst.device_type(), src.device_type());
+  int device_id =
+      dst.device_type() == kDLGPU ? dst.device_id() : src.device_id();
+  core::MemcpyAsync(dst.mutableData<T>(), src.data<T>(),
+                    sizeof(T) * src.numel(), flag, device_id);
+}
+
 }  // namespace core
 }  // namespace turbo_transformers
@@ -13,6 +13,9 @@
 #include "turbo_transformers/core/tensor.h"
 
 #include "catch2/catch.hpp"
+#ifdef TT_WITH_CUDA
+#include "turbo_transformers/core/cuda_device_context.h"
+#endif
 
 namespace turbo_transformers {
 namespace core {
@@ -34,6 +37,65 @@ TEST_CASE("TensorTest2", "[tensor_init]") {
   REQUIRE(test_tensor.numel() == 3 * 4);
 }
 
+TEST_CASE("TensorTest-dlpack-view", "[tensor_init]") {
+  Tensor tensor(NewDLPackTensorT<float>({3, 4}));
+  tensor.mutableData<float>()[5] = 1.5f;
+  {
+    Tensor view(tensor.ToDLPackView());
+    REQUIRE(view.data<float>() == tensor.data<float>());
+    REQUIRE(view.shape(1) == 4);
+    REQUIRE(view.data<float>()[5] == 1.5f);
+    REQUIRE(view.is_view());
+    Tensor owned_view(NewDLPackTensorView(
+        tensor.mutableData<float>(), {3, 4}, kDLCPU, 0, kDLFloat, 32, 1,
+        std::make_shared<int>(0)));
+    REQUIRE(owned_view.is_view());
+  }
+  REQUIRE(!tensor.is_view());
+  // The view does not own the data.
+  REQUIRE(tensor.data<float>()[5] == 1.5f);
+  tensor.Reshape<float>({2, 4}, kDLCPU, 0);
+  Tensor view(tensor.ToDLPackView());
+  REQUIRE(view.numel() == 8);
+}
+
+TEST_CASE("TensorTest-shared-dlpack", "[tensor_init]") {
+  Tensor tensor(NewDLPackTensorT<float>({3, 4}));
+  tensor.mutableData<float>()[5] = 1.5f;
+  const float *data = tensor.data<float>();
+  Tensor shared(tensor.ToSharedDLPack());
+  REQUIRE(shared.data<float>() == data);
+  REQUIRE(tensor.data<float>() == data);
+  REQUIRE(tensor.is_view());
+  // Shrunk in place, the tensor still writes into the shared data.
+  tensor.Reshape<float>({2, 4}, kDLCPU, 0);
+  REQUIRE(tensor.data<float>() == data);
+  Tensor shared_again(tensor.ToSharedDLPack());
+  REQUIRE(shared_again.numel() == 8);
+  // The shared data outlives the reallocation of the tensor for more
+  // elements.
+  tensor.Reshape<float>({8, 4}, kDLCPU, 0);
+  REQUIRE(tensor.data<float>() != data);
+  tensor = Tensor(nullptr);
+  REQUIRE(shared.data<float>()[5] == 1.5f);
+  REQUIRE(shared.shape(0) == 3);
+
+  float raw[4];
+  Tensor view(NewDLPackTensorViewT<float>(raw, {4}));
+  REQUIRE_THROWS(view.ToSharedDLPack());
+}
+
+TEST_CASE("TensorTest-memcpy-flag", "[memcpy]") {
+  REQUIRE(ToMemcpyFlag(kDLCPU, kDLCPUPinned) == MemcpyFlag::kCPU2CPU);
+  REQUIRE(ToMemcpyFlag(kDLGPU, kDLCPUPinned) == MemcpyFlag::kCPU2GPU);
+  REQUIRE(ToMemcpyFlag(kDLCPUPinned, kDLGPU) == MemcpyFlag::kGPU2CPU);
+
+  float src[] = {1, 2, 3};
+  float dst[] = {0, 0, 0};
+  MemcpyAsync(dst, src, sizeof(src), MemcpyFlag::kCPU2CPU, 0);
+  REQUIRE(dst[2] == 3);
+}
+
 #ifdef TT_WITH_CUDA
 template <typename T>
 inline void Fill(Tensor &tensor) {
@@ -55,6 +117,21 @@ TEST_CASE("TensorTest3", "GPU init") {
   REQUIRE(test_tensor.n_dim() == 2);
   REQUIRE(test_tensor.numel() == 3 * 4);
 }
+
+TEST_CASE("TensorTest-pinned-async-copy", "[memcpy]") {
+  Tensor host_tensor(NewDLPackTensorT<float>({3, 4}, kDLCPUPinned, 0));
+  float *host_data = host_tensor.mutableData<float>();
+  for (int i = 0; i < 12; ++i) host_data[i] = i * 0.1;
+  Tensor gpu_tensor(NewDLPackTensorT<float>({3, 4}, kDLGPU, 0));
+  Tensor result(NewDLPackTensorT<float>({3, 4}, kDLCPUPinned, 0));
+  MemcpyAsync(gpu_tensor.mutableData<float>(), host_data, 12 * sizeof(float),
+              MemcpyFlag::kCPU2GPU, 0);
+  MemcpyAsync(result.mutableData<float>(), gpu_tensor.data<float>(),
+              12 * sizeof(float), MemcpyFlag::kGPU2CPU, 0);
+  CUDADeviceContext::GetInstance(0).Wait();
+  for (int i = 0; i < 12; ++i)
+    REQUIRE(fabs(result.data<float>()[i] - i * 0.1) < 1e-6);
+}
 #endif
 
 }  // namespace core
@@ -0,0 +1,169 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <dlpack/dlpack.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <numeric>
+#include <type_traits>
+
+#include "turbo_transformers/core/enforce.h"
+#include "turbo_transformers/core/tensor.h"
+
+namespace turbo_transformers {
+namespace core {
+
+// A non-owning view of a tensor. It is trivially copyable and keeps the shape
+// and strides inline, so creating, slicing and querying a view never
+// allocates nor visits the payload variant of core::Tensor.
+//
+// Unlike core::Tensor::data, the data of a view may be strided, e.g. a
+// transposed weight or a slice imported from torch. The strides are counted
+// in elements, as in DLPack.
+//
+// Like a pointer, a const view does not make the data const. Kernels take
+// their inputs as `const TensorView &` and their outputs by value.
+class TensorView {
+ public:
+  static constexpr int kMaxDims = 6;
+
+  TensorView() = default;
+
+  // Implicit, so kernels taking views can be called with tensors directly.
+  TensorView(const Tensor &tensor) {  // NOLINT
+    auto &dl_tensor = tensor.to_dl_tensor();
+    TT_ENFORCE_LE(dl_tensor.ndim, kMaxDims,
+                  "TensorView supports at most %d dims, got %d", kMaxDims,
+                  dl_tensor.ndim);
+    data_ = reinterpret_cast<char *>(dl_tensor.data) + dl_tensor.byte_offset;
+    ctx_ = dl_tensor.ctx;
+    dtype_ = dl_tensor.dtype;
+    ndim_ = dl_tensor.ndim;
+    std::copy(dl_tensor.shape, dl_tensor.shape + ndim_, shape_);
+    if (dl_tensor.strides != nullptr) {
+      std::copy(dl_tensor.strides, dl_tensor.strides + ndim_, strides_);
+    } else {
+      int64_t stride = 1;
+      for (int i = ndim_ - 1; i >= 0; --i) {
+        strides_[i] = stride;
+        stride *= shape_[i];
+      }
+    }
+  }
+
+  size_t n_dim() const { return ndim_; }
+
+  int64_t shape(int pos) const {
+    if (pos < 0) {
+      pos = ndim_ + pos;
+    }
+    TT_ENFORCE_LT(pos, ndim_, "The index(%d) is out of the range[0...%d]", pos,
+                  ndim_ - 1);
+    return shape_[pos];
+  }
+
+  int64_t stride(int pos) const {
+    if (pos < 0) {
+      pos = ndim_ + pos;
+    }
+    TT_ENFORCE_LT(pos, ndim_, "The index(%d) is out of the range[0...%d]", pos,
+                  ndim_ - 1);
+    return strides_[pos];
+  }
+
+  bool is_contiguous() const {
+    int64_t expected = 1;
+    for (int i = ndim_ - 1; i >= 0; --i) {
+      if (shape_[i] != 1 && strides_[i] != expected) {
+        return false;
+      }
+      expected *= shape_[i];
+    }
+    return true;
+  }
+
+  int64_t numel() const {
+    return std::accumulate(shape_, shape_ + ndim_, int64_t(1),
+                           std::multiplies<int64_t>());
+  }
+
+  template <typename T>
+  const T *data() const {
+    TT_ENFORCE(details::IsDataType<T>(dtype_),
+               "data type mismatch, request %s, actual (%d,%d)",
+               typeid(T).name(), dtype_.code, dtype_.bits);
+    return reinterpret_cast<const T *>(data_);
+  }
+
+  template <typename T>
+  T *mutableData() const {
+    return const_cast<T *>(data<T>());
+  }
+
+  template <typename T>
+  bool IsType() const {
+    return details::IsDataType<T>(dtype_);
+  }
+
+  DLDeviceType device_type() const { return ctx_.device_type; }
+  int device_id() const { return ctx_.device_id; }
+  DLContext device_ctx() const { return ctx_; }
+
+  // The n-th sub-tensor along the first dimension.
+  TensorView operator[](int64_t n) const {
+    TT_ENFORCE_GT(ndim_, 1, "operator[] needs ndim > 1");
+    TensorView result = *this;
+    result.data_ = data_ + n * strides_[0] * (dtype_.bits / 8);
+    result.ndim_ = ndim_ - 1;
+    std::copy(shape_ + 1, shape_ + ndim_, result.shape_);
+    std::copy(strides_ + 1, strides_ + ndim_, result.strides_);
+    return result;
+  }
+
+  // A view of the same data with the given shape and strides, starting
+  // `offset` elements after this view, like torch.as_strided. The strides
+  // may be 0 to repeat the data, e.g. for the operands of a batched GEMM.
+  TensorView AsStrided(std::initializer_list<int64_t> shape,
+                       std::initializer_list<int64_t> strides,
+                       int64_t offset = 0) const {
+    TT_ENFORCE_EQ(shape.size(), strides.size(),
+                  "The shape and strides of a view mismatch");
+    TT_ENFORCE_LE(shape.size(), kMaxDims,
+                  "TensorView supports at most %d dims, got %d", kMaxDims,
+                  shape.size());
+    TensorView result = *this;
+    result.data_ = data_ + offset * (dtype_.bits / 8);
+    result.ndim_ = static_cast<int>(shape.size());
+    std::copy(shape.begin(), shape.end(), result.shape_);
+    std::copy(strides.begin(), strides.end(), result.strides_);
+    return result;
+  }
+
+ private:
+  char *data_{nullptr};
+  DLContext ctx_{kDLCPU, 0};
+  DLDataType dtype_{kDLFloat, 32, 1};
+  int ndim_{0};
+  int64_t shape_[kMaxDims]{};
+  int64_t strides_[kMaxDims]{};
+};
+
+static_assert(std::is_trivially_copyable<TensorView>::value,
+              "TensorView must be trivially copyable");
+
+}  // namespace core
+}  // namespace turbo_transformers
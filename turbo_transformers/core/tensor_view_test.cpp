@@ -0,0 +1,106 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+#include "turbo_transformers/core/tensor_view.h"
+
+#include <vector>
+
+#include "catch2/catch.hpp"
+
+namespace turbo_transformers {
+namespace core {
+
+TEST_CASE("tensor_view-from_tensor", "[tensor_view]") {
+  Tensor tensor(NewDLPackTensorT<float>({3, 4, 5}));
+  TensorView view(tensor);
+  REQUIRE(view.n_dim() == 3);
+  REQUIRE(view.shape(0) == 3);
+  REQUIRE(view.shape(-1) == 5);
+  REQUIRE(view.numel() == 60);
+  REQUIRE(view.data<float>() == tensor.data<float>());
+  REQUIRE(view.device_type() == kDLCPU);
+  REQUIRE_THROWS(view.data<int64_t>());
+}
+
+TEST_CASE("tensor_view-slice", "[tensor_view]") {
+  Tensor tensor(NewDLPackTensorT<float>({3, 4, 5}));
+  float *data = tensor.mutableData<float>();
+  for (int i = 0; i < 60; ++i) {
+    data[i] = static_cast<float>(i);
+  }
+  TensorView view(tensor);
+  for (int64_t n = 0; n < 3; ++n) {
+    auto slice = view[n];
+    REQUIRE(slice.n_dim() == 2);
+    REQUIRE(slice.shape(0) == 4);
+    REQUIRE(slice.shape(1) == 5);
+    REQUIRE(slice.data<float>()[0] == 20.f * n);
+    // The slice of a slice.
+    REQUIRE(slice[3].data<float>()[4] == 20.f * n + 19);
+  }
+}
+
+TEST_CASE("tensor_view-strided", "[tensor_view]") {
+  std::vector<float> buffer(24);
+  for (int i = 0; i < 24; ++i) {
+    buffer[i] = static_cast<float>(i);
+  }
+  // The transpose of the 3x4 matrix starting at buffer[2], with strides as
+  // exported by torch.
+  int64_t shape[] = {4, 3};
+  int64_t strides[] = {1, 4};
+  auto *dl_tensor = new DLManagedTensor();
+  dl_tensor->dl_tensor.data = buffer.data();
+  dl_tensor->dl_tensor.ctx = {kDLCPU, 0};
+  dl_tensor->dl_tensor.ndim = 2;
+  dl_tensor->dl_tensor.dtype = {kDLFloat, 32, 1};
+  dl_tensor->dl_tensor.shape = shape;
+  dl_tensor->dl_tensor.strides = strides;
+  dl_tensor->dl_tensor.byte_offset = 2 * sizeof(float);
+  dl_tensor->deleter = [](DLManagedTensor *self) { delete self; };
+  Tensor tensor(dl_tensor);
+  REQUIRE_FALSE(tensor.is_contiguous());
+  REQUIRE_THROWS(tensor.data<float>());
+
+  TensorView view(tensor);
+  REQUIRE_FALSE(view.is_contiguous());
+  REQUIRE(view.stride(0) == 1);
+  REQUIRE(view.stride(-1) == 4);
+  REQUIRE(view.data<float>()[0] == 2.f);
+  REQUIRE(view[1].n_dim() == 1);
+  REQUIRE(view[1].stride(0) == 4);
+  REQUIRE(view[1].data<float>()[0] == 3.f);
+
+  Tensor dense(NewDLPackTensorT<float>({4, 3}));
+  REQUIRE(TensorView(dense).is_contiguous());
+  REQUIRE(TensorView(dense).stride(0) == 3);
+}
+
+TEST_CASE("tensor_view-as_strided", "[tensor_view]") {
+  Tensor tensor(NewDLPackTensorT<float>({2, 6}));
+  float *data = tensor.mutableData<float>();
+  for (int i = 0; i < 12; ++i) {
+    data[i] = static_cast<float>(i);
+  }
+  // The columns [2, 5) of the first row, repeated 4 times.
+  auto view = TensorView(tensor).AsStrided({4, 3}, {0, 1}, 2);
+  REQUIRE(view.n_dim() == 2);
+  REQUIRE(view.shape(0) == 4);
+  REQUIRE(view.stride(0) == 0);
+  REQUIRE(view.data<float>()[0] == 2.f);
+  REQUIRE(view[3].data<float>()[2] == 4.f);
+  REQUIRE_FALSE(view.is_contiguous());
+  REQUIRE_THROWS(TensorView(tensor).AsStrided({4, 3}, {1}));
+}
+
+}  // namespace core
+}  // namespace turbo_transformers
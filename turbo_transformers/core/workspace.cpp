@@ -0,0 +1,72 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/core/workspace.h"
+
+#include "turbo_transformers/core/enforce.h"
+
+namespace turbo_transformers {
+namespace core {
+
+void Workspace::Reserve(const MemoryPlan &plan, DLDeviceType device_type,
+                        int device_id) {
+  // The views of the old arena must not outlive it.
+  entries_.clear();
+  plan_ = plan;
+  arena_size_ = plan_.total_size;
+  // An arena of the device large enough for the plan is kept, so that the
+  // models sharing a workspace reserve it for their plans in turn without
+  // reallocating it.
+  if (!arena_.is_null() && arena_ctx_.device_type == device_type &&
+      arena_ctx_.device_id == device_id && arena_capacity() >= arena_size_) {
+    return;
+  }
+  arena_ctx_ = {device_type, device_id};
+  if (arena_size_ == 0) {
+    arena_ = Tensor(nullptr);
+    return;
+  }
+  arena_ = Tensor(NewDLPackTensorT<uint8_t>(
+      {static_cast<int64_t>(arena_size_)}, device_type, device_id));
+}
+
+Workspace::UseGuard::UseGuard(Workspace *workspace) : workspace_(workspace) {
+  if (workspace_ != nullptr && workspace_->in_use_.exchange(true)) {
+    TT_THROW("The workspace is used by another call at the same time");
+  }
+}
+
+Workspace::UseGuard::~UseGuard() {
+  if (workspace_ != nullptr) {
+    workspace_->in_use_ = false;
+  }
+}
+
+Workspace::Entry &Workspace::GetEntry(absl::string_view name) {
+  auto iter = entries_.find(name);
+  if (iter != entries_.end()) {
+    return iter->second;
+  }
+  std::string key(name);
+  auto &entry = entries_[key];
+  if (arena_size_ != 0) {
+    auto block = plan_.blocks.find(key);
+    if (block != plan_.blocks.end()) {
+      entry.block = &block->second;
+    }
+  }
+  return entry;
+}
+
+}  // namespace core
+}  // namespace turbo_transformers
@@ -0,0 +1,105 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <atomic>
+#include <functional>
+#include <map>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "turbo_transformers/core/memory_planner.h"
+#include "turbo_transformers/core/tensor.h"
+
+namespace turbo_transformers {
+namespace core {
+
+// The intermediate tensors of one inference call, looked up by name.
+//
+// After `Reserve`, every tensor of the plan is a view into a single arena, so
+// the inference does not touch the allocator as long as the requested shapes
+// fit in the planned sizes. Tensors which are not planned, or outgrow their
+// block, are allocated on demand and reused by the following calls like a
+// TempTensor. A workspace must not be used by two calls concurrently.
+class Workspace {
+ public:
+  // Marks `workspace` as used by a call until the guard is destroyed, and
+  // throws if another call is using it already. A null workspace, standing
+  // for the workspace of the calling thread, is not checked.
+  class UseGuard {
+   public:
+    explicit UseGuard(Workspace *workspace);
+    ~UseGuard();
+
+   private:
+    Workspace *workspace_;
+  };
+
+  Workspace() = default;
+
+  void Reserve(const MemoryPlan &plan, DLDeviceType device_type,
+               int device_id);
+
+  template <typename T>
+  Tensor &GetTensor(absl::string_view name,
+                    std::initializer_list<int64_t> shape,
+                    DLDeviceType device_type, int device_id) {
+    auto &entry = GetEntry(name);
+    size_t bytes = std::accumulate(shape.begin(), shape.end(), int64_t(1),
+                                   std::multiplies<int64_t>()) *
+                   sizeof(T);
+    if (entry.block != nullptr && arena_ctx_.device_type == device_type &&
+        arena_ctx_.device_id == device_id && bytes <= entry.block->size) {
+      auto *data = reinterpret_cast<T *>(arena_base() + entry.block->offset);
+      if (entry.tensor.is_null() || !entry.tensor.IsType<T>() ||
+          entry.tensor.data<T>() != data ||
+          entry.tensor.numel() * sizeof(T) < bytes) {
+        // Expose the whole block, so the Reshape below never reallocates.
+        entry.tensor = Tensor(NewDLPackTensorViewT<T>(
+            data, {static_cast<int64_t>(entry.block->size / sizeof(T))},
+            device_type, device_id));
+      }
+    }
+    entry.tensor.Reshape<T>(shape, device_type, device_id);
+    return entry.tensor;
+  }
+
+  // The bytes of the plan, and of the arena, which may be larger, as the
+  // arena of a previous plan is kept if it is large enough.
+  size_t arena_size() const { return arena_size_; }
+  size_t arena_capacity() const {
+    return arena_.is_null() ? 0 : static_cast<size_t>(arena_.numel());
+  }
+  // The plan of the last Reserve.
+  const MemoryPlan &plan() const { return plan_; }
+
+ private:
+  struct Entry {
+    Entry() : tensor(nullptr) {}
+    Tensor tensor;
+    const MemoryBlock *block{nullptr};
+  };
+
+  Entry &GetEntry(absl::string_view name);
+  uint8_t *arena_base() { return arena_.mutableData<uint8_t>(); }
+
+  MemoryPlan plan_;
+  Tensor arena_{nullptr};
+  size_t arena_size_{0};
+  DLContext arena_ctx_{kDLCPU, 0};
+  std::map<std::string, Entry, std::less<>> entries_;
+  std::atomic<bool> in_use_{false};
+};
+
+}  // namespace core
+}  // namespace turbo_transformers
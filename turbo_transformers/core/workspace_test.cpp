@@ -0,0 +1,88 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+#include "turbo_transformers/core/workspace.h"
+
+#include "catch2/catch.hpp"
+
+namespace turbo_transformers {
+namespace core {
+
+TEST_CASE("workspace-planned", "[workspace]") {
+  MemoryPlanner planner;
+  planner.AddUsage("a", 64 * sizeof(float), 0, 1);
+  planner.AddUsage("b", 64 * sizeof(float), 1, 2);
+  planner.AddUsage("c", 64 * sizeof(float), 2, 3);
+  Workspace workspace;
+  workspace.Reserve(planner.Plan(), kDLCPU, 0);
+  REQUIRE(workspace.arena_size() == 2 * 64 * sizeof(float));
+
+  auto &a = workspace.GetTensor<float>("a", {4, 16}, kDLCPU, 0);
+  auto &c = workspace.GetTensor<float>("c", {2, 8}, kDLCPU, 0);
+  REQUIRE(a.data<float>() == c.data<float>());
+  REQUIRE(c.n_dim() == 2);
+  REQUIRE(c.numel() == 16);
+
+  // Growing within the planned size stays in the arena.
+  const float *data = c.data<float>();
+  auto &c2 = workspace.GetTensor<float>("c", {4, 16}, kDLCPU, 0);
+  REQUIRE(c2.data<float>() == data);
+  REQUIRE(c2.numel() == 64);
+
+  // Outgrowing the plan falls back to an allocation.
+  auto &c3 = workspace.GetTensor<float>("c", {8, 16}, kDLCPU, 0);
+  REQUIRE(c3.numel() == 128);
+  REQUIRE(c3.data<float>() != data);
+}
+
+TEST_CASE("workspace-reserve-keeps-arena", "[workspace]") {
+  MemoryPlanner large, small;
+  large.AddUsage("a", 256 * sizeof(float), 0, 0);
+  small.AddUsage("b", 64 * sizeof(float), 0, 0);
+  Workspace workspace;
+  workspace.Reserve(large.Plan(), kDLCPU, 0);
+  const float *data =
+      workspace.GetTensor<float>("a", {256}, kDLCPU, 0).data<float>();
+
+  // A smaller plan reuses the arena of the larger one.
+  workspace.Reserve(small.Plan(), kDLCPU, 0);
+  REQUIRE(workspace.arena_size() == 64 * sizeof(float));
+  REQUIRE(workspace.arena_capacity() == 256 * sizeof(float));
+  REQUIRE(workspace.GetTensor<float>("b", {64}, kDLCPU, 0).data<float>() ==
+          data);
+
+  workspace.Reserve(large.Plan(), kDLCPU, 0);
+  REQUIRE(workspace.arena_capacity() == 256 * sizeof(float));
+}
+
+TEST_CASE("workspace-unplanned", "[workspace]") {
+  Workspace workspace;
+  auto &t = workspace.GetTensor<float>("t", {3, 4}, kDLCPU, 0);
+  const float *data = t.data<float>();
+  auto &t2 = workspace.GetTensor<float>("t", {2, 4}, kDLCPU, 0);
+  REQUIRE(t2.data<float>() == data);
+  REQUIRE(t2.numel() == 8);
+}
+
+TEST_CASE("workspace-use_guard", "[workspace]") {
+  Workspace workspace;
+  {
+    Workspace::UseGuard guard(&workspace);
+    REQUIRE_THROWS(Workspace::UseGuard(&workspace));
+    Workspace::UseGuard thread_workspace(nullptr);
+  }
+  // Released with the guard.
+  Workspace::UseGuard guard(&workspace);
+}
+
+}  // namespace core
+}  // namespace turbo_transformers
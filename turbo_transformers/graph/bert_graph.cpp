@@ -0,0 +1,54 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/graph/bert_graph.h"
+
+#include <utility>
+
+namespace turbo_transformers {
+namespace graph {
+
+int AddBertLayer(Graph *graph, int hidden, int mask, const std::string &prefix,
+                 layers::BertLayerWeights weights, int64_t num_heads) {
+  auto constant = [&](const char *name, core::Tensor *value) {
+    return graph->AddConstant(prefix + name, std::move(*value));
+  };
+  auto &w = weights;
+  int qkv = graph->AddBiasAct(
+      graph->MatMul(hidden, constant("attention.qkv.weight", &w.qkv_weight)),
+      constant("attention.qkv.bias", &w.qkv_bias));
+  int context = graph->Attention(qkv, mask, num_heads);
+  int attention = graph->AddBiasLayerNorm(
+      graph->MatMul(context, constant("attention.output.dense.weight",
+                                      &w.attention_dense_weight)),
+      hidden,
+      constant("attention.output.dense.bias", &w.attention_dense_bias),
+      constant("attention.output.LayerNorm.weight",
+               &w.attention_layer_norm_weight),
+      constant("attention.output.LayerNorm.bias",
+               &w.attention_layer_norm_bias));
+  int intermediate = graph->AddBiasAct(
+      graph->MatMul(attention, constant("intermediate.dense.weight",
+                                        &w.intermediate_weight)),
+      constant("intermediate.dense.bias", &w.intermediate_bias),
+      ActivationType::Gelu);
+  return graph->AddBiasLayerNorm(
+      graph->MatMul(intermediate,
+                    constant("output.dense.weight", &w.output_dense_weight)),
+      attention, constant("output.dense.bias", &w.output_dense_bias),
+      constant("output.LayerNorm.weight", &w.output_layer_norm_weight),
+      constant("output.LayerNorm.bias", &w.output_layer_norm_bias));
+}
+
+}  // namespace graph
+}  // namespace turbo_transformers
@@ -0,0 +1,33 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <string>
+
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/graph/graph.h"
+#include "turbo_transformers/layers/bert_layer_weights.h"
+
+namespace turbo_transformers {
+namespace graph {
+
+// Adds the operators of a BERT encoder layer of `num_heads` heads on `hidden`
+// [batch_size, seq_length, hidden_size] with the attention mask `mask` to
+// `graph`, unfused as layers::BertLayer computes them, and returns the output
+// of the layer. The constants are named `prefix` and the names of the
+// weights.
+int AddBertLayer(Graph *graph, int hidden, int mask, const std::string &prefix,
+                 layers::BertLayerWeights weights, int64_t num_heads);
+
+}  // namespace graph
+}  // namespace turbo_transformers
@@ -0,0 +1,236 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/graph/executor.h"
+
+#include <cmath>
+#include <numeric>
+#include <utility>
+
+#include "turbo_transformers/core/half.h"
+#include "turbo_transformers/core/memory.h"
+#include "turbo_transformers/core/profiler.h"
+#include "turbo_transformers/layers/kernels/activation.h"
+#include "turbo_transformers/layers/kernels/attention.h"
+#include "turbo_transformers/layers/kernels/layer_norm.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+#include "turbo_transformers/layers/kernels/softmax.h"
+
+namespace turbo_transformers {
+namespace graph {
+
+namespace kernels = layers::kernels;
+
+namespace {
+template <typename T>
+void AddBiasAct(ActivationType act, const core::Tensor &bias,
+                core::Tensor *out) {
+  switch (act) {
+    case ActivationType::Gelu:
+      kernels::AddBiasAct<T, ActivationType::Gelu>(bias, out);
+      break;
+    case ActivationType::Tanh:
+      kernels::AddBiasAct<T, ActivationType::Tanh>(bias, out);
+      break;
+    case ActivationType::Identity:
+      kernels::AddBiasAct<T, ActivationType::Identity>(bias, out);
+      break;
+  }
+}
+
+void Product(const core::Tensor &a, const core::Tensor &b,
+             const kernels::PackedWeight &packed_weight, core::Tensor *out) {
+  if (packed_weight.is_null()) {
+    kernels::MatMul(a, false, b, false, 1.0, *out, 0.0);
+  } else {
+    kernels::MatMul(a, packed_weight, *out, 0.0);
+  }
+}
+
+template <typename T>
+void Copy(const core::Tensor &src, core::Tensor *dst) {
+  auto flag = core::ToMemcpyFlag(dst->device_type(), src.device_type());
+  core::MemcpyAsync(dst->mutableData<T>(), src.data<T>(),
+                    src.numel() * sizeof(T), flag, dst->device_id());
+}
+}  // namespace
+
+Executor::Executor(Graph graph, DLDeviceType device_type, int device_id,
+                   const std::vector<Pass> &passes)
+    : graph_(std::move(graph)),
+      device_type_(device_type),
+      device_id_(device_id) {
+  RunPasses(&graph_, passes);
+  for (auto &node : graph_.nodes()) {
+    if (node.op != OpType::kConstant) {
+      continue;
+    }
+    TT_ENFORCE(node.value.device_type() == device_type &&
+                   node.value.device_id() == device_id,
+               "The constant %s is not on the device of the executor",
+               node.name);
+    half_ = half_ || node.value.IsType<core::Half>();
+  }
+}
+
+core::MemoryPlan Executor::MakeMemoryPlan(
+    const std::vector<std::vector<int64_t>> &input_shapes) const {
+  return PlanMemory(graph_, input_shapes,
+                    half_ ? sizeof(core::Half) : sizeof(float), device_type_);
+}
+
+std::vector<core::Tensor> Executor::Run(
+    const std::vector<const core::Tensor *> &inputs,
+    core::Workspace *workspace) const {
+  if (workspace == nullptr) {
+    static thread_local core::Workspace thread_workspace;
+    workspace = &thread_workspace;
+  }
+  auto &nodes = graph_.nodes();
+  TT_ENFORCE_EQ(inputs.size(), graph_.inputs().size(),
+                "The graph takes %d inputs", graph_.inputs().size());
+  std::vector<const core::Tensor *> values(nodes.size(), nullptr);
+  std::vector<std::vector<int64_t>> input_shapes;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    input_shapes.push_back(ShapeOf(*inputs[i]));
+    values[graph_.inputs()[i]] = inputs[i];
+  }
+  auto shapes = InferShapes(graph_, input_shapes);
+
+  std::vector<core::Tensor> views;
+  views.reserve(nodes.size());
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    views.emplace_back(nullptr);
+  }
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    if (half_) {
+      RunNode<core::Half>(static_cast<int>(i), shapes, &values, &views,
+                          workspace);
+    } else {
+      RunNode<float>(static_cast<int>(i), shapes, &values, &views,
+                     workspace);
+    }
+  }
+  std::vector<core::Tensor> outputs;
+  for (int output : graph_.outputs()) {
+    outputs.emplace_back(values[output]->ToDLPackView());
+  }
+  return outputs;
+}
+
+template <typename T>
+void Executor::RunNode(int index,
+                       const std::vector<std::vector<int64_t>> &shapes,
+                       std::vector<const core::Tensor *> *values,
+                       std::vector<core::Tensor> *views,
+                       core::Workspace *workspace) const {
+  auto &node = graph_.nodes()[index];
+  if (node.op == OpType::kInput) {
+    return;
+  }
+  if (node.op == OpType::kConstant) {
+    (*values)[index] = &node.value;
+    return;
+  }
+  core::ProfileScope profile_scope(OpName(node.op), *(*values)[node.inputs[0]]);
+  auto input = [&](int k) -> const core::Tensor & {
+    return *(*values)[node.inputs[k]];
+  };
+  // The output is a view of the shape of the node on a flat tensor of the
+  // workspace, so that its planned block serves any shape.
+  auto &shape = shapes[index];
+  auto numel = std::accumulate(shape.begin(), shape.end(), int64_t(1),
+                               std::multiplies<int64_t>());
+  auto &flat = workspace->GetTensor<T>(TensorName(index), {numel},
+                                       device_type_, device_id_);
+  (*views)[index] = core::Tensor(core::NewDLPackTensorViewT<T>(
+      flat.template mutableData<T>(), shape, device_type_, device_id_));
+  core::Tensor *out = &(*views)[index];
+  (*values)[index] = out;
+
+  switch (node.op) {
+    case OpType::kMatMul:
+      Product(input(0), input(1), node.packed_weight, out);
+      break;
+    case OpType::kAddBiasAct:
+      Copy<T>(input(0), out);
+      AddBiasAct<T>(node.act, input(1), out);
+      break;
+    case OpType::kMatMulAddBiasAct:
+      if (node.act == ActivationType::Gelu) {
+        kernels::MatMulAddBiasGelu<T>(input(0), input(1), node.packed_weight,
+                                      input(2), out);
+      } else {
+        Product(input(0), input(1), node.packed_weight, out);
+        AddBiasAct<T>(node.act, input(2), out);
+      }
+      break;
+    case OpType::kAddBiasLayerNorm:
+      Copy<T>(input(0), out);
+      kernels::AddBiasLayerNorm<T>(input(1), input(2), input(3), input(4),
+                                   out);
+      break;
+    case OpType::kMatMulAddBiasLayerNorm:
+      kernels::MatMulAddBiasLayerNorm<T>(input(0), input(1),
+                                         node.packed_weight, input(2),
+                                         input(3), input(4), input(5), out);
+      break;
+    case OpType::kLayerNorm:
+      Copy<T>(input(0), out);
+      kernels::LayerNorm<T>(input(1), input(2), out);
+      break;
+    case OpType::kAttention: {
+      auto &qkv = input(0);
+      int64_t batch_size = qkv.shape(0), seq_length = qkv.shape(1);
+      int64_t all_head_size = qkv.shape(2) / 3;
+      int64_t num_heads = node.num_heads;
+      int64_t size_per_head = all_head_size / num_heads;
+      // The heads are read out of the projection, [batch_size, seq_length,
+      // 3, num_heads, size_per_head], and the context written into the
+      // merged heads, by strides.
+      auto heads = [&](int64_t idx) {
+        return core::TensorView(qkv).AsStrided(
+            {batch_size, num_heads, seq_length, size_per_head},
+            {seq_length * 3 * all_head_size, size_per_head,
+             3 * all_head_size, 1},
+            idx * all_head_size);
+      };
+      auto context = core::TensorView(*out).AsStrided(
+          {batch_size, num_heads, seq_length, size_per_head},
+          {seq_length * all_head_size, size_per_head, all_head_size, 1});
+      float scale = 1 / std::sqrt(static_cast<float>(size_per_head));
+      if (kernels::IsFusedAttentionSupported(device_type_, seq_length,
+                                             size_per_head)) {
+        kernels::FusedAttention(heads(0), heads(1), heads(2), input(1), scale,
+                                context);
+      } else {
+        auto &att_score = workspace->GetTensor<T>(
+            TensorName(index) + "/att_score",
+            {batch_size, num_heads, seq_length, seq_length}, device_type_,
+            device_id_);
+        kernels::BatchMatMul(heads(0), false, heads(1), true, 1.0, att_score,
+                             0.0);
+        kernels::ApplyMaskAndSoftmax(att_score, input(1), scale);
+        kernels::BatchMatMul(att_score, false, heads(2), false, 1.0, context,
+                             0.0);
+      }
+      break;
+    }
+    case OpType::kInput:
+    case OpType::kConstant:
+      break;
+  }
+}
+
+}  // namespace graph
+}  // namespace turbo_transformers
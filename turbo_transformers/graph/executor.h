@@ -0,0 +1,67 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <vector>
+
+#include "turbo_transformers/core/memory_planner.h"
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/workspace.h"
+#include "turbo_transformers/graph/graph.h"
+#include "turbo_transformers/graph/passes.h"
+
+namespace turbo_transformers {
+namespace graph {
+
+// Runs a graph by the kernels of layers/kernels. The passes rewrite the
+// graph once, when the executor is built, afterwards it holds no mutable
+// state, so several threads can run it at once, each with a workspace of
+// its own.
+class Executor {
+ public:
+  // The constants of `graph` must be on `device_type`. The graph runs in
+  // half if LowerToHalf is among the `passes`.
+  Executor(Graph graph, DLDeviceType device_type, int device_id = 0,
+           const std::vector<Pass> &passes = DefaultPasses());
+
+  // The plan of the outputs of the nodes for inputs of `input_shapes`, see
+  // passes.h. A workspace reserved with it runs the inputs up to these
+  // shapes on its arena, see core::Workspace::Reserve.
+  core::MemoryPlan MakeMemoryPlan(
+      const std::vector<std::vector<int64_t>> &input_shapes) const;
+
+  // Runs the graph on `inputs`, in the order of Graph::AddInput, and returns
+  // the outputs in the order of Graph::MarkOutput. They are views of
+  // `workspace`, or of a workspace of the calling thread if it is null,
+  // valid until its next use.
+  std::vector<core::Tensor> Run(const std::vector<const core::Tensor *> &inputs,
+                                core::Workspace *workspace = nullptr) const;
+
+  // The graph after the passes.
+  const Graph &graph() const { return graph_; }
+
+ private:
+  template <typename T>
+  void RunNode(int index, const std::vector<std::vector<int64_t>> &shapes,
+               std::vector<const core::Tensor *> *values,
+               std::vector<core::Tensor> *views,
+               core::Workspace *workspace) const;
+
+  Graph graph_;
+  DLDeviceType device_type_;
+  int device_id_;
+  bool half_{false};
+};
+
+}  // namespace graph
+}  // namespace turbo_transformers
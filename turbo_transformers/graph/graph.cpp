@@ -0,0 +1,259 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/graph/graph.h"
+
+#include <algorithm>
+
+#include "turbo_transformers/core/enforce.h"
+
+namespace turbo_transformers {
+namespace graph {
+
+const char *OpName(OpType op) {
+  switch (op) {
+    case OpType::kInput:
+      return "Input";
+    case OpType::kConstant:
+      return "Constant";
+    case OpType::kMatMul:
+      return "MatMul";
+    case OpType::kAddBiasAct:
+      return "AddBiasAct";
+    case OpType::kAddBiasLayerNorm:
+      return "AddBiasLayerNorm";
+    case OpType::kLayerNorm:
+      return "LayerNorm";
+    case OpType::kAttention:
+      return "Attention";
+    case OpType::kMatMulAddBiasAct:
+      return "MatMulAddBiasAct";
+    case OpType::kMatMulAddBiasLayerNorm:
+      return "MatMulAddBiasLayerNorm";
+  }
+  return "Unknown";
+}
+
+int Graph::AddNode(Node node) {
+  int index = static_cast<int>(nodes_.size());
+  for (int input : node.inputs) {
+    TT_ENFORCE(input >= 0 && input < index,
+               "The input %d of the %s node %d is not before it", input,
+               OpName(node.op), index);
+  }
+  nodes_.push_back(std::move(node));
+  return index;
+}
+
+int Graph::AddInput(const std::string &name) {
+  Node node(OpType::kInput);
+  node.name = name;
+  int index = AddNode(std::move(node));
+  inputs_.push_back(index);
+  return index;
+}
+
+int Graph::AddConstant(const std::string &name, core::Tensor value) {
+  TT_ENFORCE(!value.is_null(), "The constant %s has no value", name);
+  Node node(OpType::kConstant);
+  node.name = name;
+  node.value = std::move(value);
+  return AddNode(std::move(node));
+}
+
+int Graph::MatMul(int a, int b) {
+  Node node(OpType::kMatMul);
+  node.inputs = {a, b};
+  return AddNode(std::move(node));
+}
+
+int Graph::AddBiasAct(int x, int bias, ActivationType act) {
+  Node node(OpType::kAddBiasAct);
+  node.inputs = {x, bias};
+  node.act = act;
+  return AddNode(std::move(node));
+}
+
+int Graph::AddBiasLayerNorm(int x, int residual, int bias, int gamma,
+                            int beta) {
+  Node node(OpType::kAddBiasLayerNorm);
+  node.inputs = {x, residual, bias, gamma, beta};
+  return AddNode(std::move(node));
+}
+
+int Graph::LayerNorm(int x, int gamma, int beta) {
+  Node node(OpType::kLayerNorm);
+  node.inputs = {x, gamma, beta};
+  return AddNode(std::move(node));
+}
+
+int Graph::Attention(int qkv, int mask, int64_t num_heads) {
+  TT_ENFORCE_GT(num_heads, 0, "The attention needs a head.");
+  Node node(OpType::kAttention);
+  node.inputs = {qkv, mask};
+  node.num_heads = num_heads;
+  return AddNode(std::move(node));
+}
+
+void Graph::MarkOutput(int node) {
+  TT_ENFORCE(node >= 0 && node < static_cast<int>(nodes_.size()),
+             "The output %d is not a node", node);
+  outputs_.push_back(node);
+}
+
+std::vector<int> Graph::CountUses() const {
+  std::vector<int> uses(nodes_.size(), 0);
+  for (auto &node : nodes_) {
+    for (int input : node.inputs) {
+      ++uses[input];
+    }
+  }
+  for (int output : outputs_) {
+    ++uses[output];
+  }
+  return uses;
+}
+
+void Graph::Compact(const std::vector<bool> &keep) {
+  std::vector<int> new_index(nodes_.size(), -1);
+  std::vector<Node> kept;
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    if (!keep[i]) {
+      continue;
+    }
+    new_index[i] = static_cast<int>(kept.size());
+    for (int &input : nodes_[i].inputs) {
+      TT_ENFORCE_GE(new_index[input], 0,
+                    "The input %d of the kept node %d is removed", input, i);
+      input = new_index[input];
+    }
+    kept.push_back(std::move(nodes_[i]));
+  }
+  auto remap = [&](std::vector<int> *indices) {
+    for (int &index : *indices) {
+      TT_ENFORCE_GE(new_index[index], 0, "The node %d is removed", index);
+      index = new_index[index];
+    }
+  };
+  remap(&inputs_);
+  remap(&outputs_);
+  nodes_ = std::move(kept);
+}
+
+int Graph::Count(OpType op) const {
+  return static_cast<int>(
+      std::count_if(nodes_.begin(), nodes_.end(),
+                    [op](const Node &node) { return node.op == op; }));
+}
+
+namespace {
+using Shape = std::vector<int64_t>;
+
+Shape ProductShape(const Shape &a, const Shape &b, int node) {
+  TT_ENFORCE(b.size() == 2 && !a.empty() && a.back() == b[0],
+             "The product of node %d multiplies [..., %d] by a [%d, %d] "
+             "matrix",
+             node, a.empty() ? 0 : a.back(), b.empty() ? 0 : b[0],
+             b.size() < 2 ? 0 : b[1]);
+  Shape shape = a;
+  shape.back() = b[1];
+  return shape;
+}
+
+void EnforceVector(const Shape &x, const Shape &v, int node) {
+  TT_ENFORCE(v.size() == 1 && !x.empty() && v[0] == x.back(),
+             "The vectors of node %d should be of its %d columns", node,
+             x.empty() ? 0 : x.back());
+}
+}  // namespace
+
+std::vector<int64_t> ShapeOf(const core::Tensor &tensor) {
+  std::vector<int64_t> shape(tensor.n_dim());
+  for (size_t i = 0; i < shape.size(); ++i) {
+    shape[i] = tensor.shape(static_cast<int>(i));
+  }
+  return shape;
+}
+
+std::vector<std::vector<int64_t>> InferShapes(
+    const Graph &graph, const std::vector<std::vector<int64_t>> &input_shapes) {
+  TT_ENFORCE_EQ(input_shapes.size(), graph.inputs().size(),
+                "The graph takes %d inputs", graph.inputs().size());
+  auto &nodes = graph.nodes();
+  std::vector<Shape> shapes(nodes.size());
+  for (size_t i = 0; i < graph.inputs().size(); ++i) {
+    shapes[graph.inputs()[i]] = input_shapes[i];
+  }
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    auto &node = nodes[i];
+    int index = static_cast<int>(i);
+    auto input = [&](int k) -> const Shape & {
+      return shapes[node.inputs[k]];
+    };
+    switch (node.op) {
+      case OpType::kInput:
+        break;
+      case OpType::kConstant:
+        shapes[i] = ShapeOf(node.value);
+        break;
+      case OpType::kMatMul:
+        shapes[i] = ProductShape(input(0), input(1), index);
+        break;
+      case OpType::kAddBiasAct:
+        EnforceVector(input(0), input(1), index);
+        shapes[i] = input(0);
+        break;
+      case OpType::kMatMulAddBiasAct:
+        shapes[i] = ProductShape(input(0), input(1), index);
+        EnforceVector(shapes[i], input(2), index);
+        break;
+      case OpType::kAddBiasLayerNorm:
+      case OpType::kMatMulAddBiasLayerNorm: {
+        int first = 1;
+        if (node.op == OpType::kMatMulAddBiasLayerNorm) {
+          shapes[i] = ProductShape(input(0), input(1), index);
+          first = 2;
+        } else {
+          shapes[i] = input(0);
+        }
+        TT_ENFORCE(input(first) == shapes[i],
+                   "The residual of node %d mismatches its input", index);
+        for (int k = first + 1; k < first + 4; ++k) {
+          EnforceVector(shapes[i], input(k), index);
+        }
+        break;
+      }
+      case OpType::kLayerNorm:
+        EnforceVector(input(0), input(1), index);
+        EnforceVector(input(0), input(2), index);
+        shapes[i] = input(0);
+        break;
+      case OpType::kAttention: {
+        auto &qkv = input(0);
+        TT_ENFORCE(qkv.size() == 3 && qkv[2] % (3 * node.num_heads) == 0,
+                   "The attention %d takes the [batch_size, seq_length, 3 * "
+                   "%d heads] projections",
+                   index, node.num_heads);
+        TT_ENFORCE(input(1) == Shape({qkv[0], 1, 1, qkv[1]}),
+                   "The attention %d takes a [%d, 1, 1, %d] mask", index,
+                   qkv[0], qkv[1]);
+        shapes[i] = {qkv[0], qkv[1], qkv[2] / 3};
+        break;
+      }
+    }
+  }
+  return shapes;
+}
+
+}  // namespace graph
+}  // namespace turbo_transformers
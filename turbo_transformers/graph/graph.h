@@ -0,0 +1,127 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+#include "turbo_transformers/layers/types.h"
+
+namespace turbo_transformers {
+namespace graph {
+
+using layers::types::ActivationType;
+
+// The operators of a graph. The element type of every operator is that of
+// its first input, the masks are float. Matrices multiply the last dim of
+// their first input, the dims before it are the rows.
+enum class OpType {
+  // A tensor given to Executor::Run.
+  kInput = 0,
+  // A weight held by the node.
+  kConstant,
+  // inputs: a [..., k], b [k, n]. output: a * b [..., n]
+  kMatMul,
+  // inputs: x [..., n], bias [n]. output: act(x + bias)
+  kAddBiasAct,
+  // inputs: x, residual, bias, gamma, beta.
+  // output: LayerNorm(x + residual + bias)
+  kAddBiasLayerNorm,
+  // inputs: x, gamma, beta. output: LayerNorm(x)
+  kLayerNorm,
+  // inputs: qkv [batch_size, seq_length, 3, num_heads, size_per_head], as
+  // the fused qkv projection of BERT, and mask [batch_size, 1, 1,
+  // seq_length]. output: the merged heads [batch_size, seq_length, num_heads
+  // * size_per_head] of softmax(q * k^T / sqrt(size_per_head) + mask) * v.
+  kAttention,
+  // The fused operators built by the passes, see passes.h.
+  // inputs: a, b, bias. output: act(a * b + bias)
+  kMatMulAddBiasAct,
+  // inputs: a, b, residual, bias, gamma, beta.
+  // output: LayerNorm(a * b + residual + bias)
+  kMatMulAddBiasLayerNorm,
+};
+
+const char *OpName(OpType op);
+
+struct Node {
+  explicit Node(OpType op) : op(op) {}
+  OpType op;
+  // The nodes whose outputs this one takes, all before it in the graph.
+  std::vector<int> inputs;
+  // The name of an input or a constant.
+  std::string name;
+  ActivationType act{ActivationType::Identity};
+  int64_t num_heads{0};
+  // The value of a constant.
+  core::Tensor value{nullptr};
+  // The weight b of a product packed for the CPU BLAS, see
+  // SelectWeightLayouts.
+  layers::kernels::PackedWeight packed_weight;
+};
+
+// A static graph of the inference of a model, whose nodes are stored in
+// topological order: every node is added after its inputs. The builders
+// return the index of the added node. The passes of passes.h rewrite it
+// into the fused operators before an Executor runs it.
+class Graph {
+ public:
+  int AddInput(const std::string &name);
+  int AddConstant(const std::string &name, core::Tensor value);
+  int MatMul(int a, int b);
+  int AddBiasAct(int x, int bias,
+                 ActivationType act = ActivationType::Identity);
+  int AddBiasLayerNorm(int x, int residual, int bias, int gamma, int beta);
+  int LayerNorm(int x, int gamma, int beta);
+  int Attention(int qkv, int mask, int64_t num_heads);
+  // An output of the graph, returned by Executor::Run in the order marked.
+  void MarkOutput(int node);
+
+  int AddNode(Node node);
+
+  std::vector<Node> &nodes() { return nodes_; }
+  const std::vector<Node> &nodes() const { return nodes_; }
+  // The input nodes in the order of AddInput.
+  const std::vector<int> &inputs() const { return inputs_; }
+  const std::vector<int> &outputs() const { return outputs_; }
+
+  // The number of nodes taking the output of each node, and of the outputs
+  // of the graph it is.
+  std::vector<int> CountUses() const;
+
+  // Keeps the nodes for which `keep` is true and renumbers their inputs and
+  // the outputs, which must all be kept.
+  void Compact(const std::vector<bool> &keep);
+
+  // The number of nodes of type `op`.
+  int Count(OpType op) const;
+
+ private:
+  std::vector<Node> nodes_;
+  std::vector<int> inputs_;
+  std::vector<int> outputs_;
+};
+
+// The shape of `tensor`.
+std::vector<int64_t> ShapeOf(const core::Tensor &tensor);
+
+// The shape of the output of every node, given the shapes of the inputs in
+// the order of AddInput. Throws if the shapes of a node mismatch.
+std::vector<std::vector<int64_t>> InferShapes(
+    const Graph &graph, const std::vector<std::vector<int64_t>> &input_shapes);
+
+}  // namespace graph
+}  // namespace turbo_transformers
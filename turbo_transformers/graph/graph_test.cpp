@@ -0,0 +1,178 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/graph/executor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/graph/bert_graph.h"
+#include "turbo_transformers/layers/bert_layer.h"
+#include "turbo_transformers/layers/kernels/common.h"
+
+namespace turbo_transformers {
+namespace graph {
+
+using layers::BertLayerWeights;
+using layers::kernels::common::CreateTensorAndFillRandom;
+
+static const int64_t kHiddenSize = 64, kIntermediateSize = 128, kNumHeads = 4;
+
+static core::Tensor Copy(const core::Tensor &tensor) {
+  core::Tensor copy(
+      core::NewDLPackTensorT<float>(ShapeOf(tensor), kDLCPU, 0));
+  std::copy(tensor.data<float>(), tensor.data<float>() + tensor.numel(),
+            copy.mutableData<float>());
+  return copy;
+}
+
+static BertLayerWeights CreateWeights() {
+  auto random = [](std::initializer_list<int64_t> shape) {
+    return CreateTensorAndFillRandom<float>(shape, kDLCPU, 0);
+  };
+  BertLayerWeights w;
+  w.qkv_weight = random({kHiddenSize, 3 * kHiddenSize});
+  w.qkv_bias = random({3 * kHiddenSize});
+  w.attention_dense_weight = random({kHiddenSize, kHiddenSize});
+  w.attention_dense_bias = random({kHiddenSize});
+  w.attention_layer_norm_weight = random({kHiddenSize});
+  w.attention_layer_norm_bias = random({kHiddenSize});
+  w.intermediate_weight = random({kHiddenSize, kIntermediateSize});
+  w.intermediate_bias = random({kIntermediateSize});
+  w.output_dense_weight = random({kIntermediateSize, kHiddenSize});
+  w.output_dense_bias = random({kHiddenSize});
+  w.output_layer_norm_weight = random({kHiddenSize});
+  w.output_layer_norm_bias = random({kHiddenSize});
+  return w;
+}
+
+static layers::BertLayer CreateBertLayer(const BertLayerWeights &w) {
+  return layers::BertLayer(
+      std::make_shared<layers::BertAttention>(
+          Copy(w.qkv_weight), Copy(w.qkv_bias), Copy(w.attention_dense_weight),
+          Copy(w.attention_dense_bias), Copy(w.attention_layer_norm_weight),
+          Copy(w.attention_layer_norm_bias), kNumHeads),
+      std::make_shared<layers::BertIntermediate>(Copy(w.intermediate_weight),
+                                                 Copy(w.intermediate_bias)),
+      std::make_shared<layers::BertOutput>(
+          Copy(w.output_dense_weight), Copy(w.output_dense_bias),
+          Copy(w.output_layer_norm_weight), Copy(w.output_layer_norm_bias)));
+}
+
+static Graph CreateBertGraph(const BertLayerWeights &w) {
+  BertLayerWeights copy;
+  copy.qkv_weight = Copy(w.qkv_weight);
+  copy.qkv_bias = Copy(w.qkv_bias);
+  copy.attention_dense_weight = Copy(w.attention_dense_weight);
+  copy.attention_dense_bias = Copy(w.attention_dense_bias);
+  copy.attention_layer_norm_weight = Copy(w.attention_layer_norm_weight);
+  copy.attention_layer_norm_bias = Copy(w.attention_layer_norm_bias);
+  copy.intermediate_weight = Copy(w.intermediate_weight);
+  copy.intermediate_bias = Copy(w.intermediate_bias);
+  copy.output_dense_weight = Copy(w.output_dense_weight);
+  copy.output_dense_bias = Copy(w.output_dense_bias);
+  copy.output_layer_norm_weight = Copy(w.output_layer_norm_weight);
+  copy.output_layer_norm_bias = Copy(w.output_layer_norm_bias);
+
+  Graph graph;
+  int hidden = graph.AddInput("hidden");
+  int mask = graph.AddInput("mask");
+  graph.MarkOutput(AddBertLayer(&graph, hidden, mask, "layer.0.",
+                                std::move(copy), kNumHeads));
+  return graph;
+}
+
+static bool AllClose(const core::Tensor &a, const core::Tensor &b) {
+  if (a.numel() != b.numel()) {
+    return false;
+  }
+  for (int64_t i = 0; i < a.numel(); ++i) {
+    if (std::abs(a.data<float>()[i] - b.data<float>()[i]) > 1e-4) {
+      return false;
+    }
+  }
+  return true;
+}
+
+TEST_CASE("graph-fusion-passes", "[graph]") {
+  auto weights = CreateWeights();
+  Executor executor(CreateBertGraph(weights), kDLCPU);
+  auto &graph = executor.graph();
+  REQUIRE(graph.Count(OpType::kMatMul) == 0);
+  REQUIRE(graph.Count(OpType::kAddBiasAct) == 0);
+  REQUIRE(graph.Count(OpType::kAddBiasLayerNorm) == 0);
+  REQUIRE(graph.Count(OpType::kMatMulAddBiasAct) == 2);
+  REQUIRE(graph.Count(OpType::kMatMulAddBiasLayerNorm) == 2);
+  REQUIRE(graph.Count(OpType::kAttention) == 1);
+
+  auto shapes = InferShapes(graph, {{2, 10, kHiddenSize}, {2, 1, 1, 10}});
+  REQUIRE(shapes[graph.outputs()[0]] ==
+          std::vector<int64_t>{2, 10, kHiddenSize});
+  REQUIRE_THROWS(InferShapes(graph, {{2, 10, kHiddenSize + 1}, {2, 1, 1, 10}}));
+}
+
+TEST_CASE("graph-bert-layer", "[graph]") {
+  auto weights = CreateWeights();
+  auto bert_layer = CreateBertLayer(weights);
+  Executor fused(CreateBertGraph(weights), kDLCPU);
+  Executor unfused(CreateBertGraph(weights), kDLCPU, 0, {});
+
+  for (int64_t batch_size : {1, 3}) {
+    for (int64_t seq_length : {5, 16}) {
+      auto input = CreateTensorAndFillRandom<float>(
+          {batch_size, seq_length, kHiddenSize}, kDLCPU, 0);
+      core::Tensor mask(nullptr);
+      mask.Reshape<float>({batch_size, 1, 1, seq_length}, kDLCPU, 0);
+      for (int64_t i = 0; i < mask.numel(); ++i) {
+        // Mask the last key of every sequence.
+        mask.mutableData<float>()[i] =
+            i % seq_length == seq_length - 1 ? -10000.f : 0.f;
+      }
+      core::Tensor expected(nullptr);
+      bert_layer(input, mask, &expected);
+
+      auto outputs = fused.Run({&input, &mask});
+      REQUIRE(outputs.size() == 1);
+      REQUIRE(AllClose(outputs[0], expected));
+      REQUIRE(AllClose(unfused.Run({&input, &mask})[0], expected));
+    }
+  }
+}
+
+TEST_CASE("graph-memory-plan", "[graph]") {
+  auto weights = CreateWeights();
+  auto bert_layer = CreateBertLayer(weights);
+  Executor executor(CreateBertGraph(weights), kDLCPU);
+  auto plan = executor.MakeMemoryPlan({{4, 32, kHiddenSize}, {4, 1, 1, 32}});
+  core::Workspace workspace;
+  workspace.Reserve(plan, kDLCPU, 0);
+  REQUIRE(workspace.arena_size() > 0);
+
+  auto input =
+      CreateTensorAndFillRandom<float>({2, 20, kHiddenSize}, kDLCPU, 0);
+  auto mask = layers::kernels::common::CreateTensorAndFillConstant<float>(
+      {2, 1, 1, 20}, kDLCPU, 0, 0.f);
+  core::Tensor expected(nullptr);
+  bert_layer(input, mask, &expected);
+  auto outputs = executor.Run({&input, &mask}, &workspace);
+  REQUIRE(AllClose(outputs[0], expected));
+  // The next run of the workspace reuses its planned blocks.
+  auto *data = outputs[0].data<float>();
+  REQUIRE(executor.Run({&input, &mask}, &workspace)[0].data<float>() == data);
+}
+
+}  // namespace graph
+}  // namespace turbo_transformers
@@ -0,0 +1,191 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/graph/passes.h"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+#include "turbo_transformers/core/half.h"
+#include "turbo_transformers/core/memory.h"
+#include "turbo_transformers/layers/kernels/attention.h"
+
+namespace turbo_transformers {
+namespace graph {
+
+namespace {
+// Whether the first input of `node` is the product of a MatMul nobody else
+// takes.
+bool TakesOwnProduct(const Graph &graph, const std::vector<int> &uses,
+                     const Node &node) {
+  int x = node.inputs[0];
+  return graph.nodes()[x].op == OpType::kMatMul && uses[x] == 1;
+}
+
+// Replaces the first input of `node`, a MatMul, by the operands of the
+// product, and gives `node` the packed weight of the product if it has one.
+void TakeOverProduct(Graph *graph, Node *node, OpType fused) {
+  auto &product = graph->nodes()[node->inputs[0]];
+  std::vector<int> inputs = product.inputs;
+  inputs.insert(inputs.end(), node->inputs.begin() + 1, node->inputs.end());
+  node->inputs = std::move(inputs);
+  node->packed_weight = std::move(product.packed_weight);
+  node->op = fused;
+}
+}  // namespace
+
+void FuseMatMulAddBiasAct(Graph *graph) {
+  auto uses = graph->CountUses();
+  for (auto &node : graph->nodes()) {
+    if (node.op == OpType::kAddBiasAct &&
+        TakesOwnProduct(*graph, uses, node)) {
+      TakeOverProduct(graph, &node, OpType::kMatMulAddBiasAct);
+    }
+  }
+}
+
+void FuseMatMulAddBiasLayerNorm(Graph *graph) {
+  auto uses = graph->CountUses();
+  for (auto &node : graph->nodes()) {
+    if (node.op == OpType::kAddBiasLayerNorm &&
+        TakesOwnProduct(*graph, uses, node)) {
+      TakeOverProduct(graph, &node, OpType::kMatMulAddBiasLayerNorm);
+    }
+  }
+}
+
+void EliminateDeadNodes(Graph *graph) {
+  auto &nodes = graph->nodes();
+  std::vector<bool> keep(nodes.size(), false);
+  for (int output : graph->outputs()) {
+    keep[output] = true;
+  }
+  // The inputs of a node are before it, so one backward sweep finds all the
+  // nodes the outputs depend on.
+  for (size_t i = nodes.size(); i-- > 0;) {
+    if (nodes[i].op == OpType::kInput) {
+      keep[i] = true;
+    }
+    if (keep[i]) {
+      for (int input : nodes[i].inputs) {
+        keep[input] = true;
+      }
+    }
+  }
+  graph->Compact(keep);
+}
+
+void SelectWeightLayouts(Graph *graph) {
+  auto &nodes = graph->nodes();
+  for (auto &node : nodes) {
+    if (node.op != OpType::kMatMul && node.op != OpType::kMatMulAddBiasAct &&
+        node.op != OpType::kMatMulAddBiasLayerNorm) {
+      continue;
+    }
+    auto &weight = nodes[node.inputs[1]];
+    if (weight.op == OpType::kConstant && node.packed_weight.is_null()) {
+      // Null unless the BLAS packs weights, i.e. MKL on the CPU.
+      node.packed_weight = layers::kernels::PackWeight(weight.value);
+    }
+  }
+}
+
+void LowerToHalf(Graph *graph) {
+  for (auto &node : graph->nodes()) {
+    // A weight packed for the CPU does not serve the GPU.
+    node.packed_weight = layers::kernels::PackedWeight();
+    if (node.op != OpType::kConstant) {
+      continue;
+    }
+    TT_ENFORCE(node.value.device_type() == kDLGPU,
+               "Only the GPU runs half graphs, the constant %s is not on it",
+               node.name);
+    if (!node.value.IsType<float>()) {
+      continue;
+    }
+    auto &value = node.value;
+    auto shape = ShapeOf(value);
+    int64_t numel = value.numel();
+    std::vector<float> host(numel);
+    core::Memcpy(host.data(), value.data<float>(), numel * sizeof(float),
+                 core::MemcpyFlag::kGPU2CPU);
+    std::vector<core::Half> host_half(host.begin(), host.end());
+    core::Tensor lowered(core::NewDLPackTensorT<core::Half>(
+        shape, value.device_type(), value.device_id()));
+    core::Memcpy(lowered.mutableData<core::Half>(), host_half.data(),
+                 numel * sizeof(core::Half), core::MemcpyFlag::kCPU2GPU);
+    value = std::move(lowered);
+  }
+}
+
+std::vector<Pass> DefaultPasses(bool half) {
+  std::vector<Pass> passes{FuseMatMulAddBiasAct, FuseMatMulAddBiasLayerNorm,
+                           EliminateDeadNodes, SelectWeightLayouts};
+  if (half) {
+    passes.push_back(LowerToHalf);
+  }
+  return passes;
+}
+
+void RunPasses(Graph *graph, const std::vector<Pass> &passes) {
+  for (auto &pass : passes) {
+    pass(graph);
+  }
+}
+
+std::string TensorName(int index) { return "graph/" + std::to_string(index); }
+
+core::MemoryPlan PlanMemory(
+    const Graph &graph, const std::vector<std::vector<int64_t>> &input_shapes,
+    size_t elem_size, DLDeviceType device_type) {
+  auto shapes = InferShapes(graph, input_shapes);
+  auto &nodes = graph.nodes();
+  int64_t end = static_cast<int64_t>(nodes.size());
+  std::vector<int64_t> last_use(nodes.size(), -1);
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    for (int input : nodes[i].inputs) {
+      last_use[input] = static_cast<int64_t>(i);
+    }
+  }
+  for (int output : graph.outputs()) {
+    last_use[output] = end;
+  }
+  core::MemoryPlanner planner;
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    auto &node = nodes[i];
+    if (node.op == OpType::kInput || node.op == OpType::kConstant) {
+      continue;
+    }
+    auto numel = std::accumulate(shapes[i].begin(), shapes[i].end(),
+                                 int64_t(1), std::multiplies<int64_t>());
+    int64_t op = static_cast<int64_t>(i);
+    planner.AddUsage(TensorName(op), numel * elem_size, op,
+                     std::max(op, last_use[i]));
+    if (node.op == OpType::kAttention) {
+      auto &qkv = shapes[node.inputs[0]];
+      auto size_per_head = qkv[2] / 3 / node.num_heads;
+      if (!layers::kernels::IsFusedAttentionSupported(device_type, qkv[1],
+                                                      size_per_head)) {
+        planner.AddUsage(TensorName(op) + "/att_score",
+                         qkv[0] * node.num_heads * qkv[1] * qkv[1] *
+                             elem_size,
+                         op, op);
+      }
+    }
+  }
+  return planner.Plan();
+}
+
+}  // namespace graph
+}  // namespace turbo_transformers
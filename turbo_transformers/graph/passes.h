@@ -0,0 +1,73 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "turbo_transformers/core/memory_planner.h"
+#include "turbo_transformers/graph/graph.h"
+
+namespace turbo_transformers {
+namespace graph {
+
+// A rewrite of a graph. The passes run in order, each on the result of the
+// previous one, see RunPasses.
+using Pass = std::function<void(Graph *)>;
+
+// A MatMul whose product is only taken by an AddBiasAct becomes a
+// MatMulAddBiasAct, so the bias and the activation are the epilogue of the
+// GEMM, see kernels::MatMulAddBiasGelu, rather than a pass over a product
+// of its own.
+void FuseMatMulAddBiasAct(Graph *graph);
+
+// A MatMul whose product is only taken by an AddBiasLayerNorm becomes a
+// MatMulAddBiasLayerNorm, which normalizes the rows of the product while they
+// are in the cache, see kernels::MatMulAddBiasLayerNorm.
+void FuseMatMulAddBiasLayerNorm(Graph *graph);
+
+// Removes the nodes whose outputs are not used, e.g. the operators merged
+// by the fusions. The inputs of the graph are kept.
+void EliminateDeadNodes(Graph *graph);
+
+// Selects the layouts of the constant weights of the products: on the CPU,
+// they are packed for the BLAS once, see kernels::PackWeight, instead of by
+// every GEMM. The attention reads the heads out of the qkv projection by
+// strides, so no transposes are left to select.
+void SelectWeightLayouts(Graph *graph);
+
+// Lowers the float constants to half, so that the graph runs in half on
+// the GPU. The inputs but the masks must then be half as well.
+void LowerToHalf(Graph *graph);
+
+// The fusions followed by the elimination of the dead nodes, the layout
+// selection, and the lowering to half if `half`.
+std::vector<Pass> DefaultPasses(bool half = false);
+
+void RunPasses(Graph *graph, const std::vector<Pass> &passes);
+
+// The name of the output of the node `index` in a workspace.
+std::string TensorName(int index);
+
+// Plans the outputs of the nodes of `graph` run on `device_type` with inputs
+// of `input_shapes`, whose elements take `elem_size` bytes, see
+// core::MemoryPlanner. The operator of a node is its index, and an output is
+// alive from its node to its last use, or to the end for the outputs of the
+// graph.
+core::MemoryPlan PlanMemory(
+    const Graph &graph, const std::vector<std::vector<int64_t>> &input_shapes,
+    size_t elem_size, DLDeviceType device_type);
+
+}  // namespace graph
+}  // namespace turbo_transformers
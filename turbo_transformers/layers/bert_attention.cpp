@@ -13,8 +13,14 @@
 
 #include "turbo_transformers/layers/bert_attention.h"
 
+#include <algorithm>
+#include <vector>
+
 #include "loguru.hpp"
 #include "turbo_transformers/core/memory.h"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/profiler.h"
+#include "turbo_transformers/layers/kernels/attention.h"
 #include "turbo_transformers/layers/kernels/common.h"
 #include "turbo_transformers/layers/kernels/layer_norm.h"
 #include "turbo_transformers/layers/kernels/mat_mul.h"
@@ -23,12 +29,144 @@
 namespace turbo_transformers {
 namespace layers {
 
-static std::mutex mutex_;
+static constexpr const char* kTempQKV = "BertAttention/temp_qkv";
+static constexpr const char* kQKV = "BertAttention/qkv";
+static constexpr const char* kAttScore = "BertAttention/att_score";
+static constexpr const char* kSelfAttrOut = "BertAttention/self_attr_out";
+static constexpr const char* kVarlenMask = "BertAttention/varlen_mask";
+static constexpr const char* kRowInput = "BertAttention/row_input";
+
+namespace {
+// 4-6. of sequences of different lengths, which attend to their own tokens
+// only. The sequence b is the rows [begins[b], begins[b] + lens[b]) of the
+// batch entry `batch_idx(b)` of q, k, v and context, (batch, head_num,
+// tokens, size_per_head), where padded sequences each take a batch entry and
+// packed ones share the single entry.
+template <typename T>
+void VarlenAttention(const core::TensorView& q, const core::TensorView& k,
+                     const core::TensorView& v,
+                     const std::vector<int64_t>& begins,
+                     const std::vector<int64_t>& lens, float scale,
+                     core::TensorView context, core::Workspace* workspace) {
+  auto head_num = q.shape(1);
+  auto size_per_head = q.shape(3);
+  auto device_type = context.device_type();
+  auto device_id = context.device_id();
+  // The keys past the lengths are skipped rather than masked.
+  auto max_seq_length = *std::max_element(lens.begin(), lens.end());
+  core::Tensor& mask = workspace->GetTensor<float>(
+      kVarlenMask, {std::max<int64_t>(max_seq_length, 1)}, device_type,
+      device_id);
+  kernels::common::Fill<float>(mask.mutableData<float>(), mask.numel(), 0.f,
+                               device_type, device_id);
+
+  for (size_t b = 0; b < lens.size(); ++b) {
+    auto seq_length = lens[b];
+    if (seq_length == 0) {
+      continue;
+    }
+    int64_t batch_idx = q.shape(0) == 1 ? 0 : b;
+    auto heads = [&](const core::TensorView& t) {
+      return t.AsStrided({1, head_num, seq_length, size_per_head},
+                         {t.stride(0), t.stride(1), t.stride(2), 1},
+                         batch_idx * t.stride(0) + begins[b] * t.stride(2));
+    };
+    auto seq_mask = core::TensorView(mask).AsStrided(
+        {1, 1, 1, seq_length}, {seq_length, seq_length, seq_length, 1});
+    if (kernels::IsFusedAttentionSupported(device_type, seq_length,
+                                           size_per_head)) {
+      kernels::FusedAttention(heads(q), heads(k), heads(v), seq_mask, scale,
+                              heads(context));
+    } else {
+      // The heads of a single sequence collapse into one batch dim, so the
+      // context is written into the merged heads directly.
+      core::Tensor& att_score = workspace->GetTensor<T>(
+          kAttScore, {1, head_num, seq_length, seq_length}, device_type,
+          device_id);
+      kernels::BatchMatMul(heads(q), false, heads(k), true, 1.0, att_score,
+                           0.0);
+      kernels::ApplyMaskAndSoftmax(att_score, seq_mask, scale);
+      kernels::BatchMatMul(att_score, false, heads(v), false, 1.0,
+                           heads(context), 0.0);
+    }
+  }
+}
+
+// 4-6. of the query `row` of every sequence, which attends to all the keys
+// under `attention_mask`, or to its first lens[b] keys if `lens` is not null.
+// q, k, v are (batch_size, head_num, seq_length, size_per_head) and context
+// (batch_size, head_num, 1, size_per_head).
+template <typename T>
+void RowAttention(const core::TensorView& q, const core::TensorView& k,
+                  const core::TensorView& v,
+                  const core::Tensor* attention_mask, const int64_t* lens,
+                  int64_t row, float scale, core::TensorView context,
+                  core::Workspace* workspace) {
+  auto batch_size = q.shape(0);
+  auto head_num = q.shape(1);
+  auto seq_length = q.shape(2);
+  auto size_per_head = q.shape(3);
+  auto device_type = context.device_type();
+  auto device_id = context.device_id();
+  auto query = [&](int64_t batch, int64_t batch_idx) {
+    return q.AsStrided({batch, head_num, 1, size_per_head},
+                       {q.stride(0), q.stride(1), q.stride(2), 1},
+                       batch_idx * q.stride(0) + row * q.stride(2));
+  };
+  if (lens == nullptr) {
+    // The masked scores of a single query per head are small, so they are
+    // not worth the fused attention.
+    core::Tensor& att_score = workspace->GetTensor<T>(
+        kAttScore, {batch_size, head_num, 1, seq_length}, device_type,
+        device_id);
+    kernels::BatchMatMul(query(batch_size, 0), false, k, true, 1.0,
+                         att_score, 0.0);
+    kernels::ApplyMaskAndSoftmax(att_score, *attention_mask, scale);
+    kernels::BatchMatMul(att_score, false, v, false, 1.0, context, 0.0);
+    return;
+  }
+  core::Tensor& mask = workspace->GetTensor<float>(
+      kVarlenMask, {seq_length}, device_type, device_id);
+  kernels::common::Fill<float>(mask.mutableData<float>(), mask.numel(), 0.f,
+                               device_type, device_id);
+  for (int64_t b = 0; b < batch_size; ++b) {
+    // The context of a padded query is zeroed by the caller.
+    if (row >= lens[b]) {
+      continue;
+    }
+    auto keys = [&](const core::TensorView& t) {
+      return t.AsStrided({1, head_num, lens[b], size_per_head},
+                         {t.stride(0), t.stride(1), t.stride(2), 1},
+                         b * t.stride(0));
+    };
+    auto seq_mask = core::TensorView(mask).AsStrided(
+        {1, 1, 1, lens[b]}, {lens[b], lens[b], lens[b], 1});
+    core::Tensor& att_score = workspace->GetTensor<T>(
+        kAttScore, {1, head_num, 1, lens[b]}, device_type, device_id);
+    kernels::BatchMatMul(query(1, b), false, keys(k), true, 1.0, att_score,
+                         0.0);
+    kernels::ApplyMaskAndSoftmax(att_score, seq_mask, scale);
+    kernels::BatchMatMul(
+        att_score, false, keys(v), false, 1.0,
+        context.AsStrided({1, head_num, 1, size_per_head},
+                          {context.stride(0), context.stride(1),
+                           context.stride(2), 1},
+                          b * context.stride(0)),
+        0.0);
+  }
+}
+}  // namespace
 
 void BertAttention::operator()(const core::Tensor& input_tensor,
                                const core::Tensor& attention_mask,
-                               core::Tensor* output) const {
-  std::lock_guard<std::mutex> g(mutex_);
+                               core::Tensor* output,
+                               core::Workspace* workspace) const {
+  // Callers without a workspace use the one of the calling thread, so
+  // concurrent calls never share their scratch tensors.
+  if (workspace == nullptr) {
+    static thread_local core::Workspace thread_workspace;
+    workspace = &thread_workspace;
+  }
   TT_ENFORCE_EQ(kernels::common::is_same_device_ctx(
                     input_tensor.device_ctx(), attention_mask.device_ctx()),
                 true,
@@ -39,79 +177,451 @@ void BertAttention::operator()(const core::Tensor& input_tensor,
                 "The input ids should be a matrix with shape [BatchSize, "
                 "SeqLen, HiddenSize].");
   EnforceShapeAndType();
+  if (input_tensor.IsType<core::Half>()) {
+    Compute<core::Half>(input_tensor, &attention_mask, nullptr, nullptr, -1,
+                        output, workspace);
+  } else {
+    Compute<float>(input_tensor, &attention_mask, nullptr, nullptr, -1,
+                   output, workspace);
+  }
+}
+
+void BertAttention::RunWithSeqLens(const core::Tensor& input_tensor,
+                                   const core::Tensor& seq_lens,
+                                   core::Tensor* output,
+                                   core::Workspace* workspace) const {
+  if (workspace == nullptr) {
+    static thread_local core::Workspace thread_workspace;
+    workspace = &thread_workspace;
+  }
+  TT_ENFORCE_EQ(input_tensor.n_dim(), 3,
+                "The input ids should be a matrix with shape [BatchSize, "
+                "SeqLen, HiddenSize].");
+  TT_ENFORCE(seq_lens.device_type() == kDLCPU && seq_lens.IsType<int64_t>() &&
+                 seq_lens.numel() == input_tensor.shape(0),
+             "The sequence lengths should be an int64 CPU tensor with shape "
+             "[BatchSize].");
+  const auto* lens = seq_lens.data<int64_t>();
+  for (int64_t b = 0; b < seq_lens.numel(); ++b) {
+    TT_ENFORCE(lens[b] >= 0 && lens[b] <= input_tensor.shape(1),
+               "The length of the sequence %d should be in [0, %d], got %d.",
+               b, input_tensor.shape(1), lens[b]);
+  }
+  EnforceShapeAndType();
+  if (input_tensor.IsType<core::Half>()) {
+    Compute<core::Half>(input_tensor, nullptr, nullptr, &seq_lens, -1,
+                        output, workspace);
+  } else {
+    Compute<float>(input_tensor, nullptr, nullptr, &seq_lens, -1, output,
+                   workspace);
+  }
+}
+
+void BertAttention::RunPacked(const core::Tensor& input_tensor,
+                              const core::Tensor& seq_offsets,
+                              core::Tensor* output,
+                              core::Workspace* workspace) const {
+  if (workspace == nullptr) {
+    static thread_local core::Workspace thread_workspace;
+    workspace = &thread_workspace;
+  }
+  TT_ENFORCE(input_tensor.n_dim() == 3 && input_tensor.shape(0) == 1,
+             "The packed input should be a tensor with shape [1, "
+             "TotalTokens, HiddenSize].");
+  TT_ENFORCE(seq_offsets.device_type() == kDLCPU &&
+                 seq_offsets.IsType<int64_t>() && seq_offsets.numel() > 1,
+             "The sequence offsets should be an int64 CPU tensor with shape "
+             "[BatchSize + 1].");
+  const auto* offsets = seq_offsets.data<int64_t>();
+  for (int64_t b = 0; b + 1 < seq_offsets.numel(); ++b) {
+    TT_ENFORCE_LE(offsets[b], offsets[b + 1],
+                  "The sequence offsets should be ascending.");
+  }
+  TT_ENFORCE(offsets[0] == 0 &&
+                 offsets[seq_offsets.numel() - 1] == input_tensor.shape(1),
+             "The sequence offsets should cover the %d tokens.",
+             input_tensor.shape(1));
+  EnforceShapeAndType();
+  if (input_tensor.IsType<core::Half>()) {
+    Compute<core::Half>(input_tensor, nullptr, &seq_offsets, nullptr, -1,
+                        output, workspace);
+  } else {
+    Compute<float>(input_tensor, nullptr, &seq_offsets, nullptr, -1, output,
+                   workspace);
+  }
+}
+
+void BertAttention::RunOnRow(const core::Tensor& input_tensor,
+                             const core::Tensor* attention_mask,
+                             const core::Tensor* seq_lens, int64_t row,
+                             core::Tensor* output,
+                             core::Workspace* workspace) const {
+  if (workspace == nullptr) {
+    static thread_local core::Workspace thread_workspace;
+    workspace = &thread_workspace;
+  }
+  TT_ENFORCE_EQ(input_tensor.n_dim(), 3,
+                "The input ids should be a matrix with shape [BatchSize, "
+                "SeqLen, HiddenSize].");
+  TT_ENFORCE(row >= 0 && row < input_tensor.shape(1),
+             "The row should be in [0, %d), got %d.", input_tensor.shape(1),
+             row);
+  TT_ENFORCE((attention_mask == nullptr) != (seq_lens == nullptr),
+             "The attention takes either a mask or the sequence lengths.");
+  if (seq_lens != nullptr) {
+    TT_ENFORCE(seq_lens->device_type() == kDLCPU &&
+                   seq_lens->IsType<int64_t>() &&
+                   seq_lens->numel() == input_tensor.shape(0),
+               "The sequence lengths should be an int64 CPU tensor with "
+               "shape [BatchSize].");
+  } else {
+    TT_ENFORCE_EQ(kernels::common::is_same_device_ctx(
+                      input_tensor.device_ctx(), attention_mask->device_ctx()),
+                  true,
+                  "The input_tensor and attention_mask should have the same "
+                  "device type and device id.");
+  }
+  EnforceShapeAndType();
+  if (input_tensor.IsType<core::Half>()) {
+    Compute<core::Half>(input_tensor, attention_mask, nullptr, seq_lens, row,
+                        output, workspace);
+  } else {
+    Compute<float>(input_tensor, attention_mask, nullptr, seq_lens, row,
+                   output, workspace);
+  }
+}
+
+void BertAttention::RunPartial(const core::Tensor& input_tensor,
+                               const core::Tensor& attention_mask,
+                               core::Tensor* output,
+                               core::Workspace* workspace) const {
+  if (workspace == nullptr) {
+    static thread_local core::Workspace thread_workspace;
+    workspace = &thread_workspace;
+  }
+  TT_ENFORCE_EQ(kernels::common::is_same_device_ctx(
+                    input_tensor.device_ctx(), attention_mask.device_ctx()),
+                true,
+                "The input_tensor and attention_mask should have the same "
+                "device type and device id.");
+  TT_ENFORCE_EQ(input_tensor.n_dim(), 3,
+                "The input ids should be a matrix with shape [BatchSize, "
+                "SeqLen, HiddenSize].");
+  TT_ENFORCE(input_tensor.IsType<float>(),
+             "The shards of a layer take a float input");
+  TT_ENFORCE(quantized_qkv_weight_.is_null() && bf16_qkv_weight_.is_null() &&
+                 compressed_qkv_weight_.is_null(),
+             "The shards of a layer keep their weights in float");
+  EnforceShapeAndType();
+  Compute<float>(input_tensor, &attention_mask, nullptr, nullptr, -1, output,
+                 workspace, true);
+}
+
+template <typename T>
+void BertAttention::Compute(const core::Tensor& input_tensor,
+                            const core::Tensor* attention_mask,
+                            const core::Tensor* seq_offsets,
+                            const core::Tensor* seq_lens, int64_t row,
+                            core::Tensor* output, core::Workspace* workspace,
+                            bool partial) const {
+  core::ProfileScope profile_scope("BertAttention", input_tensor);
+  core::LayerTimer layer_timer("BertAttention");
   auto batch_size = input_tensor.shape(0);
   auto seq_length = input_tensor.shape(1);
   auto hidden_size = input_tensor.shape(2);
-  auto size_per_head = hidden_size / num_attention_heads_;
+  // The heads of a pruned layer may be narrower than the hidden size.
+  auto all_head_size = qkv_weight_.shape(1) / 3;
+  auto size_per_head = all_head_size / num_attention_heads_;
   LOG_S(3) << "batch_size: " << batch_size
            << ", num_head: " << num_attention_heads_
            << ", seq_length: " << seq_length << ", hidden_size: " << hidden_size
            << ", size_per_head: " << size_per_head;
-  output->Reshape<float>({batch_size, seq_length, hidden_size},
-                         input_tensor.device_type(), input_tensor.device_id());
-
-  // 1. temp_qkv = MatMul(input)
-  static core::TempTensor temp_qkv_tmp;
-  core::Tensor& temp_qkv = temp_qkv_tmp.GetTensor(input_tensor.device_ctx());
-  temp_qkv.Reshape<float>({3, batch_size, seq_length, hidden_size},
-                          input_tensor.device_type(), input_tensor.device_id());
-
-  kernels::MatMul(input_tensor, false, qkv_weight_, false, 1.0, &temp_qkv, 0.0);
-
-  // 2. qkv = transpose(temp_qkv + bias)
-  // Since `SplitAddBiasTransposeForScore` does not support inplace,
-  // qkv and temp_qkv cannot be same tensor
-  static core::TempTensor qkv_tensor_tmp;
-  core::Tensor& qkv = qkv_tensor_tmp.GetTensor(input_tensor.device_ctx());
-  qkv.Reshape<float>(
-      {3, batch_size, num_attention_heads_, seq_length, size_per_head},
-      input_tensor.device_type(), input_tensor.device_id());
+  // The queries computed, a single row of every sequence if `row` is given.
+  auto n_queries = row < 0 ? seq_length : 1;
+  output->Reshape<T>({batch_size, n_queries, hidden_size},
+                     input_tensor.device_type(), input_tensor.device_id());
 
-  kernels::SplitAddBiasTransposeForScore(&qkv, temp_qkv, qkv_bias_);
-  // 3. q = qkv[0]; k = qkv[1]; v = qkv[2];
-  auto q = qkv[0];
-  auto k = qkv[1];
-  auto v = qkv[2];
-
-  // 4. att_score = softmax((q * k^T)*1/sqrt(size_per_head) + att_mask)
-  static core::TempTensor att_score_tmp;
-  core::Tensor& att_score = att_score_tmp.GetTensor(input_tensor.device_ctx());
-  att_score.Reshape<float>(
-      {batch_size, num_attention_heads_, seq_length, seq_length},
-      input_tensor.device_type(), input_tensor.device_id());
-  kernels::BatchMatMul(q, false, k, true, 1.0, &att_score, 0.0);
-
-  kernels::ApplyMaskAndSoftmax(
-      &att_score, attention_mask,
-      1 / std::sqrt(static_cast<float>(size_per_head)));
-  // 5. ctx = v * att_score
-  static core::TempTensor context_layer_tmpr;
-  core::Tensor& context_layer =
-      context_layer_tmpr.GetTensor(input_tensor.device_ctx());
-  context_layer.Reshape<float>(
-      {batch_size, num_attention_heads_, seq_length, size_per_head},
-      input_tensor.device_type(), input_tensor.device_id());
-  kernels::BatchMatMul(att_score, false, v, false, 1.0, &context_layer, 0.0);
-
-  // 6. self_att_out = transpose(ctx)
-  static core::TempTensor self_attr_out_tmp;
-  core::Tensor& self_attr_out =
-      self_attr_out_tmp.GetTensor(input_tensor.device_ctx());
-  self_attr_out.Reshape<float>(
-      {batch_size, seq_length, num_attention_heads_ * size_per_head},
+  // 1-3. q, k, v = split(MatMul(input) + bias) as (batch_size, head_num,
+  // seq_length, size_per_head) each.
+  core::TensorView q, k, v;
+  bool quantized = !quantized_qkv_weight_.is_null();
+  bool bf16 = !bf16_qkv_weight_.is_null();
+  // The compressed weights multiply few rows only, more take the float ones.
+  bool compressed = !compressed_qkv_weight_.is_null() &&
+                    kernels::IsWeightOnlyMatMulSupported(batch_size *
+                                                         seq_length);
+  if (quantized || bf16 || compressed) {
+    // The bias is added while the int8 product is dequantized, or after the
+    // bfloat16 or compressed one, and the heads are read straight out of it,
+    // [batch_size, seq_length, 3, head_num, size_per_head], by strides.
+    core::Tensor& temp_qkv = workspace->GetTensor<T>(
+        kTempQKV, {batch_size, seq_length, 3 * all_head_size},
+        input_tensor.device_type(), input_tensor.device_id());
+    if (quantized) {
+      kernels::QuantizedMatMulBiasAct<types::ActivationType::Identity>(
+          input_tensor, quantized_qkv_weight_, qkv_bias_, &temp_qkv);
+    } else if (bf16) {
+      kernels::BF16MatMulBiasAct<types::ActivationType::Identity>(
+          input_tensor, bf16_qkv_weight_, qkv_bias_, &temp_qkv);
+    } else {
+      kernels::WeightOnlyMatMulBiasAct<types::ActivationType::Identity>(
+          input_tensor, compressed_qkv_weight_, qkv_bias_, &temp_qkv);
+    }
+    auto heads = [&](int64_t idx) {
+      return core::TensorView(temp_qkv).AsStrided(
+          {batch_size, num_attention_heads_, seq_length, size_per_head},
+          {seq_length * 3 * all_head_size, size_per_head, 3 * all_head_size,
+           1},
+          idx * all_head_size);
+    };
+    q = heads(0);
+    k = heads(1);
+    v = heads(2);
+  } else {
+    // The heads of q, k and v are written directly by the epilogue of the
+    // projection.
+    core::Tensor& qkv = workspace->GetTensor<T>(
+        kQKV,
+        {3, batch_size, num_attention_heads_, seq_length, size_per_head},
+        input_tensor.device_type(), input_tensor.device_id());
+    kernels::MatMulSplitAddBiasTransposeForScore(
+        qkv, input_tensor, qkv_weight_, packed_qkv_weight_, qkv_bias_);
+    core::TensorView qkv_view(qkv);
+    q = qkv_view[0];
+    k = qkv_view[1];
+    v = qkv_view[2];
+  }
+
+  core::Tensor& self_attr_out = workspace->GetTensor<T>(
+      kSelfAttrOut, {batch_size, n_queries, all_head_size},
       input_tensor.device_type(), input_tensor.device_id());
+  float scale = 1 / std::sqrt(static_cast<float>(size_per_head));
+  // self_att_out as the heads (batch_size, head_num, n_queries,
+  // size_per_head) of the context.
+  auto context = core::TensorView(self_attr_out)
+                     .AsStrided({batch_size, num_attention_heads_, n_queries,
+                                 size_per_head},
+                                {n_queries * all_head_size, size_per_head,
+                                 all_head_size, 1});
+  // The residual of the dense layer, the rows of the input the queries are.
+  const core::Tensor* residual = &input_tensor;
+  if (row >= 0) {
+    const auto* lens =
+        seq_lens == nullptr ? nullptr : seq_lens->data<int64_t>();
+    RowAttention<T>(q, k, v, attention_mask, lens, row, scale, context,
+                    workspace);
+    for (int64_t b = 0; lens != nullptr && b < batch_size; ++b) {
+      if (row >= lens[b]) {
+        kernels::common::Fill<T>(
+            self_attr_out.mutableData<T>() + b * all_head_size,
+            all_head_size, T(0.f), input_tensor.device_type(),
+            input_tensor.device_id());
+      }
+    }
+    core::Tensor& row_input = workspace->GetTensor<T>(
+        kRowInput, {batch_size, 1, hidden_size}, input_tensor.device_type(),
+        input_tensor.device_id());
+    auto flag = core::ToMemcpyFlag(input_tensor.device_type(),
+                                   input_tensor.device_type());
+    core::Memcpy2DAsync(row_input.mutableData<T>(), hidden_size * sizeof(T),
+                        input_tensor.data<T>() + row * hidden_size,
+                        seq_length * hidden_size * sizeof(T),
+                        hidden_size * sizeof(T), batch_size, flag,
+                        input_tensor.device_id());
+    residual = &row_input;
+  } else if (seq_offsets != nullptr) {
+    // 4-6. The packed tokens are a single sequence of the projections, whose
+    // attention runs sequence by sequence.
+    const auto* offsets = seq_offsets->data<int64_t>();
+    std::vector<int64_t> begins(offsets, offsets + seq_offsets->numel() - 1);
+    std::vector<int64_t> lens(begins.size());
+    for (size_t b = 0; b < lens.size(); ++b) {
+      lens[b] = offsets[b + 1] - offsets[b];
+    }
+    VarlenAttention<T>(q, k, v, begins, lens, scale, context, workspace);
+  } else if (seq_lens != nullptr) {
+    // 4-6. Every sequence attends to its valid keys only, and the context of
+    // its padded queries is zero.
+    const auto* lens = seq_lens->data<int64_t>();
+    VarlenAttention<T>(q, k, v, std::vector<int64_t>(batch_size, 0),
+                       std::vector<int64_t>(lens, lens + batch_size), scale,
+                       context, workspace);
+    for (int64_t b = 0; b < batch_size; ++b) {
+      if (lens[b] < seq_length) {
+        kernels::common::Fill<T>(
+            self_attr_out.mutableData<T>() +
+                (b * seq_length + lens[b]) * all_head_size,
+            (seq_length - lens[b]) * all_head_size, T(0.f),
+            input_tensor.device_type(), input_tensor.device_id());
+      }
+    }
+  } else if (kernels::IsFusedAttentionSupported(
+                 input_tensor.device_type(), seq_length, size_per_head)) {
+    // 4-6. self_att_out = transpose(softmax((q * k^T) * scale + att_mask) * v),
+    // which never stores the scores of a whole head.
+    kernels::FusedAttention(q, k, v, *attention_mask, scale, context);
+  } else {
+    // 4. att_score = softmax((q * k^T)*1/sqrt(size_per_head) + att_mask)
+    core::Tensor& att_score = workspace->GetTensor<T>(
+        kAttScore, {batch_size, num_attention_heads_, seq_length, seq_length},
+        input_tensor.device_type(), input_tensor.device_id());
+    kernels::BatchMatMul(q, false, k, true, 1.0, att_score, 0.0);
 
-  kernels::TransposeForScore(&self_attr_out, context_layer);
+    kernels::ApplyMaskAndSoftmax(att_score, *attention_mask, scale);
+    // 5-6. self_att_out = transpose(v * att_score), written into the merged
+    // heads directly.
+    kernels::BatchMatMul(att_score, false, v, false, 1.0, context, 0.0);
+  }
 
   // 7. output = LayerNorm(MatMul(self_att_out) + Bias)
-  kernels::MatMul(self_attr_out, false, dense_weight_, false, 1.0, output, 0.0);
+  if (partial) {
+    if (!sparse_dense_weight_.is_null()) {
+      kernels::BlockSparseMatMul(self_attr_out, sparse_dense_weight_, output);
+    } else if (!packed_dense_weight_.is_null()) {
+      kernels::MatMul(self_attr_out, packed_dense_weight_, *output, 0.0);
+    } else {
+      kernels::MatMul(self_attr_out, false, dense_weight_, false, 1.0, *output,
+                      0.0);
+    }
+    return;
+  }
+  if (quantized) {
+    kernels::QuantizedMatMulAddBiasLayerNorm(
+        self_attr_out, quantized_dense_weight_, *residual, dense_bias_,
+        layer_norm_weight_, layer_norm_bias_, output);
+    return;
+  }
+  if (bf16) {
+    kernels::BF16MatMulAddBiasLayerNorm(self_attr_out, bf16_dense_weight_,
+                                        *residual, dense_bias_,
+                                        layer_norm_weight_, layer_norm_bias_,
+                                        output);
+    return;
+  }
+  if (!compressed_dense_weight_.is_null() &&
+      kernels::IsWeightOnlyMatMulSupported(batch_size * n_queries)) {
+    kernels::WeightOnlyMatMulAddBiasLayerNorm(
+        self_attr_out, compressed_dense_weight_, *residual, dense_bias_,
+        layer_norm_weight_, layer_norm_bias_, output);
+    return;
+  }
+  if (!sparse_dense_weight_.is_null()) {
+    kernels::BlockSparseMatMul(self_attr_out, sparse_dense_weight_, output);
+    kernels::AddBiasLayerNorm<T>(*residual, dense_bias_, layer_norm_weight_,
+                                 layer_norm_bias_, output);
+    return;
+  }
+  kernels::MatMulAddBiasLayerNorm<T>(self_attr_out, dense_weight_,
+                                     packed_dense_weight_, *residual,
+                                     dense_bias_,
+                                     layer_norm_weight_,  // gemma
+                                     layer_norm_bias_, output);
+}
+
+void BertAttention::Quantize() {
+  quantized_qkv_weight_ = kernels::QuantizeWeight(qkv_weight_);
+  quantized_dense_weight_ = kernels::QuantizeWeight(dense_weight_);
+  packed_qkv_weight_ = kernels::PackedWeight();
+  packed_dense_weight_ = kernels::PackedWeight();
+  sparse_dense_weight_ = kernels::BlockSparseWeight();
+  bf16_qkv_weight_ = kernels::BF16Weight();
+  bf16_dense_weight_ = kernels::BF16Weight();
+  compressed_qkv_weight_ = kernels::WeightOnlyWeight();
+  compressed_dense_weight_ = kernels::WeightOnlyWeight();
+}
+
+void BertAttention::ConvertToBF16() {
+  bf16_qkv_weight_ = kernels::ConvertWeightToBF16(qkv_weight_);
+  bf16_dense_weight_ = kernels::ConvertWeightToBF16(dense_weight_);
+  quantized_qkv_weight_ = kernels::QuantizedWeight();
+  quantized_dense_weight_ = kernels::QuantizedWeight();
+  packed_qkv_weight_ = kernels::PackedWeight();
+  packed_dense_weight_ = kernels::PackedWeight();
+  sparse_dense_weight_ = kernels::BlockSparseWeight();
+  compressed_qkv_weight_ = kernels::WeightOnlyWeight();
+  compressed_dense_weight_ = kernels::WeightOnlyWeight();
+}
 
-  kernels::AddBiasLayerNorm<float>(input_tensor, dense_bias_,
-                                   layer_norm_weight_,  // gemma
-                                   layer_norm_bias_, output);
+void BertAttention::CompressWeights(kernels::WeightOnlyType type) {
+  if (kernels::IsWeightOnlyMatMulSupported(1)) {
+    compressed_qkv_weight_ = kernels::CompressWeight(qkv_weight_, type);
+    compressed_dense_weight_ = kernels::CompressWeight(dense_weight_, type);
+  }
+  quantized_qkv_weight_ = kernels::QuantizedWeight();
+  quantized_dense_weight_ = kernels::QuantizedWeight();
+  bf16_qkv_weight_ = kernels::BF16Weight();
+  bf16_dense_weight_ = kernels::BF16Weight();
+  PackWeights();
+}
+
+void BertAttention::PackWeights() {
+  packed_qkv_weight_ = kernels::PackLayerWeight(qkv_weight_);
+  sparse_dense_weight_ = kernels::SparsifyWeight(dense_weight_);
+  packed_dense_weight_ = sparse_dense_weight_.is_null()
+                             ? kernels::PackLayerWeight(dense_weight_)
+                             : kernels::PackedWeight();
+}
+
+bool BertAttention::GetFusedWeights(
+    kernels::FusedBertLayerWeights* weights) const {
+  weights->qkv_weight = &qkv_weight_;
+  weights->qkv_bias = &qkv_bias_;
+  weights->attention_dense_weight = &dense_weight_;
+  weights->attention_dense_bias = &dense_bias_;
+  weights->attention_layer_norm_weight = &layer_norm_weight_;
+  weights->attention_layer_norm_bias = &layer_norm_bias_;
+  weights->num_attention_heads = num_attention_heads_;
+  return quantized_qkv_weight_.is_null() && bf16_qkv_weight_.is_null() &&
+         compressed_qkv_weight_.is_null() && sparse_dense_weight_.is_null() &&
+         qkv_weight_.is_contiguous() && dense_weight_.is_contiguous();
+}
+
+int64_t BertAttention::PlanMemory(core::MemoryPlanner* planner,
+                                  int64_t batch_size, int64_t seq_length,
+                                  int64_t op) const {
+  auto all_head_size = qkv_weight_.shape(1) / 3;
+  auto size_per_head = all_head_size / num_attention_heads_;
+  size_t elem_size = qkv_weight_.IsType<core::Half>() ? sizeof(core::Half)
+                                                      : sizeof(float);
+  size_t bytes = batch_size * seq_length * all_head_size * elem_size;
+  // op: qkv projection, op + 1: q * k^T and softmax, op + 2: score * v, op +
+  // 3: dense and layer norm. The heads are read out of the int8, bfloat16 or
+  // compressed projection in place. The fused attention writes the merged
+  // heads at op + 1, which shorter inputs may take even when seq_length does
+  // not.
+  bool compressed = !compressed_qkv_weight_.is_null() &&
+                    kernels::IsWeightOnlyMatMulSupported(batch_size *
+                                                         seq_length);
+  if (!quantized_qkv_weight_.is_null() || !bf16_qkv_weight_.is_null() ||
+      compressed) {
+    planner->AddUsage(kTempQKV, 3 * bytes, op, op + 2);
+  } else {
+    planner->AddUsage(kQKV,
+                      3 * batch_size * num_attention_heads_ * seq_length *
+                          size_per_head * elem_size,
+                      op, op + 2);
+  }
+  if (!kernels::IsFusedAttentionSupported(qkv_weight_.device_type(),
+                                          seq_length, size_per_head)) {
+    planner->AddUsage(kAttScore,
+                      batch_size * num_attention_heads_ * seq_length *
+                          seq_length * elem_size,
+                      op + 1, op + 2);
+  }
+  planner->AddUsage(kSelfAttrOut, bytes, op + 1, op + 3);
+  return op + 3;
 }
 
 void BertAttention::EnforceShapeAndType() const {
+  TT_ENFORCE_GT(num_attention_heads_, 0, "The attention needs a head.");
+  TT_ENFORCE_EQ(qkv_weight_.n_dim(), 2, "qkv weight must be matrix");
+  TT_ENFORCE_EQ(qkv_weight_.shape(1) % (3 * num_attention_heads_), 0,
+                "The qkv weight of %d columns can not be split into 3 x %d "
+                "heads",
+                qkv_weight_.shape(1), num_attention_heads_);
+  TT_ENFORCE_EQ(dense_weight_.shape(0), qkv_weight_.shape(1) / 3,
+                "The dense weight must take the %d columns of the heads",
+                qkv_weight_.shape(1) / 3);
   if (loguru::current_verbosity_cutoff() >= 3) {
     std::ostringstream os;
     os << ">>>>>>>>>>>> qkv_weight_ <<<<<<<<<<<<" << std::endl;
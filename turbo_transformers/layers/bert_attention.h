@@ -13,16 +13,27 @@
 
 #pragma once
 #include <memory>
-#include <mutex>
-
 #include <utility>
+
+#include "turbo_transformers/core/memory_planner.h"
 #include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/workspace.h"
+#include "turbo_transformers/layers/kernels/bf16_mat_mul.h"
+#include "turbo_transformers/layers/kernels/fused_bert_layer.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+#include "turbo_transformers/layers/kernels/quantization.h"
+#include "turbo_transformers/layers/kernels/sparse_mat_mul.h"
+#include "turbo_transformers/layers/kernels/weight_only_mat_mul.h"
 
 namespace turbo_transformers {
 namespace layers {
 
 class BertAttention {
  public:
+  // The qkv weight is [hidden_size, 3 * num_attention_heads * size_per_head]
+  // and the dense weight [num_attention_heads * size_per_head, hidden_size].
+  // The heads of a head-pruned layer may be fewer than hidden_size /
+  // size_per_head, every layer then takes its own number of heads.
   BertAttention(core::Tensor qkv_weight, core::Tensor qkv_bias,
                 core::Tensor dense_weight, core::Tensor dense_bias,
                 core::Tensor layer_norm_weight, core::Tensor layer_norm_bias,
@@ -35,14 +46,99 @@ class BertAttention {
         layer_norm_bias_(std::move(layer_norm_bias)),
         num_attention_heads_(num_attention_heads) {
     EnforceShapeAndType();
+    PackWeights();
   }
   void EnforceShapeAndType() const;
 
+  // Quantizes the qkv and dense weights to int8 on their device, afterwards
+  // the GEMMs run through the kernels of kernels/quantization.h. It must not
+  // be called while the layer is being used by other threads.
+  void Quantize();
+  // Rounds the qkv and dense weights of a float CPU layer to bfloat16,
+  // afterwards the GEMMs run through the kernels of kernels/bf16_mat_mul.h,
+  // while the softmax and the layer norms stay in float. The same as
+  // Quantize applies.
+  void ConvertToBF16();
+  // Stores the qkv and dense weights of a float CPU layer as `type` too,
+  // afterwards the GEMMs of up to kernels::kWeightOnlyMaxKernelRows rows run
+  // through the kernels of kernels/weight_only_mat_mul.h, which convert them
+  // back to float as they multiply. The float weights are kept for the GEMMs
+  // of more rows, so no memory is saved. A no-op on the CPUs without the
+  // kernels, see kernels::IsWeightOnlyMatMulSupported. The same as Quantize
+  // applies.
+  void CompressWeights(kernels::WeightOnlyType type);
+  // Sets the weights of the attention in `weights` and returns whether the
+  // fused layer reads them, i.e. they are contiguous and neither quantized,
+  // converted, compressed nor sparse, see kernels::FusedBertLayer.
+  bool GetFusedWeights(kernels::FusedBertLayerWeights *weights) const;
+
+  // The intermediate tensors are taken from `workspace` if it is given,
+  // otherwise from a workspace owned by the calling thread. The layer holds
+  // no mutable state, so it can be called from several threads at once.
   void operator()(const core::Tensor &input_tensor,
-                  const core::Tensor &attention_mask,
-                  core::Tensor *output) const;
+                  const core::Tensor &attention_mask, core::Tensor *output,
+                  core::Workspace *workspace = nullptr) const;
+
+  // The attention of padded sequences given by their lengths rather than by
+  // a mask. `seq_lens` is an int64 CPU tensor [batch_size]. Each sequence
+  // attends to its first seq_lens[b] keys only, so the scores of the padded
+  // keys and queries are never computed, and the attention output of the
+  // padded queries is zero before the dense layer.
+  void RunWithSeqLens(const core::Tensor &input_tensor,
+                      const core::Tensor &seq_lens, core::Tensor *output,
+                      core::Workspace *workspace = nullptr) const;
+
+  // The attention of the packed tokens of several sequences. `input_tensor`
+  // [1, total_tokens, hidden_size] holds the valid tokens of the sequences
+  // back to back, and `seq_offsets`, an int64 CPU tensor [batch_size + 1],
+  // the prefix sums of their lengths. The projections run on the tokens
+  // only, the attention sequence by sequence, so no padding is computed.
+  void RunPacked(const core::Tensor &input_tensor,
+                 const core::Tensor &seq_offsets, core::Tensor *output,
+                 core::Workspace *workspace = nullptr) const;
+
+  // The attention output of the query `row` of every sequence only,
+  // [batch_size, 1, hidden_size], as the last layer needs when its output is
+  // pooled by the first or the last row. The keys and values are projected
+  // from all the tokens, the scores, the context and the dense layer take the
+  // single row. The sequences are masked by either `attention_mask` or
+  // `seq_lens`, see RunWithSeqLens, the other one is null.
+  void RunOnRow(const core::Tensor &input_tensor,
+                const core::Tensor *attention_mask,
+                const core::Tensor *seq_lens, int64_t row,
+                core::Tensor *output,
+                core::Workspace *workspace = nullptr) const;
+
+  // The attention of a shard of a tensor-parallel layer, whose qkv weight
+  // holds a range of the heads and whose dense weight their rows. `output`
+  // [batch_size, seq_length, hidden_size] is the product of the context and
+  // the dense weight only; the outputs of all the shards are summed, then the
+  // dense bias, the residual and the layer norm are applied once, by
+  // kernels::AddBiasLayerNorm. The weights stay in float.
+  void RunPartial(const core::Tensor &input_tensor,
+                  const core::Tensor &attention_mask, core::Tensor *output,
+                  core::Workspace *workspace = nullptr) const;
+
+  // Declare the intermediate tensors of a call starting at operator `op`.
+  // Returns the index of the last operator this layer occupies.
+  int64_t PlanMemory(core::MemoryPlanner *planner, int64_t batch_size,
+                     int64_t seq_length, int64_t op) const;
 
  private:
+  // T is float or core::Half, the data type of the input and the weights.
+  // Exactly one of `attention_mask`, `seq_offsets` for packed inputs and
+  // `seq_lens` is given. Only the query `row` is computed if it is not
+  // negative, which excludes `seq_offsets`. A `partial` output stops after
+  // the product of the dense layer, see RunPartial.
+  template <typename T>
+  void Compute(const core::Tensor &input_tensor,
+               const core::Tensor *attention_mask,
+               const core::Tensor *seq_offsets, const core::Tensor *seq_lens,
+               int64_t row, core::Tensor *output, core::Workspace *workspace,
+               bool partial = false) const;
+  // Packs the float weights for the float GEMMs, or sparsifies the dense one.
+  void PackWeights();
+
   core::Tensor qkv_weight_;
   core::Tensor qkv_bias_;
   core::Tensor dense_weight_;
@@ -50,6 +146,16 @@ class BertAttention {
   core::Tensor layer_norm_weight_;
   core::Tensor layer_norm_bias_;
   int64_t num_attention_heads_;
+  kernels::PackedWeight packed_qkv_weight_;
+  kernels::PackedWeight packed_dense_weight_;
+  kernels::QuantizedWeight quantized_qkv_weight_;
+  kernels::QuantizedWeight quantized_dense_weight_;
+  kernels::BF16Weight bf16_qkv_weight_;
+  kernels::BF16Weight bf16_dense_weight_;
+  kernels::WeightOnlyWeight compressed_qkv_weight_;
+  kernels::WeightOnlyWeight compressed_dense_weight_;
+  // Not null if the dense weight was pruned into enough zero blocks.
+  kernels::BlockSparseWeight sparse_dense_weight_;
 };
 
 }  // namespace layers
@@ -0,0 +1,455 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+#include "turbo_transformers/layers/bert_attention.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/kernels/layer_norm.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+static BertAttention CreateBertAttention(int64_t hidden_size,
+                                         int64_t num_heads) {
+  using kernels::common::CreateTensorAndFillRandom;
+  return BertAttention(
+      CreateTensorAndFillRandom<float>({hidden_size, 3 * hidden_size}, kDLCPU,
+                                       0),
+      CreateTensorAndFillRandom<float>({3 * hidden_size}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({hidden_size, hidden_size}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0), num_heads);
+}
+
+TEST_CASE("bert_attention-concurrent_calls", "[bert_attention]") {
+  const int64_t batch_size = 2, seq_length = 16, hidden_size = 64;
+  auto attention = CreateBertAttention(hidden_size, 4);
+  auto input = kernels::common::CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+  auto mask = kernels::common::CreateTensorAndFillConstant<float>(
+      {batch_size, 1, 1, seq_length}, kDLCPU, 0, 0.f);
+
+  core::Tensor expected(nullptr);
+  attention(input, mask, &expected);
+
+  const int n_threads = 4;
+  std::vector<core::Tensor> outputs;
+  for (int i = 0; i < n_threads; ++i) {
+    outputs.emplace_back(nullptr);
+  }
+  std::vector<std::thread> threads;
+  for (int i = 0; i < n_threads; ++i) {
+    threads.emplace_back([&, i] {
+      core::Workspace workspace;
+      for (int step = 0; step < 10; ++step) {
+        // Mix the thread's own workspace and the implicit one.
+        attention(input, mask, &outputs[i], step % 2 ? &workspace : nullptr);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (auto &output : outputs) {
+    REQUIRE(kernels::common::CheckResultOfCPU<float>(expected, output));
+  }
+}
+
+TEST_CASE("bert_attention-planned_workspace", "[bert_attention]") {
+  const int64_t batch_size = 2, seq_length = 8, hidden_size = 64;
+  auto attention = CreateBertAttention(hidden_size, 4);
+  auto input = kernels::common::CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+  auto mask = kernels::common::CreateTensorAndFillConstant<float>(
+      {batch_size, 1, 1, seq_length}, kDLCPU, 0, 0.f);
+
+  core::Tensor expected(nullptr);
+  attention(input, mask, &expected);
+
+  core::MemoryPlanner planner;
+  REQUIRE(attention.PlanMemory(&planner, batch_size, seq_length, 0) == 3);
+  core::Workspace workspace;
+  workspace.Reserve(planner.Plan(), kDLCPU, 0);
+  core::Tensor output(nullptr);
+  attention(input, mask, &output, &workspace);
+  REQUIRE(kernels::common::CheckResultOfCPU<float>(expected, output));
+}
+
+TEST_CASE("bert_attention-quantized", "[bert_attention]") {
+  // The heads are read out of the dequantized projection by strides, and
+  // stay close to the float attention.
+  const int64_t batch_size = 2, seq_length = 8, hidden_size = 64;
+  auto attention = CreateBertAttention(hidden_size, 4);
+  auto input = kernels::common::CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+  auto mask = kernels::common::CreateTensorAndFillConstant<float>(
+      {batch_size, 1, 1, seq_length}, kDLCPU, 0, 0.f);
+
+  core::Tensor expected(nullptr);
+  attention(input, mask, &expected);
+  attention.Quantize();
+  core::Tensor output(nullptr);
+  attention(input, mask, &output);
+  float max_diff = 0;
+  for (int64_t i = 0; i < output.numel(); ++i) {
+    max_diff = std::max(max_diff, std::abs(output.data<float>()[i] -
+                                           expected.data<float>()[i]));
+  }
+  REQUIRE(max_diff < 0.1f);
+}
+
+TEST_CASE("bert_attention-bf16", "[bert_attention]") {
+  // As the int8 attention, the heads are read out of the projection by
+  // strides, also on the planned workspace.
+  const int64_t batch_size = 2, seq_length = 8, hidden_size = 64;
+  auto attention = CreateBertAttention(hidden_size, 4);
+  auto input = kernels::common::CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+  auto mask = kernels::common::CreateTensorAndFillConstant<float>(
+      {batch_size, 1, 1, seq_length}, kDLCPU, 0, 0.f);
+
+  core::Tensor expected(nullptr);
+  attention(input, mask, &expected);
+  attention.ConvertToBF16();
+  core::MemoryPlanner planner;
+  attention.PlanMemory(&planner, batch_size, seq_length, 0);
+  core::Workspace workspace;
+  workspace.Reserve(planner.Plan(), kDLCPU, 0);
+  core::Tensor output(nullptr);
+  attention(input, mask, &output, &workspace);
+  float max_diff = 0;
+  for (int64_t i = 0; i < output.numel(); ++i) {
+    max_diff = std::max(max_diff, std::abs(output.data<float>()[i] -
+                                           expected.data<float>()[i]));
+  }
+  REQUIRE(max_diff < 0.1f);
+}
+
+TEST_CASE("bert_attention-weight_only", "[bert_attention]") {
+  // The fp16 and int8 weights of the planned workspace, whose 16 rows take
+  // the float weights, and of a single row, whose GEMMs take the kernels of
+  // few rows where the CPU has them.
+  const int64_t batch_size = 2, seq_length = 8, hidden_size = 64;
+  auto input = kernels::common::CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+  auto mask = kernels::common::CreateTensorAndFillConstant<float>(
+      {batch_size, 1, 1, seq_length}, kDLCPU, 0, 0.f);
+  for (auto type :
+       {kernels::WeightOnlyType::kFP16, kernels::WeightOnlyType::kInt8}) {
+    auto attention = CreateBertAttention(hidden_size, 4);
+    core::Tensor expected(nullptr), expected_row(nullptr);
+    attention(input, mask, &expected);
+    attention.RunOnRow(input, &mask, nullptr, 0, &expected_row);
+    attention.CompressWeights(type);
+    core::MemoryPlanner planner;
+    attention.PlanMemory(&planner, batch_size, seq_length, 0);
+    core::Workspace workspace;
+    workspace.Reserve(planner.Plan(), kDLCPU, 0);
+    core::Tensor output(nullptr), row(nullptr);
+    attention(input, mask, &output, &workspace);
+    attention.RunOnRow(input, &mask, nullptr, 0, &row);
+    float max_diff = 0;
+    for (int64_t i = 0; i < output.numel(); ++i) {
+      max_diff = std::max(max_diff, std::abs(output.data<float>()[i] -
+                                             expected.data<float>()[i]));
+    }
+    for (int64_t i = 0; i < row.numel(); ++i) {
+      max_diff = std::max(max_diff, std::abs(row.data<float>()[i] -
+                                             expected_row.data<float>()[i]));
+    }
+    REQUIRE(max_diff < 0.1f);
+  }
+}
+
+TEST_CASE("bert_attention-pruned_heads", "[bert_attention]") {
+  using kernels::common::CreateTensor;
+  using kernels::common::CreateTensorAndFillRandom;
+  const int64_t batch_size = 2, seq_length = 8, hidden_size = 64;
+  const int64_t num_heads = 4, size_per_head = 16;
+  const std::vector<int64_t> kept_heads{0, 2};
+  const int64_t kept_size = 2 * size_per_head;
+  auto qkv_weight = CreateTensorAndFillRandom<float>(
+      {hidden_size, 3 * hidden_size}, kDLCPU, 0);
+  auto qkv_bias =
+      CreateTensorAndFillRandom<float>({3 * hidden_size}, kDLCPU, 0);
+  auto dense_weight =
+      CreateTensorAndFillRandom<float>({hidden_size, hidden_size}, kDLCPU, 0);
+  auto dense_bias = CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+  auto gamma = CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+  auto beta = CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+
+  // The columns of the kept heads of q, k and v, and their dense rows.
+  auto pruned_qkv_weight =
+      CreateTensor<float>({hidden_size, 3 * kept_size}, kDLCPU, 0);
+  auto pruned_qkv_bias = CreateTensor<float>({3 * kept_size}, kDLCPU, 0);
+  auto pruned_dense_weight =
+      CreateTensor<float>({kept_size, hidden_size}, kDLCPU, 0);
+  for (int64_t w = 0; w < 3; ++w) {
+    for (size_t h = 0; h < kept_heads.size(); ++h) {
+      for (int64_t c = 0; c < size_per_head; ++c) {
+        int64_t src = w * hidden_size + kept_heads[h] * size_per_head + c;
+        int64_t dst = w * kept_size + h * size_per_head + c;
+        for (int64_t r = 0; r < hidden_size; ++r) {
+          pruned_qkv_weight.mutableData<float>()[r * 3 * kept_size + dst] =
+              qkv_weight.data<float>()[r * 3 * hidden_size + src];
+        }
+        pruned_qkv_bias.mutableData<float>()[dst] =
+            qkv_bias.data<float>()[src];
+      }
+    }
+  }
+  for (size_t h = 0; h < kept_heads.size(); ++h) {
+    for (int64_t c = 0; c < size_per_head; ++c) {
+      std::copy_n(dense_weight.data<float>() +
+                      (kept_heads[h] * size_per_head + c) * hidden_size,
+                  hidden_size,
+                  pruned_dense_weight.mutableData<float>() +
+                      (h * size_per_head + c) * hidden_size);
+    }
+  }
+  // The unpruned layer sees nothing of the pruned heads.
+  for (int64_t h : {1, 3}) {
+    std::fill_n(
+        dense_weight.mutableData<float>() + h * size_per_head * hidden_size,
+        size_per_head * hidden_size, 0.f);
+  }
+
+  auto input = CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+  auto mask = kernels::common::CreateTensorAndFillConstant<float>(
+      {batch_size, 1, 1, seq_length}, kDLCPU, 0, 0.f);
+  auto copy = [](const core::Tensor &t) {
+    core::Tensor result(nullptr);
+    result.Reshape<float>({t.numel()}, kDLCPU, 0);
+    std::copy_n(t.data<float>(), t.numel(), result.mutableData<float>());
+    return result;
+  };
+  core::Tensor expected(nullptr);
+  BertAttention(std::move(qkv_weight), std::move(qkv_bias),
+                std::move(dense_weight), copy(dense_bias), copy(gamma),
+                copy(beta), num_heads)(input, mask, &expected);
+
+  BertAttention pruned(std::move(pruned_qkv_weight), std::move(pruned_qkv_bias),
+                       std::move(pruned_dense_weight), std::move(dense_bias),
+                       std::move(gamma), std::move(beta), kept_heads.size());
+  core::Tensor output(nullptr);
+  pruned(input, mask, &output);
+  REQUIRE(kernels::common::CheckResultOfCPU<float>(expected, output));
+
+  core::MemoryPlanner planner;
+  pruned.PlanMemory(&planner, batch_size, seq_length, 0);
+  core::Workspace workspace;
+  workspace.Reserve(planner.Plan(), kDLCPU, 0);
+  pruned(input, mask, &output, &workspace);
+  REQUIRE(kernels::common::CheckResultOfCPU<float>(expected, output));
+}
+
+TEST_CASE("bert_attention-tensor_parallel", "[bert_attention]") {
+  using kernels::common::CreateTensor;
+  using kernels::common::CreateTensorAndFillRandom;
+  const int64_t batch_size = 2, seq_length = 8, hidden_size = 64;
+  const int64_t num_heads = 4, n_shards = 2;
+  const int64_t shard_size = hidden_size / n_shards;
+  auto qkv_weight = CreateTensorAndFillRandom<float>(
+      {hidden_size, 3 * hidden_size}, kDLCPU, 0);
+  auto qkv_bias =
+      CreateTensorAndFillRandom<float>({3 * hidden_size}, kDLCPU, 0);
+  auto dense_weight =
+      CreateTensorAndFillRandom<float>({hidden_size, hidden_size}, kDLCPU, 0);
+  auto dense_bias = CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+  auto gamma = CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+  auto beta = CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+  auto input = CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+  auto mask = CreateTensorAndFillRandom<float>({batch_size, 1, 1, seq_length},
+                                               kDLCPU, 0);
+
+  // Every shard takes the columns of its heads of q, k and v, and their
+  // dense rows.
+  std::vector<std::unique_ptr<BertAttention>> shards;
+  for (int64_t s = 0; s < n_shards; ++s) {
+    auto shard_qkv_weight =
+        CreateTensor<float>({hidden_size, 3 * shard_size}, kDLCPU, 0);
+    auto shard_qkv_bias = CreateTensor<float>({3 * shard_size}, kDLCPU, 0);
+    for (int64_t w = 0; w < 3; ++w) {
+      int64_t src = w * hidden_size + s * shard_size;
+      for (int64_t r = 0; r < hidden_size; ++r) {
+        std::copy_n(qkv_weight.data<float>() + r * 3 * hidden_size + src,
+                    shard_size,
+                    shard_qkv_weight.mutableData<float>() +
+                        r * 3 * shard_size + w * shard_size);
+      }
+      std::copy_n(qkv_bias.data<float>() + src, shard_size,
+                  shard_qkv_bias.mutableData<float>() + w * shard_size);
+    }
+    auto shard_dense_weight =
+        CreateTensor<float>({shard_size, hidden_size}, kDLCPU, 0);
+    std::copy_n(dense_weight.data<float>() + s * shard_size * hidden_size,
+                shard_size * hidden_size,
+                shard_dense_weight.mutableData<float>());
+    shards.emplace_back(new BertAttention(
+        std::move(shard_qkv_weight), std::move(shard_qkv_bias),
+        std::move(shard_dense_weight),
+        CreateTensor<float>({hidden_size}, kDLCPU, 0),
+        CreateTensor<float>({hidden_size}, kDLCPU, 0),
+        CreateTensor<float>({hidden_size}, kDLCPU, 0), num_heads / n_shards));
+  }
+  core::Tensor output(nullptr), partial(nullptr);
+  shards[0]->RunPartial(input, mask, &output);
+  for (int64_t s = 1; s < n_shards; ++s) {
+    shards[s]->RunPartial(input, mask, &partial);
+    kernels::common::Accumulate(partial.data<float>(),
+                                output.mutableData<float>(), output.numel(),
+                                kDLCPU);
+  }
+  kernels::AddBiasLayerNorm<float>(input, dense_bias, gamma, beta, &output);
+
+  core::Tensor expected(nullptr);
+  BertAttention(std::move(qkv_weight), std::move(qkv_bias),
+                std::move(dense_weight), std::move(dense_bias),
+                std::move(gamma), std::move(beta),
+                num_heads)(input, mask, &expected);
+  REQUIRE(kernels::common::CheckResultOfCPU<float>(expected, output));
+}
+
+TEST_CASE("bert_attention-packed_sequences", "[bert_attention]") {
+  const std::vector<int64_t> seq_lens{5, 8, 1, 3};
+  const int64_t batch_size = seq_lens.size(), seq_length = 8,
+                hidden_size = 64;
+  auto attention = CreateBertAttention(hidden_size, 4);
+  auto input = kernels::common::CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+  auto mask = kernels::common::CreateTensorAndFillConstant<float>(
+      {batch_size, 1, 1, seq_length}, kDLCPU, 0, 0.f);
+  auto offsets = kernels::common::CreateTensor<int64_t>({batch_size + 1},
+                                                        kDLCPU, 0);
+  offsets.mutableData<int64_t>()[0] = 0;
+  for (int64_t b = 0; b < batch_size; ++b) {
+    std::fill(mask.mutableData<float>() + b * seq_length + seq_lens[b],
+              mask.mutableData<float>() + (b + 1) * seq_length, -10000.f);
+    offsets.mutableData<int64_t>()[b + 1] =
+        offsets.data<int64_t>()[b] + seq_lens[b];
+  }
+  const int64_t total_tokens = offsets.data<int64_t>()[batch_size];
+  auto packed = kernels::common::CreateTensor<float>(
+      {1, total_tokens, hidden_size}, kDLCPU, 0);
+  for (int64_t b = 0; b < batch_size; ++b) {
+    std::copy_n(input.data<float>() + b * seq_length * hidden_size,
+                seq_lens[b] * hidden_size,
+                packed.mutableData<float>() +
+                    offsets.data<int64_t>()[b] * hidden_size);
+  }
+
+  core::Tensor expected(nullptr);
+  attention(input, mask, &expected);
+  core::Tensor output(nullptr);
+  for (int step = 0; step < 2; ++step) {
+    attention.RunPacked(packed, offsets, &output);
+    REQUIRE(output.shape(1) == total_tokens);
+    // The packed tokens match the valid tokens of the padded batch.
+    for (int64_t b = 0; b < batch_size; ++b) {
+      const float *expected_data =
+          expected.data<float>() + b * seq_length * hidden_size;
+      const float *output_data =
+          output.data<float>() + offsets.data<int64_t>()[b] * hidden_size;
+      for (int64_t i = 0; i < seq_lens[b] * hidden_size; ++i) {
+        REQUIRE(std::abs(expected_data[i] - output_data[i]) < 1e-4);
+      }
+    }
+  }
+}
+
+TEST_CASE("bert_attention-seq_lens", "[bert_attention]") {
+  const std::vector<int64_t> seq_lens{5, 8, 1};
+  const int64_t batch_size = seq_lens.size(), seq_length = 8,
+                hidden_size = 64;
+  auto attention = CreateBertAttention(hidden_size, 4);
+  auto input = kernels::common::CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+  auto mask = kernels::common::CreateTensorAndFillConstant<float>(
+      {batch_size, 1, 1, seq_length}, kDLCPU, 0, 0.f);
+  auto lens = kernels::common::CreateTensor<int64_t>({batch_size}, kDLCPU, 0);
+  std::copy(seq_lens.begin(), seq_lens.end(), lens.mutableData<int64_t>());
+  for (int64_t b = 0; b < batch_size; ++b) {
+    std::fill(mask.mutableData<float>() + b * seq_length + seq_lens[b],
+              mask.mutableData<float>() + (b + 1) * seq_length, -10000.f);
+  }
+
+  core::Tensor expected(nullptr);
+  attention(input, mask, &expected);
+  core::Tensor output(nullptr);
+  core::Workspace workspace;
+  for (int step = 0; step < 2; ++step) {
+    attention.RunWithSeqLens(input, lens, &output, &workspace);
+    for (int64_t b = 0; b < batch_size; ++b) {
+      for (int64_t i = 0; i < seq_length * hidden_size; ++i) {
+        auto idx = b * seq_length * hidden_size + i;
+        if (i < seq_lens[b] * hidden_size) {
+          REQUIRE(std::abs(expected.data<float>()[idx] -
+                           output.data<float>()[idx]) < 1e-4);
+        } else {
+          REQUIRE(std::isfinite(output.data<float>()[idx]));
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("bert_attention-row", "[bert_attention]") {
+  const std::vector<int64_t> seq_lens{5, 8, 1};
+  const int64_t batch_size = seq_lens.size(), seq_length = 8,
+                hidden_size = 64;
+  auto attention = CreateBertAttention(hidden_size, 4);
+  auto input = kernels::common::CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+  auto mask = kernels::common::CreateTensorAndFillConstant<float>(
+      {batch_size, 1, 1, seq_length}, kDLCPU, 0, 0.f);
+  auto lens = kernels::common::CreateTensor<int64_t>({batch_size}, kDLCPU, 0);
+  std::copy(seq_lens.begin(), seq_lens.end(), lens.mutableData<int64_t>());
+  for (int64_t b = 0; b < batch_size; ++b) {
+    std::fill(mask.mutableData<float>() + b * seq_length + seq_lens[b],
+              mask.mutableData<float>() + (b + 1) * seq_length, -10000.f);
+  }
+
+  core::Tensor expected(nullptr), expected_lens(nullptr);
+  attention(input, mask, &expected);
+  attention.RunWithSeqLens(input, lens, &expected_lens);
+  core::Tensor output(nullptr);
+  core::Workspace workspace;
+  for (int64_t row : {int64_t(0), seq_length - 1}) {
+    for (bool by_lens : {false, true}) {
+      attention.RunOnRow(input, by_lens ? nullptr : &mask,
+                         by_lens ? &lens : nullptr, row, &output, &workspace);
+      REQUIRE(output.shape(0) == batch_size);
+      REQUIRE(output.shape(1) == 1);
+      const auto &full = by_lens ? expected_lens : expected;
+      for (int64_t b = 0; b < batch_size; ++b) {
+        for (int64_t i = 0; i < hidden_size; ++i) {
+          auto idx = (b * seq_length + row) * hidden_size + i;
+          REQUIRE(std::abs(full.data<float>()[idx] -
+                           output.data<float>()[b * hidden_size + i]) < 1e-4);
+        }
+      }
+    }
+  }
+}
+
+}  // namespace layers
+}  // namespace turbo_transformers
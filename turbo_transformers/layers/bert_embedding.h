@@ -38,11 +38,16 @@ class BERTEmbedding {
 
   void EnforceShapeAndType() const;
 
+  // A null position_ids stands for the positions 0, 1, ... of every
+  // sequence, which are then generated by the kernel.
   void operator()(const core::Tensor &input_ids,
                   const core::Tensor &position_ids,
                   const core::Tensor &token_type_ids,
                   core::Tensor *output) const;
 
+  DLDeviceType device_type() const { return word_embedings_.device_type(); }
+  int device_id() const { return word_embedings_.device_id(); }
+
  private:
   core::Tensor word_embedings_;
   core::Tensor position_embeddings_;
@@ -0,0 +1,58 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/bert_encoder.h"
+
+#include "turbo_transformers/core/enforce.h"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/profiler.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+void BertEncoder::operator()(const core::Tensor& input_tensor,
+                             const core::Tensor& attention_mask,
+                             core::Tensor* output,
+                             const core::Tensor* seq_offsets,
+                             core::Workspace* workspace) const {
+  core::ProfileScope profile_scope("BertEncoder", input_tensor);
+  core::LayerTimer layer_timer("BertEncoder");
+  TT_ENFORCE(!layers_.empty(), "The encoder has no layers");
+  const core::Tensor* input = &input_tensor;
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    core::ProfileScope layer_scope("Layer", *input, static_cast<int>(i));
+    (*layers_[i])(*input, attention_mask, output, seq_offsets, workspace);
+    input = output;
+  }
+}
+
+void BertEncoder::Quantize() {
+  for (auto& layer : layers_) {
+    layer->Quantize();
+  }
+}
+
+void BertEncoder::ConvertToBF16() {
+  for (auto& layer : layers_) {
+    layer->ConvertToBF16();
+  }
+}
+
+void BertEncoder::CompressWeights(kernels::WeightOnlyType type) {
+  for (auto& layer : layers_) {
+    layer->CompressWeights(type);
+  }
+}
+
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,50 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/workspace.h"
+#include "turbo_transformers/layers/bert_layer.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+// The stack of the encoder layers of a BERT model.
+class BertEncoder {
+ public:
+  explicit BertEncoder(std::vector<std::shared_ptr<BertLayer>> layers)
+      : layers_(std::move(layers)) {}
+
+  // The first layer reads `input_tensor`, the others run on `output` in
+  // place, which may be `input_tensor` itself. See BertLayer::operator().
+  void operator()(const core::Tensor &input_tensor,
+                  const core::Tensor &attention_mask, core::Tensor *output,
+                  const core::Tensor *seq_offsets = nullptr,
+                  core::Workspace *workspace = nullptr) const;
+
+  void Quantize();
+  void ConvertToBF16();
+  void CompressWeights(kernels::WeightOnlyType type);
+
+  size_t num_layers() const { return layers_.size(); }
+
+ private:
+  std::vector<std::shared_ptr<BertLayer>> layers_;
+};
+
+}  // namespace layers
+}  // namespace turbo_transformers
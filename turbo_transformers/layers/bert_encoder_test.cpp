@@ -0,0 +1,387 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/bert_model.h"
+
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/core/memory_tracker.h"
+#include "turbo_transformers/core/tensor_copy.h"
+#include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/sequence_pool.h"
+#ifdef TT_WITH_CUDA
+#include "turbo_transformers/core/cuda_device_context.h"
+#include "turbo_transformers/core/cuda_enforce.cuh"
+#include "turbo_transformers/layers/kernels/gpu_fused_bert_layer_kernel.h"
+#endif
+
+namespace turbo_transformers {
+namespace layers {
+
+static const int64_t kHiddenSize = 64, kIntermediateSize = 128;
+static const int64_t kVocabSize = 100, kMaxPositions = 32;
+
+static std::shared_ptr<BertLayer> CreateBertLayer(
+    std::shared_ptr<BertAttention> *attention = nullptr,
+    std::shared_ptr<BertIntermediate> *intermediate = nullptr,
+    std::shared_ptr<BertOutput> *output = nullptr) {
+  using kernels::common::CreateTensorAndFillRandom;
+  auto att = std::make_shared<BertAttention>(
+      CreateTensorAndFillRandom<float>({kHiddenSize, 3 * kHiddenSize}, kDLCPU,
+                                       0),
+      CreateTensorAndFillRandom<float>({3 * kHiddenSize}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({kHiddenSize, kHiddenSize}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({kHiddenSize}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({kHiddenSize}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({kHiddenSize}, kDLCPU, 0), 4);
+  auto inter = std::make_shared<BertIntermediate>(
+      CreateTensorAndFillRandom<float>({kHiddenSize, kIntermediateSize},
+                                       kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({kIntermediateSize}, kDLCPU, 0));
+  auto out = std::make_shared<BertOutput>(
+      CreateTensorAndFillRandom<float>({kIntermediateSize, kHiddenSize},
+                                       kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({kHiddenSize}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({kHiddenSize}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({kHiddenSize}, kDLCPU, 0));
+  if (attention != nullptr) {
+    *attention = att;
+    *intermediate = inter;
+    *output = out;
+  }
+  return std::make_shared<BertLayer>(att, inter, out);
+}
+
+static std::shared_ptr<BERTEmbedding> CreateBertEmbedding() {
+  using kernels::common::CreateTensorAndFillRandom;
+  return std::make_shared<BERTEmbedding>(
+      CreateTensorAndFillRandom<float>({kVocabSize, kHiddenSize}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({kMaxPositions, kHiddenSize}, kDLCPU,
+                                       0),
+      CreateTensorAndFillRandom<float>({2, kHiddenSize}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({kHiddenSize}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({kHiddenSize}, kDLCPU, 0));
+}
+
+static core::Tensor CreateInputIds(const std::vector<int64_t> &ids,
+                                   int64_t batch_size) {
+  auto tensor = kernels::common::CreateTensor<int64_t>(
+      {batch_size, static_cast<int64_t>(ids.size()) / batch_size}, kDLCPU, 0);
+  std::copy(ids.begin(), ids.end(), tensor.mutableData<int64_t>());
+  return tensor;
+}
+
+TEST_CASE("bert_encoder-sublayers", "[bert_encoder]") {
+  const int64_t batch_size = 2, seq_length = 8;
+  std::vector<std::shared_ptr<BertAttention>> attentions(2);
+  std::vector<std::shared_ptr<BertIntermediate>> intermediates(2);
+  std::vector<std::shared_ptr<BertOutput>> outputs(2);
+  std::vector<std::shared_ptr<BertLayer>> layers;
+  for (int i = 0; i < 2; ++i) {
+    layers.push_back(
+        CreateBertLayer(&attentions[i], &intermediates[i], &outputs[i]));
+  }
+  BertEncoder encoder(layers);
+  REQUIRE(encoder.num_layers() == 2);
+
+  auto input = kernels::common::CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, kHiddenSize}, kDLCPU, 0);
+  auto mask = kernels::common::CreateTensorAndFillConstant<float>(
+      {batch_size, 1, 1, seq_length}, kDLCPU, 0, 0.f);
+
+  // The sublayers one after another.
+  core::Tensor expected(nullptr), attention_out(nullptr),
+      intermediate_out(nullptr);
+  const core::Tensor *layer_input = &input;
+  for (int i = 0; i < 2; ++i) {
+    (*attentions[i])(*layer_input, mask, &attention_out);
+    (*intermediates[i])(attention_out, &intermediate_out);
+    (*outputs[i])(intermediate_out, attention_out, &expected);
+    layer_input = &expected;
+  }
+
+  core::Tensor output(nullptr);
+  encoder(input, mask, &output);
+  REQUIRE(output.shape(2) == kHiddenSize);
+  REQUIRE(kernels::common::CheckResultOfCPU<float>(expected, output));
+
+  // In place.
+  core::Workspace workspace;
+  encoder(input, mask, &input, nullptr, &workspace);
+  REQUIRE(kernels::common::CheckResultOfCPU<float>(expected, input));
+}
+
+#ifdef TT_WITH_CUDA
+TEST_CASE("bert_layer-fused-gpu", "[bert_encoder]") {
+  // The same weights on the CPU and on the GPU.
+  std::vector<core::Tensor> cpu_weights, gpu_weights;
+  auto add_weight = [&](std::initializer_list<int64_t> shape) {
+    core::Tensor cpu(nullptr), gpu(nullptr);
+    std::tie(cpu, gpu) =
+        kernels::common::CreateAndFillRandomForCPUGPUTensors<float>(shape);
+    cpu_weights.push_back(std::move(cpu));
+    gpu_weights.push_back(std::move(gpu));
+  };
+  add_weight({kHiddenSize, 3 * kHiddenSize});
+  add_weight({3 * kHiddenSize});
+  add_weight({kHiddenSize, kHiddenSize});
+  for (int i = 0; i < 3; ++i) {
+    add_weight({kHiddenSize});
+  }
+  add_weight({kHiddenSize, kIntermediateSize});
+  add_weight({kIntermediateSize});
+  add_weight({kIntermediateSize, kHiddenSize});
+  for (int i = 0; i < 3; ++i) {
+    add_weight({kHiddenSize});
+  }
+  auto create_layer = [](std::vector<core::Tensor> &w) {
+    return std::make_shared<BertLayer>(
+        std::make_shared<BertAttention>(std::move(w[0]), std::move(w[1]),
+                                        std::move(w[2]), std::move(w[3]),
+                                        std::move(w[4]), std::move(w[5]), 4),
+        std::make_shared<BertIntermediate>(std::move(w[6]), std::move(w[7])),
+        std::make_shared<BertOutput>(std::move(w[8]), std::move(w[9]),
+                                     std::move(w[10]), std::move(w[11])));
+  };
+  auto cpu_layer = create_layer(cpu_weights);
+  auto gpu_layer = create_layer(gpu_weights);
+  bool was_enabled = kernels::IsFusedBertLayerEnabled();
+  kernels::EnableFusedBertLayer(true);
+
+  // 64 tokens are too many for the fused layer.
+  std::vector<std::pair<int64_t, int64_t>> shapes{
+      {1, 1}, {1, 20}, {2, 16}, {4, 8}, {8, 8}};
+  for (auto &shape : shapes) {
+    int64_t batch_size = shape.first, seq_length = shape.second;
+    core::Tensor cpu_input(nullptr), gpu_input(nullptr);
+    std::tie(cpu_input, gpu_input) =
+        kernels::common::CreateAndFillRandomForCPUGPUTensors<float>(
+            {batch_size, seq_length, kHiddenSize});
+    // The last sequence is padded by a token.
+    auto cpu_mask = kernels::common::CreateTensorAndFillConstant<float>(
+        {batch_size, 1, 1, seq_length}, kDLCPU, 0, 0.f);
+    if (seq_length > 1) {
+      cpu_mask.mutableData<float>()[batch_size * seq_length - 1] = -10000.f;
+    }
+    auto gpu_mask = kernels::common::CreateTensor<float>(
+        {batch_size, 1, 1, seq_length}, kDLGPU, 0);
+    core::Copy<float>(cpu_mask, gpu_mask);
+    REQUIRE(kernels::IsFusedBertLayerSupported(gpu_input, kHiddenSize / 4) ==
+            (batch_size * seq_length <= 32 &&
+             kernels::IsGPUFusedBertLayerSupported(0)));
+
+    core::Tensor cpu_output(nullptr), gpu_output(nullptr);
+    (*cpu_layer)(cpu_input, cpu_mask, &cpu_output);
+    (*gpu_layer)(gpu_input, gpu_mask, &gpu_output);
+    REQUIRE(kernels::common::CheckResultOfCPUAndGPU<float>(cpu_output,
+                                                           gpu_output));
+    // In place.
+    (*gpu_layer)(gpu_input, gpu_mask, &gpu_input);
+    REQUIRE(kernels::common::CheckResultOfCPUAndGPU<float>(cpu_output,
+                                                           gpu_input));
+  }
+  kernels::EnableFusedBertLayer(was_enabled);
+}
+
+TEST_CASE("bert_layer-fused-gpu-fallback", "[bert_encoder]") {
+  using kernels::common::CreateTensorAndFillRandom;
+  auto attention = std::make_shared<BertAttention>(
+      CreateTensorAndFillRandom<float>({kHiddenSize, 3 * kHiddenSize}, kDLGPU,
+                                       0),
+      CreateTensorAndFillRandom<float>({3 * kHiddenSize}, kDLGPU, 0),
+      CreateTensorAndFillRandom<float>({kHiddenSize, kHiddenSize}, kDLGPU, 0),
+      CreateTensorAndFillRandom<float>({kHiddenSize}, kDLGPU, 0),
+      CreateTensorAndFillRandom<float>({kHiddenSize}, kDLGPU, 0),
+      CreateTensorAndFillRandom<float>({kHiddenSize}, kDLGPU, 0), 4);
+  auto intermediate = std::make_shared<BertIntermediate>(
+      CreateTensorAndFillRandom<float>({kHiddenSize, kIntermediateSize},
+                                       kDLGPU, 0),
+      CreateTensorAndFillRandom<float>({kIntermediateSize}, kDLGPU, 0));
+  auto output = std::make_shared<BertOutput>(
+      CreateTensorAndFillRandom<float>({kIntermediateSize, kHiddenSize},
+                                       kDLGPU, 0),
+      CreateTensorAndFillRandom<float>({kHiddenSize}, kDLGPU, 0),
+      CreateTensorAndFillRandom<float>({kHiddenSize}, kDLGPU, 0),
+      CreateTensorAndFillRandom<float>({kHiddenSize}, kDLGPU, 0));
+  BertLayer layer(attention, intermediate, output);
+  auto input = CreateTensorAndFillRandom<float>({2, 8, kHiddenSize}, kDLGPU, 0);
+  auto mask = kernels::common::CreateTensorAndFillConstant<float>(
+      {2, 1, 1, 8}, kDLGPU, 0, 0.f);
+
+  bool was_enabled = kernels::IsFusedBertLayerEnabled();
+  kernels::EnableFusedBertLayer(false);
+  core::Tensor expected(nullptr);
+  layer(input, mask, &expected);
+  kernels::EnableFusedBertLayer(true);
+  core::Tensor cpu_expected = kernels::common::CreateTensor<float>(
+      {2, 8, kHiddenSize}, kDLCPU, 0);
+  core::Copy<float>(expected, cpu_expected);
+
+  // The fused layer runs on a GPU which launches it cooperatively, the
+  // others fall back to the layers one by one.
+  core::Tensor fused_output(nullptr);
+  bool fused = RunFusedBertLayer(*attention, *intermediate, *output, input,
+                                 mask, &fused_output);
+  REQUIRE(fused == kernels::IsGPUFusedBertLayerSupported(0));
+  if (fused) {
+    REQUIRE(kernels::common::CheckResultOfCPUAndGPU<float>(cpu_expected,
+                                                           fused_output));
+  }
+  // Back to back, every launch waits at its barriers for its own blocks
+  // only.
+  core::Tensor layer_output(nullptr);
+  for (int i = 0; i < 100; ++i) {
+    layer(input, mask, &layer_output);
+  }
+  REQUIRE(kernels::common::CheckResultOfCPUAndGPU<float>(cpu_expected,
+                                                         layer_output));
+
+  // A stream capture never takes the cooperative launch, the layers are
+  // captured one by one.
+  auto &cuda_ctx = core::CUDADeviceContext::GetInstance(0);
+  core::Tensor captured_output(nullptr);
+  layer(input, mask, &captured_output);
+  cuda_ctx.Wait();
+  TT_ENFORCE_CUDA_SUCCESS(
+      cudaStreamBeginCapture(cuda_ctx.stream(), cudaStreamCaptureModeGlobal));
+  bool fused_in_capture = RunFusedBertLayer(
+      *attention, *intermediate, *output, input, mask, &captured_output);
+  layer(input, mask, &captured_output);
+  cudaGraph_t graph;
+  TT_ENFORCE_CUDA_SUCCESS(cudaStreamEndCapture(cuda_ctx.stream(), &graph));
+  REQUIRE(!fused_in_capture);
+  cudaGraphExec_t exec;
+#if CUDART_VERSION >= 12000
+  TT_ENFORCE_CUDA_SUCCESS(cudaGraphInstantiate(&exec, graph, 0));
+#else
+  TT_ENFORCE_CUDA_SUCCESS(
+      cudaGraphInstantiate(&exec, graph, nullptr, nullptr, 0));
+#endif
+  TT_ENFORCE_CUDA_SUCCESS(cudaGraphLaunch(exec, cuda_ctx.stream()));
+  cuda_ctx.Wait();
+  REQUIRE(kernels::common::CheckResultOfCPUAndGPU<float>(cpu_expected,
+                                                         captured_output));
+  TT_ENFORCE_CUDA_SUCCESS(cudaGraphExecDestroy(exec));
+  TT_ENFORCE_CUDA_SUCCESS(cudaGraphDestroy(graph));
+  kernels::EnableFusedBertLayer(was_enabled);
+}
+#endif
+
+TEST_CASE("bert_model-packed", "[bert_encoder]") {
+  BertModel model(CreateBertEmbedding(),
+                  std::make_shared<BertEncoder>(
+                      std::vector<std::shared_ptr<BertLayer>>{
+                          CreateBertLayer(), CreateBertLayer()}));
+  const std::vector<std::vector<int64_t>> sequences{
+      {5, 17, 3, 42, 8, 1}, {7, 9, 64}};
+
+  // Every sequence alone, unpadded.
+  std::vector<core::Tensor> expected_hidden, expected_pooled;
+  for (auto &ids : sequences) {
+    auto input_ids = CreateInputIds(ids, 1);
+    core::Tensor mask(nullptr), token_type_ids(nullptr),
+        position_ids(nullptr);
+    expected_hidden.emplace_back(nullptr);
+    expected_pooled.emplace_back(nullptr);
+    model(input_ids, &mask, &token_type_ids, &position_ids,
+          types::PoolType::kMean, &expected_hidden.back(),
+          &expected_pooled.back());
+  }
+
+  std::vector<int64_t> packed_ids;
+  std::vector<int64_t> offsets{0};
+  for (auto &ids : sequences) {
+    packed_ids.insert(packed_ids.end(), ids.begin(), ids.end());
+    offsets.push_back(static_cast<int64_t>(packed_ids.size()));
+  }
+  auto input_ids = CreateInputIds(packed_ids, 1);
+  auto seq_offsets = CreateInputIds(offsets, 1);
+  core::Tensor mask(nullptr), token_type_ids(nullptr), position_ids(nullptr),
+      hidden(nullptr), pooled(nullptr);
+  model(input_ids, &mask, &token_type_ids, &position_ids,
+        types::PoolType::kMean, &hidden, &pooled, &seq_offsets);
+
+  REQUIRE(hidden.shape(1) == static_cast<int64_t>(packed_ids.size()));
+  REQUIRE(pooled.shape(0) == 2);
+  for (size_t b = 0; b < sequences.size(); ++b) {
+    auto n_values = expected_hidden[b].numel();
+    const float *packed_hidden =
+        hidden.data<float>() + offsets[b] * kHiddenSize;
+    const float *ref_hidden = expected_hidden[b].data<float>();
+    for (int64_t i = 0; i < n_values; ++i) {
+      REQUIRE(std::abs(packed_hidden[i] - ref_hidden[i]) < 1e-3);
+    }
+    const float *ref_pooled = expected_pooled[b].data<float>();
+    for (int64_t i = 0; i < kHiddenSize; ++i) {
+      REQUIRE(std::abs(pooled.data<float>()[b * kHiddenSize + i] -
+                       ref_pooled[i]) < 1e-3);
+    }
+  }
+
+  // The host ids of the ragged batch.
+  core::Tensor ragged_hidden(nullptr), ragged_pooled(nullptr);
+  model.RunPacked(packed_ids, offsets, types::PoolType::kMean, &ragged_hidden,
+                  &ragged_pooled);
+  REQUIRE(kernels::common::CheckResultOfCPU<float>(hidden, ragged_hidden));
+  REQUIRE(kernels::common::CheckResultOfCPU<float>(pooled, ragged_pooled));
+  REQUIRE_THROWS(model.RunPacked(packed_ids, {0, 6}, types::PoolType::kMean,
+                                 &ragged_hidden, &ragged_pooled));
+}
+
+TEST_CASE("bert_model-warm-up", "[bert_encoder]") {
+  BertModel model(CreateBertEmbedding(),
+                  std::make_shared<BertEncoder>(
+                      std::vector<std::shared_ptr<BertLayer>>{
+                          CreateBertLayer(), CreateBertLayer()}));
+  auto input_ids = CreateInputIds({5, 17, 3, 42, 8, 1, 7, 9, 64, 2, 4, 6}, 2);
+  // The tensors allocated while running the batch, the outputs included.
+  auto count_allocs = [&](core::Workspace *workspace, core::Tensor *pooled) {
+    core::ResetMemoryTracking();
+    core::Tensor mask(nullptr), token_type_ids(nullptr),
+        position_ids(nullptr), hidden(nullptr);
+    *pooled = core::Tensor(nullptr);
+    {
+      core::MemoryTagGuard tag("warm_up_test");
+      model(input_ids, &mask, &token_type_ids, &position_ids,
+            types::PoolType::kFirst, &hidden, pooled, nullptr, workspace);
+    }
+    for (auto &usage : core::GetMemoryUsages()) {
+      if (usage.tag == "warm_up_test" && usage.device_type == kDLCPU) {
+        return usage.num_allocs;
+      }
+    }
+    return size_t(0);
+  };
+
+  core::EnableMemoryTracking();
+  core::Workspace cold_workspace, warm_workspace;
+  core::Tensor expected(nullptr), pooled(nullptr);
+  auto cold_allocs = count_allocs(&cold_workspace, &expected);
+  auto steady_allocs = count_allocs(&cold_workspace, &expected);
+  REQUIRE(cold_allocs > steady_allocs);
+
+  // A larger batch leaves the workspace large enough for the smaller ones.
+  model.Reserve(3, 8, &warm_workspace);
+  REQUIRE(count_allocs(&warm_workspace, &pooled) == steady_allocs);
+  REQUIRE(kernels::common::CheckResultOfCPU<float>(expected, pooled));
+  core::DisableMemoryTracking();
+
+  REQUIRE_THROWS(model.WarmUp({{0, 8}}));
+}
+
+}  // namespace layers
+}  // namespace turbo_transformers
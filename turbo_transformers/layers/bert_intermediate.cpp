@@ -17,6 +17,8 @@
 
 #include "turbo_transformers/core/blas.h"
 #include "turbo_transformers/core/memory.h"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/profiler.h"
 #include "turbo_transformers/layers/kernels/activation.h"
 #include "turbo_transformers/layers/kernels/layer_norm.h"
 #include "turbo_transformers/layers/kernels/mat_mul.h"
@@ -28,14 +30,91 @@ namespace layers {
 
 void BertIntermediate::operator()(const core::Tensor& input_tensor,
                                   core::Tensor* output_tensor) const {
-  output_tensor->Reshape<float>(
+  if (input_tensor.IsType<core::Half>()) {
+    Compute<core::Half>(input_tensor, output_tensor);
+  } else {
+    Compute<float>(input_tensor, output_tensor);
+  }
+}
+
+template <typename T>
+void BertIntermediate::Compute(const core::Tensor& input_tensor,
+                               core::Tensor* output_tensor) const {
+  core::ProfileScope profile_scope("BertIntermediate", input_tensor);
+  core::LayerTimer layer_timer("BertIntermediate");
+  output_tensor->Reshape<T>(
       {input_tensor.shape(0), input_tensor.shape(1), dense_weight_.shape(1)},
       input_tensor.device_type(), input_tensor.device_id());
 
-  kernels::MatMul(input_tensor, false, dense_weight_, false, 1.0, output_tensor,
-                  0.0);
-  kernels::AddBiasAct<float, kernels::ActivationType::Gelu>(dense_bias_,
-                                                            output_tensor);
+  if (!quantized_dense_weight_.is_null()) {
+    kernels::QuantizedMatMulBiasAct<kernels::ActivationType::Gelu>(
+        input_tensor, quantized_dense_weight_, dense_bias_, output_tensor);
+    return;
+  }
+  if (!bf16_dense_weight_.is_null()) {
+    kernels::BF16MatMulBiasAct<kernels::ActivationType::Gelu>(
+        input_tensor, bf16_dense_weight_, dense_bias_, output_tensor);
+    return;
+  }
+  // The compressed weight multiplies few rows only, more take the float one.
+  if (!compressed_dense_weight_.is_null() &&
+      kernels::IsWeightOnlyMatMulSupported(input_tensor.numel() /
+                                           dense_weight_.shape(0))) {
+    kernels::WeightOnlyMatMulBiasAct<kernels::ActivationType::Gelu>(
+        input_tensor, compressed_dense_weight_, dense_bias_, output_tensor);
+    return;
+  }
+  if (!sparse_dense_weight_.is_null()) {
+    kernels::BlockSparseMatMul(input_tensor, sparse_dense_weight_,
+                               output_tensor);
+    kernels::AddBiasAct<T, kernels::ActivationType::Gelu>(dense_bias_,
+                                                          output_tensor);
+    return;
+  }
+  kernels::MatMulAddBiasGelu<T>(input_tensor, dense_weight_,
+                                packed_dense_weight_, dense_bias_,
+                                output_tensor);
+}
+
+void BertIntermediate::Quantize() {
+  quantized_dense_weight_ = kernels::QuantizeWeight(dense_weight_);
+  packed_dense_weight_ = kernels::PackedWeight();
+  sparse_dense_weight_ = kernels::BlockSparseWeight();
+  bf16_dense_weight_ = kernels::BF16Weight();
+  compressed_dense_weight_ = kernels::WeightOnlyWeight();
+}
+
+void BertIntermediate::ConvertToBF16() {
+  bf16_dense_weight_ = kernels::ConvertWeightToBF16(dense_weight_);
+  quantized_dense_weight_ = kernels::QuantizedWeight();
+  packed_dense_weight_ = kernels::PackedWeight();
+  sparse_dense_weight_ = kernels::BlockSparseWeight();
+  compressed_dense_weight_ = kernels::WeightOnlyWeight();
+}
+
+void BertIntermediate::CompressWeights(kernels::WeightOnlyType type) {
+  if (kernels::IsWeightOnlyMatMulSupported(1)) {
+    compressed_dense_weight_ = kernels::CompressWeight(dense_weight_, type);
+  }
+  quantized_dense_weight_ = kernels::QuantizedWeight();
+  bf16_dense_weight_ = kernels::BF16Weight();
+  PackWeights();
+}
+
+void BertIntermediate::PackWeights() {
+  sparse_dense_weight_ = kernels::SparsifyWeight(dense_weight_);
+  packed_dense_weight_ = sparse_dense_weight_.is_null()
+                             ? kernels::PackLayerWeight(dense_weight_)
+                             : kernels::PackedWeight();
+}
+
+bool BertIntermediate::GetFusedWeights(
+    kernels::FusedBertLayerWeights* weights) const {
+  weights->intermediate_weight = &dense_weight_;
+  weights->intermediate_bias = &dense_bias_;
+  return quantized_dense_weight_.is_null() && bf16_dense_weight_.is_null() &&
+         compressed_dense_weight_.is_null() && sparse_dense_weight_.is_null() &&
+         dense_weight_.is_contiguous();
 }
 
 void BertIntermediate::EnforceShapeAndType() const {
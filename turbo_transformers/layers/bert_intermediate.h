@@ -15,6 +15,12 @@
 #include <memory>
 #include <utility>
 #include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/layers/kernels/bf16_mat_mul.h"
+#include "turbo_transformers/layers/kernels/fused_bert_layer.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+#include "turbo_transformers/layers/kernels/quantization.h"
+#include "turbo_transformers/layers/kernels/sparse_mat_mul.h"
+#include "turbo_transformers/layers/kernels/weight_only_mat_mul.h"
 
 namespace turbo_transformers {
 namespace layers {
@@ -25,14 +31,42 @@ class BertIntermediate {
       : dense_weight_(std::move(dense_weight)),
         dense_bias_(std::move(dense_bias)) {
     EnforceShapeAndType();
+    PackWeights();
   }
 
   void EnforceShapeAndType() const;
+  // Quantizes the dense weight to int8 on its device, afterwards the GEMM
+  // runs through the kernels of kernels/quantization.h. It must not be called
+  // while the layer is being used by other threads.
+  void Quantize();
+  // Rounds the dense weight of a float CPU layer to bfloat16, see
+  // BertAttention::ConvertToBF16.
+  void ConvertToBF16();
+  // Stores the dense weight of a float CPU layer as `type` too, see
+  // BertAttention::CompressWeights.
+  void CompressWeights(kernels::WeightOnlyType type);
+  // See BertAttention::GetFusedWeights.
+  bool GetFusedWeights(kernels::FusedBertLayerWeights* weights) const;
+
   void operator()(const core::Tensor& input_tensor, core::Tensor* output) const;
 
+  int64_t intermediate_size() const { return dense_weight_.shape(1); }
+
  private:
+  // T is float or core::Half, the data type of the input and the weights.
+  template <typename T>
+  void Compute(const core::Tensor& input_tensor, core::Tensor* output) const;
+  // See BertAttention::PackWeights.
+  void PackWeights();
+
   core::Tensor dense_weight_;
   core::Tensor dense_bias_;
+  kernels::PackedWeight packed_dense_weight_;
+  kernels::QuantizedWeight quantized_dense_weight_;
+  kernels::BF16Weight bf16_dense_weight_;
+  kernels::WeightOnlyWeight compressed_dense_weight_;
+  // Not null if the weight was pruned into enough zero blocks.
+  kernels::BlockSparseWeight sparse_dense_weight_;
 };
 
 }  // namespace layers
@@ -0,0 +1,129 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/bert_layer.h"
+
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/profiler.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+static constexpr const char* kAttentionOut = "BertLayer/attention_out";
+static constexpr const char* kIntermediateOut = "BertLayer/intermediate_out";
+static constexpr const char* kFusedScratch = "BertLayer/fused_scratch";
+
+bool RunFusedBertLayer(const BertAttention& attention,
+                       const BertIntermediate& intermediate,
+                       const BertOutput& output_layer,
+                       const core::Tensor& input_tensor,
+                       const core::Tensor& attention_mask,
+                       core::Tensor* output, core::Workspace* workspace) {
+  kernels::FusedBertLayerWeights weights;
+  if (!attention.GetFusedWeights(&weights) ||
+      !intermediate.GetFusedWeights(&weights) ||
+      !output_layer.GetFusedWeights(&weights)) {
+    return false;
+  }
+  auto size_per_head =
+      weights.qkv_weight->shape(1) / 3 / weights.num_attention_heads;
+  if (!kernels::IsFusedBertLayerSupported(input_tensor, size_per_head) ||
+      !input_tensor.is_contiguous()) {
+    return false;
+  }
+  if (workspace == nullptr) {
+    static thread_local core::Workspace thread_workspace;
+    workspace = &thread_workspace;
+  }
+  core::ProfileScope profile_scope("FusedBertLayer", input_tensor);
+  core::Tensor& scratch = workspace->GetTensor<float>(
+      kFusedScratch,
+      {kernels::FusedBertLayerScratchSize(input_tensor, weights)},
+      input_tensor.device_type(), input_tensor.device_id());
+  return kernels::FusedBertLayer(input_tensor, attention_mask, weights,
+                                 &scratch, output);
+}
+
+void BertLayer::operator()(const core::Tensor& input_tensor,
+                           const core::Tensor& attention_mask,
+                           core::Tensor* output,
+                           const core::Tensor* seq_offsets,
+                           core::Workspace* workspace) const {
+  if (workspace == nullptr) {
+    static thread_local core::Workspace thread_workspace;
+    workspace = &thread_workspace;
+  }
+  if (input_tensor.IsType<core::Half>()) {
+    Compute<core::Half>(input_tensor, attention_mask, output, seq_offsets,
+                        workspace);
+  } else {
+    Compute<float>(input_tensor, attention_mask, output, seq_offsets,
+                   workspace);
+  }
+}
+
+template <typename T>
+void BertLayer::Compute(const core::Tensor& input_tensor,
+                        const core::Tensor& attention_mask,
+                        core::Tensor* output, const core::Tensor* seq_offsets,
+                        core::Workspace* workspace) const {
+  core::ProfileScope profile_scope("BertLayer", input_tensor);
+  core::LayerTimer layer_timer("BertLayer");
+  auto batch_size = input_tensor.shape(0);
+  auto seq_length = input_tensor.shape(1);
+  auto hidden_size = input_tensor.shape(2);
+  auto device_type = input_tensor.device_type();
+  auto device_id = input_tensor.device_id();
+  if (seq_offsets == nullptr &&
+      RunFusedBertLayer(*attention_, *intermediate_, *output_, input_tensor,
+                        attention_mask, output, workspace)) {
+    return;
+  }
+
+  core::Tensor& attention_out = workspace->GetTensor<T>(
+      kAttentionOut, {batch_size, seq_length, hidden_size}, device_type,
+      device_id);
+  if (seq_offsets != nullptr) {
+    attention_->RunPacked(input_tensor, *seq_offsets, &attention_out,
+                          workspace);
+  } else {
+    (*attention_)(input_tensor, attention_mask, &attention_out, workspace);
+  }
+  core::Tensor& intermediate_out = workspace->GetTensor<T>(
+      kIntermediateOut,
+      {batch_size, seq_length, intermediate_->intermediate_size()},
+      device_type, device_id);
+  (*intermediate_)(attention_out, &intermediate_out);
+  (*output_)(intermediate_out, attention_out, output);
+}
+
+void BertLayer::Quantize() {
+  attention_->Quantize();
+  intermediate_->Quantize();
+  output_->Quantize();
+}
+
+void BertLayer::ConvertToBF16() {
+  attention_->ConvertToBF16();
+  intermediate_->ConvertToBF16();
+  output_->ConvertToBF16();
+}
+
+void BertLayer::CompressWeights(kernels::WeightOnlyType type) {
+  attention_->CompressWeights(type);
+  intermediate_->CompressWeights(type);
+  output_->CompressWeights(type);
+}
+
+}  // namespace layers
+}  // namespace turbo_transformers
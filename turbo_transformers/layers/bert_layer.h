@@ -0,0 +1,89 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <memory>
+#include <utility>
+
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/workspace.h"
+#include "turbo_transformers/layers/bert_attention.h"
+#include "turbo_transformers/layers/bert_intermediate.h"
+#include "turbo_transformers/layers/bert_output.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+// Runs `attention`, `intermediate` and `output_layer` on `input_tensor` as a
+// single kernels::FusedBertLayer and returns true if the fused layer takes
+// them, i.e. for a few float tokens on the GPU, see
+// kernels::IsFusedBertLayerSupported, and whole float weights, see
+// BertAttention::GetFusedWeights, and the GPU accepts the cooperative launch
+// outside of a stream capture.
+// Otherwise returns false and leaves the data of `output` alone. The scratch
+// memory is taken from `workspace`, or from a workspace of the calling thread
+// if it is null.
+bool RunFusedBertLayer(const BertAttention &attention,
+                       const BertIntermediate &intermediate,
+                       const BertOutput &output_layer,
+                       const core::Tensor &input_tensor,
+                       const core::Tensor &attention_mask,
+                       core::Tensor *output,
+                       core::Workspace *workspace = nullptr);
+
+// A BERT encoder layer, the attention followed by the intermediate and the
+// output layers, run by a single call. The sublayers are shared with whoever
+// built them, e.g. the Python layers, so quantizing one of them applies here
+// as well.
+class BertLayer {
+ public:
+  BertLayer(std::shared_ptr<BertAttention> attention,
+            std::shared_ptr<BertIntermediate> intermediate,
+            std::shared_ptr<BertOutput> output)
+      : attention_(std::move(attention)),
+        intermediate_(std::move(intermediate)),
+        output_(std::move(output)) {}
+
+  // The attention takes `attention_mask`, or the packed tokens between
+  // `seq_offsets` if it is given, see BertAttention::RunPacked. A few tokens
+  // with a mask run as a single kernel once it is enabled, see
+  // RunFusedBertLayer. The outputs
+  // of the attention and of the intermediate layer are taken from
+  // `workspace`, or from a workspace of the calling thread if it is null.
+  // `output` may be `input_tensor`.
+  void operator()(const core::Tensor &input_tensor,
+                  const core::Tensor &attention_mask, core::Tensor *output,
+                  const core::Tensor *seq_offsets = nullptr,
+                  core::Workspace *workspace = nullptr) const;
+
+  // See BertAttention::Quantize.
+  void Quantize();
+  // See BertAttention::ConvertToBF16.
+  void ConvertToBF16();
+  // See BertAttention::CompressWeights.
+  void CompressWeights(kernels::WeightOnlyType type);
+
+ private:
+  template <typename T>
+  void Compute(const core::Tensor &input_tensor,
+               const core::Tensor &attention_mask, core::Tensor *output,
+               const core::Tensor *seq_offsets,
+               core::Workspace *workspace) const;
+
+  std::shared_ptr<BertAttention> attention_;
+  std::shared_ptr<BertIntermediate> intermediate_;
+  std::shared_ptr<BertOutput> output_;
+};
+
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,43 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include "turbo_transformers/core/tensor.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+// The float weights of a BERT encoder layer, in the layouts of BertAttention,
+// BertIntermediate and BertOutput and named as kernels::FusedBertLayerWeights
+// names them, which graph::AddBertLayer and TensorParallelBertLayer take.
+struct BertLayerWeights {
+  // [hidden_size, 3 * all_head_size], [3 * all_head_size]
+  core::Tensor qkv_weight{nullptr};
+  core::Tensor qkv_bias{nullptr};
+  // [all_head_size, hidden_size], [hidden_size]
+  core::Tensor attention_dense_weight{nullptr};
+  core::Tensor attention_dense_bias{nullptr};
+  core::Tensor attention_layer_norm_weight{nullptr};
+  core::Tensor attention_layer_norm_bias{nullptr};
+  // [hidden_size, intermediate_size], [intermediate_size]
+  core::Tensor intermediate_weight{nullptr};
+  core::Tensor intermediate_bias{nullptr};
+  // [intermediate_size, hidden_size], [hidden_size]
+  core::Tensor output_dense_weight{nullptr};
+  core::Tensor output_dense_bias{nullptr};
+  core::Tensor output_layer_norm_weight{nullptr};
+  core::Tensor output_layer_norm_bias{nullptr};
+};
+
+}  // namespace layers
+}  // namespace turbo_transformers
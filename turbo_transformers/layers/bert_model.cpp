@@ -0,0 +1,166 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/bert_model.h"
+
+#include <algorithm>
+
+#include "turbo_transformers/core/enforce.h"
+#include "turbo_transformers/core/memory.h"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/profiler.h"
+#include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/prepare_bert_masks.h"
+#include "turbo_transformers/layers/sequence_pool.h"
+#ifdef TT_WITH_CUDA
+#include "turbo_transformers/core/cuda_device_context.h"
+#endif
+
+namespace turbo_transformers {
+namespace layers {
+
+// The positions and the token types of packed sequences, the positions
+// restarting at every sequence.
+static void PreparePackedIds(const core::Tensor& input_ids,
+                             const core::Tensor& seq_offsets,
+                             core::Tensor* token_type_ids,
+                             core::Tensor* position_ids) {
+  auto total_tokens = input_ids.shape(1);
+  auto device_type = input_ids.device_type();
+  auto device_id = input_ids.device_id();
+  if (position_ids->is_null()) {
+    auto* pos_ids = position_ids->Reshape<int64_t>({1, total_tokens},
+                                                   device_type, device_id);
+    auto* offsets = seq_offsets.data<int64_t>();
+    for (int64_t b = 0; b + 1 < seq_offsets.numel(); ++b) {
+      kernels::common::Sequence(pos_ids + offsets[b],
+                                offsets[b + 1] - offsets[b], device_type,
+                                device_id);
+    }
+  }
+  if (token_type_ids->is_null()) {
+    token_type_ids->Reshape<int64_t>({1, total_tokens}, device_type,
+                                     device_id);
+    kernels::common::Fill(token_type_ids->mutableData<int64_t>(),
+                          token_type_ids->numel(), static_cast<int64_t>(0),
+                          device_type, device_id);
+  }
+}
+
+void BertModel::operator()(const core::Tensor& input_ids,
+                           core::Tensor* attention_mask,
+                           core::Tensor* token_type_ids,
+                           core::Tensor* position_ids,
+                           types::PoolType pooling, core::Tensor* hidden,
+                           core::Tensor* output,
+                           const core::Tensor* seq_offsets,
+                           core::Workspace* workspace) const {
+  core::ProfileScope profile_scope("BertModel", input_ids);
+  core::LayerTimer layer_timer("BertModel");
+  SequencePool pool(pooling);
+  if (seq_offsets != nullptr) {
+    TT_ENFORCE_EQ(input_ids.shape(0), 1,
+                  "The packed input ids should be [1, total_tokens]");
+    TT_ENFORCE_EQ(seq_offsets->data<int64_t>()[seq_offsets->numel() - 1],
+                  input_ids.shape(1),
+                  "The last of the seq_offsets should be the token count");
+    core::RecordBatch(seq_offsets->numel() - 1, input_ids.numel(), 0);
+    PreparePackedIds(input_ids, *seq_offsets, token_type_ids, position_ids);
+    (*embedding_)(input_ids, *position_ids, *token_type_ids, hidden);
+    (*encoder_)(*hidden, core::Tensor(nullptr), hidden, seq_offsets,
+                workspace);
+    pool.RunPacked(*hidden, *seq_offsets, output);
+    return;
+  }
+
+  // The padding is only known on the host, a mask on the GPU counts none.
+  int64_t padded_tokens = 0;
+  if (!attention_mask->is_null() && attention_mask->device_type() == kDLCPU) {
+    auto* mask = attention_mask->data<int64_t>();
+    padded_tokens = std::count(mask, mask + attention_mask->numel(), 0);
+  }
+  core::RecordBatch(input_ids.shape(0), input_ids.numel(), padded_tokens);
+  core::Tensor extended_attention_mask(nullptr);
+  PrepareBertMasks()(input_ids, attention_mask, token_type_ids, position_ids,
+                     &extended_attention_mask);
+  (*embedding_)(input_ids, *position_ids, *token_type_ids, hidden);
+  (*encoder_)(*hidden, extended_attention_mask, hidden, nullptr, workspace);
+  pool(*hidden, output);
+}
+
+void BertModel::RunPacked(const std::vector<int64_t>& input_ids,
+                          const std::vector<int64_t>& seq_offsets,
+                          types::PoolType pooling, core::Tensor* hidden,
+                          core::Tensor* output,
+                          core::Workspace* workspace) const {
+  TT_ENFORCE(seq_offsets.size() >= 2 && seq_offsets.front() == 0 &&
+                 seq_offsets.back() ==
+                     static_cast<int64_t>(input_ids.size()),
+             "The seq_offsets should go from 0 to the number of ids");
+  for (size_t b = 1; b < seq_offsets.size(); ++b) {
+    TT_ENFORCE_GT(seq_offsets[b], seq_offsets[b - 1],
+                  "The sequence %d is empty", b - 1);
+  }
+  auto device_type = embedding_->device_type();
+  auto device_id = embedding_->device_id();
+  core::Tensor ids(nullptr);
+  ids.Reshape<int64_t>({1, static_cast<int64_t>(input_ids.size())},
+                       device_type, device_id);
+  core::Memcpy(ids.mutableData<int64_t>(), input_ids.data(),
+               input_ids.size() * sizeof(int64_t),
+               core::ToMemcpyFlag(device_type, kDLCPU));
+  core::Tensor offsets(nullptr);
+  offsets.Reshape<int64_t>({static_cast<int64_t>(seq_offsets.size())},
+                           kDLCPU, 0);
+  std::copy(seq_offsets.begin(), seq_offsets.end(),
+            offsets.mutableData<int64_t>());
+  core::Tensor attention_mask(nullptr), token_type_ids(nullptr),
+      position_ids(nullptr);
+  (*this)(ids, &attention_mask, &token_type_ids, &position_ids, pooling,
+          hidden, output, &offsets, workspace);
+}
+
+void BertModel::WarmUp(const std::vector<std::pair<int64_t, int64_t>>& shapes,
+                       types::PoolType pooling,
+                       core::Workspace* workspace) const {
+  auto sorted_shapes = shapes;
+  std::sort(sorted_shapes.begin(), sorted_shapes.end(),
+            [](const std::pair<int64_t, int64_t>& a,
+               const std::pair<int64_t, int64_t>& b) {
+              return a.first * a.second > b.first * b.second;
+            });
+  auto device_type = embedding_->device_type();
+  auto device_id = embedding_->device_id();
+  for (auto& shape : sorted_shapes) {
+    TT_ENFORCE(shape.first > 0 && shape.second > 0,
+               "The warm up shape [%d, %d] is empty", shape.first,
+               shape.second);
+    core::Tensor input_ids(nullptr);
+    input_ids.Reshape<int64_t>({shape.first, shape.second}, device_type,
+                               device_id);
+    kernels::common::Fill(input_ids.mutableData<int64_t>(), input_ids.numel(),
+                          static_cast<int64_t>(0), device_type, device_id);
+    core::Tensor attention_mask(nullptr), token_type_ids(nullptr),
+        position_ids(nullptr), hidden(nullptr), output(nullptr);
+    (*this)(input_ids, &attention_mask, &token_type_ids, &position_ids,
+            pooling, &hidden, &output, nullptr, workspace);
+  }
+#ifdef TT_WITH_CUDA
+  if (device_type == kDLGPU) {
+    core::CUDADeviceContext::GetInstance(device_id).Wait();
+  }
+#endif
+}
+
+}  // namespace layers
+}  // namespace turbo_transformers
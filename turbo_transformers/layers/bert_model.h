@@ -0,0 +1,93 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/workspace.h"
+#include "turbo_transformers/layers/bert_embedding.h"
+#include "turbo_transformers/layers/bert_encoder.h"
+#include "turbo_transformers/layers/types.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+// The embedding, the encoder and the sequence pooling of a BERT model, so
+// that a forward pass is a single call.
+class BertModel {
+ public:
+  BertModel(std::shared_ptr<BERTEmbedding> embedding,
+            std::shared_ptr<BertEncoder> encoder)
+      : embedding_(std::move(embedding)), encoder_(std::move(encoder)) {}
+
+  // Writes the last hidden states [batch_size, seq_length, hidden_size] to
+  // `hidden` and their pooling to `output`. The null `attention_mask`,
+  // `token_type_ids` and `position_ids` are filled with their defaults, see
+  // PrepareBertMasks. If `seq_offsets` is given, `input_ids` [1,
+  // total_tokens] holds the packed sequences between the offsets, see
+  // BertAttention::RunPacked, the mask is unused and the default positions
+  // restart at every sequence.
+  void operator()(const core::Tensor &input_ids, core::Tensor *attention_mask,
+                  core::Tensor *token_type_ids, core::Tensor *position_ids,
+                  types::PoolType pooling, core::Tensor *hidden,
+                  core::Tensor *output,
+                  const core::Tensor *seq_offsets = nullptr,
+                  core::Workspace *workspace = nullptr) const;
+
+  // Runs the sequences held back to back in `input_ids`, the host ids of a
+  // ragged batch, between the prefix sums of their lengths `seq_offsets`
+  // [batch_size + 1]. The ids are uploaded to the device of the model as
+  // they are, and the sequences run packed, as by operator() with
+  // `seq_offsets`, so no padded batch is ever built.
+  void RunPacked(const std::vector<int64_t> &input_ids,
+                 const std::vector<int64_t> &seq_offsets,
+                 types::PoolType pooling, core::Tensor *hidden,
+                 core::Tensor *output,
+                 core::Workspace *workspace = nullptr) const;
+
+  // Runs the model once on dummy inputs of every [batch_size, seq_len] of
+  // `shapes`, the largest first, so that the first requests of these shapes
+  // run at their steady latency: the tensors of `workspace`, or of the
+  // thread-local workspaces of the calling thread if it is null, grow to
+  // their largest size at once, the GEMMs of every shape are tuned, see
+  // GPUGemm, and the BLAS handles and the kernels are loaded. The runs count
+  // in the metrics as any batch.
+  void WarmUp(const std::vector<std::pair<int64_t, int64_t>> &shapes,
+              types::PoolType pooling = types::PoolType::kFirst,
+              core::Workspace *workspace = nullptr) const;
+
+  // Warms up the largest shape only, which leaves the workspace large enough
+  // for any batch within [max_batch_size, max_seq_len], though the GEMMs of
+  // the smaller shapes are tuned by their first requests.
+  void Reserve(int64_t max_batch_size, int64_t max_seq_len,
+               core::Workspace *workspace = nullptr) const {
+    WarmUp({{max_batch_size, max_seq_len}}, types::PoolType::kFirst,
+           workspace);
+  }
+
+  void Quantize() { encoder_->Quantize(); }
+  void ConvertToBF16() { encoder_->ConvertToBF16(); }
+  void CompressWeights(kernels::WeightOnlyType type) {
+    encoder_->CompressWeights(type);
+  }
+
+ private:
+  std::shared_ptr<BERTEmbedding> embedding_;
+  std::shared_ptr<BertEncoder> encoder_;
+};
+
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -16,6 +16,8 @@
 #include <loguru.hpp>
 
 #include "turbo_transformers/core/memory.h"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/profiler.h"
 #include "turbo_transformers/layers/kernels/common.h"
 #include "turbo_transformers/layers/kernels/layer_norm.h"
 #include "turbo_transformers/layers/kernels/mat_mul.h"
@@ -31,14 +33,97 @@ void BertOutput::operator()(const core::Tensor &hidden_states,
                 true,
                 "BertOutput: The input_tensor and hidden_states should have "
                 "the same device type and device id.");
-  output_tensor->Reshape<float>(
+  if (hidden_states.IsType<core::Half>()) {
+    Compute<core::Half>(hidden_states, input_tensor, output_tensor);
+  } else {
+    Compute<float>(hidden_states, input_tensor, output_tensor);
+  }
+}
+
+template <typename T>
+void BertOutput::Compute(const core::Tensor &hidden_states,
+                         const core::Tensor &input_tensor,
+                         core::Tensor *output_tensor) const {
+  core::ProfileScope profile_scope("BertOutput", hidden_states);
+  core::LayerTimer layer_timer("BertOutput");
+  output_tensor->Reshape<T>(
       {hidden_states.shape(0), hidden_states.shape(1), dense_weight_.shape(1)},
       hidden_states.device_type(), hidden_states.device_id());
-  kernels::MatMul(hidden_states, false, dense_weight_, false, 1.0,
-                  output_tensor, 0.0);
-  kernels::AddBiasLayerNorm<float>(input_tensor, dense_bias_,
-                                   layer_norm_weight_, layer_norm_bias_,
-                                   output_tensor);
+  if (!quantized_dense_weight_.is_null()) {
+    kernels::QuantizedMatMulAddBiasLayerNorm(
+        hidden_states, quantized_dense_weight_, input_tensor, dense_bias_,
+        layer_norm_weight_, layer_norm_bias_, output_tensor);
+    return;
+  }
+  if (!bf16_dense_weight_.is_null()) {
+    kernels::BF16MatMulAddBiasLayerNorm(
+        hidden_states, bf16_dense_weight_, input_tensor, dense_bias_,
+        layer_norm_weight_, layer_norm_bias_, output_tensor);
+    return;
+  }
+  // The compressed weight multiplies few rows only, more take the float one.
+  if (!compressed_dense_weight_.is_null() &&
+      kernels::IsWeightOnlyMatMulSupported(hidden_states.numel() /
+                                           dense_weight_.shape(0))) {
+    kernels::WeightOnlyMatMulAddBiasLayerNorm(
+        hidden_states, compressed_dense_weight_, input_tensor, dense_bias_,
+        layer_norm_weight_, layer_norm_bias_, output_tensor);
+    return;
+  }
+  if (!sparse_dense_weight_.is_null()) {
+    kernels::BlockSparseMatMul(hidden_states, sparse_dense_weight_,
+                               output_tensor);
+    kernels::AddBiasLayerNorm<T>(input_tensor, dense_bias_, layer_norm_weight_,
+                                 layer_norm_bias_, output_tensor);
+    return;
+  }
+  kernels::MatMulAddBiasLayerNorm<T>(hidden_states, dense_weight_,
+                                     packed_dense_weight_, input_tensor,
+                                     dense_bias_, layer_norm_weight_,
+                                     layer_norm_bias_, output_tensor);
+}
+
+void BertOutput::Quantize() {
+  quantized_dense_weight_ = kernels::QuantizeWeight(dense_weight_);
+  packed_dense_weight_ = kernels::PackedWeight();
+  sparse_dense_weight_ = kernels::BlockSparseWeight();
+  bf16_dense_weight_ = kernels::BF16Weight();
+  compressed_dense_weight_ = kernels::WeightOnlyWeight();
+}
+
+void BertOutput::ConvertToBF16() {
+  bf16_dense_weight_ = kernels::ConvertWeightToBF16(dense_weight_);
+  quantized_dense_weight_ = kernels::QuantizedWeight();
+  packed_dense_weight_ = kernels::PackedWeight();
+  sparse_dense_weight_ = kernels::BlockSparseWeight();
+  compressed_dense_weight_ = kernels::WeightOnlyWeight();
+}
+
+void BertOutput::CompressWeights(kernels::WeightOnlyType type) {
+  if (kernels::IsWeightOnlyMatMulSupported(1)) {
+    compressed_dense_weight_ = kernels::CompressWeight(dense_weight_, type);
+  }
+  quantized_dense_weight_ = kernels::QuantizedWeight();
+  bf16_dense_weight_ = kernels::BF16Weight();
+  PackWeights();
+}
+
+void BertOutput::PackWeights() {
+  sparse_dense_weight_ = kernels::SparsifyWeight(dense_weight_);
+  packed_dense_weight_ = sparse_dense_weight_.is_null()
+                             ? kernels::PackLayerWeight(dense_weight_)
+                             : kernels::PackedWeight();
+}
+
+bool BertOutput::GetFusedWeights(
+    kernels::FusedBertLayerWeights *weights) const {
+  weights->output_dense_weight = &dense_weight_;
+  weights->output_dense_bias = &dense_bias_;
+  weights->output_layer_norm_weight = &layer_norm_weight_;
+  weights->output_layer_norm_bias = &layer_norm_bias_;
+  return quantized_dense_weight_.is_null() && bf16_dense_weight_.is_null() &&
+         compressed_dense_weight_.is_null() && sparse_dense_weight_.is_null() &&
+         dense_weight_.is_contiguous();
 }
 
 void BertOutput::EnforceShapeAndType() const {
@@ -16,6 +16,8 @@
 #include <loguru.hpp>
 
 #include "turbo_transformers/core/memory.h"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/profiler.h"
 #include "turbo_transformers/layers/kernels/activation.h"
 #include "turbo_transformers/layers/kernels/mat_mul.h"
 
@@ -26,14 +28,30 @@ void BertPooler::operator()(const core::Tensor& input_tensor,
                             core::Tensor* output_tensor) const {
   TT_ENFORCE_EQ(input_tensor.n_dim(), 2, "input's dim should be 2, not %d",
                 input_tensor.n_dim());
-  output_tensor->Reshape<float>({input_tensor.shape(0), dense_weight_.shape(0)},
-                                input_tensor.device_type(),
-                                input_tensor.device_id());
-
-  kernels::MatMul(input_tensor, false, dense_weight_, false, 1.0, output_tensor,
-                  0.0);
-  kernels::AddBiasAct<float, kernels::ActivationType::Tanh>(dense_bias_,
-                                                            output_tensor);
+  if (input_tensor.IsType<core::Half>()) {
+    Compute<core::Half>(input_tensor, output_tensor);
+  } else {
+    Compute<float>(input_tensor, output_tensor);
+  }
+}
+
+template <typename T>
+void BertPooler::Compute(const core::Tensor& input_tensor,
+                         core::Tensor* output_tensor) const {
+  core::ProfileScope profile_scope("BertPooler", input_tensor);
+  core::LayerTimer layer_timer("BertPooler");
+  output_tensor->Reshape<T>({input_tensor.shape(0), dense_weight_.shape(0)},
+                            input_tensor.device_type(),
+                            input_tensor.device_id());
+
+  if (!packed_dense_weight_.is_null()) {
+    kernels::MatMul(input_tensor, packed_dense_weight_, *output_tensor, 0.0);
+  } else {
+    kernels::MatMul(input_tensor, false, dense_weight_, false, 1.0,
+                    *output_tensor, 0.0);
+  }
+  kernels::AddBiasAct<T, kernels::ActivationType::Tanh>(dense_bias_,
+                                                        output_tensor);
 }
 
 void BertPooler::EnforceShapeAndType() const {
@@ -15,6 +15,7 @@
 #include <memory>
 #include <utility>
 #include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
 
 namespace turbo_transformers {
 namespace layers {
@@ -25,14 +26,20 @@ class BertPooler {
       : dense_weight_(std::move(dense_weight)),
         dense_bias_(std::move(dense_bias)) {
     EnforceShapeAndType();
+    packed_dense_weight_ = kernels::PackLayerWeight(dense_weight_);
   }
 
   void EnforceShapeAndType() const;
   void operator()(const core::Tensor& input_tensor, core::Tensor* output) const;
 
  private:
+  // T is float or core::Half, the data type of the input and the weights.
+  template <typename T>
+  void Compute(const core::Tensor& input_tensor, core::Tensor* output) const;
+
   core::Tensor dense_weight_;
   core::Tensor dense_bias_;
+  kernels::PackedWeight packed_dense_weight_;
 };
 
 }  // namespace layers
@@ -0,0 +1,211 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/gpt2_attention.h"
+
+#include <cmath>
+
+#include "loguru.hpp"
+#include "turbo_transformers/core/memory.h"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/profiler.h"
+#include "turbo_transformers/core/tensor_copy.h"
+#include "turbo_transformers/layers/kernels/activation.h"
+#include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/kernels/layer_norm.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+#include "turbo_transformers/layers/kernels/softmax.h"
+#include "turbo_transformers/layers/kernels/transpose.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+static constexpr const char* kLayerNormOut = "GPT2Attention/layer_norm_out";
+static constexpr const char* kQKV = "GPT2Attention/qkv";
+static constexpr const char* kAttScore = "GPT2Attention/att_score";
+static constexpr const char* kAttMask = "GPT2Attention/att_mask";
+static constexpr const char* kSelfAttrOut = "GPT2Attention/self_attr_out";
+
+void GPT2Attention::InitCache(int64_t batch_size, int64_t max_seq_len,
+                              KVCache* cache) const {
+  auto size_per_head = qkv_weight_.shape(1) / 3 / num_attention_heads_;
+  for (auto* tensor : {&cache->key, &cache->value}) {
+    if (qkv_weight_.IsType<core::Half>()) {
+      tensor->Reshape<core::Half>(
+          {batch_size, num_attention_heads_, max_seq_len, size_per_head},
+          qkv_weight_.device_type(), qkv_weight_.device_id());
+    } else {
+      tensor->Reshape<float>(
+          {batch_size, num_attention_heads_, max_seq_len, size_per_head},
+          qkv_weight_.device_type(), qkv_weight_.device_id());
+    }
+  }
+  cache->seq_len = 0;
+}
+
+void GPT2Attention::operator()(const core::Tensor& input_tensor,
+                               KVCache* cache, core::Tensor* output,
+                               core::Workspace* workspace) const {
+  core::ProfileScope profile_scope("GPT2Attention", input_tensor);
+  core::LayerTimer layer_timer("GPT2Attention");
+  if (workspace == nullptr) {
+    static thread_local core::Workspace thread_workspace;
+    workspace = &thread_workspace;
+  }
+  TT_ENFORCE_EQ(input_tensor.n_dim(), 3,
+                "The input should be a tensor with shape [BatchSize, SeqLen, "
+                "HiddenSize].");
+  TT_ENFORCE(!cache->key.is_null() &&
+                 cache->key.shape(0) == input_tensor.shape(0),
+             "The cache should be initialized for the batch of %d sequences, "
+             "see InitCache.",
+             input_tensor.shape(0));
+  TT_ENFORCE_LE(cache->seq_len + input_tensor.shape(1), cache->key.shape(2),
+                "The %d cached and %d new tokens exceed the cache of %d.",
+                cache->seq_len, input_tensor.shape(1), cache->key.shape(2));
+  if (input_tensor.IsType<core::Half>()) {
+    Compute<core::Half>(input_tensor, cache, output, workspace);
+  } else {
+    Compute<float>(input_tensor, cache, output, workspace);
+  }
+}
+
+template <typename T>
+void GPT2Attention::Compute(const core::Tensor& input_tensor, KVCache* cache,
+                            core::Tensor* output,
+                            core::Workspace* workspace) const {
+  auto batch_size = input_tensor.shape(0);
+  auto seq_length = input_tensor.shape(1);
+  auto hidden_size = input_tensor.shape(2);
+  auto all_head_size = qkv_weight_.shape(1) / 3;
+  auto size_per_head = all_head_size / num_attention_heads_;
+  auto past_length = cache->seq_len;
+  auto total_length = past_length + seq_length;
+  auto max_seq_length = cache->key.shape(2);
+  auto device_type = input_tensor.device_type();
+  auto device_id = input_tensor.device_id();
+
+  // 1. layer_norm_out = LayerNorm(input)
+  core::Tensor& layer_norm_out = workspace->GetTensor<T>(
+      kLayerNormOut, {batch_size, seq_length, hidden_size}, device_type,
+      device_id);
+  core::CopyAsync<T>(input_tensor, layer_norm_out);
+  kernels::LayerNorm<T>(layer_norm_weight_, layer_norm_bias_, &layer_norm_out,
+                        layer_norm_epsilon_);
+
+  // 2. qkv = transpose(MatMul(layer_norm_out) + bias)
+  core::Tensor& qkv = workspace->GetTensor<T>(
+      kQKV, {3, batch_size, num_attention_heads_, seq_length, size_per_head},
+      device_type, device_id);
+  kernels::MatMulSplitAddBiasTransposeForScore(
+      qkv, layer_norm_out, qkv_weight_, packed_qkv_weight_, qkv_bias_);
+  core::TensorView qkv_view(qkv);
+  auto q = qkv_view[0];
+
+  // 3. Append the new keys and values to the rows of their heads in the
+  // cache, a single copy each.
+  auto flag = core::ToMemcpyFlag(device_type, device_type);
+  size_t row_bytes = seq_length * size_per_head * sizeof(T);
+  int idx = 1;
+  for (auto* cached : {&cache->key, &cache->value}) {
+    core::Memcpy2DAsync(cached->template mutableData<T>() +
+                            past_length * size_per_head,
+                        max_seq_length * size_per_head * sizeof(T),
+                        qkv_view[idx++].template data<T>(), row_bytes,
+                        row_bytes, batch_size * num_attention_heads_, flag,
+                        device_id);
+  }
+  auto cached_heads = [&](const core::Tensor& cached) {
+    return core::TensorView(cached).AsStrided(
+        {batch_size, num_attention_heads_, total_length, size_per_head},
+        {num_attention_heads_ * max_seq_length * size_per_head,
+         max_seq_length * size_per_head, size_per_head, 1});
+  };
+
+  // 4. att_score = softmax(q * k^T / sqrt(size_per_head)), where the new
+  // tokens do not attend to the ones after them.
+  core::Tensor& att_score = workspace->GetTensor<T>(
+      kAttScore, {batch_size, num_attention_heads_, seq_length, total_length},
+      device_type, device_id);
+  kernels::BatchMatMul(q, false, cached_heads(cache->key), true, 1.0,
+                       att_score, 0.0);
+  core::Tensor& att_mask = workspace->GetTensor<float>(
+      kAttMask, {batch_size, 1, 1, total_length}, device_type, device_id);
+  kernels::common::Fill<float>(att_mask.mutableData<float>(),
+                               att_mask.numel(), 0.f, device_type, device_id);
+  float scale = 1 / std::sqrt(static_cast<float>(size_per_head));
+  kernels::ApplyMaskAndSoftmax(att_score, att_mask, scale, true);
+
+  // 5. self_attr_out = transpose(att_score * v), the context is written into
+  // the merged heads directly.
+  core::Tensor& self_attr_out = workspace->GetTensor<T>(
+      kSelfAttrOut, {batch_size, seq_length, all_head_size}, device_type,
+      device_id);
+  auto context = core::TensorView(self_attr_out)
+                     .AsStrided({batch_size, num_attention_heads_, seq_length,
+                                 size_per_head},
+                                {seq_length * all_head_size, size_per_head,
+                                 all_head_size, 1});
+  kernels::BatchMatMul(att_score, false, cached_heads(cache->value), false,
+                       1.0, context, 0.0);
+
+  // 6. output = input + MatMul(self_attr_out) + bias
+  if (output != &input_tensor) {
+    output->Reshape<T>({batch_size, seq_length, hidden_size}, device_type,
+                       device_id);
+    core::CopyAsync<T>(input_tensor, *output);
+  }
+  if (packed_dense_weight_.is_null()) {
+    kernels::MatMul(self_attr_out, false, dense_weight_, false, 1.0, *output,
+                    1.0);
+  } else {
+    kernels::MatMul(self_attr_out, packed_dense_weight_, *output, 1.0);
+  }
+  kernels::AddBiasAct<T, kernels::ActivationType::Identity>(dense_bias_,
+                                                            output);
+  cache->seq_len = total_length;
+}
+
+void GPT2Attention::EnforceShapeAndType() const {
+  TT_ENFORCE_GT(num_attention_heads_, 0, "The attention needs a head.");
+  TT_ENFORCE_EQ(qkv_weight_.n_dim(), 2, "qkv weight must be matrix");
+  TT_ENFORCE_EQ(qkv_weight_.shape(1) % (3 * num_attention_heads_), 0,
+                "The qkv weight of %d columns can not be split into 3 x %d "
+                "heads",
+                qkv_weight_.shape(1), num_attention_heads_);
+  TT_ENFORCE_EQ(dense_weight_.shape(0), qkv_weight_.shape(1) / 3,
+                "The dense weight must take the %d columns of the heads",
+                qkv_weight_.shape(1) / 3);
+  TT_ENFORCE_EQ(dense_weight_.shape(1), qkv_weight_.shape(0),
+                "The dense weight must write the %d features of the input",
+                qkv_weight_.shape(0));
+  if (loguru::current_verbosity_cutoff() >= 3) {
+    std::ostringstream os;
+    os << ">>>>>>>>>>>> layer_norm_weights <<<<<<<<<<<<" << std::endl;
+    layer_norm_weight_.Print<float>(os);
+    os << ">>>>>>>>>>>> layer_norm_bias <<<<<<<<<<<<" << std::endl;
+    layer_norm_bias_.Print<float>(os);
+    os << ">>>>>>>>>>>> qkv_weight_ <<<<<<<<<<<<" << std::endl;
+    qkv_weight_.Print<float>(os);
+    os << ">>>>>>>>>>>> qkv_bias_ <<<<<<<<<<<<" << std::endl;
+    qkv_bias_.Print<float>(os);
+    os << ">>>>>>>>>>>> dense_weight_ <<<<<<<<<<<<" << std::endl;
+    dense_weight_.Print<float>(os);
+    os << ">>>>>>>>>>>> dense_bias_ <<<<<<<<<<<<" << std::endl;
+    dense_bias_.Print<float>(os);
+    LOG_S(3) << os.str();
+  }
+}
+
+}  // namespace layers
+}  // namespace turbo_transformers
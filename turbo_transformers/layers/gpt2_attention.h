@@ -0,0 +1,103 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <memory>
+#include <utility>
+
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/workspace.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+// The layer_norm_epsilon of the GPT-2 checkpoints.
+constexpr float kGPT2LayerNormEpsilon = 1e-5f;
+
+// The keys and values of the tokens a GPT2Attention has seen, so that the
+// following steps of a generation attend to them instead of recomputing the
+// whole prefix. A cache belongs to one batch of sequences, which all have
+// the same number of tokens, and must not be used by two calls at once.
+struct KVCache {
+  KVCache() : key(nullptr), value(nullptr) {}
+  // [batch_size, head_num, max_seq_len, size_per_head], see
+  // GPT2Attention::InitCache.
+  core::Tensor key;
+  core::Tensor value;
+  // The tokens cached so far.
+  int64_t seq_len{0};
+};
+
+// The causal self-attention of a GPT-2 block, including the layer norm in
+// front of it and the residual after it:
+//   output = input + dense(attention(layer_norm(input)))
+class GPT2Attention {
+ public:
+  // The weights are [in_features, out_features] as the Conv1D of GPT-2, i.e.
+  // the qkv weight is [hidden_size, 3 * hidden_size] and the dense weight
+  // [hidden_size, hidden_size]. `layer_norm_epsilon` is the one of the GPT-2
+  // config.
+  GPT2Attention(core::Tensor layer_norm_weight, core::Tensor layer_norm_bias,
+                core::Tensor qkv_weight, core::Tensor qkv_bias,
+                core::Tensor dense_weight, core::Tensor dense_bias,
+                int64_t num_attention_heads,
+                float layer_norm_epsilon = kGPT2LayerNormEpsilon)
+      : layer_norm_weight_(std::move(layer_norm_weight)),
+        layer_norm_bias_(std::move(layer_norm_bias)),
+        qkv_weight_(std::move(qkv_weight)),
+        qkv_bias_(std::move(qkv_bias)),
+        dense_weight_(std::move(dense_weight)),
+        dense_bias_(std::move(dense_bias)),
+        num_attention_heads_(num_attention_heads),
+        layer_norm_epsilon_(layer_norm_epsilon) {
+    EnforceShapeAndType();
+    packed_qkv_weight_ = kernels::PackLayerWeight(qkv_weight_);
+    packed_dense_weight_ = kernels::PackLayerWeight(dense_weight_);
+  }
+  void EnforceShapeAndType() const;
+
+  // Allocate `cache` for `batch_size` sequences of up to `max_seq_len`
+  // tokens on the device of the weights, and empty it.
+  void InitCache(int64_t batch_size, int64_t max_seq_len,
+                 KVCache *cache) const;
+
+  // `input_tensor` [batch_size, seq_len, hidden_size] are the next tokens of
+  // the sequences in `cache`, e.g. the whole prompt, then one token per
+  // generation step. Their keys and values are appended to the cache, and
+  // every token attends to the cached ones and to the new ones up to its
+  // own position. `output` may be `input_tensor`.
+  void operator()(const core::Tensor &input_tensor, KVCache *cache,
+                  core::Tensor *output,
+                  core::Workspace *workspace = nullptr) const;
+
+ private:
+  // T is float or core::Half, the data type of the input and the weights.
+  template <typename T>
+  void Compute(const core::Tensor &input_tensor, KVCache *cache,
+               core::Tensor *output, core::Workspace *workspace) const;
+
+  core::Tensor layer_norm_weight_;
+  core::Tensor layer_norm_bias_;
+  core::Tensor qkv_weight_;
+  core::Tensor qkv_bias_;
+  core::Tensor dense_weight_;
+  core::Tensor dense_bias_;
+  int64_t num_attention_heads_;
+  float layer_norm_epsilon_;
+  kernels::PackedWeight packed_qkv_weight_;
+  kernels::PackedWeight packed_dense_weight_;
+};
+
+}  // namespace layers
+}  // namespace turbo_transformers
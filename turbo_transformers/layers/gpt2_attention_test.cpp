@@ -0,0 +1,219 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+#include "turbo_transformers/layers/gpt2_attention.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/layers/gpt2_block.h"
+#include "turbo_transformers/layers/kernels/common.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+using kernels::common::CreateTensorAndFillRandom;
+
+static GPT2Attention CreateGPT2Attention(int64_t hidden_size,
+                                         int64_t num_heads) {
+  return GPT2Attention(
+      CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({hidden_size, 3 * hidden_size}, kDLCPU,
+                                       0),
+      CreateTensorAndFillRandom<float>({3 * hidden_size}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({hidden_size, hidden_size}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0), num_heads);
+}
+
+// The rows [begin, end) of every sequence of `tensor` [batch, seq, hidden].
+static core::Tensor SliceTokens(const core::Tensor &tensor, int64_t begin,
+                                int64_t end) {
+  auto batch_size = tensor.shape(0), seq_length = tensor.shape(1),
+       hidden_size = tensor.shape(2);
+  core::Tensor result(nullptr);
+  auto *data = result.Reshape<float>({batch_size, end - begin, hidden_size},
+                                     kDLCPU, 0);
+  for (int64_t b = 0; b < batch_size; ++b) {
+    std::copy(tensor.data<float>() + (b * seq_length + begin) * hidden_size,
+              tensor.data<float>() + (b * seq_length + end) * hidden_size,
+              data + b * (end - begin) * hidden_size);
+  }
+  return result;
+}
+
+// Whether the rows [begin, end) of `expected` equal `actual`.
+static bool CheckTokens(const core::Tensor &expected, int64_t begin,
+                        int64_t end, const core::Tensor &actual) {
+  return kernels::common::CheckResultOfCPU<float>(
+      SliceTokens(expected, begin, end), actual);
+}
+
+TEST_CASE("gpt2_attention-reference", "[gpt2_attention]") {
+  const int64_t batch_size = 2, seq_length = 5, hidden_size = 16,
+                num_heads = 2, size_per_head = hidden_size / num_heads;
+  auto ln_weight = CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+  auto ln_bias = CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+  auto qkv_weight = CreateTensorAndFillRandom<float>(
+      {hidden_size, 3 * hidden_size}, kDLCPU, 0);
+  auto qkv_bias =
+      CreateTensorAndFillRandom<float>({3 * hidden_size}, kDLCPU, 0);
+  auto dense_weight =
+      CreateTensorAndFillRandom<float>({hidden_size, hidden_size}, kDLCPU, 0);
+  auto dense_bias =
+      CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+  auto input = CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+
+  // input + dense(causal_attention(layer_norm(input))) computed naively.
+  std::vector<float> expected(input.numel());
+  for (int64_t b = 0; b < batch_size; ++b) {
+    std::vector<float> qkv(seq_length * 3 * hidden_size);
+    for (int64_t s = 0; s < seq_length; ++s) {
+      const float *x = input.data<float>() + (b * seq_length + s) * hidden_size;
+      float mean = 0, var = 0;
+      for (int64_t i = 0; i < hidden_size; ++i) {
+        mean += x[i] / hidden_size;
+      }
+      for (int64_t i = 0; i < hidden_size; ++i) {
+        var += (x[i] - mean) * (x[i] - mean) / hidden_size;
+      }
+      for (int64_t j = 0; j < 3 * hidden_size; ++j) {
+        float sum = qkv_bias.data<float>()[j];
+        for (int64_t i = 0; i < hidden_size; ++i) {
+          float ln = (x[i] - mean) / std::sqrt(var + 1e-5f) *
+                         ln_weight.data<float>()[i] +
+                     ln_bias.data<float>()[i];
+          sum += ln * qkv_weight.data<float>()[i * 3 * hidden_size + j];
+        }
+        qkv[s * 3 * hidden_size + j] = sum;
+      }
+    }
+    for (int64_t s = 0; s < seq_length; ++s) {
+      std::vector<float> context(hidden_size);
+      for (int64_t h = 0; h < num_heads; ++h) {
+        std::vector<float> score(s + 1);
+        for (int64_t t = 0; t <= s; ++t) {
+          for (int64_t d = 0; d < size_per_head; ++d) {
+            score[t] += qkv[s * 3 * hidden_size + h * size_per_head + d] *
+                        qkv[t * 3 * hidden_size + hidden_size +
+                            h * size_per_head + d] /
+                        std::sqrt(static_cast<float>(size_per_head));
+          }
+        }
+        float max_score = *std::max_element(score.begin(), score.end());
+        float sum = 0;
+        for (auto &x : score) {
+          x = std::exp(x - max_score);
+          sum += x;
+        }
+        for (int64_t t = 0; t <= s; ++t) {
+          for (int64_t d = 0; d < size_per_head; ++d) {
+            context[h * size_per_head + d] +=
+                score[t] / sum *
+                qkv[t * 3 * hidden_size + 2 * hidden_size + h * size_per_head +
+                    d];
+          }
+        }
+      }
+      for (int64_t j = 0; j < hidden_size; ++j) {
+        int64_t idx = (b * seq_length + s) * hidden_size + j;
+        float sum = input.data<float>()[idx] + dense_bias.data<float>()[j];
+        for (int64_t i = 0; i < hidden_size; ++i) {
+          sum += context[i] * dense_weight.data<float>()[i * hidden_size + j];
+        }
+        expected[idx] = sum;
+      }
+    }
+  }
+
+  GPT2Attention attention(std::move(ln_weight), std::move(ln_bias),
+                          std::move(qkv_weight), std::move(qkv_bias),
+                          std::move(dense_weight), std::move(dense_bias),
+                          num_heads);
+  KVCache cache;
+  attention.InitCache(batch_size, seq_length, &cache);
+  core::Tensor output(nullptr);
+  attention(input, &cache, &output);
+  REQUIRE(cache.seq_len == seq_length);
+  for (int64_t i = 0; i < output.numel(); ++i) {
+    REQUIRE(std::abs(output.data<float>()[i] - expected[i]) <
+            1e-3 * std::max(1.f, std::abs(expected[i])));
+  }
+}
+
+// A prompt followed by one token per step gives the outputs of running all
+// the tokens at once.
+TEST_CASE("gpt2_attention-kv_cache", "[gpt2_attention]") {
+  const int64_t batch_size = 2, seq_length = 7, prompt_length = 3,
+                hidden_size = 64;
+  auto attention = CreateGPT2Attention(hidden_size, 4);
+  auto input = CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+
+  KVCache cache;
+  attention.InitCache(batch_size, seq_length, &cache);
+  core::Tensor expected(nullptr);
+  attention(input, &cache, &expected);
+
+  attention.InitCache(batch_size, seq_length, &cache);
+  core::Workspace workspace;
+  core::Tensor output(nullptr);
+  attention(SliceTokens(input, 0, prompt_length), &cache, &output,
+            &workspace);
+  REQUIRE(CheckTokens(expected, 0, prompt_length, output));
+  for (int64_t step = prompt_length; step < seq_length; ++step) {
+    // In place, as a decoder running its layers on the same hidden states.
+    auto token = SliceTokens(input, step, step + 1);
+    attention(token, &cache, &token, &workspace);
+    REQUIRE(cache.seq_len == step + 1);
+    REQUIRE(CheckTokens(expected, step, step + 1, token));
+  }
+  auto token = SliceTokens(input, 0, 1);
+  REQUIRE_THROWS(attention(token, &cache, &output));
+}
+
+TEST_CASE("gpt2_block-kv_cache", "[gpt2_attention]") {
+  const int64_t batch_size = 3, seq_length = 6, prompt_length = 2,
+                hidden_size = 32, intermediate_size = 128;
+  GPT2Block block(
+      CreateGPT2Attention(hidden_size, 2),
+      CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({hidden_size, intermediate_size},
+                                       kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({intermediate_size}, kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({intermediate_size, hidden_size},
+                                       kDLCPU, 0),
+      CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0));
+  auto input = CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+
+  KVCache cache;
+  block.InitCache(batch_size, seq_length, &cache);
+  core::Tensor expected(nullptr);
+  block(input, &cache, &expected);
+
+  block.InitCache(batch_size, seq_length, &cache);
+  core::Tensor output(nullptr);
+  block(SliceTokens(input, 0, prompt_length), &cache, &output);
+  REQUIRE(CheckTokens(expected, 0, prompt_length, output));
+  for (int64_t step = prompt_length; step < seq_length; ++step) {
+    block(SliceTokens(input, step, step + 1), &cache, &output);
+    REQUIRE(CheckTokens(expected, step, step + 1, output));
+  }
+}
+
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,116 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/gpt2_block.h"
+
+#include "loguru.hpp"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/profiler.h"
+#include "turbo_transformers/core/tensor_copy.h"
+#include "turbo_transformers/layers/kernels/activation.h"
+#include "turbo_transformers/layers/kernels/layer_norm.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+static constexpr const char* kAttentionOut = "GPT2Block/attention_out";
+static constexpr const char* kLayerNormOut = "GPT2Block/layer_norm_out";
+static constexpr const char* kIntermediateOut = "GPT2Block/intermediate_out";
+
+void GPT2Block::operator()(const core::Tensor& input_tensor, KVCache* cache,
+                           core::Tensor* output,
+                           core::Workspace* workspace) const {
+  core::ProfileScope profile_scope("GPT2Block", input_tensor);
+  core::LayerTimer layer_timer("GPT2Block");
+  if (workspace == nullptr) {
+    static thread_local core::Workspace thread_workspace;
+    workspace = &thread_workspace;
+  }
+  if (input_tensor.IsType<core::Half>()) {
+    Compute<core::Half>(input_tensor, cache, output, workspace);
+  } else {
+    Compute<float>(input_tensor, cache, output, workspace);
+  }
+}
+
+template <typename T>
+void GPT2Block::Compute(const core::Tensor& input_tensor, KVCache* cache,
+                        core::Tensor* output,
+                        core::Workspace* workspace) const {
+  auto batch_size = input_tensor.shape(0);
+  auto seq_length = input_tensor.shape(1);
+  auto hidden_size = input_tensor.shape(2);
+  auto device_type = input_tensor.device_type();
+  auto device_id = input_tensor.device_id();
+
+  // 1. hidden = input + attention(LayerNorm(input))
+  core::Tensor& hidden = workspace->GetTensor<T>(
+      kAttentionOut, {batch_size, seq_length, hidden_size}, device_type,
+      device_id);
+  attention_(input_tensor, cache, &hidden, workspace);
+
+  // 2. intermediate = gelu(MatMul(LayerNorm(hidden)) + bias)
+  core::Tensor& layer_norm_out = workspace->GetTensor<T>(
+      kLayerNormOut, {batch_size, seq_length, hidden_size}, device_type,
+      device_id);
+  core::CopyAsync<T>(hidden, layer_norm_out);
+  kernels::LayerNorm<T>(layer_norm_weight_, layer_norm_bias_, &layer_norm_out,
+                        layer_norm_epsilon_);
+  core::Tensor& intermediate = workspace->GetTensor<T>(
+      kIntermediateOut, {batch_size, seq_length, fc_weight_.shape(1)},
+      device_type, device_id);
+  if (packed_fc_weight_.is_null()) {
+    kernels::MatMul(layer_norm_out, false, fc_weight_, false, 1.0,
+                    intermediate, 0.0);
+  } else {
+    kernels::MatMul(layer_norm_out, packed_fc_weight_, intermediate, 0.0);
+  }
+  kernels::AddBiasAct<T, kernels::ActivationType::Gelu>(fc_bias_,
+                                                        &intermediate);
+
+  // 3. output = hidden + MatMul(intermediate) + bias
+  output->Reshape<T>({batch_size, seq_length, hidden_size}, device_type,
+                     device_id);
+  core::CopyAsync<T>(hidden, *output);
+  if (packed_proj_weight_.is_null()) {
+    kernels::MatMul(intermediate, false, proj_weight_, false, 1.0, *output,
+                    1.0);
+  } else {
+    kernels::MatMul(intermediate, packed_proj_weight_, *output, 1.0);
+  }
+  kernels::AddBiasAct<T, kernels::ActivationType::Identity>(proj_bias_,
+                                                            output);
+}
+
+void GPT2Block::EnforceShapeAndType() const {
+  TT_ENFORCE_EQ(fc_weight_.n_dim(), 2, "fc weight must be matrix");
+  TT_ENFORCE_EQ(proj_weight_.n_dim(), 2, "proj weight must be matrix");
+  TT_ENFORCE_EQ(fc_weight_.shape(1), proj_weight_.shape(0),
+                "The fc and proj weights mismatch, %d vs %d",
+                fc_weight_.shape(1), proj_weight_.shape(0));
+  TT_ENFORCE_EQ(fc_weight_.shape(0), proj_weight_.shape(1),
+                "The fc and proj weights mismatch, %d vs %d",
+                fc_weight_.shape(0), proj_weight_.shape(1));
+  if (loguru::current_verbosity_cutoff() >= 3) {
+    std::ostringstream os;
+    os << ">>>>>>>>>>>> fc_weight_ <<<<<<<<<<<<" << std::endl;
+    fc_weight_.Print<float>(os);
+    os << ">>>>>>>>>>>> proj_weight_ <<<<<<<<<<<<" << std::endl;
+    proj_weight_.Print<float>(os);
+    LOG_S(3) << os.str();
+  }
+}
+
+}  // namespace layers
+}  // namespace turbo_transformers
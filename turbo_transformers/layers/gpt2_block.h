@@ -0,0 +1,84 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <memory>
+#include <utility>
+
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/workspace.h"
+#include "turbo_transformers/layers/gpt2_attention.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+// A GPT-2 decoder block, the causal self-attention followed by the MLP,
+// each with a layer norm in front and a residual after:
+//   hidden = GPT2Attention(input)
+//   output = hidden + proj(gelu(fc(layer_norm(hidden))))
+class GPT2Block {
+ public:
+  // The fc weight is [hidden_size, intermediate_size] and the proj weight
+  // [intermediate_size, hidden_size]. See GPT2Attention for
+  // `layer_norm_epsilon`.
+  GPT2Block(GPT2Attention attention, core::Tensor layer_norm_weight,
+            core::Tensor layer_norm_bias, core::Tensor fc_weight,
+            core::Tensor fc_bias, core::Tensor proj_weight,
+            core::Tensor proj_bias,
+            float layer_norm_epsilon = kGPT2LayerNormEpsilon)
+      : attention_(std::move(attention)),
+        layer_norm_weight_(std::move(layer_norm_weight)),
+        layer_norm_bias_(std::move(layer_norm_bias)),
+        fc_weight_(std::move(fc_weight)),
+        fc_bias_(std::move(fc_bias)),
+        proj_weight_(std::move(proj_weight)),
+        proj_bias_(std::move(proj_bias)),
+        layer_norm_epsilon_(layer_norm_epsilon) {
+    EnforceShapeAndType();
+    packed_fc_weight_ = kernels::PackLayerWeight(fc_weight_);
+    packed_proj_weight_ = kernels::PackLayerWeight(proj_weight_);
+  }
+  void EnforceShapeAndType() const;
+
+  // See GPT2Attention::InitCache, a block takes a cache of its own.
+  void InitCache(int64_t batch_size, int64_t max_seq_len,
+                 KVCache *cache) const {
+    attention_.InitCache(batch_size, max_seq_len, cache);
+  }
+
+  // Run the next tokens of the sequences in `cache`, see
+  // GPT2Attention::operator(). `output` may be `input_tensor`.
+  void operator()(const core::Tensor &input_tensor, KVCache *cache,
+                  core::Tensor *output,
+                  core::Workspace *workspace = nullptr) const;
+
+ private:
+  template <typename T>
+  void Compute(const core::Tensor &input_tensor, KVCache *cache,
+               core::Tensor *output, core::Workspace *workspace) const;
+
+  GPT2Attention attention_;
+  core::Tensor layer_norm_weight_;
+  core::Tensor layer_norm_bias_;
+  core::Tensor fc_weight_;
+  core::Tensor fc_bias_;
+  core::Tensor proj_weight_;
+  core::Tensor proj_bias_;
+  float layer_norm_epsilon_;
+  kernels::PackedWeight packed_fc_weight_;
+  kernels::PackedWeight packed_proj_weight_;
+};
+
+}  // namespace layers
+}  // namespace turbo_transformers
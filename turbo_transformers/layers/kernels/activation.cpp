@@ -12,6 +12,10 @@
 // See the AUTHORS file for names of contributors.
 #include "turbo_transformers/layers/kernels/activation.h"
 
+#include "turbo_transformers/core/config.h"
+#include "turbo_transformers/core/profiler.h"
+#include "turbo_transformers/layers/kernels/cpu_vector_kernels.h"
+
 #ifdef TT_WITH_CUDA
 #include "turbo_transformers/core/cuda_device_context.h"
 #include "turbo_transformers/layers/kernels/gpu_activation_kernel.h"
@@ -22,33 +26,30 @@ namespace layers {
 namespace kernels {
 
 namespace {
+// core::Half is only supported by the GPU kernels.
 template <typename T, ActivationType ActType>
 void CPUAddBiasActKernel(const T *bias, int64_t batch_size, int64_t feature_dim,
-                         T *out);
+                         T *out) {
+  TT_THROW("The CPU AddBiasAct only supports float.");
+}
+
+void CPUAddBiasAct(void (*add_bias_act_row)(const float *, int64_t, float *),
+                   const float *bias, int64_t batch_size, int64_t feature_dim,
+                   float *out) {
+  int n_th = core::ParallelThreadsFor(batch_size * feature_dim);
+#pragma omp parallel for num_threads(n_th) if (n_th > 1)
+  for (int64_t i = 0; i < batch_size; ++i) {
+    add_bias_act_row(bias, feature_dim, out + i * feature_dim);
+  }
+}
 
 template <>
 void CPUAddBiasActKernel<float, ActivationType::Gelu>(const float *bias,
                                                       int64_t batch_size,
                                                       int64_t feature_dim,
                                                       float *out) {
-  core::Tensor temp_tensor(nullptr);
-  auto *buff =
-      temp_tensor.Reshape<float>({batch_size * feature_dim}, kDLCPU, 0);
-#pragma omp parallel for
-  for (int64_t i = 0; i < batch_size; ++i) {
-    int64_t k = 0;
-#pragma omp simd
-    for (int64_t j = feature_dim * i; j < feature_dim * (i + 1); ++j) {
-      float tmp_ = out[j] + bias[k++];
-      buff[j] = (0.7978845608028654f * (tmp_ + 0.044715f * tmp_ * tmp_ * tmp_));
-    }
-    vsTanh(feature_dim, &buff[i * feature_dim], &buff[i * feature_dim]);
-    k = 0;
-#pragma omp simd
-    for (int64_t j = feature_dim * i; j < feature_dim * (i + 1); ++j) {
-      out[j] = (out[j] + bias[k++]) * 0.5f * (1.0f + buff[j]);
-    }
-  }
+  CPUAddBiasAct(GetCPUVectorKernels().add_bias_gelu, bias, batch_size,
+                feature_dim, out);
 }
 
 template <>
@@ -56,20 +57,26 @@ void CPUAddBiasActKernel<float, ActivationType::Tanh>(const float *bias,
                                                       int64_t batch_size,
                                                       int64_t feature_dim,
                                                       float *out) {
-#pragma omp parallel for
+  CPUAddBiasAct(GetCPUVectorKernels().add_bias_tanh, bias, batch_size,
+                feature_dim, out);
+}
+template <>
+void CPUAddBiasActKernel<float, ActivationType::Identity>(const float *bias,
+                                                          int64_t batch_size,
+                                                          int64_t feature_dim,
+                                                          float *out) {
+  auto add = GetCPUVectorKernels().add;
+  int n_th = core::ParallelThreadsFor(batch_size * feature_dim);
+#pragma omp parallel for num_threads(n_th) if (n_th > 1)
   for (int64_t i = 0; i < batch_size; ++i) {
-    int64_t k = 0;
-#pragma omp simd
-    for (int64_t j = feature_dim * i; j < feature_dim * (i + 1); ++j) {
-      out[j] = out[j] + bias[k++];
-    }
-    vsTanh(feature_dim, &out[i * feature_dim], &out[i * feature_dim]);
+    add(out + i * feature_dim, bias, feature_dim, out + i * feature_dim);
   }
 }
 }  // namespace
 
 template <typename T, ActivationType ActType>
 void AddBiasAct(const core::Tensor &bias_tensor, core::Tensor *out_tensor) {
+  core::ProfileScope profile_scope("AddBiasAct", *out_tensor);
   auto *out = out_tensor->mutableData<T>();
   auto *bias = bias_tensor.data<T>();
 
@@ -82,7 +89,8 @@ void AddBiasAct(const core::Tensor &bias_tensor, core::Tensor *out_tensor) {
   } else if (out_tensor->device_type() == kDLGPU &&
              bias_tensor.device_type() == kDLGPU) {
 #ifdef TT_WITH_CUDA
-    core::CUDADeviceContext &cuda_ctx = core::CUDADeviceContext::GetInstance();
+    core::CUDADeviceContext &cuda_ctx =
+        core::CUDADeviceContext::GetInstance(out_tensor->device_id());
     GPUAddBiasActKernel<T, ActType>(bias, m, n, cuda_ctx.stream(), out);
 #endif
   } else {
@@ -96,6 +104,18 @@ template void AddBiasAct<float, ActivationType::Tanh>(
 
 template void AddBiasAct<float, ActivationType::Gelu>(
     const core::Tensor &bias_tensor, core::Tensor *out_tensor);
+
+template void AddBiasAct<core::Half, ActivationType::Tanh>(
+    const core::Tensor &bias_tensor, core::Tensor *out_tensor);
+
+template void AddBiasAct<core::Half, ActivationType::Gelu>(
+    const core::Tensor &bias_tensor, core::Tensor *out_tensor);
+
+template void AddBiasAct<float, ActivationType::Identity>(
+    const core::Tensor &bias_tensor, core::Tensor *out_tensor);
+
+template void AddBiasAct<core::Half, ActivationType::Identity>(
+    const core::Tensor &bias_tensor, core::Tensor *out_tensor);
 }  // namespace kernels
 }  // namespace layers
 }  // namespace turbo_transformers
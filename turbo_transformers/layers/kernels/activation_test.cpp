@@ -13,6 +13,11 @@
 
 #include "turbo_transformers/layers/kernels/activation.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
 #include "loguru.hpp"
 #ifdef TT_WITH_CUDA
 #include "turbo_transformers/core/cuda_device_context.h"
@@ -25,6 +30,56 @@ namespace turbo_transformers {
 namespace layers {
 namespace kernels {
 
+static float RefAct(ActivationType act_type, float x) {
+  if (act_type == ActivationType::Tanh) {
+    return std::tanh(x);
+  }
+  if (act_type == ActivationType::Identity) {
+    return x;
+  }
+  return 0.5f * x *
+         (1.f + std::tanh(0.7978845608028654f * (x + 0.044715f * x * x * x)));
+}
+
+TEST_CASE("activation-cpu-test") {
+  // The rows are not multiples of the vector width either.
+  for (int64_t hidden_size : {1, 15, 12 * 64, 4096 * 2 + 1}) {
+    for (auto act_type : {ActivationType::Gelu, ActivationType::Tanh,
+                          ActivationType::Identity}) {
+      const int64_t batch_size = 3;
+      core::Tensor bias =
+          common::CreateTensor<float>({hidden_size}, kDLCPU, 0);
+      core::Tensor out =
+          common::CreateTensor<float>({batch_size, hidden_size}, kDLCPU, 0);
+      std::vector<float> expected(batch_size * hidden_size);
+      for (int64_t j = 0; j < hidden_size; ++j) {
+        bias.mutableData<float>()[j] = 2.f * rand() / RAND_MAX - 1.f;
+      }
+      for (int64_t i = 0; i < batch_size * hidden_size; ++i) {
+        // Also beyond the saturation of tanh.
+        float x = 20.f * rand() / RAND_MAX - 10.f;
+        out.mutableData<float>()[i] = x;
+        expected[i] =
+            RefAct(act_type, x + bias.data<float>()[i % hidden_size]);
+      }
+      if (act_type == ActivationType::Gelu) {
+        AddBiasAct<float, ActivationType::Gelu>(bias, &out);
+      } else if (act_type == ActivationType::Tanh) {
+        AddBiasAct<float, ActivationType::Tanh>(bias, &out);
+      } else {
+        AddBiasAct<float, ActivationType::Identity>(bias, &out);
+      }
+      float max_error = 0;
+      for (int64_t i = 0; i < batch_size * hidden_size; ++i) {
+        max_error = std::max(max_error,
+                             std::abs(out.data<float>()[i] - expected[i]) /
+                                 std::max(1.f, std::abs(expected[i])));
+      }
+      REQUIRE(max_error < 1e-5f);
+    }
+  }
+}
+
 #ifdef TT_WITH_CUDA
 template <typename T, typename Func>
 static void ActivationTestHelper(int batch_size, int seq_length,
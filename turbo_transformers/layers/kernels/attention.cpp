@@ -0,0 +1,403 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/attention.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "turbo_transformers/core/blas.h"
+#include "turbo_transformers/core/profiler.h"
+#include "turbo_transformers/layers/kernels/cpu_vector_kernels.h"
+#ifdef TT_WITH_CUDA
+#include "turbo_transformers/core/cuda_device_context.h"
+#include "turbo_transformers/layers/kernels/gpu_attention_kernel.h"
+#endif
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// A block keeps kQueryBlock rows of q and of the context, kKeyBlock rows of k
+// and of v, and kQueryBlock x kKeyBlock scores, about 400KB for heads of 64,
+// which is resident in the L2 of server cores. Sequences up to kKeyBlock take
+// a single key block, so their context is never rescaled.
+static constexpr int64_t kQueryBlock = 64;
+static constexpr int64_t kKeyBlock = 512;
+
+namespace {
+struct HeadLayout {
+  const float* data;
+  int64_t batch_stride;
+  int64_t head_stride;
+  int64_t row_stride;
+};
+
+HeadLayout GetHeadLayout(const core::TensorView& tensor) {
+  TT_ENFORCE_EQ(tensor.stride(3), 1,
+                "The heads of the attention must be dense in size_per_head.");
+  return {tensor.data<float>(), tensor.stride(0), tensor.stride(1),
+          tensor.stride(2)};
+}
+
+const float* HeadRow(const HeadLayout& layout, int64_t batch_idx,
+                     int64_t head_idx, int64_t row) {
+  return layout.data + batch_idx * layout.batch_stride +
+         head_idx * layout.head_stride + row * layout.row_stride;
+}
+
+// Folds the scores of the keys [key_begin, key_begin + n_keys) into the
+// running max, sum and context of the query rows, where out holds the
+// unnormalized context, i.e. sum(exp(score - max) * v).
+void AttendKeyBlock(const float* q, BlasInt ldq, const float* k, BlasInt ldk,
+                    const float* v, BlasInt ldv, const float* mask,
+                    int64_t n_queries, int64_t n_keys, int64_t size_per_head,
+                    float scale, bool first, float* scores, float* row_max,
+                    float* row_sum, float* out, BlasInt ld_out) {
+  cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, n_queries, n_keys,
+              size_per_head, scale, q, ldq, k, ldk, 0.0f, scores, kKeyBlock);
+  auto& vector_kernels = GetCPUVectorKernels();
+  for (int64_t i = 0; i < n_queries; ++i) {
+    auto* score_ptr = scores + i * kKeyBlock;
+    float max_val =
+        std::max(row_max[i],
+                 vector_kernels.scale_add_max(score_ptr, 1.0f, mask, n_keys));
+    float sum = vector_kernels.exp_sum(score_ptr, max_val, n_keys);
+    if (first) {
+      row_sum[i] = sum;
+    } else {
+      // Rescale what was accumulated under the previous max.
+      auto correction = std::exp(row_max[i] - max_val);
+      row_sum[i] = row_sum[i] * correction + sum;
+      vector_kernels.scale(out + i * ld_out, correction, size_per_head);
+    }
+    row_max[i] = max_val;
+  }
+  cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, n_queries,
+              size_per_head, n_keys, 1.0f, scores, kKeyBlock, v, ldv,
+              first ? 0.0f : 1.0f, out, ld_out);
+}
+
+// Attends the queries [q_begin, q_begin + n_queries) to all the keys, block
+// by block, and normalizes their context.
+void AttendAllKeys(const HeadLayout& q, const HeadLayout& k,
+                   const HeadLayout& v, const HeadLayout& out,
+                   const float* mask, int64_t batch_idx, int64_t head_idx,
+                   int64_t q_begin, int64_t n_queries, int64_t seq_length,
+                   int64_t size_per_head, float scale, float* scores,
+                   float* row_max, float* row_sum) {
+  auto* out_ptr =
+      const_cast<float*>(HeadRow(out, batch_idx, head_idx, q_begin));
+  std::fill(row_max, row_max + n_queries,
+            std::numeric_limits<float>::lowest());
+  for (int64_t k_begin = 0; k_begin < seq_length; k_begin += kKeyBlock) {
+    AttendKeyBlock(HeadRow(q, batch_idx, head_idx, q_begin), q.row_stride,
+                   HeadRow(k, batch_idx, head_idx, k_begin), k.row_stride,
+                   HeadRow(v, batch_idx, head_idx, k_begin), v.row_stride,
+                   mask + k_begin, n_queries,
+                   std::min(kKeyBlock, seq_length - k_begin), size_per_head,
+                   scale, k_begin == 0, scores, row_max, row_sum, out_ptr,
+                   out.row_stride);
+  }
+  for (int64_t i = 0; i < n_queries; ++i) {
+    auto coef = 1.0f / row_sum[i];
+    auto* row_ptr = out_ptr + i * out.row_stride;
+#pragma omp simd
+    for (int64_t d = 0; d < size_per_head; ++d) {
+      row_ptr[d] *= coef;
+    }
+  }
+}
+
+// Attends the local queries [q_begin, q_begin + n_queries) to the
+// `num_global` global keys and to the keys within `window` of them. The
+// scores of the block are one GEMM of the keys spanning all of its bands,
+// whose columns outside the band of a query are zeroed after the softmax.
+// A row of `scores` takes the global keys followed by the band.
+void AttendWindowBlock(const HeadLayout& q, const HeadLayout& k,
+                       const HeadLayout& v, const HeadLayout& out,
+                       const float* mask, int64_t batch_idx, int64_t head_idx,
+                       int64_t q_begin, int64_t n_queries, int64_t seq_length,
+                       int64_t size_per_head, int64_t window,
+                       int64_t num_global, float scale, float* scores,
+                       BlasInt ld_scores) {
+  auto k_begin = std::max(num_global, q_begin - window);
+  auto k_end = std::min(seq_length, q_begin + n_queries + window);
+  auto n_band = k_end - k_begin;
+  const float* q_ptr = HeadRow(q, batch_idx, head_idx, q_begin);
+  float* band_scores = scores + num_global;
+  if (num_global > 0) {
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, n_queries,
+                num_global, size_per_head, scale, q_ptr, q.row_stride,
+                HeadRow(k, batch_idx, head_idx, 0), k.row_stride, 0.0f,
+                scores, ld_scores);
+  }
+  cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, n_queries, n_band,
+              size_per_head, scale, q_ptr, q.row_stride,
+              HeadRow(k, batch_idx, head_idx, k_begin), k.row_stride, 0.0f,
+              band_scores, ld_scores);
+  auto& vector_kernels = GetCPUVectorKernels();
+  for (int64_t i = 0; i < n_queries; ++i) {
+    auto query = q_begin + i;
+    auto* score_ptr = scores + i * ld_scores;
+    auto* band_ptr = score_ptr + num_global;
+    // The band of the query is [lo, hi) of the band columns.
+    auto lo = std::max(k_begin, query - window) - k_begin;
+    auto hi = std::min(k_end, query + window + 1) - k_begin;
+    float max_val = std::max(
+        vector_kernels.scale_add_max(score_ptr, 1.0f, mask, num_global),
+        vector_kernels.scale_add_max(band_ptr + lo, 1.0f, mask + k_begin + lo,
+                                     hi - lo));
+    float sum = vector_kernels.exp_sum(score_ptr, max_val, num_global) +
+                vector_kernels.exp_sum(band_ptr + lo, max_val, hi - lo);
+    std::fill(band_ptr, band_ptr + lo, 0.0f);
+    std::fill(band_ptr + hi, band_ptr + n_band, 0.0f);
+    vector_kernels.scale(score_ptr, 1.0f / sum, num_global);
+    vector_kernels.scale(band_ptr + lo, 1.0f / sum, hi - lo);
+  }
+  auto* out_ptr =
+      const_cast<float*>(HeadRow(out, batch_idx, head_idx, q_begin));
+  if (num_global > 0) {
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, n_queries,
+                size_per_head, num_global, 1.0f, scores, ld_scores,
+                HeadRow(v, batch_idx, head_idx, 0), v.row_stride, 0.0f,
+                out_ptr, out.row_stride);
+  }
+  cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, n_queries,
+              size_per_head, n_band, 1.0f, band_scores, ld_scores,
+              HeadRow(v, batch_idx, head_idx, k_begin), v.row_stride,
+              num_global > 0 ? 1.0f : 0.0f, out_ptr, out.row_stride);
+}
+
+void EnforceAttentionShapes(const core::TensorView& q_tensor,
+                            const core::TensorView& k_tensor,
+                            const core::TensorView& v_tensor,
+                            const core::TensorView& att_mask,
+                            const core::TensorView& context) {
+  TT_ENFORCE(q_tensor.n_dim() == 4 && k_tensor.n_dim() == 4 &&
+                 v_tensor.n_dim() == 4 && context.n_dim() == 4,
+             "q, k, v and context should be (batch_size, head_num, "
+             "seq_length, size_per_head)");
+  for (auto& tensor : {k_tensor, v_tensor, context}) {
+    for (int i = 0; i < 4; ++i) {
+      TT_ENFORCE_EQ(tensor.shape(i), q_tensor.shape(i),
+                    "The shapes of q, k, v and context mismatch.");
+    }
+  }
+  TT_ENFORCE_EQ(att_mask.numel(), q_tensor.shape(0) * q_tensor.shape(2),
+                "The attention mask should be (batch_size, 1, 1, seq_length)");
+  TT_ENFORCE(att_mask.is_contiguous(), "The attention mask must be dense.");
+}
+
+#ifdef TT_WITH_CUDA
+AttentionStrides GetAttentionStrides(const core::TensorView& tensor) {
+  TT_ENFORCE_EQ(tensor.stride(3), 1,
+                "The heads of the attention must be dense in size_per_head.");
+  return AttentionStrides{tensor.stride(0), tensor.stride(1),
+                          tensor.stride(2)};
+}
+#endif
+}  // namespace
+
+void FusedAttention(const core::TensorView& q_tensor,
+                    const core::TensorView& k_tensor,
+                    const core::TensorView& v_tensor,
+                    const core::TensorView& att_mask, float scale,
+                    core::TensorView context) {
+  core::ProfileScope profile_scope("FusedAttention", q_tensor);
+  EnforceAttentionShapes(q_tensor, k_tensor, v_tensor, att_mask, context);
+  auto batch_size = q_tensor.shape(0);
+  auto head_num = q_tensor.shape(1);
+  auto seq_length = q_tensor.shape(2);
+  auto size_per_head = q_tensor.shape(3);
+  if (q_tensor.device_type() == kDLGPU && context.device_type() == kDLGPU) {
+#ifdef TT_WITH_CUDA
+    TT_ENFORCE(IsFusedAttentionSupported(kDLGPU, seq_length, size_per_head),
+               "The fused attention of the GPU supports seq_length <= %d and "
+               "size_per_head <= %d, got %d and %d",
+               kGPUFusedAttentionMaxSeqLen, kGPUFusedAttentionMaxHeadSize,
+               seq_length, size_per_head);
+    auto strides = GetAttentionStrides;
+    auto& cuda_ctx = core::CUDADeviceContext::GetInstance(q_tensor.device_id());
+    if (q_tensor.IsType<core::Half>()) {
+      GPUFusedAttention(
+          q_tensor.data<core::Half>(), strides(q_tensor),
+          k_tensor.data<core::Half>(), strides(k_tensor),
+          v_tensor.data<core::Half>(), strides(v_tensor),
+          att_mask.data<float>(), batch_size, head_num, seq_length,
+          size_per_head, scale, context.mutableData<core::Half>(),
+          strides(context), cuda_ctx.stream());
+    } else {
+      GPUFusedAttention(q_tensor.data<float>(), strides(q_tensor),
+                        k_tensor.data<float>(), strides(k_tensor),
+                        v_tensor.data<float>(), strides(v_tensor),
+                        att_mask.data<float>(), batch_size, head_num,
+                        seq_length, size_per_head, scale,
+                        context.mutableData<float>(), strides(context),
+                        cuda_ctx.stream());
+    }
+    return;
+#else
+    TT_THROW("The current code is not compiled with CUDA.");
+#endif
+  }
+  if (q_tensor.device_type() != kDLCPU || context.device_type() != kDLCPU) {
+    TT_THROW("device_type is not supported");
+  }
+
+  auto q = GetHeadLayout(q_tensor);
+  auto k = GetHeadLayout(k_tensor);
+  auto v = GetHeadLayout(v_tensor);
+  auto out = GetHeadLayout(context);
+  auto* mask = att_mask.data<float>();
+  auto n_query_blocks = (seq_length + kQueryBlock - 1) / kQueryBlock;
+
+#pragma omp parallel
+  {
+    std::vector<float> scores(kQueryBlock * kKeyBlock);
+    std::vector<float> row_max(kQueryBlock);
+    std::vector<float> row_sum(kQueryBlock);
+#pragma omp for collapse(3)
+    for (int64_t batch_idx = 0; batch_idx < batch_size; ++batch_idx) {
+      for (int64_t head_idx = 0; head_idx < head_num; ++head_idx) {
+        for (int64_t block = 0; block < n_query_blocks; ++block) {
+          auto q_begin = block * kQueryBlock;
+          AttendAllKeys(q, k, v, out, mask + batch_idx * seq_length,
+                        batch_idx, head_idx, q_begin,
+                        std::min(kQueryBlock, seq_length - q_begin),
+                        seq_length, size_per_head, scale, scores.data(),
+                        row_max.data(), row_sum.data());
+        }
+      }
+    }
+  }
+}
+
+void SlidingWindowAttention(const core::TensorView& q_tensor,
+                            const core::TensorView& k_tensor,
+                            const core::TensorView& v_tensor,
+                            const core::TensorView& att_mask, int64_t window,
+                            int64_t num_global_tokens, float scale,
+                            core::TensorView context) {
+  core::ProfileScope profile_scope("SlidingWindowAttention", q_tensor);
+  EnforceAttentionShapes(q_tensor, k_tensor, v_tensor, att_mask, context);
+  auto batch_size = q_tensor.shape(0);
+  auto head_num = q_tensor.shape(1);
+  auto seq_length = q_tensor.shape(2);
+  auto size_per_head = q_tensor.shape(3);
+  TT_ENFORCE_GE(window, 0, "The attention window should not be negative.");
+  TT_ENFORCE(num_global_tokens >= 0 && num_global_tokens <= seq_length,
+             "The global tokens should be in [0, %d], got %d.", seq_length,
+             num_global_tokens);
+  if (q_tensor.device_type() == kDLGPU && context.device_type() == kDLGPU) {
+#ifdef TT_WITH_CUDA
+    TT_ENFORCE_LE(size_per_head, kGPUWindowAttentionMaxHeadSize,
+                  "The sliding window attention of the GPU supports "
+                  "size_per_head <= %d, got %d",
+                  kGPUWindowAttentionMaxHeadSize, size_per_head);
+    auto strides = GetAttentionStrides;
+    auto& cuda_ctx = core::CUDADeviceContext::GetInstance(q_tensor.device_id());
+    if (q_tensor.IsType<core::Half>()) {
+      GPUSlidingWindowAttention(
+          q_tensor.data<core::Half>(), strides(q_tensor),
+          k_tensor.data<core::Half>(), strides(k_tensor),
+          v_tensor.data<core::Half>(), strides(v_tensor),
+          att_mask.data<float>(), batch_size, head_num, seq_length,
+          size_per_head, window, num_global_tokens, scale,
+          context.mutableData<core::Half>(), strides(context),
+          cuda_ctx.stream());
+    } else {
+      GPUSlidingWindowAttention(
+          q_tensor.data<float>(), strides(q_tensor), k_tensor.data<float>(),
+          strides(k_tensor), v_tensor.data<float>(), strides(v_tensor),
+          att_mask.data<float>(), batch_size, head_num, seq_length,
+          size_per_head, window, num_global_tokens, scale,
+          context.mutableData<float>(), strides(context), cuda_ctx.stream());
+    }
+    return;
+#else
+    TT_THROW("The current code is not compiled with CUDA.");
+#endif
+  }
+  if (q_tensor.device_type() != kDLCPU || context.device_type() != kDLCPU) {
+    TT_THROW("device_type is not supported");
+  }
+
+  auto q = GetHeadLayout(q_tensor);
+  auto k = GetHeadLayout(k_tensor);
+  auto v = GetHeadLayout(v_tensor);
+  auto out = GetHeadLayout(context);
+  auto* mask = att_mask.data<float>();
+  // The global queries come first, followed by the local ones.
+  auto n_global_blocks = (num_global_tokens + kQueryBlock - 1) / kQueryBlock;
+  auto n_local_blocks =
+      (seq_length - num_global_tokens + kQueryBlock - 1) / kQueryBlock;
+  auto n_blocks = n_global_blocks + n_local_blocks;
+  // The widest band of a block of local queries.
+  BlasInt ld_scores =
+      num_global_tokens +
+      std::min(seq_length - num_global_tokens, kQueryBlock + 2 * window);
+
+#pragma omp parallel
+  {
+    std::vector<float> scores(
+        kQueryBlock * std::max<int64_t>(kKeyBlock, ld_scores));
+    std::vector<float> row_max(kQueryBlock);
+    std::vector<float> row_sum(kQueryBlock);
+#pragma omp for collapse(3)
+    for (int64_t batch_idx = 0; batch_idx < batch_size; ++batch_idx) {
+      for (int64_t head_idx = 0; head_idx < head_num; ++head_idx) {
+        for (int64_t block = 0; block < n_blocks; ++block) {
+          const float* batch_mask = mask + batch_idx * seq_length;
+          if (block < n_global_blocks) {
+            auto q_begin = block * kQueryBlock;
+            AttendAllKeys(q, k, v, out, batch_mask, batch_idx, head_idx,
+                          q_begin,
+                          std::min(kQueryBlock, num_global_tokens - q_begin),
+                          seq_length, size_per_head, scale, scores.data(),
+                          row_max.data(), row_sum.data());
+          } else {
+            auto q_begin =
+                num_global_tokens + (block - n_global_blocks) * kQueryBlock;
+            AttendWindowBlock(q, k, v, out, batch_mask, batch_idx, head_idx,
+                              q_begin,
+                              std::min(kQueryBlock, seq_length - q_begin),
+                              seq_length, size_per_head, window,
+                              num_global_tokens, scale, scores.data(),
+                              ld_scores);
+          }
+        }
+      }
+    }
+  }
+}
+
+bool IsFusedAttentionSupported(DLDeviceType device_type, int64_t seq_length,
+                               int64_t size_per_head) {
+  if (device_type == kDLCPU) {
+    return true;
+  }
+#ifdef TT_WITH_CUDA
+  if (device_type == kDLGPU) {
+    return seq_length <= kGPUFusedAttentionMaxSeqLen &&
+           size_per_head <= kGPUFusedAttentionMaxHeadSize;
+  }
+#endif
+  return false;
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
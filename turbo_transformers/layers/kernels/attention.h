@@ -0,0 +1,65 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/tensor_view.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// context = softmax(q * k^T * scale + att_mask) * v, i.e.
+//   BatchMatMul(q, false, k, true, 1.0, att_score, 0.0);
+//   ApplyMaskAndSoftmax(att_score, att_mask, scale);
+//   BatchMatMul(att_score, false, v, false, 1.0, context, 0.0);
+// without the (batch_size, head_num, seq_length, seq_length) att_score. The
+// scores of a block of queries are computed against a block of keys at a
+// time and folded into the context with an online softmax, so the working
+// set of a block stays in the cache. On the GPU, a single kernel keeps the
+// scores in shared memory, see IsFusedAttentionSupported.
+// q, k, v, context: (batch_size, head_num, seq_length, size_per_head), may be
+// strided except for the last dimension, e.g. context can be a view of the
+// merged heads (batch_size, seq_length, head_num * size_per_head).
+// att_mask: (batch_size, 1, 1, seq_length)
+extern void FusedAttention(const core::TensorView& q,
+                           const core::TensorView& k,
+                           const core::TensorView& v,
+                           const core::TensorView& att_mask, float scale,
+                           core::TensorView context);
+
+// The Longformer attention of long sequences, where every query attends to
+// the keys within `window` of it and to the first `num_global_tokens` keys,
+// e.g. [CLS] and the question, and the global queries attend to all keys. The
+// work and the scratch memory are O(seq_length * (window +
+// num_global_tokens)) instead of O(seq_length^2). On the CPU, the scores of a
+// block of queries are the GEMM of their band of keys. On the GPU, a warp
+// folds the keys of a query into its context with an online softmax, for
+// heads up to kGPUWindowAttentionMaxHeadSize. The tensors are those of
+// FusedAttention.
+extern void SlidingWindowAttention(const core::TensorView& q,
+                                   const core::TensorView& k,
+                                   const core::TensorView& v,
+                                   const core::TensorView& att_mask,
+                                   int64_t window, int64_t num_global_tokens,
+                                   float scale, core::TensorView context);
+
+// Whether FusedAttention takes the given heads, i.e. always on the CPU, and on
+// the GPU for sequences up to 128 and heads up to 64.
+extern bool IsFusedAttentionSupported(DLDeviceType device_type,
+                                      int64_t seq_length,
+                                      int64_t size_per_head);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,282 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/attention.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+#include "turbo_transformers/layers/kernels/softmax.h"
+#include "turbo_transformers/layers/kernels/transpose.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+TEST_CASE("fused-attention-cpu-test") {
+  const int64_t batch_size = 2, num_attention_heads = 3, size_per_head = 16;
+  const float scale = 0.25f;
+  // Shorter than a block, and several query and key blocks with partial
+  // tails.
+  for (int64_t seq_length : {10, 200, 700}) {
+    auto qkv = common::CreateTensorAndFillRandom<float>(
+        {3, batch_size, num_attention_heads, seq_length, size_per_head},
+        kDLCPU, 0);
+    auto att_mask = common::CreateTensorAndFillRandom<float>(
+        {batch_size, 1, 1, seq_length}, kDLCPU, 0);
+    // Mask the padding of the first sequence like BERT does.
+    auto* mask_data = att_mask.mutableData<float>();
+    for (int64_t i = seq_length / 2; i < seq_length; ++i) {
+      mask_data[i] = -10000.0f;
+    }
+    core::TensorView qkv_view(qkv);
+    auto q = qkv_view[0];
+    auto k = qkv_view[1];
+    auto v = qkv_view[2];
+
+    auto att_score = common::CreateTensor<float>(
+        {batch_size, num_attention_heads, seq_length, seq_length}, kDLCPU, 0);
+    BatchMatMul(q, false, k, true, 1.0, att_score, 0.0);
+    ApplyMaskAndSoftmax(att_score, att_mask, scale);
+    auto expected = common::CreateTensor<float>(
+        {batch_size, num_attention_heads, seq_length, size_per_head}, kDLCPU,
+        0);
+    BatchMatMul(att_score, false, v, false, 1.0, expected, 0.0);
+
+    auto context = common::CreateTensor<float>(
+        {batch_size, num_attention_heads, seq_length, size_per_head}, kDLCPU,
+        0);
+    FusedAttention(q, k, v, att_mask, scale, context);
+    REQUIRE(common::CheckResultOfCPU<float>(context, expected));
+
+    // The context written directly into the merged heads.
+    auto expected_merged = common::CreateTensor<float>(
+        {batch_size, seq_length, num_attention_heads * size_per_head}, kDLCPU,
+        0);
+    TransposeForScore(expected_merged, expected);
+    auto merged = common::CreateTensor<float>(
+        {batch_size, seq_length, num_attention_heads * size_per_head}, kDLCPU,
+        0);
+    auto hidden_size = num_attention_heads * size_per_head;
+    FusedAttention(
+        q, k, v, att_mask, scale,
+        core::TensorView(merged).AsStrided(
+            {batch_size, num_attention_heads, seq_length, size_per_head},
+            {seq_length * hidden_size, size_per_head, hidden_size, 1}));
+    REQUIRE(common::CheckResultOfCPU<float>(merged, expected_merged));
+  }
+}
+
+// The context of the queries attending to the keys `attends(query, key)`.
+template <typename Attends>
+static core::Tensor NaiveMaskedAttention(const core::TensorView& q,
+                                         const core::TensorView& k,
+                                         const core::TensorView& v,
+                                         const core::Tensor& att_mask,
+                                         float scale, Attends attends) {
+  auto batch_size = q.shape(0), head_num = q.shape(1), seq_length = q.shape(2),
+       size_per_head = q.shape(3);
+  auto context = common::CreateTensor<float>(
+      {batch_size, head_num, seq_length, size_per_head}, kDLCPU, 0);
+  auto* out = context.mutableData<float>();
+  const auto* mask = att_mask.data<float>();
+  std::vector<double> scores(seq_length);
+  for (int64_t b = 0; b < batch_size; ++b) {
+    for (int64_t h = 0; h < head_num; ++h) {
+      auto row = [&](const core::TensorView& t, int64_t i) {
+        return t.data<float>() + b * t.stride(0) + h * t.stride(1) +
+               i * t.stride(2);
+      };
+      for (int64_t i = 0; i < seq_length; ++i) {
+        double max_val = -1e30, sum = 0;
+        for (int64_t j = 0; j < seq_length; ++j) {
+          if (!attends(i, j)) {
+            continue;
+          }
+          double score = 0;
+          for (int64_t d = 0; d < size_per_head; ++d) {
+            score += row(q, i)[d] * row(k, j)[d];
+          }
+          scores[j] = score * scale + mask[b * seq_length + j];
+          max_val = std::max(max_val, scores[j]);
+        }
+        auto* out_row = out + ((b * head_num + h) * seq_length + i) *
+                                  size_per_head;
+        std::vector<double> acc(size_per_head, 0);
+        for (int64_t j = 0; j < seq_length; ++j) {
+          if (!attends(i, j)) {
+            continue;
+          }
+          double prob = std::exp(scores[j] - max_val);
+          sum += prob;
+          for (int64_t d = 0; d < size_per_head; ++d) {
+            acc[d] += prob * row(v, j)[d];
+          }
+        }
+        for (int64_t d = 0; d < size_per_head; ++d) {
+          out_row[d] = static_cast<float>(acc[d] / sum);
+        }
+      }
+    }
+  }
+  return context;
+}
+
+TEST_CASE("sliding-window-attention-cpu-test") {
+  const int64_t batch_size = 2, num_attention_heads = 3, size_per_head = 16;
+  const float scale = 0.25f;
+  // A single block, and global and local blocks with partial tails.
+  for (int64_t seq_length : {10, 300}) {
+    auto qkv = common::CreateTensorAndFillRandom<float>(
+        {3, batch_size, num_attention_heads, seq_length, size_per_head},
+        kDLCPU, 0);
+    auto att_mask = common::CreateTensorAndFillRandom<float>(
+        {batch_size, 1, 1, seq_length}, kDLCPU, 0);
+    auto* mask_data = att_mask.mutableData<float>();
+    for (int64_t i = seq_length / 2; i < seq_length; ++i) {
+      mask_data[i] = -10000.0f;
+    }
+    core::TensorView qkv_view(qkv);
+    auto q = qkv_view[0];
+    auto k = qkv_view[1];
+    auto v = qkv_view[2];
+    auto context = common::CreateTensor<float>(
+        {batch_size, num_attention_heads, seq_length, size_per_head}, kDLCPU,
+        0);
+    for (int64_t window : {0, 3, 40}) {
+      for (int64_t num_global : {0, 1, 70}) {
+        if (num_global > seq_length) {
+          continue;
+        }
+        auto expected = NaiveMaskedAttention(
+            q, k, v, att_mask, scale, [&](int64_t query, int64_t key) {
+              return query < num_global || key < num_global ||
+                     std::abs(query - key) <= window;
+            });
+        SlidingWindowAttention(q, k, v, att_mask, window, num_global, scale,
+                               context);
+        REQUIRE(common::CheckResultOfCPU<float>(context, expected));
+      }
+    }
+
+    // A window spanning the sequences is the whole attention.
+    auto expected = common::CreateTensor<float>(
+        {batch_size, num_attention_heads, seq_length, size_per_head}, kDLCPU,
+        0);
+    FusedAttention(q, k, v, att_mask, scale, expected);
+    SlidingWindowAttention(q, k, v, att_mask, seq_length, 0, scale, context);
+    REQUIRE(common::CheckResultOfCPU<float>(context, expected));
+  }
+}
+
+#ifdef TT_WITH_CUDA
+TEST_CASE("fused-attention-gpu-test") {
+  const int64_t num_attention_heads = 12, size_per_head = 64;
+  const int64_t hidden_size = num_attention_heads * size_per_head;
+  const float scale = 0.125f;
+  for (int64_t batch_size : {1, 8}) {
+    // A single and several query blocks, up to the longest sequence.
+    for (int64_t seq_length : {10, 40, 128}) {
+      core::Tensor qkv_cpu(nullptr), qkv_gpu(nullptr);
+      std::tie(qkv_cpu, qkv_gpu) =
+          common::CreateAndFillRandomForCPUGPUTensors<float>(
+              {3, batch_size, num_attention_heads, seq_length, size_per_head});
+      core::Tensor mask_cpu(nullptr), mask_gpu(nullptr);
+      std::tie(mask_cpu, mask_gpu) =
+          common::CreateAndFillRandomForCPUGPUTensors<float>(
+              {batch_size, 1, 1, seq_length});
+      core::TensorView qkv_cpu_view(qkv_cpu), qkv_gpu_view(qkv_gpu);
+      auto merged_heads = [&](const core::Tensor& tensor) {
+        return core::TensorView(tensor).AsStrided(
+            {batch_size, num_attention_heads, seq_length, size_per_head},
+            {seq_length * hidden_size, size_per_head, hidden_size, 1});
+      };
+
+      auto context_cpu = common::CreateTensor<float>(
+          {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+      FusedAttention(qkv_cpu_view[0], qkv_cpu_view[1], qkv_cpu_view[2],
+                     mask_cpu, scale, merged_heads(context_cpu));
+      auto context_gpu = common::CreateTensor<float>(
+          {batch_size, seq_length, hidden_size}, kDLGPU, 0);
+      REQUIRE(IsFusedAttentionSupported(kDLGPU, seq_length, size_per_head));
+      FusedAttention(qkv_gpu_view[0], qkv_gpu_view[1], qkv_gpu_view[2],
+                     mask_gpu, scale, merged_heads(context_gpu));
+      REQUIRE(common::CheckResultOfCPUAndGPU<float>(context_cpu, context_gpu));
+
+      core::Tensor qkv_half_cpu(nullptr), qkv_half_gpu(nullptr);
+      std::tie(qkv_half_cpu, qkv_half_gpu) =
+          common::CreateAndFillRandomForCPUGPUHalfTensors(
+              {3, batch_size, num_attention_heads, seq_length, size_per_head});
+      core::TensorView qkv_half_cpu_view(qkv_half_cpu),
+          qkv_half_gpu_view(qkv_half_gpu);
+      FusedAttention(qkv_half_cpu_view[0], qkv_half_cpu_view[1],
+                     qkv_half_cpu_view[2], mask_cpu, scale,
+                     merged_heads(context_cpu));
+      auto context_half_gpu = common::CreateTensor<core::Half>(
+          {batch_size, seq_length, hidden_size}, kDLGPU, 0);
+      FusedAttention(qkv_half_gpu_view[0], qkv_half_gpu_view[1],
+                     qkv_half_gpu_view[2], mask_gpu, scale,
+                     merged_heads(context_half_gpu));
+      REQUIRE(common::CheckResultOfCPUAndGPUHalf(context_cpu,
+                                                 context_half_gpu, 1e-2f));
+    }
+  }
+  REQUIRE_FALSE(IsFusedAttentionSupported(kDLGPU, 129, 64));
+}
+
+TEST_CASE("sliding-window-attention-gpu-test") {
+  const int64_t batch_size = 2, num_attention_heads = 4, size_per_head = 64;
+  const int64_t hidden_size = num_attention_heads * size_per_head;
+  const float scale = 0.125f;
+  for (int64_t seq_length : {10, 500}) {
+    core::Tensor qkv_cpu(nullptr), qkv_gpu(nullptr);
+    std::tie(qkv_cpu, qkv_gpu) =
+        common::CreateAndFillRandomForCPUGPUTensors<float>(
+            {3, batch_size, num_attention_heads, seq_length, size_per_head});
+    core::Tensor mask_cpu(nullptr), mask_gpu(nullptr);
+    std::tie(mask_cpu, mask_gpu) =
+        common::CreateAndFillRandomForCPUGPUTensors<float>(
+            {batch_size, 1, 1, seq_length});
+    core::TensorView qkv_cpu_view(qkv_cpu), qkv_gpu_view(qkv_gpu);
+    auto merged_heads = [&](const core::Tensor& tensor) {
+      return core::TensorView(tensor).AsStrided(
+          {batch_size, num_attention_heads, seq_length, size_per_head},
+          {seq_length * hidden_size, size_per_head, hidden_size, 1});
+    };
+    for (int64_t window : {2, 64}) {
+      for (int64_t num_global : {0, 3}) {
+        auto context_cpu = common::CreateTensor<float>(
+            {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+        SlidingWindowAttention(qkv_cpu_view[0], qkv_cpu_view[1],
+                               qkv_cpu_view[2], mask_cpu, window, num_global,
+                               scale, merged_heads(context_cpu));
+        auto context_gpu = common::CreateTensor<float>(
+            {batch_size, seq_length, hidden_size}, kDLGPU, 0);
+        SlidingWindowAttention(qkv_gpu_view[0], qkv_gpu_view[1],
+                               qkv_gpu_view[2], mask_gpu, window, num_global,
+                               scale, merged_heads(context_gpu));
+        REQUIRE(
+            common::CheckResultOfCPUAndGPU<float>(context_cpu, context_gpu));
+      }
+    }
+  }
+}
+#endif
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,388 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/bf16_mat_mul.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "turbo_transformers/core/blas.h"
+#include "turbo_transformers/core/cpu_isa.h"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/profiler.h"
+#include "turbo_transformers/layers/kernels/activation.h"
+#include "turbo_transformers/layers/kernels/layer_norm.h"
+#include "turbo_transformers/layers/kernels/panel_gemm.h"
+#if defined(__GNUC__) && defined(__x86_64__) && __GNUC__ >= 11
+#include <cpuid.h>
+#include <immintrin.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define TT_WITH_BF16_KERNELS
+#endif
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+namespace {
+// The rows of the activations computed at once by the AVX512-BF16 kernel,
+// and by an AMX tile.
+constexpr int64_t kRowBlock = 4;
+constexpr int64_t kTileRows = 16;
+// The columns computed at once by both kernels, and converted back to float
+// at a time by a thread of the fallback.
+constexpr int64_t kColBlock = kBF16NAlignment;
+constexpr int64_t kPanelsPerBlock = kColBlock / kBF16PanelWidth;
+
+enum class BF16Kernel { kFallback, kAVX512, kAMX };
+
+#ifdef TT_WITH_BF16_KERNELS
+// Linux hands out the AMX tile state to the processes asking for it.
+bool RequestAMX() {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  constexpr unsigned int kAMXBF16 = 1u << 22, kAMXTile = 1u << 24;
+  if ((edx & kAMXBF16) == 0 || (edx & kAMXTile) == 0) {
+    return false;
+  }
+  constexpr long kArchReqXCompPerm = 0x1023, kXFeatureXTileData = 18;
+  return syscall(SYS_arch_prctl, kArchReqXCompPerm, kXFeatureXTileData) == 0;
+}
+#endif
+
+BF16Kernel GetBF16Kernel() {
+#ifdef TT_WITH_BF16_KERNELS
+  static const bool has_avx512_bf16 = __builtin_cpu_supports("avx512bf16");
+  static const bool has_amx = has_avx512_bf16 && RequestAMX();
+  // The kernels are AVX-512 ones, so they obey TT_CPU_ISA as well.
+  if (core::GetCPUIsa() == core::CPUIsa::kAVX512) {
+    if (has_amx) {
+      return BF16Kernel::kAMX;
+    }
+    if (has_avx512_bf16) {
+      return BF16Kernel::kAVX512;
+    }
+  }
+#endif
+  return BF16Kernel::kFallback;
+}
+
+// Returns the number of rows M of `input`.
+int64_t CheckShapes(const core::Tensor& input, const BF16Weight& weight,
+                    const core::Tensor& out) {
+  TT_ENFORCE(!weight.is_null(), "BF16MatMul error: no weight.");
+  return panel_gemm::CheckShapes("BF16MatMul", input, weight.k, weight.n,
+                                 out);
+}
+
+#ifdef TT_WITH_BF16_KERNELS
+// Rounds the rows of the float matrix [m, k] to bfloat16 [m_pad, k_pad], the
+// padding is zero.
+void ConvertRows(const float* input, int64_t m, int64_t m_pad, int64_t k,
+                 int64_t k_pad, core::BFloat16* out) {
+#pragma omp parallel for
+  for (int64_t i = 0; i < m_pad; ++i) {
+    core::BFloat16* dst = out + i * k_pad;
+    int64_t valid = i < m ? k : 0;
+    for (int64_t j = 0; j < valid; ++j) {
+      dst[j] = core::BFloat16(input[i * k + j]);
+    }
+    std::fill(dst + valid, dst + k_pad, core::BFloat16(0.f));
+  }
+}
+
+// acc[r * kColBlock + c] += sum_j x[r][j] * w[j][c] for j in [0, k_len),
+// the kRowBlock rows `x` and the kPanelsPerBlock panels starting at `w`,
+// `panel_size` elements apart. The binary is not built for a specific CPU,
+// so the kernels are compiled for their own targets and chosen at runtime.
+__attribute__((target("avx512f,avx512bf16"))) void DotBF16AVX512(
+    const core::BFloat16* const* x, const core::BFloat16* w,
+    int64_t panel_size, int64_t k_len, float* acc) {
+  static_assert(kRowBlock == 4 && kPanelsPerBlock == 4,
+                "The kernel computes 4 x 64 outputs");
+  __m512 sums[16];
+  for (int r = 0; r < 4; ++r) {
+    for (int c = 0; c < 4; ++c) {
+      sums[r * 4 + c] = _mm512_loadu_ps(acc + r * kColBlock + c * 16);
+    }
+  }
+  for (int64_t j = 0; j < k_len; j += 2) {
+    __m512bh wv[4];
+    for (int c = 0; c < 4; ++c) {
+      wv[c] = (__m512bh)_mm512_loadu_si512(w + c * panel_size + j * 16);
+    }
+    for (int r = 0; r < 4; ++r) {
+      // The pair x[r][j], x[r][j + 1] times the 16 columns of a panel.
+      int32_t pair;
+      std::memcpy(&pair, x[r] + j, sizeof(pair));
+      auto xv = (__m512bh)_mm512_set1_epi32(pair);
+      for (int c = 0; c < 4; ++c) {
+        sums[r * 4 + c] = _mm512_dpbf16_ps(sums[r * 4 + c], xv, wv[c]);
+      }
+    }
+  }
+  for (int r = 0; r < 4; ++r) {
+    for (int c = 0; c < 4; ++c) {
+      _mm512_storeu_ps(acc + r * kColBlock + c * 16, sums[r * 4 + c]);
+    }
+  }
+}
+
+// The depth of the weight blocks, whose 4 panels, 4 x 128 pairs of rows x 64
+// bytes, stay in the L1 cache while the rows of a chunk are multiplied.
+constexpr int64_t kDepthBlock = 256;
+constexpr int64_t kRowChunk = 64;
+
+void AVX512BF16Gemm(const core::BFloat16* x, const BF16Weight& weight,
+                    int64_t m, float* y) {
+  int64_t n = weight.n;
+  int64_t panel_size = weight.data.shape(1) * weight.data.shape(2);
+  int64_t k_pad = weight.data.shape(1) * 2;
+  const auto* w = weight.data.data<core::BFloat16>();
+  int64_t col_blocks = weight.data.shape(0) / kPanelsPerBlock;
+  int64_t row_chunks = (m + kRowChunk - 1) / kRowChunk;
+#pragma omp parallel for collapse(2)
+  for (int64_t b = 0; b < col_blocks; ++b) {
+    for (int64_t rc = 0; rc < row_chunks; ++rc) {
+      int64_t chunk_begin = rc * kRowChunk;
+      int64_t chunk_end = std::min(chunk_begin + kRowChunk, m);
+      float acc[kRowChunk * kColBlock] = {};
+      const core::BFloat16* panels = w + b * kPanelsPerBlock * panel_size;
+      for (int64_t depth = 0; depth < k_pad; depth += kDepthBlock) {
+        int64_t k_len = std::min(kDepthBlock, k_pad - depth);
+        for (int64_t r0 = chunk_begin; r0 < chunk_end; r0 += kRowBlock) {
+          // The last block repeats its last row instead of being special
+          // cased.
+          const core::BFloat16* rows[kRowBlock];
+          for (int64_t r = 0; r < kRowBlock; ++r) {
+            rows[r] = x + std::min(r0 + r, m - 1) * k_pad + depth;
+          }
+          DotBF16AVX512(rows, panels + depth * kBF16PanelWidth, panel_size,
+                        k_len, acc + (r0 - chunk_begin) * kColBlock);
+        }
+      }
+      int64_t col = b * kColBlock;
+      panel_gemm::StoreBlock(acc, kColBlock, chunk_begin, chunk_end, col,
+                             std::min(kColBlock, n - col), n, nullptr, y);
+    }
+  }
+}
+
+// The palette 1 configuration of the tiles: 0-3 accumulate 16 x 16 floats,
+// 4 holds 16 rows x 32 of the activations, 5 the 16 pairs of rows x 16
+// columns of a panel.
+struct alignas(64) TileConfig {
+  uint8_t palette_id{1};
+  uint8_t start_row{0};
+  uint8_t reserved[14]{};
+  uint16_t colsb[16]{};
+  uint8_t rows[16]{};
+  uint8_t reserved_rows[16]{};
+};
+
+__attribute__((target("amx-tile,amx-bf16"))) void AMXBF16Gemm(
+    const core::BFloat16* x, const BF16Weight& weight, int64_t m, float* y) {
+  static_assert(kPanelsPerBlock == 4, "The kernel accumulates 4 tiles");
+  int64_t n = weight.n;
+  int64_t k_pair_rows = weight.data.shape(1);
+  int64_t panel_size = k_pair_rows * weight.data.shape(2);
+  int64_t k_pad = k_pair_rows * 2;
+  const auto* w = weight.data.data<core::BFloat16>();
+  int64_t col_blocks = weight.data.shape(0) / kPanelsPerBlock;
+  int64_t row_blocks = (m + kTileRows - 1) / kTileRows;
+  TileConfig config;
+  for (int t = 0; t < 6; ++t) {
+    config.colsb[t] = 64;
+    config.rows[t] = kTileRows;
+  }
+#pragma omp parallel
+  {
+    // The tile configuration is a state of the thread.
+    _tile_loadconfig(&config);
+    alignas(64) float acc[kTileRows * kColBlock];
+#pragma omp for collapse(2)
+    for (int64_t b = 0; b < col_blocks; ++b) {
+      for (int64_t rb = 0; rb < row_blocks; ++rb) {
+        const core::BFloat16* a = x + rb * kTileRows * k_pad;
+        const core::BFloat16* panels = w + b * kPanelsPerBlock * panel_size;
+        _tile_zero(0);
+        _tile_zero(1);
+        _tile_zero(2);
+        _tile_zero(3);
+        for (int64_t j = 0; j < k_pad; j += kBF16KAlignment) {
+          _tile_loadd(4, a + j, k_pad * sizeof(core::BFloat16));
+          const core::BFloat16* b_tile = panels + j * kBF16PanelWidth;
+          _tile_loadd(5, b_tile, 64);
+          _tile_dpbf16ps(0, 4, 5);
+          _tile_loadd(5, b_tile + panel_size, 64);
+          _tile_dpbf16ps(1, 4, 5);
+          _tile_loadd(5, b_tile + 2 * panel_size, 64);
+          _tile_dpbf16ps(2, 4, 5);
+          _tile_loadd(5, b_tile + 3 * panel_size, 64);
+          _tile_dpbf16ps(3, 4, 5);
+        }
+        constexpr int64_t stride = kColBlock * sizeof(float);
+        _tile_stored(0, acc, stride);
+        _tile_stored(1, acc + 16, stride);
+        _tile_stored(2, acc + 32, stride);
+        _tile_stored(3, acc + 48, stride);
+        int64_t col = b * kColBlock;
+        panel_gemm::StoreBlock(
+            acc, kColBlock, rb * kTileRows,
+            std::min(rb * kTileRows + kTileRows, m), col,
+            std::min(kColBlock, n - col), n, nullptr, y);
+      }
+    }
+    _tile_release();
+  }
+}
+#endif
+
+// Converts the weight back to float kColBlock columns at a time and
+// multiplies them by cblas_sgemm. Within the parallel region, MKL and
+// OpenBLAS run the GEMM of a block on the calling thread.
+void FallbackBF16Gemm(const float* x, const BF16Weight& weight, int64_t m,
+                      float* y) {
+  int64_t k = weight.k;
+  int64_t n = weight.n;
+  int64_t panel_size = weight.data.shape(1) * weight.data.shape(2);
+  const auto* w = weight.data.data<core::BFloat16>();
+  int64_t col_blocks = weight.data.shape(0) / kPanelsPerBlock;
+#pragma omp parallel
+  {
+    std::vector<float> w_block(k * kColBlock);
+#pragma omp for schedule(dynamic)
+    for (int64_t b = 0; b < col_blocks; ++b) {
+      const core::BFloat16* panels = w + b * kPanelsPerBlock * panel_size;
+      for (int64_t j = 0; j < k; ++j) {
+        for (int64_t c = 0; c < kColBlock; ++c) {
+          w_block[j * kColBlock + c] =
+              panels[(c / kBF16PanelWidth) * panel_size +
+                     (j / 2) * 2 * kBF16PanelWidth +
+                     (c % kBF16PanelWidth) * 2 + j % 2];
+        }
+      }
+      int64_t col = b * kColBlock;
+      cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m,
+                  std::min(kColBlock, n - col), k, 1.0f, x, k, w_block.data(),
+                  kColBlock, 0.0f, y + col, n);
+    }
+  }
+}
+
+void BF16Gemm(const core::Tensor& input, const BF16Weight& weight,
+              int64_t m, core::Tensor* out) {
+  core::AddToCounter(core::Counter::kGemmFlops, 2 * m * weight.n * weight.k);
+  const auto* x = input.data<float>();
+  auto* y = out->mutableData<float>();
+  BF16Kernel kernel = GetBF16Kernel();
+  if (kernel == BF16Kernel::kFallback) {
+    FallbackBF16Gemm(x, weight, m, y);
+    return;
+  }
+#ifdef TT_WITH_BF16_KERNELS
+  // The rows are padded to whole tiles, which the AVX512-BF16 kernel ignores.
+  int64_t k_pad = weight.data.shape(1) * 2;
+  int64_t m_pad = panel_gemm::AlignUp(m, kTileRows);
+  core::Tensor bf16_input(nullptr);
+  auto* x_bf16 =
+      bf16_input.Reshape<core::BFloat16>({m_pad, k_pad}, kDLCPU, 0);
+  ConvertRows(x, m, m_pad, weight.k, k_pad, x_bf16);
+  if (kernel == BF16Kernel::kAMX) {
+    AMXBF16Gemm(x_bf16, weight, m, y);
+  } else {
+    AVX512BF16Gemm(x_bf16, weight, m, y);
+  }
+#endif
+}
+}  // namespace
+
+BF16Weight ConvertWeightToBF16(const core::TensorView& weight) {
+  TT_ENFORCE_EQ(weight.n_dim(), 2, "The weight must be a matrix.");
+  TT_ENFORCE(weight.device_type() == kDLCPU && weight.IsType<float>(),
+             "Only float CPU weights can be converted to bfloat16.");
+  BF16Weight result;
+  result.k = weight.shape(0);
+  result.n = weight.shape(1);
+  int64_t k_pad = panel_gemm::AlignUp(result.k, kBF16KAlignment);
+  int64_t n_pad = panel_gemm::AlignUp(result.n, kBF16NAlignment);
+  auto* data = result.data.Reshape<core::BFloat16>(
+      {n_pad / kBF16PanelWidth, k_pad / 2, 2 * kBF16PanelWidth}, kDLCPU, 0);
+  const float* w = weight.data<float>();
+  int64_t k_stride = weight.stride(0);
+  int64_t n_stride = weight.stride(1);
+#pragma omp parallel for
+  for (int64_t p = 0; p < n_pad / kBF16PanelWidth; ++p) {
+    core::BFloat16* panel = data + p * k_pad * kBF16PanelWidth;
+    for (int64_t j = 0; j < k_pad; ++j) {
+      for (int64_t c = 0; c < kBF16PanelWidth; ++c) {
+        int64_t col = p * kBF16PanelWidth + c;
+        float value = j < result.k && col < result.n
+                          ? w[j * k_stride + col * n_stride]
+                          : 0.f;
+        panel[(j / 2) * 2 * kBF16PanelWidth + c * 2 + j % 2] =
+            core::BFloat16(value);
+      }
+    }
+  }
+  return result;
+}
+
+void BF16MatMul(const core::Tensor& input, const BF16Weight& weight,
+                core::Tensor* out) {
+  core::ProfileScope profile_scope("BF16MatMul", input);
+  int64_t m = CheckShapes(input, weight, *out);
+  BF16Gemm(input, weight, m, out);
+}
+
+template <types::ActivationType ActType>
+void BF16MatMulBiasAct(const core::Tensor& input, const BF16Weight& weight,
+                       const core::Tensor& bias, core::Tensor* out) {
+  core::ProfileScope profile_scope("BF16MatMulBiasAct", input);
+  int64_t m = CheckShapes(input, weight, *out);
+  TT_ENFORCE_EQ(bias.numel(), weight.n, "The bias and weight mismatch.");
+  BF16Gemm(input, weight, m, out);
+  AddBiasAct<float, ActType>(bias, out);
+}
+
+template void BF16MatMulBiasAct<types::ActivationType::Gelu>(
+    const core::Tensor& input, const BF16Weight& weight,
+    const core::Tensor& bias, core::Tensor* out);
+template void BF16MatMulBiasAct<types::ActivationType::Tanh>(
+    const core::Tensor& input, const BF16Weight& weight,
+    const core::Tensor& bias, core::Tensor* out);
+template void BF16MatMulBiasAct<types::ActivationType::Identity>(
+    const core::Tensor& input, const BF16Weight& weight,
+    const core::Tensor& bias, core::Tensor* out);
+
+void BF16MatMulAddBiasLayerNorm(const core::Tensor& input,
+                                const BF16Weight& weight,
+                                const core::Tensor& residual,
+                                const core::Tensor& bias,
+                                const core::Tensor& gamma,
+                                const core::Tensor& beta, core::Tensor* out) {
+  core::ProfileScope profile_scope("BF16MatMulAddBiasLayerNorm", input);
+  int64_t m = CheckShapes(input, weight, *out);
+  TT_ENFORCE_EQ(residual.numel(), out->numel(),
+                "The residual and out mismatch.");
+  TT_ENFORCE_EQ(bias.numel(), weight.n, "The bias and weight mismatch.");
+  BF16Gemm(input, weight, m, out);
+  AddBiasLayerNorm<float>(residual, bias, gamma, beta, out);
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
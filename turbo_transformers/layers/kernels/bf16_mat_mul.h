@@ -0,0 +1,77 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cstdint>
+
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/tensor_view.h"
+#include "turbo_transformers/layers/types.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// The bfloat16 weight of `out = input * weight` on the CPU, which halves the
+// bytes a GEMM reads from memory. The columns are split into panels of
+// kBF16PanelWidth, and a panel stores the pairs of rows k, k + 1 of its
+// columns next to each other, the layout the AVX512-BF16 dot products and
+// the AMX tiles take, i.e. weight[k][n] ~= data[n / 16][k / 2][n % 16][k % 2].
+// K is padded with zeros to a multiple of kBF16KAlignment, N to a multiple
+// of kBF16NAlignment.
+struct BF16Weight {
+  core::Tensor data{nullptr};  // core::BFloat16, [N_pad / 16, K_pad / 2, 32]
+  int64_t k{0};
+  int64_t n{0};
+
+  bool is_null() const { return data.is_null(); }
+};
+
+constexpr int64_t kBF16PanelWidth = 16;
+constexpr int64_t kBF16KAlignment = 32;
+constexpr int64_t kBF16NAlignment = 64;
+
+// Rounds the float CPU `weight` [K, N], which may be strided, to bfloat16.
+extern BF16Weight ConvertWeightToBF16(const core::TensorView& weight);
+
+// out = input * weight for the float `input` [..., K] and the dense float
+// `out` of M * N elements. The products are accumulated in float. On CPUs
+// with AMX, the inputs are rounded to bfloat16 as well and multiplied on the
+// tiles, several times faster than cblas_sgemm. With AVX512-BF16 only, they
+// are multiplied by its dot products, which compute at the rate of float
+// FMAs, so only the GEMMs of few rows, bound by the weights they read, gain.
+// Elsewhere, the weight is converted back to float a block of columns at a
+// time, which stays in the cache of the thread, and multiplied by
+// cblas_sgemm.
+extern void BF16MatMul(const core::Tensor& input, const BF16Weight& weight,
+                       core::Tensor* out);
+
+// out = Act(input * weight + bias).
+template <types::ActivationType ActType>
+extern void BF16MatMulBiasAct(const core::Tensor& input,
+                              const BF16Weight& weight,
+                              const core::Tensor& bias, core::Tensor* out);
+
+// out = LayerNorm(input * weight + bias + residual) with the layer norm
+// parameters `gamma` and `beta`, normalized in float.
+extern void BF16MatMulAddBiasLayerNorm(const core::Tensor& input,
+                                       const BF16Weight& weight,
+                                       const core::Tensor& residual,
+                                       const core::Tensor& bias,
+                                       const core::Tensor& gamma,
+                                       const core::Tensor& beta,
+                                       core::Tensor* out);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,108 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/bf16_mat_mul.h"
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/core/cpu_isa.h"
+#include "turbo_transformers/layers/kernels/activation.h"
+#include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/kernels/layer_norm.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// The 8 bit mantissas of bfloat16 are compared up to 2% of the largest
+// reference value.
+static constexpr float kTolerance = 0.02f;
+
+// The AVX512-BF16 kernel if the CPU has it, and the float fallback.
+static std::vector<core::CPUIsa> BF16TestIsas() {
+  std::vector<core::CPUIsa> isas{core::CPUIsa::kScalar};
+  if (core::GetCPUIsa() == core::CPUIsa::kAVX512) {
+    isas.push_back(core::CPUIsa::kAVX512);
+  }
+  return isas;
+}
+
+TEST_CASE("bf16-matmul-cpu") {
+  auto selected = core::GetCPUIsa();
+  for (auto isa : BF16TestIsas()) {
+    core::SetCPUIsa(isa);
+    // K and N are not multiples of the padding.
+    for (int64_t m : {1, 7}) {
+      for (int64_t k : {32, 100}) {
+        for (int64_t n : {4, 30, 130}) {
+          core::Tensor input = common::CreateTensorAndFillUniform({m, k});
+          core::Tensor weight = common::CreateTensorAndFillUniform({k, n});
+          auto bf16_weight = ConvertWeightToBF16(weight);
+
+          core::Tensor expected =
+              common::CreateTensor<float>({m, n}, kDLCPU, 0);
+          MatMul(input, false, weight, false, 1.0, expected, 0.0);
+          core::Tensor out = common::CreateTensor<float>({m, n}, kDLCPU, 0);
+          BF16MatMul(input, bf16_weight, &out);
+          REQUIRE(common::CheckResultOfCPUWithin(out, expected, kTolerance));
+        }
+      }
+    }
+  }
+  core::SetCPUIsa(selected);
+}
+
+TEST_CASE("bf16-matmul-bias-act-cpu") {
+  const int64_t batch = 2, seq = 5, k = 128, n = 48;
+  core::Tensor input = common::CreateTensorAndFillUniform({batch, seq, k});
+  core::Tensor weight = common::CreateTensorAndFillUniform({k, n});
+  core::Tensor bias = common::CreateTensorAndFillUniform({n});
+  auto bf16_weight = ConvertWeightToBF16(weight);
+
+  core::Tensor expected = common::CreateTensor<float>({batch, seq, n}, kDLCPU,
+                                                      0);
+  MatMul(input, false, weight, false, 1.0, expected, 0.0);
+  AddBiasAct<float, types::ActivationType::Gelu>(bias, &expected);
+
+  core::Tensor out = common::CreateTensor<float>({batch, seq, n}, kDLCPU, 0);
+  BF16MatMulBiasAct<types::ActivationType::Gelu>(input, bf16_weight, bias,
+                                                 &out);
+  REQUIRE(common::CheckResultOfCPUWithin(out, expected, kTolerance));
+
+  core::Tensor wrong_out = common::CreateTensor<float>({batch, n}, kDLCPU, 0);
+  REQUIRE_THROWS(BF16MatMul(input, bf16_weight, &wrong_out));
+}
+
+TEST_CASE("bf16-matmul-add-bias-layer-norm-cpu") {
+  const int64_t m = 6, k = 96, n = 40;
+  core::Tensor input = common::CreateTensorAndFillUniform({m, k});
+  core::Tensor weight = common::CreateTensorAndFillUniform({k, n});
+  core::Tensor residual = common::CreateTensorAndFillUniform({m, n});
+  core::Tensor bias = common::CreateTensorAndFillUniform({n});
+  core::Tensor gamma = common::CreateTensorAndFillUniform({n});
+  core::Tensor beta = common::CreateTensorAndFillUniform({n});
+  auto bf16_weight = ConvertWeightToBF16(weight);
+
+  core::Tensor expected = common::CreateTensor<float>({m, n}, kDLCPU, 0);
+  MatMul(input, false, weight, false, 1.0, expected, 0.0);
+  AddBiasLayerNorm<float>(residual, bias, gamma, beta, &expected);
+
+  core::Tensor out = common::CreateTensor<float>({m, n}, kDLCPU, 0);
+  BF16MatMulAddBiasLayerNorm(input, bf16_weight, residual, bias, gamma, beta,
+                             &out);
+  REQUIRE(common::CheckResultOfCPUWithin(out, expected, kTolerance));
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
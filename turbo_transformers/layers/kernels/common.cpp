@@ -13,6 +13,14 @@
 
 #include "common.h"
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+#ifdef TT_WITH_CUDA
+#include "turbo_transformers/core/cuda_device_context.h"
+#endif
+
 namespace turbo_transformers {
 namespace layers {
 namespace kernels {
@@ -35,12 +43,13 @@ bool is_same_shape(const core::Tensor& t1, const core::Tensor& t2) {
 }
 
 template <typename T>
-void Sequence(T* data, int64_t size, DLDeviceType device) {
+void Sequence(T* data, int64_t size, DLDeviceType device, int device_id) {
   if (device == kDLCPU) {
     std::iota(data, data + size, static_cast<T>(0));
   } else if (device == kDLGPU) {
 #ifdef TT_WITH_CUDA
-    turbo_transformers::layers::kernels::GPUSequence(data, size);
+    turbo_transformers::layers::kernels::GPUSequence(
+        data, size, core::CUDADeviceContext::GetInstance(device_id).stream());
 #else
     TT_THROW("code is not compiled with CUDA.");
 #endif
@@ -48,16 +57,20 @@ void Sequence(T* data, int64_t size, DLDeviceType device) {
     TT_THROW("device_type is not supported");
   }
 }
-template void Sequence(float* data, int64_t size, DLDeviceType device);
-template void Sequence(int64_t* data, int64_t size, DLDeviceType device);
+template void Sequence(float* data, int64_t size, DLDeviceType device,
+                       int device_id);
+template void Sequence(int64_t* data, int64_t size, DLDeviceType device,
+                       int device_id);
 
 template <typename T>
-void Fill(T* data, int64_t size, T val, DLDeviceType device) {
+void Fill(T* data, int64_t size, T val, DLDeviceType device, int device_id) {
   if (device == kDLCPU) {
     std::fill(data, data + size, val);
   } else if (device == kDLGPU) {
 #ifdef TT_WITH_CUDA
-    layers::kernels::GPUFill(data, size, val);
+    layers::kernels::GPUFill(
+        data, size, val,
+        core::CUDADeviceContext::GetInstance(device_id).stream());
 #else
     TT_THROW("code is not compiled with CUDA.");
 #endif
@@ -67,20 +80,57 @@ void Fill(T* data, int64_t size, T val, DLDeviceType device) {
 }
 
 template void Fill<float>(float* data, int64_t size, float val,
-                          DLDeviceType device);
+                          DLDeviceType device, int device_id);
 template void Fill<int64_t>(int64_t* data, int64_t size, int64_t val,
-                            DLDeviceType device);
+                            DLDeviceType device, int device_id);
+template void Fill<uint16_t>(uint16_t* data, int64_t size, uint16_t val,
+                             DLDeviceType device, int device_id);
+
+// The GPU fills the halfs by their bits, core::Half is not known to nvcc.
+template <>
+void Fill<core::Half>(core::Half* data, int64_t size, core::Half val,
+                      DLDeviceType device, int device_id) {
+  if (device == kDLCPU) {
+    std::fill(data, data + size, val);
+    return;
+  }
+  uint16_t bits;
+  static_assert(sizeof(bits) == sizeof(val), "A half takes 16 bits");
+  std::memcpy(&bits, &val, sizeof(bits));
+  Fill<uint16_t>(reinterpret_cast<uint16_t*>(data), size, bits, device,
+                 device_id);
+}
 
 // TODO(jiaruifang): this function should better pass a function in.
 // how can we pass a lambda function as __device__ to cuda?
 void Transform(int64_t* src_data, float* dst_data, int64_t size,
-               DLDeviceType device) {
+               DLDeviceType device, int device_id) {
   if (device == kDLCPU) {
     std::transform(src_data, src_data + size, dst_data,
                    [](int64_t v) { return -10000.0f * (1 - v); });
   } else if (device == kDLGPU) {
 #ifdef TT_WITH_CUDA
-    layers::kernels::GPUTransform(src_data, dst_data, size);
+    layers::kernels::GPUTransform(
+        src_data, dst_data, size,
+        core::CUDADeviceContext::GetInstance(device_id).stream());
+#else
+    TT_THROW("code is not compiled with CUDA.");
+#endif
+  } else {
+    TT_THROW("device_type is not supported");
+  }
+}
+
+void Accumulate(const float* src_data, float* dst_data, int64_t size,
+                DLDeviceType device, int device_id) {
+  if (device == kDLCPU) {
+    std::transform(src_data, src_data + size, dst_data, dst_data,
+                   std::plus<float>());
+  } else if (device == kDLGPU) {
+#ifdef TT_WITH_CUDA
+    layers::kernels::GPUAccumulate(
+        src_data, dst_data, size,
+        core::CUDADeviceContext::GetInstance(device_id).stream());
 #else
     TT_THROW("code is not compiled with CUDA.");
 #endif
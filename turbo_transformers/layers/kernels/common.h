@@ -14,6 +14,11 @@
 #pragma once
 #include <dlpack/dlpack.h>
 
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+
 #include "turbo_transformers/core/tensor.h"
 #include "turbo_transformers/core/tensor_copy.h"
 #ifdef TT_WITH_CUDA
@@ -37,16 +42,26 @@ extern bool is_same_device_ctx(DLContext t1, DLContext t2);
 
 extern bool is_same_shape(const core::Tensor& t1, const core::Tensor& t2);
 
+// On the GPU, the following run on the current stream of `device_id`.
 template <typename T>
-void Sequence(T* data, int64_t size, DLDeviceType device);
+void Sequence(T* data, int64_t size, DLDeviceType device, int device_id = 0);
 
 template <typename T>
-void Fill(T* data, int64_t size, T val, DLDeviceType device);
+void Fill(T* data, int64_t size, T val, DLDeviceType device,
+          int device_id = 0);
+template <>
+void Fill<core::Half>(core::Half* data, int64_t size, core::Half val,
+                      DLDeviceType device, int device_id);
 
 // TODO(jiaruifang): this function should better pass a function in.
 // how can we pass a lambda function as __device__ to cuda?
 void Transform(int64_t* src_data, float* dst_data, int64_t size,
-               DLDeviceType device);
+               DLDeviceType device, int device_id = 0);
+
+// dst_data += src_data, e.g. to sum the partial outputs of the shards of a
+// tensor-parallel layer.
+void Accumulate(const float* src_data, float* dst_data, int64_t size,
+                DLDeviceType device, int device_id = 0);
 
 template <typename T>
 void FillRandom(core::Tensor& tensor) {
@@ -81,7 +96,7 @@ core::Tensor CreateTensorAndFillConstant(std::initializer_list<int64_t> shape,
                                          T value) {
   core::Tensor tensor = CreateTensor<T>(shape, dev_type, dev_id);
   layers::kernels::common::Fill<T>(tensor.mutableData<T>(), tensor.numel(),
-                                   value, dev_type);
+                                   value, dev_type, dev_id);
   return tensor;
 }
 
@@ -98,6 +113,22 @@ core::Tensor CreateTensorAndFillRandom(std::initializer_list<int64_t> shape,
   return cpu_tensor;
 }
 
+// A float tensor on the CPU, uniform in [low, high). Unlike RandomFillHost,
+// whose values are positive and seeded by the time, the values take both
+// signs and the seed is fixed, so the tolerance of a test comparing a kernel
+// of reduced precision does not depend on the time of the run.
+inline core::Tensor CreateTensorAndFillUniform(
+    std::initializer_list<int64_t> shape, float low = -1.f, float high = 1.f) {
+  static std::mt19937 generator(0);
+  std::uniform_real_distribution<float> distribution(low, high);
+  core::Tensor tensor = CreateTensor<float>(shape, kDLCPU, 0);
+  auto* data = tensor.mutableData<float>();
+  for (int64_t i = 0; i < tensor.numel(); ++i) {
+    data[i] = distribution(generator);
+  }
+  return tensor;
+}
+
 #ifdef TT_WITH_CUDA
 template <typename T>
 std::tuple<core::Tensor, core::Tensor> CreateAndFillRandomForCPUGPUTensors(
@@ -129,6 +160,48 @@ bool CheckResultOfCPUAndGPU(const core::Tensor& cpu_tensor,
   }
   return ret;
 }
+
+// A float tensor on the CPU and its half copy on the GPU. The CPU values are
+// rounded to half as well, so both hold the same inputs.
+inline std::tuple<core::Tensor, core::Tensor>
+CreateAndFillRandomForCPUGPUHalfTensors(std::initializer_list<int64_t> shape) {
+  core::Tensor cpu_tensor = CreateTensor<float>(shape, kDLCPU, 0);
+  core::Tensor half_tensor = CreateTensor<core::Half>(shape, kDLCPU, 0);
+  core::Tensor gpu_tensor = CreateTensor<core::Half>(shape, kDLGPU, 0);
+  auto* cpu_data = cpu_tensor.mutableData<float>();
+  auto* half_data = half_tensor.mutableData<core::Half>();
+  RandomFillHost(cpu_data, cpu_tensor.numel());
+  for (int64_t i = 0; i < cpu_tensor.numel(); ++i) {
+    half_data[i] = core::Half(cpu_data[i]);
+    cpu_data[i] = static_cast<float>(half_data[i]);
+  }
+  core::Copy<core::Half>(half_tensor, gpu_tensor);
+  return std::make_tuple(std::move(cpu_tensor), std::move(gpu_tensor));
+}
+
+// Compares the half `gpu_tensor` with the float `cpu_tensor` up to the
+// relative error `tolerance`.
+inline bool CheckResultOfCPUAndGPUHalf(const core::Tensor& cpu_tensor,
+                                       const core::Tensor& gpu_tensor,
+                                       float tolerance) {
+  TT_ENFORCE(layers::kernels::common::is_same_shape(cpu_tensor, gpu_tensor),
+             "The shape of the inputs is not equal.");
+  const float* cpu_data = cpu_tensor.data<float>();
+  core::Tensor tmp_tensor =
+      CreateTensor<core::Half>({gpu_tensor.numel()}, kDLCPU, 0);
+  core::Copy<core::Half>(gpu_tensor, tmp_tensor);
+  const core::Half* gpu_data_ref = tmp_tensor.data<core::Half>();
+  for (int64_t i = 0; i < gpu_tensor.numel(); ++i) {
+    float gpu_val = static_cast<float>(gpu_data_ref[i]);
+    if (std::abs(gpu_val - cpu_data[i]) >
+        tolerance * std::max(1.0f, std::abs(cpu_data[i]))) {
+      std::cerr << "@ " << i << ": " << gpu_val << " vs " << cpu_data[i]
+                << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
 #endif
 
 template <typename T>
@@ -150,6 +223,30 @@ bool CheckResultOfCPU(const core::Tensor& cpu_tensor_lhs,
   return ret;
 }
 
+// Compares the float CPU tensors up to `tolerance` times the largest
+// magnitude of `expected`, e.g. the results of the int8, bfloat16 or half
+// kernels with those of the float ones.
+inline bool CheckResultOfCPUWithin(const core::Tensor& out,
+                                   const core::Tensor& expected,
+                                   float tolerance) {
+  TT_ENFORCE(layers::kernels::common::is_same_shape(out, expected),
+             "The shape of the inputs is not equal.");
+  const float* out_data = out.data<float>();
+  const float* expected_data = expected.data<float>();
+  float max_abs = 0;
+  for (int64_t i = 0; i < expected.numel(); ++i) {
+    max_abs = std::max(max_abs, std::abs(expected_data[i]));
+  }
+  for (int64_t i = 0; i < expected.numel(); ++i) {
+    if (std::abs(out_data[i] - expected_data[i]) > tolerance * max_abs) {
+      std::cerr << "@ " << i << ": " << out_data[i] << " vs "
+                << expected_data[i] << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
 }  // namespace common
 }  // namespace kernels
 }  // namespace layers
@@ -0,0 +1,231 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/cpu_vector_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+// Clang ignores `#pragma GCC target`, so it only builds the portable kernels.
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+#include <immintrin.h>
+#define TT_WITH_X86_VECTOR_KERNELS
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define TT_WITH_NEON_VECTOR_KERNELS
+#endif
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+namespace {
+// The Cephes approximation of exp, within 2 ulps on the clamped range.
+constexpr float kExpMin = -87.f;
+constexpr float kExpMax = 88.f;
+constexpr float kLog2e = 1.44269504088896341f;
+constexpr float kLn2Hi = 0.693359375f;
+constexpr float kLn2Lo = -2.12194440e-4f;
+constexpr float kExpP0 = 1.9875691500e-4f;
+constexpr float kExpP1 = 1.3981999507e-3f;
+constexpr float kExpP2 = 8.3334519073e-3f;
+constexpr float kExpP3 = 4.1665795894e-2f;
+constexpr float kExpP4 = 1.6666665459e-1f;
+constexpr float kExpP5 = 5.0000001201e-1f;
+
+// tanh(x) = x * P(x^2) / Q(x^2) as approximated by Eigen, within a few ulps
+// of tanh. It saturates to +-1 beyond kTanhClamp.
+constexpr float kTanhClamp = 7.90531110763549805f;
+constexpr float kTanhAlpha1 = 4.89352455891786e-03f;
+constexpr float kTanhAlpha3 = 6.37261928875436e-04f;
+constexpr float kTanhAlpha5 = 1.48572235717979e-05f;
+constexpr float kTanhAlpha7 = 5.12229709037114e-08f;
+constexpr float kTanhAlpha9 = -8.60467152213735e-11f;
+constexpr float kTanhAlpha11 = 2.00018790482477e-13f;
+constexpr float kTanhAlpha13 = -2.76076847742355e-16f;
+constexpr float kTanhBeta0 = 4.89352518554385e-03f;
+constexpr float kTanhBeta2 = 2.26843463243900e-03f;
+constexpr float kTanhBeta4 = 1.18534705686654e-04f;
+constexpr float kTanhBeta6 = 1.19825839466702e-06f;
+
+// gelu(x) = 0.5 * x * (1 + tanh(sqrt(2 / pi) * (x + 0.044715 * x^3)))
+constexpr float kGeluScale = 0.7978845608028654f;
+constexpr float kGeluCubic = 0.044715f;
+
+namespace scalar {
+struct Vec {
+  using Reg = float;
+  static constexpr int64_t kWidth = 1;
+
+  static Reg Load(const float *p) { return *p; }
+  static void Store(float *p, Reg v) { *p = v; }
+  static Reg Set(float x) { return x; }
+  static Reg Add(Reg a, Reg b) { return a + b; }
+  static Reg Sub(Reg a, Reg b) { return a - b; }
+  static Reg Mul(Reg a, Reg b) { return a * b; }
+  static Reg Div(Reg a, Reg b) { return a / b; }
+  // a * b + c
+  static Reg Fma(Reg a, Reg b, Reg c) { return a * b + c; }
+  static Reg Max(Reg a, Reg b) { return std::max(a, b); }
+  static Reg Min(Reg a, Reg b) { return std::min(a, b); }
+  static Reg Round(Reg x) { return std::nearbyint(x); }
+  // 2^n for an integral n in the range of normal floats.
+  static Reg Pow2(Reg n) {
+    int32_t bits = (static_cast<int32_t>(n) + 127) << 23;
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+  }
+  static float ReduceSum(Reg v) { return v; }
+  static float ReduceMax(Reg v) { return v; }
+};
+
+#include "turbo_transformers/layers/kernels/cpu_vector_kernels_impl.h"
+}  // namespace scalar
+
+#ifdef TT_WITH_X86_VECTOR_KERNELS
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+namespace avx2 {
+struct Vec {
+  using Reg = __m256;
+  static constexpr int64_t kWidth = 8;
+
+  static Reg Load(const float *p) { return _mm256_loadu_ps(p); }
+  static void Store(float *p, Reg v) { _mm256_storeu_ps(p, v); }
+  static Reg Set(float x) { return _mm256_set1_ps(x); }
+  static Reg Add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+  static Reg Sub(Reg a, Reg b) { return _mm256_sub_ps(a, b); }
+  static Reg Mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+  static Reg Div(Reg a, Reg b) { return _mm256_div_ps(a, b); }
+  static Reg Fma(Reg a, Reg b, Reg c) { return _mm256_fmadd_ps(a, b, c); }
+  static Reg Max(Reg a, Reg b) { return _mm256_max_ps(a, b); }
+  static Reg Min(Reg a, Reg b) { return _mm256_min_ps(a, b); }
+  static Reg Round(Reg x) {
+    return _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  }
+  static Reg Pow2(Reg n) {
+    __m256i exponent =
+        _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(exponent, 23));
+  }
+  static float ReduceSum(Reg v) {
+    __m128 x = _mm_add_ps(_mm256_castps256_ps128(v),
+                          _mm256_extractf128_ps(v, 1));
+    x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    x = _mm_add_ss(x, _mm_movehdup_ps(x));
+    return _mm_cvtss_f32(x);
+  }
+  static float ReduceMax(Reg v) {
+    __m128 x = _mm_max_ps(_mm256_castps256_ps128(v),
+                          _mm256_extractf128_ps(v, 1));
+    x = _mm_max_ps(x, _mm_movehl_ps(x, x));
+    x = _mm_max_ss(x, _mm_movehdup_ps(x));
+    return _mm_cvtss_f32(x);
+  }
+};
+
+#include "turbo_transformers/layers/kernels/cpu_vector_kernels_impl.h"
+}  // namespace avx2
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+namespace avx512 {
+struct Vec {
+  using Reg = __m512;
+  static constexpr int64_t kWidth = 16;
+
+  static Reg Load(const float *p) { return _mm512_loadu_ps(p); }
+  static void Store(float *p, Reg v) { _mm512_storeu_ps(p, v); }
+  static Reg Set(float x) { return _mm512_set1_ps(x); }
+  static Reg Add(Reg a, Reg b) { return _mm512_add_ps(a, b); }
+  static Reg Sub(Reg a, Reg b) { return _mm512_sub_ps(a, b); }
+  static Reg Mul(Reg a, Reg b) { return _mm512_mul_ps(a, b); }
+  static Reg Div(Reg a, Reg b) { return _mm512_div_ps(a, b); }
+  static Reg Fma(Reg a, Reg b, Reg c) { return _mm512_fmadd_ps(a, b, c); }
+  static Reg Max(Reg a, Reg b) { return _mm512_max_ps(a, b); }
+  static Reg Min(Reg a, Reg b) { return _mm512_min_ps(a, b); }
+  static Reg Round(Reg x) {
+    return _mm512_roundscale_ps(x,
+                                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  }
+  static Reg Pow2(Reg n) {
+    __m512i exponent =
+        _mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(exponent, 23));
+  }
+  static float ReduceSum(Reg v) { return _mm512_reduce_add_ps(v); }
+  static float ReduceMax(Reg v) { return _mm512_reduce_max_ps(v); }
+};
+
+#include "turbo_transformers/layers/kernels/cpu_vector_kernels_impl.h"
+}  // namespace avx512
+#pragma GCC pop_options
+#endif
+
+#ifdef TT_WITH_NEON_VECTOR_KERNELS
+namespace neon {
+struct Vec {
+  using Reg = float32x4_t;
+  static constexpr int64_t kWidth = 4;
+
+  static Reg Load(const float *p) { return vld1q_f32(p); }
+  static void Store(float *p, Reg v) { vst1q_f32(p, v); }
+  static Reg Set(float x) { return vdupq_n_f32(x); }
+  static Reg Add(Reg a, Reg b) { return vaddq_f32(a, b); }
+  static Reg Sub(Reg a, Reg b) { return vsubq_f32(a, b); }
+  static Reg Mul(Reg a, Reg b) { return vmulq_f32(a, b); }
+  static Reg Div(Reg a, Reg b) { return vdivq_f32(a, b); }
+  static Reg Fma(Reg a, Reg b, Reg c) { return vfmaq_f32(c, a, b); }
+  static Reg Max(Reg a, Reg b) { return vmaxq_f32(a, b); }
+  static Reg Min(Reg a, Reg b) { return vminq_f32(a, b); }
+  static Reg Round(Reg x) { return vrndnq_f32(x); }
+  static Reg Pow2(Reg n) {
+    int32x4_t exponent = vaddq_s32(vcvtq_s32_f32(n), vdupq_n_s32(127));
+    return vreinterpretq_f32_s32(vshlq_n_s32(exponent, 23));
+  }
+  static float ReduceSum(Reg v) { return vaddvq_f32(v); }
+  static float ReduceMax(Reg v) { return vmaxvq_f32(v); }
+};
+
+#include "turbo_transformers/layers/kernels/cpu_vector_kernels_impl.h"
+}  // namespace neon
+#endif
+}  // namespace
+
+const CPUVectorKernels &GetCPUVectorKernels(core::CPUIsa isa) {
+  switch (isa) {
+    case core::CPUIsa::kAVX512:
+#ifdef TT_WITH_X86_VECTOR_KERNELS
+      return avx512::kKernels;
+#endif
+      // Fall through to the next ISA if this one is not compiled.
+    case core::CPUIsa::kAVX2:
+#ifdef TT_WITH_X86_VECTOR_KERNELS
+      return avx2::kKernels;
+#endif
+    case core::CPUIsa::kNEON:
+#ifdef TT_WITH_NEON_VECTOR_KERNELS
+      return neon::kKernels;
+#endif
+    case core::CPUIsa::kScalar:
+      break;
+  }
+  return scalar::kKernels;
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,63 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cstdint>
+
+#include "turbo_transformers/core/cpu_isa.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// The row primitives of the CPU kernels, explicitly vectorized for each
+// core::CPUIsa. All pointers are float rows of n elements.
+struct CPUVectorKernels {
+  // x = x * scale + add, returns max(x).
+  float (*scale_add_max)(float *x, float scale, const float *add, int64_t n);
+  // x = exp(x - offset), returns sum(x).
+  float (*exp_sum)(float *x, float offset, int64_t n);
+  // x = x * alpha
+  void (*scale)(float *x, float alpha, int64_t n);
+  // out = a + b, `out` may be `a` or `b`.
+  void (*add)(const float *a, const float *b, int64_t n, float *out);
+  // out = max(a, b), `out` may be `a` or `b`.
+  void (*maximum)(const float *a, const float *b, int64_t n, float *out);
+  // out = LayerNorm(out + residual + bias) * gamma + beta, where residual
+  // and bias are either both given or both null.
+  void (*layer_norm)(float *out, const float *residual, const float *bias,
+                     const float *gamma, const float *beta, float epsilon,
+                     int64_t n);
+  // out = gelu(out + bias), with the tanh approximation of gelu.
+  void (*add_bias_gelu)(const float *bias, int64_t n, float *out);
+  // out = tanh(out + bias)
+  void (*add_bias_tanh)(const float *bias, int64_t n, float *out);
+  // out = alpha * x * w + beta * out for the row x of k elements and the row
+  // major w [k, n], whose rows are `ldw` apart. `out` is not read if beta is
+  // 0.
+  void (*gemv)(const float *x, const float *w, int64_t ldw, int64_t k,
+               float alpha, float beta, int64_t n, float *out);
+};
+
+// The kernels of the best ISA compiled into the binary which is not above
+// `isa`.
+const CPUVectorKernels &GetCPUVectorKernels(core::CPUIsa isa);
+
+// The kernels of core::GetCPUIsa().
+inline const CPUVectorKernels &GetCPUVectorKernels() {
+  return GetCPUVectorKernels(core::GetCPUIsa());
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,299 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+// The generic implementation of CPUVectorKernels. It has no include guard on
+// purpose: cpu_vector_kernels.cpp includes it once per ISA, inside a
+// namespace which defines `Vec`, the vector type of the ISA, while the ISA is
+// enabled for the compiled code. The elements beyond the last whole vector of
+// a row are computed by the functions of the namespace `scalar`.
+// NOLINT(build/header_guard)
+
+using Reg = Vec::Reg;
+
+inline int64_t VectorPart(int64_t n) { return n - n % Vec::kWidth; }
+
+inline Reg Exp(Reg x) {
+  x = Vec::Min(Vec::Max(x, Vec::Set(kExpMin)), Vec::Set(kExpMax));
+  // exp(x) = 2^n * exp(r), where n = round(x / ln2) and |r| <= ln2 / 2.
+  Reg n = Vec::Round(Vec::Mul(x, Vec::Set(kLog2e)));
+  Reg r = Vec::Fma(n, Vec::Set(-kLn2Hi), x);
+  r = Vec::Fma(n, Vec::Set(-kLn2Lo), r);
+  Reg p = Vec::Set(kExpP0);
+  p = Vec::Fma(p, r, Vec::Set(kExpP1));
+  p = Vec::Fma(p, r, Vec::Set(kExpP2));
+  p = Vec::Fma(p, r, Vec::Set(kExpP3));
+  p = Vec::Fma(p, r, Vec::Set(kExpP4));
+  p = Vec::Fma(p, r, Vec::Set(kExpP5));
+  Reg exp_r = Vec::Fma(Vec::Mul(r, r), p, Vec::Add(r, Vec::Set(1.f)));
+  return Vec::Mul(exp_r, Vec::Pow2(n));
+}
+
+inline Reg Tanh(Reg x) {
+  x = Vec::Min(Vec::Max(x, Vec::Set(-kTanhClamp)), Vec::Set(kTanhClamp));
+  Reg x2 = Vec::Mul(x, x);
+  Reg p = Vec::Set(kTanhAlpha13);
+  p = Vec::Fma(p, x2, Vec::Set(kTanhAlpha11));
+  p = Vec::Fma(p, x2, Vec::Set(kTanhAlpha9));
+  p = Vec::Fma(p, x2, Vec::Set(kTanhAlpha7));
+  p = Vec::Fma(p, x2, Vec::Set(kTanhAlpha5));
+  p = Vec::Fma(p, x2, Vec::Set(kTanhAlpha3));
+  p = Vec::Fma(p, x2, Vec::Set(kTanhAlpha1));
+  Reg q = Vec::Set(kTanhBeta6);
+  q = Vec::Fma(q, x2, Vec::Set(kTanhBeta4));
+  q = Vec::Fma(q, x2, Vec::Set(kTanhBeta2));
+  q = Vec::Fma(q, x2, Vec::Set(kTanhBeta0));
+  return Vec::Div(Vec::Mul(x, p), q);
+}
+
+inline Reg Gelu(Reg x) {
+  Reg inner = Vec::Mul(
+      x, Vec::Fma(Vec::Mul(x, x), Vec::Set(kGeluCubic), Vec::Set(1.f)));
+  Reg half_x = Vec::Mul(x, Vec::Set(0.5f));
+  Reg t = Tanh(Vec::Mul(inner, Vec::Set(kGeluScale)));
+  return Vec::Fma(half_x, t, half_x);
+}
+
+float ScaleAddMax(float *x, float scale, const float *add, int64_t n) {
+  int64_t n_vec = VectorPart(n);
+  Reg max_val = Vec::Set(std::numeric_limits<float>::lowest());
+  for (int64_t j = 0; j < n_vec; j += Vec::kWidth) {
+    Reg v = Vec::Fma(Vec::Load(x + j), Vec::Set(scale), Vec::Load(add + j));
+    Vec::Store(x + j, v);
+    max_val = Vec::Max(max_val, v);
+  }
+  float result = Vec::ReduceMax(max_val);
+  for (int64_t j = n_vec; j < n; ++j) {
+    x[j] = x[j] * scale + add[j];
+    result = std::max(result, x[j]);
+  }
+  return result;
+}
+
+float ExpSum(float *x, float offset, int64_t n) {
+  int64_t n_vec = VectorPart(n);
+  Reg sum = Vec::Set(0.f);
+  for (int64_t j = 0; j < n_vec; j += Vec::kWidth) {
+    Reg v = Exp(Vec::Sub(Vec::Load(x + j), Vec::Set(offset)));
+    Vec::Store(x + j, v);
+    sum = Vec::Add(sum, v);
+  }
+  float result = Vec::ReduceSum(sum);
+  for (int64_t j = n_vec; j < n; ++j) {
+    x[j] = scalar::Exp(x[j] - offset);
+    result += x[j];
+  }
+  return result;
+}
+
+void Scale(float *x, float alpha, int64_t n) {
+  int64_t n_vec = VectorPart(n);
+  for (int64_t j = 0; j < n_vec; j += Vec::kWidth) {
+    Vec::Store(x + j, Vec::Mul(Vec::Load(x + j), Vec::Set(alpha)));
+  }
+  for (int64_t j = n_vec; j < n; ++j) {
+    x[j] *= alpha;
+  }
+}
+
+void Add(const float *a, const float *b, int64_t n, float *out) {
+  int64_t n_vec = VectorPart(n);
+  for (int64_t j = 0; j < n_vec; j += Vec::kWidth) {
+    Vec::Store(out + j, Vec::Add(Vec::Load(a + j), Vec::Load(b + j)));
+  }
+  for (int64_t j = n_vec; j < n; ++j) {
+    out[j] = a[j] + b[j];
+  }
+}
+
+void Maximum(const float *a, const float *b, int64_t n, float *out) {
+  int64_t n_vec = VectorPart(n);
+  for (int64_t j = 0; j < n_vec; j += Vec::kWidth) {
+    Vec::Store(out + j, Vec::Max(Vec::Load(a + j), Vec::Load(b + j)));
+  }
+  for (int64_t j = n_vec; j < n; ++j) {
+    out[j] = std::max(a[j], b[j]);
+  }
+}
+
+// Adds the residual and the bias to a vector of the row, if any, and the
+// vector to the sums of the row.
+template <bool kAddResidual>
+inline void AccumulateLayerNorm(float *out, const float *residual,
+                                const float *bias, Reg *sum, Reg *square_sum) {
+  Reg v = Vec::Load(out);
+  if (kAddResidual) {
+    v = Vec::Add(v, Vec::Add(Vec::Load(residual), Vec::Load(bias)));
+    Vec::Store(out, v);
+  }
+  *sum = Vec::Add(*sum, v);
+  *square_sum = Vec::Fma(v, v, *square_sum);
+}
+
+// The sums run over four vectors at a time, so their additions do not wait
+// on one another. A kN > 0 is the width of the rows, known at compile time:
+// the loops lose their tails and their trip counts are constant.
+template <int64_t kN, bool kAddResidual>
+void LayerNormImpl(float *out, const float *residual, const float *bias,
+                   const float *gamma, const float *beta, float epsilon,
+                   int64_t n) {
+  constexpr int64_t kBlock = 4 * Vec::kWidth;
+  if (kN > 0) {
+    n = kN;
+  }
+  int64_t n_block = n - n % kBlock;
+  int64_t n_vec = VectorPart(n);
+  Reg sum0 = Vec::Set(0.f), sum1 = sum0, sum2 = sum0, sum3 = sum0;
+  Reg square_sum0 = sum0, square_sum1 = sum0, square_sum2 = sum0,
+      square_sum3 = sum0;
+  for (int64_t j = 0; j < n_block; j += kBlock) {
+    AccumulateLayerNorm<kAddResidual>(out + j, residual + j, bias + j, &sum0,
+                                      &square_sum0);
+    int64_t j1 = j + Vec::kWidth, j2 = j1 + Vec::kWidth, j3 = j2 + Vec::kWidth;
+    AccumulateLayerNorm<kAddResidual>(out + j1, residual + j1, bias + j1,
+                                      &sum1, &square_sum1);
+    AccumulateLayerNorm<kAddResidual>(out + j2, residual + j2, bias + j2,
+                                      &sum2, &square_sum2);
+    AccumulateLayerNorm<kAddResidual>(out + j3, residual + j3, bias + j3,
+                                      &sum3, &square_sum3);
+  }
+  for (int64_t j = n_block; j < n_vec; j += Vec::kWidth) {
+    AccumulateLayerNorm<kAddResidual>(out + j, residual + j, bias + j, &sum0,
+                                      &square_sum0);
+  }
+  float mean =
+      Vec::ReduceSum(Vec::Add(Vec::Add(sum0, sum1), Vec::Add(sum2, sum3)));
+  float var = Vec::ReduceSum(Vec::Add(Vec::Add(square_sum0, square_sum1),
+                                      Vec::Add(square_sum2, square_sum3)));
+  for (int64_t j = n_vec; j < n; ++j) {
+    if (kAddResidual) {
+      out[j] += residual[j] + bias[j];
+    }
+    mean += out[j];
+    var += out[j] * out[j];
+  }
+  mean = mean / n;
+  var = var / n - mean * mean;
+  float rstd = 1.f / std::sqrt(var + epsilon);
+  for (int64_t j = 0; j < n_vec; j += Vec::kWidth) {
+    Reg normed = Vec::Mul(Vec::Sub(Vec::Load(out + j), Vec::Set(mean)),
+                          Vec::Set(rstd));
+    Vec::Store(out + j, Vec::Fma(normed, Vec::Load(gamma + j),
+                                 Vec::Load(beta + j)));
+  }
+  for (int64_t j = n_vec; j < n; ++j) {
+    out[j] = beta[j] + gamma[j] * rstd * (out[j] - mean);
+  }
+}
+
+template <bool kAddResidual>
+void LayerNormOfWidth(float *out, const float *residual, const float *bias,
+                      const float *gamma, const float *beta, float epsilon,
+                      int64_t n) {
+  // The hidden sizes of BERT-base, BERT-large and GPT-2-large.
+  switch (n) {
+    case 768:
+      return LayerNormImpl<768, kAddResidual>(out, residual, bias, gamma, beta,
+                                              epsilon, n);
+    case 1024:
+      return LayerNormImpl<1024, kAddResidual>(out, residual, bias, gamma,
+                                               beta, epsilon, n);
+    case 1280:
+      return LayerNormImpl<1280, kAddResidual>(out, residual, bias, gamma,
+                                               beta, epsilon, n);
+    default:
+      return LayerNormImpl<0, kAddResidual>(out, residual, bias, gamma, beta,
+                                            epsilon, n);
+  }
+}
+
+void LayerNorm(float *out, const float *residual, const float *bias,
+               const float *gamma, const float *beta, float epsilon,
+               int64_t n) {
+  if (residual != nullptr) {
+    LayerNormOfWidth<true>(out, residual, bias, gamma, beta, epsilon, n);
+  } else {
+    LayerNormOfWidth<false>(out, residual, bias, gamma, beta, epsilon, n);
+  }
+}
+
+void AddBiasGelu(const float *bias, int64_t n, float *out) {
+  int64_t n_vec = VectorPart(n);
+  for (int64_t j = 0; j < n_vec; j += Vec::kWidth) {
+    Vec::Store(out + j,
+               Gelu(Vec::Add(Vec::Load(out + j), Vec::Load(bias + j))));
+  }
+  for (int64_t j = n_vec; j < n; ++j) {
+    out[j] = scalar::Gelu(out[j] + bias[j]);
+  }
+}
+
+void AddBiasTanh(const float *bias, int64_t n, float *out) {
+  int64_t n_vec = VectorPart(n);
+  for (int64_t j = 0; j < n_vec; j += Vec::kWidth) {
+    Vec::Store(out + j,
+               Tanh(Vec::Add(Vec::Load(out + j), Vec::Load(bias + j))));
+  }
+  for (int64_t j = n_vec; j < n; ++j) {
+    out[j] = scalar::Tanh(out[j] + bias[j]);
+  }
+}
+
+inline void StoreGemv(float *out, Reg acc, float alpha, float beta) {
+  Reg v = Vec::Mul(acc, Vec::Set(alpha));
+  if (beta != 0.f) {
+    v = Vec::Fma(Vec::Load(out), Vec::Set(beta), v);
+  }
+  Vec::Store(out, v);
+}
+
+void Gemv(const float *x, const float *w, int64_t ldw, int64_t k, float alpha,
+          float beta, int64_t n, float *out) {
+  // Four vectors of columns at a time, so the loads of a row of w overlap
+  // with the FMAs of the previous vectors.
+  constexpr int64_t kBlock = 4 * Vec::kWidth;
+  int64_t n_block = n - n % kBlock;
+  for (int64_t j = 0; j < n_block; j += kBlock) {
+    Reg acc0 = Vec::Set(0.f), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+    for (int64_t i = 0; i < k; ++i) {
+      Reg xi = Vec::Set(x[i]);
+      const float *row = w + i * ldw + j;
+      acc0 = Vec::Fma(xi, Vec::Load(row), acc0);
+      acc1 = Vec::Fma(xi, Vec::Load(row + Vec::kWidth), acc1);
+      acc2 = Vec::Fma(xi, Vec::Load(row + 2 * Vec::kWidth), acc2);
+      acc3 = Vec::Fma(xi, Vec::Load(row + 3 * Vec::kWidth), acc3);
+    }
+    StoreGemv(out + j, acc0, alpha, beta);
+    StoreGemv(out + j + Vec::kWidth, acc1, alpha, beta);
+    StoreGemv(out + j + 2 * Vec::kWidth, acc2, alpha, beta);
+    StoreGemv(out + j + 3 * Vec::kWidth, acc3, alpha, beta);
+  }
+  int64_t n_vec = VectorPart(n);
+  for (int64_t j = n_block; j < n_vec; j += Vec::kWidth) {
+    Reg acc = Vec::Set(0.f);
+    for (int64_t i = 0; i < k; ++i) {
+      acc = Vec::Fma(Vec::Set(x[i]), Vec::Load(w + i * ldw + j), acc);
+    }
+    StoreGemv(out + j, acc, alpha, beta);
+  }
+  for (int64_t j = n_vec; j < n; ++j) {
+    float acc = 0.f;
+    for (int64_t i = 0; i < k; ++i) {
+      acc += x[i] * w[i * ldw + j];
+    }
+    out[j] = alpha * acc + (beta != 0.f ? beta * out[j] : 0.f);
+  }
+}
+
+const CPUVectorKernels kKernels = {ScaleAddMax, ExpSum,      Scale,
+                                   Add,         Maximum,     LayerNorm,
+                                   AddBiasGelu, AddBiasTanh, Gemv};
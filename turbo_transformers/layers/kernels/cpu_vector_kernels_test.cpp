@@ -0,0 +1,163 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+#include "turbo_transformers/layers/kernels/cpu_vector_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "catch2/catch.hpp"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+static std::vector<float> RandomRow(int64_t n, float low, float high) {
+  std::vector<float> row(n);
+  for (auto& x : row) {
+    x = low + (high - low) * rand() / RAND_MAX;
+  }
+  return row;
+}
+
+static float MaxRelativeError(const std::vector<float>& out,
+                              const std::vector<float>& expected) {
+  float max_error = 0;
+  for (size_t i = 0; i < out.size(); ++i) {
+    max_error = std::max(max_error, std::abs(out[i] - expected[i]) /
+                                        std::max(1.f, std::abs(expected[i])));
+  }
+  return max_error;
+}
+
+static float Gelu(float x) {
+  return 0.5f * x *
+         (1.f + std::tanh(0.7978845608028654f * (x + 0.044715f * x * x * x)));
+}
+
+TEST_CASE("cpu-vector-kernels") {
+  for (auto isa : {core::CPUIsa::kScalar, core::CPUIsa::kNEON,
+                   core::CPUIsa::kAVX2, core::CPUIsa::kAVX512}) {
+    if (!core::IsCPUIsaSupported(isa)) {
+      continue;
+    }
+    INFO("isa: " << core::CPUIsaName(isa));
+    auto& vector_kernels = GetCPUVectorKernels(isa);
+    // Shorter than a vector, with and without a tail, and the hidden sizes
+    // with kernels of their own.
+    for (int64_t n : {1, 7, 16, 100, 768, 1024, 1280}) {
+      INFO("n: " << n);
+      auto x = RandomRow(n, -20.f, 20.f);
+      auto add = RandomRow(n, -1.f, 1.f);
+
+      auto out = x;
+      std::vector<float> expected(n);
+      float expected_max = -1e30f;
+      for (int64_t j = 0; j < n; ++j) {
+        expected[j] = x[j] * 0.5f + add[j];
+        expected_max = std::max(expected_max, expected[j]);
+      }
+      REQUIRE(vector_kernels.scale_add_max(out.data(), 0.5f, add.data(), n) ==
+              Approx(expected_max));
+      REQUIRE(MaxRelativeError(out, expected) < 1e-6f);
+
+      out = x;
+      float expected_sum = 0;
+      for (int64_t j = 0; j < n; ++j) {
+        expected[j] = std::exp(x[j] - 10.f);
+        expected_sum += expected[j];
+      }
+      REQUIRE(vector_kernels.exp_sum(out.data(), 10.f, n) ==
+              Approx(expected_sum).epsilon(1e-5));
+      REQUIRE(MaxRelativeError(out, expected) < 1e-5f);
+
+      out = x;
+      vector_kernels.scale(out.data(), 0.25f, n);
+      vector_kernels.add(out.data(), add.data(), n, out.data());
+      for (int64_t j = 0; j < n; ++j) {
+        expected[j] = x[j] * 0.25f + add[j];
+      }
+      REQUIRE(MaxRelativeError(out, expected) < 1e-6f);
+
+      vector_kernels.maximum(x.data(), add.data(), n, out.data());
+      for (int64_t j = 0; j < n; ++j) {
+        expected[j] = std::max(x[j], add[j]);
+      }
+      REQUIRE(out == expected);
+
+      out = x;
+      vector_kernels.add_bias_gelu(add.data(), n, out.data());
+      for (int64_t j = 0; j < n; ++j) {
+        expected[j] = Gelu(x[j] + add[j]);
+      }
+      REQUIRE(MaxRelativeError(out, expected) < 1e-5f);
+
+      out = x;
+      vector_kernels.add_bias_tanh(add.data(), n, out.data());
+      for (int64_t j = 0; j < n; ++j) {
+        expected[j] = std::tanh(x[j] + add[j]);
+      }
+      REQUIRE(MaxRelativeError(out, expected) < 1e-5f);
+
+      auto residual = RandomRow(n, -1.f, 1.f);
+      auto gamma = RandomRow(n, 0.5f, 1.5f);
+      auto beta = RandomRow(n, -1.f, 1.f);
+      for (bool add_residual : {false, true}) {
+        out = x;
+        float mean = 0, var = 0;
+        for (int64_t j = 0; j < n; ++j) {
+          expected[j] = x[j] + (add_residual ? residual[j] + add[j] : 0.f);
+          mean += expected[j];
+        }
+        mean /= n;
+        for (int64_t j = 0; j < n; ++j) {
+          var += (expected[j] - mean) * (expected[j] - mean);
+        }
+        var /= n;
+        for (int64_t j = 0; j < n; ++j) {
+          expected[j] = (expected[j] - mean) / std::sqrt(var + 1e-12f) *
+                            gamma[j] +
+                        beta[j];
+        }
+        vector_kernels.layer_norm(
+            out.data(), add_residual ? residual.data() : nullptr,
+            add_residual ? add.data() : nullptr, gamma.data(), beta.data(),
+            1e-12f, n);
+        REQUIRE(MaxRelativeError(out, expected) < 1e-4f);
+      }
+
+      // A strided [k, n] weight, accumulated into out and written anew.
+      const int64_t k = 33, ldw = n + 3;
+      auto w = RandomRow(k * ldw, -1.f, 1.f);
+      auto v = RandomRow(k, -1.f, 1.f);
+      for (float beta : {0.f, 0.5f}) {
+        out = x;
+        for (int64_t j = 0; j < n; ++j) {
+          float acc = 0;
+          for (int64_t i = 0; i < k; ++i) {
+            acc += v[i] * w[i * ldw + j];
+          }
+          expected[j] = 2.f * acc + beta * x[j];
+        }
+        vector_kernels.gemv(v.data(), w.data(), ldw, k, 2.f, beta, n,
+                            out.data());
+        REQUIRE(MaxRelativeError(out, expected) < 1e-5f);
+      }
+    }
+  }
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,175 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/embedding.h"
+
+#include <algorithm>
+
+#include "turbo_transformers/core/config.h"
+#include "turbo_transformers/core/profiler.h"
+#include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/kernels/cpu_vector_kernels.h"
+#ifdef TT_WITH_CUDA
+#include "turbo_transformers/core/cuda_device_context.h"
+#include "turbo_transformers/layers/kernels/gpu_embedding_kernel.h"
+#endif
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+namespace {
+// core::Half is only supported by the GPU kernels.
+template <typename T>
+void CPUEmbeddingLayerNorm(T* out, const T* word_embeddings,
+                           const T* position_embeddings,
+                           const T* token_type_embeddings,
+                           const int64_t* input_ids,
+                           const int64_t* position_ids,
+                           const int64_t* token_type_ids, const T* gamma,
+                           const T* beta, int64_t num_ids, int64_t seq_len,
+                           int64_t hidden_size, float epsilon) {
+  TT_THROW("The CPU embedding only supports float.");
+}
+
+template <>
+void CPUEmbeddingLayerNorm<float>(
+    float* out, const float* word_embeddings, const float* position_embeddings,
+    const float* token_type_embeddings, const int64_t* input_ids,
+    const int64_t* position_ids, const int64_t* token_type_ids,
+    const float* gamma, const float* beta, int64_t num_ids, int64_t seq_len,
+    int64_t hidden_size, float epsilon) {
+  auto layer_norm = GetCPUVectorKernels().layer_norm;
+  // A row reads three embeddings and writes the output.
+  int n_th = core::ParallelThreadsFor(4 * num_ids * hidden_size);
+#pragma omp parallel for num_threads(n_th) if (n_th > 1)
+  for (int64_t i = 0; i < num_ids; ++i) {
+    int64_t position = position_ids == nullptr ? i % seq_len : position_ids[i];
+    const float* word = word_embeddings + input_ids[i] * hidden_size;
+    float* dst = out + i * hidden_size;
+    std::copy(word, word + hidden_size, dst);
+    // The row stays in the cache while the other two are added and it is
+    // normalized.
+    layer_norm(dst, token_type_embeddings + token_type_ids[i] * hidden_size,
+               position_embeddings + position * hidden_size, gamma, beta,
+               epsilon, hidden_size);
+  }
+}
+
+void EnforceIdsInRange(const core::Tensor& ids, int64_t size,
+                       const char* name) {
+  if (ids.device_type() != kDLCPU) {
+    return;
+  }
+  const int64_t* data = ids.data<int64_t>();
+  for (int64_t i = 0; i < ids.numel(); ++i) {
+    TT_ENFORCE(data[i] >= 0 && data[i] < size,
+               "The %s id %d is out of the range [0, %d).", name, data[i],
+               size);
+  }
+}
+}  // namespace
+
+template <typename T>
+void LookupEmbeddingLayerNorm(const core::Tensor& input_ids,
+                              const core::Tensor& position_ids,
+                              const core::Tensor& token_type_ids,
+                              const core::Tensor& word_embeddings,
+                              const core::Tensor& position_embeddings,
+                              const core::Tensor& token_type_embeddings,
+                              const core::Tensor& gamma,
+                              const core::Tensor& beta, core::Tensor* output,
+                              float epsilon) {
+  core::ProfileScope profile_scope("LookupEmbeddingLayerNorm", input_ids);
+  TT_ENFORCE_EQ(
+      input_ids.n_dim(), 2,
+      "The input ids should be a matrix with shape [BatchSize, SeqLen].");
+  auto batch_size = input_ids.shape(0);
+  auto seq_len = input_ids.shape(1);
+  auto hidden_size = word_embeddings.shape(1);
+  auto num_ids = input_ids.numel();
+  for (auto* ids : {&position_ids, &token_type_ids}) {
+    if (ids->is_null()) {
+      continue;
+    }
+    TT_ENFORCE_EQ(ids->numel(), num_ids,
+                  "The position and token type ids should have the shape of "
+                  "the input ids.");
+    TT_ENFORCE_EQ(common::is_same_device_ctx(input_ids.device_ctx(),
+                                             ids->device_ctx()),
+                  true,
+                  "The ids should have the same device type and device id.");
+  }
+  TT_ENFORCE(!token_type_ids.is_null(), "The token type ids are missing.");
+  TT_ENFORCE_EQ(common::is_same_device_ctx(input_ids.device_ctx(),
+                                           word_embeddings.device_ctx()),
+                true,
+                "The ids and the embedding tables should have the same "
+                "device type and device id.");
+
+  EnforceIdsInRange(input_ids, word_embeddings.shape(0), "word");
+  EnforceIdsInRange(token_type_ids, token_type_embeddings.shape(0),
+                    "token type");
+  if (position_ids.is_null()) {
+    TT_ENFORCE_LE(seq_len, position_embeddings.shape(0),
+                  "The sequences are longer than the %d positions.",
+                  position_embeddings.shape(0));
+  } else {
+    EnforceIdsInRange(position_ids, position_embeddings.shape(0), "position");
+  }
+
+  output->Reshape<T>({batch_size, seq_len, hidden_size},
+                     input_ids.device_type(), input_ids.device_id());
+  const int64_t* position_ids_ptr =
+      position_ids.is_null() ? nullptr : position_ids.data<int64_t>();
+  if (input_ids.device_type() == kDLCPU) {
+    CPUEmbeddingLayerNorm<T>(
+        output->mutableData<T>(), word_embeddings.data<T>(),
+        position_embeddings.data<T>(), token_type_embeddings.data<T>(),
+        input_ids.data<int64_t>(), position_ids_ptr,
+        token_type_ids.data<int64_t>(), gamma.data<T>(), beta.data<T>(),
+        num_ids, seq_len, hidden_size, epsilon);
+  } else if (input_ids.device_type() == kDLGPU) {
+#ifdef TT_WITH_CUDA
+    auto& cuda_ctx = core::CUDADeviceContext::GetInstance(output->device_id());
+    GPUEmbeddingLayerNorm<T>(
+        output->mutableData<T>(), word_embeddings.data<T>(),
+        position_embeddings.data<T>(), token_type_embeddings.data<T>(),
+        input_ids.data<int64_t>(), position_ids_ptr,
+        token_type_ids.data<int64_t>(), gamma.data<T>(), beta.data<T>(),
+        word_embeddings.shape(0), num_ids, seq_len, hidden_size, epsilon,
+        cuda_ctx.stream());
+#else
+    TT_THROW("The current code is not compiled with CUDA.");
+#endif
+  } else {
+    TT_THROW("device_type %d is not supported for the embedding",
+             input_ids.device_type());
+  }
+}
+
+template void LookupEmbeddingLayerNorm<float>(
+    const core::Tensor& input_ids, const core::Tensor& position_ids,
+    const core::Tensor& token_type_ids, const core::Tensor& word_embeddings,
+    const core::Tensor& position_embeddings,
+    const core::Tensor& token_type_embeddings, const core::Tensor& gamma,
+    const core::Tensor& beta, core::Tensor* output, float epsilon);
+template void LookupEmbeddingLayerNorm<core::Half>(
+    const core::Tensor& input_ids, const core::Tensor& position_ids,
+    const core::Tensor& token_type_ids, const core::Tensor& word_embeddings,
+    const core::Tensor& position_embeddings,
+    const core::Tensor& token_type_embeddings, const core::Tensor& gamma,
+    const core::Tensor& beta, core::Tensor* output, float epsilon);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
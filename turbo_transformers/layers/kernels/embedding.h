@@ -0,0 +1,43 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/layers/kernels/layer_norm.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// The BERT embedding of [batch_size, seq_len] tokens,
+//   output = LayerNorm(word_embeddings[input_ids] +
+//                      position_embeddings[position_ids] +
+//                      token_type_embeddings[token_type_ids]),
+// computed in a single pass: the three rows of a token are summed and
+// normalized before the output row is written. If position_ids is null, the
+// position of a token is its index in its sequence. The ids are int64 on the
+// device of the tables, the output has the data type T of the tables.
+template <typename T>
+void LookupEmbeddingLayerNorm(const core::Tensor& input_ids,
+                              const core::Tensor& position_ids,
+                              const core::Tensor& token_type_ids,
+                              const core::Tensor& word_embeddings,
+                              const core::Tensor& position_embeddings,
+                              const core::Tensor& token_type_embeddings,
+                              const core::Tensor& gamma,
+                              const core::Tensor& beta, core::Tensor* output,
+                              float epsilon = kLayerNormEpsilon);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,153 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/embedding.h"
+
+#include <cmath>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/layers/kernels/common.h"
+#ifdef TT_WITH_CUDA
+#include "turbo_transformers/core/cuda_device_context.h"
+#endif
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+static core::Tensor CreateIds(std::initializer_list<int64_t> shape,
+                              int64_t size, DLDeviceType dev_type) {
+  auto ids = common::CreateTensor<int64_t>(shape, kDLCPU, 0);
+  for (int64_t i = 0; i < ids.numel(); ++i) {
+    ids.mutableData<int64_t>()[i] = rand() % size;
+  }
+  if (dev_type == kDLGPU) {
+    auto gpu_ids = common::CreateTensor<int64_t>(shape, dev_type, 0);
+    core::Copy<int64_t>(ids, gpu_ids);
+    return gpu_ids;
+  }
+  return ids;
+}
+
+TEST_CASE("embedding-layer-norm-cpu-test") {
+  int64_t batch_size = 2, seq_len = 5, vocab_size = 30, n_positions = 8;
+  for (int64_t hidden_size : {20, 768}) {
+    auto word = common::CreateTensorAndFillRandom<float>(
+        {vocab_size, hidden_size}, kDLCPU, 0);
+    auto position = common::CreateTensorAndFillRandom<float>(
+        {n_positions, hidden_size}, kDLCPU, 0);
+    auto token_type =
+        common::CreateTensorAndFillRandom<float>({2, hidden_size}, kDLCPU, 0);
+    auto gamma =
+        common::CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+    auto beta =
+        common::CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+    auto input_ids = CreateIds({batch_size, seq_len}, vocab_size, kDLCPU);
+    auto token_type_ids = CreateIds({batch_size, seq_len}, 2, kDLCPU);
+    auto position_ids = CreateIds({batch_size, seq_len}, n_positions, kDLCPU);
+    core::Tensor no_position_ids(nullptr);
+
+    for (bool given_positions : {true, false}) {
+      core::Tensor output(nullptr);
+      LookupEmbeddingLayerNorm<float>(
+          input_ids, given_positions ? position_ids : no_position_ids,
+          token_type_ids, word, position, token_type, gamma, beta, &output);
+      REQUIRE(output.shape(2) == hidden_size);
+
+      float max_error = 0;
+      for (int64_t i = 0; i < batch_size * seq_len; ++i) {
+        int64_t pos = given_positions ? position_ids.data<int64_t>()[i]
+                                      : i % seq_len;
+        std::vector<double> x(hidden_size);
+        double mean = 0, var = 0;
+        for (int64_t j = 0; j < hidden_size; ++j) {
+          x[j] = word.data<float>()[input_ids.data<int64_t>()[i] * hidden_size +
+                                    j] +
+                 position.data<float>()[pos * hidden_size + j] +
+                 token_type.data<float>()
+                     [token_type_ids.data<int64_t>()[i] * hidden_size + j];
+          mean += x[j];
+        }
+        mean /= hidden_size;
+        for (int64_t j = 0; j < hidden_size; ++j) {
+          var += (x[j] - mean) * (x[j] - mean);
+        }
+        var /= hidden_size;
+        for (int64_t j = 0; j < hidden_size; ++j) {
+          double expected = (x[j] - mean) / std::sqrt(var + 1e-12) *
+                                gamma.data<float>()[j] +
+                            beta.data<float>()[j];
+          max_error = std::max(
+              max_error, static_cast<float>(std::abs(
+                             output.data<float>()[i * hidden_size + j] -
+                             expected)));
+        }
+      }
+      REQUIRE(max_error < 1e-4f);
+    }
+
+    input_ids.mutableData<int64_t>()[3] = vocab_size;
+    core::Tensor output(nullptr);
+    REQUIRE_THROWS(LookupEmbeddingLayerNorm<float>(
+        input_ids, position_ids, token_type_ids, word, position, token_type,
+        gamma, beta, &output));
+  }
+}
+
+#ifdef TT_WITH_CUDA
+TEST_CASE("embedding-layer-norm-gpu-test") {
+  // The tokens leave the last block partial, and the hidden size of 30 is
+  // loaded one element at a time instead of by packs.
+  int64_t batch_size = 3, seq_len = 41, vocab_size = 100, n_positions = 64;
+  for (int64_t hidden_size : {20, 30, 768, 4096}) {
+    core::Tensor word_cpu(nullptr), word_gpu(nullptr), position_cpu(nullptr),
+        position_gpu(nullptr), token_type_cpu(nullptr), token_type_gpu(nullptr),
+        gamma_cpu(nullptr), gamma_gpu(nullptr), beta_cpu(nullptr),
+        beta_gpu(nullptr);
+    std::tie(word_cpu, word_gpu) =
+        common::CreateAndFillRandomForCPUGPUTensors<float>(
+            {vocab_size, hidden_size});
+    std::tie(position_cpu, position_gpu) =
+        common::CreateAndFillRandomForCPUGPUTensors<float>(
+            {n_positions, hidden_size});
+    std::tie(token_type_cpu, token_type_gpu) =
+        common::CreateAndFillRandomForCPUGPUTensors<float>({2, hidden_size});
+    std::tie(gamma_cpu, gamma_gpu) =
+        common::CreateAndFillRandomForCPUGPUTensors<float>({hidden_size});
+    std::tie(beta_cpu, beta_gpu) =
+        common::CreateAndFillRandomForCPUGPUTensors<float>({hidden_size});
+    auto input_ids = CreateIds({batch_size, seq_len}, vocab_size, kDLCPU);
+    auto token_type_ids = CreateIds({batch_size, seq_len}, 2, kDLCPU);
+    auto input_ids_gpu = common::CreateTensor<int64_t>({batch_size, seq_len},
+                                                       kDLGPU, 0);
+    auto token_type_ids_gpu = common::CreateTensor<int64_t>(
+        {batch_size, seq_len}, kDLGPU, 0);
+    core::Copy<int64_t>(input_ids, input_ids_gpu);
+    core::Copy<int64_t>(token_type_ids, token_type_ids_gpu);
+
+    core::Tensor output_cpu(nullptr), output_gpu(nullptr);
+    LookupEmbeddingLayerNorm<float>(
+        input_ids, core::Tensor(nullptr), token_type_ids, word_cpu,
+        position_cpu, token_type_cpu, gamma_cpu, beta_cpu, &output_cpu);
+    LookupEmbeddingLayerNorm<float>(
+        input_ids_gpu, core::Tensor(nullptr), token_type_ids_gpu, word_gpu,
+        position_gpu, token_type_gpu, gamma_gpu, beta_gpu, &output_gpu);
+    REQUIRE(common::CheckResultOfCPUAndGPU<float>(output_cpu, output_gpu));
+  }
+}
+#endif
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
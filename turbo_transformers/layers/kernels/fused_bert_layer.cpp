@@ -0,0 +1,122 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/fused_bert_layer.h"
+
+#include <atomic>
+#include <cstdlib>
+
+#include "turbo_transformers/core/config.h"
+#ifdef TT_WITH_CUDA
+#include "turbo_transformers/core/cuda_device_context.h"
+#include "turbo_transformers/layers/kernels/gpu_fused_bert_layer_kernel.h"
+#endif
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+namespace {
+std::atomic<bool>& FusedBertLayerEnabled() {
+  static std::atomic<bool> enabled([] {
+    const char* env = std::getenv("TT_FUSED_BERT_LAYER");
+    return env != nullptr && std::atoi(env) != 0;
+  }());
+  return enabled;
+}
+}  // namespace
+
+bool IsFusedBertLayerEnabled() {
+  return FusedBertLayerEnabled().load(std::memory_order_relaxed);
+}
+
+void EnableFusedBertLayer(bool enable) {
+  FusedBertLayerEnabled().store(enable, std::memory_order_relaxed);
+}
+
+bool IsFusedBertLayerSupported(const core::Tensor& input,
+                               int64_t size_per_head) {
+#ifdef TT_WITH_CUDA
+  return IsFusedBertLayerEnabled() && input.device_type() == kDLGPU &&
+         input.IsType<float>() && input.n_dim() == 3 &&
+         input.shape(0) * input.shape(1) <= kGPUFusedBertLayerMaxTokens &&
+         size_per_head <= kGPUFusedBertLayerMaxHeadSize &&
+         IsGPUFusedBertLayerSupported(input.device_id());
+#else
+  return false;
+#endif
+}
+
+int64_t FusedBertLayerScratchSize(const core::Tensor& input,
+                                  const FusedBertLayerWeights& weights) {
+#ifdef TT_WITH_CUDA
+  return GPUFusedBertLayerScratchSize(
+      input.shape(0) * input.shape(1), input.shape(2),
+      weights.intermediate_weight->shape(1), weights.qkv_weight->shape(1) / 3);
+#else
+  TT_THROW("The current code is not compiled with CUDA.");
+#endif
+}
+
+bool FusedBertLayer(const core::Tensor& input,
+                    const core::Tensor& attention_mask,
+                    const FusedBertLayerWeights& weights,
+                    core::Tensor* scratch, core::Tensor* output,
+                    float epsilon) {
+  auto batch_size = input.shape(0);
+  auto seq_length = input.shape(1);
+  auto size_per_head =
+      weights.qkv_weight->shape(1) / 3 / weights.num_attention_heads;
+  TT_ENFORCE(IsFusedBertLayerSupported(input, size_per_head),
+             "The fused layer does not take %d x %d tokens of heads of %d",
+             batch_size, seq_length, size_per_head);
+  TT_ENFORCE(attention_mask.IsType<float>() &&
+                 attention_mask.numel() == batch_size * seq_length,
+             "The attention mask should be float (batch_size, 1, 1, "
+             "seq_length)");
+  TT_ENFORCE(scratch->IsType<float>() &&
+                 scratch->numel() >= FusedBertLayerScratchSize(input, weights),
+             "The scratch memory of the fused layer is too small");
+#ifdef TT_WITH_CUDA
+  auto hidden_size = input.shape(2);
+  auto intermediate_size = weights.intermediate_weight->shape(1);
+  // `output` may be `input`, whose shape it keeps.
+  output->Reshape<float>({batch_size, seq_length, hidden_size},
+                         input.device_type(), input.device_id());
+  GPUFusedBertLayerWeights gpu_weights{
+      weights.qkv_weight->data<float>(),
+      weights.qkv_bias->data<float>(),
+      weights.attention_dense_weight->data<float>(),
+      weights.attention_dense_bias->data<float>(),
+      weights.attention_layer_norm_weight->data<float>(),
+      weights.attention_layer_norm_bias->data<float>(),
+      weights.intermediate_weight->data<float>(),
+      weights.intermediate_bias->data<float>(),
+      weights.output_dense_weight->data<float>(),
+      weights.output_dense_bias->data<float>(),
+      weights.output_layer_norm_weight->data<float>(),
+      weights.output_layer_norm_bias->data<float>()};
+  auto& cuda_ctx = core::CUDADeviceContext::GetInstance(input.device_id());
+  return GPUFusedBertLayer(
+      input.data<float>(), attention_mask.data<float>(), batch_size,
+      seq_length, hidden_size, intermediate_size, weights.num_attention_heads,
+      size_per_head, gpu_weights, epsilon, scratch->mutableData<float>(),
+      output->mutableData<float>(), input.device_id(), cuda_ctx.stream());
+#else
+  TT_THROW("The current code is not compiled with CUDA.");
+#endif
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
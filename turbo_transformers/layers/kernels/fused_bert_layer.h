@@ -0,0 +1,75 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/layers/kernels/layer_norm.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// The float weights of a BERT encoder layer, as BertAttention, BertIntermediate
+// and BertOutput hold them.
+struct FusedBertLayerWeights {
+  const core::Tensor* qkv_weight{nullptr};
+  const core::Tensor* qkv_bias{nullptr};
+  const core::Tensor* attention_dense_weight{nullptr};
+  const core::Tensor* attention_dense_bias{nullptr};
+  const core::Tensor* attention_layer_norm_weight{nullptr};
+  const core::Tensor* attention_layer_norm_bias{nullptr};
+  int64_t num_attention_heads{0};
+  const core::Tensor* intermediate_weight{nullptr};
+  const core::Tensor* intermediate_bias{nullptr};
+  const core::Tensor* output_dense_weight{nullptr};
+  const core::Tensor* output_dense_bias{nullptr};
+  const core::Tensor* output_layer_norm_weight{nullptr};
+  const core::Tensor* output_layer_norm_bias{nullptr};
+};
+
+// Whether FusedBertLayer runs `input` [batch_size, seq_length, hidden_size]
+// of a layer with heads of `size_per_head`: while it is enabled, for a float
+// input of up to 32 tokens and heads up to 64 on a GPU which launches
+// cooperative kernels, with CUDA 11 or later.
+bool IsFusedBertLayerSupported(const core::Tensor& input,
+                               int64_t size_per_head);
+
+// Runs a whole encoder layer, the attention, the intermediate and the output
+// layers, as a single persistent kernel, see GPUFusedBertLayer. A batch of a
+// few tokens leaves most of the SMs idle in each of the kernels of the
+// layers, and the launches and the round trips of the activations through
+// the memory take longer than the work; the persistent kernel spreads every
+// GEMM over all the SMs and keeps the activations in the L2 cache in between.
+// The mask is that of BertAttention, `scratch` a float tensor of at least
+// FusedBertLayerScratchSize elements on the device. `output` may be `input`.
+// The layer norms take `epsilon` as kernels::LayerNorm does.
+// Returns false, having run nothing, if the GPU refuses the launch or the
+// stream is being captured; the caller then runs the layers one by one.
+bool FusedBertLayer(const core::Tensor& input,
+                    const core::Tensor& attention_mask,
+                    const FusedBertLayerWeights& weights,
+                    core::Tensor* scratch, core::Tensor* output,
+                    float epsilon = kLayerNormEpsilon);
+
+int64_t FusedBertLayerScratchSize(const core::Tensor& input,
+                                  const FusedBertLayerWeights& weights);
+
+// The fused layer is disabled unless the environment variable
+// TT_FUSED_BERT_LAYER is 1. It is experimental and not benchmarked against
+// the layers run kernel by kernel yet.
+bool IsFusedBertLayerEnabled();
+void EnableFusedBertLayer(bool enable);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,50 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+
+#pragma once
+#include "turbo_transformers/layers/types.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+using types::ActivationType;
+
+// The activations of the GPU kernels, computed in float.
+template <typename T, ActivationType ActType>
+__inline__ __device__ T ActvationOp(const T& x);
+
+template <>
+__inline__ __device__ float ActvationOp<float, ActivationType::Gelu>(
+    const float& x) {
+  float cdf =
+      0.5f *
+      (1.0f + tanhf((0.7978845608028654f * (x + 0.044715f * x * x * x))));
+  return x * cdf;
+}
+
+template <>
+__inline__ __device__ float ActvationOp<float, ActivationType::Tanh>(
+    const float& x) {
+  return tanhf(x);
+}
+
+template <>
+__inline__ __device__ float ActvationOp<float, ActivationType::Identity>(
+    const float& x) {
+  return x;
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
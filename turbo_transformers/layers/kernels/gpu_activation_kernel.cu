@@ -14,36 +14,19 @@
 #include <numeric>
 
 #include "ide_macro.h"
+#include "turbo_transformers/layers/kernels/gpu_activation.cuh"
 #include "turbo_transformers/layers/kernels/gpu_activation_kernel.h"
+#include "turbo_transformers/layers/kernels/gpu_half.cuh"
 
 namespace turbo_transformers {
 namespace layers {
 namespace kernels {
-namespace {
-
-template <typename T, ActivationType ActType>
-__inline__ __device__ T ActvationOp(const T& x);
-
-template <>
-__inline__ __device__ float ActvationOp<float, ActivationType::Gelu>(
-    const float& x) {
-  float cdf =
-      0.5f *
-      (1.0f + tanhf((0.7978845608028654f * (x + 0.044715f * x * x * x))));
-  return x * cdf;
-}
-
-template <>
-__inline__ __device__ float ActvationOp<float, ActivationType::Tanh>(
-    const float& x) {
-  return tanhf(x);
-}
-}  // namespace
 
+// The activation is computed in float for both float and half elements.
 template <typename T, ActivationType ActType>
 static __global__ void add_bias_act(const T* bias, int batch_size,
                                     int feature_dim, T* out) {
-  T val, reg_bias;
+  float val, reg_bias;
 
   int row_id;
   int elem_per_thread = (feature_dim + blockDim.x - 1) / blockDim.x;
@@ -52,10 +35,11 @@ static __global__ void add_bias_act(const T* bias, int batch_size,
   for (int i = 0; i < elem_per_thread; ++i) {
     int offset = i * blockDim.x + tid;
     if (offset < feature_dim) {
-      reg_bias = bias[offset];
+      reg_bias = ToFloat(bias[offset]);
       row_id = blockIdx.x;
-      val = out[offset + row_id * feature_dim] + reg_bias;
-      out[offset + row_id * feature_dim] = ActvationOp<T, ActType>(val);
+      val = ToFloat(out[offset + row_id * feature_dim]) + reg_bias;
+      out[offset + row_id * feature_dim] =
+          FromFloat<T>(ActvationOp<float, ActType>(val));
     }
   }
 }
@@ -67,8 +51,8 @@ void GPUAddBiasActKernel(const T* bias_data, int64_t batch_size,
   dim3 grid(batch_size);
   int block_size = min(1024, (int)(feature_dim / 4));
   dim3 block(block_size);
-  add_bias_act<T, ActType><<<grid, block, 0, stream>>>(bias_data, batch_size,
-                                                       feature_dim, out_data);
+  add_bias_act<DeviceType<T>, ActType><<<grid, block, 0, stream>>>(
+      ToDevicePtr(bias_data), batch_size, feature_dim, ToDevicePtr(out_data));
 }
 
 template void GPUAddBiasActKernel<float, ActivationType::Gelu>(
@@ -78,6 +62,22 @@ template void GPUAddBiasActKernel<float, ActivationType::Gelu>(
 template void GPUAddBiasActKernel<float, ActivationType::Tanh>(
     const float* bias_data, int64_t batch_size, int64_t feature_dim,
     cudaStream_t stream, float* out_data);
+
+template void GPUAddBiasActKernel<core::Half, ActivationType::Gelu>(
+    const core::Half* bias_data, int64_t batch_size, int64_t feature_dim,
+    cudaStream_t stream, core::Half* out_data);
+
+template void GPUAddBiasActKernel<core::Half, ActivationType::Tanh>(
+    const core::Half* bias_data, int64_t batch_size, int64_t feature_dim,
+    cudaStream_t stream, core::Half* out_data);
+
+template void GPUAddBiasActKernel<float, ActivationType::Identity>(
+    const float* bias_data, int64_t batch_size, int64_t feature_dim,
+    cudaStream_t stream, float* out_data);
+
+template void GPUAddBiasActKernel<core::Half, ActivationType::Identity>(
+    const core::Half* bias_data, int64_t batch_size, int64_t feature_dim,
+    cudaStream_t stream, core::Half* out_data);
 }  // namespace kernels
 }  // namespace layers
 }  // namespace turbo_transformers
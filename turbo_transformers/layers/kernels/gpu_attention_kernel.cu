@@ -0,0 +1,301 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include <cuda_runtime.h>
+
+#include "turbo_transformers/layers/kernels/gpu_attention_kernel.h"
+#include "turbo_transformers/layers/kernels/gpu_block_reduce.cuh"
+#include "turbo_transformers/layers/kernels/gpu_half.cuh"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+namespace {
+// The queries of a thread block, and its threads.
+constexpr int kQueryBlock = 16;
+constexpr int kBlockSize = 128;
+
+// A thread block computes the context of kQueryBlock queries of one head.
+// The shared memory keeps the scaled queries, the keys of the head, which are
+// then overwritten by its values, and the probabilities of the queries. The
+// rows of the keys and values are padded by one, so the threads reading
+// consecutive rows hit different banks.
+template <typename T>
+__global__ void fused_attention_kernel(const T* q, AttentionStrides q_strides,
+                                       const T* k, AttentionStrides k_strides,
+                                       const T* v, AttentionStrides v_strides,
+                                       const float* att_mask, int seq_len,
+                                       int size_per_head, float scale,
+                                       T* context,
+                                       AttentionStrides context_strides) {
+  extern __shared__ float s_buf[];
+  int ld_kv = size_per_head + 1;
+  float* s_kv = s_buf;
+  float* s_q = s_kv + seq_len * ld_kv;
+  float* s_prob = s_q + kQueryBlock * size_per_head;
+
+  int q_begin = blockIdx.x * kQueryBlock;
+  int n_queries = min(kQueryBlock, seq_len - q_begin);
+  int head_idx = blockIdx.y;
+  int batch_idx = blockIdx.z;
+  const T* q_head = q + batch_idx * q_strides.batch +
+                    head_idx * q_strides.head + q_begin * q_strides.row;
+  const T* k_head = k + batch_idx * k_strides.batch + head_idx * k_strides.head;
+  const T* v_head = v + batch_idx * v_strides.batch + head_idx * v_strides.head;
+  const float* mask = att_mask + batch_idx * seq_len;
+
+  for (int idx = threadIdx.x; idx < n_queries * size_per_head;
+       idx += blockDim.x) {
+    int row = idx / size_per_head, col = idx % size_per_head;
+    s_q[idx] = ToFloat(q_head[row * q_strides.row + col]) * scale;
+  }
+  for (int idx = threadIdx.x; idx < seq_len * size_per_head;
+       idx += blockDim.x) {
+    int row = idx / size_per_head, col = idx % size_per_head;
+    s_kv[row * ld_kv + col] = ToFloat(k_head[row * k_strides.row + col]);
+  }
+  __syncthreads();
+
+  for (int idx = threadIdx.x; idx < n_queries * seq_len; idx += blockDim.x) {
+    int row = idx / seq_len, key = idx % seq_len;
+    const float* q_row = s_q + row * size_per_head;
+    const float* k_row = s_kv + key * ld_kv;
+    float score = mask[key];
+    for (int i = 0; i < size_per_head; ++i) {
+      score += q_row[i] * k_row[i];
+    }
+    s_prob[idx] = score;
+  }
+  __syncthreads();
+
+  // The keys are consumed, so the values are loaded while the warps take the
+  // softmax of the rows.
+  for (int idx = threadIdx.x; idx < seq_len * size_per_head;
+       idx += blockDim.x) {
+    int row = idx / size_per_head, col = idx % size_per_head;
+    s_kv[row * ld_kv + col] = ToFloat(v_head[row * v_strides.row + col]);
+  }
+  int warp_idx = threadIdx.x / warpSize;
+  int lane_idx = threadIdx.x % warpSize;
+  for (int row = warp_idx; row < n_queries; row += blockDim.x / warpSize) {
+    float* prob_row = s_prob + row * seq_len;
+    float max_val = -1e20f;
+    for (int key = lane_idx; key < seq_len; key += warpSize) {
+      max_val = max(max_val, prob_row[key]);
+    }
+    warpReduce<ReduceType::kMax, 1>(&max_val);
+    float sum = 0.0f;
+    for (int key = lane_idx; key < seq_len; key += warpSize) {
+      float prob = __expf(prob_row[key] - max_val);
+      prob_row[key] = prob;
+      sum += prob;
+    }
+    warpReduce<ReduceType::kSum, 1>(&sum);
+    float coef = 1.0f / (sum + 1e-6f);
+    for (int key = lane_idx; key < seq_len; key += warpSize) {
+      prob_row[key] *= coef;
+    }
+  }
+  __syncthreads();
+
+  T* context_head = context + batch_idx * context_strides.batch +
+                    head_idx * context_strides.head +
+                    q_begin * context_strides.row;
+  for (int idx = threadIdx.x; idx < n_queries * size_per_head;
+       idx += blockDim.x) {
+    int row = idx / size_per_head, col = idx % size_per_head;
+    const float* prob_row = s_prob + row * seq_len;
+    float val = 0.0f;
+    for (int key = 0; key < seq_len; ++key) {
+      val += prob_row[key] * s_kv[key * ld_kv + col];
+    }
+    context_head[row * context_strides.row + col] = FromFloat<T>(val);
+  }
+}
+
+// The columns of the context a lane keeps.
+constexpr int kWindowMaxCols = kGPUWindowAttentionMaxHeadSize / 32;
+
+// The running state of the online softmax of a query, whose lanes each keep
+// the columns lane_idx + i * warpSize of the query and the context.
+struct WindowQueryState {
+  float q[kWindowMaxCols];
+  float out[kWindowMaxCols];
+  float row_max;
+  float row_sum;
+};
+
+template <typename T>
+__device__ __forceinline__ void AttendKey(const T* k_row, const T* v_row,
+                                          float mask, int size_per_head,
+                                          int lane_idx,
+                                          WindowQueryState* state) {
+  float score = 0.0f;
+#pragma unroll
+  for (int i = 0; i < kWindowMaxCols; ++i) {
+    int col = lane_idx + i * warpSize;
+    if (col < size_per_head) {
+      score += state->q[i] * ToFloat(k_row[col]);
+    }
+  }
+  warpReduce<ReduceType::kSum, 1>(&score);
+  score += mask;
+  float new_max = max(state->row_max, score);
+  float correction = __expf(state->row_max - new_max);
+  float prob = __expf(score - new_max);
+  state->row_sum = state->row_sum * correction + prob;
+#pragma unroll
+  for (int i = 0; i < kWindowMaxCols; ++i) {
+    int col = lane_idx + i * warpSize;
+    if (col < size_per_head) {
+      state->out[i] = state->out[i] * correction + prob * ToFloat(v_row[col]);
+    }
+  }
+  state->row_max = new_max;
+}
+
+// A warp computes the context of one query, the global queries attend to all
+// keys and the local ones to the global keys and their band, so a query of
+// the window never reads more than num_global + 2 * window + 1 keys.
+template <typename T>
+__global__ void sliding_window_attention_kernel(
+    const T* q, AttentionStrides q_strides, const T* k,
+    AttentionStrides k_strides, const T* v, AttentionStrides v_strides,
+    const float* att_mask, int64_t n_rows, int head_num, int seq_len,
+    int size_per_head, int window, int num_global, float scale, T* context,
+    AttentionStrides context_strides) {
+  int64_t row_idx = static_cast<int64_t>(blockIdx.x) * (blockDim.x / warpSize) +
+                    threadIdx.x / warpSize;
+  if (row_idx >= n_rows) {
+    return;
+  }
+  int lane_idx = threadIdx.x % warpSize;
+  int query = row_idx % seq_len;
+  int head_idx = (row_idx / seq_len) % head_num;
+  int batch_idx = row_idx / (static_cast<int64_t>(seq_len) * head_num);
+  const T* q_row = q + batch_idx * q_strides.batch +
+                   head_idx * q_strides.head + query * q_strides.row;
+  const T* k_head = k + batch_idx * k_strides.batch + head_idx * k_strides.head;
+  const T* v_head = v + batch_idx * v_strides.batch + head_idx * v_strides.head;
+  const float* mask = att_mask + batch_idx * seq_len;
+
+  WindowQueryState state;
+#pragma unroll
+  for (int i = 0; i < kWindowMaxCols; ++i) {
+    int col = lane_idx + i * warpSize;
+    state.q[i] = col < size_per_head ? ToFloat(q_row[col]) * scale : 0.0f;
+    state.out[i] = 0.0f;
+  }
+  state.row_max = -1e20f;
+  state.row_sum = 0.0f;
+  int band_begin = 0, band_end = seq_len;
+  if (query >= num_global) {
+    for (int key = 0; key < num_global; ++key) {
+      AttendKey(k_head + key * k_strides.row, v_head + key * v_strides.row,
+                mask[key], size_per_head, lane_idx, &state);
+    }
+    band_begin = max(num_global, query - window);
+    band_end = min(seq_len, query + window + 1);
+  }
+  for (int key = band_begin; key < band_end; ++key) {
+    AttendKey(k_head + key * k_strides.row, v_head + key * v_strides.row,
+              mask[key], size_per_head, lane_idx, &state);
+  }
+
+  T* context_row = context + batch_idx * context_strides.batch +
+                   head_idx * context_strides.head +
+                   query * context_strides.row;
+  float coef = 1.0f / (state.row_sum + 1e-6f);
+#pragma unroll
+  for (int i = 0; i < kWindowMaxCols; ++i) {
+    int col = lane_idx + i * warpSize;
+    if (col < size_per_head) {
+      context_row[col] = FromFloat<T>(state.out[i] * coef);
+    }
+  }
+}
+}  // namespace
+
+template <typename T>
+void GPUFusedAttention(const T* q, AttentionStrides q_strides, const T* k,
+                       AttentionStrides k_strides, const T* v,
+                       AttentionStrides v_strides, const float* att_mask,
+                       int64_t batch_size, int64_t head_num, int64_t seq_len,
+                       int64_t size_per_head, float scale, T* context,
+                       AttentionStrides context_strides, cudaStream_t stream) {
+  dim3 grid((seq_len + kQueryBlock - 1) / kQueryBlock, head_num, batch_size);
+  dim3 block(kBlockSize);
+  // At most 45KB, within the 48KB of a block without opting in.
+  size_t smem_size = (seq_len * (size_per_head + 1) +
+                      kQueryBlock * (size_per_head + seq_len)) *
+                     sizeof(float);
+  fused_attention_kernel<<<grid, block, smem_size, stream>>>(
+      ToDevicePtr(q), q_strides, ToDevicePtr(k), k_strides, ToDevicePtr(v),
+      v_strides, att_mask, seq_len, size_per_head, scale, ToDevicePtr(context),
+      context_strides);
+}
+
+template void GPUFusedAttention<float>(
+    const float* q, AttentionStrides q_strides, const float* k,
+    AttentionStrides k_strides, const float* v, AttentionStrides v_strides,
+    const float* att_mask, int64_t batch_size, int64_t head_num,
+    int64_t seq_len, int64_t size_per_head, float scale, float* context,
+    AttentionStrides context_strides, cudaStream_t stream);
+template void GPUFusedAttention<core::Half>(
+    const core::Half* q, AttentionStrides q_strides, const core::Half* k,
+    AttentionStrides k_strides, const core::Half* v,
+    AttentionStrides v_strides, const float* att_mask, int64_t batch_size,
+    int64_t head_num, int64_t seq_len, int64_t size_per_head, float scale,
+    core::Half* context, AttentionStrides context_strides,
+    cudaStream_t stream);
+
+template <typename T>
+void GPUSlidingWindowAttention(const T* q, AttentionStrides q_strides,
+                               const T* k, AttentionStrides k_strides,
+                               const T* v, AttentionStrides v_strides,
+                               const float* att_mask, int64_t batch_size,
+                               int64_t head_num, int64_t seq_len,
+                               int64_t size_per_head, int64_t window,
+                               int64_t num_global_tokens, float scale,
+                               T* context, AttentionStrides context_strides,
+                               cudaStream_t stream) {
+  int64_t n_rows = batch_size * head_num * seq_len;
+  int64_t warps_per_block = kBlockSize / 32;
+  dim3 grid((n_rows + warps_per_block - 1) / warps_per_block);
+  dim3 block(kBlockSize);
+  sliding_window_attention_kernel<<<grid, block, 0, stream>>>(
+      ToDevicePtr(q), q_strides, ToDevicePtr(k), k_strides, ToDevicePtr(v),
+      v_strides, att_mask, n_rows, head_num, seq_len, size_per_head,
+      std::min(window, seq_len), num_global_tokens, scale,
+      ToDevicePtr(context), context_strides);
+}
+
+template void GPUSlidingWindowAttention<float>(
+    const float* q, AttentionStrides q_strides, const float* k,
+    AttentionStrides k_strides, const float* v, AttentionStrides v_strides,
+    const float* att_mask, int64_t batch_size, int64_t head_num,
+    int64_t seq_len, int64_t size_per_head, int64_t window,
+    int64_t num_global_tokens, float scale, float* context,
+    AttentionStrides context_strides, cudaStream_t stream);
+template void GPUSlidingWindowAttention<core::Half>(
+    const core::Half* q, AttentionStrides q_strides, const core::Half* k,
+    AttentionStrides k_strides, const core::Half* v,
+    AttentionStrides v_strides, const float* att_mask, int64_t batch_size,
+    int64_t head_num, int64_t seq_len, int64_t size_per_head, int64_t window,
+    int64_t num_global_tokens, float scale, core::Half* context,
+    AttentionStrides context_strides, cudaStream_t stream);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,63 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cstdint>
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// The longest sequence and the widest head of GPUFusedAttention, whose thread
+// blocks keep the keys, then the values, of a whole head in shared memory.
+constexpr int64_t kGPUFusedAttentionMaxSeqLen = 128;
+constexpr int64_t kGPUFusedAttentionMaxHeadSize = 64;
+
+// The strides of a (batch_size, head_num, seq_len, size_per_head) tensor
+// whose last dimension is dense.
+struct AttentionStrides {
+  int64_t batch;
+  int64_t head;
+  int64_t row;
+};
+
+// context = softmax(q * k^T * scale + att_mask) * v in one launch, for
+// seq_len <= kGPUFusedAttentionMaxSeqLen and
+// size_per_head <= kGPUFusedAttentionMaxHeadSize.
+template <typename T>
+void GPUFusedAttention(const T* q, AttentionStrides q_strides, const T* k,
+                       AttentionStrides k_strides, const T* v,
+                       AttentionStrides v_strides, const float* att_mask,
+                       int64_t batch_size, int64_t head_num, int64_t seq_len,
+                       int64_t size_per_head, float scale, T* context,
+                       AttentionStrides context_strides, cudaStream_t stream);
+
+// The widest head of GPUSlidingWindowAttention, whose lanes each keep up to
+// 4 columns of the context.
+constexpr int64_t kGPUWindowAttentionMaxHeadSize = 128;
+
+// The context of SlidingWindowAttention, one warp per query.
+template <typename T>
+void GPUSlidingWindowAttention(const T* q, AttentionStrides q_strides,
+                               const T* k, AttentionStrides k_strides,
+                               const T* v, AttentionStrides v_strides,
+                               const float* att_mask, int64_t batch_size,
+                               int64_t head_num, int64_t seq_len,
+                               int64_t size_per_head, int64_t window,
+                               int64_t num_global_tokens, float scale,
+                               T* context, AttentionStrides context_strides,
+                               cudaStream_t stream);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
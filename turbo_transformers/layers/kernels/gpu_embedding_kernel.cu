@@ -13,61 +13,211 @@
 
 #include <cuda_runtime.h>
 
+#include <cstdint>
 #include <numeric>
+#include <stdexcept>
 
+#include "turbo_transformers/layers/kernels/gpu_block_reduce.cuh"
 #include "turbo_transformers/layers/kernels/gpu_embedding_kernel.h"
+#include "turbo_transformers/layers/kernels/gpu_half.cuh"
 
 namespace turbo_transformers {
 namespace layers {
 namespace kernels {
 
-template <bool IsAdd>
-static __global__ void lookup(float* dst, const float* embedding_table,
-                              const int64_t* ids, int64_t vocab_size) {
-  int64_t id = ids[blockIdx.x];
-  int hidden_idx = threadIdx.x;
-  int hidden_size = blockDim.x;
-  // TODO(jiaruifang): There should have a checker to check the range of id.
+namespace {
+constexpr int kWarpSize = 32;
+// A warp keeps the row of a token in registers, up to kMaxColsPerThread
+// elements per thread, which covers the hidden sizes up to 4096.
+constexpr int kMaxColsPerThread = 128;
+constexpr int kMaxHiddenSize = kWarpSize * kMaxColsPerThread;
+// The tokens of a block, one per warp. Short sequences are a handful of
+// blocks, so a block of a single token would leave most of the GPU idle
+// between the launches of the layers.
+constexpr int kTokensPerBlock = 4;
+
+template <typename T, int kPack>
+__device__ __forceinline__ Pack<T, kPack> LoadPack(const T* ptr) {
+  return *reinterpret_cast<const Pack<T, kPack>*>(ptr);
+}
+
+// One warp per token. Lane l holds the packs l, l + 32, ... of the row, so
+// the loads of a warp are contiguous, kPack elements of each table at a
+// time. The three rows are summed into registers and normalized there, so
+// the output is written once and never read. kPack must divide hidden_size.
+template <typename T, int kPack, int kPacksPerThread>
+__global__ void WarpEmbeddingLayerNormKernel(
+    T* out, const T* word_embeddings, const T* position_embeddings,
+    const T* token_type_embeddings, const int64_t* input_ids,
+    const int64_t* position_ids, const int64_t* token_type_ids,
+    const T* gamma, const T* beta, int64_t vocab_size, int64_t num_ids,
+    int seq_len, int hidden_size, float epsilon) {
+  int64_t token = static_cast<int64_t>(blockIdx.x) * kTokensPerBlock +
+                  threadIdx.y;
+  if (token >= num_ids) {
+    return;
+  }
+  int64_t id = input_ids[token];
   if (id >= vocab_size) {
     asm("trap;");
   }
+  int64_t position =
+      position_ids == nullptr ? token % seq_len : position_ids[token];
+  const T* word = word_embeddings + id * hidden_size;
+  const T* pos = position_embeddings + position * hidden_size;
+  const T* type = token_type_embeddings + token_type_ids[token] * hidden_size;
 
-#if defined(__CUDA_ARCH__) && __CUDA_ARCH__ > 300
-  float val = __ldg(&embedding_table[id * hidden_size + hidden_idx]);
-#else
-  float val = embedding_table[id * hidden_size + hidden_idx];
-#endif
-  if (IsAdd) {
-    dst[blockIdx.x * hidden_size + hidden_idx] += val;
-  } else {
-    dst[blockIdx.x * hidden_size + hidden_idx] = val;
+  float x[kPacksPerThread][kPack];
+  float sum_list[2] = {0.f, 0.f};
+#pragma unroll
+  for (int p = 0; p < kPacksPerThread; ++p) {
+    int col = (p * kWarpSize + threadIdx.x) * kPack;
+    if (col < hidden_size) {
+      auto word_pack = LoadPack<T, kPack>(word + col);
+      auto pos_pack = LoadPack<T, kPack>(pos + col);
+      auto type_pack = LoadPack<T, kPack>(type + col);
+#pragma unroll
+      for (int e = 0; e < kPack; ++e) {
+        x[p][e] = ToFloat(word_pack.data[e]) + ToFloat(pos_pack.data[e]) +
+                  ToFloat(type_pack.data[e]);
+        sum_list[0] += x[p][e];
+        sum_list[1] += x[p][e] * x[p][e];
+      }
+    }
+  }
+  warpReduce<ReduceType::kSum, 2>(sum_list);
+  float mean = sum_list[0] / hidden_size;
+  // The single pass may round a constant row to a tiny negative variance.
+  float rstd = rsqrtf(
+      fmaxf(sum_list[1] / hidden_size - mean * mean, 0.f) + epsilon);
+
+  T* dst = out + token * hidden_size;
+#pragma unroll
+  for (int p = 0; p < kPacksPerThread; ++p) {
+    int col = (p * kWarpSize + threadIdx.x) * kPack;
+    if (col < hidden_size) {
+      auto gamma_pack = LoadPack<T, kPack>(gamma + col);
+      auto beta_pack = LoadPack<T, kPack>(beta + col);
+      Pack<T, kPack> out_pack;
+#pragma unroll
+      for (int e = 0; e < kPack; ++e) {
+        out_pack.data[e] = FromFloat<T>((x[p][e] - mean) * rstd *
+                                            ToFloat(gamma_pack.data[e]) +
+                                        ToFloat(beta_pack.data[e]));
+      }
+      *reinterpret_cast<Pack<T, kPack>*>(dst + col) = out_pack;
+    }
   }
 }
 
-template <bool Add>
-void GPULookupKernel(float* dst, const float* embedding_table,
-                     const int64_t* ids, int64_t vocab_size,
-                     int64_t hidden_size, int64_t num_ids,
-                     cudaStream_t stream) {
-  dim3 grid(num_ids);
-  dim3 block(hidden_size);
-  if (block.x > 1024) {
+// Launches the warp kernel with the fewest packs per thread which cover a
+// row, trying kPacksPerThread, 2 * kPacksPerThread, ... in turn.
+template <typename T, int kPack, int kPacksPerThread,
+          bool kLast = (kPack * kPacksPerThread >= kMaxColsPerThread)>
+struct WarpEmbeddingLayerNormLauncher {
+  static void Run(T* out, const T* word_embeddings,
+                  const T* position_embeddings,
+                  const T* token_type_embeddings, const int64_t* input_ids,
+                  const int64_t* position_ids, const int64_t* token_type_ids,
+                  const T* gamma, const T* beta, int64_t vocab_size,
+                  int64_t num_ids, int seq_len, int hidden_size,
+                  float epsilon, cudaStream_t stream) {
+    if (kPacksPerThread * kPack * kWarpSize < hidden_size) {
+      WarpEmbeddingLayerNormLauncher<T, kPack, kPacksPerThread * 2>::Run(
+          out, word_embeddings, position_embeddings, token_type_embeddings,
+          input_ids, position_ids, token_type_ids, gamma, beta, vocab_size,
+          num_ids, seq_len, hidden_size, epsilon, stream);
+      return;
+    }
+    dim3 block(kWarpSize, kTokensPerBlock);
+    dim3 grid((num_ids + kTokensPerBlock - 1) / kTokensPerBlock);
+    WarpEmbeddingLayerNormKernel<T, kPack, kPacksPerThread>
+        <<<grid, block, 0, stream>>>(
+            out, word_embeddings, position_embeddings, token_type_embeddings,
+            input_ids, position_ids, token_type_ids, gamma, beta, vocab_size,
+            num_ids, seq_len, hidden_size, epsilon);
+  }
+};
+
+template <typename T, int kPack, int kPacksPerThread>
+struct WarpEmbeddingLayerNormLauncher<T, kPack, kPacksPerThread, true> {
+  static void Run(T* out, const T* word_embeddings,
+                  const T* position_embeddings,
+                  const T* token_type_embeddings, const int64_t* input_ids,
+                  const int64_t* position_ids, const int64_t* token_type_ids,
+                  const T* gamma, const T* beta, int64_t vocab_size,
+                  int64_t num_ids, int seq_len, int hidden_size,
+                  float epsilon, cudaStream_t stream) {
+    dim3 block(kWarpSize, kTokensPerBlock);
+    dim3 grid((num_ids + kTokensPerBlock - 1) / kTokensPerBlock);
+    WarpEmbeddingLayerNormKernel<T, kPack, kPacksPerThread>
+        <<<grid, block, 0, stream>>>(
+            out, word_embeddings, position_embeddings, token_type_embeddings,
+            input_ids, position_ids, token_type_ids, gamma, beta, vocab_size,
+            num_ids, seq_len, hidden_size, epsilon);
+  }
+};
+
+bool IsAligned(const void* ptr, size_t alignment) {
+  return reinterpret_cast<uintptr_t>(ptr) % alignment == 0;
+}
+}  // namespace
+
+template <typename T>
+void GPUEmbeddingLayerNorm(T* out, const T* word_embeddings,
+                           const T* position_embeddings,
+                           const T* token_type_embeddings,
+                           const int64_t* input_ids,
+                           const int64_t* position_ids,
+                           const int64_t* token_type_ids, const T* gamma,
+                           const T* beta, int64_t vocab_size, int64_t num_ids,
+                           int64_t seq_len, int64_t hidden_size,
+                           float epsilon, cudaStream_t stream) {
+  if (hidden_size > kMaxHiddenSize) {
     throw std::runtime_error(
-        "GPULookupKernel currently does not support a hidden_size larger than "
-        "1024");
+        "GPUEmbeddingLayerNorm does not support a hidden_size larger than "
+        "4096");
+  }
+  using DeviceT = DeviceType<T>;
+  constexpr int kVectorPack = 16 / sizeof(DeviceT);
+  // The rows of whole packs are loaded and stored 16 bytes at a time, i.e.
+  // 4 floats or 8 halves, the rows of the tables then being aligned as well.
+  bool use_vector = hidden_size % kVectorPack == 0 && IsAligned(out, 16) &&
+                    IsAligned(word_embeddings, 16) &&
+                    IsAligned(position_embeddings, 16) &&
+                    IsAligned(token_type_embeddings, 16) &&
+                    IsAligned(gamma, 16) && IsAligned(beta, 16);
+  if (use_vector) {
+    WarpEmbeddingLayerNormLauncher<DeviceT, kVectorPack, 1>::Run(
+        ToDevicePtr(out), ToDevicePtr(word_embeddings),
+        ToDevicePtr(position_embeddings), ToDevicePtr(token_type_embeddings),
+        input_ids, position_ids, token_type_ids, ToDevicePtr(gamma),
+        ToDevicePtr(beta), vocab_size, num_ids, seq_len, hidden_size, epsilon,
+        stream);
+  } else {
+    WarpEmbeddingLayerNormLauncher<DeviceT, 1, 1>::Run(
+        ToDevicePtr(out), ToDevicePtr(word_embeddings),
+        ToDevicePtr(position_embeddings), ToDevicePtr(token_type_embeddings),
+        input_ids, position_ids, token_type_ids, ToDevicePtr(gamma),
+        ToDevicePtr(beta), vocab_size, num_ids, seq_len, hidden_size, epsilon,
+        stream);
   }
-  lookup<Add>
-      <<<grid, block, 0, stream>>>(dst, embedding_table, ids, vocab_size);
 }
 
-template void GPULookupKernel<true>(float* dst, const float* embedding_table,
-                                    const int64_t* ids, int64_t vocab_size,
-                                    int64_t hidden_size, int64_t num_ids,
-                                    cudaStream_t stream);
-template void GPULookupKernel<false>(float* dst, const float* embedding_table,
-                                     const int64_t* ids, int64_t vocab_size,
-                                     int64_t hidden_size, int64_t num_ids,
-                                     cudaStream_t stream);
+template void GPUEmbeddingLayerNorm<float>(
+    float* out, const float* word_embeddings, const float* position_embeddings,
+    const float* token_type_embeddings, const int64_t* input_ids,
+    const int64_t* position_ids, const int64_t* token_type_ids,
+    const float* gamma, const float* beta, int64_t vocab_size, int64_t num_ids,
+    int64_t seq_len, int64_t hidden_size, float epsilon, cudaStream_t stream);
+template void GPUEmbeddingLayerNorm<core::Half>(
+    core::Half* out, const core::Half* word_embeddings,
+    const core::Half* position_embeddings,
+    const core::Half* token_type_embeddings, const int64_t* input_ids,
+    const int64_t* position_ids, const int64_t* token_type_ids,
+    const core::Half* gamma, const core::Half* beta, int64_t vocab_size,
+    int64_t num_ids, int64_t seq_len, int64_t hidden_size, float epsilon,
+    cudaStream_t stream);
 }  // namespace kernels
 }  // namespace layers
 }  // namespace turbo_transformers
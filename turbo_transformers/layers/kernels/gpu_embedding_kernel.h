@@ -17,10 +17,20 @@ namespace turbo_transformers {
 namespace layers {
 namespace kernels {
 
-template <bool Add>
-void GPULookupKernel(float* dst, const float* embedding_table,
-                     const int64_t* ids, int64_t vocab_size,
-                     int64_t hidden_size, int64_t num_ids, cudaStream_t stream);
+// See LookupEmbeddingLayerNorm. position_ids may be null, hidden_size must
+// not be larger than 4096. A warp computes a token, a few of them per block,
+// with 16-byte loads of the float or half tables whenever the hidden size
+// and the alignment of the tables allow it.
+template <typename T>
+void GPUEmbeddingLayerNorm(T* out, const T* word_embeddings,
+                           const T* position_embeddings,
+                           const T* token_type_embeddings,
+                           const int64_t* input_ids,
+                           const int64_t* position_ids,
+                           const int64_t* token_type_ids, const T* gamma,
+                           const T* beta, int64_t vocab_size, int64_t num_ids,
+                           int64_t seq_len, int64_t hidden_size,
+                           float epsilon, cudaStream_t stream);
 
 }  // namespace kernels
 }  // namespace layers
@@ -0,0 +1,419 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include <cuda.h>
+#include <cuda_runtime.h>
+#if CUDA_VERSION >= 11000
+#include <cooperative_groups.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+#include "turbo_transformers/layers/kernels/gpu_block_reduce.cuh"
+#include "turbo_transformers/layers/kernels/gpu_fused_bert_layer_kernel.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+namespace {
+constexpr int kBlockSize = 256;
+constexpr int kWarpSize = 32;
+constexpr int kWarps = kBlockSize / kWarpSize;
+constexpr int kMaxTokens = kGPUFusedBertLayerMaxTokens;
+constexpr int kMaxHeadSize = kGPUFusedBertLayerMaxHeadSize;
+// A GEMM is cut into units of kTileN columns by kTileK rows of the weight,
+// whose partial products over the kTileK rows are summed up by the next
+// phase, so that even the narrow GEMMs keep all the SMs loading weights.
+constexpr int kTileN = 64;
+constexpr int kTileK = 128;
+// The threads of a unit split its rows into kKGroups.
+constexpr int kKGroups = kBlockSize / kTileN;
+// The partial sums of the kKGroups, the largest use of the shared memory.
+constexpr int kSharedFloats = kKGroups * kTileN * kMaxTokens;
+static_assert(kMaxTokens * kTileK <= kSharedFloats,
+              "The inputs of a unit should fit in the shared memory");
+static_assert(3 * kMaxTokens * kMaxHeadSize + kMaxTokens * kMaxTokens <=
+                  kSharedFloats,
+              "The q, k, v and scores of a head should fit in the shared "
+              "memory");
+
+struct Params {
+  const float* input;
+  const float* attention_mask;
+  float* output;
+  int n_tokens;
+  int seq_len;
+  int hidden_size;
+  int intermediate_size;
+  int num_heads;
+  int size_per_head;
+  float scale;
+  float epsilon;
+  GPUFusedBertLayerWeights weights;
+  float* partial;
+  float* context;
+  float* attention_out;
+  float* intermediate_out;
+};
+
+__host__ __device__ int NumSlices(int k) { return (k + kTileK - 1) / kTileK; }
+
+__host__ __device__ int NumGemmUnits(int n, int k) {
+  return (n + kTileN - 1) / kTileN * NumSlices(k);
+}
+
+#if CUDA_VERSION >= 11000
+// The kernel is launched cooperatively, which guarantees that all the
+// blocks are resident and can wait at the barrier for one another; the
+// barrier also orders the writes of a phase before the reads of the next.
+// Before CUDA 11, the grid barrier needs the relocatable device code, which
+// tt_kernels is not built with, so the fused layer is left out.
+__device__ void GridSync() { cooperative_groups::this_grid().sync(); }
+#endif
+
+// partial[s][m][n] = sum of x[m][k] * w[k][n] over the rows k of the slice s.
+// The activations written by an earlier phase are read by __ldcg, past the
+// L1 cache of the SM, which does not see the writes of the other SMs.
+__device__ void SkinnyGemm(const float* x, const float* w, int n_rows, int k,
+                           int n, float* partial, float* shared) {
+  int n_tiles = (n + kTileN - 1) / kTileN;
+  int col = threadIdx.x % kTileN;
+  int group = threadIdx.x / kTileN;
+  for (int unit = blockIdx.x; unit < n_tiles * NumSlices(k);
+       unit += gridDim.x) {
+    int n0 = unit % n_tiles * kTileN;
+    int slice = unit / n_tiles;
+    int k0 = slice * kTileK;
+    int k_len = min(kTileK, k - k0);
+    __syncthreads();
+    for (int i = threadIdx.x; i < n_rows * kTileK; i += kBlockSize) {
+      int row = i / kTileK, kk = i % kTileK;
+      shared[i] = kk < k_len ? __ldcg(x + row * k + k0 + kk) : 0.f;
+    }
+    __syncthreads();
+    float acc[kMaxTokens];
+#pragma unroll
+    for (int row = 0; row < kMaxTokens; ++row) {
+      acc[row] = 0.f;
+    }
+    if (n0 + col < n) {
+      for (int kk = group; kk < k_len; kk += kKGroups) {
+        float weight = __ldg(w + static_cast<int64_t>(k0 + kk) * n + n0 + col);
+#pragma unroll
+        for (int row = 0; row < kMaxTokens; ++row) {
+          if (row < n_rows) {
+            acc[row] += shared[row * kTileK + kk] * weight;
+          }
+        }
+      }
+    }
+    __syncthreads();
+#pragma unroll
+    for (int row = 0; row < kMaxTokens; ++row) {
+      if (row < n_rows) {
+        shared[(group * kMaxTokens + row) * kTileN + col] = acc[row];
+      }
+    }
+    __syncthreads();
+    for (int i = threadIdx.x; i < n_rows * kTileN; i += kBlockSize) {
+      int row = i / kTileN, c = i % kTileN;
+      if (n0 + c < n) {
+        float sum = 0.f;
+#pragma unroll
+        for (int g = 0; g < kKGroups; ++g) {
+          sum += shared[(g * kMaxTokens + row) * kTileN + c];
+        }
+        partial[(static_cast<int64_t>(slice) * n_rows + row) * n + n0 + c] =
+            sum;
+      }
+    }
+  }
+}
+
+// The attention of a (sequence, head) per unit, whose q, k and v are summed
+// up from the partial products of the qkv GEMM into the shared memory.
+__device__ void Attention(const Params& p, float* shared) {
+  int d = p.size_per_head;
+  int seq_len = p.seq_len;
+  int all_head_size = p.num_heads * d;
+  int qkv_size = 3 * all_head_size;
+  int slices = NumSlices(p.hidden_size);
+  float* q = shared;
+  float* k = q + kMaxTokens * kMaxHeadSize;
+  float* v = k + kMaxTokens * kMaxHeadSize;
+  float* score = v + kMaxTokens * kMaxHeadSize;
+  int warp = threadIdx.x / kWarpSize, lane = threadIdx.x % kWarpSize;
+  int batch_size = p.n_tokens / seq_len;
+  for (int unit = blockIdx.x; unit < batch_size * p.num_heads;
+       unit += gridDim.x) {
+    int b = unit / p.num_heads, h = unit % p.num_heads;
+    __syncthreads();
+    for (int i = threadIdx.x; i < 3 * seq_len * d; i += kBlockSize) {
+      int which = i / (seq_len * d), s = i / d % seq_len, j = i % d;
+      int col = which * all_head_size + h * d + j;
+      int64_t row = b * seq_len + s;
+      float sum = __ldg(p.weights.qkv_bias + col);
+      for (int slice = 0; slice < slices; ++slice) {
+        sum += __ldcg(p.partial + (slice * p.n_tokens + row) * qkv_size + col);
+      }
+      shared[which * kMaxTokens * kMaxHeadSize + s * d + j] = sum;
+    }
+    __syncthreads();
+    for (int i = threadIdx.x; i < seq_len * seq_len; i += kBlockSize) {
+      int query = i / seq_len, key = i % seq_len;
+      float dot = 0.f;
+      for (int j = 0; j < d; ++j) {
+        dot += q[query * d + j] * k[key * d + j];
+      }
+      score[i] = dot * p.scale + __ldg(p.attention_mask + b * seq_len + key);
+    }
+    __syncthreads();
+    // A warp per query, seq_len is at most the warp size.
+    for (int query = warp; query < seq_len; query += kWarps) {
+      float value = lane < seq_len ? score[query * seq_len + lane] : -INFINITY;
+      float max_value = value;
+      warpReduce<ReduceType::kMax, 1>(&max_value);
+      float e = lane < seq_len ? __expf(value - max_value) : 0.f;
+      float sum = e;
+      warpReduce<ReduceType::kSum, 1>(&sum);
+      if (lane < seq_len) {
+        score[query * seq_len + lane] = e / sum;
+      }
+    }
+    __syncthreads();
+    for (int i = threadIdx.x; i < seq_len * d; i += kBlockSize) {
+      int query = i / d, j = i % d;
+      float context = 0.f;
+      for (int key = 0; key < seq_len; ++key) {
+        context += score[query * seq_len + key] * v[key * d + j];
+      }
+      p.context[static_cast<int64_t>(b * seq_len + query) * all_head_size +
+                h * d + j] = context;
+    }
+  }
+}
+
+// output[m] = LayerNorm(sum of partial[s][m] + bias + residual[m]), a warp
+// per row, in the order of the GPU layer norm kernels.
+__device__ void AddBiasLayerNorm(const float* partial, int slices,
+                                 const float* bias, const float* residual,
+                                 const float* gamma, const float* beta,
+                                 float epsilon, int n_rows, int n,
+                                 float* output) {
+  int lane = threadIdx.x % kWarpSize;
+  for (int row = blockIdx.x * kWarps + threadIdx.x / kWarpSize; row < n_rows;
+       row += gridDim.x * kWarps) {
+    int64_t offset = static_cast<int64_t>(row) * n;
+    float* out = output + offset;
+    float sum = 0.f;
+    for (int c = lane; c < n; c += kWarpSize) {
+      float value = __ldg(bias + c) + __ldcg(residual + offset + c);
+      for (int slice = 0; slice < slices; ++slice) {
+        value += __ldcg(partial + slice * n_rows * n + offset + c);
+      }
+      out[c] = value;
+      sum += value;
+    }
+    warpReduce<ReduceType::kSum, 1>(&sum);
+    float mean = sum / n;
+    float m2 = 0.f;
+    for (int c = lane; c < n; c += kWarpSize) {
+      float diff = out[c] - mean;
+      m2 += diff * diff;
+    }
+    warpReduce<ReduceType::kSum, 1>(&m2);
+    float rstd = rsqrtf(m2 / n + epsilon);
+    for (int c = lane; c < n; c += kWarpSize) {
+      out[c] = (out[c] - mean) * rstd * __ldg(gamma + c) + __ldg(beta + c);
+    }
+  }
+}
+
+// output = Gelu(sum of the partial products + bias), as ActvationOp.
+__device__ void AddBiasGelu(const float* partial, int slices,
+                            const float* bias, int n_rows, int n,
+                            float* output) {
+  int64_t size = static_cast<int64_t>(n_rows) * n;
+  for (int64_t i = static_cast<int64_t>(blockIdx.x) * kBlockSize + threadIdx.x;
+       i < size; i += static_cast<int64_t>(gridDim.x) * kBlockSize) {
+    float x = __ldg(bias + i % n);
+    for (int slice = 0; slice < slices; ++slice) {
+      x += __ldcg(partial + slice * size + i);
+    }
+    float cdf =
+        0.5f *
+        (1.0f + tanhf((0.7978845608028654f * (x + 0.044715f * x * x * x))));
+    output[i] = x * cdf;
+  }
+}
+
+#if CUDA_VERSION >= 11000
+__global__ void __launch_bounds__(kBlockSize)
+    FusedBertLayerKernel(Params p) {
+  __shared__ float shared[kSharedFloats];
+  const auto& w = p.weights;
+  int all_head_size = p.num_heads * p.size_per_head;
+  // 1. The qkv projection.
+  SkinnyGemm(p.input, w.qkv_weight, p.n_tokens, p.hidden_size,
+             3 * all_head_size, p.partial, shared);
+  GridSync();
+  // 2. The attention of every head into the context.
+  Attention(p, shared);
+  GridSync();
+  // 3. LayerNorm(context * W + bias + input).
+  SkinnyGemm(p.context, w.attention_dense_weight, p.n_tokens, all_head_size,
+             p.hidden_size, p.partial, shared);
+  GridSync();
+  AddBiasLayerNorm(p.partial, NumSlices(all_head_size),
+                   w.attention_dense_bias, p.input,
+                   w.attention_layer_norm_weight, w.attention_layer_norm_bias,
+                   p.epsilon, p.n_tokens, p.hidden_size, p.attention_out);
+  GridSync();
+  // 4. Gelu(attention_out * W + bias).
+  SkinnyGemm(p.attention_out, w.intermediate_weight, p.n_tokens,
+             p.hidden_size, p.intermediate_size, p.partial, shared);
+  GridSync();
+  AddBiasGelu(p.partial, NumSlices(p.hidden_size), w.intermediate_bias,
+              p.n_tokens, p.intermediate_size, p.intermediate_out);
+  GridSync();
+  // 5. LayerNorm(intermediate_out * W + bias + attention_out).
+  SkinnyGemm(p.intermediate_out, w.output_dense_weight, p.n_tokens,
+             p.intermediate_size, p.hidden_size, p.partial, shared);
+  GridSync();
+  AddBiasLayerNorm(p.partial, NumSlices(p.intermediate_size),
+                   w.output_dense_bias, p.attention_out,
+                   w.output_layer_norm_weight, w.output_layer_norm_bias,
+                   p.epsilon, p.n_tokens, p.hidden_size, p.output);
+}
+#endif
+
+// The blocks of the kernel resident on a GPU at once, the most a
+// cooperative launch takes, or 0 if the GPU does not launch cooperatively.
+int MaxResidentBlocks(int device_id) {
+#if CUDA_VERSION < 11000
+  return 0;
+#else
+  static std::mutex mutex;
+  static std::unordered_map<int, int> blocks;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = blocks.find(device_id);
+  if (it == blocks.end()) {
+    int cooperative = 0, sm_count = 0, blocks_per_sm = 0;
+    // The occupancy is that of the current device, which the caller may not
+    // have set to `device_id`.
+    int prev_device_id = 0;
+    if (cudaGetDevice(&prev_device_id) != cudaSuccess ||
+        cudaSetDevice(device_id) != cudaSuccess ||
+        cudaDeviceGetAttribute(&cooperative, cudaDevAttrCooperativeLaunch,
+                               device_id) != cudaSuccess ||
+        cudaDeviceGetAttribute(&sm_count, cudaDevAttrMultiProcessorCount,
+                               device_id) != cudaSuccess ||
+        cudaOccupancyMaxActiveBlocksPerMultiprocessor(
+            &blocks_per_sm, FusedBertLayerKernel, kBlockSize, 0) !=
+            cudaSuccess) {
+      // Do not leave the error to the next CUDA call.
+      cudaGetLastError();
+      cooperative = 0;
+    }
+    cudaSetDevice(prev_device_id);
+    it = blocks.emplace(device_id, cooperative ? sm_count * blocks_per_sm : 0)
+             .first;
+  }
+  return it->second;
+#endif
+}
+}  // namespace
+
+int64_t GPUFusedBertLayerScratchSize(int64_t n_tokens, int64_t hidden_size,
+                                     int64_t intermediate_size,
+                                     int64_t all_head_size) {
+  int64_t hidden_slices = NumSlices(static_cast<int>(hidden_size));
+  int64_t partial = std::max(
+      {hidden_slices * 3 * all_head_size,
+       NumSlices(static_cast<int>(all_head_size)) * hidden_size,
+       hidden_slices * intermediate_size,
+       NumSlices(static_cast<int>(intermediate_size)) * hidden_size});
+  return n_tokens * (partial + all_head_size + hidden_size + intermediate_size);
+}
+
+bool IsGPUFusedBertLayerSupported(int device_id) {
+  return MaxResidentBlocks(device_id) > 0;
+}
+
+bool GPUFusedBertLayer(const float* input, const float* attention_mask,
+                       int64_t batch_size, int64_t seq_len,
+                       int64_t hidden_size, int64_t intermediate_size,
+                       int64_t num_heads, int64_t size_per_head,
+                       const GPUFusedBertLayerWeights& weights,
+                       float layer_norm_epsilon, float* scratch, float* output,
+                       int device_id, cudaStream_t stream) {
+#if CUDA_VERSION < 11000
+  return false;
+#else
+  Params p;
+  p.input = input;
+  p.attention_mask = attention_mask;
+  p.output = output;
+  p.n_tokens = batch_size * seq_len;
+  p.seq_len = seq_len;
+  p.hidden_size = hidden_size;
+  p.intermediate_size = intermediate_size;
+  p.num_heads = num_heads;
+  p.size_per_head = size_per_head;
+  p.scale = 1.f / sqrtf(static_cast<float>(size_per_head));
+  p.epsilon = layer_norm_epsilon;
+  p.weights = weights;
+  int64_t all_head_size = num_heads * size_per_head;
+  p.context = scratch;
+  p.attention_out = p.context + p.n_tokens * all_head_size;
+  p.intermediate_out = p.attention_out + p.n_tokens * hidden_size;
+  p.partial = p.intermediate_out + p.n_tokens * intermediate_size;
+  // The most units of a phase, more blocks would only wait at the barriers.
+  int units = std::max(
+      {NumGemmUnits(3 * all_head_size, hidden_size),
+       static_cast<int>(batch_size * num_heads),
+       NumGemmUnits(hidden_size, all_head_size),
+       NumGemmUnits(intermediate_size, hidden_size),
+       NumGemmUnits(hidden_size, intermediate_size)});
+  int max_blocks = MaxResidentBlocks(device_id);
+  if (max_blocks == 0) {
+    return false;
+  }
+  // A stream capture does not take a cooperative launch, whose refusal would
+  // invalidate the capture, e.g. the CUDA graph of a BertModel.
+  cudaStreamCaptureStatus capture = cudaStreamCaptureStatusNone;
+  if (cudaStreamIsCapturing(stream, &capture) != cudaSuccess ||
+      capture != cudaStreamCaptureStatusNone) {
+    cudaGetLastError();
+    return false;
+  }
+  int blocks = std::min(units, max_blocks);
+  void* args[] = {&p};
+  if (cudaLaunchCooperativeKernel(
+          reinterpret_cast<const void*>(FusedBertLayerKernel), blocks,
+          kBlockSize, args, 0, stream) != cudaSuccess) {
+    // E.g. the GPU is shared by MPS, which limits the resident blocks.
+    cudaGetLastError();
+    return false;
+  }
+  return true;
+#endif
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,71 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cuda_runtime.h>
+#include <stdint.h>
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// The tokens and the head size GPUFusedBertLayer takes at most.
+constexpr int64_t kGPUFusedBertLayerMaxTokens = 32;
+constexpr int64_t kGPUFusedBertLayerMaxHeadSize = 64;
+
+// The float weights of a BERT encoder layer on the GPU, laid out as
+// BertAttention, BertIntermediate and BertOutput take them, i.e. [in, out].
+struct GPUFusedBertLayerWeights {
+  const float* qkv_weight;
+  const float* qkv_bias;
+  const float* attention_dense_weight;
+  const float* attention_dense_bias;
+  const float* attention_layer_norm_weight;
+  const float* attention_layer_norm_bias;
+  const float* intermediate_weight;
+  const float* intermediate_bias;
+  const float* output_dense_weight;
+  const float* output_dense_bias;
+  const float* output_layer_norm_weight;
+  const float* output_layer_norm_bias;
+};
+
+// The floats of the scratch memory of GPUFusedBertLayer.
+int64_t GPUFusedBertLayerScratchSize(int64_t n_tokens, int64_t hidden_size,
+                                     int64_t intermediate_size,
+                                     int64_t all_head_size);
+
+// Whether the GPU launches the kernel of GPUFusedBertLayer cooperatively.
+// Never before CUDA 11, whose grid barrier needs relocatable device code.
+bool IsGPUFusedBertLayerSupported(int device_id);
+
+// See FusedBertLayer. A persistent kernel of at most as many blocks as are
+// resident on the GPU at once runs the phases of the layer one after another,
+// the blocks meeting at a grid-wide barrier in between. It is launched
+// cooperatively, so that the blocks never wait for blocks which are not
+// scheduled. `scratch` holds the partial products and the activations, which
+// stay in the L2 cache. Returns false, having queued nothing, if the GPU
+// refuses the launch or `stream` is being captured, since a cooperative
+// kernel can not be captured into a CUDA graph. The layer norms add
+// `layer_norm_epsilon` to the variance.
+bool GPUFusedBertLayer(const float* input, const float* attention_mask,
+                       int64_t batch_size, int64_t seq_len,
+                       int64_t hidden_size, int64_t intermediate_size,
+                       int64_t num_heads, int64_t size_per_head,
+                       const GPUFusedBertLayerWeights& weights,
+                       float layer_norm_epsilon, float* scratch, float* output,
+                       int device_id, cudaStream_t stream);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,422 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/gpu_gemm_tuner.h"
+
+#include <cuda.h>
+#if CUDA_VERSION >= 11000
+#include <cublasLt.h>
+#endif
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+#include "loguru.hpp"
+#include "turbo_transformers/core/cuda_enforce.cuh"
+#include "turbo_transformers/core/enforce.h"
+#include "turbo_transformers/core/tensor.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+namespace {
+// The timed runs of every candidate, after a warm up run.
+constexpr int kTimedRuns = 3;
+// The heuristic algorithms of cuBLASLt tried besides the cublasGemmAlgo_t.
+constexpr int kMaxLtAlgos = 8;
+
+struct GemmKey {
+  int device_id;
+  int dtype;
+  int trans_a;
+  int trans_b;
+  int64_t m;
+  int64_t n;
+  int64_t k;
+  int64_t lda;
+  int64_t ldb;
+  int64_t ldc;
+  int64_t batch_count;
+
+  bool operator<(const GemmKey& other) const {
+    return std::tie(device_id, dtype, trans_a, trans_b, m, n, k, lda, ldb, ldc,
+                    batch_count) <
+           std::tie(other.device_id, other.dtype, other.trans_a,
+                    other.trans_b, other.m, other.n, other.k, other.lda,
+                    other.ldb, other.ldc, other.batch_count);
+  }
+};
+
+// Either a cublasGemmAlgo_t of cublasGemmEx, or the opaque
+// cublasLtMatmulAlgo_t of cublasLtMatmul, saved as its 8 words.
+struct GemmAlgo {
+  bool use_lt{false};
+  int algo{CUBLAS_GEMM_DEFAULT_TENSOR_OP};
+  uint64_t lt_algo[8]{};
+};
+
+struct AlgoCache {
+  std::mutex mutex;
+  std::map<GemmKey, GemmAlgo> algos;
+  // The GELU_BIAS epilogue algorithms, use_lt is false if there is none.
+  std::map<GemmKey, GemmAlgo> bias_gelu_algos;
+  // The file of TT_GEMM_ALGO_CACHE, if any.
+  std::string path;
+};
+
+GemmKey MakeKey(const GPUGemmArgs& args, int device_id) {
+  return {device_id, args.dtype, args.trans_a, args.trans_b,
+          args.m,    args.n,     args.k,       args.lda,
+          args.ldb,  args.ldc,   args.batch_count};
+}
+
+void WriteEntry(std::ostream& os, const GemmKey& key, const GemmAlgo& algo) {
+  os << key.device_id << " " << key.dtype << " " << key.trans_a << " "
+     << key.trans_b << " " << key.m << " " << key.n << " " << key.k << " "
+     << key.lda << " " << key.ldb << " " << key.ldc << " " << key.batch_count
+     << " " << algo.use_lt << " " << algo.algo;
+  for (auto word : algo.lt_algo) {
+    os << " " << word;
+  }
+  os << "\n";
+}
+
+void ReadEntries(const std::string& path,
+                 std::map<GemmKey, GemmAlgo>* algos) {
+  std::ifstream is(path);
+  GemmKey key;
+  GemmAlgo algo;
+  while (is >> key.device_id >> key.dtype >> key.trans_a >> key.trans_b >>
+         key.m >> key.n >> key.k >> key.lda >> key.ldb >> key.ldc >>
+         key.batch_count >> algo.use_lt >> algo.algo) {
+    for (auto& word : algo.lt_algo) {
+      is >> word;
+    }
+    (*algos)[key] = algo;
+  }
+}
+
+AlgoCache& GetAlgoCache() {
+  static AlgoCache* cache = [] {
+    auto* cache = new AlgoCache;
+    if (const char* path = std::getenv("TT_GEMM_ALGO_CACHE")) {
+      cache->path = path;
+      ReadEntries(cache->path, &cache->algos);
+      LOG_S(1) << "Loaded " << cache->algos.size()
+               << " GEMM algorithms from " << cache->path;
+    }
+    return cache;
+  }();
+  return *cache;
+}
+
+cublasStatus_t RunGemmEx(const GPUGemmArgs& args, int algo, void* c,
+                         float beta, cublasHandle_t handle) {
+  if (args.batch_count == 1) {
+    return cublasGemmEx(handle, args.trans_a, args.trans_b, args.m, args.n,
+                        args.k, &args.alpha, args.a, args.dtype, args.lda,
+                        args.b, args.dtype, args.ldb, &beta, c, args.dtype,
+                        args.ldc, CUDA_R_32F,
+                        static_cast<cublasGemmAlgo_t>(algo));
+  }
+  return cublasGemmStridedBatchedEx(
+      handle, args.trans_a, args.trans_b, args.m, args.n, args.k, &args.alpha,
+      args.a, args.dtype, args.lda, args.stride_a, args.b, args.dtype,
+      args.ldb, args.stride_b, &beta, c, args.dtype, args.ldc, args.stride_c,
+      args.batch_count, CUDA_R_32F, static_cast<cublasGemmAlgo_t>(algo));
+}
+
+#if CUDA_VERSION >= 11000
+static_assert(sizeof(cublasLtMatmulAlgo_t) == sizeof(GemmAlgo::lt_algo),
+              "cublasLtMatmulAlgo_t is expected to be 8 words");
+
+// The descriptors of the GEMM for cublasLtMatmul. A cuBLAS handle is also a
+// valid cuBLASLt handle.
+class LtGemm {
+ public:
+  LtGemm(const GPUGemmArgs& args, const core::CUDADeviceContext& gpu_ctx)
+      : args_(args),
+        handle_(reinterpret_cast<cublasLtHandle_t>(gpu_ctx.cublas_handle())),
+        stream_(gpu_ctx.stream()) {
+    TT_ENFORCE_CUDA_SUCCESS(
+        cublasLtMatmulDescCreate(&desc_, CUBLAS_COMPUTE_32F, CUDA_R_32F));
+    TT_ENFORCE_CUDA_SUCCESS(cublasLtMatmulDescSetAttribute(
+        desc_, CUBLASLT_MATMUL_DESC_TRANSA, &args.trans_a,
+        sizeof(args.trans_a)));
+    TT_ENFORCE_CUDA_SUCCESS(cublasLtMatmulDescSetAttribute(
+        desc_, CUBLASLT_MATMUL_DESC_TRANSB, &args.trans_b,
+        sizeof(args.trans_b)));
+    bool a_trans = args.trans_a != CUBLAS_OP_N;
+    bool b_trans = args.trans_b != CUBLAS_OP_N;
+    a_layout_ = CreateLayout(a_trans ? args.k : args.m,
+                             a_trans ? args.m : args.k, args.lda,
+                             args.stride_a);
+    b_layout_ = CreateLayout(b_trans ? args.n : args.k,
+                             b_trans ? args.k : args.n, args.ldb,
+                             args.stride_b);
+    c_layout_ = CreateLayout(args.m, args.n, args.ldc, args.stride_c);
+  }
+
+  ~LtGemm() {
+    cublasLtMatrixLayoutDestroy(c_layout_);
+    cublasLtMatrixLayoutDestroy(b_layout_);
+    cublasLtMatrixLayoutDestroy(a_layout_);
+    cublasLtMatmulDescDestroy(desc_);
+  }
+
+#if CUDA_VERSION >= 11040
+  // Adds bias [m] to every column of C and applies gelu in the epilogue.
+  void SetBiasGelu(const void* bias) {
+    cublasLtEpilogue_t epilogue = CUBLASLT_EPILOGUE_GELU_BIAS;
+    TT_ENFORCE_CUDA_SUCCESS(cublasLtMatmulDescSetAttribute(
+        desc_, CUBLASLT_MATMUL_DESC_EPILOGUE, &epilogue, sizeof(epilogue)));
+    TT_ENFORCE_CUDA_SUCCESS(cublasLtMatmulDescSetAttribute(
+        desc_, CUBLASLT_MATMUL_DESC_BIAS_POINTER, &bias, sizeof(bias)));
+  }
+#endif
+
+  // The heuristic algorithms which need no workspace.
+  int GetHeuristics(cublasLtMatmulAlgo_t* algos, int max_algos) {
+    cublasLtMatmulPreference_t preference;
+    TT_ENFORCE_CUDA_SUCCESS(cublasLtMatmulPreferenceCreate(&preference));
+    cublasLtMatmulHeuristicResult_t results[kMaxLtAlgos];
+    int n_results = 0;
+    auto status = cublasLtMatmulAlgoGetHeuristic(
+        handle_, desc_, a_layout_, b_layout_, c_layout_, c_layout_,
+        preference, std::min(max_algos, kMaxLtAlgos), results, &n_results);
+    TT_ENFORCE_CUDA_SUCCESS(cublasLtMatmulPreferenceDestroy(preference));
+    int n_algos = 0;
+    for (int i = 0; status == CUBLAS_STATUS_SUCCESS && i < n_results; ++i) {
+      if (results[i].state == CUBLAS_STATUS_SUCCESS) {
+        algos[n_algos++] = results[i].algo;
+      }
+    }
+    return n_algos;
+  }
+
+  cublasStatus_t Run(const cublasLtMatmulAlgo_t* algo, void* c, float beta) {
+    return cublasLtMatmul(handle_, desc_, &args_.alpha, args_.a, a_layout_,
+                          args_.b, b_layout_, &beta, c, c_layout_, c,
+                          c_layout_, algo, nullptr, 0, stream_);
+  }
+
+ private:
+  cublasLtMatrixLayout_t CreateLayout(int64_t rows, int64_t cols, int64_t ld,
+                                      int64_t stride) {
+    cublasLtMatrixLayout_t layout;
+    TT_ENFORCE_CUDA_SUCCESS(
+        cublasLtMatrixLayoutCreate(&layout, args_.dtype, rows, cols, ld));
+    if (args_.batch_count > 1) {
+      int32_t batch_count = static_cast<int32_t>(args_.batch_count);
+      TT_ENFORCE_CUDA_SUCCESS(cublasLtMatrixLayoutSetAttribute(
+          layout, CUBLASLT_MATRIX_LAYOUT_BATCH_COUNT, &batch_count,
+          sizeof(batch_count)));
+      TT_ENFORCE_CUDA_SUCCESS(cublasLtMatrixLayoutSetAttribute(
+          layout, CUBLASLT_MATRIX_LAYOUT_STRIDED_BATCH_OFFSET, &stride,
+          sizeof(stride)));
+    }
+    return layout;
+  }
+
+  const GPUGemmArgs& args_;
+  cublasLtHandle_t handle_;
+  cudaStream_t stream_;
+  cublasLtMatmulDesc_t desc_;
+  cublasLtMatrixLayout_t a_layout_;
+  cublasLtMatrixLayout_t b_layout_;
+  cublasLtMatrixLayout_t c_layout_;
+};
+#endif
+
+cublasStatus_t RunGemm(const GPUGemmArgs& args, const GemmAlgo& algo,
+                       void* c, float beta,
+                       const core::CUDADeviceContext& gpu_ctx) {
+  if (algo.use_lt) {
+#if CUDA_VERSION >= 11000
+    cublasLtMatmulAlgo_t lt_algo;
+    std::memcpy(&lt_algo, algo.lt_algo, sizeof(lt_algo));
+    return LtGemm(args, gpu_ctx).Run(&lt_algo, c, beta);
+#else
+    TT_THROW("The cuBLASLt GEMM algorithms need CUDA 11 or later.");
+#endif
+  }
+  return RunGemmEx(args, algo.algo, c, beta, gpu_ctx.cublas_handle());
+}
+
+// Times the candidates with beta = 0 on a scratch C, so the output of an
+// accumulating GEMM is left untouched.
+GemmAlgo TuneGemm(const GPUGemmArgs& args,
+                  const core::CUDADeviceContext& gpu_ctx) {
+  size_t elem_size = args.dtype == CUDA_R_16F ? 2 : 4;
+  int64_t c_size =
+      (args.batch_count - 1) * args.stride_c + (args.n - 1) * args.ldc + args.m;
+  core::Tensor scratch(nullptr);
+  void* c = scratch.Reshape<uint8_t>({c_size * static_cast<int64_t>(elem_size)},
+                                     kDLGPU, gpu_ctx.device_id());
+
+  cudaEvent_t start, stop;
+  TT_ENFORCE_CUDA_SUCCESS(cudaEventCreate(&start));
+  TT_ENFORCE_CUDA_SUCCESS(cudaEventCreate(&stop));
+  GemmAlgo best;
+  float best_time = std::numeric_limits<float>::max();
+  auto try_algo = [&](const GemmAlgo& algo) {
+    if (RunGemm(args, algo, c, 0.0f, gpu_ctx) != CUBLAS_STATUS_SUCCESS) {
+      return;
+    }
+    TT_ENFORCE_CUDA_SUCCESS(cudaEventRecord(start, gpu_ctx.stream()));
+    for (int i = 0; i < kTimedRuns; ++i) {
+      RunGemm(args, algo, c, 0.0f, gpu_ctx);
+    }
+    TT_ENFORCE_CUDA_SUCCESS(cudaEventRecord(stop, gpu_ctx.stream()));
+    TT_ENFORCE_CUDA_SUCCESS(cudaEventSynchronize(stop));
+    float elapsed = 0;
+    TT_ENFORCE_CUDA_SUCCESS(cudaEventElapsedTime(&elapsed, start, stop));
+    if (elapsed < best_time) {
+      best_time = elapsed;
+      best = algo;
+    }
+  };
+
+  GemmAlgo algo;
+  for (int id = CUBLAS_GEMM_DEFAULT; id <= CUBLAS_GEMM_ALGO23; ++id) {
+    algo.algo = id;
+    try_algo(algo);
+  }
+  for (int id = CUBLAS_GEMM_DEFAULT_TENSOR_OP;
+       id <= CUBLAS_GEMM_ALGO15_TENSOR_OP; ++id) {
+    algo.algo = id;
+    try_algo(algo);
+  }
+#if CUDA_VERSION >= 11000
+  cublasLtMatmulAlgo_t lt_algos[kMaxLtAlgos];
+  int n_lt_algos = LtGemm(args, gpu_ctx).GetHeuristics(lt_algos, kMaxLtAlgos);
+  algo.use_lt = true;
+  for (int i = 0; i < n_lt_algos; ++i) {
+    std::memcpy(algo.lt_algo, &lt_algos[i], sizeof(lt_algos[i]));
+    try_algo(algo);
+  }
+#endif
+  TT_ENFORCE_CUDA_SUCCESS(cudaEventDestroy(stop));
+  TT_ENFORCE_CUDA_SUCCESS(cudaEventDestroy(start));
+  return best;
+}
+
+bool IsCapturing(cudaStream_t stream) {
+  cudaStreamCaptureStatus status = cudaStreamCaptureStatusNone;
+  TT_ENFORCE_CUDA_SUCCESS(cudaStreamIsCapturing(stream, &status));
+  return status != cudaStreamCaptureStatusNone;
+}
+}  // namespace
+
+void GPUGemm(const GPUGemmArgs& args, const core::CUDADeviceContext& gpu_ctx) {
+  auto& cache = GetAlgoCache();
+  auto key = MakeKey(args, gpu_ctx.device_id());
+  GemmAlgo algo;
+  bool found;
+  {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    auto it = cache.algos.find(key);
+    found = it != cache.algos.end();
+    if (found) {
+      algo = it->second;
+    }
+  }
+  // Timing would synchronize a capturing stream, which invalidates the
+  // capture, so the default algorithm is used without being cached.
+  if (!found && !IsCapturing(gpu_ctx.stream())) {
+    algo = TuneGemm(args, gpu_ctx);
+    LOG_S(1) << "Tuned the GEMM m=" << args.m << " n=" << args.n
+             << " k=" << args.k << " batch=" << args.batch_count << ": "
+             << (algo.use_lt ? std::string("cuBLASLt")
+                             : std::to_string(algo.algo));
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.algos[key] = algo;
+    if (!cache.path.empty()) {
+      std::ofstream os(cache.path, std::ios::app);
+      WriteEntry(os, key, algo);
+    }
+  }
+  TT_ENFORCE_CUDA_SUCCESS(RunGemm(args, algo, args.c, args.beta, gpu_ctx));
+}
+
+bool GPUGemmBiasGelu(const GPUGemmArgs& args, const void* bias,
+                     const core::CUDADeviceContext& gpu_ctx) {
+  TT_ENFORCE(args.batch_count == 1 && args.beta == 0.0f,
+             "The GELU_BIAS epilogue needs a single GEMM with beta = 0.");
+#if CUDA_VERSION >= 11040
+  auto& cache = GetAlgoCache();
+  auto key = MakeKey(args, gpu_ctx.device_id());
+  GemmAlgo algo;
+  bool found;
+  {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    auto it = cache.bias_gelu_algos.find(key);
+    found = it != cache.bias_gelu_algos.end();
+    if (found) {
+      algo = it->second;
+    }
+  }
+  LtGemm gemm(args, gpu_ctx);
+  gemm.SetBiasGelu(bias);
+  cublasLtMatmulAlgo_t lt_algo;
+  if (!found) {
+    // The heuristics only query the host, so they are safe during a capture.
+    algo.use_lt = gemm.GetHeuristics(&lt_algo, 1) == 1;
+    if (algo.use_lt) {
+      std::memcpy(algo.lt_algo, &lt_algo, sizeof(lt_algo));
+    }
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.bias_gelu_algos[key] = algo;
+  }
+  if (!algo.use_lt) {
+    return false;
+  }
+  std::memcpy(&lt_algo, algo.lt_algo, sizeof(lt_algo));
+  TT_ENFORCE_CUDA_SUCCESS(gemm.Run(&lt_algo, args.c, 0.0f));
+  return true;
+#else
+  return false;
+#endif
+}
+
+void LoadGemmAlgoCache(const std::string& path) {
+  std::map<GemmKey, GemmAlgo> algos;
+  // The GELU_BIAS epilogue algorithms, use_lt is false if there is none.
+  std::map<GemmKey, GemmAlgo> bias_gelu_algos;
+  ReadEntries(path, &algos);
+  auto& cache = GetAlgoCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  for (auto& entry : algos) {
+    cache.algos[entry.first] = entry.second;
+  }
+}
+
+void SaveGemmAlgoCache(const std::string& path) {
+  auto& cache = GetAlgoCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  std::ofstream os(path);
+  TT_ENFORCE(os.good(), "Can not open %s", path);
+  for (auto& entry : cache.algos) {
+    WriteEntry(os, entry.first, entry.second);
+  }
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
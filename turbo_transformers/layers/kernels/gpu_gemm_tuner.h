@@ -0,0 +1,82 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cublas_v2.h>
+
+#include <cstdint>
+#include <string>
+
+#include "turbo_transformers/core/cuda_device_context.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// A (strided batched) GEMM C = alpha * op(A) * op(B) + beta * C in the column
+// major convention of cuBLAS. A, B and C hold `dtype`, the products are
+// accumulated in float.
+struct GPUGemmArgs {
+  cublasOperation_t trans_a;
+  cublasOperation_t trans_b;
+  int64_t m;
+  int64_t n;
+  int64_t k;
+  const void* a;
+  int64_t lda;
+  int64_t stride_a;
+  const void* b;
+  int64_t ldb;
+  int64_t stride_b;
+  void* c;
+  int64_t ldc;
+  int64_t stride_c;
+  int64_t batch_count;
+  cudaDataType_t dtype;
+  float alpha;
+  float beta;
+};
+
+// Runs the GEMM with the fastest algorithm for its shape on this device.
+//
+// The first call for a (m, n, k, transposes, leading dims, batch, dtype)
+// times the cublasGemmAlgo_t candidates, and the heuristic algorithms of
+// cuBLASLt since CUDA 11, on a scratch copy of C, then caches the winner for
+// the process. During a CUDA graph capture, unseen shapes take the default
+// algorithm instead, which the warm up run before a capture avoids.
+//
+// If the environment variable TT_GEMM_ALGO_CACHE names a file, the cache is
+// loaded from it on first use and the new winners are appended to it, so the
+// following processes skip the tuning.
+void GPUGemm(const GPUGemmArgs& args, const core::CUDADeviceContext& gpu_ctx);
+
+// C = gelu(alpha * op(A) * op(B) + bias), where bias [m] of `dtype` is added
+// to every column of C, in one cublasLtMatmul with the GELU_BIAS epilogue.
+// The algorithm is the first heuristic of cuBLASLt, cached for the shape.
+// Returns false and leaves C untouched if the epilogue is not available,
+// before CUDA 11.4 or for the shape, then the caller adds the bias itself.
+// The GEMM must not be batched nor accumulate into C.
+bool GPUGemmBiasGelu(const GPUGemmArgs& args, const void* bias,
+                     const core::CUDADeviceContext& gpu_ctx);
+
+// Adds the algorithms saved in `path` to the cache, replacing the cached
+// shapes. The algorithms tuned on another GPU model or cuBLAS version are
+// still correct, but may not be the fastest.
+void LoadGemmAlgoCache(const std::string& path);
+
+// Writes every cached algorithm into `path`.
+void SaveGemmAlgoCache(const std::string& path);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,95 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/gpu_gemv_kernel.h"
+
+#include "turbo_transformers/layers/kernels/gpu_half.cuh"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+namespace {
+// The columns of a block, a warp wide, and the warps splitting k.
+constexpr int kColsPerBlock = 32;
+constexpr int kWarpsPerBlock = 8;
+
+template <typename T>
+__global__ void GemvKernel(const T* a, int64_t lda, const T* b, int64_t ldb,
+                           int m, int n, int k, float alpha, float beta,
+                           T* c, int64_t ldc) {
+  __shared__ float partial[kGPUGemvMaxRows][kWarpsPerBlock][kColsPerBlock];
+  int col = blockIdx.x * kColsPerBlock + threadIdx.x;
+  float acc[kGPUGemvMaxRows] = {0.f};
+  if (col < n) {
+    for (int i = threadIdx.y; i < k; i += kWarpsPerBlock) {
+      float w = ToFloat(b[i * ldb + col]);
+#pragma unroll
+      for (int r = 0; r < kGPUGemvMaxRows; ++r) {
+        if (r < m) {
+          acc[r] += ToFloat(a[r * lda + i]) * w;
+        }
+      }
+    }
+  }
+#pragma unroll
+  for (int r = 0; r < kGPUGemvMaxRows; ++r) {
+    partial[r][threadIdx.y][threadIdx.x] = acc[r];
+  }
+  __syncthreads();
+  // The warp r sums the partial products of the row r.
+  int r = threadIdx.y;
+  if (r < m && col < n) {
+    float sum = 0.f;
+#pragma unroll
+    for (int w = 0; w < kWarpsPerBlock; ++w) {
+      sum += partial[r][w][threadIdx.x];
+    }
+    float val = alpha * sum;
+    if (beta != 0.f) {
+      val += beta * ToFloat(c[r * ldc + col]);
+    }
+    c[r * ldc + col] = FromFloat<T>(val);
+  }
+}
+}  // namespace
+
+template <typename T>
+void GPUGemv(const T* a, int64_t lda, const T* b, int64_t ldb, int m, int n,
+             int k, float alpha, float beta, T* c, int64_t ldc,
+             cudaStream_t stream) {
+  static_assert(kGPUGemvMaxRows <= kWarpsPerBlock,
+                "A warp writes each row of c");
+  if (m == 0 || n == 0) {
+    return;
+  }
+  dim3 grid((n + kColsPerBlock - 1) / kColsPerBlock);
+  dim3 block(kColsPerBlock, kWarpsPerBlock);
+  GemvKernel<DeviceType<T>><<<grid, block, 0, stream>>>(
+      ToDevicePtr(a), lda, ToDevicePtr(b), ldb, m, n, k, alpha, beta,
+      ToDevicePtr(c), ldc);
+}
+
+template void GPUGemv<float>(const float* a, int64_t lda, const float* b,
+                             int64_t ldb, int m, int n, int k, float alpha,
+                             float beta, float* c, int64_t ldc,
+                             cudaStream_t stream);
+template void GPUGemv<core::Half>(const core::Half* a, int64_t lda,
+                                  const core::Half* b, int64_t ldb, int m,
+                                  int n, int k, float alpha, float beta,
+                                  core::Half* c, int64_t ldc,
+                                  cudaStream_t stream);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,39 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cuda_runtime.h>
+#include <stdint.h>
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// The rows of A up to which MatMul on the GPU runs GPUGemv instead of a
+// cuBLAS GEMM.
+constexpr int kGPUGemvMaxRows = 4;
+
+// c = alpha * a * b + beta * c for the row major a [m, k], b [k, n] and c
+// [m, n], whose rows are lda, ldb and ldc elements apart, and m up to
+// kGPUGemvMaxRows. A thread computes a column of c, the threads of a warp
+// consecutive columns, so the rows of b are read coalesced, and the warps of
+// a block split k. The products are accumulated in float. `c` is not read if
+// beta is 0.
+template <typename T>
+void GPUGemv(const T* a, int64_t lda, const T* b, int64_t ldb, int m, int n,
+             int k, float alpha, float beta, T* c, int64_t ldc,
+             cudaStream_t stream);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
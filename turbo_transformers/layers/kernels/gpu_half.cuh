@@ -0,0 +1,79 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+
+#pragma once
+#include <cuda_fp16.h>
+
+namespace turbo_transformers {
+namespace core {
+// core/half.h targets the host compiler, the kernels only need the name of
+// the type, whose storage is the same as __half.
+struct Half;
+}  // namespace core
+
+namespace layers {
+namespace kernels {
+
+// The type used by the kernels for the elements of type T on the host.
+template <typename T>
+struct DeviceTypeTrait {
+  using Type = T;
+};
+
+template <>
+struct DeviceTypeTrait<core::Half> {
+  using Type = __half;
+};
+
+template <typename T>
+using DeviceType = typename DeviceTypeTrait<T>::Type;
+
+template <typename T>
+DeviceType<T>* ToDevicePtr(T* ptr) {
+  return reinterpret_cast<DeviceType<T>*>(ptr);
+}
+
+template <typename T>
+const DeviceType<T>* ToDevicePtr(const T* ptr) {
+  return reinterpret_cast<const DeviceType<T>*>(ptr);
+}
+
+// The kernels load and store the half elements, but compute in float.
+__device__ __forceinline__ float ToFloat(float val) { return val; }
+__device__ __forceinline__ float ToFloat(__half val) {
+  return __half2float(val);
+}
+
+template <typename T>
+__device__ __forceinline__ T FromFloat(float val);
+
+template <>
+__device__ __forceinline__ float FromFloat<float>(float val) {
+  return val;
+}
+
+template <>
+__device__ __forceinline__ __half FromFloat<__half>(float val) {
+  return __float2half(val);
+}
+
+// kPack elements loaded or stored by a single instruction, e.g. a float4.
+template <typename T, int kPack>
+struct alignas(sizeof(T) * kPack) Pack {
+  T data[kPack];
+};
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -12,52 +12,122 @@
 // See the AUTHORS file for names of contributors.
 
 #include <cuda_runtime.h>
-#include <immintrin.h>
 
+#include <cstdint>
 #include <numeric>
 
 #include "turbo_transformers/layers/kernels/gpu_block_reduce.cuh"
+#include "turbo_transformers/layers/kernels/gpu_half.cuh"
 #include "turbo_transformers/layers/kernels/gpu_layer_norm_kernel.h"
 
 namespace turbo_transformers {
 namespace layers {
 namespace kernels {
 
-template <bool AddBias>
-static __global__ void layer_norm_kernel_32x_le_1024(
-    float* out, const float* input, const float* bias, const float* gamma,
-    const float* beta, int m, int n) {
-  int tid = threadIdx.x;
-  int offset = blockIdx.x * n + tid;
-  __shared__ float s_mean;
-  __shared__ float s_variance;
+namespace {
+constexpr int kWarpSize = 32;
+// The warp kernel keeps a row in registers, up to kMaxColsPerThread
+// elements per thread. Longer rows take the block kernel.
+constexpr int kMaxColsPerThread = 128;
+constexpr int kMaxWarpLayerNormLen = kWarpSize * kMaxColsPerThread;
+constexpr int kRowsPerBlock = 4;
 
-  float local_out = 0.0f;
-  if (AddBias) {
-    local_out = out[offset] + input[offset] + bias[tid];
-  } else {
-    local_out = out[offset];
+// Merges the Welford statistics (mean, sum of squared deviations, count) of
+// another part of the row into the ones of this part.
+__device__ __forceinline__ void WelfordMerge(float* mean, float* m2,
+                                             float* count, float other_mean,
+                                             float other_m2,
+                                             float other_count) {
+  if (other_count == 0.f) {
+    return;
   }
+  float new_count = *count + other_count;
+  float delta = other_mean - *mean;
+  *mean += delta * other_count / new_count;
+  *m2 += other_m2 + delta * delta * *count * other_count / new_count;
+  *count = new_count;
+}
 
-  float sum_list[2] = {local_out, local_out * local_out};
-  blockReduce<ReduceType::kSum, 2>(sum_list);
+// One warp per row. Lane l holds the packs l, l + 32, ... of the row, so the
+// loads of a warp are contiguous. The mean and the variance come from a
+// single pass over the registers, the residual and the bias are added on
+// the fly. kPack must divide n. A kN > 0 is the width of the rows, which the
+// packs cover exactly: the bounds checks go away and the counts of the
+// Welford updates, hence their divisions, are known at compile time.
+template <bool AddBias, typename T, int kPack, int kPacksPerThread,
+          int kN = 0>
+__global__ void WarpLayerNormKernel(T* out, const T* input, const T* bias,
+                                    const T* gamma, const T* beta, int m,
+                                    int n, float epsilon) {
+  using PackT = Pack<T, kPack>;
+  static_assert(kN == 0 || kN == kPacksPerThread * kPack * kWarpSize,
+                "The packs must cover the rows exactly.");
+  if (kN > 0) {
+    n = kN;
+  }
+  int row = blockIdx.x * kRowsPerBlock + threadIdx.y;
+  if (row >= m) {
+    return;
+  }
+  T* out_row = out + static_cast<int64_t>(row) * n;
+  const T* input_row = input + static_cast<int64_t>(row) * n;
 
-  if (tid == 0) {
-    float mean = sum_list[0] / n;
-    float mean_2 = sum_list[1] / n;
-    s_mean = mean;
-    s_variance = rsqrtf(mean_2 - mean * mean + 1e-6f);
+  float x[kPacksPerThread][kPack];
+  float mean = 0.f, m2 = 0.f, count = 0.f;
+#pragma unroll
+  for (int p = 0; p < kPacksPerThread; ++p) {
+    int col = (p * kWarpSize + threadIdx.x) * kPack;
+    if (kN > 0 || col < n) {
+      auto out_pack = *reinterpret_cast<const PackT*>(out_row + col);
+      PackT input_pack, bias_pack;
+      if (AddBias) {
+        input_pack = *reinterpret_cast<const PackT*>(input_row + col);
+        bias_pack = *reinterpret_cast<const PackT*>(bias + col);
+      }
+#pragma unroll
+      for (int e = 0; e < kPack; ++e) {
+        x[p][e] = ToFloat(out_pack.data[e]);
+        if (AddBias) {
+          x[p][e] += ToFloat(input_pack.data[e]) + ToFloat(bias_pack.data[e]);
+        }
+        count += 1.f;
+        float delta = x[p][e] - mean;
+        mean += delta / count;
+        m2 += delta * (x[p][e] - mean);
+      }
+    }
+  }
+  for (int offset = kWarpSize / 2; offset > 0; offset /= 2) {
+    WelfordMerge(&mean, &m2, &count,
+                 __shfl_xor_sync(0xffffffff, mean, offset, kWarpSize),
+                 __shfl_xor_sync(0xffffffff, m2, offset, kWarpSize),
+                 __shfl_xor_sync(0xffffffff, count, offset, kWarpSize));
+  }
+  float rstd = rsqrtf(m2 / n + epsilon);
+
+#pragma unroll
+  for (int p = 0; p < kPacksPerThread; ++p) {
+    int col = (p * kWarpSize + threadIdx.x) * kPack;
+    if (kN > 0 || col < n) {
+      auto gamma_pack = *reinterpret_cast<const PackT*>(gamma + col);
+      auto beta_pack = *reinterpret_cast<const PackT*>(beta + col);
+      PackT out_pack;
+#pragma unroll
+      for (int e = 0; e < kPack; ++e) {
+        out_pack.data[e] = FromFloat<T>((x[p][e] - mean) * rstd *
+                                            ToFloat(gamma_pack.data[e]) +
+                                        ToFloat(beta_pack.data[e]));
+      }
+      *reinterpret_cast<PackT*>(out_row + col) = out_pack;
+    }
   }
-  __syncthreads();
-  out[offset] = (local_out - s_mean) * s_variance * gamma[tid] + beta[tid];
 }
 
-// TODO(jiaruifang) if the lowese dimension is not 32x and <= 1024,
-// implementation is not optimized
-template <bool AddBias>
-static __global__ void layer_norm_kernel(float* out, const float* input,
-                                         const float* bias, const float* gamma,
-                                         const float* beta, int m, int n) {
+// One block per row, for the rows which do not fit in the registers of a warp.
+template <bool AddBias, typename T>
+__global__ void layer_norm_kernel(T* out, const T* input, const T* bias,
+                                  const T* gamma, const T* beta, int m, int n,
+                                  float epsilon) {
   int tid = threadIdx.x;
   int offset = blockIdx.x * n;
   int block_dim_x = blockDim.x;
@@ -72,7 +142,8 @@ static __global__ void layer_norm_kernel(float* out, const float* input,
   if (AddBias) {
     idx = tid;
     while (idx < n) {
-      float tmp = (bias[idx] + input[idx + offset] + out[idx + offset]);
+      float tmp = (ToFloat(bias[idx]) + ToFloat(input[idx + offset]) +
+                   ToFloat(out[idx + offset]));
       local_sum_out += tmp;
       local_sum_square_out += tmp * tmp;
       idx += block_dim_x;
@@ -80,7 +151,7 @@ static __global__ void layer_norm_kernel(float* out, const float* input,
   } else {
     idx = tid;
     while (idx < n) {
-      float tmp = out[idx + offset];
+      float tmp = ToFloat(out[idx + offset]);
       local_sum_out += tmp;
       local_sum_square_out += tmp * tmp;
       idx += block_dim_x;
@@ -96,52 +167,148 @@ static __global__ void layer_norm_kernel(float* out, const float* input,
     float mean = sum_list[0] / n;
     float mean_2 = sum_list[1] / n;
     s_mean = mean;
-    s_variance = rsqrtf(mean_2 - mean * mean + 1e-6f);
+    // The single pass may round a constant row to a tiny negative variance.
+    s_variance = rsqrtf(fmaxf(mean_2 - mean * mean, 0.f) + epsilon);
   }
   __syncthreads();
 
   idx = tid;
   if (AddBias) {
     while (idx < n) {
-      out[idx + offset] =
-          (out[idx + offset] + input[idx + offset] + bias[idx] - s_mean) *
-              s_variance * gamma[idx] +
-          beta[idx];
+      out[idx + offset] = FromFloat<T>(
+          (ToFloat(out[idx + offset]) + ToFloat(input[idx + offset]) +
+           ToFloat(bias[idx]) - s_mean) *
+              s_variance * ToFloat(gamma[idx]) +
+          ToFloat(beta[idx]));
       idx += block_dim_x;
     }
   } else {
     while (idx < n) {
-      out[idx + offset] =
-          (out[idx + offset] - s_mean) * s_variance * gamma[idx] + beta[idx];
+      out[idx + offset] = FromFloat<T>(
+          (ToFloat(out[idx + offset]) - s_mean) * s_variance *
+              ToFloat(gamma[idx]) +
+          ToFloat(beta[idx]));
       idx += block_dim_x;
     }
   }
 }
 
+template <bool AddBias, typename T, int kPack, int kPacksPerThread,
+          int kN = 0>
+void LaunchWarpLayerNorm(T* out, const T* input, const T* bias, const T* gamma,
+                         const T* beta, int m, int n, float epsilon,
+                         cudaStream_t stream) {
+  dim3 block(kWarpSize, kRowsPerBlock);
+  dim3 grid((m + kRowsPerBlock - 1) / kRowsPerBlock);
+  WarpLayerNormKernel<AddBias, T, kPack, kPacksPerThread, kN>
+      <<<grid, block, 0, stream>>>(out, input, bias, gamma, beta, m, n,
+                                   epsilon);
+}
+
+// Launches the warp kernel with the fewest packs per thread which cover a
+// row, trying kPacksPerThread, 2 * kPacksPerThread, ... in turn.
+template <bool AddBias, typename T, int kPack, int kPacksPerThread,
+          bool kLast = (kPack * kPacksPerThread >= kMaxColsPerThread)>
+struct WarpLayerNormLauncher {
+  static void Run(T* out, const T* input, const T* bias, const T* gamma,
+                  const T* beta, int m, int n, float epsilon,
+                  cudaStream_t stream) {
+    if (kPacksPerThread * kPack * kWarpSize < n) {
+      WarpLayerNormLauncher<AddBias, T, kPack, kPacksPerThread * 2>::Run(
+          out, input, bias, gamma, beta, m, n, epsilon, stream);
+      return;
+    }
+    LaunchWarpLayerNorm<AddBias, T, kPack, kPacksPerThread>(
+        out, input, bias, gamma, beta, m, n, epsilon, stream);
+  }
+};
+
+template <bool AddBias, typename T, int kPack, int kPacksPerThread>
+struct WarpLayerNormLauncher<AddBias, T, kPack, kPacksPerThread, true> {
+  static void Run(T* out, const T* input, const T* bias, const T* gamma,
+                  const T* beta, int m, int n, float epsilon,
+                  cudaStream_t stream) {
+    LaunchWarpLayerNorm<AddBias, T, kPack, kPacksPerThread>(
+        out, input, bias, gamma, beta, m, n, epsilon, stream);
+  }
+};
+
+// The hidden sizes of BERT-base, BERT-large and GPT-2-large get kernels of
+// their own width, the other ones the launcher above.
+template <bool AddBias, typename T, int kPack>
+bool LaunchFixedWarpLayerNorm(T* out, const T* input, const T* bias,
+                              const T* gamma, const T* beta, int m, int n,
+                              float epsilon, cudaStream_t stream) {
+  constexpr int kRowPack = kPack * kWarpSize;
+  switch (n) {
+    case 768:
+      LaunchWarpLayerNorm<AddBias, T, kPack, 768 / kRowPack, 768>(
+          out, input, bias, gamma, beta, m, n, epsilon, stream);
+      return true;
+    case 1024:
+      LaunchWarpLayerNorm<AddBias, T, kPack, 1024 / kRowPack, 1024>(
+          out, input, bias, gamma, beta, m, n, epsilon, stream);
+      return true;
+    case 1280:
+      LaunchWarpLayerNorm<AddBias, T, kPack, 1280 / kRowPack, 1280>(
+          out, input, bias, gamma, beta, m, n, epsilon, stream);
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool IsAligned(const void* ptr, size_t alignment) {
+  return reinterpret_cast<uintptr_t>(ptr) % alignment == 0;
+}
+}  // namespace
+
 template <bool AddBias, typename T>
 void GPULayerNorm(T* out, const T* input, const T* bias, const T* gamma,
-                  const T* beta, int m, int n, cudaStream_t stream) {
-  dim3 grid(m);
-  if (n <= 1024 && n % 32 == 0) {
-    dim3 block(n);
-    layer_norm_kernel_32x_le_1024<AddBias>
-        <<<grid, block, 0, stream>>>(out, input, bias, gamma, beta, m, n);
+                  const T* beta, int m, int n, float epsilon,
+                  cudaStream_t stream) {
+  using DeviceT = DeviceType<T>;
+  constexpr int kVectorPack = 16 / sizeof(DeviceT);
+  if (n > kMaxWarpLayerNormLen) {
+    dim3 grid(m);
+    dim3 block(1024);
+    layer_norm_kernel<AddBias><<<grid, block, 0, stream>>>(
+        ToDevicePtr(out), ToDevicePtr(input), ToDevicePtr(bias),
+        ToDevicePtr(gamma), ToDevicePtr(beta), m, n, epsilon);
+    return;
+  }
+  // Rows of whole packs are loaded and stored 16 bytes at a time.
+  bool use_vector = n % kVectorPack == 0 && IsAligned(out, 16) &&
+                    IsAligned(gamma, 16) && IsAligned(beta, 16) &&
+                    (!AddBias || (IsAligned(input, 16) && IsAligned(bias, 16)));
+  if (use_vector &&
+      LaunchFixedWarpLayerNorm<AddBias, DeviceT, kVectorPack>(
+          ToDevicePtr(out), ToDevicePtr(input), ToDevicePtr(bias),
+          ToDevicePtr(gamma), ToDevicePtr(beta), m, n, epsilon, stream)) {
+    return;
+  }
+  if (use_vector) {
+    WarpLayerNormLauncher<AddBias, DeviceT, kVectorPack, 1>::Run(
+        ToDevicePtr(out), ToDevicePtr(input), ToDevicePtr(bias),
+        ToDevicePtr(gamma), ToDevicePtr(beta), m, n, epsilon, stream);
   } else {
-    int block_size = min(1024, (int)((n + 31) / 32 * 32));
-    dim3 block(block_size);
-    layer_norm_kernel<AddBias>
-        <<<grid, block, 0, stream>>>(out, input, bias, gamma, beta, m, n);
+    WarpLayerNormLauncher<AddBias, DeviceT, 1, 1>::Run(
+        ToDevicePtr(out), ToDevicePtr(input), ToDevicePtr(bias),
+        ToDevicePtr(gamma), ToDevicePtr(beta), m, n, epsilon, stream);
   }
 }
 
-template void GPULayerNorm<true>(float* out, const float* input,
-                                 const float* bias, const float* gamma,
-                                 const float* beta, int m, int n,
-                                 cudaStream_t stream);
-template void GPULayerNorm<false>(float* out, const float* input,
-                                  const float* bias, const float* gamma,
-                                  const float* beta, int m, int n,
-                                  cudaStream_t stream);
+#define INSTANTIATE_GPU_LAYER_NORM(AddBias, T)                         \
+  template void GPULayerNorm<AddBias, T>(T* out, const T* input,       \
+                                         const T* bias, const T* gamma, \
+                                         const T* beta, int m, int n,   \
+                                         float epsilon, cudaStream_t stream)
+
+INSTANTIATE_GPU_LAYER_NORM(true, float);
+INSTANTIATE_GPU_LAYER_NORM(false, float);
+INSTANTIATE_GPU_LAYER_NORM(true, core::Half);
+INSTANTIATE_GPU_LAYER_NORM(false, core::Half);
+#undef INSTANTIATE_GPU_LAYER_NORM
 }  // namespace kernels
 }  // namespace layers
 }  // namespace turbo_transformers
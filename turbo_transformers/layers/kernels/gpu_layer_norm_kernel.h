@@ -19,7 +19,8 @@ namespace kernels {
 
 template <bool AddBias, typename T>
 void GPULayerNorm(T* out, const T* input, const T* bias, const T* gamma,
-                  const T* beta, int m, int n, cudaStream_t stream);
+                  const T* beta, int m, int n, float epsilon,
+                  cudaStream_t stream);
 }  // namespace kernels
 }  // namespace layers
 }  // namespace turbo_transformers
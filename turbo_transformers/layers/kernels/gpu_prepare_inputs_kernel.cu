@@ -0,0 +1,122 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include <cuda_runtime.h>
+
+#include <cstdint>
+
+#include "turbo_transformers/layers/kernels/gpu_prepare_inputs_kernel.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+namespace {
+constexpr int kBlockSize = 256;
+
+inline int NumBlocks(int64_t size) {
+  return static_cast<int>((size + kBlockSize - 1) / kBlockSize);
+}
+
+__global__ void PadPackedInputsKernel(
+    const int64_t* packed_ids, const int64_t* packed_segment_ids,
+    const int64_t* packed_position_ids, const int64_t* seq_offsets,
+    int64_t size, int64_t max_seq_len, int64_t* input_ids,
+    int64_t* segment_ids, int64_t* position_ids, float* extended_mask) {
+  int64_t i = static_cast<int64_t>(blockIdx.x) * blockDim.x + threadIdx.x;
+  if (i >= size) {
+    return;
+  }
+  int64_t b = i / max_seq_len;
+  int64_t s = i - b * max_seq_len;
+  int64_t begin = seq_offsets[b];
+  bool valid = s < seq_offsets[b + 1] - begin;
+  int64_t src = begin + s;
+  if (input_ids != nullptr) {
+    input_ids[i] = valid ? packed_ids[src] : 0;
+  }
+  if (segment_ids != nullptr) {
+    segment_ids[i] =
+        valid && packed_segment_ids != nullptr ? packed_segment_ids[src] : 0;
+  }
+  if (position_ids != nullptr) {
+    int64_t position = 0;
+    if (valid) {
+      position =
+          packed_position_ids != nullptr ? packed_position_ids[src] : s;
+    }
+    position_ids[i] = position;
+  }
+  if (extended_mask != nullptr) {
+    extended_mask[i] = valid ? 0.f : -10000.f;
+  }
+}
+
+__global__ void PrepareBertMasksKernel(const int64_t* att_mask,
+                                       int64_t* fill_mask,
+                                       int64_t* segment_ids,
+                                       int64_t* position_ids,
+                                       float* extended_mask, int64_t size,
+                                       int64_t seq_len) {
+  int64_t i = static_cast<int64_t>(blockIdx.x) * blockDim.x + threadIdx.x;
+  if (i >= size) {
+    return;
+  }
+  if (fill_mask != nullptr) {
+    fill_mask[i] = 1;
+  }
+  if (segment_ids != nullptr) {
+    segment_ids[i] = 0;
+  }
+  if (position_ids != nullptr) {
+    position_ids[i] = i % seq_len;
+  }
+  if (extended_mask != nullptr) {
+    int64_t v = att_mask == nullptr ? 1 : att_mask[i];
+    extended_mask[i] = -10000.0f * (1 - v);
+  }
+}
+}  // namespace
+
+void GPUPadPackedInputs(const int64_t* packed_ids,
+                        const int64_t* packed_segment_ids,
+                        const int64_t* packed_position_ids,
+                        const int64_t* seq_offsets, int64_t batch_size,
+                        int64_t max_seq_len, int64_t* input_ids,
+                        int64_t* segment_ids, int64_t* position_ids,
+                        float* extended_mask, cudaStream_t stream) {
+  int64_t size = batch_size * max_seq_len;
+  if (size == 0) {
+    return;
+  }
+  PadPackedInputsKernel<<<NumBlocks(size), kBlockSize, 0, stream>>>(
+      packed_ids, packed_segment_ids, packed_position_ids, seq_offsets, size,
+      max_seq_len, input_ids, segment_ids, position_ids, extended_mask);
+}
+
+void GPUPrepareBertMasks(const int64_t* att_mask, int64_t* fill_mask,
+                         int64_t* segment_ids, int64_t* position_ids,
+                         float* extended_mask, int64_t batch_size,
+                         int64_t seq_len, cudaStream_t stream) {
+  int64_t size = batch_size * seq_len;
+  if (size == 0) {
+    return;
+  }
+  PrepareBertMasksKernel<<<NumBlocks(size), kBlockSize, 0, stream>>>(
+      att_mask, fill_mask, segment_ids, position_ids, extended_mask, size,
+      seq_len);
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,42 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cuda_runtime.h>
+#include <stdint.h>
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// See PadPackedInputs, a thread per element of the padded outputs.
+void GPUPadPackedInputs(const int64_t* packed_ids,
+                        const int64_t* packed_segment_ids,
+                        const int64_t* packed_position_ids,
+                        const int64_t* seq_offsets, int64_t batch_size,
+                        int64_t max_seq_len, int64_t* input_ids,
+                        int64_t* segment_ids, int64_t* position_ids,
+                        float* extended_mask, cudaStream_t stream);
+
+// The defaults of PrepareBertMasks in a single launch: the non-null
+// `fill_mask`, `segment_ids` and `position_ids` [batch_size, seq_len] are set
+// to 1, 0 and the index of the token, and the non-null `extended_mask` is
+// computed from `att_mask`, or from the default mask if it is null.
+void GPUPrepareBertMasks(const int64_t* att_mask, int64_t* fill_mask,
+                         int64_t* segment_ids, int64_t* position_ids,
+                         float* extended_mask, int64_t batch_size,
+                         int64_t seq_len, cudaStream_t stream);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
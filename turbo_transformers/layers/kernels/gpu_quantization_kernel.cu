@@ -0,0 +1,193 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include <cuda_runtime.h>
+
+#include "turbo_transformers/layers/kernels/gpu_activation.cuh"
+#include "turbo_transformers/layers/kernels/gpu_block_reduce.cuh"
+#include "turbo_transformers/layers/kernels/gpu_half.cuh"
+#include "turbo_transformers/layers/kernels/gpu_quantization_kernel.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+namespace {
+// One block per row, the reductions need a multiple of 32 threads.
+constexpr int kBlockSize = 256;
+
+struct Identity {
+  __device__ float operator()(float val, int) const { return val; }
+};
+
+template <typename T, ActivationType ActType>
+struct AddBiasAct {
+  const T* bias;
+  __device__ float operator()(float val, int col) const {
+    return ActvationOp<float, ActType>(val + ToFloat(bias[col]));
+  }
+};
+}  // namespace
+
+template <typename T>
+static __global__ void quantize_rows(const T* input, int k, int k_pad,
+                                     int8_t* out, float* scales) {
+  const T* row = input + blockIdx.x * k;
+  __shared__ float s_scale;
+
+  float max_abs = 0.f;
+  for (int j = threadIdx.x; j < k; j += blockDim.x) {
+    max_abs = fmaxf(max_abs, fabsf(ToFloat(row[j])));
+  }
+  blockReduce<ReduceType::kMax, 1>(&max_abs);
+  if (threadIdx.x == 0) {
+    s_scale = max_abs > 0.f ? max_abs / 127.f : 1.f;
+    scales[blockIdx.x] = s_scale;
+  }
+  __syncthreads();
+
+  float inv_scale = 1.f / s_scale;
+  int8_t* dst = out + blockIdx.x * k_pad;
+  for (int j = threadIdx.x; j < k_pad; j += blockDim.x) {
+    dst[j] = j < k ? static_cast<int8_t>(
+                         __float2int_rn(ToFloat(row[j]) * inv_scale))
+                   : 0;
+  }
+}
+
+template <typename T, typename Epilogue>
+static __global__ void dequantize(const int32_t* acc, int n, int ld_acc,
+                                  const float* row_scales,
+                                  const float* col_scales, Epilogue epilogue,
+                                  T* out) {
+  int row = blockIdx.x;
+  float row_scale = row_scales[row];
+  for (int j = threadIdx.x; j < n; j += blockDim.x) {
+    float val = static_cast<float>(acc[row * ld_acc + j]) * row_scale *
+                col_scales[j];
+    out[row * n + j] = FromFloat<T>(epilogue(val, j));
+  }
+}
+
+// The dequantized row is kept in the dynamic shared memory of n floats, so
+// the int32 products are read once.
+template <typename T>
+static __global__ void dequantize_add_bias_layer_norm(
+    const int32_t* acc, int n, int ld_acc, const float* row_scales,
+    const float* col_scales, const T* residual, const T* bias, const T* gamma,
+    const T* beta, float epsilon, T* out) {
+  extern __shared__ float s_row[];
+  __shared__ float s_mean;
+  __shared__ float s_variance;
+  int row = blockIdx.x;
+  float row_scale = row_scales[row];
+
+  float sum_list[2] = {0.f, 0.f};
+  for (int j = threadIdx.x; j < n; j += blockDim.x) {
+    float val = static_cast<float>(acc[row * ld_acc + j]) * row_scale *
+                    col_scales[j] +
+                ToFloat(bias[j]) + ToFloat(residual[row * n + j]);
+    s_row[j] = val;
+    sum_list[0] += val;
+    sum_list[1] += val * val;
+  }
+  blockReduce<ReduceType::kSum, 2>(sum_list);
+  if (threadIdx.x == 0) {
+    float mean = sum_list[0] / n;
+    float mean_2 = sum_list[1] / n;
+    s_mean = mean;
+    // The single pass may round a constant row to a tiny negative variance.
+    s_variance = rsqrtf(fmaxf(mean_2 - mean * mean, 0.f) + epsilon);
+  }
+  __syncthreads();
+
+  for (int j = threadIdx.x; j < n; j += blockDim.x) {
+    out[row * n + j] =
+        FromFloat<T>((s_row[j] - s_mean) * s_variance * ToFloat(gamma[j]) +
+                     ToFloat(beta[j]));
+  }
+}
+
+template <typename T>
+void GPUQuantizeRows(const T* input, int64_t m, int64_t k, int64_t k_pad,
+                     cudaStream_t stream, int8_t* out, float* scales) {
+  quantize_rows<<<m, kBlockSize, 0, stream>>>(ToDevicePtr(input), k, k_pad,
+                                              out, scales);
+}
+
+template <typename T>
+void GPUDequantize(const int32_t* acc, int64_t m, int64_t n, int64_t ld_acc,
+                   const float* row_scales, const float* col_scales,
+                   cudaStream_t stream, T* out) {
+  dequantize<<<m, kBlockSize, 0, stream>>>(acc, n, ld_acc, row_scales,
+                                           col_scales, Identity(),
+                                           ToDevicePtr(out));
+}
+
+template <typename T, types::ActivationType ActType>
+void GPUDequantizeAddBiasAct(const int32_t* acc, int64_t m, int64_t n,
+                             int64_t ld_acc, const float* row_scales,
+                             const float* col_scales, const T* bias,
+                             cudaStream_t stream, T* out) {
+  AddBiasAct<DeviceType<T>, ActType> epilogue{ToDevicePtr(bias)};
+  dequantize<<<m, kBlockSize, 0, stream>>>(acc, n, ld_acc, row_scales,
+                                           col_scales, epilogue,
+                                           ToDevicePtr(out));
+}
+
+template <typename T>
+void GPUDequantizeAddBiasLayerNorm(const int32_t* acc, int64_t m, int64_t n,
+                                   int64_t ld_acc, const float* row_scales,
+                                   const float* col_scales, const T* residual,
+                                   const T* bias, const T* gamma,
+                                   const T* beta, float epsilon,
+                                   cudaStream_t stream, T* out) {
+  dequantize_add_bias_layer_norm<<<m, kBlockSize, n * sizeof(float),
+                                   stream>>>(
+      acc, n, ld_acc, row_scales, col_scales, ToDevicePtr(residual),
+      ToDevicePtr(bias), ToDevicePtr(gamma), ToDevicePtr(beta), epsilon,
+      ToDevicePtr(out));
+}
+
+#define INSTANTIATE_GPU_QUANTIZATION(T)                                       \
+  template void GPUQuantizeRows<T>(const T* input, int64_t m, int64_t k,      \
+                                   int64_t k_pad, cudaStream_t stream,        \
+                                   int8_t* out, float* scales);               \
+  template void GPUDequantize<T>(const int32_t* acc, int64_t m, int64_t n,    \
+                                 int64_t ld_acc, const float* row_scales,     \
+                                 const float* col_scales,                     \
+                                 cudaStream_t stream, T* out);                \
+  template void GPUDequantizeAddBiasAct<T, ActivationType::Gelu>(            \
+      const int32_t* acc, int64_t m, int64_t n, int64_t ld_acc,               \
+      const float* row_scales, const float* col_scales, const T* bias,        \
+      cudaStream_t stream, T* out);                                           \
+  template void GPUDequantizeAddBiasAct<T, ActivationType::Tanh>(            \
+      const int32_t* acc, int64_t m, int64_t n, int64_t ld_acc,               \
+      const float* row_scales, const float* col_scales, const T* bias,        \
+      cudaStream_t stream, T* out);                                           \
+  template void GPUDequantizeAddBiasAct<T, ActivationType::Identity>(        \
+      const int32_t* acc, int64_t m, int64_t n, int64_t ld_acc,               \
+      const float* row_scales, const float* col_scales, const T* bias,        \
+      cudaStream_t stream, T* out);                                           \
+  template void GPUDequantizeAddBiasLayerNorm<T>(                             \
+      const int32_t* acc, int64_t m, int64_t n, int64_t ld_acc,               \
+      const float* row_scales, const float* col_scales, const T* residual,    \
+      const T* bias, const T* gamma, const T* beta, float epsilon,            \
+      cudaStream_t stream, T* out)
+
+INSTANTIATE_GPU_QUANTIZATION(float);
+INSTANTIATE_GPU_QUANTIZATION(core::Half);
+#undef INSTANTIATE_GPU_QUANTIZATION
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,58 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+
+#pragma once
+#include <cuda_runtime.h>
+
+#include <cstdint>
+
+#include "turbo_transformers/layers/types.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// Quantizes the rows of `input` [m, k] symmetrically to int8 [m, k_pad],
+// i.e. row i ~= out[i] * scales[i]. The padding is filled with zeros.
+template <typename T>
+void GPUQuantizeRows(const T* input, int64_t m, int64_t k, int64_t k_pad,
+                     cudaStream_t stream, int8_t* out, float* scales);
+
+// The epilogues of the int8 GEMM. `acc` holds the int32 products [m, ld_acc],
+// whose first n columns are dequantized with the per-row and per-column
+// scales into `out` [m, n].
+template <typename T>
+void GPUDequantize(const int32_t* acc, int64_t m, int64_t n, int64_t ld_acc,
+                   const float* row_scales, const float* col_scales,
+                   cudaStream_t stream, T* out);
+
+// out = Act(dequantized + bias)
+template <typename T, types::ActivationType ActType>
+void GPUDequantizeAddBiasAct(const int32_t* acc, int64_t m, int64_t n,
+                             int64_t ld_acc, const float* row_scales,
+                             const float* col_scales, const T* bias,
+                             cudaStream_t stream, T* out);
+
+// out = LayerNorm(dequantized + bias + residual)
+template <typename T>
+void GPUDequantizeAddBiasLayerNorm(const int32_t* acc, int64_t m, int64_t n,
+                                   int64_t ld_acc, const float* row_scales,
+                                   const float* col_scales, const T* residual,
+                                   const T* bias, const T* gamma,
+                                   const T* beta, float epsilon,
+                                   cudaStream_t stream, T* out);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
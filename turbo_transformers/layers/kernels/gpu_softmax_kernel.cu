@@ -12,11 +12,11 @@
 // See the AUTHORS file for names of contributors.
 
 #include <cuda_runtime.h>
-#include <immintrin.h>
 
-#include <cub/cub.cuh>
-#include <numeric>
+#include <cstdint>
 
+#include "turbo_transformers/layers/kernels/gpu_block_reduce.cuh"
+#include "turbo_transformers/layers/kernels/gpu_half.cuh"
 #include "turbo_transformers/layers/kernels/gpu_softmax_kernel.h"
 
 namespace turbo_transformers {
@@ -24,179 +24,254 @@ namespace layers {
 namespace kernels {
 
 namespace {
-template <typename T, int Len>
-struct Array {
-  __device__ __forceinline__ Array() {}
-  __device__ __forceinline__ Array(T* inputs) {
-    for (int i = 0; i < Len; ++i) {
-      data[i] = inputs[i];
-    }
+constexpr int kWarpSize = 32;
+// The warp kernel keeps a row in registers, up to kMaxColsPerThread
+// elements per thread. Longer rows take the block kernel.
+constexpr int kMaxColsPerThread = 32;
+constexpr int kMaxWarpSoftmaxLen = kWarpSize * kMaxColsPerThread;
+constexpr int kRowsPerBlock = 4;
+constexpr int kBlockSoftmaxSize = 512;
+// The score of the columns beyond the row, whose exp is 0.
+constexpr float kPaddingScore = -1e20f;
+
+// The keys a row attends to, all of them unless the rows are causal, see
+// ApplyMaskAndSoftmax.
+__device__ __forceinline__ int ValidLen(int row, int seq_len, int from_len,
+                                        bool causal) {
+  return causal ? seq_len - from_len + row % from_len + 1 : seq_len;
+}
+
+// One warp per row. Lane l holds the packs l, l + 32, ... of the row, so the
+// loads of a warp are contiguous. kPack must divide seq_len. kFull rows are
+// exactly covered by the packs, so no lane checks the bounds of the row.
+template <typename T, int kPack, int kPacksPerThread, bool kFull>
+__global__ void WarpSoftmaxKernel(T* qk_buf, const float* attr_mask, int rows,
+                                  int rows_per_batch, int seq_len,
+                                  int from_len, bool causal, float scale) {
+  int row = blockIdx.x * kRowsPerBlock + threadIdx.y;
+  if (row >= rows) {
+    return;
   }
-  T data[Len];
-};
+  T* row_ptr = qk_buf + static_cast<int64_t>(row) * seq_len;
+  const float* mask = attr_mask + (row / rows_per_batch) * seq_len;
+  int valid_len = ValidLen(row, seq_len, from_len, causal);
 
-template <typename T, int Len>
-struct ArrayAddFunc {
-  __device__ __forceinline__ Array<T, Len> operator()(const Array<T, Len>& p1,
-                                                      const Array<T, Len>& p2) {
-    Array<T, Len> result;
-    for (int i = 0; i < Len; ++i) {
-      result.data[i] = p1.data[i] + p2.data[i];
+  float x[kPacksPerThread][kPack];
+  float max_val = kPaddingScore;
+#pragma unroll
+  for (int p = 0; p < kPacksPerThread; ++p) {
+    int col = (p * kWarpSize + threadIdx.x) * kPack;
+    if (kFull || col < seq_len) {
+      auto pack = *reinterpret_cast<const Pack<T, kPack>*>(row_ptr + col);
+#pragma unroll
+      for (int e = 0; e < kPack; ++e) {
+        x[p][e] = col + e < valid_len
+                      ? ToFloat(pack.data[e]) * scale + mask[col + e]
+                      : kPaddingScore;
+        max_val = max(max_val, x[p][e]);
+      }
+    } else {
+#pragma unroll
+      for (int e = 0; e < kPack; ++e) {
+        x[p][e] = kPaddingScore;
+      }
     }
-    return result;
   }
-};
+  warpReduce<ReduceType::kMax, 1>(&max_val);
 
-template <typename T, int Len>
-struct ArrayMaxFunc {
-  __device__ __forceinline__ Array<T, Len> operator()(const Array<T, Len>& p1,
-                                                      const Array<T, Len>& p2) {
-    Array<T, Len> result;
-    for (int i = 0; i < Len; ++i) {
-      result.data[i] = p1.data[i] > p2.data[i] ? p1.data[i] : p2.data[i];
+  float sum = 0.f;
+#pragma unroll
+  for (int p = 0; p < kPacksPerThread; ++p) {
+#pragma unroll
+    for (int e = 0; e < kPack; ++e) {
+      x[p][e] = __expf(x[p][e] - max_val);
+      sum += x[p][e];
     }
-    return result;
   }
-};
+  warpReduce<ReduceType::kSum, 1>(&sum);
+  float inv_sum = 1.f / (sum + 1e-6f);
 
-template <int BlockDim, int K>
-__global__ void cub_softmax_kernel_k(float* qk_buf_, const float* attr_mask,
-                                     const int batch_size, const int head_num,
-                                     const int seq_len, const float scaler) {
-  using CubBlockReduce = cub::BlockReduce<Array<float, K>, BlockDim>;
-  __shared__ typename CubBlockReduce::TempStorage temp_storage;
-  __shared__ float s_sum[K], s_max[K];
-  float tmp[K];
-  int qk_offset = blockIdx.x * K * seq_len;
-
-  int batch_id = (blockIdx.x * K) / (head_num * seq_len);
-  int mask_offset = batch_id * seq_len;
-  float mask_val =
-      threadIdx.x < seq_len ? attr_mask[threadIdx.x + mask_offset] : 0.0f;
-
-  for (int i = 0; i < K; ++i) {
-    float qk = threadIdx.x < seq_len
-                   ? qk_buf_[threadIdx.x + qk_offset + seq_len * i]
-                   : 0.0f;
-    int next_batch_id =
-        i == 0 ? batch_id : (blockIdx.x * K + i) / (head_num * seq_len);
-    if (batch_id != next_batch_id) {
-      batch_id = next_batch_id;
-      mask_val = threadIdx.x < seq_len
-                     ? attr_mask[threadIdx.x + batch_id * seq_len]
-                     : 0.0f;
+#pragma unroll
+  for (int p = 0; p < kPacksPerThread; ++p) {
+    int col = (p * kWarpSize + threadIdx.x) * kPack;
+    if (kFull || col < seq_len) {
+      Pack<T, kPack> pack;
+#pragma unroll
+      for (int e = 0; e < kPack; ++e) {
+        pack.data[e] = FromFloat<T>(x[p][e] * inv_sum);
+      }
+      *reinterpret_cast<Pack<T, kPack>*>(row_ptr + col) = pack;
     }
-    // mask_val = (1.0f - mask_val) * -10000.0f;
-    tmp[i] = threadIdx.x < seq_len ? (qk * scaler + mask_val) : -1e20f;
   }
+}
+
+// Merges the softmax statistics (max, sum of exp(x - max)) of two parts.
+__device__ __forceinline__ void MergeMaxSum(float* max_val, float* sum,
+                                            float other_max, float other_sum) {
+  float new_max = max(*max_val, other_max);
+  *sum = *sum * __expf(*max_val - new_max) +
+         other_sum * __expf(other_max - new_max);
+  *max_val = new_max;
+}
 
-  Array<float, K> max_val =
-      CubBlockReduce(temp_storage)
-          .Reduce(Array<float, K>(tmp), ArrayMaxFunc<float, K>());
+// One block per row of any length. The first pass reads the row once for
+// both its max and its sum, the second one writes the probabilities.
+template <typename T, int kPack>
+__global__ void BlockSoftmaxKernel(T* qk_buf, const float* attr_mask,
+                                   int rows_per_batch, int seq_len,
+                                   int from_len, bool causal, float scale) {
+  __shared__ float s_max[kBlockSoftmaxSize / kWarpSize];
+  __shared__ float s_sum[kBlockSoftmaxSize / kWarpSize];
+  T* row_ptr = qk_buf + static_cast<int64_t>(blockIdx.x) * seq_len;
+  const float* mask = attr_mask + (blockIdx.x / rows_per_batch) * seq_len;
+  int valid_len = ValidLen(blockIdx.x, seq_len, from_len, causal);
 
-  if (threadIdx.x == 0) {
-    for (int i = 0; i < K; ++i) {
-      s_max[i] = max_val.data[i];
+  float max_val = kPaddingScore;
+  float sum = 0.f;
+  for (int col = threadIdx.x * kPack; col < seq_len;
+       col += kBlockSoftmaxSize * kPack) {
+    auto pack = *reinterpret_cast<const Pack<T, kPack>*>(row_ptr + col);
+#pragma unroll
+    for (int e = 0; e < kPack; ++e) {
+      if (col + e < valid_len) {
+        MergeMaxSum(&max_val, &sum,
+                    ToFloat(pack.data[e]) * scale + mask[col + e], 1.f);
+      }
     }
   }
+  for (int offset = kWarpSize / 2; offset > 0; offset /= 2) {
+    MergeMaxSum(&max_val, &sum,
+                __shfl_xor_sync(0xffffffff, max_val, offset, kWarpSize),
+                __shfl_xor_sync(0xffffffff, sum, offset, kWarpSize));
+  }
+  int warp = threadIdx.x / kWarpSize;
+  int lane = threadIdx.x % kWarpSize;
+  if (lane == 0) {
+    s_max[warp] = max_val;
+    s_sum[warp] = sum;
+  }
   __syncthreads();
+  max_val = s_max[0];
+  sum = s_sum[0];
+  for (int i = 1; i < kBlockSoftmaxSize / kWarpSize; ++i) {
+    MergeMaxSum(&max_val, &sum, s_max[i], s_sum[i]);
+  }
+  float inv_sum = 1.f / (sum + 1e-6f);
 
-  float qk_tmp[K];
-  for (int i = 0; i < K; ++i) {
-    qk_tmp[i] = threadIdx.x < seq_len ? __expf((tmp[i] - s_max[i])) : 0.0f;
+  for (int col = threadIdx.x * kPack; col < seq_len;
+       col += kBlockSoftmaxSize * kPack) {
+    auto pack = *reinterpret_cast<const Pack<T, kPack>*>(row_ptr + col);
+#pragma unroll
+    for (int e = 0; e < kPack; ++e) {
+      float x = ToFloat(pack.data[e]) * scale + mask[col + e];
+      pack.data[e] = FromFloat<T>(
+          col + e < valid_len ? __expf(x - max_val) * inv_sum : 0.f);
+    }
+    *reinterpret_cast<Pack<T, kPack>*>(row_ptr + col) = pack;
   }
+}
 
-  Array<float, K> sum_val =
-      CubBlockReduce(temp_storage)
-          .Reduce(Array<float, K>(qk_tmp), ArrayAddFunc<float, K>());
+// The padded lengths 32 * kPack * 2^i fill the packs of the warp and take
+// the kernel without bounds checks.
+template <typename T, int kPack, int kPacksPerThread>
+void LaunchWarpSoftmax(T* qk_buf, const float* attr_mask, int rows,
+                       int rows_per_batch, int seq_len, int from_len,
+                       bool causal, float scale, cudaStream_t stream) {
+  dim3 block(kWarpSize, kRowsPerBlock);
+  dim3 grid((rows + kRowsPerBlock - 1) / kRowsPerBlock);
+  if (seq_len == kPacksPerThread * kPack * kWarpSize) {
+    WarpSoftmaxKernel<T, kPack, kPacksPerThread, true>
+        <<<grid, block, 0, stream>>>(qk_buf, attr_mask, rows, rows_per_batch,
+                                     seq_len, from_len, causal, scale);
+  } else {
+    WarpSoftmaxKernel<T, kPack, kPacksPerThread, false>
+        <<<grid, block, 0, stream>>>(qk_buf, attr_mask, rows, rows_per_batch,
+                                     seq_len, from_len, causal, scale);
+  }
+}
 
-  if (threadIdx.x == 0) {
-    for (int i = 0; i < K; ++i) {
-      s_sum[i] = sum_val.data[i] + 1e-6f;
+// Launches the warp kernel with the fewest packs per thread which cover a
+// row, trying kPacksPerThread, 2 * kPacksPerThread, ... in turn.
+template <typename T, int kPack, int kPacksPerThread,
+          bool kLast = (kPack * kPacksPerThread >= kMaxColsPerThread)>
+struct WarpSoftmaxLauncher {
+  static void Run(T* qk_buf, const float* attr_mask, int rows,
+                  int rows_per_batch, int seq_len, int from_len, bool causal,
+                  float scale, cudaStream_t stream) {
+    if (kPacksPerThread * kPack * kWarpSize < seq_len) {
+      WarpSoftmaxLauncher<T, kPack, kPacksPerThread * 2>::Run(
+          qk_buf, attr_mask, rows, rows_per_batch, seq_len, from_len, causal,
+          scale, stream);
+      return;
     }
+    LaunchWarpSoftmax<T, kPack, kPacksPerThread>(qk_buf, attr_mask, rows,
+                                                 rows_per_batch, seq_len,
+                                                 from_len, causal, scale,
+                                                 stream);
   }
-  __syncthreads();
+};
 
-  if (threadIdx.x < seq_len) {
-    for (int i = 0; i < K; ++i) {
-      qk_buf_[threadIdx.x + qk_offset + seq_len * i] = (qk_tmp[i] / s_sum[i]);
-    }
+template <typename T, int kPack, int kPacksPerThread>
+struct WarpSoftmaxLauncher<T, kPack, kPacksPerThread, true> {
+  static void Run(T* qk_buf, const float* attr_mask, int rows,
+                  int rows_per_batch, int seq_len, int from_len, bool causal,
+                  float scale, cudaStream_t stream) {
+    LaunchWarpSoftmax<T, kPack, kPacksPerThread>(qk_buf, attr_mask, rows,
+                                                 rows_per_batch, seq_len,
+                                                 from_len, causal, scale,
+                                                 stream);
+  }
+};
+
+template <typename T, int kPack>
+void LaunchSoftmax(T* qk_buf, const float* attr_mask, int rows,
+                   int rows_per_batch, int seq_len, int from_len, bool causal,
+                   float scale, cudaStream_t stream) {
+  if (seq_len <= kMaxWarpSoftmaxLen) {
+    WarpSoftmaxLauncher<T, kPack, 1>::Run(qk_buf, attr_mask, rows,
+                                          rows_per_batch, seq_len, from_len,
+                                          causal, scale, stream);
+  } else {
+    BlockSoftmaxKernel<T, kPack><<<rows, kBlockSoftmaxSize, 0, stream>>>(
+        qk_buf, attr_mask, rows_per_batch, seq_len, from_len, causal, scale);
   }
 }
 }  // namespace
 
-#define SOFTMAX_KERNEL_CASE(BlockDim, ...)                 \
-  case (BlockDim):                                         \
-    if (row_per_thread_block == RowsPerThreadBlock) {      \
-      cub_softmax_kernel_k<BlockDim, RowsPerThreadBlock>   \
-          <<<grid, block, 0, stream>>>(__VA_ARGS__);       \
-    } else {                                               \
-      cub_softmax_kernel_k<BlockDim, OneRowPerThreadBlock> \
-          <<<grid, block, 0, stream>>>(__VA_ARGS__);       \
-    }                                                      \
-    break
-
-#define RUN_KERNEL(...)                                         \
-  do {                                                          \
-    switch (block.x) {                                          \
-      SOFTMAX_KERNEL_CASE(32, __VA_ARGS__);                     \
-      SOFTMAX_KERNEL_CASE(64, __VA_ARGS__);                     \
-      SOFTMAX_KERNEL_CASE(96, __VA_ARGS__);                     \
-      SOFTMAX_KERNEL_CASE(128, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(160, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(192, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(224, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(256, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(288, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(320, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(352, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(384, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(416, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(448, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(480, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(512, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(544, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(576, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(608, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(640, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(672, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(704, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(736, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(768, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(800, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(832, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(864, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(896, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(928, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(960, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(992, __VA_ARGS__);                    \
-      SOFTMAX_KERNEL_CASE(1024, __VA_ARGS__);                   \
-      default:                                                  \
-        throw std::runtime_error("The block.x should be 32x."); \
-    }                                                           \
-  } while (0)
-
-template <>
-void GPUSoftmaxMask(float* qk_buf, const float* attr_mask, int64_t batch_size,
-                    int64_t head_num, int64_t seq_len, float scale,
-                    cudaStream_t stream) {
-  dim3 block, grid;
-  int high_dim_size = batch_size * head_num * seq_len;
-  const int OneRowPerThreadBlock = 1;
-  const int RowsPerThreadBlock = 2;
-  int row_per_thread_block = OneRowPerThreadBlock;
-  if ((head_num * seq_len) % RowsPerThreadBlock == 0) {
-    row_per_thread_block = RowsPerThreadBlock;
+template <typename T>
+void GPUSoftmaxMask(T* qk_buf, const float* attr_mask, int64_t batch_size,
+                    int64_t head_num, int64_t from_seq_len, int64_t to_seq_len,
+                    float scale, bool causal, cudaStream_t stream) {
+  using DeviceT = DeviceType<T>;
+  constexpr int kVectorPack = 16 / sizeof(DeviceT);
+  int rows = batch_size * head_num * from_seq_len;
+  int rows_per_batch = head_num * from_seq_len;
+  int seq_len = to_seq_len;
+  // Rows of whole packs are loaded and stored 16 bytes at a time.
+  bool use_vector = seq_len % kVectorPack == 0 &&
+                    reinterpret_cast<uintptr_t>(qk_buf) % 16 == 0;
+  if (use_vector) {
+    LaunchSoftmax<DeviceT, kVectorPack>(ToDevicePtr(qk_buf), attr_mask, rows,
+                                        rows_per_batch, seq_len, from_seq_len,
+                                        causal, scale, stream);
+  } else {
+    LaunchSoftmax<DeviceT, 1>(ToDevicePtr(qk_buf), attr_mask, rows,
+                              rows_per_batch, seq_len, from_seq_len, causal,
+                              scale, stream);
   }
-  // block size must be 32x, so warp reduce can work
-  block.x = (seq_len + 31) / 32 * 32;
-  grid.x = high_dim_size / row_per_thread_block;
-  // Because there are many function templates, the compilation speed may be
-  // slow.
-  RUN_KERNEL(qk_buf, attr_mask, batch_size, head_num, seq_len, scale);
 }
-#undef RUN_KERNEL
-#undef SOFTMAX_KERNEL_CASE
+
+template void GPUSoftmaxMask<float>(float* qk_buf, const float* attr_mask,
+                                    int64_t batch_size, int64_t head_num,
+                                    int64_t from_seq_len, int64_t to_seq_len,
+                                    float scale, bool causal,
+                                    cudaStream_t stream);
+template void GPUSoftmaxMask<core::Half>(core::Half* qk_buf,
+                                         const float* attr_mask,
+                                         int64_t batch_size, int64_t head_num,
+                                         int64_t from_seq_len,
+                                         int64_t to_seq_len, float scale,
+                                         bool causal, cudaStream_t stream);
 }  // namespace kernels
 }  // namespace layers
 }  // namespace turbo_transformers
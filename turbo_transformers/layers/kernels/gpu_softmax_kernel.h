@@ -17,10 +17,12 @@ namespace turbo_transformers {
 namespace layers {
 namespace kernels {
 
+// The scores may be float or core::Half, the mask and the softmax itself are
+// always float. See ApplyMaskAndSoftmax for the causal rows.
 template <typename T>
-void GPUSoftmaxMask(T* qk_buf, const T* attr_mask, int64_t batch_size,
-                    int64_t head_num, int64_t seq_len, float scale,
-                    cudaStream_t stream);
+void GPUSoftmaxMask(T* qk_buf, const float* attr_mask, int64_t batch_size,
+                    int64_t head_num, int64_t from_seq_len, int64_t to_seq_len,
+                    float scale, bool causal, cudaStream_t stream);
 }  // namespace kernels
 }  // namespace layers
 }  // namespace turbo_transformers
@@ -16,6 +16,7 @@
 #include <cstdio>
 #include <numeric>
 
+#include "turbo_transformers/layers/kernels/gpu_half.cuh"
 #include "turbo_transformers/layers/kernels/gpu_transpose_kernel.h"
 
 namespace turbo_transformers {
@@ -27,10 +28,11 @@ namespace kernels {
    output : (weight_num, batch_size, head_num, seq_len, size_per_head)
    bias (weight_num, head_num, size_per_head)
    */
+template <typename T>
 static __global__ void split_add_bias_transpose_for_score(
-    const float* input_data, const float* bias_data, const int batch_size,
+    const T* input_data, const T* bias_data, const int batch_size,
     const int seq_len, const int head_num, const int weight_num,
-    const int size_per_head, float* output_data) {
+    const int size_per_head, T* output_data) {
   int tid = threadIdx.x;
   int bid = blockIdx.x;
   int idx = tid;
@@ -44,38 +46,146 @@ static __global__ void split_add_bias_transpose_for_score(
   int weight_id_head_num_size_per_head = weight_id * head_num_size_per_head;
   int head_id_size_per_head = head_id * size_per_head;
   while (idx < size_per_head) {
-    float bias_val = bias_data[weight_id_head_num_size_per_head +
-                               head_id_size_per_head + idx];
+    float bias_val = ToFloat(bias_data[weight_id_head_num_size_per_head +
+                                       head_id_size_per_head + idx]);
     output_data[weight_id * batch_size * seq_len * head_num_size_per_head +
                 batch_id * seq_len * head_num_size_per_head +
                 head_id * seq_len * size_per_head + seq_id * size_per_head +
-                idx] =
-        input_data[batch_id * seq_len * weight_num * head_num_size_per_head +
-                   seq_id * weight_num * head_num_size_per_head +
-                   weight_id_head_num_size_per_head + head_id_size_per_head +
-                   idx] +
-        bias_val;
+                idx] = FromFloat<T>(
+        ToFloat(input_data[batch_id * seq_len * weight_num *
+                               head_num_size_per_head +
+                           seq_id * weight_num * head_num_size_per_head +
+                           weight_id_head_num_size_per_head +
+                           head_id_size_per_head + idx]) +
+        bias_val);
     idx += blockDim.x;
   }
 }
 
-template <>
+// The head sizes of the common models, 64 and 128, get kernels of their own
+// width: a thread per element of a row, with the rows of kFixedBlockSize
+// threads in a block rather than a block of size_per_head threads per row.
+constexpr int kFixedBlockSize = 256;
+
+template <typename T, int kSizePerHead>
+static __global__ void split_add_bias_transpose_for_score_fixed(
+    const T* input_data, const T* bias_data, const int rows,
+    const int batch_size, const int seq_len, const int head_num,
+    const int weight_num, T* output_data) {
+  int row = blockIdx.x * blockDim.y + threadIdx.y;
+  if (row >= rows) {
+    return;
+  }
+  int batch_id = row / (seq_len * weight_num * head_num);
+  int seq_id =
+      row % (seq_len * weight_num * head_num) / (weight_num * head_num);
+  int weight_id = row % (weight_num * head_num) / head_num;
+  int head_id = row % head_num;
+  int idx = threadIdx.x;
+  float bias_val =
+      ToFloat(bias_data[(weight_id * head_num + head_id) * kSizePerHead + idx]);
+  output_data[(((weight_id * batch_size + batch_id) * head_num + head_id) *
+                   seq_len +
+               seq_id) *
+                  kSizePerHead +
+              idx] =
+      FromFloat<T>(ToFloat(input_data[row * kSizePerHead + idx]) + bias_val);
+}
+
+template <typename T, int kSizePerHead>
+static void LaunchSplitAddBiasTransposeForScoreFixed(
+    const T* input_data, const T* bias_data, T* out_data, int batch_size,
+    int seq_len, int weight_num, int head_num, cudaStream_t stream) {
+  constexpr int kRowsPerBlock = kFixedBlockSize / kSizePerHead;
+  int rows = batch_size * seq_len * head_num * weight_num;
+  dim3 grid((rows + kRowsPerBlock - 1) / kRowsPerBlock);
+  dim3 block(kSizePerHead, kRowsPerBlock);
+  split_add_bias_transpose_for_score_fixed<T, kSizePerHead>
+      <<<grid, block, 0, stream>>>(input_data, bias_data, rows, batch_size,
+                                   seq_len, head_num, weight_num, out_data);
+}
+
+template <typename T>
 void GPUSplitAddBiasTransposeForScore(
-    const float* input_data, const float* bias_data, float* out_data,
-    int64_t batch_size, int64_t seq_len, int64_t weight_num,
-    int64_t num_attention_heads, int64_t size_per_head, cudaStream_t stream) {
+    const T* input_data, const T* bias_data, T* out_data, int64_t batch_size,
+    int64_t seq_len, int64_t weight_num, int64_t num_attention_heads,
+    int64_t size_per_head, cudaStream_t stream) {
+  switch (size_per_head) {
+    case 64:
+      LaunchSplitAddBiasTransposeForScoreFixed<DeviceType<T>, 64>(
+          ToDevicePtr(input_data), ToDevicePtr(bias_data),
+          ToDevicePtr(out_data), batch_size, seq_len, weight_num,
+          num_attention_heads, stream);
+      return;
+    case 128:
+      LaunchSplitAddBiasTransposeForScoreFixed<DeviceType<T>, 128>(
+          ToDevicePtr(input_data), ToDevicePtr(bias_data),
+          ToDevicePtr(out_data), batch_size, seq_len, weight_num,
+          num_attention_heads, stream);
+      return;
+  }
   const int n = size_per_head;
   const int m = batch_size * seq_len * num_attention_heads * weight_num;
   dim3 grid(m);
   dim3 block(min(n, 1024));
   split_add_bias_transpose_for_score<<<grid, block, 0, stream>>>(
-      input_data, bias_data, batch_size, seq_len, num_attention_heads,
-      weight_num, size_per_head, out_data);
+      ToDevicePtr(input_data), ToDevicePtr(bias_data), batch_size, seq_len,
+      num_attention_heads, weight_num, size_per_head, ToDevicePtr(out_data));
 }
 
-static __global__ void transpose(const float* src, float* dst,
-                                 const int batch_size, const int seq_len,
-                                 const int head_num, const int size_per_head) {
+template void GPUSplitAddBiasTransposeForScore<float>(
+    const float* input_data, const float* bias_data, float* out_data,
+    int64_t batch_size, int64_t seq_len, int64_t weight_num,
+    int64_t num_attention_heads, int64_t size_per_head, cudaStream_t stream);
+template void GPUSplitAddBiasTransposeForScore<core::Half>(
+    const core::Half* input_data, const core::Half* bias_data,
+    core::Half* out_data, int64_t batch_size, int64_t seq_len,
+    int64_t weight_num, int64_t num_attention_heads, int64_t size_per_head,
+    cudaStream_t stream);
+
+// One block per row of size_per_head elements of the output.
+template <typename T>
+static __global__ void broadcast_bias_for_score(const T* bias_data,
+                                                const int batch_size,
+                                                const int seq_len,
+                                                const int head_num,
+                                                const int size_per_head,
+                                                T* output_data) {
+  int bid = blockIdx.x;
+  int head_id = bid / seq_len % head_num;
+  int weight_id = bid / (seq_len * head_num * batch_size);
+  const T* src = bias_data + (weight_id * head_num + head_id) * size_per_head;
+  T* dst = output_data + bid * size_per_head;
+  for (int idx = threadIdx.x; idx < size_per_head; idx += blockDim.x) {
+    dst[idx] = src[idx];
+  }
+}
+
+template <typename T>
+void GPUBroadcastBiasForScore(const T* bias_data, T* out_data,
+                              int64_t batch_size, int64_t seq_len,
+                              int64_t weight_num, int64_t num_attention_heads,
+                              int64_t size_per_head, cudaStream_t stream) {
+  dim3 grid(weight_num * batch_size * num_attention_heads * seq_len);
+  dim3 block(min(int(size_per_head), 1024));
+  broadcast_bias_for_score<<<grid, block, 0, stream>>>(
+      ToDevicePtr(bias_data), batch_size, seq_len, num_attention_heads,
+      size_per_head, ToDevicePtr(out_data));
+}
+
+template void GPUBroadcastBiasForScore<float>(
+    const float* bias_data, float* out_data, int64_t batch_size,
+    int64_t seq_len, int64_t weight_num, int64_t num_attention_heads,
+    int64_t size_per_head, cudaStream_t stream);
+template void GPUBroadcastBiasForScore<core::Half>(
+    const core::Half* bias_data, core::Half* out_data, int64_t batch_size,
+    int64_t seq_len, int64_t weight_num, int64_t num_attention_heads,
+    int64_t size_per_head, cudaStream_t stream);
+
+template <typename T>
+static __global__ void transpose(const T* src, T* dst, const int batch_size,
+                                 const int seq_len, const int head_num,
+                                 const int size_per_head) {
   int tid = threadIdx.x;
   int batch_id = blockIdx.x / (head_num * seq_len);
   int seq_id = blockIdx.x % seq_len;
@@ -90,23 +200,72 @@ static __global__ void transpose(const float* src, float* dst,
   }
 }
 
+template <typename T, int kSizePerHead>
+static __global__ void transpose_fixed(const T* src, T* dst, const int rows,
+                                       const int seq_len, const int head_num) {
+  int row = blockIdx.x * blockDim.y + threadIdx.y;
+  if (row >= rows) {
+    return;
+  }
+  int batch_id = row / (head_num * seq_len);
+  int seq_id = row % seq_len;
+  int head_id = (row % (head_num * seq_len)) / seq_len;
+  dst[((batch_id * seq_len + seq_id) * head_num + head_id) * kSizePerHead +
+      threadIdx.x] = src[row * kSizePerHead + threadIdx.x];
+}
+
+template <typename T, int kSizePerHead>
+static void LaunchTransposeForScoreFixed(const T* input_data, T* output_data,
+                                         int batch_size, int seq_len,
+                                         int head_num, cudaStream_t stream) {
+  constexpr int kRowsPerBlock = kFixedBlockSize / kSizePerHead;
+  int rows = batch_size * head_num * seq_len;
+  dim3 grid((rows + kRowsPerBlock - 1) / kRowsPerBlock);
+  dim3 block(kSizePerHead, kRowsPerBlock);
+  transpose_fixed<T, kSizePerHead><<<grid, block, 0, stream>>>(
+      input_data, output_data, rows, seq_len, head_num);
+}
+
 /*
    (batch_size, seq_len, num_attention_heads, size_per_head) ->
    (batch_size, head_num, seq_len, size_per_head)
    */
-template <>
-void GPUTransposeForScore(const float* input_data, float* output_data,
+template <typename T>
+void GPUTransposeForScore(const T* input_data, T* output_data,
                           int64_t batch_size, int64_t seq_len,
                           int64_t num_attention_heads, int64_t size_per_head,
                           cudaStream_t stream) {
+  switch (size_per_head) {
+    case 64:
+      LaunchTransposeForScoreFixed<DeviceType<T>, 64>(
+          ToDevicePtr(input_data), ToDevicePtr(output_data), batch_size,
+          seq_len, num_attention_heads, stream);
+      return;
+    case 128:
+      LaunchTransposeForScoreFixed<DeviceType<T>, 128>(
+          ToDevicePtr(input_data), ToDevicePtr(output_data), batch_size,
+          seq_len, num_attention_heads, stream);
+      return;
+  }
   dim3 grid, block;
   grid.x = batch_size * num_attention_heads * seq_len;
   block.x = min(1024, int(size_per_head));
-  transpose<<<grid, block, 0, stream>>>(input_data, output_data, batch_size,
-                                        seq_len, num_attention_heads,
-                                        size_per_head);
+  transpose<<<grid, block, 0, stream>>>(
+      ToDevicePtr(input_data), ToDevicePtr(output_data), batch_size, seq_len,
+      num_attention_heads, size_per_head);
 }
 
+template void GPUTransposeForScore<float>(const float* input_data,
+                                          float* output_data,
+                                          int64_t batch_size, int64_t seq_len,
+                                          int64_t num_attention_heads,
+                                          int64_t size_per_head,
+                                          cudaStream_t stream);
+template void GPUTransposeForScore<core::Half>(
+    const core::Half* input_data, core::Half* output_data, int64_t batch_size,
+    int64_t seq_len, int64_t num_attention_heads, int64_t size_per_head,
+    cudaStream_t stream);
+
 }  // namespace kernels
 }  // namespace layers
 }  // namespace turbo_transformers
@@ -25,6 +25,14 @@ void GPUSplitAddBiasTransposeForScore(const T* input_data, const T* bias_data,
                                       int64_t size_per_head,
                                       cudaStream_t stream);
 
+// output: (weight_num, batch_size, head_num, seq_len, size_per_head) is filled
+// with bias (weight_num, head_num, size_per_head).
+template <typename T>
+void GPUBroadcastBiasForScore(const T* bias_data, T* out_data,
+                              int64_t batch_size, int64_t seq_len,
+                              int64_t weight_num, int64_t num_attention_heads,
+                              int64_t size_per_head, cudaStream_t stream);
+
 template <typename T>
 void GPUTransposeForScore(const T* input_data, T* output_data,
                           int64_t batch_size, int64_t seq_len,
@@ -22,96 +22,106 @@
 #include <thrust/sequence.h>
 #include <thrust/transform.h>
 
+#include "turbo_transformers/layers/kernels/gpu_half.cuh"
+
 namespace turbo_transformers {
 namespace layers {
 namespace kernels {
 
 #define max(a, b) ((a) > (b)) ? (a) : (b)
 
+// Half elements are reduced in float. The threads of a block read adjacent
+// columns, so each row is loaded coalesced.
 template <typename T, types::PoolType t>
-__inline__ T __device__ ReduceOp(const T* target, int start_idx, int stride,
-                                 int len);
-
-template <>
-__inline__ float __device__ ReduceOp<float, types::PoolType::kMax>(
-    const float* input, int start_idx, int stride, int len) {
-  float res = input[start_idx];
-  for (int k = 1; k < len; ++k) {
-    res = max(res, input[start_idx + stride * k]);
+__inline__ float __device__ ReduceOp(const T* input, int start_idx, int stride,
+                                     int len) {
+  if (t == types::PoolType::kLast) {
+    return ToFloat(input[start_idx + stride * (len - 1)]);
   }
-  return res;
-}
-
-template <>
-__inline__ float __device__ ReduceOp<float, types::PoolType::kMean>(
-    const float* input, int start_idx, int stride, int len) {
-  float res = input[start_idx];
+  float res = ToFloat(input[start_idx]);
   for (int k = 1; k < len; ++k) {
-    res += input[start_idx + stride * k];
+    float val = ToFloat(input[start_idx + stride * k]);
+    if (t == types::PoolType::kMax) {
+      res = max(res, val);
+    } else {
+      res += val;
+    }
   }
-  return res / len;
+  return t == types::PoolType::kMean ? res / len : res;
 }
 
 //[batch, seq_len, hidden_size] -> [batch, hidden_size]
 template <typename T, types::PoolType t>
-__global__ void ReduceAixsOne(const T* input, T* output, int batch_size,
+__global__ void ReduceAixsOne(const T* input, T* output,
+                              const int64_t* seq_lens, int batch_size,
                               int seq_len, int hidden_size) {
   int tid = threadIdx.x;  // hidden_size idx
   int gid = blockIdx.x;   // batch_size idx
   if (tid >= hidden_size || gid >= batch_size) return;
   for (int i = gid; i < batch_size; i += gridDim.x) {
+    int len = seq_len;
+    if (seq_lens != nullptr) {
+      len = static_cast<int>(seq_lens[i]);
+      len = len < 1 ? 1 : (len > seq_len ? seq_len : len);
+    }
     for (int j = tid; j < hidden_size; j += blockDim.x) {
       int output_idx = j + i * hidden_size;
       int input_idx = j + i * hidden_size * seq_len;
       output[output_idx] =
-          ReduceOp<T, t>(input, input_idx, hidden_size, seq_len);
+          FromFloat<T>(ReduceOp<T, t>(input, input_idx, hidden_size, len));
     }
   }
 }
 
-template __global__ void ReduceAixsOne<float, types::PoolType::kMax>(
-    const float* input, float* output, int batch_size, int seq_len,
-    int hidden_size);
-template __global__ void ReduceAixsOne<float, types::PoolType::kMean>(
-    const float* input, float* output, int batch_size, int seq_len,
-    int hidden_size);
-
 template <typename T, types::PoolType t>
-void GPUReduceAxisOne(const T* input, T* output, int batch_size, int seq_len,
-                      int hidden_size) {
+void GPUReduceAxisOne(const T* input, T* output, const int64_t* seq_lens,
+                      int batch_size, int seq_len, int hidden_size,
+                      cudaStream_t stream) {
   dim3 grid_size(batch_size);
-  dim3 block_size(max(1024, hidden_size));
-  ReduceAixsOne<T, t><<<grid_size, block_size>>>(input, output, batch_size,
-                                                 seq_len, hidden_size);
+  dim3 block_size(hidden_size < 1024 ? hidden_size : 1024);
+  ReduceAixsOne<DeviceType<T>, t><<<grid_size, block_size, 0, stream>>>(
+      ToDevicePtr(input), ToDevicePtr(output), seq_lens, batch_size, seq_len,
+      hidden_size);
 }
 
-template void GPUReduceAxisOne<float, types::PoolType::kMax>(const float* input,
-                                                             float* output,
-                                                             int batch_size,
-                                                             int seq_len,
-                                                             int hidden_size);
+#define INSTANTIATE_GPU_REDUCE_AXIS_ONE(T, t)                             \
+  template void GPUReduceAxisOne<T, t>(                                   \
+      const T* input, T* output, const int64_t* seq_lens, int batch_size, \
+      int seq_len, int hidden_size, cudaStream_t stream)
 
-template void GPUReduceAxisOne<float, types::PoolType::kMean>(
-    const float* input, float* output, int batch_size, int seq_len,
-    int hidden_size);
+INSTANTIATE_GPU_REDUCE_AXIS_ONE(float, types::PoolType::kMax);
+INSTANTIATE_GPU_REDUCE_AXIS_ONE(float, types::PoolType::kMean);
+INSTANTIATE_GPU_REDUCE_AXIS_ONE(float, types::PoolType::kLast);
+INSTANTIATE_GPU_REDUCE_AXIS_ONE(core::Half, types::PoolType::kMax);
+INSTANTIATE_GPU_REDUCE_AXIS_ONE(core::Half, types::PoolType::kMean);
+INSTANTIATE_GPU_REDUCE_AXIS_ONE(core::Half, types::PoolType::kLast);
+#undef INSTANTIATE_GPU_REDUCE_AXIS_ONE
 
 template <typename T>
-void GPUSequence(T* data_ptr, int64_t size) {
+void GPUSequence(T* data_ptr, int64_t size, cudaStream_t stream) {
   thrust::device_ptr<T> data_dev_ptr = thrust::device_pointer_cast(data_ptr);
-  thrust::sequence(thrust::device, data_dev_ptr, data_dev_ptr + size);
+  thrust::sequence(thrust::cuda::par.on(stream), data_dev_ptr,
+                   data_dev_ptr + size);
 }
 
-template void GPUSequence<int64_t>(int64_t* data_ptr, int64_t size);
-template void GPUSequence<float>(float* data_ptr, int64_t size);
+template void GPUSequence<int64_t>(int64_t* data_ptr, int64_t size,
+                                   cudaStream_t stream);
+template void GPUSequence<float>(float* data_ptr, int64_t size,
+                                 cudaStream_t stream);
 
 template <typename T>
-void GPUFill(T* data_ptr, int64_t size, T val) {
+void GPUFill(T* data_ptr, int64_t size, T val, cudaStream_t stream) {
   thrust::device_ptr<T> data_dev_ptr = thrust::device_pointer_cast(data_ptr);
-  thrust::fill(thrust::device, data_dev_ptr, data_dev_ptr + size, val);
+  thrust::fill(thrust::cuda::par.on(stream), data_dev_ptr, data_dev_ptr + size,
+               val);
 }
 
-template void GPUFill<int64_t>(int64_t* data_ptr, int64_t size, int64_t val);
-template void GPUFill<float>(float* data_ptr, int64_t size, float val);
+template void GPUFill<int64_t>(int64_t* data_ptr, int64_t size, int64_t val,
+                               cudaStream_t stream);
+template void GPUFill<float>(float* data_ptr, int64_t size, float val,
+                             cudaStream_t stream);
+template void GPUFill<uint16_t>(uint16_t* data_ptr, int64_t size,
+                                uint16_t val, cudaStream_t stream);
 
 struct negative_functor {
   __host__ __device__ float operator()(const int64_t& v) const {
@@ -119,14 +129,25 @@ struct negative_functor {
   }
 };
 void GPUTransform(int64_t* src_data_ptr, float* dst_data_ptr,
-                  const int64_t size) {
+                  const int64_t size, cudaStream_t stream) {
   negative_functor func;
   thrust::device_ptr<int64_t> src_data_ptr_dev_ptr =
       thrust::device_pointer_cast(src_data_ptr);
   thrust::device_ptr<float> dst_data_ptr_dev_ptr =
       thrust::device_pointer_cast(dst_data_ptr);
-  thrust::transform(src_data_ptr_dev_ptr, src_data_ptr_dev_ptr + size,
-                    dst_data_ptr_dev_ptr, func);
+  thrust::transform(thrust::cuda::par.on(stream), src_data_ptr_dev_ptr,
+                    src_data_ptr_dev_ptr + size, dst_data_ptr_dev_ptr, func);
+}
+
+void GPUAccumulate(const float* src_data_ptr, float* dst_data_ptr,
+                   int64_t size, cudaStream_t stream) {
+  thrust::device_ptr<const float> src_dev_ptr =
+      thrust::device_pointer_cast(src_data_ptr);
+  thrust::device_ptr<float> dst_dev_ptr =
+      thrust::device_pointer_cast(dst_data_ptr);
+  thrust::transform(thrust::cuda::par.on(stream), src_dev_ptr,
+                    src_dev_ptr + size, dst_dev_ptr, dst_dev_ptr,
+                    thrust::plus<float>());
 }
 
 }  // namespace kernels
@@ -12,6 +12,7 @@
 // See the AUTHORS file for names of contributors.
 
 #pragma once
+#include <cuda_runtime.h>
 #include <stdint.h>
 #include "turbo_transformers/layers/types.h"
 
@@ -19,18 +20,25 @@ namespace turbo_transformers {
 namespace layers {
 namespace kernels {
 
+// Pools [batch_size, seq_len, hidden_size] into [batch_size, hidden_size]
+// with kMax, kMean or kLast. If seq_lens is not null, only the first
+// seq_lens[i] positions of the i-th sequence are pooled.
 template <typename T, layers::types::PoolType t>
-void GPUReduceAxisOne(const T* input, T* output, int batch_size, int seq_len,
-                      int hidden_size);
+void GPUReduceAxisOne(const T* input, T* output, const int64_t* seq_lens,
+                      int batch_size, int seq_len, int hidden_size,
+                      cudaStream_t stream);
 
 template <typename T>
-void GPUSequence(T* data_ptr, int64_t size);
+void GPUSequence(T* data_ptr, int64_t size, cudaStream_t stream);
 
 template <typename T>
-void GPUFill(T* data_ptr, int64_t size, T val);
+void GPUFill(T* data_ptr, int64_t size, T val, cudaStream_t stream);
 
 extern void GPUTransform(int64_t* src_data_ptr, float* dst_data_ptr,
-                         const int64_t size);
+                         const int64_t size, cudaStream_t stream);
+
+extern void GPUAccumulate(const float* src_data_ptr, float* dst_data_ptr,
+                          int64_t size, cudaStream_t stream);
 
 }  // namespace kernels
 }  // namespace layers
@@ -0,0 +1,66 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include <cuda_runtime.h>
+
+#include <cstdint>
+
+#include "turbo_transformers/layers/kernels/gpu_window_merge_kernel.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+namespace {
+constexpr int kBlockSize = 256;
+
+__global__ void MergeWindowsKernel(const float* input, int64_t size,
+                                   int64_t hidden_size, int64_t window_tokens,
+                                   int64_t stride, int64_t prefix,
+                                   int64_t window_rows, int64_t num_windows,
+                                   bool mean, float* output) {
+  int64_t i = static_cast<int64_t>(blockIdx.x) * blockDim.x + threadIdx.x;
+  if (i >= size) {
+    return;
+  }
+  int64_t t = i / hidden_size;
+  int64_t h = i - t * hidden_size;
+  int64_t first = t < window_tokens ? 0 : (t - window_tokens) / stride + 1;
+  int64_t last = min(num_windows - 1, t / stride);
+  float result = mean ? 0.f : -INFINITY;
+  for (int64_t w = first; w <= last; ++w) {
+    float value =
+        input[(w * window_rows + prefix + t - w * stride) * hidden_size + h];
+    result = mean ? result + value : fmaxf(result, value);
+  }
+  output[i] = mean ? result / (last - first + 1) : result;
+}
+}  // namespace
+
+void GPUMergeWindows(const float* input, int64_t doc_len, int64_t hidden_size,
+                     int64_t window_tokens, int64_t stride, int64_t prefix,
+                     int64_t window_rows, int64_t num_windows, bool mean,
+                     float* output, cudaStream_t stream) {
+  int64_t size = doc_len * hidden_size;
+  if (size == 0) {
+    return;
+  }
+  int blocks = static_cast<int>((size + kBlockSize - 1) / kBlockSize);
+  MergeWindowsKernel<<<blocks, kBlockSize, 0, stream>>>(
+      input, size, hidden_size, window_tokens, stride, prefix, window_rows,
+      num_windows, mean, output);
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
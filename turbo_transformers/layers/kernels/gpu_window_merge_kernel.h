@@ -0,0 +1,30 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cuda_runtime.h>
+#include <stdint.h>
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// See MergeWindows, a thread per element of the output.
+void GPUMergeWindows(const float* input, int64_t doc_len, int64_t hidden_size,
+                     int64_t window_tokens, int64_t stride, int64_t prefix,
+                     int64_t window_rows, int64_t num_windows, bool mean,
+                     float* output, cudaStream_t stream);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
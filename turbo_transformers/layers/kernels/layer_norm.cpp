@@ -14,7 +14,10 @@
 #include "turbo_transformers/layers/kernels/layer_norm.h"
 
 #include "common.h"
+#include "turbo_transformers/core/config.h"
+#include "turbo_transformers/core/profiler.h"
 #include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/kernels/cpu_vector_kernels.h"
 #ifdef TT_WITH_CUDA
 #include "turbo_transformers/core/cuda_device_context.h"
 #include "turbo_transformers/layers/kernels/common.h"
@@ -24,11 +27,32 @@
 namespace turbo_transformers {
 namespace layers {
 namespace kernels {
-static constexpr float g_epsilon = 1e-12;
+namespace {
+// core::Half is only supported by the GPU kernels.
+template <bool AddBias, typename T>
+void CPULayerNorm(T* out, const T* input, const T* bias, const T* gamma,
+                  const T* beta, float epsilon, int64_t m, int64_t n) {
+  TT_THROW("The CPU LayerNorm only supports float.");
+}
+
+template <bool AddBias>
+void CPULayerNorm(float* out, const float* input, const float* bias,
+                  const float* gamma, const float* beta, float epsilon,
+                  int64_t m, int64_t n) {
+  auto layer_norm = GetCPUVectorKernels().layer_norm;
+  int n_th = core::ParallelThreadsFor(m * n);
+#pragma omp parallel for num_threads(n_th) if (n_th > 1)
+  for (int64_t batch_idx = 0; batch_idx < m; ++batch_idx) {
+    layer_norm(out + batch_idx * n, AddBias ? input + batch_idx * n : nullptr,
+               AddBias ? bias : nullptr, gamma, beta, epsilon, n);
+  }
+}
+}  // namespace
 
 template <typename T>
 void LayerNorm(const core::Tensor& gamma, const core::Tensor& beta,
-               core::Tensor* out_tensor) {
+               core::Tensor* out_tensor, float epsilon) {
+  core::ProfileScope profile_scope("LayerNorm", *out_tensor);
   TT_ENFORCE_EQ(
       common::is_same_device_ctx(gamma.device_ctx(), beta.device_ctx()), true,
       "LayerNorm gamma and beta must be on the same device context.");
@@ -43,34 +67,18 @@ void LayerNorm(const core::Tensor& gamma, const core::Tensor& beta,
   const auto beta_ptr = beta.data<T>();
 
   if (out_tensor->device_type() == kDLCPU) {
-#pragma omp parallel for
-    for (int64_t batch_idx = 0; batch_idx < batch_size; ++batch_idx) {
-      T mean = 0;
-      T var = 0;
-      auto start_idx = batch_idx * feature_dim;
-      auto end_idx = (batch_idx + 1) * feature_dim;
-#pragma omp simd reduction(+ : mean, var)
-      for (int64_t i = start_idx; i < end_idx; i++) {
-        mean += out[i];
-        var += out[i] * out[i];
-      }
-      mean = mean / feature_dim;
-      var = var / feature_dim - mean * mean;
-
-      var = 1.f / sqrtf(var + g_epsilon);
-
-#pragma omp simd
-      for (int64_t i = 0; i < feature_dim; ++i) {
-        int64_t j = batch_idx * feature_dim + i;
-        out[j] = beta_ptr[i] + gamma_ptr[i] * var * (out[j] - mean);
-      }
-    }
+    const T* input = nullptr;
+    const T* bias = nullptr;
+    CPULayerNorm</*AddBias*/ false>(out, input, bias, gamma_ptr, beta_ptr,
+                                    epsilon, batch_size, feature_dim);
   } else if (out_tensor->device_type() == kDLGPU) {
 #ifdef TT_WITH_CUDA
-    auto& cuda_ctx = core::CUDADeviceContext::GetInstance();
+    auto& cuda_ctx =
+        core::CUDADeviceContext::GetInstance(out_tensor->device_id());
     T* bias = nullptr;
     GPULayerNorm</*AddBias*/ false>(out, out, bias, gamma_ptr, beta_ptr,
-                                    batch_size, feature_dim, cuda_ctx.stream());
+                                    batch_size, feature_dim, epsilon,
+                                    cuda_ctx.stream());
 #else
     TT_THROW("The current code is not compiled with CUDA.");
 #endif
@@ -82,14 +90,18 @@ void LayerNorm(const core::Tensor& gamma, const core::Tensor& beta,
 
 template void LayerNorm<float>(const core::Tensor& gamma,
                                const core::Tensor& beta,
-                               core::Tensor* out_tensor);
+                               core::Tensor* out_tensor, float epsilon);
+template void LayerNorm<core::Half>(const core::Tensor& gamma,
+                                    const core::Tensor& beta,
+                                    core::Tensor* out_tensor, float epsilon);
 
 template <typename T>
 void AddBiasLayerNorm(const core::Tensor& input_tensor,
                       const core::Tensor& bias_tensor,
                       const core::Tensor& gamma_tensor,
                       const core::Tensor& beta_tensor,
-                      core::Tensor* out_tensor) {
+                      core::Tensor* out_tensor, float epsilon) {
+  core::ProfileScope profile_scope("AddBiasLayerNorm", input_tensor);
   TT_ENFORCE_EQ(common::is_same_device_ctx(input_tensor.device_ctx(),
                                            bias_tensor.device_ctx()),
                 true,
@@ -117,33 +129,14 @@ void AddBiasLayerNorm(const core::Tensor& input_tensor,
   // TODO(florianzhao): Check the dim of bias_tensor, gamma_tensor, beta_tensor,
   // out_tensor
   if (input_tensor.device_type() == kDLCPU) {
-#pragma omp parallel for
-    for (int64_t batch_idx = 0; batch_idx < m; ++batch_idx) {
-      T mean = 0;
-      T var = 0;
-#pragma omp simd reduction(+ : mean, var)
-      for (int64_t i = batch_idx * n; i < (batch_idx + 1) * n; i++) {
-        int64_t j = i - batch_idx * n;
-        T t = out[i] = out[i] + input[i] + bias[j];
-        mean += t;
-        var += t * t;
-      }
-      mean = mean / n;
-      var = var / n - mean * mean;
-
-      var = 1.f / sqrtf(var + g_epsilon);
-
-#pragma omp simd
-      for (int64_t i = 0; i < n; ++i) {
-        int64_t j = batch_idx * n + i;
-        out[j] = beta[i] + gamma[i] * var * (out[j] - mean);
-      }
-    }
+    CPULayerNorm</*AddBias*/ true>(out, input, bias, gamma, beta, epsilon, m,
+                                   n);
   } else if (input_tensor.device_type() == kDLGPU) {
 #ifdef TT_WITH_CUDA
-    core::CUDADeviceContext& cuda_ctx = core::CUDADeviceContext::GetInstance();
+    core::CUDADeviceContext& cuda_ctx =
+        core::CUDADeviceContext::GetInstance(out_tensor->device_id());
     GPULayerNorm</*AddBias*/ true>(out, input, bias, gamma, beta, m, n,
-                                   cuda_ctx.stream());
+                                   epsilon, cuda_ctx.stream());
 #else
     TT_THROW("The current code is not compiled with CUDA.");
 #endif
@@ -157,7 +150,14 @@ template void AddBiasLayerNorm<float>(const core::Tensor& input_tensor,
                                       const core::Tensor& bias_tensor,
                                       const core::Tensor& gamma_tensor,
                                       const core::Tensor& beta_tensor,
-                                      core::Tensor* out_tensor);
+                                      core::Tensor* out_tensor,
+                                      float epsilon);
+template void AddBiasLayerNorm<core::Half>(const core::Tensor& input_tensor,
+                                           const core::Tensor& bias_tensor,
+                                           const core::Tensor& gamma_tensor,
+                                           const core::Tensor& beta_tensor,
+                                           core::Tensor* out_tensor,
+                                           float epsilon);
 
 }  // namespace kernels
 }  // namespace layers
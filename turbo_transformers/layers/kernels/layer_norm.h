@@ -20,16 +20,22 @@ namespace turbo_transformers {
 namespace layers {
 namespace kernels {
 
+// The layer_norm_eps of BERT. Other models pass their own, e.g. the 1e-5
+// of GPT-2.
+constexpr float kLayerNormEpsilon = 1e-12f;
+
 template <typename T>
 extern void LayerNorm(const core::Tensor& gamma, const core::Tensor& beta,
-                      core::Tensor* out_tensor);
+                      core::Tensor* out_tensor,
+                      float epsilon = kLayerNormEpsilon);
 
 template <typename T>
 extern void AddBiasLayerNorm(const core::Tensor& input_tensor,
                              const core::Tensor& bias_tensor,
                              const core::Tensor& gamma_tensor,
                              const core::Tensor& beta_tensor,
-                             core::Tensor* out_tensor);
+                             core::Tensor* out_tensor,
+                             float epsilon = kLayerNormEpsilon);
 
 }  // namespace kernels
 }  // namespace layers
@@ -29,7 +29,8 @@ namespace kernels {
 
 #ifdef TT_WITH_CUDA
 TEST_CASE("add_bias_layer_norm-test") {
-  std::vector<int64_t> hidden_size_list{12 * 64, 2000};
+  std::vector<int64_t> hidden_size_list{12 * 64, 1023, 1024, 1280,
+                                       2000, 4096, 5000};
   std::vector<int64_t> batch_size_list{1, 20};
   std::vector<int64_t> seq_length_list{10,  20,  40,  60,  80,
                                        100, 200, 300, 400, 500};
@@ -71,6 +72,35 @@ TEST_CASE("add_bias_layer_norm-test") {
         REQUIRE(common::CheckResultOfCPUAndGPU<float>(cpu_out, gpu_out));
       }
 }
+
+TEST_CASE("add_bias_layer_norm-gpu-fp16-test") {
+  for (int64_t hidden_size : {12 * 64, 1022, 1280})
+    for (int64_t batch_size : {1, 20})
+      for (int64_t seq_length : {10, 100}) {
+        core::Tensor cpu_input(nullptr), gpu_input(nullptr), cpu_bias(nullptr),
+            gpu_bias(nullptr), cpu_out(nullptr), gpu_out(nullptr),
+            cpu_gamma(nullptr), gpu_gamma(nullptr), cpu_beta(nullptr),
+            gpu_beta(nullptr);
+        std::tie(cpu_input, gpu_input) =
+            common::CreateAndFillRandomForCPUGPUHalfTensors(
+                {batch_size, seq_length, hidden_size});
+        std::tie(cpu_bias, gpu_bias) =
+            common::CreateAndFillRandomForCPUGPUHalfTensors({hidden_size});
+        std::tie(cpu_out, gpu_out) =
+            common::CreateAndFillRandomForCPUGPUHalfTensors(
+                {batch_size, seq_length, hidden_size});
+        std::tie(cpu_gamma, gpu_gamma) =
+            common::CreateAndFillRandomForCPUGPUHalfTensors({hidden_size});
+        std::tie(cpu_beta, gpu_beta) =
+            common::CreateAndFillRandomForCPUGPUHalfTensors({hidden_size});
+
+        AddBiasLayerNorm<float>(cpu_input, cpu_bias, cpu_gamma, cpu_beta,
+                                &cpu_out);
+        AddBiasLayerNorm<core::Half>(gpu_input, gpu_bias, gpu_gamma, gpu_beta,
+                                     &gpu_out);
+        REQUIRE(common::CheckResultOfCPUAndGPUHalf(cpu_out, gpu_out, 1e-2));
+      }
+}
 #endif
 
 }  // namespace kernels
@@ -13,23 +13,208 @@
 
 #include "mat_mul.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
 #include "common.h"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/profiler.h"
+#include "turbo_transformers/layers/kernels/activation.h"
+#include "turbo_transformers/layers/kernels/cpu_vector_kernels.h"
+#include "turbo_transformers/layers/kernels/layer_norm.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #ifdef TT_WITH_CUDA
 #include <cuda.h>
 
 #include "turbo_transformers/core/cuda_device_context.h"
 #include "turbo_transformers/core/cuda_enforce.cuh"
+#include "turbo_transformers/layers/kernels/gpu_gemm_tuner.h"
+#include "turbo_transformers/layers/kernels/gpu_gemv_kernel.h"
+#include "turbo_transformers/layers/kernels/gpu_layer_norm_kernel.h"
 #endif
 
 namespace turbo_transformers {
 namespace layers {
 namespace kernels {
-void MatMul(const core::Tensor& A, bool a_trans, const core::Tensor& B,
-            bool b_trans, float alpha, core::Tensor* out, float beta) {
-  BlasInt a_cols = A.shape(-1);
-  BlasInt a_rows = A.numel() / a_cols;
-  BlasInt b_cols = B.shape(-1);
-  BlasInt b_rows = B.numel() / b_cols;
+namespace {
+// Collapses the dims [begin, end) of `t` into one dim, whose stride is
+// stored in `stride`. Returns false if the dims can not be collapsed.
+bool CollapseDims(const core::TensorView& t, int begin, int end,
+                  int64_t* stride) {
+  *stride = 0;
+  int64_t expected = -1;
+  for (int i = end - 1; i >= begin; --i) {
+    if (t.shape(i) == 1) {
+      continue;
+    }
+    if (expected < 0) {
+      *stride = t.stride(i);
+    } else if (t.stride(i) != expected) {
+      return false;
+    }
+    expected = t.stride(i) * t.shape(i);
+  }
+  return true;
+}
+
+// How a strided matrix is passed to BLAS. A matrix whose rows are dense is
+// row major, one whose columns are dense, e.g. torch.t(weight), is column
+// major and passed as the transposed row major matrix.
+struct MatrixLayout {
+  BlasInt rows;
+  BlasInt cols;
+  BlasInt ld;
+  bool col_major;
+};
+
+// The matrix formed by the last dim of `t` and the dims [rows_begin, ndim - 1)
+// flattened into the rows.
+MatrixLayout GetMatrixLayout(const core::TensorView& t, int rows_begin) {
+  int ndim = static_cast<int>(t.n_dim());
+  MatrixLayout layout;
+  layout.cols = t.shape(-1);
+  layout.rows = 1;
+  for (int i = rows_begin; i < ndim - 1; ++i) {
+    layout.rows *= t.shape(i);
+  }
+  int64_t row_stride;
+  TT_ENFORCE(CollapseDims(t, rows_begin, ndim - 1, &row_stride),
+             "The rows of the matrix can not be flattened");
+  int64_t col_stride = t.stride(-1);
+  if (layout.cols == 1 || col_stride == 1) {
+    layout.col_major = false;
+    layout.ld = layout.rows == 1 ? std::max<BlasInt>(layout.cols, 1)
+                                 : static_cast<BlasInt>(row_stride);
+  } else if (layout.rows == 1 || row_stride == 1) {
+    layout.col_major = true;
+    layout.ld = static_cast<BlasInt>(col_stride);
+  } else {
+    TT_THROW("Neither the rows nor the columns of the matrix are dense");
+  }
+  return layout;
+}
+
+// The offsets of the matrices of `t` by their index in the batch, whose dims
+// are those before the last two and may have any strides.
+std::vector<int64_t> GetBatchOffsets(const core::TensorView& t) {
+  int batch_ndim = static_cast<int>(t.n_dim()) - 2;
+  int64_t batch_size = 1;
+  for (int i = 0; i < batch_ndim; ++i) {
+    batch_size *= t.shape(i);
+  }
+  std::vector<int64_t> offsets(batch_size);
+  std::vector<int64_t> index(batch_ndim, 0);
+  int64_t offset = 0;
+  for (int64_t b = 0; b < batch_size; ++b) {
+    offsets[b] = offset;
+    for (int i = batch_ndim - 1; i >= 0; --i) {
+      offset += t.stride(i);
+      if (++index[i] < t.shape(i)) {
+        break;
+      }
+      offset -= t.stride(i) * t.shape(i);
+      index[i] = 0;
+    }
+  }
+  return offsets;
+}
+
+// The rows of A up to which MatMul on the CPU runs CPUGemv instead of a BLAS
+// GEMM, whose kernels are tuned for large blocks of rows.
+constexpr BlasInt kCPUGemvMaxRows = 4;
+// The columns of B a CPU thread multiplies at a time. A block of a BERT-base
+// weight, 768 x 64 floats, takes 192KB of the L2 cache, where the rows of A
+// after the first read it.
+constexpr int64_t kGemvColBlock = 64;
+// The multiply-adds below which CPUGemv is not worth the threads.
+constexpr int64_t kGemvParallelWork = 1 << 16;
+
+// c = alpha * a * b + beta * c for a few rows of the row major a, b and c,
+// bound by the memory bandwidth as every element of b is used by only m
+// multiply-adds. The column blocks of b are split among the threads.
+void CPUGemv(BlasInt m, BlasInt n, BlasInt k, float alpha, const float* a,
+             BlasInt lda, const float* b, BlasInt ldb, float beta, float* c,
+             BlasInt ldc) {
+  auto gemv = GetCPUVectorKernels().gemv;
+  int64_t n_blocks = (n + kGemvColBlock - 1) / kGemvColBlock;
+#pragma omp parallel for if (n_blocks > 1 && int64_t(n) * k * m >= \
+                             kGemvParallelWork)
+  for (int64_t block = 0; block < n_blocks; ++block) {
+    int64_t begin = block * kGemvColBlock;
+    int64_t cols = std::min<int64_t>(kGemvColBlock, n - begin);
+    for (BlasInt i = 0; i < m; ++i) {
+      gemv(a + i * lda, b + begin, ldb, k, alpha, beta, cols,
+           c + i * ldc + begin);
+    }
+  }
+}
+
+#ifdef TT_WITH_CUDA
+// The matrices [begin, begin + size) of a batch, whose offsets in A, B and C
+// advance by a constant stride each, so that they make one strided batched
+// GEMM.
+struct BatchRun {
+  int64_t begin;
+  int64_t size;
+  int64_t stride_a;
+  int64_t stride_b;
+  int64_t stride_c;
+};
+
+std::vector<BatchRun> SplitBatchRuns(const std::vector<int64_t>& a,
+                                     const std::vector<int64_t>& b,
+                                     const std::vector<int64_t>& c) {
+  std::vector<BatchRun> runs;
+  int64_t batch_size = static_cast<int64_t>(c.size());
+  for (int64_t begin = 0; begin < batch_size;) {
+    BatchRun run{begin, 1, 0, 0, 0};
+    if (begin + 1 < batch_size) {
+      run.stride_a = a[begin + 1] - a[begin];
+      run.stride_b = b[begin + 1] - b[begin];
+      run.stride_c = c[begin + 1] - c[begin];
+      run.size = 2;
+      for (int64_t i = begin + 2; i < batch_size &&
+                                  a[i] - a[i - 1] == run.stride_a &&
+                                  b[i] - b[i - 1] == run.stride_b &&
+                                  c[i] - c[i - 1] == run.stride_c;
+           ++i) {
+        ++run.size;
+      }
+    }
+    runs.push_back(run);
+    begin += run.size;
+  }
+  return runs;
+}
+
+const void* GPUData(const core::TensorView& t, int64_t offset = 0) {
+  if (t.IsType<core::Half>()) {
+    return t.data<core::Half>() + offset;
+  }
+  return t.data<float>() + offset;
+}
+
+cudaDataType_t GPUDataType(const core::TensorView& t) {
+  return t.IsType<core::Half>() ? CUDA_R_16F : CUDA_R_32F;
+}
+#endif
+}  // namespace
+
+void MatMul(const core::TensorView& A, bool a_trans,
+            const core::TensorView& B, bool b_trans, float alpha,
+            core::TensorView out, float beta) {
+  core::ProfileScope profile_scope("MatMul", A);
+  auto a_layout = GetMatrixLayout(A, 0);
+  auto b_layout = GetMatrixLayout(B, 0);
+  BlasInt a_cols = a_layout.cols;
+  BlasInt a_rows = a_layout.rows;
+  BlasInt b_cols = b_layout.cols;
+  BlasInt b_rows = b_layout.rows;
 
   BlasInt M = a_trans ? a_cols : a_rows;
   BlasInt N = b_trans ? b_rows : b_cols;
@@ -39,57 +224,85 @@ void MatMul(const core::Tensor& A, bool a_trans, const core::Tensor& B,
   TT_ENFORCE_EQ(K_a, K_b, "matrix shape mismatch");
   TT_ENFORCE(common::is_same_device_ctx(A.device_ctx(), B.device_ctx()),
              "MatMul error: the device of A and B is different.");
-  TT_ENFORCE(common::is_same_device_ctx(A.device_ctx(), out->device_ctx()),
+  TT_ENFORCE(common::is_same_device_ctx(A.device_ctx(), out.device_ctx()),
              "MatMul error: the device of A and out is different.");
+  core::AddToCounter(core::Counter::kGemmFlops, int64_t(2) * M * N * K_a);
+
+  // A dense out may have any shape of M * N elements, e.g. the fused QKV
+  // output of the attention.
+  int ldc = N;
+  if (!out.is_contiguous()) {
+    auto c_layout = GetMatrixLayout(out, 0);
+    TT_ENFORCE(!c_layout.col_major && c_layout.rows == M && c_layout.cols == N,
+               "MatMul error: a strided out must be a row major M x N matrix.");
+    ldc = c_layout.ld;
+  }
 
   if (A.device_type() == kDLCPU && B.device_type() == kDLCPU &&
-      out->device_type() == kDLCPU) {
-    CBLAS_TRANSPOSE transA = a_trans ? CblasTrans : CblasNoTrans;
-    CBLAS_TRANSPOSE transB = b_trans ? CblasTrans : CblasNoTrans;
+      out.device_type() == kDLCPU) {
+    TT_ENFORCE(A.IsType<float>(), "The CPU MatMul only supports float.");
+    CBLAS_TRANSPOSE transA =
+        (a_trans != a_layout.col_major) ? CblasTrans : CblasNoTrans;
+    CBLAS_TRANSPOSE transB =
+        (b_trans != b_layout.col_major) ? CblasTrans : CblasNoTrans;
 
-    int lda = (transA == CblasNoTrans) ? K_a : M;
-    int ldb = (transB == CblasNoTrans) ? N : K_a;
-    int ldc = N;
+    int lda = a_layout.ld;
+    int ldb = b_layout.ld;
 
+    if (M <= kCPUGemvMaxRows && transA == CblasNoTrans &&
+        transB == CblasNoTrans) {
+      CPUGemv(M, N, K_a, alpha, A.data<float>(), lda, B.data<float>(), ldb,
+              beta, out.mutableData<float>(), ldc);
+      return;
+    }
     cblas_sgemm(CblasRowMajor, transA, transB, M, N, K_a, alpha,
                 A.data<float>(), lda, B.data<float>(), ldb, beta,
-                out->mutableData<float>(), ldc);
+                out.mutableData<float>(), ldc);
   } else if (A.device_type() == kDLGPU && B.device_type() == kDLGPU &&
-             out->device_type() == kDLGPU) {
+             out.device_type() == kDLGPU) {
 #ifdef TT_WITH_CUDA
-    cublasOperation_t transA = a_trans ? CUBLAS_OP_T : CUBLAS_OP_N;
-    cublasOperation_t transB = b_trans ? CUBLAS_OP_T : CUBLAS_OP_N;
+    cublasOperation_t transA =
+        (a_trans != a_layout.col_major) ? CUBLAS_OP_T : CUBLAS_OP_N;
+    cublasOperation_t transB =
+        (b_trans != b_layout.col_major) ? CUBLAS_OP_T : CUBLAS_OP_N;
 
-    int lda = (transA == CUBLAS_OP_N) ? K_a : M;
-    int ldb = (transB == CUBLAS_OP_N) ? N : K_a;
-    int ldc = N;
+    int lda = a_layout.ld;
+    int ldb = b_layout.ld;
 
-    auto& gpu_ctx =
-        ::turbo_transformers::core::CUDADeviceContext::GetInstance();
+    auto& gpu_ctx = ::turbo_transformers::core::CUDADeviceContext::GetInstance(
+        out.device_id());
 
+    if (M <= kGPUGemvMaxRows && transA == CUBLAS_OP_N &&
+        transB == CUBLAS_OP_N) {
+      if (A.IsType<core::Half>()) {
+        GPUGemv(A.data<core::Half>(), lda, B.data<core::Half>(), ldb, M, N,
+                K_a, alpha, beta, out.mutableData<core::Half>(), ldc,
+                gpu_ctx.stream());
+      } else {
+        GPUGemv(A.data<float>(), lda, B.data<float>(), ldb, M, N, K_a, alpha,
+                beta, out.mutableData<float>(), ldc, gpu_ctx.stream());
+      }
+      return;
+    }
 #if defined(CUDA_VERSION) && CUDA_VERSION >= 9010
-    if (gpu_ctx.compute_major() >= 5) {
-      auto cublas_algo = CUBLAS_GEMM_DEFAULT_TENSOR_OP;
-      TT_ENFORCE_CUDA_SUCCESS(
-          cublasSetMathMode(gpu_ctx.cublas_handle(), CUBLAS_TENSOR_OP_MATH));
-      TT_ENFORCE_CUDA_SUCCESS(cublasGemmEx(
-          gpu_ctx.cublas_handle(), transB, transA, N, M, K_a, &alpha,
-          B.data<float>(), CUDA_R_32F, ldb, A.data<float>(), CUDA_R_32F, lda,
-          &beta, out->mutableData<float>(), CUDA_R_32F, ldc, CUDA_R_32F,
-          cublas_algo));
-      TT_ENFORCE_CUDA_SUCCESS(
-          cublasSetMathMode(gpu_ctx.cublas_handle(), CUBLAS_DEFAULT_MATH));
+    // The half products are accumulated in float on the tensor cores.
+    if (A.IsType<core::Half>() || gpu_ctx.compute_major() >= 5) {
+      GPUGemm({transB, transA, N, M, K_a, GPUData(B), ldb, 0, GPUData(A), lda,
+               0, const_cast<void*>(GPUData(out)), ldc, 0, 1, GPUDataType(A),
+               alpha, beta},
+              gpu_ctx);
     } else {
       TT_ENFORCE_CUDA_SUCCESS(cublasSgemmEx(
           gpu_ctx.cublas_handle(), transB, transA, N, M, K_a, &alpha,
           B.data<float>(), CUDA_R_32F, ldb, A.data<float>(), CUDA_R_32F, lda,
-          &beta, out->mutableData<float>(), CUDA_R_32F, ldc));
+          &beta, out.mutableData<float>(), CUDA_R_32F, ldc));
     }
 #else
+    TT_ENFORCE(A.IsType<float>(), "The half MatMul needs CUDA 9.1 or later.");
     TT_ENFORCE_CUDA_SUCCESS(cublasSgemm(gpu_ctx.cublas_handle(), transB, transA,
                                         N, M, K_a, &alpha, B.data<float>(), ldb,
                                         A.data<float>(), lda, &beta,
-                                        out->mutableData<float>(), ldc));
+                                        out.mutableData<float>(), ldc));
 #endif
 #else
     TT_THROW("CUDA is not supported for MatMul");
@@ -98,24 +311,27 @@ void MatMul(const core::Tensor& A, bool a_trans, const core::Tensor& B,
     TT_THROW("device_type %d is not supported for MatMul", A.device_type());
   }
 }
-void BatchMatMul(const core::Tensor& A, bool a_trans, const core::Tensor& B,
-                 bool b_trans, float alpha, core::Tensor* C, float beta) {
-  auto* A_shape = &A.shape(0);
+void BatchMatMul(const core::TensorView& A, bool a_trans,
+                 const core::TensorView& B, bool b_trans, float alpha,
+                 core::TensorView C, float beta) {
+  core::ProfileScope profile_scope("BatchMatMul", A);
   auto A_ndim = A.n_dim();
-  auto* B_shape = &B.shape(0);
   auto B_ndim = B.n_dim();
   TT_ENFORCE_GT(A_ndim, 2, "A must at least be 3 dims");
   TT_ENFORCE_GT(B_ndim, 2, "B must at least be 3 dims");
 
-  BlasInt a_rows = A_shape[A_ndim - 2];
-  BlasInt a_cols = A_shape[A_ndim - 1];
-  BlasInt b_rows = B_shape[B_ndim - 2];
-  BlasInt b_cols = B_shape[B_ndim - 1];
+  auto a_layout = GetMatrixLayout(A, A_ndim - 2);
+  auto b_layout = GetMatrixLayout(B, B_ndim - 2);
+  auto c_layout = GetMatrixLayout(C, C.n_dim() - 2);
+  TT_ENFORCE(!c_layout.col_major, "BatchMatMul error: C must be row major.");
+
+  BlasInt a_rows = a_layout.rows;
+  BlasInt a_cols = a_layout.cols;
+  BlasInt b_rows = b_layout.rows;
+  BlasInt b_cols = b_layout.cols;
 
-  BlasInt a_batch_size = std::accumulate(A_shape, A_shape + A_ndim - 2, 1,
-                                         std::multiplies<int64_t>());
-  BlasInt b_batch_size = std::accumulate(B_shape, B_shape + B_ndim - 2, 1,
-                                         std::multiplies<int64_t>());
+  BlasInt a_batch_size = A.numel() / (a_rows * a_cols);
+  BlasInt b_batch_size = B.numel() / (b_rows * b_cols);
 
   TT_ENFORCE_EQ(a_batch_size, b_batch_size, "BatchSize mismatch");
 
@@ -125,67 +341,375 @@ void BatchMatMul(const core::Tensor& A, bool a_trans, const core::Tensor& B,
   BlasInt K_b = b_trans ? b_cols : b_rows;
   TT_ENFORCE_EQ(K_a, K_b, "K mismatch");
 
-  auto* C_shape = &C->shape(0);
-  auto C_ndim = C->n_dim();
-
-  BlasInt c_rows = C_shape[C_ndim - 2];
-  BlasInt c_cols = C_shape[C_ndim - 1];
-  BlasInt c_batch_size = std::accumulate(C_shape, C_shape + C_ndim - 2, 1,
-                                         std::multiplies<int64_t>());
+  BlasInt c_rows = c_layout.rows;
+  BlasInt c_cols = c_layout.cols;
+  BlasInt c_batch_size = C.numel() / (c_rows * c_cols);
 
   TT_ENFORCE_EQ(c_rows, M, "C shape mismatch");
   TT_ENFORCE_EQ(c_cols, N, "C shape mismatch");
   TT_ENFORCE_EQ(c_batch_size, b_batch_size, "C BatchSize mismatch");
+  core::AddToCounter(core::Counter::kGemmFlops,
+                     int64_t(2) * c_batch_size * M * N * K_a);
 
-  BlasInt offsetA = a_rows * a_cols;
-  BlasInt offsetB = b_rows * b_cols;
-  BlasInt offsetC = c_rows * c_cols;
-
+  // The batch dims may have any strides, e.g. the heads of q, k and v read
+  // straight out of the fused QKV projection [batch, seq, 3, heads, width],
+  // or the context written into the merged heads [batch, seq, heads, width].
   if (A.device_type() == kDLCPU && B.device_type() == kDLCPU &&
-      C->device_type() == kDLCPU) {
+      C.device_type() == kDLCPU) {
+    TT_ENFORCE(A.IsType<float>(), "The CPU BatchMatMul only supports float.");
     std::unique_ptr<const float*[]> A_array(new const float*[a_batch_size]);
     std::unique_ptr<const float*[]> B_array(new const float*[b_batch_size]);
     std::unique_ptr<float*[]> C_array(new float*[c_batch_size]);
 
     auto* a_ptr = A.data<float>();
     auto* b_ptr = B.data<float>();
-    auto* c_ptr = C->mutableData<float>();
+    auto* c_ptr = C.mutableData<float>();
+    auto offsets_a = GetBatchOffsets(A);
+    auto offsets_b = GetBatchOffsets(B);
+    auto offsets_c = GetBatchOffsets(C);
 
     for (int i = 0; i < a_batch_size; ++i) {
-      A_array[i] = a_ptr + i * offsetA;
-      B_array[i] = b_ptr + i * offsetB;
-      C_array[i] = c_ptr + i * offsetC;
+      A_array[i] = a_ptr + offsets_a[i];
+      B_array[i] = b_ptr + offsets_b[i];
+      C_array[i] = c_ptr + offsets_c[i];
     }
-    auto transA = a_trans ? CblasTrans : CblasNoTrans;
-    auto transB = b_trans ? CblasTrans : CblasNoTrans;
-    int lda = (transA == CblasNoTrans) ? K_a : M;
-    int ldb = (transB == CblasNoTrans) ? N : K_a;
-    int ldc = N;
+    auto transA = (a_trans != a_layout.col_major) ? CblasTrans : CblasNoTrans;
+    auto transB = (b_trans != b_layout.col_major) ? CblasTrans : CblasNoTrans;
+    int lda = a_layout.ld;
+    int ldb = b_layout.ld;
+    int ldc = c_layout.ld;
 
     cblas_sgemm_batch(CblasRowMajor, &transA, &transB, &M, &N, &K_a, &alpha,
                       A_array.get(), &lda, B_array.get(), &ldb, &beta,
                       C_array.get(), &ldc, 1, &a_batch_size);
   } else if (A.device_type() == kDLGPU && B.device_type() == kDLGPU &&
-             C->device_type() == kDLGPU) {
+             C.device_type() == kDLGPU) {
 #ifdef TT_WITH_CUDA
-    auto transA = a_trans ? CUBLAS_OP_T : CUBLAS_OP_N;
-    auto transB = b_trans ? CUBLAS_OP_T : CUBLAS_OP_N;
-
-    int lda = (transA == CUBLAS_OP_N) ? K_a : M;
-    int ldb = (transB == CUBLAS_OP_N) ? N : K_a;
-    int ldc = N;
-    auto& gpu_ctx =
-        ::turbo_transformers::core::CUDADeviceContext::GetInstance();
-    cublasSgemmStridedBatched(
-        gpu_ctx.cublas_handle(), transB, transA, N, M, K_a, &alpha,
-        B.data<float>(), ldb, offsetB, A.data<float>(), lda, offsetA, &beta,
-        C->mutableData<float>(), ldc, offsetC, a_batch_size);
+    auto transA = (a_trans != a_layout.col_major) ? CUBLAS_OP_T : CUBLAS_OP_N;
+    auto transB = (b_trans != b_layout.col_major) ? CUBLAS_OP_T : CUBLAS_OP_N;
+
+    int lda = a_layout.ld;
+    int ldb = b_layout.ld;
+    int ldc = c_layout.ld;
+    auto& gpu_ctx = ::turbo_transformers::core::CUDADeviceContext::GetInstance(
+        C.device_id());
+    // Batch dims collapsing into a single stride each make one strided
+    // batched GEMM. Otherwise the batch runs as the fewest strided batched
+    // GEMMs, e.g. one per sequence for heads split out of [batch, seq, heads,
+    // width], which saves transposing the heads into a dense batch.
+    std::vector<BatchRun> runs;
+    std::vector<int64_t> offsets_a, offsets_b, offsets_c;
+    int64_t stride_a, stride_b, stride_c;
+    if (CollapseDims(A, 0, A_ndim - 2, &stride_a) &&
+        CollapseDims(B, 0, B_ndim - 2, &stride_b) &&
+        CollapseDims(C, 0, C.n_dim() - 2, &stride_c)) {
+      runs.push_back({0, a_batch_size, stride_a, stride_b, stride_c});
+      offsets_a = offsets_b = offsets_c = {0};
+    } else {
+      offsets_a = GetBatchOffsets(A);
+      offsets_b = GetBatchOffsets(B);
+      offsets_c = GetBatchOffsets(C);
+      runs = SplitBatchRuns(offsets_a, offsets_b, offsets_c);
+    }
+    for (auto& run : runs) {
+      auto a_offset = offsets_a[run.begin];
+      auto b_offset = offsets_b[run.begin];
+      auto c_offset = offsets_c[run.begin];
+#if defined(CUDA_VERSION) && CUDA_VERSION >= 9010
+      if (A.IsType<core::Half>() || gpu_ctx.compute_major() >= 5) {
+        GPUGemm({transB, transA, N, M, K_a, GPUData(B, b_offset), ldb,
+                 run.stride_b, GPUData(A, a_offset), lda, run.stride_a,
+                 const_cast<void*>(GPUData(C, c_offset)), ldc, run.stride_c,
+                 run.size, GPUDataType(A), alpha, beta},
+                gpu_ctx);
+        continue;
+      }
+#else
+      TT_ENFORCE(A.IsType<float>(),
+                 "The half BatchMatMul needs CUDA 9.1 or later.");
+#endif
+      TT_ENFORCE_CUDA_SUCCESS(cublasSgemmStridedBatched(
+          gpu_ctx.cublas_handle(), transB, transA, N, M, K_a, &alpha,
+          B.data<float>() + b_offset, ldb, run.stride_b,
+          A.data<float>() + a_offset, lda, run.stride_a, &beta,
+          C.mutableData<float>() + c_offset, ldc, run.stride_c, run.size));
+    }
 #endif
   } else {
     TT_THROW("device_type %d is not supported!", A.device_type());
   }
 }
 
+#ifdef TT_BLAS_USE_MKL
+// The rows of A the weights are packed for. MKL takes them as a hint, the
+// packed weights serve any number of rows.
+static constexpr BlasInt kPackedRowsHint = 128;
+#endif
+
+PackedWeight PackWeight(const core::TensorView& weight) {
+  PackedWeight packed;
+#ifdef TT_BLAS_USE_MKL
+  if (weight.device_type() != kDLCPU || !weight.IsType<float>()) {
+    return packed;
+  }
+  TT_ENFORCE_EQ(weight.n_dim(), 2, "The weight must be a matrix.");
+  auto layout = GetMatrixLayout(weight, 0);
+  packed.k = layout.rows;
+  packed.n = layout.cols;
+  size_t bytes = cblas_sgemm_pack_get_size(CblasBMatrix, kPackedRowsHint,
+                                           layout.cols, layout.rows);
+  auto* data = packed.data.Reshape<float>(
+      {static_cast<int64_t>((bytes + sizeof(float) - 1) / sizeof(float))},
+      kDLCPU, 0);
+  cblas_sgemm_pack(CblasRowMajor, CblasBMatrix,
+                   layout.col_major ? CblasTrans : CblasNoTrans,
+                   kPackedRowsHint, layout.cols, layout.rows, 1.0f,
+                   weight.data<float>(), layout.ld, data);
+#endif
+  return packed;
+}
+
+namespace {
+std::atomic<bool>& PackingSharedWeightsEnabled() {
+  static std::atomic<bool> enabled([] {
+    const char* env = std::getenv("TT_PACK_SHARED_WEIGHTS");
+    return env != nullptr && std::atoi(env) != 0;
+  }());
+  return enabled;
+}
+}  // namespace
+
+bool IsPackingSharedWeightsEnabled() {
+  return PackingSharedWeightsEnabled().load(std::memory_order_relaxed);
+}
+
+void EnablePackingSharedWeights(bool enable) {
+  PackingSharedWeightsEnabled().store(enable, std::memory_order_relaxed);
+}
+
+PackedWeight PackLayerWeight(const core::Tensor& weight) {
+  if (weight.is_view() && !IsPackingSharedWeightsEnabled()) {
+    return PackedWeight();
+  }
+  return PackWeight(weight);
+}
+
+void MatMul(const core::TensorView& A, const PackedWeight& B,
+            core::TensorView out, float beta) {
+  core::ProfileScope profile_scope("MatMul", A);
+#ifdef TT_BLAS_USE_MKL
+  TT_ENFORCE(!B.is_null(), "MatMul error: the packed weight is null.");
+  TT_ENFORCE(A.device_type() == kDLCPU && out.device_type() == kDLCPU,
+             "MatMul error: packed weights are only supported on the CPU.");
+  auto a_layout = GetMatrixLayout(A, 0);
+  TT_ENFORCE_EQ(a_layout.cols, B.k, "matrix shape mismatch");
+  BlasInt M = a_layout.rows;
+  BlasInt N = B.n;
+  BlasInt K = B.k;
+  core::AddToCounter(core::Counter::kGemmFlops, int64_t(2) * M * N * K);
+  int ldc = N;
+  if (!out.is_contiguous()) {
+    auto c_layout = GetMatrixLayout(out, 0);
+    TT_ENFORCE(!c_layout.col_major && c_layout.rows == M && c_layout.cols == N,
+               "MatMul error: a strided out must be a row major M x N matrix.");
+    ldc = c_layout.ld;
+  }
+  cblas_sgemm_compute(CblasRowMajor,
+                      a_layout.col_major ? CblasTrans : CblasNoTrans,
+                      CblasPacked, M, N, K, A.data<float>(), a_layout.ld,
+                      B.data.data<float>(), N, beta, out.mutableData<float>(),
+                      ldc);
+#else
+  TT_THROW("Packed weights need MKL.");
+#endif
+}
+
+namespace {
+// out[begin, begin + rows) = input[begin, begin + rows) * weight for the
+// contiguous [m, k] input and [m, n] out.
+void MatMulRows(const core::TensorView& input, const core::TensorView& weight,
+                const PackedWeight& packed_weight, const core::TensorView& out,
+                int64_t begin, int64_t rows) {
+  int64_t k = input.shape(-1);
+  int64_t n = out.shape(-1);
+  auto a = input.AsStrided({rows, k}, {k, 1}, begin * k);
+  auto c = out.AsStrided({rows, n}, {n, 1}, begin * n);
+  if (packed_weight.is_null()) {
+    MatMul(a, false, weight, false, 1.0, c, 0.0);
+  } else {
+    MatMul(a, packed_weight, c, 0.0);
+  }
+}
+}  // namespace
+
+// The rows multiplied and normalized at a time by a CPU thread. A block of
+// BERT-base, 64 x 768 floats, takes 192KB of the L2 cache.
+static constexpr int64_t kLayerNormRowBlock = 64;
+// The bytes of out multiplied at a time on the GPU, which stay in its L2.
+static constexpr int64_t kLayerNormChunkBytes = 4 << 20;
+
+template <typename T>
+void MatMulAddBiasLayerNorm(const core::Tensor& input,
+                            const core::TensorView& weight,
+                            const PackedWeight& packed_weight,
+                            const core::Tensor& residual,
+                            const core::Tensor& bias,
+                            const core::Tensor& gamma,
+                            const core::Tensor& beta, core::Tensor* out) {
+  core::ProfileScope profile_scope("MatMulAddBiasLayerNorm", input);
+  int64_t n = out->shape(-1);
+  int64_t m = out->numel() / n;
+  int64_t k = input.shape(-1);
+  TT_ENFORCE_EQ(input.numel(), m * k, "The input and out mismatch.");
+  TT_ENFORCE_EQ(residual.numel(), out->numel(),
+                "The residual and out mismatch.");
+  TT_ENFORCE_EQ(bias.numel(), n, "The bias and out mismatch.");
+  // Throws here for a weight BLAS can not take, rather than in a thread.
+  GetMatrixLayout(weight, 0);
+
+  core::TensorView input_rows = input;
+  core::TensorView out_rows = *out;
+  TT_ENFORCE(input_rows.is_contiguous() && out_rows.is_contiguous(),
+             "The input and out must be contiguous.");
+  auto dense = [&](int64_t begin, int64_t rows) {
+    MatMulRows(input_rows, weight, packed_weight, out_rows, begin, rows);
+  };
+
+  int n_threads = 1;
+#ifdef _OPENMP
+  n_threads = omp_get_max_threads();
+#endif
+  int64_t n_blocks = (m + kLayerNormRowBlock - 1) / kLayerNormRowBlock;
+  // Only a packed weight is worth blocking: the GEMM of a block would
+  // repack the whole plain weight, which costs more than the layer norm
+  // pass saved.
+  if (out->device_type() == kDLCPU && !packed_weight.is_null() &&
+      n_blocks >= n_threads) {
+    auto layer_norm = GetCPUVectorKernels().layer_norm;
+    auto* out_ptr = out->mutableData<float>();
+    const auto* residual_ptr = residual.data<float>();
+    // Within the parallel region, MKL and OpenBLAS run the GEMM of a block
+    // on the calling thread.
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t b = 0; b < n_blocks; ++b) {
+      int64_t begin = b * kLayerNormRowBlock;
+      int64_t rows = std::min(kLayerNormRowBlock, m - begin);
+      dense(begin, rows);
+      for (int64_t i = begin; i < begin + rows; ++i) {
+        layer_norm(out_ptr + i * n, residual_ptr + i * n, bias.data<float>(),
+                   gamma.data<float>(), beta.data<float>(), kLayerNormEpsilon,
+                   n);
+      }
+    }
+    return;
+  }
+#ifdef TT_WITH_CUDA
+  if (out->device_type() == kDLGPU) {
+    auto stream =
+        core::CUDADeviceContext::GetInstance(out->device_id()).stream();
+    int64_t chunk_rows =
+        std::max<int64_t>(1, kLayerNormChunkBytes / (n * sizeof(T)));
+    for (int64_t begin = 0; begin < m; begin += chunk_rows) {
+      int64_t rows = std::min(chunk_rows, m - begin);
+      dense(begin, rows);
+      GPULayerNorm</*AddBias*/ true>(
+          out->mutableData<T>() + begin * n, residual.data<T>() + begin * n,
+          bias.data<T>(), gamma.data<T>(), beta.data<T>(), rows, n,
+          kLayerNormEpsilon, stream);
+    }
+    return;
+  }
+#endif
+  // A plain weight, or too few rows to keep every thread busy with a block.
+  dense(0, m);
+  AddBiasLayerNorm<T>(residual, bias, gamma, beta, out);
+}
+
+template void MatMulAddBiasLayerNorm<float>(
+    const core::Tensor& input, const core::TensorView& weight,
+    const PackedWeight& packed_weight, const core::Tensor& residual,
+    const core::Tensor& bias, const core::Tensor& gamma,
+    const core::Tensor& beta, core::Tensor* out);
+template void MatMulAddBiasLayerNorm<core::Half>(
+    const core::Tensor& input, const core::TensorView& weight,
+    const PackedWeight& packed_weight, const core::Tensor& residual,
+    const core::Tensor& bias, const core::Tensor& gamma,
+    const core::Tensor& beta, core::Tensor* out);
+
+// The rows multiplied and activated at a time by a CPU thread. A block of
+// BERT-base, 16 x 3072 floats, takes 192KB of the L2 cache.
+static constexpr int64_t kGeluRowBlock = 16;
+
+template <typename T>
+void MatMulAddBiasGelu(const core::Tensor& input,
+                       const core::TensorView& weight,
+                       const PackedWeight& packed_weight,
+                       const core::Tensor& bias, core::Tensor* out) {
+  core::ProfileScope profile_scope("MatMulAddBiasGelu", input);
+  int64_t n = out->shape(-1);
+  int64_t m = out->numel() / n;
+  int64_t k = input.shape(-1);
+  TT_ENFORCE_EQ(input.numel(), m * k, "The input and out mismatch.");
+  TT_ENFORCE_EQ(bias.numel(), n, "The bias and out mismatch.");
+  auto w_layout = GetMatrixLayout(weight, 0);
+  TT_ENFORCE(w_layout.rows == k && w_layout.cols == n,
+             "The weight, input and out mismatch.");
+
+  core::TensorView input_rows = input;
+  core::TensorView out_rows = *out;
+  TT_ENFORCE(input_rows.is_contiguous() && out_rows.is_contiguous(),
+             "The input and out must be contiguous.");
+
+  int n_threads = 1;
+#ifdef _OPENMP
+  n_threads = omp_get_max_threads();
+#endif
+  int64_t n_blocks = (m + kGeluRowBlock - 1) / kGeluRowBlock;
+  // As MatMulAddBiasLayerNorm, only a packed weight is worth blocking.
+  if (out->device_type() == kDLCPU && !packed_weight.is_null() &&
+      n_blocks >= n_threads) {
+    auto add_bias_gelu = GetCPUVectorKernels().add_bias_gelu;
+    auto* out_ptr = out->mutableData<float>();
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t b = 0; b < n_blocks; ++b) {
+      int64_t begin = b * kGeluRowBlock;
+      int64_t rows = std::min(kGeluRowBlock, m - begin);
+      MatMulRows(input_rows, weight, packed_weight, out_rows, begin, rows);
+      for (int64_t i = begin; i < begin + rows; ++i) {
+        add_bias_gelu(bias.data<float>(), n, out_ptr + i * n);
+      }
+    }
+    return;
+  }
+#ifdef TT_WITH_CUDA
+  if (out->device_type() == kDLGPU) {
+    auto& gpu_ctx = core::CUDADeviceContext::GetInstance(out->device_id());
+    // out^T = weight^T * input^T in the column major convention of cuBLAS.
+    GPUGemmArgs args{w_layout.col_major ? CUBLAS_OP_T : CUBLAS_OP_N,
+                     CUBLAS_OP_N, n, m, k, GPUData(weight), w_layout.ld, 0,
+                     GPUData(input), k, 0, const_cast<void*>(GPUData(*out)),
+                     n, 0, 1, GPUDataType(input), 1.0f, 0.0f};
+    if (GPUGemmBiasGelu(args, bias.data<T>(), gpu_ctx)) {
+      return;
+    }
+  }
+#endif
+  // A plain CPU weight, too few rows, or no GELU epilogue in cuBLASLt.
+  MatMulRows(input_rows, weight, packed_weight, out_rows, 0, m);
+  AddBiasAct<T, ActivationType::Gelu>(bias, out);
+}
+
+template void MatMulAddBiasGelu<float>(const core::Tensor& input,
+                                       const core::TensorView& weight,
+                                       const PackedWeight& packed_weight,
+                                       const core::Tensor& bias,
+                                       core::Tensor* out);
+template void MatMulAddBiasGelu<core::Half>(const core::Tensor& input,
+                                            const core::TensorView& weight,
+                                            const PackedWeight& packed_weight,
+                                            const core::Tensor& bias,
+                                            core::Tensor* out);
+
 }  // namespace kernels
 }  // namespace layers
 }  // namespace turbo_transformers
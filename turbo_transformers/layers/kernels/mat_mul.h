@@ -13,14 +13,79 @@
 
 #pragma once
 #include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/tensor_view.h"
 namespace turbo_transformers {
 namespace layers {
 namespace kernels {
-extern void MatMul(const core::Tensor& A, bool a_trans, const core::Tensor& B,
-                   bool b_trans, float alpha, core::Tensor* out, float beta);
-extern void BatchMatMul(const core::Tensor& A, bool a_trans,
-                        const core::Tensor& B, bool b_trans, float alpha,
-                        core::Tensor* C, float beta);
+// The operands are float, or core::Half on the GPU, whose products are
+// accumulated in float.
+extern void MatMul(const core::TensorView& A, bool a_trans,
+                   const core::TensorView& B, bool b_trans, float alpha,
+                   core::TensorView out, float beta);
+extern void BatchMatMul(const core::TensorView& A, bool a_trans,
+                        const core::TensorView& B, bool b_trans, float alpha,
+                        core::TensorView C, float beta);
+
+// A float weight B [K, N] of `out = A * B` packed once into the panel format
+// of the CPU GEMMs, which saves repacking B on every call, most noticeably for
+// the small M of a single sequence. The data is opaque to everything but
+// MatMul below. Only MKL exposes its packed format, so with other BLAS
+// libraries, as for weights on the GPU, the packed weight is null and the
+// callers keep using the plain weight.
+struct PackedWeight {
+  core::Tensor data{nullptr};
+  int64_t k{0};
+  int64_t n{0};
+
+  bool is_null() const { return data.is_null(); }
+};
+
+// Packs `weight` [K, N], which may be strided, e.g. torch.t of a
+// torch.nn.Linear weight. The packed weight is a copy, later changes of
+// `weight` are not seen by it.
+extern PackedWeight PackWeight(const core::TensorView& weight);
+
+// The packed weight of a layer, or a null one if `weight` is a view of memory
+// owned by someone else, i.e. a weight of a mapped WeightFile or one shared
+// by the models through the WeightStore: its packed copy would double the
+// memory the mapping or the sharing saves, and is private to the model.
+// The layers keep the plain weight either way, for the other GEMMs and the
+// conversions. EnablePackingSharedWeights(true), or the environment variable
+// TT_PACK_SHARED_WEIGHTS=1, packs those too, trading the memory for the
+// speed of the small batches.
+extern PackedWeight PackLayerWeight(const core::Tensor& weight);
+extern bool IsPackingSharedWeightsEnabled();
+extern void EnablePackingSharedWeights(bool enable);
+
+// out = A * B + beta * out for a packed B on the CPU.
+extern void MatMul(const core::TensorView& A, const PackedWeight& B,
+                   core::TensorView out, float beta);
+
+// out = LayerNorm(input * weight + bias + residual) with the layer norm
+// parameters `gamma` and `beta`, as the output dense layers of BERT. The
+// packed weight is used if not null, the rows are then multiplied in blocks
+// which are normalized while they are in the cache. On the GPU, the rows are
+// multiplied in chunks whose products are normalized from the L2 cache.
+template <typename T>
+extern void MatMulAddBiasLayerNorm(const core::Tensor& input,
+                                   const core::TensorView& weight,
+                                   const PackedWeight& packed_weight,
+                                   const core::Tensor& residual,
+                                   const core::Tensor& bias,
+                                   const core::Tensor& gamma,
+                                   const core::Tensor& beta,
+                                   core::Tensor* out);
+
+// out = gelu(input * weight + bias), as the intermediate dense layers of BERT.
+// The packed weight is used if not null, the rows are then multiplied in
+// blocks which are activated while they are in the cache. On the GPU, the
+// bias and gelu are the epilogue of the cuBLASLt GEMM if the CUDA version
+// has it.
+template <typename T>
+extern void MatMulAddBiasGelu(const core::Tensor& input,
+                              const core::TensorView& weight,
+                              const PackedWeight& packed_weight,
+                              const core::Tensor& bias, core::Tensor* out);
 
 }  // namespace kernels
 }  // namespace layers
@@ -12,13 +12,24 @@
 // See the AUTHORS file for names of contributors.
 #include "turbo_transformers/layers/kernels/mat_mul.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <cstdlib>
 #include <ctime>
+#include <string>
+#include <vector>
 
 #include "catch2/catch.hpp"
+#include "turbo_transformers/core/config.h"
 #include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/layers/kernels/activation.h"
 #include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/kernels/layer_norm.h"
+#ifdef TT_WITH_CUDA
+#include "turbo_transformers/layers/kernels/gpu_gemm_tuner.h"
+#endif
 
 namespace turbo_transformers {
 namespace layers {
@@ -69,6 +80,53 @@ TEST_CASE("blas-batch-gemm") {
   REQUIRE(float_eq(C2[3], 29));
 }
 
+TEST_CASE("blas-batch-gemm-groups") {
+  // The attention products of 12 heads, q * k^T in the first group and
+  // the scores * v in the second.
+  const BlasInt heads = 12, S = 37, D = 64;
+  BlasInt m[] = {S, S}, n[] = {S, D}, k[] = {D, S};
+  BlasInt lda[] = {D, S}, ldb[] = {D, D}, ldc[] = {S, D};
+  CBLAS_TRANSPOSE trans_a[] = {CblasNoTrans, CblasNoTrans};
+  CBLAS_TRANSPOSE trans_b[] = {CblasTrans, CblasNoTrans};
+  float alpha[] = {0.125, 1.}, beta[] = {0., 0.};
+  BlasInt group_size[] = {heads, heads};
+
+  std::vector<std::vector<float>> a, b, c, expected;
+  std::vector<const float*> a_ptrs, b_ptrs;
+  std::vector<float*> c_ptrs;
+  for (int group = 0; group < 2; ++group) {
+    for (BlasInt h = 0; h < heads; ++h) {
+      a.emplace_back(m[group] * k[group]);
+      b.emplace_back(k[group] * n[group]);
+      c.emplace_back(m[group] * n[group]);
+      for (auto& x : a.back()) {
+        x = static_cast<float>(rand()) / RAND_MAX - 0.5f;
+      }
+      for (auto& x : b.back()) {
+        x = static_cast<float>(rand()) / RAND_MAX - 0.5f;
+      }
+      expected.emplace_back(c.back());
+      cblas_sgemm(CblasRowMajor, trans_a[group], trans_b[group], m[group],
+                  n[group], k[group], alpha[group], a.back().data(),
+                  lda[group], b.back().data(), ldb[group], beta[group],
+                  expected.back().data(), ldc[group]);
+    }
+  }
+  for (size_t i = 0; i < a.size(); ++i) {
+    a_ptrs.push_back(a[i].data());
+    b_ptrs.push_back(b[i].data());
+    c_ptrs.push_back(c[i].data());
+  }
+
+  cblas_sgemm_batch(CblasRowMajor, trans_a, trans_b, m, n, k, alpha,
+                    a_ptrs.data(), lda, b_ptrs.data(), ldb, beta,
+                    c_ptrs.data(), ldc, 2, group_size);
+  for (size_t i = 0; i < c.size(); ++i) {
+    REQUIRE(std::equal(c[i].begin(), c[i].end(), expected[i].begin(),
+                       float_eq));
+  }
+}
+
 TEST_CASE("blas-sscal") {
   float vec[] = {1, 2};
   cblas_sscal(2, 2, vec, 1);
@@ -76,9 +134,279 @@ TEST_CASE("blas-sscal") {
   REQUIRE(float_eq(vec[1], 4));
 }
 
+// Wraps `data` with the given strides, like torch.utils.dlpack does for a
+// non-contiguous tensor.
+static core::Tensor CreateStridedView(float* data, std::vector<int64_t> shape,
+                                      std::vector<int64_t> strides,
+                                      uint64_t byte_offset = 0) {
+  struct Layout {
+    std::vector<int64_t> shape;
+    std::vector<int64_t> strides;
+  };
+  auto* layout = new Layout{std::move(shape), std::move(strides)};
+  auto* tensor = new DLManagedTensor();
+  tensor->dl_tensor.data = data;
+  tensor->dl_tensor.ctx = {kDLCPU, 0};
+  tensor->dl_tensor.ndim = static_cast<int>(layout->shape.size());
+  tensor->dl_tensor.dtype = {kDLFloat, 32, 1};
+  tensor->dl_tensor.shape = layout->shape.data();
+  tensor->dl_tensor.strides = layout->strides.data();
+  tensor->dl_tensor.byte_offset = byte_offset;
+  tensor->manager_ctx = layout;
+  tensor->deleter = [](DLManagedTensor* self) {
+    delete static_cast<Layout*>(self->manager_ctx);
+    delete self;
+  };
+  return core::Tensor(tensor);
+}
+
+TEST_CASE("matmul-cpu-strided") {
+  const int64_t M = 3, K = 4, N = 5;
+  core::Tensor A = common::CreateTensorAndFillRandom<float>({M, K}, kDLCPU, 0);
+  // B is stored as its transpose, e.g. torch.t(weight).
+  core::Tensor Bt =
+      common::CreateTensorAndFillRandom<float>({N, K}, kDLCPU, 0);
+  core::Tensor B = common::CreateTensor<float>({K, N}, kDLCPU, 0);
+  for (int64_t k = 0; k < K; ++k) {
+    for (int64_t n = 0; n < N; ++n) {
+      B.mutableData<float>()[k * N + n] = Bt.data<float>()[n * K + k];
+    }
+  }
+  core::Tensor B_view = CreateStridedView(Bt.mutableData<float>(), {K, N},
+                                          {1, K});
+  REQUIRE_FALSE(B_view.is_contiguous());
+  REQUIRE_THROWS(B_view.data<float>());
+
+  core::Tensor expected = common::CreateTensor<float>({M, N}, kDLCPU, 0);
+  MatMul(A, false, B, false, 1.0, expected, 0.0);
+
+  core::Tensor out = common::CreateTensor<float>({M, N}, kDLCPU, 0);
+  MatMul(A, false, B_view, false, 1.0, out, 0.0);
+  REQUIRE(common::CheckResultOfCPU<float>(out, expected));
+
+  // A column slice of a wider matrix, starting at its second column.
+  const int64_t ld = K + 3;
+  core::Tensor wide = common::CreateTensor<float>({M, ld}, kDLCPU, 0);
+  for (int64_t m = 0; m < M; ++m) {
+    for (int64_t k = 0; k < K; ++k) {
+      wide.mutableData<float>()[m * ld + k + 1] = A.data<float>()[m * K + k];
+    }
+  }
+  core::Tensor A_view = CreateStridedView(wide.mutableData<float>(), {M, K},
+                                          {ld, 1}, sizeof(float));
+  MatMul(A_view, false, B_view, false, 1.0, out, 0.0);
+  REQUIRE(common::CheckResultOfCPU<float>(out, expected));
+
+  // Neither the rows nor the columns are dense.
+  core::Tensor bad_view = CreateStridedView(wide.mutableData<float>(),
+                                            {2, 2}, {ld, 2});
+  REQUIRE_THROWS(MatMul(bad_view, false, B_view, false, 1.0, out, 0.0));
+}
+
+TEST_CASE("matmul-cpu-gemv") {
+  // The rows up to 4 run the GEMV kernel, 5 the BLAS GEMM.
+  for (int64_t m : {1, 2, 4, 5}) {
+    for (int64_t n : {1, 70, 768}) {
+      const int64_t k = 96;
+      INFO("m: " << m << ", n: " << n);
+      core::Tensor A =
+          common::CreateTensorAndFillRandom<float>({m, k}, kDLCPU, 0);
+      core::Tensor B =
+          common::CreateTensorAndFillRandom<float>({k, n}, kDLCPU, 0);
+      core::Tensor out =
+          common::CreateTensorAndFillRandom<float>({m, n}, kDLCPU, 0);
+      std::vector<float> expected(m * n);
+      for (int64_t i = 0; i < m; ++i) {
+        for (int64_t j = 0; j < n; ++j) {
+          float acc = 0;
+          for (int64_t l = 0; l < k; ++l) {
+            acc += A.data<float>()[i * k + l] * B.data<float>()[l * n + j];
+          }
+          expected[i * n + j] = 2.f * acc + 0.5f * out.data<float>()[i * n + j];
+        }
+      }
+      MatMul(A, false, B, false, 2.0, out, 0.5);
+      for (int64_t i = 0; i < m * n; ++i) {
+        REQUIRE(std::abs(out.data<float>()[i] - expected[i]) < 1e-4);
+      }
+    }
+  }
+}
+
+TEST_CASE("matmul-cpu-packed") {
+  const int64_t K = 64, N = 96;
+  core::Tensor B = common::CreateTensorAndFillRandom<float>({K, N}, kDLCPU, 0);
+  core::Tensor Bt = common::CreateTensor<float>({N, K}, kDLCPU, 0);
+  for (int64_t k = 0; k < K; ++k) {
+    for (int64_t n = 0; n < N; ++n) {
+      Bt.mutableData<float>()[n * K + k] = B.data<float>()[k * N + n];
+    }
+  }
+  // A dense weight and the transposed view of torch.t(weight).
+  core::Tensor B_view = CreateStridedView(Bt.mutableData<float>(), {K, N},
+                                          {1, K});
+  for (auto* weight : {&B, &B_view}) {
+    PackedWeight packed = PackWeight(*weight);
+    if (core::GetBlasProvider() != core::BlasProvider::MKL) {
+      REQUIRE(packed.is_null());
+      continue;
+    }
+    REQUIRE(packed.k == K);
+    REQUIRE(packed.n == N);
+    // Fewer and more rows than the packing hint.
+    for (int64_t M : {1, 7, 300}) {
+      core::Tensor A =
+          common::CreateTensorAndFillRandom<float>({M, K}, kDLCPU, 0);
+      core::Tensor expected = common::CreateTensor<float>({M, N}, kDLCPU, 0);
+      MatMul(A, false, B, false, 1.0, expected, 0.0);
+      core::Tensor out = common::CreateTensor<float>({M, N}, kDLCPU, 0);
+      MatMul(A, packed, out, 0.0);
+      REQUIRE(common::CheckResultOfCPU<float>(out, expected));
+    }
+  }
+}
+
+TEST_CASE("matmul-add-bias-layer-norm-cpu") {
+  const int64_t K = 64, N = 96;
+  core::Tensor B = common::CreateTensorAndFillRandom<float>({K, N}, kDLCPU, 0);
+  core::Tensor bias = common::CreateTensorAndFillRandom<float>({N}, kDLCPU, 0);
+  core::Tensor gamma =
+      common::CreateTensorAndFillRandom<float>({N}, kDLCPU, 0);
+  core::Tensor beta = common::CreateTensorAndFillRandom<float>({N}, kDLCPU, 0);
+  PackedWeight packed = PackWeight(B);
+  // A single block, and blocks with a partial one.
+  for (int64_t M : {3, 100}) {
+    core::Tensor A =
+        common::CreateTensorAndFillRandom<float>({M, K}, kDLCPU, 0);
+    core::Tensor residual =
+        common::CreateTensorAndFillRandom<float>({M, N}, kDLCPU, 0);
+    core::Tensor expected = common::CreateTensor<float>({M, N}, kDLCPU, 0);
+    MatMul(A, false, B, false, 1.0, expected, 0.0);
+    AddBiasLayerNorm<float>(residual, bias, gamma, beta, &expected);
+    PackedWeight no_packed;
+    for (auto* packed_weight : {&packed, &no_packed}) {
+      core::Tensor out = common::CreateTensor<float>({M, N}, kDLCPU, 0);
+      MatMulAddBiasLayerNorm<float>(A, B, *packed_weight, residual, bias,
+                                    gamma, beta, &out);
+      REQUIRE(common::CheckResultOfCPU<float>(out, expected));
+    }
+  }
+}
+
+TEST_CASE("matmul-add-bias-gelu-cpu") {
+  const int64_t K = 64, N = 96;
+  core::Tensor B = common::CreateTensorAndFillRandom<float>({K, N}, kDLCPU, 0);
+  core::Tensor bias = common::CreateTensorAndFillRandom<float>({N}, kDLCPU, 0);
+  PackedWeight packed = PackWeight(B);
+  // A single block, and blocks with a partial one.
+  for (int64_t M : {3, 100}) {
+    core::Tensor A =
+        common::CreateTensorAndFillRandom<float>({M, K}, kDLCPU, 0);
+    core::Tensor expected = common::CreateTensor<float>({M, N}, kDLCPU, 0);
+    MatMul(A, false, B, false, 1.0, expected, 0.0);
+    AddBiasAct<float, ActivationType::Gelu>(bias, &expected);
+    PackedWeight no_packed;
+    for (auto* packed_weight : {&packed, &no_packed}) {
+      core::Tensor out = common::CreateTensor<float>({M, N}, kDLCPU, 0);
+      MatMulAddBiasGelu<float>(A, B, *packed_weight, bias, &out);
+      REQUIRE(common::CheckResultOfCPU<float>(out, expected));
+    }
+  }
+}
+
+TEST_CASE("batch-matmul-cpu-strided") {
+  const int64_t batch = 2, M = 3, K = 4, N = 5;
+  core::Tensor At =
+      common::CreateTensorAndFillRandom<float>({batch, K, M}, kDLCPU, 0);
+  core::Tensor A = common::CreateTensor<float>({batch, M, K}, kDLCPU, 0);
+  for (int64_t b = 0; b < batch; ++b) {
+    for (int64_t m = 0; m < M; ++m) {
+      for (int64_t k = 0; k < K; ++k) {
+        A.mutableData<float>()[(b * M + m) * K + k] =
+            At.data<float>()[(b * K + k) * M + m];
+      }
+    }
+  }
+  core::Tensor A_view = CreateStridedView(At.mutableData<float>(),
+                                          {batch, M, K}, {K * M, 1, M});
+  core::Tensor B =
+      common::CreateTensorAndFillRandom<float>({batch, K, N}, kDLCPU, 0);
+
+  core::Tensor expected =
+      common::CreateTensor<float>({batch, M, N}, kDLCPU, 0);
+  BatchMatMul(A, false, B, false, 1.0, expected, 0.0);
+  core::Tensor out = common::CreateTensor<float>({batch, M, N}, kDLCPU, 0);
+  BatchMatMul(A_view, false, B, false, 1.0, out, 0.0);
+  REQUIRE(common::CheckResultOfCPU<float>(out, expected));
+}
+
+TEST_CASE("batch-matmul-cpu-split-heads") {
+  // The heads of q, k and v read straight out of the qkv projection
+  // [batch, seq, 3, heads, width], and the context written into the merged
+  // heads [batch, seq, heads, width], which no single batch stride spans.
+  const int64_t batch = 2, seq = 3, heads = 2, width = 4;
+  const int64_t hidden = heads * width;
+  core::Tensor qkv = common::CreateTensorAndFillRandom<float>(
+      {batch, seq, 3, heads, width}, kDLCPU, 0);
+  auto split_heads = [&](int64_t idx) {
+    return core::TensorView(qkv).AsStrided(
+        {batch, heads, seq, width}, {seq * 3 * hidden, width, 3 * hidden, 1},
+        idx * hidden);
+  };
+  auto dense_heads = [&](int64_t idx) {
+    core::Tensor t =
+        common::CreateTensor<float>({batch, heads, seq, width}, kDLCPU, 0);
+    auto* dst = t.mutableData<float>();
+    for (int64_t b = 0; b < batch; ++b) {
+      for (int64_t h = 0; h < heads; ++h) {
+        for (int64_t s = 0; s < seq; ++s) {
+          auto* src = qkv.data<float>() +
+                      (((b * seq + s) * 3 + idx) * heads + h) * width;
+          dst = std::copy(src, src + width, dst);
+        }
+      }
+    }
+    return t;
+  };
+  core::Tensor q = dense_heads(0), k = dense_heads(1), v = dense_heads(2);
+
+  core::Tensor expected_score =
+      common::CreateTensor<float>({batch, heads, seq, seq}, kDLCPU, 0);
+  BatchMatMul(q, false, k, true, 1.0, expected_score, 0.0);
+  core::Tensor score =
+      common::CreateTensor<float>({batch, heads, seq, seq}, kDLCPU, 0);
+  BatchMatMul(split_heads(0), false, split_heads(1), true, 1.0, score, 0.0);
+  REQUIRE(common::CheckResultOfCPU<float>(score, expected_score));
+
+  core::Tensor expected_context =
+      common::CreateTensor<float>({batch, heads, seq, width}, kDLCPU, 0);
+  BatchMatMul(score, false, v, false, 1.0, expected_context, 0.0);
+  core::Tensor merged =
+      common::CreateTensor<float>({batch, seq, hidden}, kDLCPU, 0);
+  BatchMatMul(score, false, split_heads(2), false, 1.0,
+              core::TensorView(merged).AsStrided(
+                  {batch, heads, seq, width},
+                  {seq * hidden, width, hidden, 1}),
+              0.0);
+  for (int64_t b = 0; b < batch; ++b) {
+    for (int64_t h = 0; h < heads; ++h) {
+      for (int64_t s = 0; s < seq; ++s) {
+        for (int64_t w = 0; w < width; ++w) {
+          auto out = merged.data<float>()[(b * seq + s) * hidden +
+                                          h * width + w];
+          auto ref = expected_context
+                         .data<float>()[((b * heads + h) * seq + s) * width +
+                                        w];
+          REQUIRE(std::abs(out - ref) < 1e-5);
+        }
+      }
+    }
+  }
+}
+
 #ifdef TT_WITH_CUDA
 void check_cpu_gpu_res(bool isTransB) {
-  const std::vector<int64_t> m_list{5, 10, 15, 20};
+  const std::vector<int64_t> m_list{1, 4, 5, 10, 15, 20};
   const std::vector<int64_t> n_list{12 * 64, 12 * 64 * 4};
   const std::vector<int64_t> k_list{12 * 64, 12 * 64 * 4};
   ;
@@ -106,10 +434,10 @@ void check_cpu_gpu_res(bool isTransB) {
             common::CreateAndFillRandomForCPUGPUTensors<float>(output_shape);
 
         layers::kernels::MatMul(cpu_input_tensor, false, cpu_weight_tensor,
-                                isTransB, 1.0, &cpu_output_tensor, 0.0);
+                                isTransB, 1.0, cpu_output_tensor, 0.0);
 
         layers::kernels::MatMul(gpu_input_tensor, false, gpu_weight_tensor,
-                                isTransB, 1.0, &gpu_output_tensor, 0.0);
+                                isTransB, 1.0, gpu_output_tensor, 0.0);
 
         common::CheckResultOfCPUAndGPU<float>(cpu_output_tensor,
                                               gpu_output_tensor);
@@ -122,8 +450,154 @@ TEST_CASE("matmul-gpu-test") {
   check_cpu_gpu_res(true);
   check_cpu_gpu_res(false);
 }
+
+TEST_CASE("matmul-gpu-fp16-test") {
+  for (bool trans_b : {false, true}) {
+    for (int64_t m : {1, 3, 5, 20}) {
+      int64_t k = 12 * 64, n = 12 * 64 * 4;
+      core::Tensor cpu_input(nullptr), gpu_input(nullptr);
+      std::tie(cpu_input, gpu_input) =
+          common::CreateAndFillRandomForCPUGPUHalfTensors({m, k});
+      core::Tensor cpu_weight(nullptr), gpu_weight(nullptr);
+      if (trans_b) {
+        std::tie(cpu_weight, gpu_weight) =
+            common::CreateAndFillRandomForCPUGPUHalfTensors({n, k});
+      } else {
+        std::tie(cpu_weight, gpu_weight) =
+            common::CreateAndFillRandomForCPUGPUHalfTensors({k, n});
+      }
+      core::Tensor cpu_output(nullptr), gpu_output(nullptr);
+      std::tie(cpu_output, gpu_output) =
+          common::CreateAndFillRandomForCPUGPUHalfTensors({m, n});
+
+      MatMul(cpu_input, false, cpu_weight, trans_b, 1.0, cpu_output, 0.0);
+      MatMul(gpu_input, false, gpu_weight, trans_b, 1.0, gpu_output, 0.0);
+      REQUIRE(common::CheckResultOfCPUAndGPUHalf(cpu_output, gpu_output,
+                                                 1e-2));
+    }
+  }
+}
+
+TEST_CASE("matmul-add-bias-layer-norm-gpu") {
+  // More rows than a chunk of the GPU.
+  int64_t m = 3000, k = 64, n = 12 * 64;
+  core::Tensor cpu_input(nullptr), gpu_input(nullptr), cpu_weight(nullptr),
+      gpu_weight(nullptr), cpu_residual(nullptr), gpu_residual(nullptr),
+      cpu_bias(nullptr), gpu_bias(nullptr), cpu_gamma(nullptr),
+      gpu_gamma(nullptr), cpu_beta(nullptr), gpu_beta(nullptr);
+  std::tie(cpu_input, gpu_input) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({m, k});
+  std::tie(cpu_weight, gpu_weight) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({k, n});
+  std::tie(cpu_residual, gpu_residual) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({m, n});
+  std::tie(cpu_bias, gpu_bias) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({n});
+  std::tie(cpu_gamma, gpu_gamma) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({n});
+  std::tie(cpu_beta, gpu_beta) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({n});
+  core::Tensor cpu_output = common::CreateTensor<float>({m, n}, kDLCPU, 0);
+  core::Tensor gpu_output = common::CreateTensor<float>({m, n}, kDLGPU, 0);
+
+  MatMulAddBiasLayerNorm<float>(cpu_input, cpu_weight, PackWeight(cpu_weight),
+                                cpu_residual, cpu_bias, cpu_gamma, cpu_beta,
+                                &cpu_output);
+  MatMulAddBiasLayerNorm<float>(gpu_input, gpu_weight, PackedWeight(),
+                                gpu_residual, gpu_bias, gpu_gamma, gpu_beta,
+                                &gpu_output);
+  REQUIRE(common::CheckResultOfCPUAndGPU<float>(cpu_output, gpu_output));
+}
+
+TEST_CASE("matmul-add-bias-gelu-gpu") {
+  int64_t m = 100, k = 64, n = 4 * 64;
+  core::Tensor cpu_input(nullptr), gpu_input(nullptr), cpu_weight(nullptr),
+      gpu_weight(nullptr), cpu_bias(nullptr), gpu_bias(nullptr);
+  std::tie(cpu_input, gpu_input) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({m, k});
+  std::tie(cpu_weight, gpu_weight) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({k, n});
+  std::tie(cpu_bias, gpu_bias) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({n});
+  core::Tensor cpu_output = common::CreateTensor<float>({m, n}, kDLCPU, 0);
+  core::Tensor gpu_output = common::CreateTensor<float>({m, n}, kDLGPU, 0);
+
+  MatMul(cpu_input, false, cpu_weight, false, 1.0, cpu_output, 0.0);
+  AddBiasAct<float, ActivationType::Gelu>(cpu_bias, &cpu_output);
+  MatMulAddBiasGelu<float>(gpu_input, gpu_weight, PackedWeight(), gpu_bias,
+                           &gpu_output);
+  REQUIRE(common::CheckResultOfCPUAndGPU<float>(cpu_output, gpu_output));
+
+  std::tie(cpu_input, gpu_input) =
+      common::CreateAndFillRandomForCPUGPUHalfTensors({m, k});
+  std::tie(cpu_weight, gpu_weight) =
+      common::CreateAndFillRandomForCPUGPUHalfTensors({k, n});
+  std::tie(cpu_bias, gpu_bias) =
+      common::CreateAndFillRandomForCPUGPUHalfTensors({n});
+  MatMul(cpu_input, false, cpu_weight, false, 1.0, cpu_output, 0.0);
+  AddBiasAct<float, ActivationType::Gelu>(cpu_bias, &cpu_output);
+  core::Tensor gpu_half_output =
+      common::CreateTensor<core::Half>({m, n}, kDLGPU, 0);
+  MatMulAddBiasGelu<core::Half>(gpu_input, gpu_weight, PackedWeight(),
+                                gpu_bias, &gpu_half_output);
+  REQUIRE(common::CheckResultOfCPUAndGPUHalf(cpu_output, gpu_half_output,
+                                             1e-2));
+}
+
+TEST_CASE("matmul-gpu-tuned-accumulate") {
+  // An odd shape, accumulated twice: the first call tunes the algorithm, the
+  // second one reuses it, and neither may disturb the accumulated output.
+  int64_t m = 37, k = 12 * 64, n = 3 * 12 * 64;
+  core::Tensor cpu_input(nullptr), gpu_input(nullptr);
+  std::tie(cpu_input, gpu_input) =
+      common::CreateAndFillRandomForCPUGPUHalfTensors({m, k});
+  core::Tensor cpu_weight(nullptr), gpu_weight(nullptr);
+  std::tie(cpu_weight, gpu_weight) =
+      common::CreateAndFillRandomForCPUGPUHalfTensors({k, n});
+  core::Tensor cpu_output(nullptr), gpu_output(nullptr);
+  std::tie(cpu_output, gpu_output) =
+      common::CreateAndFillRandomForCPUGPUHalfTensors({m, n});
+  for (int i = 0; i < 2; ++i) {
+    MatMul(cpu_input, false, cpu_weight, false, 1.0, cpu_output, 1.0);
+    MatMul(gpu_input, false, gpu_weight, false, 1.0, gpu_output, 1.0);
+    REQUIRE(common::CheckResultOfCPUAndGPUHalf(cpu_output, gpu_output, 1e-2));
+  }
+
+  // The cache survives a round trip through a file.
+  std::string path = "gemm_algo_cache_test.txt";
+  SaveGemmAlgoCache(path);
+  LoadGemmAlgoCache(path);
+  MatMul(cpu_input, false, cpu_weight, false, 1.0, cpu_output, 1.0);
+  MatMul(gpu_input, false, gpu_weight, false, 1.0, gpu_output, 1.0);
+  REQUIRE(common::CheckResultOfCPUAndGPUHalf(cpu_output, gpu_output, 1e-2));
+  std::remove(path.c_str());
+}
 #endif
 
+TEST_CASE("matmul-pack-layer-weight") {
+  auto weight = common::CreateTensorAndFillRandom<float>({64, 32}, kDLCPU, 0);
+  core::Tensor view(core::NewDLPackTensorViewT<float>(
+      weight.mutableData<float>(), {64, 32}, kDLCPU, 0));
+  // Null without MKL.
+  bool packs = !PackWeight(weight).is_null();
+  REQUIRE(!PackLayerWeight(weight).is_null() == packs);
+  // The views of mapped or shared weights are not packed, unless enabled.
+  REQUIRE(!IsPackingSharedWeightsEnabled());
+  REQUIRE(PackLayerWeight(view).is_null());
+  EnablePackingSharedWeights(true);
+  auto packed = PackLayerWeight(view);
+  EnablePackingSharedWeights(false);
+  REQUIRE(!packed.is_null() == packs);
+  if (packs) {
+    auto input = common::CreateTensorAndFillRandom<float>({4, 64}, kDLCPU, 0);
+    auto expected = common::CreateTensor<float>({4, 32}, kDLCPU, 0);
+    auto output = common::CreateTensor<float>({4, 32}, kDLCPU, 0);
+    MatMul(input, false, view, false, 1.0, expected, 0.0);
+    MatMul(input, packed, output, 0.0);
+    REQUIRE(common::CheckResultOfCPU<float>(expected, output));
+  }
+}
+
 }  // namespace kernels
 }  // namespace layers
 }  // namespace turbo_transformers
@@ -0,0 +1,72 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <algorithm>
+#include <cstdint>
+
+#include "turbo_transformers/core/tensor.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// The helpers of the CPU GEMMs whose weights are stored as panels of
+// columns, see bf16_mat_mul.h and weight_only_mat_mul.h. Their kernels are
+// compiled for their own targets by __attribute__((target)), since the
+// binary is not built for a specific CPU, and chosen at runtime.
+namespace panel_gemm {
+
+inline int64_t AlignUp(int64_t size, int64_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+// Returns the number of rows M of the float CPU `input` [..., k] multiplied
+// into the dense float CPU `out` of M * n elements. `name` is the GEMM the
+// errors are reported for.
+inline int64_t CheckShapes(const char* name, const core::Tensor& input,
+                           int64_t k, int64_t n, const core::Tensor& out) {
+  TT_ENFORCE(input.device_type() == kDLCPU && out.device_type() == kDLCPU,
+             "%s error: the weight is only supported on the CPU.", name);
+  TT_ENFORCE(input.IsType<float>() && out.IsType<float>(),
+             "%s error: the input and the out must be float.", name);
+  TT_ENFORCE_EQ(input.shape(input.n_dim() - 1), k, "matrix shape mismatch");
+  int64_t m = input.numel() / k;
+  TT_ENFORCE_EQ(out.numel(), m * n, "%s error: out must have M * N elements.",
+                name);
+  return m;
+}
+
+// Copies the block `acc` [end - begin, acc_cols] to the rows [begin, end)
+// and the columns [col, col + cols) of `y` [M, n], times the `scales` of the
+// columns if they are given.
+inline void StoreBlock(const float* acc, int64_t acc_cols, int64_t begin,
+                       int64_t end, int64_t col, int64_t cols, int64_t n,
+                       const float* scales, float* y) {
+  for (int64_t i = begin; i < end; ++i) {
+    const float* src = acc + (i - begin) * acc_cols;
+    float* dst = y + i * n + col;
+    if (scales == nullptr) {
+      std::copy(src, src + cols, dst);
+    } else {
+      for (int64_t c = 0; c < cols; ++c) {
+        dst[c] = src[c] * scales[col + c];
+      }
+    }
+  }
+}
+
+}  // namespace panel_gemm
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,145 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/prepare_inputs.h"
+
+#include "turbo_transformers/core/config.h"
+#include "turbo_transformers/layers/kernels/common.h"
+#ifdef TT_WITH_CUDA
+#include "turbo_transformers/core/cuda_device_context.h"
+#include "turbo_transformers/layers/kernels/gpu_prepare_inputs_kernel.h"
+#endif
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+namespace {
+void CPUPadPackedInputs(const int64_t* packed_ids,
+                        const int64_t* packed_segment_ids,
+                        const int64_t* packed_position_ids,
+                        const int64_t* seq_offsets, int64_t batch_size,
+                        int64_t max_seq_len, int64_t* input_ids,
+                        int64_t* segment_ids, int64_t* position_ids,
+                        float* extended_mask) {
+  int n_th = core::ParallelThreadsFor(batch_size * max_seq_len);
+#pragma omp parallel for num_threads(n_th) if (n_th > 1)
+  for (int64_t b = 0; b < batch_size; ++b) {
+    int64_t begin = seq_offsets[b];
+    int64_t len = seq_offsets[b + 1] - begin;
+    for (int64_t s = 0; s < max_seq_len; ++s) {
+      int64_t i = b * max_seq_len + s;
+      bool valid = s < len;
+      if (input_ids != nullptr) {
+        input_ids[i] = valid ? packed_ids[begin + s] : 0;
+      }
+      if (segment_ids != nullptr) {
+        segment_ids[i] = valid && packed_segment_ids != nullptr
+                             ? packed_segment_ids[begin + s]
+                             : 0;
+      }
+      if (position_ids != nullptr) {
+        int64_t position = 0;
+        if (valid) {
+          position = packed_position_ids != nullptr
+                         ? packed_position_ids[begin + s]
+                         : s;
+        }
+        position_ids[i] = position;
+      }
+      if (extended_mask != nullptr) {
+        extended_mask[i] = valid ? 0.f : -10000.f;
+      }
+    }
+  }
+}
+
+int64_t* ReshapeOutput(core::Tensor* output, int64_t batch_size,
+                       int64_t max_seq_len, const core::Tensor& like) {
+  if (output == nullptr) {
+    return nullptr;
+  }
+  return output->Reshape<int64_t>({batch_size, max_seq_len},
+                                  like.device_type(), like.device_id());
+}
+}  // namespace
+
+void PadPackedInputs(const core::Tensor& packed_ids,
+                     const core::Tensor* packed_segment_ids,
+                     const core::Tensor* packed_position_ids,
+                     const core::Tensor& seq_offsets, int64_t max_seq_len,
+                     core::Tensor* input_ids, core::Tensor* segment_ids,
+                     core::Tensor* position_ids, core::Tensor* extended_mask) {
+  TT_ENFORCE_EQ(seq_offsets.n_dim(), 1,
+                "The sequence offsets should be a vector [BatchSize + 1].");
+  int64_t batch_size = seq_offsets.shape(0) - 1;
+  TT_ENFORCE_GE(batch_size, 0, "The sequence offsets are empty.");
+  for (auto* ids : {&seq_offsets, packed_segment_ids, packed_position_ids}) {
+    if (ids == nullptr) {
+      continue;
+    }
+    TT_ENFORCE_EQ(common::is_same_device_ctx(packed_ids.device_ctx(),
+                                             ids->device_ctx()),
+                  true,
+                  "The packed ids and the offsets should have the same "
+                  "device type and device id.");
+  }
+  for (auto* ids : {packed_segment_ids, packed_position_ids}) {
+    TT_ENFORCE(ids == nullptr || ids->numel() == packed_ids.numel(),
+               "The packed segment and position ids should have the shape of "
+               "the packed ids.");
+  }
+
+  auto* ids_ptr = ReshapeOutput(input_ids, batch_size, max_seq_len, packed_ids);
+  auto* seg_ptr =
+      ReshapeOutput(segment_ids, batch_size, max_seq_len, packed_ids);
+  auto* pos_ptr =
+      ReshapeOutput(position_ids, batch_size, max_seq_len, packed_ids);
+  float* mask_ptr = nullptr;
+  if (extended_mask != nullptr) {
+    mask_ptr = extended_mask->Reshape<float>(
+        {batch_size, 1, 1, max_seq_len}, packed_ids.device_type(),
+        packed_ids.device_id());
+  }
+  const int64_t* packed_seg_ptr = packed_segment_ids == nullptr
+                                      ? nullptr
+                                      : packed_segment_ids->data<int64_t>();
+  const int64_t* packed_pos_ptr = packed_position_ids == nullptr
+                                      ? nullptr
+                                      : packed_position_ids->data<int64_t>();
+
+  if (packed_ids.device_type() == kDLCPU) {
+    CPUPadPackedInputs(packed_ids.data<int64_t>(), packed_seg_ptr,
+                       packed_pos_ptr, seq_offsets.data<int64_t>(),
+                       batch_size, max_seq_len, ids_ptr, seg_ptr, pos_ptr,
+                       mask_ptr);
+  } else if (packed_ids.device_type() == kDLGPU) {
+#ifdef TT_WITH_CUDA
+    auto& cuda_ctx =
+        core::CUDADeviceContext::GetInstance(packed_ids.device_id());
+    GPUPadPackedInputs(packed_ids.data<int64_t>(), packed_seg_ptr,
+                       packed_pos_ptr, seq_offsets.data<int64_t>(),
+                       batch_size, max_seq_len, ids_ptr, seg_ptr, pos_ptr,
+                       mask_ptr, cuda_ctx.stream());
+#else
+    TT_THROW("The current code is not compiled with CUDA.");
+#endif
+  } else {
+    TT_THROW("device_type %d is not supported for PadPackedInputs",
+             packed_ids.device_type());
+  }
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
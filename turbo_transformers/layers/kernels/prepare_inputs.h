@@ -0,0 +1,40 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include "turbo_transformers/core/tensor.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// Pad the sequences of a packed batch into the inputs of the padded model in
+// one pass, in place of padding them on the host and filling the defaults
+// with a launch each. The i-th sequence is packed_ids[seq_offsets[i],
+// seq_offsets[i + 1]) of the int64 [num_tokens] ids, and seq_offsets are the
+// int64 [batch_size + 1] offsets on the device of the ids. The outputs are
+// [batch_size, max_seq_len] int64 ids padded with 0, the segment and the
+// position ids, which default to 0 and to the index of the token if the
+// packed ones are null, and the float [batch_size, 1, 1, max_seq_len]
+// extended mask, 0 for the tokens and -10000 for the padding as
+// PrepareBertMasks makes it. A null output is skipped.
+void PadPackedInputs(const core::Tensor& packed_ids,
+                     const core::Tensor* packed_segment_ids,
+                     const core::Tensor* packed_position_ids,
+                     const core::Tensor& seq_offsets, int64_t max_seq_len,
+                     core::Tensor* input_ids, core::Tensor* segment_ids,
+                     core::Tensor* position_ids, core::Tensor* extended_mask);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,122 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/prepare_inputs.h"
+
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/layers/kernels/common.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+static core::Tensor CreateInt64Tensor(const std::vector<int64_t>& data,
+                                      DLDeviceType dev_type) {
+  auto tensor = common::CreateTensor<int64_t>(
+      {static_cast<int64_t>(data.size())}, dev_type, 0);
+  core::Copy(data.data(), data.size(), kDLCPU, dev_type,
+             tensor.mutableData<int64_t>());
+  return tensor;
+}
+
+TEST_CASE("pad-packed-inputs-cpu-test") {
+  // Three sequences of 2, 4 and 1 tokens padded to 5.
+  std::vector<int64_t> ids{1, 2, 3, 4, 5, 6, 7};
+  std::vector<int64_t> segments{0, 1, 1, 0, 1, 1, 1};
+  std::vector<int64_t> positions{5, 6, 0, 1, 2, 3, 9};
+  std::vector<int64_t> offsets{0, 2, 6, 7};
+  int64_t max_seq_len = 5;
+  auto packed_ids = CreateInt64Tensor(ids, kDLCPU);
+  auto packed_segments = CreateInt64Tensor(segments, kDLCPU);
+  auto packed_positions = CreateInt64Tensor(positions, kDLCPU);
+  auto seq_offsets = CreateInt64Tensor(offsets, kDLCPU);
+
+  for (bool given : {true, false}) {
+    core::Tensor input_ids(nullptr), segment_ids(nullptr),
+        position_ids(nullptr), mask(nullptr);
+    PadPackedInputs(packed_ids, given ? &packed_segments : nullptr,
+                    given ? &packed_positions : nullptr, seq_offsets,
+                    max_seq_len, &input_ids, &segment_ids, &position_ids,
+                    &mask);
+    REQUIRE(input_ids.shape(0) == 3);
+    REQUIRE(input_ids.shape(1) == max_seq_len);
+    REQUIRE(mask.n_dim() == 4);
+    for (int64_t b = 0; b < 3; ++b) {
+      for (int64_t s = 0; s < max_seq_len; ++s) {
+        int64_t i = b * max_seq_len + s;
+        bool valid = s < offsets[b + 1] - offsets[b];
+        int64_t src = offsets[b] + s;
+        REQUIRE(input_ids.data<int64_t>()[i] == (valid ? ids[src] : 0));
+        REQUIRE(segment_ids.data<int64_t>()[i] ==
+                (valid && given ? segments[src] : 0));
+        int64_t position = given ? positions[src] : s;
+        REQUIRE(position_ids.data<int64_t>()[i] == (valid ? position : 0));
+        REQUIRE(mask.data<float>()[i] == (valid ? 0.f : -10000.f));
+      }
+    }
+  }
+
+  // The outputs not asked for stay null.
+  core::Tensor input_ids(nullptr), position_ids(nullptr);
+  PadPackedInputs(packed_ids, nullptr, nullptr, seq_offsets, max_seq_len,
+                  &input_ids, nullptr, &position_ids, nullptr);
+  REQUIRE(position_ids.data<int64_t>()[max_seq_len + 3] == 3);
+  REQUIRE_THROWS(PadPackedInputs(packed_ids, &seq_offsets, nullptr,
+                                 seq_offsets, max_seq_len, &input_ids,
+                                 nullptr, nullptr, nullptr));
+}
+
+#ifdef TT_WITH_CUDA
+TEST_CASE("pad-packed-inputs-gpu-test") {
+  for (int64_t batch_size : {1, 20}) {
+    for (int64_t max_seq_len : {7, 128}) {
+      std::vector<int64_t> offsets{0};
+      for (int64_t b = 0; b < batch_size; ++b) {
+        offsets.push_back(offsets.back() + 1 + rand() % max_seq_len);
+      }
+      std::vector<int64_t> ids(offsets.back());
+      for (auto& id : ids) {
+        id = rand() % 1000;
+      }
+      core::Tensor cpu_outputs[4] = {core::Tensor(nullptr),
+                                     core::Tensor(nullptr),
+                                     core::Tensor(nullptr),
+                                     core::Tensor(nullptr)};
+      core::Tensor gpu_outputs[4] = {core::Tensor(nullptr),
+                                     core::Tensor(nullptr),
+                                     core::Tensor(nullptr),
+                                     core::Tensor(nullptr)};
+      for (auto dev_type : {kDLCPU, kDLGPU}) {
+        auto* outputs = dev_type == kDLCPU ? cpu_outputs : gpu_outputs;
+        auto packed_ids = CreateInt64Tensor(ids, dev_type);
+        auto seq_offsets = CreateInt64Tensor(offsets, dev_type);
+        PadPackedInputs(packed_ids, &packed_ids, nullptr, seq_offsets,
+                        max_seq_len, &outputs[0], &outputs[1], &outputs[2],
+                        &outputs[3]);
+      }
+      for (int i = 0; i < 3; ++i) {
+        REQUIRE(common::CheckResultOfCPUAndGPU<int64_t>(cpu_outputs[i],
+                                                        gpu_outputs[i]));
+      }
+      REQUIRE(common::CheckResultOfCPUAndGPU<float>(cpu_outputs[3],
+                                                    gpu_outputs[3]));
+    }
+  }
+}
+#endif
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,507 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/quantization.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "turbo_transformers/core/cpu_isa.h"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/profiler.h"
+#include "turbo_transformers/layers/kernels/layer_norm.h"
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define TT_WITH_VNNI_KERNEL
+#endif
+#ifdef TT_WITH_CUDA
+#include <cuda.h>
+#if CUDA_VERSION >= 11000
+#include <cublasLt.h>
+#endif
+
+#include "turbo_transformers/core/cuda_device_context.h"
+#include "turbo_transformers/core/cuda_enforce.cuh"
+#include "turbo_transformers/core/tensor_copy.h"
+#include "turbo_transformers/layers/kernels/gpu_quantization_kernel.h"
+#endif
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+namespace {
+int64_t AlignUp(int64_t size, int64_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+// Quantizes the rows of the float matrix [m, k] to uint8 [m, k_pad] with a
+// zero point of 128, so that row i ~= (out[i] - 128) * scales[i].
+void QuantizeRows(const float* input, int64_t m, int64_t k, int64_t k_pad,
+                  uint8_t* out, float* scales) {
+#pragma omp parallel for
+  for (int64_t i = 0; i < m; ++i) {
+    const float* row = input + i * k;
+    float max_abs = 0;
+#pragma omp simd reduction(max : max_abs)
+    for (int64_t j = 0; j < k; ++j) {
+      max_abs = std::max(max_abs, std::abs(row[j]));
+    }
+    float scale = max_abs > 0 ? max_abs / 127 : 1.f;
+    float inv_scale = 1.f / scale;
+    uint8_t* dst = out + i * k_pad;
+#pragma omp simd
+    for (int64_t j = 0; j < k; ++j) {
+      dst[j] = static_cast<uint8_t>(
+          static_cast<int32_t>(std::nearbyint(row[j] * inv_scale)) + 128);
+    }
+    std::fill(dst + k, dst + k_pad, static_cast<uint8_t>(128));
+    scales[i] = scale;
+  }
+}
+
+// The rows of the activations computed at once.
+constexpr int64_t kRowBlock = 4;
+
+// acc[r * kQuantizedNAlignment + c] = sum_j x[r][j] * w[c * ldw + j] for the
+// kRowBlock rows `x` and the kQuantizedNAlignment channels starting at `w`.
+// `k_pad` is a multiple of kQuantizedKAlignment.
+using DotU8S8Func = void (*)(const uint8_t* const* x, const int8_t* w,
+                             int64_t ldw, int64_t k_pad, int32_t* acc);
+
+void DotU8S8(const uint8_t* const* x, const int8_t* w, int64_t ldw,
+             int64_t k_pad, int32_t* acc) {
+  for (int64_t r = 0; r < kRowBlock; ++r) {
+    for (int64_t c = 0; c < kQuantizedNAlignment; ++c) {
+      const uint8_t* xr = x[r];
+      const int8_t* wc = w + c * ldw;
+      int32_t sum = 0;
+#pragma omp simd reduction(+ : sum)
+      for (int64_t j = 0; j < k_pad; ++j) {
+        sum += static_cast<int32_t>(xr[j]) * static_cast<int32_t>(wc[j]);
+      }
+      acc[r * kQuantizedNAlignment + c] = sum;
+    }
+  }
+}
+
+#ifdef TT_WITH_VNNI_KERNEL
+// The binary is not built for a specific CPU, so the VNNI kernel is compiled
+// for its own target and chosen at runtime.
+__attribute__((target("avx512f,avx512bw,avx512vnni"))) void DotU8S8VNNI(
+    const uint8_t* const* x, const int8_t* w, int64_t ldw, int64_t k_pad,
+    int32_t* acc) {
+  static_assert(kRowBlock == 4 && kQuantizedNAlignment == 4,
+                "The kernel computes 4 x 4 outputs");
+  __m512i sums[16];
+  for (int i = 0; i < 16; ++i) {
+    sums[i] = _mm512_setzero_si512();
+  }
+  for (int64_t j = 0; j < k_pad; j += 64) {
+    __m512i wv[4];
+    for (int c = 0; c < 4; ++c) {
+      wv[c] = _mm512_loadu_si512(w + c * ldw + j);
+    }
+    for (int r = 0; r < 4; ++r) {
+      __m512i xv = _mm512_loadu_si512(x[r] + j);
+      for (int c = 0; c < 4; ++c) {
+        sums[r * 4 + c] = _mm512_dpbusd_epi32(sums[r * 4 + c], xv, wv[c]);
+      }
+    }
+  }
+  alignas(64) int32_t lanes[16];
+  for (int i = 0; i < 16; ++i) {
+    _mm512_store_si512(lanes, sums[i]);
+    int32_t sum = 0;
+    for (int l = 0; l < 16; ++l) {
+      sum += lanes[l];
+    }
+    acc[i] = sum;
+  }
+}
+#endif
+
+DotU8S8Func GetDotU8S8() {
+#ifdef TT_WITH_VNNI_KERNEL
+  static const bool has_vnni = __builtin_cpu_supports("avx512vnni") &&
+                               __builtin_cpu_supports("avx512bw");
+  // The VNNI kernel is an AVX-512 one, so it obeys TT_CPU_ISA as well.
+  if (has_vnni && core::GetCPUIsa() == core::CPUIsa::kAVX512) {
+    return DotU8S8VNNI;
+  }
+#endif
+  return DotU8S8;
+}
+
+// Returns the number of rows M of `input`.
+int64_t CheckShapes(const core::Tensor& input, const QuantizedWeight& weight,
+                    const core::Tensor& out) {
+  TT_ENFORCE(!weight.is_null(), "QuantizedMatMul error: no weight.");
+  TT_ENFORCE(input.device_type() == weight.data.device_type() &&
+                 out.device_type() == input.device_type(),
+             "QuantizedMatMul error: the input, the weight and the out must "
+             "be on the same device.");
+  TT_ENFORCE_EQ(input.shape(input.n_dim() - 1), weight.k,
+                "matrix shape mismatch");
+  int64_t m = input.numel() / weight.k;
+  TT_ENFORCE_EQ(out.numel(), m * weight.n,
+                "QuantizedMatMul error: out must have M * N elements.");
+  return m;
+}
+
+// Computes `input * weight` on the CPU and stores epilogue(value, column)
+// into `out`.
+template <typename Epilogue>
+void QuantizedGemm(const core::Tensor& input, const QuantizedWeight& weight,
+                   int64_t m, core::Tensor* out, Epilogue epilogue) {
+  int64_t k = weight.k;
+  int64_t n = weight.n;
+  int64_t n_pad = weight.data.shape(0);
+  int64_t k_pad = weight.data.shape(1);
+  core::AddToCounter(core::Counter::kGemmFlops, 2 * m * n * k);
+
+  core::Tensor quantized_input(nullptr);
+  core::Tensor input_scales(nullptr);
+  auto* x = quantized_input.Reshape<uint8_t>({m, k_pad}, kDLCPU, 0);
+  auto* x_scales = input_scales.Reshape<float>({m}, kDLCPU, 0);
+  QuantizeRows(input.data<float>(), m, k, k_pad, x, x_scales);
+
+  const auto* w = weight.data.data<int8_t>();
+  const auto* w_scales = weight.scales.data<float>();
+  const auto* w_sums = weight.zero_point_sums.data<int32_t>();
+  auto* y = out->mutableData<float>();
+  int64_t n_blocks = n_pad / kQuantizedNAlignment;
+  int64_t row_blocks = (m + kRowBlock - 1) / kRowBlock;
+  DotU8S8Func dot = GetDotU8S8();
+  // The rows are the inner loop, so the threads share the weight blocks.
+#pragma omp parallel for collapse(2)
+  for (int64_t b = 0; b < n_blocks; ++b) {
+    for (int64_t rb = 0; rb < row_blocks; ++rb) {
+      // The last block repeats its last row instead of being special cased.
+      const uint8_t* rows[kRowBlock];
+      for (int64_t r = 0; r < kRowBlock; ++r) {
+        rows[r] = x + std::min(rb * kRowBlock + r, m - 1) * k_pad;
+      }
+      int32_t acc[kRowBlock * kQuantizedNAlignment];
+      int64_t begin = b * kQuantizedNAlignment;
+      dot(rows, w + begin * k_pad, k_pad, k_pad, acc);
+      int64_t end = std::min(begin + kQuantizedNAlignment, n);
+      int64_t row_end = std::min(rb * kRowBlock + kRowBlock, m);
+      for (int64_t i = rb * kRowBlock; i < row_end; ++i) {
+        const int32_t* row_acc =
+            acc + (i - rb * kRowBlock) * kQuantizedNAlignment;
+        for (int64_t col = begin; col < end; ++col) {
+          float val = static_cast<float>(row_acc[col - begin] - w_sums[col]) *
+                      x_scales[i] * w_scales[col];
+          y[i * n + col] = epilogue(val, col);
+        }
+      }
+    }
+  }
+}
+
+template <types::ActivationType ActType>
+float Activate(float x);
+
+template <>
+float Activate<types::ActivationType::Gelu>(float x) {
+  return x * 0.5f *
+         (1.0f + std::tanh(0.7978845608028654f * (x + 0.044715f * x * x * x)));
+}
+
+template <>
+float Activate<types::ActivationType::Tanh>(float x) {
+  return std::tanh(x);
+}
+
+template <>
+float Activate<types::ActivationType::Identity>(float x) {
+  return x;
+}
+
+// Quantizes the channels of the float weight `w` [k, n] with the given
+// strides into the CPU tensors of `result`.
+void QuantizeChannels(const float* w, int64_t k_stride, int64_t n_stride,
+                      QuantizedWeight* result) {
+  int64_t k_pad = AlignUp(result->k, kQuantizedKAlignment);
+  int64_t n_pad = AlignUp(result->n, kQuantizedNAlignment);
+  auto* data = result->data.Reshape<int8_t>({n_pad, k_pad}, kDLCPU, 0);
+  auto* scales = result->scales.Reshape<float>({result->n}, kDLCPU, 0);
+  auto* sums = result->zero_point_sums.Reshape<int32_t>({n_pad}, kDLCPU, 0);
+  std::fill(data, data + n_pad * k_pad, 0);
+  std::fill(sums, sums + n_pad, 0);
+
+#pragma omp parallel for
+  for (int64_t c = 0; c < result->n; ++c) {
+    float max_abs = 0;
+    for (int64_t j = 0; j < result->k; ++j) {
+      max_abs = std::max(max_abs, std::abs(w[j * k_stride + c * n_stride]));
+    }
+    float scale = max_abs > 0 ? max_abs / 127 : 1.f;
+    int32_t sum = 0;
+    for (int64_t j = 0; j < result->k; ++j) {
+      auto q = static_cast<int32_t>(
+          std::nearbyint(w[j * k_stride + c * n_stride] / scale));
+      q = std::min(std::max(q, -127), 127);
+      data[c * k_pad + j] = static_cast<int8_t>(q);
+      sum += q;
+    }
+    scales[c] = scale;
+    sums[c] = 128 * sum;
+  }
+}
+
+#ifdef TT_WITH_CUDA
+// Copies the elements spanned by the strided `weight` to the host as floats.
+std::vector<float> CopyWeightToHost(const core::TensorView& weight) {
+  int64_t span = (weight.shape(0) - 1) * weight.stride(0) +
+                 (weight.shape(1) - 1) * weight.stride(1) + 1;
+  std::vector<float> result(span);
+  if (weight.IsType<core::Half>()) {
+    std::vector<core::Half> half(span);
+    core::Copy(weight.data<core::Half>(), span, kDLGPU, kDLCPU, half.data());
+    std::copy(half.begin(), half.end(), result.begin());
+  } else {
+    core::Copy(weight.data<float>(), span, kDLGPU, kDLCPU, result.data());
+  }
+  return result;
+}
+
+// y [m, n_pad] = x [m, k_pad] * w [n_pad, k_pad]^T in int32.
+void GPUInt8Gemm(const int8_t* x, const int8_t* w, int64_t m, int64_t n_pad,
+                 int64_t k_pad, const core::CUDADeviceContext& gpu_ctx,
+                 int32_t* y) {
+#if CUDA_VERSION >= 11000
+  // In column major, y^T [n_pad, m] = w^T * x^T where w is [k_pad, n_pad] and
+  // x is [k_pad, m]. It is the "TN" layout needed by the int8 tensor core
+  // kernels with the regular orders. A cuBLAS handle is also a valid cuBLASLt
+  // handle.
+  auto handle = reinterpret_cast<cublasLtHandle_t>(gpu_ctx.cublas_handle());
+  cublasLtMatmulDesc_t desc;
+  TT_ENFORCE_CUDA_SUCCESS(
+      cublasLtMatmulDescCreate(&desc, CUBLAS_COMPUTE_32I, CUDA_R_32I));
+  cublasOperation_t trans_w = CUBLAS_OP_T;
+  TT_ENFORCE_CUDA_SUCCESS(cublasLtMatmulDescSetAttribute(
+      desc, CUBLASLT_MATMUL_DESC_TRANSA, &trans_w, sizeof(trans_w)));
+  cublasLtMatrixLayout_t w_layout, x_layout, y_layout;
+  TT_ENFORCE_CUDA_SUCCESS(
+      cublasLtMatrixLayoutCreate(&w_layout, CUDA_R_8I, k_pad, n_pad, k_pad));
+  TT_ENFORCE_CUDA_SUCCESS(
+      cublasLtMatrixLayoutCreate(&x_layout, CUDA_R_8I, k_pad, m, k_pad));
+  TT_ENFORCE_CUDA_SUCCESS(
+      cublasLtMatrixLayoutCreate(&y_layout, CUDA_R_32I, n_pad, m, n_pad));
+  int32_t alpha = 1, beta = 0;
+  TT_ENFORCE_CUDA_SUCCESS(cublasLtMatmul(
+      handle, desc, &alpha, w, w_layout, x, x_layout, &beta, y, y_layout, y,
+      y_layout, nullptr, nullptr, 0, gpu_ctx.stream()));
+  TT_ENFORCE_CUDA_SUCCESS(cublasLtMatrixLayoutDestroy(y_layout));
+  TT_ENFORCE_CUDA_SUCCESS(cublasLtMatrixLayoutDestroy(x_layout));
+  TT_ENFORCE_CUDA_SUCCESS(cublasLtMatrixLayoutDestroy(w_layout));
+  TT_ENFORCE_CUDA_SUCCESS(cublasLtMatmulDescDestroy(desc));
+#else
+  TT_THROW("The int8 MatMul on the GPU needs CUDA 11 or later.");
+#endif
+}
+
+// Quantizes `input` of the type T on the GPU, multiplies it with `weight` and
+// calls epilogue(acc, ld_acc, row_scales, stream) to dequantize the int32
+// products.
+template <typename T, typename Epilogue>
+void GPUQuantizedGemm(const core::Tensor& input, const QuantizedWeight& weight,
+                      int64_t m, Epilogue epilogue) {
+  int64_t n_pad = weight.data.shape(0);
+  int64_t k_pad = weight.data.shape(1);
+  core::AddToCounter(core::Counter::kGemmFlops, 2 * m * weight.n * weight.k);
+  int device_id = input.device_id();
+  auto& gpu_ctx = core::CUDADeviceContext::GetInstance(device_id);
+
+  core::Tensor quantized_input(nullptr);
+  core::Tensor input_scales(nullptr);
+  core::Tensor products(nullptr);
+  auto* x = quantized_input.Reshape<int8_t>({m, k_pad}, kDLGPU, device_id);
+  auto* x_scales = input_scales.Reshape<float>({m}, kDLGPU, device_id);
+  auto* y = products.Reshape<int32_t>({m, n_pad}, kDLGPU, device_id);
+  GPUQuantizeRows(input.data<T>(), m, weight.k, k_pad, gpu_ctx.stream(), x,
+                  x_scales);
+  GPUInt8Gemm(x, weight.data.data<int8_t>(), m, n_pad, k_pad, gpu_ctx, y);
+  epilogue(y, n_pad, x_scales, gpu_ctx.stream());
+}
+
+template <typename T>
+void GPUQuantizedMatMul(const core::Tensor& input,
+                        const QuantizedWeight& weight, int64_t m,
+                        core::Tensor* out) {
+  GPUQuantizedGemm<T>(input, weight, m,
+                      [&](const int32_t* acc, int64_t ld_acc,
+                          const float* row_scales, cudaStream_t stream) {
+                        GPUDequantize(acc, m, weight.n, ld_acc, row_scales,
+                                      weight.scales.data<float>(), stream,
+                                      out->mutableData<T>());
+                      });
+}
+
+template <typename T, types::ActivationType ActType>
+void GPUQuantizedMatMulBiasAct(const core::Tensor& input,
+                               const QuantizedWeight& weight, int64_t m,
+                               const core::Tensor& bias, core::Tensor* out) {
+  GPUQuantizedGemm<T>(input, weight, m,
+                      [&](const int32_t* acc, int64_t ld_acc,
+                          const float* row_scales, cudaStream_t stream) {
+                        GPUDequantizeAddBiasAct<T, ActType>(
+                            acc, m, weight.n, ld_acc, row_scales,
+                            weight.scales.data<float>(), bias.data<T>(),
+                            stream, out->mutableData<T>());
+                      });
+}
+
+template <typename T>
+void GPUQuantizedMatMulAddBiasLayerNorm(
+    const core::Tensor& input, const QuantizedWeight& weight, int64_t m,
+    const core::Tensor& residual, const core::Tensor& bias,
+    const core::Tensor& gamma, const core::Tensor& beta, float epsilon,
+    core::Tensor* out) {
+  GPUQuantizedGemm<T>(input, weight, m,
+                      [&](const int32_t* acc, int64_t ld_acc,
+                          const float* row_scales, cudaStream_t stream) {
+                        GPUDequantizeAddBiasLayerNorm(
+                            acc, m, weight.n, ld_acc, row_scales,
+                            weight.scales.data<float>(), residual.data<T>(),
+                            bias.data<T>(), gamma.data<T>(), beta.data<T>(),
+                            epsilon, stream, out->mutableData<T>());
+                      });
+}
+#endif
+}  // namespace
+
+QuantizedWeight QuantizeWeight(const core::TensorView& weight) {
+  TT_ENFORCE_EQ(weight.n_dim(), 2, "The weight must be a matrix.");
+  QuantizedWeight result;
+  result.k = weight.shape(0);
+  result.n = weight.shape(1);
+  if (weight.device_type() == kDLCPU) {
+    QuantizeChannels(weight.data<float>(), weight.stride(0), weight.stride(1),
+                     &result);
+    return result;
+  }
+#ifdef TT_WITH_CUDA
+  // The weight is quantized on the host, and the int8 data and the scales
+  // are copied back to its device.
+  TT_ENFORCE_EQ(weight.device_type(), kDLGPU,
+                "The weight is on an unsupported device.");
+  auto host_weight = CopyWeightToHost(weight);
+  QuantizeChannels(host_weight.data(), weight.stride(0), weight.stride(1),
+                   &result);
+  QuantizedWeight gpu_result;
+  gpu_result.k = result.k;
+  gpu_result.n = result.n;
+  gpu_result.data.Reshape<int8_t>(
+      {result.data.shape(0), result.data.shape(1)}, kDLGPU, weight.device_id());
+  gpu_result.scales.Reshape<float>({result.n}, kDLGPU, weight.device_id());
+  core::Copy<int8_t>(result.data, gpu_result.data);
+  core::Copy<float>(result.scales, gpu_result.scales);
+  return gpu_result;
+#else
+  TT_THROW("The weight is on an unsupported device.");
+#endif
+}
+
+void QuantizedMatMul(const core::Tensor& input, const QuantizedWeight& weight,
+                     core::Tensor* out) {
+  core::ProfileScope profile_scope("QuantizedMatMul", input);
+  int64_t m = CheckShapes(input, weight, *out);
+  if (input.device_type() == kDLCPU) {
+    QuantizedGemm(input, weight, m, out,
+                  [](float val, int64_t) { return val; });
+    return;
+  }
+#ifdef TT_WITH_CUDA
+  if (input.IsType<core::Half>()) {
+    GPUQuantizedMatMul<core::Half>(input, weight, m, out);
+  } else {
+    GPUQuantizedMatMul<float>(input, weight, m, out);
+  }
+#else
+  TT_THROW("The device is not supported.");
+#endif
+}
+
+template <types::ActivationType ActType>
+void QuantizedMatMulBiasAct(const core::Tensor& input,
+                            const QuantizedWeight& weight,
+                            const core::Tensor& bias, core::Tensor* out) {
+  core::ProfileScope profile_scope("QuantizedMatMulBiasAct", input);
+  int64_t m = CheckShapes(input, weight, *out);
+  TT_ENFORCE_EQ(bias.numel(), weight.n, "The bias and weight mismatch.");
+  if (input.device_type() == kDLCPU) {
+    const float* bias_ptr = bias.data<float>();
+    QuantizedGemm(input, weight, m, out, [bias_ptr](float val, int64_t col) {
+      return Activate<ActType>(val + bias_ptr[col]);
+    });
+    return;
+  }
+#ifdef TT_WITH_CUDA
+  if (input.IsType<core::Half>()) {
+    GPUQuantizedMatMulBiasAct<core::Half, ActType>(input, weight, m, bias,
+                                                   out);
+  } else {
+    GPUQuantizedMatMulBiasAct<float, ActType>(input, weight, m, bias, out);
+  }
+#else
+  TT_THROW("The device is not supported.");
+#endif
+}
+
+template void QuantizedMatMulBiasAct<types::ActivationType::Gelu>(
+    const core::Tensor& input, const QuantizedWeight& weight,
+    const core::Tensor& bias, core::Tensor* out);
+template void QuantizedMatMulBiasAct<types::ActivationType::Tanh>(
+    const core::Tensor& input, const QuantizedWeight& weight,
+    const core::Tensor& bias, core::Tensor* out);
+template void QuantizedMatMulBiasAct<types::ActivationType::Identity>(
+    const core::Tensor& input, const QuantizedWeight& weight,
+    const core::Tensor& bias, core::Tensor* out);
+
+void QuantizedMatMulAddBiasLayerNorm(const core::Tensor& input,
+                                     const QuantizedWeight& weight,
+                                     const core::Tensor& residual,
+                                     const core::Tensor& bias,
+                                     const core::Tensor& gamma,
+                                     const core::Tensor& beta,
+                                     core::Tensor* out, float epsilon) {
+  core::ProfileScope profile_scope("QuantizedMatMulAddBiasLayerNorm", input);
+  int64_t m = CheckShapes(input, weight, *out);
+  TT_ENFORCE_EQ(residual.numel(), out->numel(),
+                "The residual and out mismatch.");
+  TT_ENFORCE_EQ(bias.numel(), weight.n, "The bias and weight mismatch.");
+  if (input.device_type() == kDLCPU) {
+    QuantizedGemm(input, weight, m, out,
+                  [](float val, int64_t) { return val; });
+    AddBiasLayerNorm<float>(residual, bias, gamma, beta, out, epsilon);
+    return;
+  }
+#ifdef TT_WITH_CUDA
+  if (input.IsType<core::Half>()) {
+    GPUQuantizedMatMulAddBiasLayerNorm<core::Half>(
+        input, weight, m, residual, bias, gamma, beta, epsilon, out);
+  } else {
+    GPUQuantizedMatMulAddBiasLayerNorm<float>(input, weight, m, residual,
+                                              bias, gamma, beta, epsilon, out);
+  }
+#else
+  TT_THROW("The device is not supported.");
+#endif
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
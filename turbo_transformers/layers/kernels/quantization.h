@@ -0,0 +1,87 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+
+#pragma once
+#include <cstdint>
+
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/tensor_view.h"
+#include "turbo_transformers/layers/kernels/layer_norm.h"
+#include "turbo_transformers/layers/types.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// The int8 weight of `out = input * weight`, quantized symmetrically per
+// output channel, i.e. weight[k][n] ~= data[n][k] * scales[n]. It lives on
+// the device of the float weight.
+//
+// Every channel is contiguous in K and padded with zeros to a multiple of
+// kQuantizedKAlignment, the number of channels is padded to a multiple of
+// kQuantizedNAlignment. On the CPU, the activations are quantized to uint8
+// with a zero point of 128, whose contribution `128 * sum_k data[n][k]` is
+// precomputed in `zero_point_sums`. On the GPU, they are quantized to int8
+// without a zero point for the int8 tensor cores, and `zero_point_sums` is
+// null.
+struct QuantizedWeight {
+  core::Tensor data{nullptr};             // int8, [N_pad, K_pad]
+  core::Tensor scales{nullptr};           // float, [N]
+  core::Tensor zero_point_sums{nullptr};  // int32, [N_pad], CPU only
+  int64_t k{0};
+  int64_t n{0};
+
+  bool is_null() const { return data.is_null(); }
+};
+
+constexpr int64_t kQuantizedKAlignment = 64;
+constexpr int64_t kQuantizedNAlignment = 4;
+
+// Quantizes the float or half `weight` [K, N], which may be strided, e.g.
+// torch.t of a torch.nn.Linear weight. Half weights are only supported on
+// the GPU.
+extern QuantizedWeight QuantizeWeight(const core::TensorView& weight);
+
+// out = input * weight. `input` [..., K] is quantized per row on the fly,
+// `out` is a dense tensor of M * N elements of the same type. On the CPU the
+// inputs are float and the int8 products run on AVX512-VNNI if the CPU
+// supports it. On the GPU the inputs are float or half and the products run
+// through cuBLASLt, which needs CUDA 11 and uses the int8 tensor cores of
+// Turing and later GPUs.
+extern void QuantizedMatMul(const core::Tensor& input,
+                            const QuantizedWeight& weight, core::Tensor* out);
+
+// out = Act(input * weight + bias), the bias and the activation are applied
+// while the results are dequantized.
+template <types::ActivationType ActType>
+extern void QuantizedMatMulBiasAct(const core::Tensor& input,
+                                   const QuantizedWeight& weight,
+                                   const core::Tensor& bias,
+                                   core::Tensor* out);
+
+// out = LayerNorm(input * weight + bias + residual) with the layer norm
+// parameters `gamma` and `beta`. On the GPU, the int32 products are
+// dequantized within the layer norm kernel.
+extern void QuantizedMatMulAddBiasLayerNorm(const core::Tensor& input,
+                                            const QuantizedWeight& weight,
+                                            const core::Tensor& residual,
+                                            const core::Tensor& bias,
+                                            const core::Tensor& gamma,
+                                            const core::Tensor& beta,
+                                            core::Tensor* out,
+                                            float epsilon = kLayerNormEpsilon);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,154 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+#include "turbo_transformers/layers/kernels/quantization.h"
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/layers/kernels/activation.h"
+#include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/kernels/layer_norm.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// The int8 results are compared up to 2% of the largest reference value.
+static constexpr float kTolerance = 0.02f;
+
+TEST_CASE("quantized-matmul-cpu") {
+  // K and N are not multiples of the padding.
+  for (int64_t m : {1, 7}) {
+    for (int64_t k : {64, 100}) {
+      for (int64_t n : {4, 30}) {
+        core::Tensor input = common::CreateTensorAndFillUniform({m, k});
+        core::Tensor weight = common::CreateTensorAndFillUniform({k, n});
+        auto quantized = QuantizeWeight(weight);
+
+        core::Tensor expected = common::CreateTensor<float>({m, n}, kDLCPU, 0);
+        MatMul(input, false, weight, false, 1.0, expected, 0.0);
+        core::Tensor out = common::CreateTensor<float>({m, n}, kDLCPU, 0);
+        QuantizedMatMul(input, quantized, &out);
+        REQUIRE(common::CheckResultOfCPUWithin(out, expected, kTolerance));
+      }
+    }
+  }
+}
+
+TEST_CASE("quantized-matmul-bias-act-cpu") {
+  const int64_t batch = 2, seq = 5, k = 128, n = 48;
+  core::Tensor input = common::CreateTensorAndFillUniform({batch, seq, k});
+  core::Tensor weight = common::CreateTensorAndFillUniform({k, n});
+  core::Tensor bias = common::CreateTensorAndFillUniform({n});
+  auto quantized = QuantizeWeight(weight);
+
+  core::Tensor expected = common::CreateTensor<float>({batch, seq, n}, kDLCPU,
+                                                      0);
+  MatMul(input, false, weight, false, 1.0, expected, 0.0);
+  AddBiasAct<float, types::ActivationType::Gelu>(bias, &expected);
+
+  core::Tensor out = common::CreateTensor<float>({batch, seq, n}, kDLCPU, 0);
+  QuantizedMatMulBiasAct<types::ActivationType::Gelu>(input, quantized, bias,
+                                                      &out);
+  REQUIRE(common::CheckResultOfCPUWithin(out, expected, kTolerance));
+
+  core::Tensor wrong_out = common::CreateTensor<float>({batch, n}, kDLCPU, 0);
+  REQUIRE_THROWS(QuantizedMatMul(input, quantized, &wrong_out));
+}
+
+TEST_CASE("quantized-matmul-add-bias-layer-norm-cpu") {
+  const int64_t m = 6, k = 96, n = 40;
+  core::Tensor input = common::CreateTensorAndFillUniform({m, k});
+  core::Tensor weight = common::CreateTensorAndFillUniform({k, n});
+  core::Tensor residual = common::CreateTensorAndFillUniform({m, n});
+  core::Tensor bias = common::CreateTensorAndFillUniform({n});
+  core::Tensor gamma = common::CreateTensorAndFillUniform({n});
+  core::Tensor beta = common::CreateTensorAndFillUniform({n});
+  auto quantized = QuantizeWeight(weight);
+
+  core::Tensor expected = common::CreateTensor<float>({m, n}, kDLCPU, 0);
+  MatMul(input, false, weight, false, 1.0, expected, 0.0);
+  AddBiasLayerNorm<float>(residual, bias, gamma, beta, &expected);
+
+  core::Tensor out = common::CreateTensor<float>({m, n}, kDLCPU, 0);
+  QuantizedMatMulAddBiasLayerNorm(input, quantized, residual, bias, gamma,
+                                  beta, &out);
+  REQUIRE(common::CheckResultOfCPUWithin(out, expected, kTolerance));
+}
+
+#ifdef TT_WITH_CUDA
+static core::Tensor ToCPU(const core::Tensor& gpu_tensor) {
+  core::Tensor cpu_tensor =
+      common::CreateTensor<float>({gpu_tensor.numel()}, kDLCPU, 0);
+  core::Copy<float>(gpu_tensor, cpu_tensor);
+  return cpu_tensor;
+}
+
+TEST_CASE("quantized-matmul-gpu") {
+  const int64_t m = 33, k = 200, n = 70;
+  core::Tensor cpu_input(nullptr), gpu_input(nullptr), cpu_weight(nullptr),
+      gpu_weight(nullptr), cpu_bias(nullptr), gpu_bias(nullptr);
+  std::tie(cpu_input, gpu_input) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({m, k});
+  std::tie(cpu_weight, gpu_weight) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({k, n});
+  std::tie(cpu_bias, gpu_bias) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({n});
+  auto quantized = QuantizeWeight(gpu_weight);
+
+  core::Tensor expected = common::CreateTensor<float>({m, n}, kDLCPU, 0);
+  MatMul(cpu_input, false, cpu_weight, false, 1.0, expected, 0.0);
+  core::Tensor out = common::CreateTensor<float>({m, n}, kDLGPU, 0);
+  QuantizedMatMul(gpu_input, quantized, &out);
+  REQUIRE(common::CheckResultOfCPUWithin(ToCPU(out), expected, kTolerance));
+
+  AddBiasAct<float, types::ActivationType::Gelu>(cpu_bias, &expected);
+  QuantizedMatMulBiasAct<types::ActivationType::Gelu>(gpu_input, quantized,
+                                                      gpu_bias, &out);
+  REQUIRE(common::CheckResultOfCPUWithin(ToCPU(out), expected, kTolerance));
+}
+
+TEST_CASE("quantized-matmul-add-bias-layer-norm-gpu") {
+  const int64_t m = 20, k = 768, n = 768;
+  core::Tensor cpu_input(nullptr), gpu_input(nullptr), cpu_weight(nullptr),
+      gpu_weight(nullptr), cpu_residual(nullptr), gpu_residual(nullptr),
+      cpu_bias(nullptr), gpu_bias(nullptr), cpu_gamma(nullptr),
+      gpu_gamma(nullptr), cpu_beta(nullptr), gpu_beta(nullptr);
+  std::tie(cpu_input, gpu_input) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({m, k});
+  std::tie(cpu_weight, gpu_weight) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({k, n});
+  std::tie(cpu_residual, gpu_residual) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({m, n});
+  std::tie(cpu_bias, gpu_bias) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({n});
+  std::tie(cpu_gamma, gpu_gamma) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({n});
+  std::tie(cpu_beta, gpu_beta) =
+      common::CreateAndFillRandomForCPUGPUTensors<float>({n});
+  auto quantized = QuantizeWeight(gpu_weight);
+
+  core::Tensor expected = common::CreateTensor<float>({m, n}, kDLCPU, 0);
+  MatMul(cpu_input, false, cpu_weight, false, 1.0, expected, 0.0);
+  AddBiasLayerNorm<float>(cpu_residual, cpu_bias, cpu_gamma, cpu_beta,
+                          &expected);
+  core::Tensor out = common::CreateTensor<float>({m, n}, kDLGPU, 0);
+  QuantizedMatMulAddBiasLayerNorm(gpu_input, quantized, gpu_residual,
+                                  gpu_bias, gpu_gamma, gpu_beta, &out);
+  REQUIRE(common::CheckResultOfCPUWithin(ToCPU(out), expected, kTolerance));
+}
+#endif
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
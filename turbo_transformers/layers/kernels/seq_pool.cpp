@@ -13,15 +13,20 @@
 
 #include "turbo_transformers/layers/kernels/seq_pool.h"
 #ifdef TT_WITH_CUDA
+#include "turbo_transformers/core/cuda_device_context.h"
 #include "turbo_transformers/layers/kernels/gpu_utils.h"
 #endif
 
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
 #include <limits>
 #include <unordered_map>
 
+#include "turbo_transformers/core/config.h"
 #include "turbo_transformers/core/memory.h"
+#include "turbo_transformers/core/profiler.h"
+#include "turbo_transformers/layers/kernels/cpu_vector_kernels.h"
 
 namespace turbo_transformers {
 namespace layers {
@@ -29,42 +34,69 @@ namespace kernels {
 
 namespace {
 
+// The columns of a row pooled by one task. The rows of a chunk stay in
+// the L1 cache while they are accumulated.
+constexpr int64_t kPoolChunkSize = 256;
+
+// core::Half is only reduced by the GPU kernels.
 template <typename T, layers::types::PoolType>
-inline void ProcessEle(const T* in_ptr, T* out_ptr, int64_t seq_len,
-                       int64_t hidden_size);
-template <>
-inline void ProcessEle<float, layers::types::PoolType::kMean>(
-    const float* in_ptr, float* out_ptr, int64_t seq_len, int64_t hidden_size) {
-  TT_ENFORCE_GT(
-      hidden_size, 0,
-      "Avg Pooling on tensor whose leading dimension should be larger than "
-      "0");
-  for (int64_t i = 0; i < hidden_size; ++i) {
-    out_ptr[i] = 0.;
-    for (int64_t j = i; j < seq_len * hidden_size; j += hidden_size) {
-      out_ptr[i] += in_ptr[j];
+inline void CPUReduceAxisOne(const T* in_ptr, T* out_ptr, const int64_t* lens,
+                             int64_t batch_size, int64_t seq_len,
+                             int64_t hidden_size) {
+  TT_THROW("The CPU SeqPool only supports float.");
+}
+
+// Walks the rows of a sequence contiguously, hidden_size chunks of
+// different sequences are pooled in parallel.
+template <layers::types::PoolType t>
+void CPUReduceAxisOneImpl(const float* in_ptr, float* out_ptr,
+                          const int64_t* lens, int64_t batch_size,
+                          int64_t seq_len, int64_t hidden_size) {
+  auto& vector_kernels = GetCPUVectorKernels();
+  int64_t n_chunks = (hidden_size + kPoolChunkSize - 1) / kPoolChunkSize;
+  int n_th = core::ParallelThreadsFor(batch_size * seq_len * hidden_size);
+#pragma omp parallel for collapse(2) num_threads(n_th) if (n_th > 1)
+  for (int64_t i = 0; i < batch_size; ++i) {
+    for (int64_t c = 0; c < n_chunks; ++c) {
+      int64_t len = lens == nullptr ? seq_len : lens[i];
+      int64_t offset = c * kPoolChunkSize;
+      int64_t n = std::min(kPoolChunkSize, hidden_size - offset);
+      const float* in = in_ptr + i * seq_len * hidden_size + offset;
+      float* out = out_ptr + i * hidden_size + offset;
+      std::copy(in, in + n, out);
+      for (int64_t j = 1; j < len; ++j) {
+        if (t == layers::types::PoolType::kMax) {
+          vector_kernels.maximum(out, in + j * hidden_size, n, out);
+        } else {
+          vector_kernels.add(out, in + j * hidden_size, n, out);
+        }
+      }
+      if (t == layers::types::PoolType::kMean) {
+        vector_kernels.scale(out, 1.f / len, n);
+      }
     }
-    out_ptr[i] /= seq_len;
   }
-};
+}
 
 template <>
-inline void ProcessEle<float, layers::types::PoolType::kMax>(
-    const float* in_ptr, float* out_ptr, int64_t seq_len, int64_t hidden_size) {
-  TT_ENFORCE_GT(
-      hidden_size, 0,
-      "Max Pooling on tensor whose leading dimension should be larger than "
-      "0");
-  for (int64_t i = 0; i < hidden_size; ++i) {
-    out_ptr[i] = std::numeric_limits<float>::lowest();
-    for (int64_t j = i; j < seq_len * hidden_size; j += hidden_size) {
-      out_ptr[i] = std::max(out_ptr[i], in_ptr[j]);
-    }
-  }
-};
+inline void CPUReduceAxisOne<float, layers::types::PoolType::kMean>(
+    const float* in_ptr, float* out_ptr, const int64_t* lens,
+    int64_t batch_size, int64_t seq_len, int64_t hidden_size) {
+  CPUReduceAxisOneImpl<layers::types::PoolType::kMean>(
+      in_ptr, out_ptr, lens, batch_size, seq_len, hidden_size);
+}
+
+template <>
+inline void CPUReduceAxisOne<float, layers::types::PoolType::kMax>(
+    const float* in_ptr, float* out_ptr, const int64_t* lens,
+    int64_t batch_size, int64_t seq_len, int64_t hidden_size) {
+  CPUReduceAxisOneImpl<layers::types::PoolType::kMax>(
+      in_ptr, out_ptr, lens, batch_size, seq_len, hidden_size);
+}
 
 template <typename T, layers::types::PoolType t>
-void SeqPoolWithProcess(const core::Tensor& input, core::Tensor* output) {
+void SeqPoolWithProcess(const core::Tensor& input, const int64_t* lens,
+                        core::Tensor* output) {
   auto batch_size = input.shape(0);
   auto seq_len = input.shape(1);
   auto hidden_size = input.shape(2);
@@ -73,21 +105,23 @@ void SeqPoolWithProcess(const core::Tensor& input, core::Tensor* output) {
   T* out_ptr = output->mutableData<T>();
 
   if (input.device_type() == kDLCPU) {
-#pragma omp parallel for
-    for (int64_t i = 0; i < batch_size; ++i) {
-      ProcessEle<T, t>(in_ptr + i * hidden_size * seq_len,
-                       out_ptr + i * hidden_size, seq_len, hidden_size);
-    }
+    CPUReduceAxisOne<T, t>(in_ptr, out_ptr, lens, batch_size, seq_len,
+                           hidden_size);
   } else {
 #ifdef TT_WITH_CUDA
-    GPUReduceAxisOne<T, t>(in_ptr, out_ptr, batch_size, seq_len, hidden_size);
+    auto stream =
+        core::CUDADeviceContext::GetInstance(output->device_id()).stream();
+    GPUReduceAxisOne<T, t>(in_ptr, out_ptr, lens, batch_size, seq_len,
+                           hidden_size, stream);
 #endif
   }
 }
 
+// Copies the idx-th position of every sequence, or the last valid one if
+// the lengths are given.
 template <typename T>
 void SeqPoolWithIdx(const core::Tensor& input, int64_t idx,
-                    core::Tensor* output) {
+                    const int64_t* lens, core::Tensor* output) {
   auto batch_size = input.shape(0);
   auto seq_len = input.shape(1);
   auto hidden_size = input.shape(2);
@@ -98,20 +132,30 @@ void SeqPoolWithIdx(const core::Tensor& input, int64_t idx,
   T* out_ptr = output->mutableData<T>();
   int64_t stride = seq_len * hidden_size;
   if (input.device_type() == kDLCPU) {
-#pragma omp parallel for
+    int n_th = core::ParallelThreadsFor(2 * batch_size * hidden_size);
+#pragma omp parallel for num_threads(n_th) if (n_th > 1)
     for (int64_t i = 0; i < batch_size; ++i) {
-      const T* sub_in_ptr = in_ptr + i * stride + idx * hidden_size;
+      int64_t row = lens == nullptr ? idx : lens[i] - 1;
+      const T* sub_in_ptr = in_ptr + i * stride + row * hidden_size;
       T* sub_out_ptr = out_ptr + i * hidden_size;
       core::Memcpy(sub_out_ptr, sub_in_ptr, hidden_size * sizeof(T),
                    core::MemcpyFlag::kCPU2CPU);
     }
   } else if (input.device_type() == kDLGPU) {
 #ifdef TT_WITH_CUDA
+    if (lens != nullptr) {
+      // The lengths are on the device, let a kernel gather the rows.
+      auto stream =
+          core::CUDADeviceContext::GetInstance(output->device_id()).stream();
+      GPUReduceAxisOne<T, layers::types::PoolType::kLast>(
+          in_ptr, out_ptr, lens, batch_size, seq_len, hidden_size, stream);
+      return;
+    }
     for (int64_t i = 0; i < batch_size; ++i) {
       const T* sub_in_ptr = in_ptr + i * stride + idx * hidden_size;
       T* sub_out_ptr = out_ptr + i * hidden_size;
-      core::Memcpy(sub_out_ptr, sub_in_ptr, hidden_size * sizeof(T),
-                   core::MemcpyFlag::kGPU2GPU);
+      core::MemcpyAsync(sub_out_ptr, sub_in_ptr, hidden_size * sizeof(T),
+                        core::MemcpyFlag::kGPU2GPU, output->device_id());
     }
 #endif
   } else {
@@ -123,7 +167,8 @@ void SeqPoolWithIdx(const core::Tensor& input, int64_t idx,
 
 template <typename T>
 void SeqPool(const core::Tensor& input, layers::types::PoolType pool_type,
-             core::Tensor* output) {
+             core::Tensor* output, const core::Tensor* seq_lens) {
+  core::ProfileScope profile_scope("SeqPool", input);
   TT_ENFORCE_EQ(input.n_dim(), 3,
                 "The input's dim should be 3, but the input's dim is %d",
                 input.n_dim());
@@ -131,22 +176,43 @@ void SeqPool(const core::Tensor& input, layers::types::PoolType pool_type,
   auto batch_size = input.shape(0);
   auto seq_len = input.shape(1);
   auto hidden_size = input.shape(2);
+  TT_ENFORCE_GT(seq_len, 0, "SeqPool needs a non-empty sequence.");
+
+  const int64_t* lens = nullptr;
+  if (seq_lens != nullptr) {
+    TT_ENFORCE_EQ(seq_lens->numel(), batch_size,
+                  "SeqPool needs a length for each of the %d sequences.",
+                  batch_size);
+    TT_ENFORCE_EQ(seq_lens->device_type(), input.device_type(),
+                  "SeqPool lengths should be on the device of the input.");
+    lens = seq_lens->data<int64_t>();
+    if (input.device_type() == kDLCPU) {
+      for (int64_t i = 0; i < batch_size; ++i) {
+        TT_ENFORCE(lens[i] >= 1 && lens[i] <= seq_len,
+                   "The length of the sequence %d should be in [1, %d], "
+                   "got %d.",
+                   i, seq_len, lens[i]);
+      }
+    }
+  }
 
   output->Reshape<T>({batch_size, hidden_size}, input.device_type(),
                      input.device_id());
 
   switch (pool_type) {
     case layers::types::PoolType::kMax:
-      SeqPoolWithProcess<T, layers::types::PoolType::kMax>(input, output);
+      SeqPoolWithProcess<T, layers::types::PoolType::kMax>(input, lens,
+                                                           output);
       break;
     case layers::types::PoolType::kMean:
-      SeqPoolWithProcess<T, layers::types::PoolType::kMean>(input, output);
+      SeqPoolWithProcess<T, layers::types::PoolType::kMean>(input, lens,
+                                                            output);
       break;
     case layers::types::PoolType::kFirst:
-      SeqPoolWithIdx<T>(input, 0, output);
+      SeqPoolWithIdx<T>(input, 0, nullptr, output);
       break;
     case layers::types::PoolType::kLast:
-      SeqPoolWithIdx<T>(input, seq_len - 1, output);
+      SeqPoolWithIdx<T>(input, seq_len - 1, lens, output);
       break;
     default:
       TT_THROW("SeqPool pool type dose not supported!");
@@ -156,7 +222,12 @@ void SeqPool(const core::Tensor& input, layers::types::PoolType pool_type,
 
 template void SeqPool<float>(const core::Tensor& input,
                              layers::types::PoolType pool_type,
-                             core::Tensor* output);
+                             core::Tensor* output,
+                             const core::Tensor* seq_lens);
+template void SeqPool<core::Half>(const core::Tensor& input,
+                                  layers::types::PoolType pool_type,
+                                  core::Tensor* output,
+                                  const core::Tensor* seq_lens);
 
 layers::types::PoolType GetPoolType(const std::string& pool_type) {
 #define _EnumCase(EnumValue)                        \
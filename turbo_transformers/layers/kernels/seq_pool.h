@@ -25,9 +25,14 @@ namespace kernels {
 // The input's shape is (batch_size, seq_len, hidden_size)
 // and the output's shape is (batch_size, hidden_size)
 // The pool_type could be max, mean, first, last.
+//
+// If seq_lens, an int64 tensor of shape (batch_size,) on the device of the
+// input, is given, only the first seq_lens[i] positions of the i-th
+// sequence are pooled, i.e. the padding is excluded. The lengths must be in
+// [1, seq_len].
 template <typename T>
 void SeqPool(const core::Tensor &input, layers::types::PoolType pool_type,
-             core::Tensor *output);
+             core::Tensor *output, const core::Tensor *seq_lens = nullptr);
 
 layers::types::PoolType GetPoolType(const std::string &pool_type);
 
@@ -0,0 +1,120 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/seq_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/layers/kernels/common.h"
+#ifdef TT_WITH_CUDA
+#include "turbo_transformers/core/cuda_device_context.h"
+#endif
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+using types::PoolType;
+
+// Pools the first lens[i] rows of every sequence.
+static std::vector<float> RefSeqPool(const core::Tensor& input,
+                                     PoolType pool_type,
+                                     const std::vector<int64_t>& lens) {
+  int64_t seq_len = input.shape(1), hidden_size = input.shape(2);
+  std::vector<float> result;
+  for (size_t i = 0; i < lens.size(); ++i) {
+    const float* seq = input.data<float>() + i * seq_len * hidden_size;
+    for (int64_t k = 0; k < hidden_size; ++k) {
+      float res = pool_type == PoolType::kLast
+                      ? seq[(lens[i] - 1) * hidden_size + k]
+                      : seq[k];
+      for (int64_t j = 1; j < lens[i]; ++j) {
+        float val = seq[j * hidden_size + k];
+        if (pool_type == PoolType::kMax) {
+          res = std::max(res, val);
+        } else if (pool_type == PoolType::kMean) {
+          res += val;
+        }
+      }
+      result.push_back(pool_type == PoolType::kMean ? res / lens[i] : res);
+    }
+  }
+  return result;
+}
+
+TEST_CASE("seq-pool-cpu-test") {
+  int64_t batch_size = 3, seq_len = 7;
+  // Across a chunk of columns and not a multiple of the vector width.
+  for (int64_t hidden_size : {15, 768, 1000}) {
+    auto input = common::CreateTensorAndFillRandom<float>(
+        {batch_size, seq_len, hidden_size}, kDLCPU, 0);
+    auto seq_lens = common::CreateTensor<int64_t>({batch_size}, kDLCPU, 0);
+    std::vector<int64_t> lens{7, 1, 4};
+    std::copy(lens.begin(), lens.end(), seq_lens.mutableData<int64_t>());
+    for (auto pool_type : {PoolType::kMax, PoolType::kMean, PoolType::kFirst,
+                           PoolType::kLast}) {
+      core::Tensor output(nullptr);
+      SeqPool<float>(input, pool_type, &output);
+      auto expected = RefSeqPool(input, pool_type, {seq_len, seq_len, seq_len});
+      REQUIRE(std::equal(expected.begin(), expected.end(),
+                         output.data<float>(), [](float a, float b) {
+                           return std::abs(a - b) < 1e-5f;
+                         }));
+
+      SeqPool<float>(input, pool_type, &output, &seq_lens);
+      expected = RefSeqPool(input, pool_type, lens);
+      REQUIRE(std::equal(expected.begin(), expected.end(),
+                         output.data<float>(), [](float a, float b) {
+                           return std::abs(a - b) < 1e-5f;
+                         }));
+    }
+
+    seq_lens.mutableData<int64_t>()[1] = 0;
+    core::Tensor output(nullptr);
+    REQUIRE_THROWS(SeqPool<float>(input, PoolType::kMean, &output, &seq_lens));
+  }
+}
+
+#ifdef TT_WITH_CUDA
+TEST_CASE("seq-pool-gpu-test") {
+  int64_t batch_size = 3, seq_len = 20;
+  for (int64_t hidden_size : {15, 768, 2000}) {
+    core::Tensor input_cpu(nullptr), input_gpu(nullptr);
+    std::tie(input_cpu, input_gpu) =
+        common::CreateAndFillRandomForCPUGPUTensors<float>(
+            {batch_size, seq_len, hidden_size});
+    auto lens_cpu = common::CreateTensor<int64_t>({batch_size}, kDLCPU, 0);
+    auto lens_gpu = common::CreateTensor<int64_t>({batch_size}, kDLGPU, 0);
+    std::vector<int64_t> lens{20, 1, 13};
+    std::copy(lens.begin(), lens.end(), lens_cpu.mutableData<int64_t>());
+    core::Copy<int64_t>(lens_cpu, lens_gpu);
+    for (auto pool_type : {PoolType::kMax, PoolType::kMean, PoolType::kLast}) {
+      core::Tensor output_cpu(nullptr), output_gpu(nullptr);
+      SeqPool<float>(input_cpu, pool_type, &output_cpu);
+      SeqPool<float>(input_gpu, pool_type, &output_gpu);
+      REQUIRE(common::CheckResultOfCPUAndGPU<float>(output_cpu, output_gpu));
+
+      SeqPool<float>(input_cpu, pool_type, &output_cpu, &lens_cpu);
+      SeqPool<float>(input_gpu, pool_type, &output_gpu, &lens_gpu);
+      REQUIRE(common::CheckResultOfCPUAndGPU<float>(output_cpu, output_gpu));
+    }
+  }
+}
+#endif
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
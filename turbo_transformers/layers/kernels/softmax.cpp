@@ -13,8 +13,13 @@
 
 #include "turbo_transformers/layers/kernels/softmax.h"
 
+#include <algorithm>
 #include <cmath>
 #include <numeric>
+
+#include "turbo_transformers/core/config.h"
+#include "turbo_transformers/core/profiler.h"
+#include "turbo_transformers/layers/kernels/cpu_vector_kernels.h"
 #ifdef TT_WITH_CUDA
 #include "turbo_transformers/core/cuda_device_context.h"
 #include "turbo_transformers/layers/kernels/gpu_softmax_kernel.h"
@@ -24,57 +29,54 @@ namespace turbo_transformers {
 namespace layers {
 namespace kernels {
 void SoftmaxMask(float* qk_buf, const float* attr_mask, int64_t batch_size,
-                 int64_t head_num, int64_t seq_len, float scale) {
-  int64_t M = batch_size * head_num * seq_len;
-  int64_t N = seq_len;
-#pragma omp parallel for
+                 int64_t head_num, int64_t from_seq_len, int64_t to_seq_len,
+                 float scale, bool causal) {
+  int64_t M = batch_size * head_num * from_seq_len;
+  int64_t N = to_seq_len;
+  auto& vector_kernels = GetCPUVectorKernels();
+  int n_th = core::ParallelThreadsFor(M * N);
+#pragma omp parallel for num_threads(n_th) if (n_th > 1)
   for (int64_t i = 0; i < M; ++i) {
     auto* qk_buf_ptr = qk_buf + i * N;
-    auto attr_mask_offset = i / (head_num * seq_len) * seq_len;
+    auto attr_mask_offset = i / (head_num * from_seq_len) * N;
     auto attr_mask_ptr = attr_mask + attr_mask_offset;
+    // The keys after the query of a causal row get no weight.
+    int64_t n = causal ? N - from_seq_len + i % from_seq_len + 1 : N;
     // max-trick
-#pragma omp simd
-    for (int64_t j = 0; j < N; ++j) {
-      auto mask_val = attr_mask_ptr[j];
-      auto qk_val = qk_buf_ptr[j];
-      qk_val = qk_val * scale + mask_val;
-      qk_buf_ptr[j] = qk_val;
-    }
-    float max_val = std::numeric_limits<float>::lowest();
-#pragma omp simd reduction(max : max_val)
-    for (int64_t j = 0; j < N; ++j) {
-      max_val = std::max(max_val, qk_buf_ptr[j]);
-    }
-#pragma omp simd
-    for (int64_t j = 0; j < N; ++j) {
-      qk_buf_ptr[j] = std::exp(qk_buf_ptr[j] - max_val);
-    }
-    float sum = 0;
-#pragma omp simd reduction(+ : sum)
-    for (int64_t j = 0; j < N; ++j) {
-      sum += qk_buf_ptr[j];
-    }
-    auto coef = 1.0f / sum;
-#pragma omp simd
-    for (int64_t j = 0; j < N; ++j) {
-      qk_buf_ptr[j] *= coef;
-    }
+    float max_val =
+        vector_kernels.scale_add_max(qk_buf_ptr, scale, attr_mask_ptr, n);
+    float sum = vector_kernels.exp_sum(qk_buf_ptr, max_val, n);
+    vector_kernels.scale(qk_buf_ptr, 1.0f / sum, n);
+    std::fill(qk_buf_ptr + n, qk_buf_ptr + N, 0.f);
   }
 }
-void ApplyMaskAndSoftmax(core::Tensor* inout, const core::Tensor& att_mask,
-                         float scale) {
-  auto batch_size = inout->shape(0);
-  auto num_att_heads = inout->shape(1);
-  auto seq_len = inout->shape(2);
-  if (inout->device_type() == kDLCPU) {
-    SoftmaxMask(inout->mutableData<float>(), att_mask.data<float>(), batch_size,
-                num_att_heads, seq_len, scale);
-  } else if (inout->device_type() == kDLGPU) {
+
+void ApplyMaskAndSoftmax(core::TensorView inout,
+                         const core::TensorView& att_mask, float scale,
+                         bool causal) {
+  core::ProfileScope profile_scope("ApplyMaskAndSoftmax", inout);
+  auto batch_size = inout.shape(0);
+  auto num_att_heads = inout.shape(1);
+  auto from_seq_len = inout.shape(2);
+  auto to_seq_len = inout.shape(3);
+  TT_ENFORCE(!causal || from_seq_len <= to_seq_len,
+             "The %d causal queries should be among the %d keys",
+             from_seq_len, to_seq_len);
+  if (inout.device_type() == kDLCPU) {
+    SoftmaxMask(inout.mutableData<float>(), att_mask.data<float>(), batch_size,
+                num_att_heads, from_seq_len, to_seq_len, scale, causal);
+  } else if (inout.device_type() == kDLGPU) {
 #ifdef TT_WITH_CUDA
-    auto& cuda_ctx = core::CUDADeviceContext::GetInstance();
-    GPUSoftmaxMask(inout->mutableData<float>(), att_mask.data<float>(),
-                   batch_size, num_att_heads, seq_len, scale,
-                   cuda_ctx.stream());
+    auto& cuda_ctx = core::CUDADeviceContext::GetInstance(inout.device_id());
+    if (inout.IsType<core::Half>()) {
+      GPUSoftmaxMask(inout.mutableData<core::Half>(), att_mask.data<float>(),
+                     batch_size, num_att_heads, from_seq_len, to_seq_len,
+                     scale, causal, cuda_ctx.stream());
+    } else {
+      GPUSoftmaxMask(inout.mutableData<float>(), att_mask.data<float>(),
+                     batch_size, num_att_heads, from_seq_len, to_seq_len,
+                     scale, causal, cuda_ctx.stream());
+    }
 #else
     TT_THROW("The current code is not compiled with CUDA.");
 #endif
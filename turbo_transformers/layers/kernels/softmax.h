@@ -15,12 +15,20 @@
 #include <cstdint>
 
 #include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/tensor_view.h"
 
 namespace turbo_transformers {
 namespace layers {
 namespace kernels {
-extern void ApplyMaskAndSoftmax(core::Tensor* inout,
-                                const core::Tensor& att_mask, float scale);
+// inout: (batch_size, head_num, from_seq_len, to_seq_len), the scores of the
+// queries against the keys, replaced by their softmax.
+// att_mask: (batch_size, 1, 1, to_seq_len), added to the scaled scores.
+// If `causal`, the queries are the last from_seq_len keys, and the i-th one
+// attends to the keys up to to_seq_len - from_seq_len + i only, e.g. the new
+// tokens of a decoder against the cached ones.
+extern void ApplyMaskAndSoftmax(core::TensorView inout,
+                                const core::TensorView& att_mask, float scale,
+                                bool causal = false);
 
 }  // namespace kernels
 }  // namespace layers
@@ -13,7 +13,10 @@
 
 #include "turbo_transformers/layers/kernels/softmax.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <vector>
 
 #include "catch2/catch.hpp"
 #include "loguru.hpp"
@@ -28,6 +31,47 @@ namespace turbo_transformers {
 namespace layers {
 namespace kernels {
 
+// The i-th of the from_len queries attends to the keys up to
+// to_len - from_len + i.
+TEST_CASE("softmax-causal-test") {
+  int64_t batch_size = 2, num_attention_heads = 3;
+  for (int64_t from_len : {1, 5}) {
+    int64_t to_len = 7;
+    auto qk_buf = common::CreateTensorAndFillRandom<float>(
+        {batch_size, num_attention_heads, from_len, to_len}, kDLCPU, 0);
+    auto attr_mask = common::CreateTensorAndFillRandom<float>(
+        {batch_size, to_len}, kDLCPU, 0);
+    std::vector<float> scores(qk_buf.data<float>(),
+                              qk_buf.data<float>() + qk_buf.numel());
+    ApplyMaskAndSoftmax(qk_buf, attr_mask, 0.5, true);
+
+    const float* mask = attr_mask.data<float>();
+    const float* result = qk_buf.data<float>();
+    for (int64_t row = 0; row < qk_buf.numel() / to_len; ++row) {
+      int64_t n_keys = to_len - from_len + row % from_len + 1;
+      const float* row_mask =
+          mask + row / (num_attention_heads * from_len) * to_len;
+      float max_val = -1e20f, sum = 0.f;
+      for (int64_t j = 0; j < n_keys; ++j) {
+        max_val = std::max(max_val, scores[row * to_len + j] * 0.5f +
+                                        row_mask[j]);
+      }
+      for (int64_t j = 0; j < n_keys; ++j) {
+        sum += std::exp(scores[row * to_len + j] * 0.5f + row_mask[j] -
+                        max_val);
+      }
+      for (int64_t j = 0; j < to_len; ++j) {
+        float expected =
+            j < n_keys ? std::exp(scores[row * to_len + j] * 0.5f +
+                                  row_mask[j] - max_val) /
+                             sum
+                       : 0.f;
+        REQUIRE(std::abs(result[row * to_len + j] - expected) < 1e-5);
+      }
+    }
+  }
+}
+
 #ifdef TT_WITH_CUDA
 TEST_CASE("softmax-gpu-test") {
   int64_t num_attention_heads = 12;
@@ -35,8 +79,9 @@ TEST_CASE("softmax-gpu-test") {
   constexpr float scaler = 1.;
 
   std::vector<int64_t> batch_size_list{1, 20};
-  std::vector<int64_t> seq_length_list{10,  20,  40,  60,  80,
-                                       100, 200, 300, 400, 500};
+  // 128 and 256 fill the packs of the warp kernel.
+  std::vector<int64_t> seq_length_list{10,  20,  40,  60,  80,  100,
+                                       128, 200, 256, 300, 400, 500};
 
   for (auto batch_size : batch_size_list)
     for (auto seq_length : seq_length_list) {
@@ -50,12 +95,87 @@ TEST_CASE("softmax-gpu-test") {
           common::CreateAndFillRandomForCPUGPUTensors<float>(
               {batch_size, seq_length});
 
-      ApplyMaskAndSoftmax(&qk_buf_gpu, attr_mask_gpu, scaler);
+      ApplyMaskAndSoftmax(qk_buf_gpu, attr_mask_gpu, scaler);
+
+      ApplyMaskAndSoftmax(qk_buf_cpu, attr_mask_cpu, scaler);
+
+      REQUIRE(common::CheckResultOfCPUAndGPU<float>(qk_buf_cpu, qk_buf_gpu));
+    }
+}
+
+TEST_CASE("softmax-gpu-fp16-test") {
+  int64_t num_attention_heads = 12;
+  for (int64_t batch_size : {1, 20})
+    for (int64_t seq_length : {10, 100, 256, 500}) {
+      core::Tensor qk_buf_cpu(nullptr), qk_buf_gpu(nullptr);
+      std::tie(qk_buf_cpu, qk_buf_gpu) =
+          common::CreateAndFillRandomForCPUGPUHalfTensors(
+              {batch_size, num_attention_heads, seq_length, seq_length});
+
+      // The mask stays in float.
+      core::Tensor attr_mask_cpu(nullptr), attr_mask_gpu(nullptr);
+      std::tie(attr_mask_cpu, attr_mask_gpu) =
+          common::CreateAndFillRandomForCPUGPUTensors<float>(
+              {batch_size, seq_length});
+
+      ApplyMaskAndSoftmax(qk_buf_gpu, attr_mask_gpu, 0.125);
+      ApplyMaskAndSoftmax(qk_buf_cpu, attr_mask_cpu, 0.125);
+
+      REQUIRE(common::CheckResultOfCPUAndGPUHalf(qk_buf_cpu, qk_buf_gpu,
+                                                 1e-3));
+    }
+}
+
+// Rows longer than 1024 take the block kernel, the others the warp kernel
+// with or without the vectorized loads.
+TEST_CASE("softmax-gpu-long-rows-test") {
+  int64_t batch_size = 2, num_attention_heads = 2;
+  for (int64_t seq_length : {33, 1023, 1024, 1025, 1500, 2048}) {
+    core::Tensor qk_buf_cpu(nullptr), qk_buf_gpu(nullptr);
+    std::tie(qk_buf_cpu, qk_buf_gpu) =
+        common::CreateAndFillRandomForCPUGPUTensors<float>(
+            {batch_size, num_attention_heads, seq_length, seq_length});
+
+    core::Tensor attr_mask_cpu(nullptr), attr_mask_gpu(nullptr);
+    std::tie(attr_mask_cpu, attr_mask_gpu) =
+        common::CreateAndFillRandomForCPUGPUTensors<float>(
+            {batch_size, seq_length});
+
+    ApplyMaskAndSoftmax(qk_buf_gpu, attr_mask_gpu, 0.125);
+    ApplyMaskAndSoftmax(qk_buf_cpu, attr_mask_cpu, 0.125);
+
+    REQUIRE(common::CheckResultOfCPUAndGPU<float>(qk_buf_cpu, qk_buf_gpu));
+
+    std::tie(qk_buf_cpu, qk_buf_gpu) =
+        common::CreateAndFillRandomForCPUGPUHalfTensors(
+            {batch_size, num_attention_heads, seq_length, seq_length});
+    ApplyMaskAndSoftmax(qk_buf_gpu, attr_mask_gpu, 0.125);
+    ApplyMaskAndSoftmax(qk_buf_cpu, attr_mask_cpu, 0.125);
+
+    REQUIRE(common::CheckResultOfCPUAndGPUHalf(qk_buf_cpu, qk_buf_gpu, 1e-3));
+  }
+}
+
+TEST_CASE("softmax-gpu-causal-test") {
+  int64_t batch_size = 2, num_attention_heads = 2;
+  for (int64_t to_len : {40, 1500}) {
+    for (int64_t from_len : {int64_t(1), int64_t(16), to_len}) {
+      core::Tensor qk_buf_cpu(nullptr), qk_buf_gpu(nullptr);
+      std::tie(qk_buf_cpu, qk_buf_gpu) =
+          common::CreateAndFillRandomForCPUGPUTensors<float>(
+              {batch_size, num_attention_heads, from_len, to_len});
+
+      core::Tensor attr_mask_cpu(nullptr), attr_mask_gpu(nullptr);
+      std::tie(attr_mask_cpu, attr_mask_gpu) =
+          common::CreateAndFillRandomForCPUGPUTensors<float>(
+              {batch_size, to_len});
 
-      ApplyMaskAndSoftmax(&qk_buf_cpu, attr_mask_cpu, scaler);
+      ApplyMaskAndSoftmax(qk_buf_gpu, attr_mask_gpu, 0.125, true);
+      ApplyMaskAndSoftmax(qk_buf_cpu, attr_mask_cpu, 0.125, true);
 
       REQUIRE(common::CheckResultOfCPUAndGPU<float>(qk_buf_cpu, qk_buf_gpu));
     }
+  }
 }
 #endif
 
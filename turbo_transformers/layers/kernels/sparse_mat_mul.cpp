@@ -0,0 +1,175 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/sparse_mat_mul.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "turbo_transformers/core/enforce.h"
+#include "turbo_transformers/core/profiler.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+namespace {
+// The rows of the input multiplied at a time by a thread, which share the
+// blocks of a column block in the cache.
+constexpr int64_t kSparseRowBlock = 32;
+// The rows whose accumulators are kept in registers, so every weight row
+// loaded serves kRowTile rows.
+constexpr int64_t kRowTile = 4;
+
+// y[i][0, kSparseBlockN) = the products of `rows` x[i] with the blocks
+// [begin, end) of a column block, for i < kRows.
+template <int64_t kRows>
+void MultiplyColumnBlock(const float* x, int64_t k, const float* values,
+                         const int32_t* block_rows, int32_t begin,
+                         int32_t end, float* y, int64_t n) {
+  float acc[kRows][kSparseBlockN] = {};
+  for (int32_t b = begin; b < end; ++b) {
+    const float* block = values + b * kSparseBlockK * kSparseBlockN;
+    const float* col = x + block_rows[b] * kSparseBlockK;
+    for (int64_t r = 0; r < kSparseBlockK; ++r) {
+      const float* w = block + r * kSparseBlockN;
+      for (int64_t i = 0; i < kRows; ++i) {
+        float a = col[i * k + r];
+#pragma omp simd
+        for (int64_t c = 0; c < kSparseBlockN; ++c) {
+          acc[i][c] += a * w[c];
+        }
+      }
+    }
+  }
+  for (int64_t i = 0; i < kRows; ++i) {
+    std::copy(acc[i], acc[i] + kSparseBlockN, y + i * n);
+  }
+}
+}  // namespace
+
+BlockSparseWeight SparsifyWeight(const core::TensorView& weight,
+                                 float min_sparsity) {
+  BlockSparseWeight sparse;
+  if (weight.device_type() != kDLCPU || !weight.IsType<float>() ||
+      weight.n_dim() != 2) {
+    return sparse;
+  }
+  int64_t k = weight.shape(0);
+  int64_t n = weight.shape(1);
+  if (k % kSparseBlockK != 0 || n % kSparseBlockN != 0) {
+    return sparse;
+  }
+  int64_t row_stride = weight.stride(0);
+  int64_t col_stride = weight.stride(1);
+  const float* w = weight.data<float>();
+  int64_t k_blocks = k / kSparseBlockK;
+  int64_t n_blocks = n / kSparseBlockN;
+
+  auto is_zero_block = [&](int64_t kb, int64_t nb) {
+    for (int64_t i = kb * kSparseBlockK; i < (kb + 1) * kSparseBlockK; ++i) {
+      for (int64_t j = nb * kSparseBlockN; j < (nb + 1) * kSparseBlockN;
+           ++j) {
+        if (w[i * row_stride + j * col_stride] != 0.f) {
+          return false;
+        }
+      }
+    }
+    return true;
+  };
+  std::vector<int32_t> block_rows;
+  std::vector<int32_t> col_offsets{0};
+  for (int64_t nb = 0; nb < n_blocks; ++nb) {
+    for (int64_t kb = 0; kb < k_blocks; ++kb) {
+      if (!is_zero_block(kb, nb)) {
+        block_rows.push_back(static_cast<int32_t>(kb));
+      }
+    }
+    col_offsets.push_back(static_cast<int32_t>(block_rows.size()));
+  }
+  int64_t nnz = static_cast<int64_t>(block_rows.size());
+  if (nnz > (1.f - min_sparsity) * k_blocks * n_blocks) {
+    return sparse;
+  }
+
+  sparse.k = k;
+  sparse.n = n;
+  // Keep one block, so an all-zero weight is not null.
+  auto* values = sparse.values.Reshape<float>(
+      {std::max<int64_t>(nnz, 1), kSparseBlockK, kSparseBlockN}, kDLCPU, 0);
+  std::fill(values, values + kSparseBlockK * kSparseBlockN, 0.f);
+  for (int64_t nb = 0; nb < n_blocks; ++nb) {
+    for (int32_t i = col_offsets[nb]; i < col_offsets[nb + 1]; ++i) {
+      float* block = values + i * kSparseBlockK * kSparseBlockN;
+      int64_t row = block_rows[i] * kSparseBlockK;
+      for (int64_t r = 0; r < kSparseBlockK; ++r) {
+        for (int64_t c = 0; c < kSparseBlockN; ++c) {
+          block[r * kSparseBlockN + c] =
+              w[(row + r) * row_stride + (nb * kSparseBlockN + c) * col_stride];
+        }
+      }
+    }
+  }
+  auto* rows = sparse.block_rows.Reshape<int32_t>(
+      {std::max<int64_t>(nnz, 1)}, kDLCPU, 0);
+  std::copy(block_rows.begin(), block_rows.end(), rows);
+  auto* offsets = sparse.col_offsets.Reshape<int32_t>({n_blocks + 1}, kDLCPU,
+                                                      0);
+  std::copy(col_offsets.begin(), col_offsets.end(), offsets);
+  return sparse;
+}
+
+void BlockSparseMatMul(const core::Tensor& input,
+                       const BlockSparseWeight& weight, core::Tensor* out) {
+  core::ProfileScope profile_scope("BlockSparseMatMul", input);
+  TT_ENFORCE(!weight.is_null(), "BlockSparseMatMul error: no weight.");
+  TT_ENFORCE(input.device_type() == kDLCPU && out->device_type() == kDLCPU,
+             "BlockSparseMatMul error: sparse weights are only supported on "
+             "the CPU.");
+  TT_ENFORCE_EQ(input.shape(input.n_dim() - 1), weight.k,
+                "matrix shape mismatch");
+  int64_t k = weight.k;
+  int64_t n = weight.n;
+  int64_t m = input.numel() / k;
+  TT_ENFORCE_EQ(out->numel(), m * n,
+                "BlockSparseMatMul error: out must have M * N elements.");
+
+  const float* x = input.data<float>();
+  const float* values = weight.values.data<float>();
+  const int32_t* block_rows = weight.block_rows.data<int32_t>();
+  const int32_t* col_offsets = weight.col_offsets.data<int32_t>();
+  float* y = out->mutableData<float>();
+  int64_t n_blocks = n / kSparseBlockN;
+  int64_t row_blocks = (m + kSparseRowBlock - 1) / kSparseRowBlock;
+#pragma omp parallel for collapse(2)
+  for (int64_t nb = 0; nb < n_blocks; ++nb) {
+    for (int64_t rb = 0; rb < row_blocks; ++rb) {
+      int64_t row_end = std::min(rb * kSparseRowBlock + kSparseRowBlock, m);
+      int64_t i = rb * kSparseRowBlock;
+      for (; i + kRowTile <= row_end; i += kRowTile) {
+        MultiplyColumnBlock<kRowTile>(x + i * k, k, values, block_rows,
+                                      col_offsets[nb], col_offsets[nb + 1],
+                                      y + i * n + nb * kSparseBlockN, n);
+      }
+      for (; i < row_end; ++i) {
+        MultiplyColumnBlock<1>(x + i * k, k, values, block_rows,
+                               col_offsets[nb], col_offsets[nb + 1],
+                               y + i * n + nb * kSparseBlockN, n);
+      }
+    }
+  }
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,62 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cstdint>
+
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/tensor_view.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// A float weight [K, N] of `out = input * weight` on the CPU, whose all-zero
+// blocks of kSparseBlockK x kSparseBlockN are skipped, e.g. the weights of
+// pruned heads or of block movement pruning. The nonzero blocks are stored
+// column block by column block: the blocks of the column block j are
+// values[col_offsets[j], col_offsets[j + 1]), which start at the row
+// block_rows[i] * kSparseBlockK. Every block is row major.
+struct BlockSparseWeight {
+  core::Tensor values{nullptr};       // float, [nnz, kBlockK, kBlockN]
+  core::Tensor block_rows{nullptr};   // int32, [nnz]
+  core::Tensor col_offsets{nullptr};  // int32, [N / kBlockN + 1]
+  int64_t k{0};
+  int64_t n{0};
+
+  bool is_null() const { return values.is_null(); }
+};
+
+constexpr int64_t kSparseBlockK = 16;
+constexpr int64_t kSparseBlockN = 16;
+
+// Below this fraction of zero blocks, the dense GEMM of BLAS is faster.
+constexpr float kMinBlockSparsity = 0.4f;
+
+// Collects the nonzero blocks of `weight` [K, N], which may be strided, e.g.
+// torch.t of a torch.nn.Linear weight. Returns a null weight unless `weight`
+// is a float CPU weight whose dims are multiples of the block and whose
+// fraction of zero blocks is at least `min_sparsity`, so dense weights keep
+// their GEMMs.
+extern BlockSparseWeight SparsifyWeight(const core::TensorView& weight,
+                                        float min_sparsity = kMinBlockSparsity);
+
+// out = input * weight, where `input` [..., K] and `out` are dense float CPU
+// tensors, the latter of M * N elements.
+extern void BlockSparseMatMul(const core::Tensor& input,
+                              const BlockSparseWeight& weight,
+                              core::Tensor* out);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
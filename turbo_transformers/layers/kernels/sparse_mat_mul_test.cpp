@@ -0,0 +1,101 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+#include "turbo_transformers/layers/kernels/sparse_mat_mul.h"
+
+#include <random>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// A random weight [k, n] whose blocks are zero with the probability
+// `sparsity`, the seed is fixed.
+static core::Tensor CreateBlockSparseWeight(int64_t k, int64_t n,
+                                            float sparsity) {
+  static std::mt19937 generator(0);
+  std::uniform_real_distribution<float> distribution(0.f, 1.f);
+  core::Tensor weight = common::CreateTensor<float>({k, n}, kDLCPU, 0);
+  auto* data = weight.mutableData<float>();
+  for (int64_t kb = 0; kb < k / kSparseBlockK; ++kb) {
+    for (int64_t nb = 0; nb < n / kSparseBlockN; ++nb) {
+      bool zero = distribution(generator) < sparsity;
+      for (int64_t i = kb * kSparseBlockK; i < (kb + 1) * kSparseBlockK; ++i) {
+        for (int64_t j = nb * kSparseBlockN; j < (nb + 1) * kSparseBlockN;
+             ++j) {
+          data[i * n + j] = zero ? 0.f : distribution(generator) - 0.5f;
+        }
+      }
+    }
+  }
+  return weight;
+}
+
+TEST_CASE("block-sparse-matmul-cpu") {
+  const int64_t K = 128, N = 96;
+  core::Tensor weight = CreateBlockSparseWeight(K, N, 0.6f);
+  core::Tensor weight_t = common::CreateTensor<float>({N, K}, kDLCPU, 0);
+  for (int64_t k = 0; k < K; ++k) {
+    for (int64_t n = 0; n < N; ++n) {
+      weight_t.mutableData<float>()[n * K + k] =
+          weight.data<float>()[k * N + n];
+    }
+  }
+  // A dense weight and the transposed view of torch.t(weight).
+  core::TensorView weight_view =
+      core::TensorView(weight_t).AsStrided({K, N}, {1, K});
+  for (auto& view : {core::TensorView(weight), weight_view}) {
+    BlockSparseWeight sparse = SparsifyWeight(view, 0.f);
+    REQUIRE(!sparse.is_null());
+    REQUIRE(sparse.k == K);
+    REQUIRE(sparse.n == N);
+    // Fewer rows than a register tile, and a partial row block.
+    for (int64_t M : {1, 3, 70}) {
+      core::Tensor input =
+          common::CreateTensorAndFillRandom<float>({M, K}, kDLCPU, 0);
+      core::Tensor expected = common::CreateTensor<float>({M, N}, kDLCPU, 0);
+      MatMul(input, false, weight, false, 1.0, expected, 0.0);
+      core::Tensor out = common::CreateTensor<float>({M, N}, kDLCPU, 0);
+      BlockSparseMatMul(input, sparse, &out);
+      REQUIRE(common::CheckResultOfCPU<float>(out, expected));
+    }
+  }
+}
+
+TEST_CASE("block-sparse-weight-selection") {
+  // Dense weights keep their GEMMs.
+  REQUIRE(SparsifyWeight(CreateBlockSparseWeight(64, 64, 0.f)).is_null());
+  // The dims must be multiples of the block.
+  core::Tensor odd =
+      common::CreateTensorAndFillConstant<float>({64, 40}, kDLCPU, 0, 0.f);
+  REQUIRE(SparsifyWeight(odd).is_null());
+
+  // An all-zero weight.
+  core::Tensor zero = CreateBlockSparseWeight(64, 32, 1.f);
+  BlockSparseWeight sparse = SparsifyWeight(zero);
+  core::Tensor input = common::CreateTensorAndFillRandom<float>({5, 64},
+                                                                kDLCPU, 0);
+  core::Tensor out = common::CreateTensorAndFillRandom<float>({5, 32},
+                                                              kDLCPU, 0);
+  BlockSparseMatMul(input, sparse, &out);
+  for (int64_t i = 0; i < out.numel(); ++i) {
+    REQUIRE(out.data<float>()[i] == 0.f);
+  }
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
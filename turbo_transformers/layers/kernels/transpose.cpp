@@ -13,10 +13,15 @@
 
 #include "turbo_transformers/layers/kernels/transpose.h"
 
+#include <algorithm>
 #include <cstring>
 
 #include "common.h"
+#include "turbo_transformers/core/config.h"
+#include "turbo_transformers/core/profiler.h"
 #include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/kernels/cpu_vector_kernels.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
 #ifdef TT_WITH_CUDA
 #include "turbo_transformers/core/cuda_device_context.h"
 #include "turbo_transformers/layers/kernels/gpu_transpose_kernel.h"
@@ -29,7 +34,9 @@ namespace kernels {
 static void TransposeForScoreImpl(float* output, const float* input,
                                   int64_t batch_size, int64_t seq_length,
                                   int64_t num_attention_heads, int64_t width) {
-#pragma omp parallel for
+  int n_th = core::ParallelThreadsFor(2 * batch_size * seq_length *
+                                      num_attention_heads * width);
+#pragma omp parallel for num_threads(n_th) if (n_th > 1)
   for (int64_t idx = 0; idx < batch_size * seq_length; ++idx) {
     int64_t batch_idx = idx / seq_length;
     int64_t seq_idx = idx % seq_length;
@@ -40,53 +47,59 @@ static void TransposeForScoreImpl(float* output, const float* input,
       auto* dst = output +
                   batch_idx * (seq_length * num_attention_heads * width) +
                   seq_idx * num_attention_heads * width + head_idx * width;
-#pragma omp simd
-      for (int64_t width_idx = 0; width_idx < width; ++width_idx) {
-        dst[width_idx] = src[width_idx];
-      }
+      std::copy(src, src + width, dst);
     }
   }
 }
 
-void TransposeForScore(core::Tensor* output, const core::Tensor& input) {
-  if (input.device_type() == kDLCPU && output->device_type() == kDLCPU) {
-    TransposeForScoreImpl(output->mutableData<float>(), input.data<float>(),
-                          output->shape(0), output->shape(1), input.shape(1),
+void TransposeForScore(core::TensorView output,
+                       const core::TensorView& input) {
+  core::ProfileScope profile_scope("TransposeForScore", input);
+  if (input.device_type() == kDLCPU && output.device_type() == kDLCPU) {
+    TransposeForScoreImpl(output.mutableData<float>(), input.data<float>(),
+                          output.shape(0), output.shape(1), input.shape(1),
                           input.shape(3));
-  } else if (input.device_type() == kDLGPU && output->device_type() == kDLGPU) {
+  } else if (input.device_type() == kDLGPU && output.device_type() == kDLGPU) {
 #ifdef TT_WITH_CUDA
-    auto batch_size = output->shape(0);
-    auto seq_length = output->shape(1);
+    auto batch_size = output.shape(0);
+    auto seq_length = output.shape(1);
     auto num_attention_heads = input.shape(1);
     auto width = input.shape(3);
-    core::CUDADeviceContext& cuda_ctx = core::CUDADeviceContext::GetInstance();
-    GPUTransposeForScore<float>(
-        input.data<float>(), output->mutableData<float>(), batch_size,
-        seq_length, num_attention_heads, width, cuda_ctx.stream());
+    core::CUDADeviceContext& cuda_ctx =
+        core::CUDADeviceContext::GetInstance(output.device_id());
+    if (input.IsType<core::Half>()) {
+      GPUTransposeForScore<core::Half>(
+          input.data<core::Half>(), output.mutableData<core::Half>(),
+          batch_size, seq_length, num_attention_heads, width,
+          cuda_ctx.stream());
+    } else {
+      GPUTransposeForScore<float>(
+          input.data<float>(), output.mutableData<float>(), batch_size,
+          seq_length, num_attention_heads, width, cuda_ctx.stream());
+    }
 #endif
   } else {
     TT_THROW("device_type is not supported");
   }
 }
 
-void SplitAddBiasTransposeForScore(core::Tensor* output_tensor,
-                                   const core::Tensor& input_tensor,
-                                   const core::Tensor& bias_tensor) {
-  TT_ENFORCE_EQ(output_tensor->n_dim(), 5,
+void SplitAddBiasTransposeForScore(core::TensorView output_tensor,
+                                   const core::TensorView& input_tensor,
+                                   const core::TensorView& bias_tensor) {
+  core::ProfileScope profile_scope("SplitAddBiasTransposeForScore",
+                                   input_tensor);
+  TT_ENFORCE_EQ(output_tensor.n_dim(), 5,
                 "output_tensor should be (weight_num, batch_size, seq_length, "
                 "num_attention_heads, size_per_head)");
-  TT_ENFORCE_EQ(output_tensor->shape(0), 3,
+  TT_ENFORCE_EQ(output_tensor.shape(0), 3,
                 "output_tensor should be (3, batch_size, seq_length, "
                 "num_attention_heads, size_per_head)");
 
-  auto batch_size = output_tensor->shape(1);
-  auto seq_length = output_tensor->shape(3);
-  auto weight_num = output_tensor->shape(0);
-  auto num_attention_heads = output_tensor->shape(2);
-  auto width = output_tensor->shape(4);
-  auto input = input_tensor.data<float>();
-  auto bias = bias_tensor.data<float>();
-  auto output = output_tensor->mutableData<float>();
+  auto batch_size = output_tensor.shape(1);
+  auto seq_length = output_tensor.shape(3);
+  auto weight_num = output_tensor.shape(0);
+  auto num_attention_heads = output_tensor.shape(2);
+  auto width = output_tensor.shape(4);
 
   TT_ENFORCE_EQ(common::is_same_device_ctx(input_tensor.device_ctx(),
                                            bias_tensor.device_ctx()),
@@ -94,15 +107,20 @@ void SplitAddBiasTransposeForScore(core::Tensor* output_tensor,
                 "SplitAddBiasTransposeForScore: input_tensor and bias_tensor "
                 "should have the same device type and device id.");
   TT_ENFORCE_EQ(common::is_same_device_ctx(input_tensor.device_ctx(),
-                                           output_tensor->device_ctx()),
+                                           output_tensor.device_ctx()),
                 true,
                 "SplitAddBiasTransposeForScore: input_tensor and output_tensor "
                 "should have the same device type and device id.");
 
-  if (output_tensor->device_type() == kDLCPU &&
+  if (output_tensor.device_type() == kDLCPU &&
       input_tensor.device_type() == kDLCPU &&
       bias_tensor.device_type() == kDLCPU) {
-#pragma omp parallel for
+    auto input = input_tensor.data<float>();
+    auto bias = bias_tensor.data<float>();
+    auto output = output_tensor.mutableData<float>();
+    auto add = GetCPUVectorKernels().add;
+    int n_th = core::ParallelThreadsFor(2 * input_tensor.numel());
+#pragma omp parallel for num_threads(n_th) if (n_th > 1)
     for (int64_t idx = 0; idx < batch_size * weight_num * seq_length; ++idx) {
       auto batch_idx = idx / (seq_length * weight_num);
       auto seq_idx = idx / weight_num % seq_length;
@@ -122,20 +140,179 @@ void SplitAddBiasTransposeForScore(core::Tensor* output_tensor,
                         head_idx * seq_length * width + seq_idx * width;
         auto* bias_ptr =
             bias + weight_idx * width * num_attention_heads + head_idx * width;
-#pragma omp simd
-        for (int64_t width_idx = 0; width_idx < width; ++width_idx) {
-          dst_ptr[width_idx] = src_ptr[width_idx] + bias_ptr[width_idx];
-        }
+        add(src_ptr, bias_ptr, width, dst_ptr);
       }
     }  // end for
-  } else if (output_tensor->device_type() == kDLGPU &&
+  } else if (output_tensor.device_type() == kDLGPU &&
+             input_tensor.device_type() == kDLGPU &&
+             bias_tensor.device_type() == kDLGPU) {
+#ifdef TT_WITH_CUDA
+    core::CUDADeviceContext& cuda_ctx =
+        core::CUDADeviceContext::GetInstance(output_tensor.device_id());
+    if (input_tensor.IsType<core::Half>()) {
+      GPUSplitAddBiasTransposeForScore<core::Half>(
+          input_tensor.data<core::Half>(), bias_tensor.data<core::Half>(),
+          output_tensor.mutableData<core::Half>(), batch_size, seq_length,
+          weight_num, num_attention_heads, width, cuda_ctx.stream());
+    } else {
+      GPUSplitAddBiasTransposeForScore<float>(
+          input_tensor.data<float>(), bias_tensor.data<float>(),
+          output_tensor.mutableData<float>(), batch_size, seq_length,
+          weight_num, num_attention_heads, width, cuda_ctx.stream());
+    }
+#endif
+  } else {
+    TT_THROW("device_type is not supported");
+  }
+}
+
+// The rows of the product computed at once on the CPU, which bounds the tile
+// scattered into the heads to kQKVRowBlock x (3 * hidden_size) floats. A tile
+// small enough for the cache makes the BLAS GEMMs slower than the pass over
+// the intermediate they save.
+static constexpr int64_t kQKVRowBlock = 1024;
+
+void MatMulSplitAddBiasTransposeForScore(core::TensorView output_tensor,
+                                         const core::TensorView& input_tensor,
+                                         const core::TensorView& weight_tensor,
+                                         const PackedWeight& packed_weight,
+                                         const core::TensorView& bias_tensor) {
+  core::ProfileScope profile_scope("MatMulSplitAddBiasTransposeForScore",
+                                   input_tensor);
+  TT_ENFORCE_EQ(output_tensor.n_dim(), 5,
+                "output_tensor should be (weight_num, batch_size, "
+                "num_attention_heads, seq_length, size_per_head)");
+  TT_ENFORCE(output_tensor.is_contiguous() && input_tensor.is_contiguous() &&
+                 bias_tensor.is_contiguous(),
+             "The input, bias and output of the qkv projection must be "
+             "dense.");
+  auto weight_num = output_tensor.shape(0);
+  auto batch_size = output_tensor.shape(1);
+  auto num_attention_heads = output_tensor.shape(2);
+  auto seq_length = output_tensor.shape(3);
+  auto width = output_tensor.shape(4);
+  auto hidden_size = input_tensor.shape(-1);
+  auto out_size = num_attention_heads * width;
+  TT_ENFORCE_EQ(input_tensor.numel(), batch_size * seq_length * hidden_size,
+                "The input and output of the qkv projection mismatch.");
+  TT_ENFORCE_EQ(weight_tensor.n_dim(), 2, "The weight must be a matrix.");
+  TT_ENFORCE_EQ(weight_tensor.shape(1), weight_num * out_size,
+                "The weight and output of the qkv projection mismatch.");
+  TT_ENFORCE_EQ(bias_tensor.numel(), weight_num * out_size,
+                "The bias and output of the qkv projection mismatch.");
+
+  if (output_tensor.device_type() == kDLCPU &&
+      input_tensor.device_type() == kDLCPU &&
+      bias_tensor.device_type() == kDLCPU) {
+    auto rows = batch_size * seq_length;
+    auto tile_cols = weight_num * out_size;
+    core::Tensor tile(nullptr);
+    tile.Reshape<float>({std::min(rows, kQKVRowBlock), tile_cols}, kDLCPU, 0);
+    auto bias = bias_tensor.data<float>();
+    auto output = output_tensor.mutableData<float>();
+    auto add = GetCPUVectorKernels().add;
+    for (int64_t begin = 0; begin < rows; begin += kQKVRowBlock) {
+      auto n_rows = std::min(kQKVRowBlock, rows - begin);
+      auto rows_view = input_tensor.AsStrided(
+          {n_rows, hidden_size}, {hidden_size, 1}, begin * hidden_size);
+      auto tile_view =
+          core::TensorView(tile).AsStrided({n_rows, tile_cols}, {tile_cols, 1});
+      if (packed_weight.is_null()) {
+        MatMul(rows_view, false, weight_tensor, false, 1.0, tile_view, 0.0);
+      } else {
+        MatMul(rows_view, packed_weight, tile_view, 0.0);
+      }
+      const float* tile_data = tile.data<float>();
+      int n_th = core::ParallelThreadsFor(2 * n_rows * tile_cols);
+#pragma omp parallel for num_threads(n_th) if (n_th > 1)
+      for (int64_t idx = 0; idx < n_rows * weight_num; ++idx) {
+        auto row = begin + idx / weight_num;
+        auto batch_idx = row / seq_length;
+        auto seq_idx = row % seq_length;
+        auto weight_idx = idx % weight_num;
+        for (int64_t head_idx = 0; head_idx < num_attention_heads;
+             ++head_idx) {
+          auto col = weight_idx * out_size + head_idx * width;
+          auto* src_ptr = tile_data + (idx / weight_num) * tile_cols + col;
+          auto* bias_ptr = bias + col;
+          auto* dst_ptr =
+              output +
+              ((weight_idx * batch_size + batch_idx) * num_attention_heads +
+               head_idx) *
+                  seq_length * width +
+              seq_idx * width;
+          add(src_ptr, bias_ptr, width, dst_ptr);
+        }
+      }
+    }
+  } else if (output_tensor.device_type() == kDLGPU &&
              input_tensor.device_type() == kDLGPU &&
              bias_tensor.device_type() == kDLGPU) {
 #ifdef TT_WITH_CUDA
-    core::CUDADeviceContext& cuda_ctx = core::CUDADeviceContext::GetInstance();
-    GPUSplitAddBiasTransposeForScore<float>(
-        input, bias, output, batch_size, seq_length, weight_num,
-        num_attention_heads, width, cuda_ctx.stream());
+    // The bias is broadcast into the heads, then the GEMMs of the heads
+    // accumulate onto it (beta = 1) and write q, k and v in place. The heads
+    // are batched either over the batch or over the heads, whichever needs
+    // fewer GEMMs.
+    core::CUDADeviceContext& cuda_ctx =
+        core::CUDADeviceContext::GetInstance(output_tensor.device_id());
+    if (input_tensor.IsType<core::Half>()) {
+      GPUBroadcastBiasForScore<core::Half>(
+          bias_tensor.data<core::Half>(),
+          output_tensor.mutableData<core::Half>(), batch_size, seq_length,
+          weight_num, num_attention_heads, width, cuda_ctx.stream());
+    } else {
+      GPUBroadcastBiasForScore<float>(
+          bias_tensor.data<float>(), output_tensor.mutableData<float>(),
+          batch_size, seq_length, weight_num, num_attention_heads, width,
+          cuda_ctx.stream());
+    }
+    auto w_row_stride = weight_tensor.stride(0);
+    auto w_col_stride = weight_tensor.stride(1);
+    auto head_size = seq_length * width;
+    for (int64_t weight_idx = 0; weight_idx < weight_num; ++weight_idx) {
+      auto w_offset = weight_idx * out_size * w_col_stride;
+      auto out_offset = weight_idx * batch_size * num_attention_heads *
+                        head_size;
+      if (batch_size <= num_attention_heads) {
+        for (int64_t batch_idx = 0; batch_idx < batch_size; ++batch_idx) {
+          BatchMatMul(
+              input_tensor.AsStrided({num_attention_heads, seq_length,
+                                      hidden_size},
+                                     {0, hidden_size, 1},
+                                     batch_idx * seq_length * hidden_size),
+              false,
+              weight_tensor.AsStrided(
+                  {num_attention_heads, hidden_size, width},
+                  {width * w_col_stride, w_row_stride, w_col_stride},
+                  w_offset),
+              false, 1.0,
+              output_tensor.AsStrided(
+                  {num_attention_heads, seq_length, width},
+                  {head_size, width, 1},
+                  out_offset + batch_idx * num_attention_heads * head_size),
+              1.0);
+        }
+      } else {
+        for (int64_t head_idx = 0; head_idx < num_attention_heads;
+             ++head_idx) {
+          BatchMatMul(
+              input_tensor.AsStrided(
+                  {batch_size, seq_length, hidden_size},
+                  {seq_length * hidden_size, hidden_size, 1}),
+              false,
+              weight_tensor.AsStrided(
+                  {batch_size, hidden_size, width},
+                  {0, w_row_stride, w_col_stride},
+                  w_offset + head_idx * width * w_col_stride),
+              false, 1.0,
+              output_tensor.AsStrided(
+                  {batch_size, seq_length, width},
+                  {num_attention_heads * head_size, width, 1},
+                  out_offset + head_idx * head_size),
+              1.0);
+        }
+      }
+    }
 #endif
   } else {
     TT_THROW("device_type is not supported");
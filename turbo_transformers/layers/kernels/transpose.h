@@ -14,6 +14,8 @@
 #pragma once
 #include <stdint.h>
 #include <turbo_transformers/core/tensor.h>
+#include <turbo_transformers/core/tensor_view.h>
+#include <turbo_transformers/layers/kernels/mat_mul.h>
 
 #include <cmath>
 #include <numeric>
@@ -34,14 +36,28 @@ namespace kernels {
     output_tensor = tf.transpose(output_tensor, [0, 2, 1, 3])
     return output_tensor
  * **/
-extern void TransposeForScore(core::Tensor* output, const core::Tensor& input);
+extern void TransposeForScore(core::TensorView output,
+                              const core::TensorView& input);
 
 // input: (batch_size, seq_length, 3, head_num, *size_per_head)
 // bias: (3, head_num, size_per_head)
 // output: (3, batch_size, num_attention_heads, seq_length, size_per_head)
-extern void SplitAddBiasTransposeForScore(core::Tensor* output,
-                                          const core::Tensor& input_tensor,
-                                          const core::Tensor& bias_tensor);
+extern void SplitAddBiasTransposeForScore(
+    core::TensorView output, const core::TensorView& input_tensor,
+    const core::TensorView& bias_tensor);
+
+// The fused qkv projection of the attention, i.e.
+//   SplitAddBiasTransposeForScore(output, MatMul(input, weight), bias)
+// without the intermediate product of the size of output.
+// input: (batch_size, seq_length, hidden_size)
+// weight: (hidden_size, 3 * head_num * size_per_head), may be strided
+// bias: (3, head_num, size_per_head)
+// output: (3, batch_size, num_attention_heads, seq_length, size_per_head)
+// The CPU multiplies with packed_weight instead of weight unless it is null.
+extern void MatMulSplitAddBiasTransposeForScore(
+    core::TensorView output, const core::TensorView& input_tensor,
+    const core::TensorView& weight_tensor, const PackedWeight& packed_weight,
+    const core::TensorView& bias_tensor);
 
 }  // namespace kernels
 }  // namespace layers
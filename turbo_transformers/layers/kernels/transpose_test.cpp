@@ -13,13 +13,16 @@
 
 #include "turbo_transformers/layers/kernels/transpose.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 
 #include "catch2/catch.hpp"
 #include "loguru.hpp"
 #include "turbo_transformers/core/blas.h"
 #include "turbo_transformers/core/enforce.h"
 #include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
 
 namespace turbo_transformers {
 namespace layers {
@@ -31,7 +34,7 @@ TEST_CASE("splitaddtranspose-gpu-test") {
   const std::vector<int64_t> batch_size_list{1, 12, 20};
   const std::vector<int64_t> seq_length_list{10, 20, 32, 64, 128};
 
-  for (auto hidden_size : {64, 2000})
+  for (auto hidden_size : {64, 128, 2000})
     for (auto num_attention_heads : num_attention_heads_list)
       for (auto batch_size : batch_size_list)
         for (auto seq_length : seq_length_list) {
@@ -55,9 +58,9 @@ TEST_CASE("splitaddtranspose-gpu-test") {
                   {3, batch_size, num_attention_heads, seq_length, hidden_size},
                   kDLCPU, 0));
 
-          SplitAddBiasTransposeForScore(&output_tensor_gpu, input_tensor_gpu,
+          SplitAddBiasTransposeForScore(output_tensor_gpu, input_tensor_gpu,
                                         bias_tensor_gpu);
-          SplitAddBiasTransposeForScore(&output_tensor_cpu, input_tensor_cpu,
+          SplitAddBiasTransposeForScore(output_tensor_cpu, input_tensor_cpu,
                                         bias_tensor_cpu);
           REQUIRE(common::CheckResultOfCPUAndGPU<float>(output_tensor_cpu,
                                                         output_tensor_gpu));
@@ -72,26 +75,126 @@ TEST_CASE("transpose-gpu-test") {
   };
   const std::vector<int64_t> seq_length_list{10, 32, 128};
 
-  for (auto num_attention_heads : num_attention_heads_list)
-    for (auto batch_size : batch_size_list)
-      for (auto seq_length : seq_length_list) {
-        core::Tensor input_tensor_cpu(nullptr), input_tensor_gpu(nullptr);
-        std::tie(input_tensor_cpu, input_tensor_gpu) =
-            common::CreateAndFillRandomForCPUGPUTensors<float>(
-                {batch_size, num_attention_heads, seq_length, 64});
-
-        turbo_transformers::core::Tensor output_tensor_gpu(
-            turbo_transformers::core::NewDLPackTensorT<float>(
-                {batch_size, seq_length, num_attention_heads, 64}, kDLGPU, 0));
-        turbo_transformers::core::Tensor output_tensor_cpu(
-            turbo_transformers::core::NewDLPackTensorT<float>(
-                {batch_size, seq_length, num_attention_heads, 64}, kDLCPU, 0));
-
-        TransposeForScore(&output_tensor_gpu, input_tensor_gpu);
-        TransposeForScore(&output_tensor_cpu, input_tensor_cpu);
-        REQUIRE(common::CheckResultOfCPUAndGPU<float>(output_tensor_cpu,
-                                                      output_tensor_gpu));
-      }
+  // The head sizes with kernels of their own and another one.
+  for (int64_t size_per_head : {64, 128, 96})
+    for (auto num_attention_heads : num_attention_heads_list)
+      for (auto batch_size : batch_size_list)
+        for (auto seq_length : seq_length_list) {
+          core::Tensor input_tensor_cpu(nullptr), input_tensor_gpu(nullptr);
+          std::tie(input_tensor_cpu, input_tensor_gpu) =
+              common::CreateAndFillRandomForCPUGPUTensors<float>(
+                  {batch_size, num_attention_heads, seq_length,
+                   size_per_head});
+
+          turbo_transformers::core::Tensor output_tensor_gpu(
+              turbo_transformers::core::NewDLPackTensorT<float>(
+                  {batch_size, seq_length, num_attention_heads,
+                   size_per_head},
+                  kDLGPU, 0));
+          turbo_transformers::core::Tensor output_tensor_cpu(
+              turbo_transformers::core::NewDLPackTensorT<float>(
+                  {batch_size, seq_length, num_attention_heads,
+                   size_per_head},
+                  kDLCPU, 0));
+
+          TransposeForScore(output_tensor_gpu, input_tensor_gpu);
+          TransposeForScore(output_tensor_cpu, input_tensor_cpu);
+          REQUIRE(common::CheckResultOfCPUAndGPU<float>(output_tensor_cpu,
+                                                        output_tensor_gpu));
+        }
+}
+#endif
+
+TEST_CASE("matmul-split-add-bias-transpose-cpu-test") {
+  // 1200 rows, so the projection runs in two row blocks, the last partial.
+  const int64_t batch_size = 3, seq_length = 400, num_attention_heads = 4,
+                size_per_head = 16, hidden_size = 64;
+  auto input = common::CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+  // The weight is used transposed, like torch.t of a torch.nn.Linear weight.
+  auto weight_t = common::CreateTensorAndFillRandom<float>(
+      {3 * hidden_size, hidden_size}, kDLCPU, 0);
+  auto bias = common::CreateTensorAndFillRandom<float>(
+      {3, num_attention_heads, size_per_head}, kDLCPU, 0);
+
+  auto product = common::CreateTensor<float>(
+      {batch_size, seq_length, 3, num_attention_heads, size_per_head}, kDLCPU,
+      0);
+  MatMul(input, false, weight_t, true, 1.0, product, 0.0);
+  auto expected = common::CreateTensor<float>(
+      {3, batch_size, num_attention_heads, seq_length, size_per_head}, kDLCPU,
+      0);
+  SplitAddBiasTransposeForScore(expected, product, bias);
+
+  auto output = common::CreateTensor<float>(
+      {3, batch_size, num_attention_heads, seq_length, size_per_head}, kDLCPU,
+      0);
+  auto weight = core::TensorView(weight_t).AsStrided(
+      {hidden_size, 3 * hidden_size}, {1, hidden_size});
+  MatMulSplitAddBiasTransposeForScore(output, input, weight, PackedWeight(),
+                                      bias);
+  REQUIRE(common::CheckResultOfCPU<float>(output, expected));
+
+  // The same with the packed weight, where the BLAS supports packing.
+  auto packed_weight = PackWeight(weight);
+  if (!packed_weight.is_null()) {
+    auto packed_output = common::CreateTensor<float>(
+        {3, batch_size, num_attention_heads, seq_length, size_per_head},
+        kDLCPU, 0);
+    MatMulSplitAddBiasTransposeForScore(packed_output, input, weight,
+                                        packed_weight, bias);
+    REQUIRE(common::CheckResultOfCPU<float>(packed_output, expected));
+  }
+}
+
+#ifdef TT_WITH_CUDA
+// The float GEMMs may run on the tensor cores in TF32, so the GPU results are
+// compared up to a relative error.
+static bool IsCloseToGPU(const core::Tensor& cpu_tensor,
+                         const core::Tensor& gpu_tensor) {
+  auto gpu_copy = common::CreateTensor<float>({gpu_tensor.numel()}, kDLCPU, 0);
+  core::Copy<float>(gpu_tensor, gpu_copy);
+  const float* cpu_data = cpu_tensor.data<float>();
+  const float* gpu_data = gpu_copy.data<float>();
+  for (int64_t i = 0; i < cpu_tensor.numel(); ++i) {
+    if (std::abs(cpu_data[i] - gpu_data[i]) >
+        1e-2f * std::max(1.0f, std::abs(cpu_data[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+TEST_CASE("matmul-split-add-bias-transpose-gpu-test") {
+  const int64_t num_attention_heads = 12, size_per_head = 64;
+  const int64_t hidden_size = num_attention_heads * size_per_head;
+  // Fewer and more sequences than heads, which batch the GEMMs differently.
+  for (int64_t batch_size : {2, 20}) {
+    const int64_t seq_length = 40;
+    core::Tensor input_cpu(nullptr), input_gpu(nullptr), weight_cpu(nullptr),
+        weight_gpu(nullptr), bias_cpu(nullptr), bias_gpu(nullptr);
+    std::tie(input_cpu, input_gpu) =
+        common::CreateAndFillRandomForCPUGPUTensors<float>(
+            {batch_size, seq_length, hidden_size});
+    std::tie(weight_cpu, weight_gpu) =
+        common::CreateAndFillRandomForCPUGPUTensors<float>(
+            {hidden_size, 3 * hidden_size});
+    std::tie(bias_cpu, bias_gpu) =
+        common::CreateAndFillRandomForCPUGPUTensors<float>(
+            {3, num_attention_heads, size_per_head});
+
+    auto output_cpu = common::CreateTensor<float>(
+        {3, batch_size, num_attention_heads, seq_length, size_per_head},
+        kDLCPU, 0);
+    auto output_gpu = common::CreateTensor<float>(
+        {3, batch_size, num_attention_heads, seq_length, size_per_head},
+        kDLGPU, 0);
+    MatMulSplitAddBiasTransposeForScore(output_cpu, input_cpu, weight_cpu,
+                                        PackedWeight(), bias_cpu);
+    MatMulSplitAddBiasTransposeForScore(output_gpu, input_gpu, weight_gpu,
+                                        PackedWeight(), bias_gpu);
+    REQUIRE(IsCloseToGPU(output_cpu, output_gpu));
+  }
 }
 #endif
 
@@ -0,0 +1,330 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/weight_only_mat_mul.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "turbo_transformers/core/cpu_isa.h"
+#include "turbo_transformers/core/half.h"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/profiler.h"
+#include "turbo_transformers/layers/kernels/activation.h"
+#include "turbo_transformers/layers/kernels/layer_norm.h"
+#include "turbo_transformers/layers/kernels/panel_gemm.h"
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define TT_WITH_WEIGHT_ONLY_KERNELS
+#endif
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+namespace {
+// The rows of the activations computed at once by the kernels.
+constexpr int64_t kRowBlock = 4;
+// The columns computed at once by the kernels.
+constexpr int64_t kColBlock = kWeightOnlyNAlignment;
+constexpr int64_t kPanelsPerBlock = kColBlock / kWeightOnlyPanelWidth;
+// The depth of the weight blocks, whose 4 panels, at most 4 x 128 x 32
+// bytes, stay in the L1 cache while the blocks of rows are multiplied.
+constexpr int64_t kDepthBlock = 128;
+
+// Returns the number of rows M of `input`.
+int64_t CheckShapes(const core::Tensor& input, const WeightOnlyWeight& weight,
+                    const core::Tensor& out) {
+  TT_ENFORCE(!weight.is_null(), "WeightOnlyMatMul error: no weight.");
+  int64_t m = panel_gemm::CheckShapes("WeightOnlyMatMul", input, weight.k,
+                                      weight.n, out);
+  TT_ENFORCE(IsWeightOnlyMatMulSupported(m),
+             "WeightOnlyMatMul error: %d rows are not supported on this CPU, "
+             "they are multiplied by the float weight.",
+             m);
+  return m;
+}
+
+#ifdef TT_WITH_WEIGHT_ONLY_KERNELS
+// The 16 weights of a panel row as floats.
+__attribute__((target("avx512f"))) inline __m512 LoadPanelRowAVX512(
+    const core::Half* w) {
+  return _mm512_cvtph_ps(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w)));
+}
+
+__attribute__((target("avx512f"))) inline __m512 LoadPanelRowAVX512(
+    const int8_t* w) {
+  return _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(w))));
+}
+
+// acc[r * kColBlock + c] += sum_j x[r][j] * w[j][c] for j in [0, k_len),
+// the Rows <= kRowBlock rows `x` and the kPanelsPerBlock panels starting at
+// `w`, `panel_size` elements apart.
+template <typename W, int Rows>
+__attribute__((target("avx512f"))) void DotAVX512(const float* const* x,
+                                                  const W* w,
+                                                  int64_t panel_size,
+                                                  int64_t k_len, float* acc) {
+  static_assert(Rows <= kRowBlock && kPanelsPerBlock == 4,
+                "The kernel computes up to 4 x 64 outputs");
+  __m512 sums[Rows * 4];
+  for (int r = 0; r < Rows; ++r) {
+    for (int c = 0; c < 4; ++c) {
+      sums[r * 4 + c] = _mm512_loadu_ps(acc + r * kColBlock + c * 16);
+    }
+  }
+  for (int64_t j = 0; j < k_len; ++j) {
+    __m512 wv[4];
+    for (int c = 0; c < 4; ++c) {
+      wv[c] = LoadPanelRowAVX512(w + c * panel_size + j * 16);
+    }
+    for (int r = 0; r < Rows; ++r) {
+      __m512 xv = _mm512_set1_ps(x[r][j]);
+      for (int c = 0; c < 4; ++c) {
+        sums[r * 4 + c] = _mm512_fmadd_ps(xv, wv[c], sums[r * 4 + c]);
+      }
+    }
+  }
+  for (int r = 0; r < Rows; ++r) {
+    for (int c = 0; c < 4; ++c) {
+      _mm512_storeu_ps(acc + r * kColBlock + c * 16, sums[r * 4 + c]);
+    }
+  }
+}
+
+__attribute__((target("avx2,fma,f16c"))) inline void LoadPanelRowAVX2(
+    const core::Half* w, __m256* lo, __m256* hi) {
+  __m256i halves = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w));
+  *lo = _mm256_cvtph_ps(_mm256_castsi256_si128(halves));
+  *hi = _mm256_cvtph_ps(_mm256_extracti128_si256(halves, 1));
+}
+
+__attribute__((target("avx2,fma,f16c"))) inline void LoadPanelRowAVX2(
+    const int8_t* w, __m256* lo, __m256* hi) {
+  __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w));
+  *lo = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(bytes));
+  *hi = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(bytes, 8)));
+}
+
+// The same as DotAVX512. The 16 registers of AVX2 hold the 4 rows of a
+// single panel, so the panels are multiplied one after another.
+template <typename W, int Rows>
+__attribute__((target("avx2,fma,f16c"))) void DotAVX2(const float* const* x,
+                                                      const W* w,
+                                                      int64_t panel_size,
+                                                      int64_t k_len,
+                                                      float* acc) {
+  static_assert(Rows <= kRowBlock, "The kernel computes up to 4 rows");
+  for (int64_t c = 0; c < kPanelsPerBlock; ++c) {
+    const W* panel = w + c * panel_size;
+    float* panel_acc = acc + c * kWeightOnlyPanelWidth;
+    __m256 sums[Rows * 2];
+    for (int r = 0; r < Rows; ++r) {
+      sums[r * 2] = _mm256_loadu_ps(panel_acc + r * kColBlock);
+      sums[r * 2 + 1] = _mm256_loadu_ps(panel_acc + r * kColBlock + 8);
+    }
+    for (int64_t j = 0; j < k_len; ++j) {
+      __m256 lo, hi;
+      LoadPanelRowAVX2(panel + j * 16, &lo, &hi);
+      for (int r = 0; r < Rows; ++r) {
+        __m256 xv = _mm256_set1_ps(x[r][j]);
+        sums[r * 2] = _mm256_fmadd_ps(xv, lo, sums[r * 2]);
+        sums[r * 2 + 1] = _mm256_fmadd_ps(xv, hi, sums[r * 2 + 1]);
+      }
+    }
+    for (int r = 0; r < Rows; ++r) {
+      _mm256_storeu_ps(panel_acc + r * kColBlock, sums[r * 2]);
+      _mm256_storeu_ps(panel_acc + r * kColBlock + 8, sums[r * 2 + 1]);
+    }
+  }
+}
+
+template <typename W>
+using DotKernel = void (*)(const float* const*, const W*, int64_t, int64_t,
+                           float*);
+
+template <typename W>
+void KernelGemm(const float* x, const WeightOnlyWeight& weight, int64_t m,
+                core::CPUIsa isa, float* y) {
+  int64_t k = weight.k;
+  int64_t n = weight.n;
+  int64_t panel_size = k * kWeightOnlyPanelWidth;
+  const W* w = weight.data.data<W>();
+  const float* scales =
+      weight.scales.is_null() ? nullptr : weight.scales.data<float>();
+  int64_t col_blocks = weight.data.shape(0) / kPanelsPerBlock;
+  // The kernels by the number of rows, fewer than kRowBlock are left over by
+  // the last block.
+  static const DotKernel<W> avx512_kernels[kRowBlock] = {
+      DotAVX512<W, 1>, DotAVX512<W, 2>, DotAVX512<W, 3>, DotAVX512<W, 4>};
+  static const DotKernel<W> avx2_kernels[kRowBlock] = {
+      DotAVX2<W, 1>, DotAVX2<W, 2>, DotAVX2<W, 3>, DotAVX2<W, 4>};
+  const DotKernel<W>* kernels =
+      isa == core::CPUIsa::kAVX512 ? avx512_kernels : avx2_kernels;
+#pragma omp parallel for
+  for (int64_t b = 0; b < col_blocks; ++b) {
+    float acc[kWeightOnlyMaxKernelRows * kColBlock] = {};
+    const W* panels = w + b * kPanelsPerBlock * panel_size;
+    for (int64_t depth = 0; depth < k; depth += kDepthBlock) {
+      int64_t k_len = std::min(kDepthBlock, k - depth);
+      for (int64_t r0 = 0; r0 < m; r0 += kRowBlock) {
+        int64_t rows = std::min(kRowBlock, m - r0);
+        const float* row_ptrs[kRowBlock];
+        for (int64_t r = 0; r < rows; ++r) {
+          row_ptrs[r] = x + (r0 + r) * k + depth;
+        }
+        kernels[rows - 1](row_ptrs, panels + depth * kWeightOnlyPanelWidth,
+                          panel_size, k_len, acc + r0 * kColBlock);
+      }
+    }
+    int64_t col = b * kColBlock;
+    panel_gemm::StoreBlock(acc, kColBlock, 0, m, col,
+                           std::min(kColBlock, n - col), n, scales, y);
+  }
+}
+#endif
+
+void WeightOnlyGemm(const core::Tensor& input, const WeightOnlyWeight& weight,
+                    int64_t m, core::Tensor* out) {
+  core::AddToCounter(core::Counter::kGemmFlops, 2 * m * weight.n * weight.k);
+  if (m == 0) {
+    return;
+  }
+#ifdef TT_WITH_WEIGHT_ONLY_KERNELS
+  const auto* x = input.data<float>();
+  auto* y = out->mutableData<float>();
+  auto isa = core::GetCPUIsa();
+  if (weight.type == WeightOnlyType::kFP16) {
+    KernelGemm<core::Half>(x, weight, m, isa, y);
+  } else {
+    KernelGemm<int8_t>(x, weight, m, isa, y);
+  }
+#endif
+}
+}  // namespace
+
+bool IsWeightOnlyMatMulSupported(int64_t m) {
+#ifdef TT_WITH_WEIGHT_ONLY_KERNELS
+  auto isa = core::GetCPUIsa();
+  return m <= kWeightOnlyMaxKernelRows &&
+         (isa == core::CPUIsa::kAVX512 || isa == core::CPUIsa::kAVX2);
+#else
+  return false;
+#endif
+}
+
+WeightOnlyWeight CompressWeight(const core::TensorView& weight,
+                                WeightOnlyType type) {
+  TT_ENFORCE_EQ(weight.n_dim(), 2, "The weight must be a matrix.");
+  TT_ENFORCE(weight.device_type() == kDLCPU && weight.IsType<float>(),
+             "Only float CPU weights can be compressed.");
+  WeightOnlyWeight result;
+  result.type = type;
+  result.k = weight.shape(0);
+  result.n = weight.shape(1);
+  int64_t k = result.k;
+  int64_t n_pad = panel_gemm::AlignUp(result.n, kWeightOnlyNAlignment);
+  int64_t panels = n_pad / kWeightOnlyPanelWidth;
+  const float* w = weight.data<float>();
+  int64_t k_stride = weight.stride(0);
+  int64_t n_stride = weight.stride(1);
+  auto value = [&](int64_t j, int64_t col) {
+    return col < result.n ? w[j * k_stride + col * n_stride] : 0.f;
+  };
+
+  if (type == WeightOnlyType::kFP16) {
+    auto* data = result.data.Reshape<core::Half>(
+        {panels, k, kWeightOnlyPanelWidth}, kDLCPU, 0);
+#pragma omp parallel for
+    for (int64_t p = 0; p < panels; ++p) {
+      core::Half* panel = data + p * k * kWeightOnlyPanelWidth;
+      for (int64_t j = 0; j < k; ++j) {
+        for (int64_t c = 0; c < kWeightOnlyPanelWidth; ++c) {
+          panel[j * kWeightOnlyPanelWidth + c] =
+              core::Half(value(j, p * kWeightOnlyPanelWidth + c));
+        }
+      }
+    }
+    return result;
+  }
+
+  auto* data = result.data.Reshape<int8_t>({panels, k, kWeightOnlyPanelWidth},
+                                           kDLCPU, 0);
+  auto* scales = result.scales.Reshape<float>({n_pad}, kDLCPU, 0);
+#pragma omp parallel for
+  for (int64_t col = 0; col < n_pad; ++col) {
+    float max_abs = 0.f;
+    for (int64_t j = 0; j < k; ++j) {
+      max_abs = std::max(max_abs, std::abs(value(j, col)));
+    }
+    float scale = max_abs > 0.f ? max_abs / 127.f : 1.f;
+    scales[col] = scale;
+    int8_t* dst = data + (col / kWeightOnlyPanelWidth) * k *
+                             kWeightOnlyPanelWidth +
+                  col % kWeightOnlyPanelWidth;
+    for (int64_t j = 0; j < k; ++j) {
+      dst[j * kWeightOnlyPanelWidth] =
+          static_cast<int8_t>(std::lround(value(j, col) / scale));
+    }
+  }
+  return result;
+}
+
+void WeightOnlyMatMul(const core::Tensor& input,
+                      const WeightOnlyWeight& weight, core::Tensor* out) {
+  core::ProfileScope profile_scope("WeightOnlyMatMul", input);
+  int64_t m = CheckShapes(input, weight, *out);
+  WeightOnlyGemm(input, weight, m, out);
+}
+
+template <types::ActivationType ActType>
+void WeightOnlyMatMulBiasAct(const core::Tensor& input,
+                             const WeightOnlyWeight& weight,
+                             const core::Tensor& bias, core::Tensor* out) {
+  core::ProfileScope profile_scope("WeightOnlyMatMulBiasAct", input);
+  int64_t m = CheckShapes(input, weight, *out);
+  TT_ENFORCE_EQ(bias.numel(), weight.n, "The bias and weight mismatch.");
+  WeightOnlyGemm(input, weight, m, out);
+  AddBiasAct<float, ActType>(bias, out);
+}
+
+template void WeightOnlyMatMulBiasAct<types::ActivationType::Gelu>(
+    const core::Tensor& input, const WeightOnlyWeight& weight,
+    const core::Tensor& bias, core::Tensor* out);
+template void WeightOnlyMatMulBiasAct<types::ActivationType::Tanh>(
+    const core::Tensor& input, const WeightOnlyWeight& weight,
+    const core::Tensor& bias, core::Tensor* out);
+template void WeightOnlyMatMulBiasAct<types::ActivationType::Identity>(
+    const core::Tensor& input, const WeightOnlyWeight& weight,
+    const core::Tensor& bias, core::Tensor* out);
+
+void WeightOnlyMatMulAddBiasLayerNorm(const core::Tensor& input,
+                                      const WeightOnlyWeight& weight,
+                                      const core::Tensor& residual,
+                                      const core::Tensor& bias,
+                                      const core::Tensor& gamma,
+                                      const core::Tensor& beta,
+                                      core::Tensor* out) {
+  core::ProfileScope profile_scope("WeightOnlyMatMulAddBiasLayerNorm", input);
+  int64_t m = CheckShapes(input, weight, *out);
+  TT_ENFORCE_EQ(residual.numel(), out->numel(),
+                "The residual and out mismatch.");
+  TT_ENFORCE_EQ(bias.numel(), weight.n, "The bias and weight mismatch.");
+  WeightOnlyGemm(input, weight, m, out);
+  AddBiasLayerNorm<float>(residual, bias, gamma, beta, out);
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,87 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cstdint>
+
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/tensor_view.h"
+#include "turbo_transformers/layers/types.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// The storage of a weight-only compressed GEMM. kFP16 rounds the weight to
+// core::Half, kInt8 quantizes it symmetrically per output channel. Unlike
+// kernels/quantization.h, the activations stay in float.
+enum class WeightOnlyType { kFP16 = 0, kInt8 };
+
+// The compressed weight of `out = input * weight` on the CPU, which halves
+// or quarters the bytes a GEMM of few rows streams from memory. The columns
+// are split into panels of kWeightOnlyPanelWidth, whose rows are stored one
+// after another, i.e. weight[k][n] ~= data[n / 16][k][n % 16] * scales[n],
+// and N is padded with zeros to a multiple of kWeightOnlyNAlignment.
+struct WeightOnlyWeight {
+  core::Tensor data{nullptr};    // core::Half or int8, [N_pad / 16, K, 16]
+  core::Tensor scales{nullptr};  // float, [N_pad], kInt8 only
+  WeightOnlyType type{WeightOnlyType::kFP16};
+  int64_t k{0};
+  int64_t n{0};
+
+  bool is_null() const { return data.is_null(); }
+};
+
+constexpr int64_t kWeightOnlyPanelWidth = 16;
+constexpr int64_t kWeightOnlyNAlignment = 64;
+// The most rows multiplied by the kernels converting the panels in registers.
+constexpr int64_t kWeightOnlyMaxKernelRows = 8;
+
+// Compresses the float CPU `weight` [K, N], which may be strided.
+extern WeightOnlyWeight CompressWeight(const core::TensorView& weight,
+                                       WeightOnlyType type);
+
+// Whether WeightOnlyMatMul multiplies M = `m` rows on this CPU, i.e. up to
+// kWeightOnlyMaxKernelRows rows on the CPUs with AVX-512 or AVX2. More rows
+// are bound by the compute rather than the weights, so the layers keep their
+// float weights and multiply them by the float GEMMs instead.
+extern bool IsWeightOnlyMatMulSupported(int64_t m);
+
+// out = input * weight for the float `input` [..., K] and the dense float
+// `out` of M * N elements, if IsWeightOnlyMatMulSupported(M). The panels are
+// converted to float in registers by AVX-512 or AVX2 kernels, a block of
+// them reused from the L1 cache by the rows, and multiplied in float.
+extern void WeightOnlyMatMul(const core::Tensor& input,
+                             const WeightOnlyWeight& weight,
+                             core::Tensor* out);
+
+// out = Act(input * weight + bias).
+template <types::ActivationType ActType>
+extern void WeightOnlyMatMulBiasAct(const core::Tensor& input,
+                                    const WeightOnlyWeight& weight,
+                                    const core::Tensor& bias,
+                                    core::Tensor* out);
+
+// out = LayerNorm(input * weight + bias + residual) with the layer norm
+// parameters `gamma` and `beta`.
+extern void WeightOnlyMatMulAddBiasLayerNorm(const core::Tensor& input,
+                                             const WeightOnlyWeight& weight,
+                                             const core::Tensor& residual,
+                                             const core::Tensor& bias,
+                                             const core::Tensor& gamma,
+                                             const core::Tensor& beta,
+                                             core::Tensor* out);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
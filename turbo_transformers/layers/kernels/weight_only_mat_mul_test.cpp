@@ -0,0 +1,135 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/weight_only_mat_mul.h"
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/core/cpu_isa.h"
+#include "turbo_transformers/layers/kernels/activation.h"
+#include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/kernels/layer_norm.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// The 7 bits of the int8 weights are compared up to 2% of the largest
+// reference value, as are the 11 of core::Half.
+static constexpr float kTolerance = 0.02f;
+
+// The kernels of every ISA this CPU supports.
+static std::vector<core::CPUIsa> WeightOnlyTestIsas() {
+  std::vector<core::CPUIsa> isas;
+  for (auto isa : {core::CPUIsa::kAVX2, core::CPUIsa::kAVX512}) {
+    if (core::IsCPUIsaSupported(isa)) {
+      isas.push_back(isa);
+    }
+  }
+  return isas;
+}
+
+TEST_CASE("weight-only-matmul-cpu") {
+  auto selected = core::GetCPUIsa();
+  for (auto isa : WeightOnlyTestIsas()) {
+    core::SetCPUIsa(isa);
+    for (auto type : {WeightOnlyType::kFP16, WeightOnlyType::kInt8}) {
+      // N is not a multiple of the padding, K not one of the depth blocks,
+      // and 7 rows leave a partial block of rows.
+      for (int64_t m : {int64_t(1), int64_t(7), kWeightOnlyMaxKernelRows}) {
+        for (int64_t k : {32, 200}) {
+          for (int64_t n : {4, 30, 130}) {
+            core::Tensor input = common::CreateTensorAndFillUniform({m, k});
+            core::Tensor weight = common::CreateTensorAndFillUniform({k, n});
+            auto compressed = CompressWeight(weight, type);
+
+            core::Tensor expected =
+                common::CreateTensor<float>({m, n}, kDLCPU, 0);
+            MatMul(input, false, weight, false, 1.0, expected, 0.0);
+            core::Tensor out = common::CreateTensor<float>({m, n}, kDLCPU, 0);
+            WeightOnlyMatMul(input, compressed, &out);
+            REQUIRE(common::CheckResultOfCPUWithin(out, expected, kTolerance));
+          }
+        }
+      }
+    }
+  }
+  core::SetCPUIsa(selected);
+}
+
+TEST_CASE("weight-only-matmul-unsupported-cpu") {
+  // More rows, and any rows without AVX2, are left to the float weights.
+  auto selected = core::GetCPUIsa();
+  core::SetCPUIsa(core::CPUIsa::kScalar);
+  REQUIRE(!IsWeightOnlyMatMulSupported(1));
+  core::SetCPUIsa(selected);
+
+  const int64_t m = kWeightOnlyMaxKernelRows + 1, k = 32, n = 16;
+  REQUIRE(!IsWeightOnlyMatMulSupported(m));
+  core::Tensor input = common::CreateTensorAndFillUniform({m, k});
+  auto compressed = CompressWeight(common::CreateTensorAndFillUniform({k, n}),
+                                   WeightOnlyType::kFP16);
+  core::Tensor out = common::CreateTensor<float>({m, n}, kDLCPU, 0);
+  REQUIRE_THROWS(WeightOnlyMatMul(input, compressed, &out));
+}
+
+TEST_CASE("weight-only-matmul-bias-act-cpu") {
+  const int64_t batch = 2, seq = 3, k = 128, n = 48;
+  if (!IsWeightOnlyMatMulSupported(batch * seq)) {
+    return;
+  }
+  core::Tensor input = common::CreateTensorAndFillUniform({batch, seq, k});
+  core::Tensor weight = common::CreateTensorAndFillUniform({k, n});
+  core::Tensor bias = common::CreateTensorAndFillUniform({n});
+  auto compressed = CompressWeight(weight, WeightOnlyType::kInt8);
+
+  core::Tensor expected =
+      common::CreateTensor<float>({batch, seq, n}, kDLCPU, 0);
+  MatMul(input, false, weight, false, 1.0, expected, 0.0);
+  AddBiasAct<float, types::ActivationType::Gelu>(bias, &expected);
+
+  core::Tensor out = common::CreateTensor<float>({batch, seq, n}, kDLCPU, 0);
+  WeightOnlyMatMulBiasAct<types::ActivationType::Gelu>(input, compressed, bias,
+                                                       &out);
+  REQUIRE(common::CheckResultOfCPUWithin(out, expected, kTolerance));
+
+  core::Tensor wrong_out = common::CreateTensor<float>({batch, n}, kDLCPU, 0);
+  REQUIRE_THROWS(WeightOnlyMatMul(input, compressed, &wrong_out));
+}
+
+TEST_CASE("weight-only-matmul-add-bias-layer-norm-cpu") {
+  const int64_t m = 2, k = 96, n = 40;
+  if (!IsWeightOnlyMatMulSupported(m)) {
+    return;
+  }
+  core::Tensor input = common::CreateTensorAndFillUniform({m, k});
+  core::Tensor weight = common::CreateTensorAndFillUniform({k, n});
+  core::Tensor residual = common::CreateTensorAndFillUniform({m, n});
+  core::Tensor bias = common::CreateTensorAndFillUniform({n});
+  core::Tensor gamma = common::CreateTensorAndFillUniform({n});
+  core::Tensor beta = common::CreateTensorAndFillUniform({n});
+  auto compressed = CompressWeight(weight, WeightOnlyType::kFP16);
+
+  core::Tensor expected = common::CreateTensor<float>({m, n}, kDLCPU, 0);
+  MatMul(input, false, weight, false, 1.0, expected, 0.0);
+  AddBiasLayerNorm<float>(residual, bias, gamma, beta, &expected);
+
+  core::Tensor out = common::CreateTensor<float>({m, n}, kDLCPU, 0);
+  WeightOnlyMatMulAddBiasLayerNorm(input, compressed, residual, bias, gamma,
+                                   beta, &out);
+  REQUIRE(common::CheckResultOfCPUWithin(out, expected, kTolerance));
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
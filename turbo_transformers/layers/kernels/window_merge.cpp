@@ -0,0 +1,109 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/window_merge.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "turbo_transformers/core/config.h"
+#ifdef TT_WITH_CUDA
+#include "turbo_transformers/core/cuda_device_context.h"
+#include "turbo_transformers/layers/kernels/gpu_window_merge_kernel.h"
+#endif
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+namespace {
+void CPUMergeWindows(const float* input, int64_t doc_len, int64_t hidden_size,
+                     int64_t window_tokens, int64_t stride, int64_t prefix,
+                     int64_t window_rows, int64_t num_windows, bool mean,
+                     float* output) {
+  int n_th = core::ParallelThreadsFor(doc_len * hidden_size);
+#pragma omp parallel for num_threads(n_th) if (n_th > 1)
+  for (int64_t t = 0; t < doc_len; ++t) {
+    // The windows w * stride <= t < w * stride + window_tokens.
+    int64_t first = t < window_tokens ? 0 : (t - window_tokens) / stride + 1;
+    int64_t last = std::min(num_windows - 1, t / stride);
+    float* out = output + t * hidden_size;
+    std::fill(out, out + hidden_size,
+              mean ? 0.f : -std::numeric_limits<float>::infinity());
+    for (int64_t w = first; w <= last; ++w) {
+      const float* row =
+          input + (w * window_rows + prefix + t - w * stride) * hidden_size;
+      for (int64_t h = 0; h < hidden_size; ++h) {
+        out[h] = mean ? out[h] + row[h] : std::max(out[h], row[h]);
+      }
+    }
+    if (mean) {
+      float scale = 1.f / (last - first + 1);
+      for (int64_t h = 0; h < hidden_size; ++h) {
+        out[h] *= scale;
+      }
+    }
+  }
+}
+}  // namespace
+
+int64_t NumWindows(int64_t doc_len, int64_t window_tokens, int64_t stride) {
+  TT_ENFORCE(window_tokens > 0 && stride > 0 && stride <= window_tokens,
+             "The windows of %d tokens %d apart leave tokens out",
+             window_tokens, stride);
+  if (doc_len <= window_tokens) {
+    return 1;
+  }
+  return (doc_len - window_tokens + stride - 1) / stride + 1;
+}
+
+void MergeWindows(const core::Tensor& input, int64_t doc_len,
+                  int64_t window_tokens, int64_t stride, int64_t prefix,
+                  int64_t window_rows, types::PoolType merge,
+                  core::Tensor* output) {
+  TT_ENFORCE(merge == types::PoolType::kMean || merge == types::PoolType::kMax,
+             "The windows are merged by their mean or their max");
+  TT_ENFORCE_GT(doc_len, 0, "The sequence of the windows is empty");
+  int64_t num_windows = NumWindows(doc_len, window_tokens, stride);
+  TT_ENFORCE(prefix >= 0 && window_rows >= prefix + window_tokens,
+             "A window of %d rows can not hold %d tokens behind %d",
+             window_rows, window_tokens, prefix);
+  int64_t hidden_size = input.shape(input.n_dim() - 1);
+  int64_t last_tokens = doc_len - (num_windows - 1) * stride;
+  TT_ENFORCE_GE(input.numel() / hidden_size,
+                (num_windows - 1) * window_rows + prefix + last_tokens,
+                "The input misses rows of the windows");
+  auto* out = output->Reshape<float>({doc_len, hidden_size},
+                                     input.device_type(), input.device_id());
+  bool mean = merge == types::PoolType::kMean;
+  if (input.device_type() == kDLCPU) {
+    CPUMergeWindows(input.data<float>(), doc_len, hidden_size, window_tokens,
+                    stride, prefix, window_rows, num_windows, mean, out);
+  } else if (input.device_type() == kDLGPU) {
+#ifdef TT_WITH_CUDA
+    auto& cuda_ctx = core::CUDADeviceContext::GetInstance(input.device_id());
+    GPUMergeWindows(input.data<float>(), doc_len, hidden_size, window_tokens,
+                    stride, prefix, window_rows, num_windows, mean, out,
+                    cuda_ctx.stream());
+#else
+    TT_THROW("The current code is not compiled with CUDA.");
+#endif
+  } else {
+    TT_THROW("device_type %d is not supported for MergeWindows",
+             input.device_type());
+  }
+}
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,42 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/layers/types.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+// The number of windows of `window_tokens` tokens, the first `stride` tokens
+// apart, which cover a sequence of `doc_len` tokens, the last one reaching
+// its end.
+int64_t NumWindows(int64_t doc_len, int64_t window_tokens, int64_t stride);
+
+// Merge the outputs of the overlapping windows of a long sequence into the
+// outputs of its `doc_len` tokens. The window w covers the tokens
+// [w * stride, w * stride + window_tokens), or up to the end, and its rows in
+// the float `input` [..., hidden_size] start at w * window_rows, its tokens
+// behind `prefix` rows of its own, e.g. of [CLS]. The float `output`
+// [doc_len, hidden_size] on the device of the input gets the mean or the max
+// of the rows of a token over the windows covering it, as `merge` is kMean
+// or kMax.
+void MergeWindows(const core::Tensor& input, int64_t doc_len,
+                  int64_t window_tokens, int64_t stride, int64_t prefix,
+                  int64_t window_rows, types::PoolType merge,
+                  core::Tensor* output);
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
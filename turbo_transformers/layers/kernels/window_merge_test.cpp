@@ -0,0 +1,108 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/kernels/window_merge.h"
+
+#include <algorithm>
+#include <tuple>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/layers/kernels/common.h"
+
+namespace turbo_transformers {
+namespace layers {
+namespace kernels {
+
+TEST_CASE("window-merge-num-windows") {
+  REQUIRE(NumWindows(3, 4, 2) == 1);
+  REQUIRE(NumWindows(4, 4, 2) == 1);
+  REQUIRE(NumWindows(5, 4, 2) == 2);
+  REQUIRE(NumWindows(7, 4, 2) == 3);
+  REQUIRE(NumWindows(10, 4, 4) == 3);
+  REQUIRE_THROWS(NumWindows(10, 4, 5));
+  REQUIRE_THROWS(NumWindows(10, 4, 0));
+}
+
+TEST_CASE("window-merge-cpu-test") {
+  // 7 tokens in windows of 4, 2 apart: [0, 4), [2, 6) and [4, 7), each behind
+  // a row of its own and followed by another, in rows of 6.
+  int64_t doc_len = 7, window_tokens = 4, stride = 2, hidden_size = 3;
+  int64_t window_rows = window_tokens + 2;
+  int64_t rows = 2 * window_rows + 1 + 3 + 1;
+  core::Tensor input(nullptr);
+  auto* in = input.Reshape<float>({1, rows, hidden_size}, kDLCPU, 0);
+  for (int64_t i = 0; i < rows * hidden_size; ++i) {
+    in[i] = static_cast<float>(i % 13) - 5.f;
+  }
+  for (auto merge : {types::PoolType::kMean, types::PoolType::kMax}) {
+    core::Tensor output(nullptr);
+    MergeWindows(input, doc_len, window_tokens, stride, 1, window_rows, merge,
+                 &output);
+    REQUIRE(output.shape(0) == doc_len);
+    REQUIRE(output.shape(1) == hidden_size);
+    for (int64_t t = 0; t < doc_len; ++t) {
+      for (int64_t h = 0; h < hidden_size; ++h) {
+        std::vector<float> values;
+        for (int64_t w = 0; w < 3; ++w) {
+          if (t >= w * stride && t < w * stride + window_tokens) {
+            values.push_back(
+                in[(w * window_rows + 1 + t - w * stride) * hidden_size + h]);
+          }
+        }
+        float expected = 0;
+        if (merge == types::PoolType::kMean) {
+          for (auto value : values) {
+            expected += value / values.size();
+          }
+        } else {
+          expected = *std::max_element(values.begin(), values.end());
+        }
+        REQUIRE(output.data<float>()[t * hidden_size + h] ==
+                Approx(expected));
+      }
+    }
+  }
+  core::Tensor output(nullptr);
+  REQUIRE_THROWS(MergeWindows(input, doc_len, window_tokens, stride, 1,
+                              window_rows, types::PoolType::kFirst, &output));
+  // The rows of the last window are missing.
+  REQUIRE_THROWS(MergeWindows(input, doc_len + 2, window_tokens, stride, 1,
+                              window_rows, types::PoolType::kMean, &output));
+}
+
+#ifdef TT_WITH_CUDA
+TEST_CASE("window-merge-gpu-test") {
+  for (int64_t doc_len : {5, 300}) {
+    int64_t window_tokens = 126, stride = 64, hidden_size = 768;
+    int64_t window_rows = window_tokens + 2;
+    int64_t rows = NumWindows(doc_len, window_tokens, stride) * window_rows;
+    core::Tensor cpu_input(nullptr), gpu_input(nullptr);
+    std::tie(cpu_input, gpu_input) =
+        common::CreateAndFillRandomForCPUGPUTensors<float>(
+            {rows, hidden_size});
+    for (auto merge : {types::PoolType::kMean, types::PoolType::kMax}) {
+      core::Tensor cpu_output(nullptr), gpu_output(nullptr);
+      MergeWindows(cpu_input, doc_len, window_tokens, stride, 1, window_rows,
+                   merge, &cpu_output);
+      MergeWindows(gpu_input, doc_len, window_tokens, stride, 1, window_rows,
+                   merge, &gpu_output);
+      REQUIRE(common::CheckResultOfCPUAndGPU<float>(cpu_output, gpu_output));
+    }
+  }
+}
+#endif
+
+}  // namespace kernels
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,150 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/layers/longformer_attention.h"
+
+#include <cmath>
+
+#include "loguru.hpp"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/profiler.h"
+#include "turbo_transformers/layers/kernels/attention.h"
+#include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+#include "turbo_transformers/layers/kernels/transpose.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+static constexpr const char* kQKV = "LongformerAttention/qkv";
+static constexpr const char* kSelfAttrOut = "LongformerAttention/self_attr_out";
+
+void LongformerAttention::operator()(const core::Tensor& input_tensor,
+                                     const core::Tensor& attention_mask,
+                                     int64_t num_global_tokens,
+                                     core::Tensor* output,
+                                     core::Workspace* workspace) const {
+  if (workspace == nullptr) {
+    static thread_local core::Workspace thread_workspace;
+    workspace = &thread_workspace;
+  }
+  TT_ENFORCE_EQ(kernels::common::is_same_device_ctx(
+                    input_tensor.device_ctx(), attention_mask.device_ctx()),
+                true,
+                "The input_tensor and attention_mask should have the same "
+                "device type and device id.");
+  TT_ENFORCE_EQ(input_tensor.n_dim(), 3,
+                "The input ids should be a matrix with shape [BatchSize, "
+                "SeqLen, HiddenSize].");
+  EnforceShapeAndType();
+  if (input_tensor.IsType<core::Half>()) {
+    Compute<core::Half>(input_tensor, attention_mask, num_global_tokens,
+                        output, workspace);
+  } else {
+    Compute<float>(input_tensor, attention_mask, num_global_tokens, output,
+                   workspace);
+  }
+}
+
+template <typename T>
+void LongformerAttention::Compute(const core::Tensor& input_tensor,
+                                  const core::Tensor& attention_mask,
+                                  int64_t num_global_tokens,
+                                  core::Tensor* output,
+                                  core::Workspace* workspace) const {
+  core::ProfileScope profile_scope("LongformerAttention", input_tensor);
+  core::LayerTimer layer_timer("LongformerAttention");
+  auto batch_size = input_tensor.shape(0);
+  auto seq_length = input_tensor.shape(1);
+  auto hidden_size = input_tensor.shape(2);
+  auto all_head_size = qkv_weight_.shape(1) / 3;
+  auto size_per_head = all_head_size / num_attention_heads_;
+  auto device_type = input_tensor.device_type();
+  auto device_id = input_tensor.device_id();
+  output->Reshape<T>({batch_size, seq_length, hidden_size}, device_type,
+                     device_id);
+
+  // 1. qkv = transpose(MatMul(input) + bias)
+  core::Tensor& qkv = workspace->GetTensor<T>(
+      kQKV, {3, batch_size, num_attention_heads_, seq_length, size_per_head},
+      device_type, device_id);
+  kernels::MatMulSplitAddBiasTransposeForScore(
+      qkv, input_tensor, qkv_weight_, packed_qkv_weight_, qkv_bias_);
+  core::TensorView qkv_view(qkv);
+
+  // 2. self_att_out = transpose(softmax(q * k^T * scale + att_mask) * v)
+  // over the window and the global tokens, written into the merged heads.
+  core::Tensor& self_attr_out = workspace->GetTensor<T>(
+      kSelfAttrOut, {batch_size, seq_length, all_head_size}, device_type,
+      device_id);
+  auto context = core::TensorView(self_attr_out)
+                     .AsStrided({batch_size, num_attention_heads_, seq_length,
+                                 size_per_head},
+                                {seq_length * all_head_size, size_per_head,
+                                 all_head_size, 1});
+  float scale = 1 / std::sqrt(static_cast<float>(size_per_head));
+  kernels::SlidingWindowAttention(qkv_view[0], qkv_view[1], qkv_view[2],
+                                  attention_mask, window_, num_global_tokens,
+                                  scale, context);
+
+  // 3. output = LayerNorm(MatMul(self_att_out) + Bias + input)
+  kernels::MatMulAddBiasLayerNorm<T>(self_attr_out, dense_weight_,
+                                     packed_dense_weight_, input_tensor,
+                                     dense_bias_, layer_norm_weight_,
+                                     layer_norm_bias_, output);
+}
+
+int64_t LongformerAttention::PlanMemory(core::MemoryPlanner* planner,
+                                        int64_t batch_size,
+                                        int64_t seq_length, int64_t op) const {
+  size_t elem_size = qkv_weight_.IsType<core::Half>() ? sizeof(core::Half)
+                                                      : sizeof(float);
+  size_t bytes =
+      batch_size * seq_length * (qkv_weight_.shape(1) / 3) * elem_size;
+  // op: qkv projection, op + 1: attention, op + 2: dense and layer norm.
+  planner->AddUsage(kQKV, 3 * bytes, op, op + 1);
+  planner->AddUsage(kSelfAttrOut, bytes, op + 1, op + 2);
+  return op + 2;
+}
+
+void LongformerAttention::EnforceShapeAndType() const {
+  TT_ENFORCE_GT(num_attention_heads_, 0, "The attention needs a head.");
+  TT_ENFORCE_GE(window_, 0, "The attention window should not be negative.");
+  TT_ENFORCE_EQ(qkv_weight_.n_dim(), 2, "qkv weight must be matrix");
+  TT_ENFORCE_EQ(qkv_weight_.shape(1) % (3 * num_attention_heads_), 0,
+                "The qkv weight of %d columns can not be split into 3 x %d "
+                "heads",
+                qkv_weight_.shape(1), num_attention_heads_);
+  TT_ENFORCE_EQ(dense_weight_.shape(0), qkv_weight_.shape(1) / 3,
+                "The dense weight must take the %d columns of the heads",
+                qkv_weight_.shape(1) / 3);
+  if (loguru::current_verbosity_cutoff() >= 3) {
+    std::ostringstream os;
+    os << ">>>>>>>>>>>> qkv_weight_ <<<<<<<<<<<<" << std::endl;
+    qkv_weight_.Print<float>(os);
+    os << ">>>>>>>>>>>> qkv_bias_ <<<<<<<<<<<<" << std::endl;
+    qkv_bias_.Print<float>(os);
+    os << ">>>>>>>>>>>> dense_weight_ <<<<<<<<<<<<" << std::endl;
+    dense_weight_.Print<float>(os);
+    os << ">>>>>>>>>>>> dense_bias_ <<<<<<<<<<<<" << std::endl;
+    dense_bias_.Print<float>(os);
+    os << ">>>>>>>>>>>> layer_norm_weights <<<<<<<<<<<<" << std::endl;
+    layer_norm_weight_.Print<float>(os);
+    os << ">>>>>>>>>>>> layer_norm_bias <<<<<<<<<<<<" << std::endl;
+    layer_norm_bias_.Print<float>(os);
+    LOG_S(3) << os.str();
+  }
+}
+
+}  // namespace layers
+}  // namespace turbo_transformers
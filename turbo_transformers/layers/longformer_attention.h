@@ -0,0 +1,88 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <memory>
+#include <utility>
+
+#include "turbo_transformers/core/memory_planner.h"
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/workspace.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+// The self-attention of a Longformer layer for long documents, which takes
+// the weights of BertAttention. A token attends to the tokens within
+// `window` of it, i.e. half the attention_window of HuggingFace, and to the
+// leading global tokens, which attend to all tokens. The attention scores
+// take O(seq_len * (window + num_global_tokens)) memory instead of the
+// [batch_size, head_num, seq_len, seq_len] scores of BertAttention. Unlike
+// HuggingFace, the global attention shares the projections of the local one.
+class LongformerAttention {
+ public:
+  LongformerAttention(core::Tensor qkv_weight, core::Tensor qkv_bias,
+                      core::Tensor dense_weight, core::Tensor dense_bias,
+                      core::Tensor layer_norm_weight,
+                      core::Tensor layer_norm_bias,
+                      int64_t num_attention_heads, int64_t window)
+      : qkv_weight_(std::move(qkv_weight)),
+        qkv_bias_(std::move(qkv_bias)),
+        dense_weight_(std::move(dense_weight)),
+        dense_bias_(std::move(dense_bias)),
+        layer_norm_weight_(std::move(layer_norm_weight)),
+        layer_norm_bias_(std::move(layer_norm_bias)),
+        num_attention_heads_(num_attention_heads),
+        window_(window) {
+    EnforceShapeAndType();
+    packed_qkv_weight_ = kernels::PackLayerWeight(qkv_weight_);
+    packed_dense_weight_ = kernels::PackLayerWeight(dense_weight_);
+  }
+  void EnforceShapeAndType() const;
+
+  // The first `num_global_tokens` tokens of every sequence are global, e.g.
+  // [CLS] and the question of a QA input, padded to the longest question of
+  // the batch. `attention_mask` is the mask [batch_size, 1, 1, seq_len] of
+  // BertAttention.
+  void operator()(const core::Tensor &input_tensor,
+                  const core::Tensor &attention_mask,
+                  int64_t num_global_tokens, core::Tensor *output,
+                  core::Workspace *workspace = nullptr) const;
+
+  // Declare the intermediate tensors of a call starting at operator `op`.
+  // Returns the index of the last operator this layer occupies.
+  int64_t PlanMemory(core::MemoryPlanner *planner, int64_t batch_size,
+                     int64_t seq_length, int64_t op) const;
+
+ private:
+  // T is float or core::Half, the data type of the input and the weights.
+  template <typename T>
+  void Compute(const core::Tensor &input_tensor,
+               const core::Tensor &attention_mask, int64_t num_global_tokens,
+               core::Tensor *output, core::Workspace *workspace) const;
+
+  core::Tensor qkv_weight_;
+  core::Tensor qkv_bias_;
+  core::Tensor dense_weight_;
+  core::Tensor dense_bias_;
+  core::Tensor layer_norm_weight_;
+  core::Tensor layer_norm_bias_;
+  int64_t num_attention_heads_;
+  int64_t window_;
+  kernels::PackedWeight packed_qkv_weight_;
+  kernels::PackedWeight packed_dense_weight_;
+};
+
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -0,0 +1,93 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+#include "turbo_transformers/layers/longformer_attention.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/layers/bert_attention.h"
+#include "turbo_transformers/layers/kernels/common.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+using kernels::common::CreateTensorAndFillRandom;
+
+// A copy of a weight or bias, so that two layers take the same parameters.
+static core::Tensor Clone(const core::Tensor &tensor) {
+  core::Tensor result(nullptr);
+  auto *data =
+      tensor.n_dim() == 1
+          ? result.Reshape<float>({tensor.shape(0)}, kDLCPU, 0)
+          : result.Reshape<float>({tensor.shape(0), tensor.shape(1)}, kDLCPU,
+                                  0);
+  std::copy(tensor.data<float>(), tensor.data<float>() + tensor.numel(), data);
+  return result;
+}
+
+TEST_CASE("longformer_attention-bert_attention", "[longformer_attention]") {
+  const int64_t batch_size = 2, seq_length = 100, hidden_size = 32,
+                num_heads = 2;
+  auto qkv_weight = CreateTensorAndFillRandom<float>(
+      {hidden_size, 3 * hidden_size}, kDLCPU, 0);
+  auto qkv_bias =
+      CreateTensorAndFillRandom<float>({3 * hidden_size}, kDLCPU, 0);
+  auto dense_weight =
+      CreateTensorAndFillRandom<float>({hidden_size, hidden_size}, kDLCPU, 0);
+  auto dense_bias =
+      CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+  auto ln_weight = CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+  auto ln_bias = CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+  auto input = CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+  auto mask = kernels::common::CreateTensorAndFillConstant<float>(
+      {batch_size, 1, 1, seq_length}, kDLCPU, 0, 0.f);
+  // The padding of the second sequence.
+  std::fill(mask.mutableData<float>() + seq_length + seq_length / 2,
+            mask.mutableData<float>() + 2 * seq_length, -10000.0f);
+
+  BertAttention bert_attention(Clone(qkv_weight), Clone(qkv_bias),
+                               Clone(dense_weight), Clone(dense_bias),
+                               Clone(ln_weight), Clone(ln_bias), num_heads);
+  core::Tensor expected(nullptr);
+  bert_attention(input, mask, &expected);
+
+  // A window of the whole sequence, and a global token whose attention
+  // covers the keys out of the window.
+  std::vector<std::pair<int64_t, int64_t>> windows_and_globals{
+      {seq_length, 0}, {seq_length - 1, 1}};
+  for (auto &window_and_global : windows_and_globals) {
+    LongformerAttention attention(
+        Clone(qkv_weight), Clone(qkv_bias), Clone(dense_weight),
+        Clone(dense_bias), Clone(ln_weight), Clone(ln_bias), num_heads,
+        window_and_global.first);
+    core::Tensor output(nullptr);
+    attention(input, mask, window_and_global.second, &output);
+    REQUIRE(kernels::common::CheckResultOfCPU<float>(output, expected));
+  }
+
+  // A narrow window attends to fewer tokens.
+  LongformerAttention attention(std::move(qkv_weight), std::move(qkv_bias),
+                                std::move(dense_weight), std::move(dense_bias),
+                                std::move(ln_weight), std::move(ln_bias),
+                                num_heads, 4);
+  core::Tensor output(nullptr);
+  attention(input, mask, 1, &output);
+  REQUIRE_FALSE(kernels::common::CheckResultOfCPU<float>(output, expected));
+}
+
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -15,7 +15,8 @@
 
 #include "turbo_transformers/layers/kernels/common.h"
 #ifdef TT_WITH_CUDA
-#include "turbo_transformers/layers/kernels/gpu_utils.h"
+#include "turbo_transformers/core/cuda_device_context.h"
+#include "turbo_transformers/layers/kernels/gpu_prepare_inputs_kernel.h"
 #endif
 
 namespace turbo_transformers {
@@ -26,7 +27,12 @@ void PrepareBertMasks::operator()(const core::Tensor& inputs,
                                   core::Tensor* seq_type,
                                   core::Tensor* position_ids,
                                   core::Tensor* extended_attention_mask) const {
-  if (position_ids->is_null()) {
+  if (inputs.device_type() == kDLGPU) {
+    PrepareOnGPU(inputs, att_mask, seq_type, position_ids,
+                 extended_attention_mask);
+    return;
+  }
+  if (position_ids != nullptr && position_ids->is_null()) {
     auto pos_ids_ptr = position_ids->Reshape<int64_t>(
         {inputs.shape(0), inputs.shape(1)}, inputs.device_type(),
         inputs.device_id());
@@ -34,7 +40,7 @@ void PrepareBertMasks::operator()(const core::Tensor& inputs,
     // fill range
     for (int64_t row_id = 0; row_id < inputs.shape(0); ++row_id) {
       kernels::common::Sequence(pos_ids_ptr, inputs.shape(1),
-                                inputs.device_type());
+                                inputs.device_type(), inputs.device_id());
       pos_ids_ptr += inputs.shape(1);
     }
   }
@@ -44,14 +50,19 @@ void PrepareBertMasks::operator()(const core::Tensor& inputs,
     seq_type->Reshape<int64_t>({inputs.shape(0), inputs.shape(1)},
                                inputs.device_type(), inputs.device_id());
     kernels::common::Fill(seq_type->mutableData<int64_t>(), seq_type->numel(),
-                          static_cast<int64_t>(0), inputs.device_type());
+                          static_cast<int64_t>(0), inputs.device_type(),
+                          inputs.device_id());
   }
 
+  if (extended_attention_mask == nullptr) {
+    return;
+  }
   if (att_mask->is_null()) {
     att_mask->Reshape<int64_t>({inputs.shape(0), inputs.shape(1)},
                                inputs.device_type(), inputs.device_id());
     kernels::common::Fill(att_mask->mutableData<int64_t>(), att_mask->numel(),
-                          static_cast<int64_t>(1), inputs.device_type());
+                          static_cast<int64_t>(1), inputs.device_type(),
+                          inputs.device_id());
   }
 
   // cast att_mask to float
@@ -60,7 +71,41 @@ void PrepareBertMasks::operator()(const core::Tensor& inputs,
       inputs.device_id());
   kernels::common::Transform(att_mask->mutableData<int64_t>(),
                              extended_attention_mask->mutableData<float>(),
-                             att_mask->numel(), inputs.device_type());
+                             att_mask->numel(), inputs.device_type(),
+                             inputs.device_id());
+}
+
+void PrepareBertMasks::PrepareOnGPU(
+    const core::Tensor& inputs, core::Tensor* att_mask, core::Tensor* seq_type,
+    core::Tensor* position_ids, core::Tensor* extended_attention_mask) const {
+#ifdef TT_WITH_CUDA
+  int64_t batch_size = inputs.shape(0);
+  int64_t seq_len = inputs.shape(1);
+  auto fill = [&](core::Tensor* tensor) -> int64_t* {
+    if (tensor == nullptr || !tensor->is_null()) {
+      return nullptr;
+    }
+    return tensor->Reshape<int64_t>({batch_size, seq_len}, inputs.device_type(),
+                                    inputs.device_id());
+  };
+  int64_t* pos_ptr = fill(position_ids);
+  int64_t* seg_ptr = fill(seq_type);
+  int64_t* mask_ptr = nullptr;
+  float* extended_ptr = nullptr;
+  if (extended_attention_mask != nullptr) {
+    mask_ptr = fill(att_mask);
+    extended_ptr = extended_attention_mask->Reshape<float>(
+        {batch_size, 1, 1, seq_len}, inputs.device_type(), inputs.device_id());
+  }
+  auto& cuda_ctx = core::CUDADeviceContext::GetInstance(inputs.device_id());
+  kernels::GPUPrepareBertMasks(
+      mask_ptr == nullptr && att_mask != nullptr ? att_mask->data<int64_t>()
+                                                 : nullptr,
+      mask_ptr, seg_ptr, pos_ptr, extended_ptr, batch_size, seq_len,
+      cuda_ctx.stream());
+#else
+  TT_THROW("The current code is not compiled with CUDA.");
+#endif
 }
 
 }  // namespace layers
@@ -17,11 +17,22 @@
 namespace turbo_transformers {
 namespace layers {
 
+// Fills the null masks, token types and positions with their defaults, and
+// converts the mask to float. position_ids may be nullptr, since
+// BERTEmbedding generates the default positions by itself. The masks may be
+// nullptr too if the attention takes the sequence lengths instead, see
+// BertAttention::RunWithSeqLens.
 class PrepareBertMasks {
  public:
   void operator()(const core::Tensor& inputs, core::Tensor* att_mask,
                   core::Tensor* seq_type, core::Tensor* position_ids,
                   core::Tensor* extended_attention_mask) const;
+
+ private:
+  // The defaults and the float mask in a single launch on the GPU.
+  void PrepareOnGPU(const core::Tensor& inputs, core::Tensor* att_mask,
+                    core::Tensor* seq_type, core::Tensor* position_ids,
+                    core::Tensor* extended_attention_mask) const;
 };
 
 }  // namespace layers
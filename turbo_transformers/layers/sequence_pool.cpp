@@ -17,10 +17,59 @@
 
 namespace turbo_transformers {
 namespace layers {
+namespace {
+template <typename T>
+void SeqPoolPacked(const core::Tensor &input, layers::types::PoolType pool_type,
+                   const core::Tensor &seq_offsets, core::Tensor *output) {
+  TT_ENFORCE(input.n_dim() == 3 && input.shape(0) == 1,
+             "The packed input should be a tensor with shape [1, "
+             "TotalTokens, HiddenSize].");
+  TT_ENFORCE(seq_offsets.device_type() == kDLCPU &&
+                 seq_offsets.IsType<int64_t>() && seq_offsets.numel() > 1,
+             "The sequence offsets should be an int64 CPU tensor with shape "
+             "[BatchSize + 1].");
+  auto batch_size = seq_offsets.numel() - 1;
+  auto total_tokens = input.shape(1);
+  auto hidden_size = input.shape(2);
+  const auto *offsets = seq_offsets.data<int64_t>();
+  auto *out = output->Reshape<T>({batch_size, hidden_size},
+                                 input.device_type(), input.device_id());
+  // Every sequence is pooled as a batch of one, into its row of the output.
+  auto *data = const_cast<T *>(input.data<T>());
+  for (int64_t b = 0; b < batch_size; ++b) {
+    auto seq_len = offsets[b + 1] - offsets[b];
+    TT_ENFORCE(seq_len >= 1 && offsets[b + 1] <= total_tokens,
+               "The sequence %d should hold tokens in [1, %d], got [%d, %d).",
+               b, total_tokens, offsets[b], offsets[b + 1]);
+    core::Tensor seq(core::NewDLPackTensorViewT<T>(
+        data + offsets[b] * hidden_size, {1, seq_len, hidden_size},
+        input.device_type(), input.device_id()));
+    core::Tensor row(core::NewDLPackTensorViewT<T>(
+        out + b * hidden_size, {1, hidden_size}, input.device_type(),
+        input.device_id()));
+    kernels::SeqPool<T>(seq, pool_type, &row, nullptr);
+  }
+}
+}  // namespace
 
 void SequencePool::operator()(const core::Tensor &input,
-                              core::Tensor *output) const {
-  kernels::SeqPool<float>(input, pool_type_, output);
+                              core::Tensor *output,
+                              const core::Tensor *seq_lens) const {
+  if (input.IsType<core::Half>()) {
+    kernels::SeqPool<core::Half>(input, pool_type_, output, seq_lens);
+  } else {
+    kernels::SeqPool<float>(input, pool_type_, output, seq_lens);
+  }
+}
+
+void SequencePool::RunPacked(const core::Tensor &input,
+                             const core::Tensor &seq_offsets,
+                             core::Tensor *output) const {
+  if (input.IsType<core::Half>()) {
+    SeqPoolPacked<core::Half>(input, pool_type_, seq_offsets, output);
+  } else {
+    SeqPoolPacked<float>(input, pool_type_, seq_offsets, output);
+  }
 }
 
 }  // namespace layers
@@ -27,7 +27,16 @@ class SequencePool {
   }
   explicit SequencePool(layers::types::PoolType pt) : pool_type_(pt) {}
 
-  void operator()(const core::Tensor &input_tensor, core::Tensor *output) const;
+  // seq_lens, if given, are the valid lengths of the sequences, see
+  // kernels::SeqPool.
+  void operator()(const core::Tensor &input_tensor, core::Tensor *output,
+                  const core::Tensor *seq_lens = nullptr) const;
+
+  // Pool the packed tokens [1, total_tokens, hidden_size] of the sequences
+  // between the int64 CPU `seq_offsets` [batch_size + 1], see
+  // BertAttention::RunPacked.
+  void RunPacked(const core::Tensor &input_tensor,
+                 const core::Tensor &seq_offsets, core::Tensor *output) const;
 
  private:
   layers::types::PoolType pool_type_;
@@ -0,0 +1,279 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+
+#include "turbo_transformers/layers/tensor_parallel_bert_layer.h"
+
+#include "turbo_transformers/core/memory.h"
+#include "turbo_transformers/core/tensor_copy.h"
+#include "turbo_transformers/layers/bert_attention.h"
+#include "turbo_transformers/layers/bert_intermediate.h"
+#include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/kernels/layer_norm.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+#ifdef TT_WITH_CUDA
+#include "turbo_transformers/core/cuda_device_context.h"
+#endif
+
+namespace turbo_transformers {
+namespace layers {
+
+static constexpr const char* kAttentionOut =
+    "TensorParallelBertLayer/attention_out";
+static constexpr const char* kIntermediateOut =
+    "TensorParallelBertLayer/intermediate_out";
+static constexpr const char* kPartialOut =
+    "TensorParallelBertLayer/partial_out";
+static constexpr const char* kInput = "TensorParallelBertLayer/input";
+static constexpr const char* kMask = "TensorParallelBertLayer/mask";
+static constexpr const char* kReceived = "TensorParallelBertLayer/received";
+
+struct TensorParallelBertLayer::Shard {
+  int device_id;
+  std::unique_ptr<BertAttention> attention;
+  std::unique_ptr<BertIntermediate> intermediate;
+  // [intermediate_size / num_shards, hidden_size]
+  core::Tensor output_weight{nullptr};
+#ifdef TT_WITH_CUDA
+  // Recorded on the stream of the shard once it wrote its partial output. The
+  // event of the first shard marks its input written instead, which the
+  // others wait on before they copy it.
+  std::unique_ptr<core::CUDAEvent> computed;
+#endif
+};
+
+// Copy the rows [row_begin, row_end) of the host `weight`, of each row the
+// columns [begin, begin + width) of every `begin` of `col_begins` side by
+// side, to the device. A vector is a single row.
+static core::Tensor CopySlice(const core::Tensor& weight, int64_t row_begin,
+                              int64_t row_end,
+                              const std::vector<int64_t>& col_begins,
+                              int64_t width, DLDeviceType device_type,
+                              int device_id) {
+  int64_t n_cols = weight.shape(weight.n_dim() - 1);
+  std::vector<float> slice;
+  slice.reserve((row_end - row_begin) * col_begins.size() * width);
+  for (int64_t r = row_begin; r < row_end; ++r) {
+    for (int64_t begin : col_begins) {
+      const float* row = weight.data<float>() + r * n_cols + begin;
+      slice.insert(slice.end(), row, row + width);
+    }
+  }
+  int64_t slice_cols = col_begins.size() * width;
+  core::Tensor tensor(
+      weight.n_dim() == 1
+          ? core::NewDLPackTensorT<float>({slice_cols}, device_type, device_id)
+          : core::NewDLPackTensorT<float>({row_end - row_begin, slice_cols},
+                                          device_type, device_id));
+  core::Copy(slice.data(), slice.size(), DLDeviceType::kDLCPU, tensor);
+  return tensor;
+}
+
+// A whole host vector on the device.
+static core::Tensor CopyVector(const core::Tensor& vector,
+                               DLDeviceType device_type, int device_id) {
+  return CopySlice(vector, 0, 1, {0}, vector.shape(0), device_type,
+                   device_id);
+}
+
+TensorParallelBertLayer::TensorParallelBertLayer(
+    const BertLayerWeights& weights, int64_t num_heads,
+    DLDeviceType device_type, const std::vector<int>& device_ids)
+    : device_type_(device_type) {
+  TT_ENFORCE(!device_ids.empty(), "A tensor-parallel layer needs a device");
+  TT_ENFORCE(weights.qkv_weight.device_type() == kDLCPU &&
+                 weights.output_dense_weight.device_type() == kDLCPU,
+             "The weights of a tensor-parallel layer are sliced on the host");
+  int64_t num_shards = device_ids.size();
+  int64_t hidden_size = weights.output_dense_weight.shape(1);
+  int64_t all_head_size = weights.qkv_weight.shape(1) / 3;
+  int64_t intermediate_size = weights.intermediate_weight.shape(1);
+  TT_ENFORCE_EQ(num_heads % num_shards, 0,
+                "The %d heads can not be split into %d shards", num_heads,
+                num_shards);
+  TT_ENFORCE_EQ(intermediate_size % num_shards, 0,
+                "The intermediate size %d can not be split into %d shards",
+                intermediate_size, num_shards);
+  int first_device = device_ids.front();
+#ifdef TT_WITH_CUDA
+  if (device_type == kDLGPU) {
+    // The first GPU gathers the partial outputs of the others, which read
+    // its inputs.
+    for (int device : device_ids) {
+      core::EnablePeerAccess(first_device, device);
+      core::EnablePeerAccess(device, first_device);
+    }
+  }
+#endif
+
+  int64_t head_cols = all_head_size / num_shards;
+  int64_t intermediate_cols = intermediate_size / num_shards;
+  for (int64_t s = 0; s < num_shards; ++s) {
+    int device = device_ids[s];
+    std::unique_ptr<Shard> shard(new Shard);
+    shard->device_id = device;
+    // The columns of the heads of the shard in q, k and v, and their rows of
+    // the dense weight.
+    int64_t head_begin = s * head_cols;
+    std::vector<int64_t> qkv_cols{head_begin, all_head_size + head_begin,
+                                  2 * all_head_size + head_begin};
+    // The biases and the layer norms are not read by the shards.
+    auto unused = [&] {
+      return core::Tensor(
+          core::NewDLPackTensorT<float>({hidden_size}, device_type, device));
+    };
+    shard->attention.reset(new BertAttention(
+        CopySlice(weights.qkv_weight, 0, hidden_size, qkv_cols, head_cols,
+                  device_type, device),
+        CopySlice(weights.qkv_bias, 0, 1, qkv_cols, head_cols, device_type,
+                  device),
+        CopySlice(weights.attention_dense_weight, head_begin,
+                  head_begin + head_cols, {0}, hidden_size, device_type,
+                  device),
+        unused(), unused(), unused(), num_heads / num_shards));
+    int64_t intermediate_begin = s * intermediate_cols;
+    shard->intermediate.reset(new BertIntermediate(
+        CopySlice(weights.intermediate_weight, 0, hidden_size,
+                  {intermediate_begin}, intermediate_cols, device_type,
+                  device),
+        CopySlice(weights.intermediate_bias, 0, 1, {intermediate_begin},
+                  intermediate_cols, device_type, device)));
+    shard->output_weight =
+        CopySlice(weights.output_dense_weight, intermediate_begin,
+                  intermediate_begin + intermediate_cols, {0}, hidden_size,
+                  device_type, device);
+#ifdef TT_WITH_CUDA
+    if (device_type == kDLGPU) {
+      shard->computed.reset(new core::CUDAEvent(device));
+    }
+#endif
+    shards_.push_back(std::move(shard));
+  }
+  attention_dense_bias_ =
+      CopyVector(weights.attention_dense_bias, device_type, first_device);
+  attention_layer_norm_weight_ = CopyVector(weights.attention_layer_norm_weight,
+                                            device_type, first_device);
+  attention_layer_norm_bias_ = CopyVector(weights.attention_layer_norm_bias,
+                                          device_type, first_device);
+  output_dense_bias_ =
+      CopyVector(weights.output_dense_bias, device_type, first_device);
+  output_layer_norm_weight_ =
+      CopyVector(weights.output_layer_norm_weight, device_type, first_device);
+  output_layer_norm_bias_ =
+      CopyVector(weights.output_layer_norm_bias, device_type, first_device);
+}
+
+TensorParallelBertLayer::~TensorParallelBertLayer() = default;
+
+void TensorParallelBertLayer::operator()(
+    core::Tensor* hidden, const core::Tensor& attention_mask,
+    const std::vector<core::Workspace*>& workspaces) const {
+  TT_ENFORCE_EQ(workspaces.size(), shards_.size(),
+                "A tensor-parallel layer of %d shards got %d workspaces",
+                shards_.size(), workspaces.size());
+  auto& attention_out = workspaces.front()->GetTensor<float>(
+      kAttentionOut, {hidden->shape(0), hidden->shape(1), hidden->shape(2)},
+      device_type_, shards_.front()->device_id);
+  RunSublayer(false, *hidden, attention_mask, &attention_out, workspaces);
+  RunSublayer(true, attention_out, attention_mask, hidden, workspaces);
+}
+
+void TensorParallelBertLayer::RunSublayer(
+    bool ffn, const core::Tensor& input, const core::Tensor& attention_mask,
+    core::Tensor* output,
+    const std::vector<core::Workspace*>& workspaces) const {
+  auto& first = *shards_.front();
+  int64_t batch_size = input.shape(0), seq_len = input.shape(1);
+  int64_t hidden_size = input.shape(2);
+  auto activation = [&](size_t s, const char* name,
+                        int64_t width) -> core::Tensor& {
+    return workspaces[s]->GetTensor<float>(
+        name, {batch_size, seq_len, width}, device_type_,
+        shards_[s]->device_id);
+  };
+#ifdef TT_WITH_CUDA
+  bool on_gpu = device_type_ == kDLGPU;
+  if (on_gpu) {
+    first.computed->Record();
+  }
+#endif
+  // The partial outputs of the other shards, on their devices.
+  std::vector<const core::Tensor*> partials;
+  for (size_t s = 0; s < shards_.size(); ++s) {
+    auto& shard = *shards_[s];
+    const core::Tensor* shard_input = &input;
+    const core::Tensor* shard_mask = &attention_mask;
+#ifdef TT_WITH_CUDA
+    if (on_gpu && s > 0) {
+      first.computed->Wait(shard.device_id);
+      auto& input_copy = activation(s, kInput, hidden_size);
+      core::MemcpyPeerAsync(input_copy.mutableData<float>(), shard.device_id,
+                            input.data<float>(), first.device_id,
+                            input.numel() * sizeof(float));
+      shard_input = &input_copy;
+      if (!ffn) {
+        auto& mask_copy = workspaces[s]->GetTensor<float>(
+            kMask, {batch_size, 1, 1, seq_len}, device_type_,
+            shard.device_id);
+        core::MemcpyPeerAsync(mask_copy.mutableData<float>(), shard.device_id,
+                              attention_mask.data<float>(), first.device_id,
+                              attention_mask.numel() * sizeof(float));
+        shard_mask = &mask_copy;
+      }
+    }
+#endif
+    core::Tensor* partial =
+        s == 0 ? output : &activation(s, kPartialOut, hidden_size);
+    if (ffn) {
+      auto& intermediate_out =
+          activation(s, kIntermediateOut, shard.output_weight.shape(0));
+      (*shard.intermediate)(*shard_input, &intermediate_out);
+      kernels::MatMul(intermediate_out, false, shard.output_weight, false, 1.0,
+                      *partial, 0.0);
+    } else {
+      shard.attention->RunPartial(*shard_input, *shard_mask, partial,
+                                  workspaces[s]);
+    }
+    if (s > 0) {
+      partials.push_back(partial);
+#ifdef TT_WITH_CUDA
+      if (on_gpu) {
+        shard.computed->Record();
+      }
+#endif
+    }
+  }
+  for (size_t s = 1; s < shards_.size(); ++s) {
+    const core::Tensor* partial = partials[s - 1];
+#ifdef TT_WITH_CUDA
+    if (on_gpu) {
+      shards_[s]->computed->Wait(first.device_id);
+      auto& received = activation(0, kReceived, hidden_size);
+      core::MemcpyPeerAsync(received.mutableData<float>(), first.device_id,
+                            partial->data<float>(), shards_[s]->device_id,
+                            received.numel() * sizeof(float));
+      partial = &received;
+    }
+#endif
+    kernels::common::Accumulate(partial->data<float>(),
+                                output->mutableData<float>(), output->numel(),
+                                device_type_, first.device_id);
+  }
+  kernels::AddBiasLayerNorm<float>(
+      input, ffn ? output_dense_bias_ : attention_dense_bias_,
+      ffn ? output_layer_norm_weight_ : attention_layer_norm_weight_,
+      ffn ? output_layer_norm_bias_ : attention_layer_norm_bias_, output);
+}
+
+}  // namespace layers
+}  // namespace turbo_transformers
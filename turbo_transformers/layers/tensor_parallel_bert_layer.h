@@ -0,0 +1,75 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+
+#pragma once
+#include <memory>
+#include <vector>
+
+#include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/workspace.h"
+#include "turbo_transformers/layers/bert_layer_weights.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+// A BERT encoder layer sharded over several devices as in Megatron-LM. A
+// shard holds the attention of a range of the heads, and a range of the
+// intermediate columns with their rows of the output weight. For the
+// attention and the FFN, the first device sends its input to the others,
+// each shard computes the partial output of its slice, and the first device
+// sums them and applies the bias, the residual and the layer norm, whose
+// weights it holds alone. The GPUs wait on each other by events only; on
+// the host the shards run one after another and read the input in place.
+class TensorParallelBertLayer {
+ public:
+  // Slices `weights`, on the host, over the devices `device_ids`, the first
+  // of which runs the reductions. The heads and the intermediate size must
+  // divide by the number of shards.
+  TensorParallelBertLayer(const BertLayerWeights &weights, int64_t num_heads,
+                          DLDeviceType device_type,
+                          const std::vector<int> &device_ids);
+  ~TensorParallelBertLayer();
+
+  // Runs the layer in place on `hidden` [batch_size, seq_len, hidden_size],
+  // masked by the extended `attention_mask` [batch_size, 1, 1, seq_len], both
+  // on the first device. `workspaces` holds the workspace of each shard, on
+  // its device. The calls of a layer must not overlap, as they share the
+  // events of the shards.
+  void operator()(core::Tensor *hidden, const core::Tensor &attention_mask,
+                  const std::vector<core::Workspace *> &workspaces) const;
+
+  size_t num_shards() const { return shards_.size(); }
+  int64_t hidden_size() const { return attention_layer_norm_weight_.shape(0); }
+
+ private:
+  struct Shard;
+
+  // The attention, reading `input` into `output`, or the FFN.
+  void RunSublayer(bool ffn, const core::Tensor &input,
+                   const core::Tensor &attention_mask, core::Tensor *output,
+                   const std::vector<core::Workspace *> &workspaces) const;
+
+  DLDeviceType device_type_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  // On the first device.
+  core::Tensor attention_dense_bias_{nullptr};
+  core::Tensor attention_layer_norm_weight_{nullptr};
+  core::Tensor attention_layer_norm_bias_{nullptr};
+  core::Tensor output_dense_bias_{nullptr};
+  core::Tensor output_layer_norm_weight_{nullptr};
+  core::Tensor output_layer_norm_bias_{nullptr};
+};
+
+}  // namespace layers
+}  // namespace turbo_transformers
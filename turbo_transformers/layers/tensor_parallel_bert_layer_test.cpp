@@ -0,0 +1,157 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+
+#include "turbo_transformers/layers/tensor_parallel_bert_layer.h"
+
+#include <memory>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/core/tensor_copy.h"
+#include "turbo_transformers/layers/bert_attention.h"
+#include "turbo_transformers/layers/bert_intermediate.h"
+#include "turbo_transformers/layers/bert_output.h"
+#include "turbo_transformers/layers/kernels/common.h"
+
+namespace turbo_transformers {
+namespace layers {
+
+static BertLayerWeights CreateWeights(int64_t hidden_size,
+                                      int64_t intermediate_size) {
+  using kernels::common::CreateTensorAndFillRandom;
+  BertLayerWeights weights;
+  weights.qkv_weight = CreateTensorAndFillRandom<float>(
+      {hidden_size, 3 * hidden_size}, kDLCPU, 0);
+  weights.qkv_bias =
+      CreateTensorAndFillRandom<float>({3 * hidden_size}, kDLCPU, 0);
+  weights.attention_dense_weight =
+      CreateTensorAndFillRandom<float>({hidden_size, hidden_size}, kDLCPU, 0);
+  weights.attention_dense_bias =
+      CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+  weights.attention_layer_norm_weight =
+      CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+  weights.attention_layer_norm_bias =
+      CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+  weights.intermediate_weight = CreateTensorAndFillRandom<float>(
+      {hidden_size, intermediate_size}, kDLCPU, 0);
+  weights.intermediate_bias =
+      CreateTensorAndFillRandom<float>({intermediate_size}, kDLCPU, 0);
+  weights.output_dense_weight = CreateTensorAndFillRandom<float>(
+      {intermediate_size, hidden_size}, kDLCPU, 0);
+  weights.output_dense_bias =
+      CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+  weights.output_layer_norm_weight =
+      CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+  weights.output_layer_norm_bias =
+      CreateTensorAndFillRandom<float>({hidden_size}, kDLCPU, 0);
+  return weights;
+}
+
+// A copy of the host `tensor` on the device, in the same shape.
+static core::Tensor CopyTo(const core::Tensor& tensor,
+                           DLDeviceType device_type) {
+  std::vector<int64_t> shape;
+  for (size_t i = 0; i < tensor.n_dim(); ++i) {
+    shape.push_back(tensor.shape(i));
+  }
+  core::Tensor copy(core::NewDLPackTensorT<float>(shape, device_type, 0));
+  core::Copy<float>(tensor, copy);
+  return copy;
+}
+
+// The unsharded layer on the host.
+static core::Tensor RunBertLayer(const BertLayerWeights& weights,
+                                 int64_t num_heads, const core::Tensor& input,
+                                 const core::Tensor& mask) {
+  core::Tensor attention_out(nullptr), intermediate_out(nullptr),
+      output(nullptr);
+  BertAttention(CopyTo(weights.qkv_weight, kDLCPU),
+                CopyTo(weights.qkv_bias, kDLCPU),
+                CopyTo(weights.attention_dense_weight, kDLCPU),
+                CopyTo(weights.attention_dense_bias, kDLCPU),
+                CopyTo(weights.attention_layer_norm_weight, kDLCPU),
+                CopyTo(weights.attention_layer_norm_bias, kDLCPU),
+                num_heads)(input, mask, &attention_out);
+  BertIntermediate(CopyTo(weights.intermediate_weight, kDLCPU),
+                   CopyTo(weights.intermediate_bias, kDLCPU))(
+      attention_out, &intermediate_out);
+  BertOutput(CopyTo(weights.output_dense_weight, kDLCPU),
+             CopyTo(weights.output_dense_bias, kDLCPU),
+             CopyTo(weights.output_layer_norm_weight, kDLCPU),
+             CopyTo(weights.output_layer_norm_bias, kDLCPU))(
+      intermediate_out, attention_out, &output);
+  return output;
+}
+
+TEST_CASE("tensor_parallel_bert_layer-cpu", "[tensor_parallel_bert_layer]") {
+  using kernels::common::CreateTensorAndFillRandom;
+  const int64_t batch_size = 2, seq_length = 8, hidden_size = 64;
+  const int64_t intermediate_size = 128, num_heads = 4;
+  auto weights = CreateWeights(hidden_size, intermediate_size);
+  auto input = CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+  auto mask = CreateTensorAndFillRandom<float>({batch_size, 1, 1, seq_length},
+                                               kDLCPU, 0);
+  auto expected = RunBertLayer(weights, num_heads, input, mask);
+
+  for (size_t num_shards : {1, 2, 4}) {
+    TensorParallelBertLayer layer(weights, num_heads, kDLCPU,
+                                  std::vector<int>(num_shards, 0));
+    REQUIRE(layer.num_shards() == num_shards);
+    REQUIRE(layer.hidden_size() == hidden_size);
+    std::vector<core::Workspace> workspaces(num_shards);
+    std::vector<core::Workspace*> workspace_ptrs;
+    for (auto& workspace : workspaces) {
+      workspace_ptrs.push_back(&workspace);
+    }
+    // Twice, as the second call reuses the activations of the first.
+    for (int i = 0; i < 2; ++i) {
+      auto hidden = CopyTo(input, kDLCPU);
+      layer(&hidden, mask, workspace_ptrs);
+      REQUIRE(kernels::common::CheckResultOfCPU<float>(expected, hidden));
+    }
+  }
+}
+
+TEST_CASE("tensor_parallel_bert_layer-uneven",
+          "[tensor_parallel_bert_layer]") {
+  auto weights = CreateWeights(64, 128);
+  REQUIRE_THROWS(TensorParallelBertLayer(weights, 4, kDLCPU, {0, 0, 0}));
+  REQUIRE_THROWS(TensorParallelBertLayer(weights, 4, kDLCPU, {}));
+}
+
+#ifdef TT_WITH_CUDA
+TEST_CASE("tensor_parallel_bert_layer-gpu", "[tensor_parallel_bert_layer]") {
+  using kernels::common::CreateTensorAndFillRandom;
+  const int64_t batch_size = 2, seq_length = 8, hidden_size = 64;
+  const int64_t intermediate_size = 128, num_heads = 4;
+  auto weights = CreateWeights(hidden_size, intermediate_size);
+  auto input = CreateTensorAndFillRandom<float>(
+      {batch_size, seq_length, hidden_size}, kDLCPU, 0);
+  auto mask = CreateTensorAndFillRandom<float>({batch_size, 1, 1, seq_length},
+                                               kDLCPU, 0);
+  auto expected = RunBertLayer(weights, num_heads, input, mask);
+
+  // The shards of a single GPU take the peer copies as well.
+  TensorParallelBertLayer layer(weights, num_heads, kDLGPU, {0, 0});
+  std::vector<core::Workspace> workspaces(2);
+  auto gpu_mask = CopyTo(mask, kDLGPU);
+  auto hidden = CopyTo(input, kDLGPU);
+  layer(&hidden, gpu_mask, {&workspaces[0], &workspaces[1]});
+  REQUIRE(kernels::common::CheckResultOfCPUAndGPU<float>(expected, hidden));
+}
+#endif
+
+}  // namespace layers
+}  // namespace turbo_transformers
@@ -17,7 +17,8 @@ namespace layers {
 namespace types {
 
 enum class ReduceType { kMax = 0, kSum };
-enum class ActivationType { Gelu = 0, Tanh };
+// Identity only adds the bias, e.g. before a residual.
+enum class ActivationType { Gelu = 0, Tanh, Identity };
 enum class PoolType { kMax = 0, kMean, kFirst, kLast };
 }  // namespace types
 }  // namespace layers
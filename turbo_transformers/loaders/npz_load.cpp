@@ -12,3 +12,39 @@
 // See the AUTHORS file for names of contributors.
 
 #include "npz_load.h"
+
+namespace turbo_transformers {
+namespace loaders {
+
+size_t NPZMapView::ByteSize(size_t alignment) const {
+  if (file_ != nullptr) {
+    return file_->ByteSize(prefix_, alignment);
+  }
+  size_t size = 0;
+  for (auto &entry : *npz_) {
+    if (entry.first.rfind(prefix_, 0) != 0) {
+      continue;
+    }
+    size_t bytes = entry.second.word_size;
+    for (auto dim : entry.second.shape) {
+      bytes *= dim;
+    }
+    size += (bytes + alignment - 1) / alignment * alignment;
+  }
+  return size;
+}
+
+NPZMapView OpenWeights(const std::string &filename, cnpy::npz_t *npz) {
+  if (WeightFile::IsWeightFile(filename)) {
+    return NPZMapView("", WeightFile::Open(filename), filename);
+  }
+  if (WeightStore::GetInstance().enabled()) {
+    return NPZMapView("", WeightFile::Open(SharedWeightFile(filename)),
+                      filename);
+  }
+  *npz = cnpy::npz_load(filename);
+  return NPZMapView("", npz, filename);
+}
+
+}  // namespace loaders
+}  // namespace turbo_transformers
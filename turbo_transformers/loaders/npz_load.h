@@ -12,20 +12,35 @@
 // See the AUTHORS file for names of contributors.
 
 #pragma once
+#include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 #include "cnpy.h"
 #include "turbo_transformers/core/tensor_copy.h"
+#include "turbo_transformers/loaders/weight_file.h"
+#include "turbo_transformers/loaders/weight_store.h"
+#include "turbo_transformers/loaders/weight_uploader.h"
 
 namespace turbo_transformers {
 namespace loaders {
 
+// The weights of an npz archive, or of a mapped WeightFile, under a prefix.
+// `source` names the file of the weights in the WeightStore, whose weights
+// are not shared if it is empty.
 class NPZMapView {
  public:
-  NPZMapView(std::string prefix, cnpy::npz_t *npz)
-      : prefix_(std::move(prefix)), npz_(npz) {}
+  NPZMapView(std::string prefix, cnpy::npz_t *npz, std::string source = "")
+      : prefix_(std::move(prefix)), npz_(npz), source_(std::move(source)) {}
+  NPZMapView(std::string prefix, std::shared_ptr<const WeightFile> file,
+             std::string source = "")
+      : prefix_(std::move(prefix)),
+        npz_(nullptr),
+        file_(std::move(file)),
+        source_(std::move(source)) {}
 
   cnpy::NpyArray &operator[](const std::string &key) {
+    TT_ENFORCE(npz_ != nullptr, "The weights are not read from an npz file");
     auto actualKey = prefix_ + key;
     auto it = npz_->find(actualKey);
     TT_ENFORCE(it != npz_->end(), "cannot find parameter %s in npz file",
@@ -34,44 +49,115 @@ class NPZMapView {
   }
 
   NPZMapView Sub(const std::string &subview) {
-    return NPZMapView(prefix_ + subview + ".", npz_);
+    NPZMapView sub(*this);
+    sub.prefix_ = prefix_ + subview + ".";
+    return sub;
   }
 
   bool IsExist(const std::string &subprefix) {
     auto actualPrefix = prefix_ + subprefix;
+    if (file_ != nullptr) {
+      return file_->ContainsPrefix(actualPrefix);
+    }
     for (auto it = npz_->begin(); it != npz_->end(); ++it) {
       if (it->first.rfind(actualPrefix, 0) == 0) return true;
     }
     return false;
   }
 
+  // The bytes of the weights under the prefix, each rounded up to
+  // `alignment`, e.g. the capacity of a WeightUploader loading them.
+  size_t ByteSize(size_t alignment) const;
+
+  // The mapped file of the weights, null for an npz archive.
+  const WeightFile *weight_file() const { return file_.get(); }
+  std::string key(const std::string &name) const { return prefix_ + name; }
+  const std::string &source() const { return source_; }
+
  private:
   std::string prefix_;
   cnpy::npz_t *npz_;
+  std::shared_ptr<const WeightFile> file_;
+  std::string source_;
 };
 
+// Maps `filename` if it is a WeightFile, otherwise reads the npz archive into
+// `npz`, which must outlive the view. With the WeightStore enabled, an npz
+// archive is mapped as its SharedWeightFile instead, and the weights of the
+// view are shared.
+NPZMapView OpenWeights(const std::string &filename, cnpy::npz_t *npz);
+
 class NPZLoader {
  public:
-  NPZLoader(NPZMapView view, DLDeviceType device)
-      : view_(std::move(view)), device_(device) {}
+  // The GPU weights are uploaded by `uploader` if it is given, which must be
+  // of `device_id`.
+  NPZLoader(NPZMapView view, DLDeviceType device, int device_id = 0,
+            WeightUploader *uploader = nullptr)
+      : view_(std::move(view)),
+        device_(device),
+        device_id_(device_id),
+        uploader_(uploader) {}
 
+  // The CPU weights of a WeightFile wrap the mapped data without a copy.
   template <typename T>
   core::Tensor LoadT(const std::string &name) {
+    auto &store = WeightStore::GetInstance();
+    if (view_.source().empty() || !store.enabled()) {
+      return LoadUnsharedT<T>(name);
+    }
+    core::Tensor tensor =
+        store.Get(view_.source(), view_.key(name), device_, device_id_,
+                  [&] { return LoadUnsharedT<T>(name); });
+    TT_ENFORCE(tensor.IsType<T>(), "The parameter %s has another type",
+               view_.key(name));
+    return tensor;
+  }
+
+  core::Tensor LoadFloat(const std::string &name) { return LoadT<float>(name); }
+  core::Tensor operator[](const std::string &name) { return LoadFloat(name); }
+
+ private:
+  template <typename T>
+  core::Tensor LoadUnsharedT(const std::string &name) {
+    if (auto *file = view_.weight_file()) {
+      auto mapped = file->Get(view_.key(name));
+      TT_ENFORCE(mapped.IsType<T>(), "The parameter %s has another type",
+                 view_.key(name));
+      if (device_ == DLDeviceType::kDLCPU) {
+        return mapped;
+      }
+      std::vector<int64_t> shape(mapped.n_dim());
+      for (size_t i = 0; i < shape.size(); ++i) {
+        shape[i] = mapped.shape(i);
+      }
+#ifdef TT_WITH_CUDA
+      if (uploader_ != nullptr) {
+        return uploader_->UploadT(mapped.data<T>(), shape);
+      }
+#endif
+      core::Tensor tensor(
+          core::NewDLPackTensorT<T>(shape, device_, device_id_));
+      core::Copy<T>(mapped, tensor);
+      return tensor;
+    }
     auto &array = view_[name];
     std::vector<int64_t> shape;
     shape.resize(array.shape.size());
     std::copy(array.shape.begin(), array.shape.end(), shape.begin());
-    core::Tensor tensor(core::NewDLPackTensorT<T>(shape, device_));
+#ifdef TT_WITH_CUDA
+    if (uploader_ != nullptr && device_ != DLDeviceType::kDLCPU) {
+      return uploader_->UploadT(array.data<T>(), shape);
+    }
+#endif
+    core::Tensor tensor(core::NewDLPackTensorT<T>(shape, device_, device_id_));
     core::Copy(array.data<T>(), tensor.numel(), DLDeviceType::kDLCPU, tensor);
     return tensor;
   }
 
-  core::Tensor LoadFloat(const std::string &name) { return LoadT<float>(name); }
-  core::Tensor operator[](const std::string &name) { return LoadFloat(name); }
-
- private:
   NPZMapView view_;
   DLDeviceType device_;
+  int device_id_;
+  WeightUploader *uploader_;
 };
 
 }  // namespace loaders
@@ -0,0 +1,251 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/loaders/weight_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+
+#include "turbo_transformers/core/enforce.h"
+
+namespace turbo_transformers {
+namespace loaders {
+
+namespace {
+constexpr char kMagic[8] = {'T', 'T', 'W', 'E', 'I', 'G', 'H', 'T'};
+constexpr uint32_t kVersion = 2;
+
+// Reads the header fields, checking every read against the mapped size.
+class HeaderReader {
+ public:
+  HeaderReader(const char *data, size_t size, const std::string &filename)
+      : data_(data), size_(size), filename_(filename) {}
+
+  template <typename T>
+  T Read() {
+    T value;
+    std::memcpy(&value, Take(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  std::string ReadString(size_t length) {
+    return std::string(Take(length), length);
+  }
+
+  size_t offset() const { return offset_; }
+
+ private:
+  const char *Take(size_t n) {
+    TT_ENFORCE(n <= size_ - offset_, "The weight file %s is truncated",
+               filename_);
+    auto *ptr = data_ + offset_;
+    offset_ += n;
+    return ptr;
+  }
+
+  const char *data_;
+  size_t size_;
+  const std::string &filename_;
+  size_t offset_{0};
+};
+
+template <typename T>
+void Write(std::ofstream &out, T value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+}  // namespace
+
+std::shared_ptr<WeightFile> WeightFile::Open(const std::string &filename) {
+  return std::shared_ptr<WeightFile>(new WeightFile(filename));
+}
+
+bool WeightFile::IsWeightFile(const std::string &filename) {
+  std::ifstream in(filename, std::ios::binary);
+  char magic[sizeof(kMagic)];
+  return in.read(magic, sizeof(magic)) &&
+         std::memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+WeightFile::WeightFile(const std::string &filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  TT_ENFORCE_NE(fd, -1, "Can not open the weight file %s", filename);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    TT_THROW("Can not stat the weight file %s", filename);
+  }
+  size_ = st.st_size;
+  // Private, so that the weights may be changed in place, e.g. by a layer
+  // fusing them, without writing to the file.
+  data_ = size_ == 0 ? MAP_FAILED
+                     : mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE, fd, 0);
+  close(fd);
+  TT_ENFORCE(data_ != MAP_FAILED, "Can not map the weight file %s",
+             filename);
+  try {
+    HeaderReader reader(static_cast<const char *>(data_), size_, filename);
+    TT_ENFORCE(reader.ReadString(sizeof(kMagic)) ==
+                   std::string(kMagic, sizeof(kMagic)),
+               "%s is no weight file", filename);
+    auto version = reader.Read<uint32_t>();
+    TT_ENFORCE(version >= 1 && version <= kVersion,
+               "The weight file %s has the unsupported version %d", filename,
+               version);
+    auto n_weights = reader.Read<uint32_t>();
+    auto n_config = version >= 2 ? reader.Read<uint32_t>() : 0;
+    reader.Read<uint64_t>();
+    for (uint32_t i = 0; i < n_config; ++i) {
+      auto key = reader.ReadString(reader.Read<uint32_t>());
+      config_[key] = reader.ReadString(reader.Read<uint32_t>());
+    }
+    for (uint32_t i = 0; i < n_weights; ++i) {
+      auto name = reader.ReadString(reader.Read<uint32_t>());
+      Entry entry;
+      entry.dtype.code = reader.Read<uint8_t>();
+      entry.dtype.bits = reader.Read<uint8_t>();
+      entry.dtype.lanes = 1;
+      entry.shape.resize(reader.Read<uint16_t>());
+      size_t numel = 1;
+      for (auto &dim : entry.shape) {
+        dim = reader.Read<int64_t>();
+        numel *= dim;
+      }
+      entry.offset = reader.Read<uint64_t>();
+      entry.size = reader.Read<uint64_t>();
+      TT_ENFORCE(entry.size == numel * entry.dtype.bits / 8 &&
+                     entry.offset <= size_ &&
+                     entry.size <= size_ - entry.offset &&
+                     entry.offset % kWeightAlignment == 0,
+                 "The weight %s of %s is corrupted", name, filename);
+      entries_.emplace(std::move(name), std::move(entry));
+    }
+  } catch (...) {
+    munmap(data_, size_);
+    throw;
+  }
+}
+
+WeightFile::~WeightFile() { munmap(data_, size_); }
+
+bool WeightFile::Contains(const std::string &name) const {
+  return entries_.count(name) != 0;
+}
+
+bool WeightFile::ContainsPrefix(const std::string &prefix) const {
+  auto it = entries_.lower_bound(prefix);
+  return it != entries_.end() &&
+         it->first.compare(0, prefix.size(), prefix) == 0;
+}
+
+size_t WeightFile::ByteSize(const std::string &prefix,
+                            size_t alignment) const {
+  size_t size = 0;
+  for (auto it = entries_.lower_bound(prefix);
+       it != entries_.end() && it->first.compare(0, prefix.size(), prefix) == 0;
+       ++it) {
+    size += (it->second.size + alignment - 1) / alignment * alignment;
+  }
+  return size;
+}
+
+const std::string &WeightFile::GetConfig(const std::string &key) const {
+  auto it = config_.find(key);
+  TT_ENFORCE(it != config_.end(), "The weight file has no config %s", key);
+  return it->second;
+}
+
+core::Tensor WeightFile::Get(const std::string &name) const {
+  auto it = entries_.find(name);
+  TT_ENFORCE(it != entries_.end(), "cannot find parameter %s in weight file",
+             name);
+  auto &entry = it->second;
+  // A scalar is stored without dimensions, which DLPack tensors need.
+  auto shape = entry.shape.empty() ? std::vector<int64_t>{1} : entry.shape;
+  return core::Tensor(core::NewDLPackTensorView(
+      static_cast<char *>(data_) + entry.offset, shape, kDLCPU, 0,
+      entry.dtype.code, entry.dtype.bits, entry.dtype.lanes,
+      shared_from_this()));
+}
+
+void SaveWeightFile(
+    const std::string &filename,
+    const std::vector<std::pair<std::string, const core::Tensor *>> &tensors,
+    const std::map<std::string, std::string> &config) {
+  // The header is sized first, the data follow at aligned offsets.
+  uint64_t header_size = sizeof(kMagic) + 3 * sizeof(uint32_t) +
+                         sizeof(uint64_t);
+  for (auto &entry : config) {
+    header_size +=
+        2 * sizeof(uint32_t) + entry.first.size() + entry.second.size();
+  }
+  for (auto &item : tensors) {
+    TT_ENFORCE(item.second->device_type() == kDLCPU,
+               "The weight %s should be on the CPU", item.first);
+    header_size += sizeof(uint32_t) + item.first.size() + 2 * sizeof(uint8_t) +
+                   sizeof(uint16_t) + item.second->n_dim() * sizeof(int64_t) +
+                   2 * sizeof(uint64_t);
+  }
+  auto align = [](uint64_t offset) {
+    return (offset + WeightFile::kWeightAlignment - 1) /
+           WeightFile::kWeightAlignment * WeightFile::kWeightAlignment;
+  };
+
+  std::ofstream out(filename, std::ios::binary);
+  TT_ENFORCE(out.good(), "Can not write the weight file %s", filename);
+  out.write(kMagic, sizeof(kMagic));
+  Write<uint32_t>(out, kVersion);
+  Write<uint32_t>(out, tensors.size());
+  Write<uint32_t>(out, config.size());
+  Write<uint64_t>(out, header_size);
+  for (auto &entry : config) {
+    for (auto *str : {&entry.first, &entry.second}) {
+      Write<uint32_t>(out, str->size());
+      out.write(str->data(), str->size());
+    }
+  }
+  uint64_t offset = align(header_size);
+  for (auto &item : tensors) {
+    auto &tensor = *item.second;
+    auto dtype = tensor.dtype();
+    Write<uint32_t>(out, item.first.size());
+    out.write(item.first.data(), item.first.size());
+    Write<uint8_t>(out, dtype.code);
+    Write<uint8_t>(out, dtype.bits);
+    Write<uint16_t>(out, tensor.n_dim());
+    for (size_t i = 0; i < tensor.n_dim(); ++i) {
+      Write<int64_t>(out, tensor.shape(i));
+    }
+    uint64_t size = tensor.numel() * dtype.bits / 8;
+    Write<uint64_t>(out, offset);
+    Write<uint64_t>(out, size);
+    offset = align(offset + size);
+  }
+  offset = align(header_size);
+  for (auto &item : tensors) {
+    uint64_t size = item.second->numel() * item.second->dtype().bits / 8;
+    std::vector<char> padding(offset - static_cast<uint64_t>(out.tellp()));
+    out.write(padding.data(), padding.size());
+    out.write(static_cast<const char *>(item.second->raw_data()), size);
+    offset = align(offset + size);
+  }
+  TT_ENFORCE(out.good(), "Can not write the weight file %s", filename);
+}
+
+}  // namespace loaders
+}  // namespace turbo_transformers
@@ -0,0 +1,90 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "turbo_transformers/core/tensor.h"
+
+namespace turbo_transformers {
+namespace loaders {
+
+// An uncompressed file of named weights, which is mapped into memory instead
+// of being read. The CPU tensors of Get wrap the mapped bytes, so loading
+// copies nothing, untouched pages are read on demand, and the processes
+// mapping the same file share its pages through the page cache. The weights
+// are stored in the layout the layers run on, e.g. the fused and transposed
+// qkv weights, and a model file carries the config of its model as well.
+//
+// The file starts with the magic "TTWEIGHT", the uint32 version, the uint32
+// number of weights, since version 2 the uint32 number of config entries,
+// and the uint64 end of the header. Every config entry follows as the uint32
+// length and the bytes of its key and of its value. Every weight follows as
+// the uint32 length of its name, the name, the uint8 DLPack type code and
+// bits, the uint16 number of dimensions, the int64 dimensions, and the
+// uint64 offset and size of its data, which starts at a multiple of
+// kWeightAlignment. All numbers are little endian. See SaveWeightFile and
+// tools/weight_file.py.
+class WeightFile : public std::enable_shared_from_this<WeightFile> {
+ public:
+  static constexpr size_t kWeightAlignment = 64;
+
+  static std::shared_ptr<WeightFile> Open(const std::string &filename);
+  // Whether `filename` exists and starts with the magic.
+  static bool IsWeightFile(const std::string &filename);
+  ~WeightFile();
+
+  bool Contains(const std::string &name) const;
+  bool ContainsPrefix(const std::string &prefix) const;
+  // The bytes of the weights under `prefix`, each rounded up to `alignment`.
+  size_t ByteSize(const std::string &prefix, size_t alignment) const;
+
+  // The config of the model, e.g. "num_hidden_layers", empty for a file of
+  // version 1.
+  const std::map<std::string, std::string> &config() const { return config_; }
+  // Throws if the config has no `key`.
+  const std::string &GetConfig(const std::string &key) const;
+
+  // A CPU tensor over the mapped data of `name`, which keeps the mapping
+  // alive. The mapping is private, writing to the tensor copies its pages
+  // instead of changing the file.
+  core::Tensor Get(const std::string &name) const;
+
+ private:
+  struct Entry {
+    DLDataType dtype;
+    std::vector<int64_t> shape;
+    size_t offset;
+    size_t size;
+  };
+
+  explicit WeightFile(const std::string &filename);
+
+  std::map<std::string, Entry> entries_;
+  std::map<std::string, std::string> config_;
+  void *data_{nullptr};
+  size_t size_{0};
+};
+
+// Writes the CPU `tensors` and the `config` of their model to a weight file.
+void SaveWeightFile(
+    const std::string &filename,
+    const std::vector<std::pair<std::string, const core::Tensor *>> &tensors,
+    const std::map<std::string, std::string> &config = {});
+
+}  // namespace loaders
+}  // namespace turbo_transformers
@@ -0,0 +1,145 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/loaders/weight_file.h"
+
+#include <cstdio>
+#include <string>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/loaders/npz_load.h"
+
+namespace turbo_transformers {
+namespace loaders {
+
+TEST_CASE("weight-file-save-and-map", "[weight_file]") {
+  std::string filename = "weight_file_test.bin";
+  core::Tensor weight(nullptr), ids(nullptr);
+  auto *weight_ptr = weight.Reshape<float>({3, 5}, kDLCPU, 0);
+  for (int i = 0; i < 15; ++i) {
+    weight_ptr[i] = i * 0.5f;
+  }
+  auto *ids_ptr = ids.Reshape<int64_t>({7}, kDLCPU, 0);
+  for (int i = 0; i < 7; ++i) {
+    ids_ptr[i] = i - 3;
+  }
+  SaveWeightFile(filename, {{"layer.weight", &weight}, {"ids", &ids}});
+  REQUIRE(WeightFile::IsWeightFile(filename));
+  REQUIRE(!WeightFile::IsWeightFile(filename + ".missing"));
+
+  core::Tensor mapped(nullptr);
+  {
+    auto file = WeightFile::Open(filename);
+    REQUIRE(file->Contains("ids"));
+    REQUIRE(file->ContainsPrefix("layer."));
+    REQUIRE(!file->ContainsPrefix("pooler."));
+    REQUIRE(file->ByteSize("layer.", 1) == 15 * sizeof(float));
+    REQUIRE(file->ByteSize("", 64) == 128);
+    REQUIRE_THROWS(file->Get("bias"));
+    mapped = file->Get("layer.weight");
+    auto mapped_ids = file->Get("ids");
+    REQUIRE(mapped_ids.IsType<int64_t>());
+    REQUIRE(mapped_ids.numel() == 7);
+    REQUIRE(mapped_ids.data<int64_t>()[0] == -3);
+    REQUIRE(reinterpret_cast<uintptr_t>(mapped_ids.data<int64_t>()) %
+                WeightFile::kWeightAlignment ==
+            0);
+  }
+  // The tensor keeps the mapping alive.
+  REQUIRE(mapped.n_dim() == 2);
+  REQUIRE(mapped.shape(0) == 3);
+  REQUIRE(mapped.shape(1) == 5);
+  for (int i = 0; i < 15; ++i) {
+    REQUIRE(mapped.data<float>()[i] == i * 0.5f);
+  }
+
+  // The loader wraps the CPU weights instead of copying them.
+  cnpy::npz_t npz;
+  auto root = OpenWeights(filename, &npz);
+  REQUIRE(root.IsExist("layer"));
+  REQUIRE(root.Sub("layer").ByteSize(1) == 15 * sizeof(float));
+  NPZLoader params(root.Sub("layer"), kDLCPU);
+  auto loaded = params["weight"];
+  REQUIRE(loaded.numel() == 15);
+  REQUIRE(loaded.data<float>()[14] == 7.0f);
+  REQUIRE_THROWS(NPZLoader(root, kDLCPU).LoadT<float>("ids"));
+  std::remove(filename.c_str());
+}
+
+TEST_CASE("weight-file-config", "[weight_file]") {
+  std::string filename = "weight_file_test_config.bin";
+  core::Tensor weight(nullptr);
+  weight.Reshape<float>({2}, kDLCPU, 0)[1] = 1.5f;
+  SaveWeightFile(filename, {{"weight", &weight}},
+                 {{"num_hidden_layers", "12"}, {"hidden_act", "gelu"}});
+  auto file = WeightFile::Open(filename);
+  REQUIRE(file->config().size() == 2);
+  REQUIRE(file->GetConfig("num_hidden_layers") == "12");
+  REQUIRE(file->GetConfig("hidden_act") == "gelu");
+  REQUIRE_THROWS(file->GetConfig("hidden_size"));
+  REQUIRE(file->Get("weight").data<float>()[1] == 1.5f);
+  std::remove(filename.c_str());
+}
+
+template <typename T>
+static void WriteLittleEndian(std::FILE *f, T value) {
+  std::fwrite(&value, sizeof(T), 1, f);
+}
+
+TEST_CASE("weight-file-version-1", "[weight_file]") {
+  // A file of version 1 has no config entries.
+  std::string filename = "weight_file_test_v1.bin";
+  {
+    std::FILE *f = std::fopen(filename.c_str(), "wb");
+    std::fputs("TTWEIGHT", f);
+    WriteLittleEndian<uint32_t>(f, 1);
+    WriteLittleEndian<uint32_t>(f, 1);
+    WriteLittleEndian<uint64_t>(f, 57);
+    WriteLittleEndian<uint32_t>(f, 1);
+    std::fputs("w", f);
+    WriteLittleEndian<uint8_t>(f, kDLFloat);
+    WriteLittleEndian<uint8_t>(f, 32);
+    WriteLittleEndian<uint16_t>(f, 1);
+    WriteLittleEndian<int64_t>(f, 2);
+    WriteLittleEndian<uint64_t>(f, WeightFile::kWeightAlignment);
+    WriteLittleEndian<uint64_t>(f, 2 * sizeof(float));
+    for (size_t i = 57; i < WeightFile::kWeightAlignment; ++i) {
+      WriteLittleEndian<uint8_t>(f, 0);
+    }
+    WriteLittleEndian<float>(f, 0.5f);
+    WriteLittleEndian<float>(f, 2.5f);
+    std::fclose(f);
+  }
+  auto file = WeightFile::Open(filename);
+  REQUIRE(file->config().empty());
+  auto w = file->Get("w");
+  REQUIRE(w.numel() == 2);
+  REQUIRE(w.data<float>()[1] == 2.5f);
+  std::remove(filename.c_str());
+}
+
+TEST_CASE("weight-file-rejects-other-files", "[weight_file]") {
+  std::string filename = "weight_file_test_truncated.bin";
+  {
+    std::FILE *f = std::fopen(filename.c_str(), "wb");
+    std::fputs("TTWEIGHT", f);
+    std::fclose(f);
+  }
+  REQUIRE(WeightFile::IsWeightFile(filename));
+  REQUIRE_THROWS(WeightFile::Open(filename));
+  REQUIRE_THROWS(WeightFile::Open(filename + ".missing"));
+  std::remove(filename.c_str());
+}
+
+}  // namespace loaders
+}  // namespace turbo_transformers
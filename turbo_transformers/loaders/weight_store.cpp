@@ -0,0 +1,148 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/loaders/weight_store.h"
+
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <list>
+#include <utility>
+#include <vector>
+
+#include "cnpy.h"
+#include "turbo_transformers/core/enforce.h"
+#include "turbo_transformers/loaders/weight_file.h"
+
+namespace turbo_transformers {
+namespace loaders {
+
+namespace {
+constexpr const char *kSharedMemoryDir = "/dev/shm";
+
+// A tensor viewing all of `tensor`, which keeps it alive.
+core::Tensor ShareTensor(std::shared_ptr<core::Tensor> tensor) {
+  std::vector<int64_t> shape(tensor->n_dim());
+  for (size_t i = 0; i < shape.size(); ++i) {
+    shape[i] = tensor->shape(i);
+  }
+  auto dtype = tensor->dtype();
+  auto *data = const_cast<void *>(tensor->raw_data());
+  auto device = tensor->device_type();
+  auto device_id = tensor->device_id();
+  return core::Tensor(
+      core::NewDLPackTensorView(data, shape, device, device_id, dtype.code,
+                                dtype.bits, dtype.lanes, std::move(tensor)));
+}
+
+// FNV-1a, which unlike std::hash is the same in every build.
+uint64_t Fingerprint(const std::string &str) {
+  uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : str) {
+    hash = (hash ^ c) * 1099511628211ull;
+  }
+  return hash;
+}
+}  // namespace
+
+void WeightStore::set_enabled(bool enabled) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  enabled_ = enabled;
+}
+
+bool WeightStore::enabled() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return enabled_;
+}
+
+core::Tensor WeightStore::Get(const std::string &source,
+                              const std::string &name, DLDeviceType device,
+                              int device_id,
+                              const std::function<core::Tensor()> &load) {
+  Key key(source, name, device, device_id);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = tensors_.find(key);
+    if (it != tensors_.end()) {
+      if (auto tensor = it->second.lock()) {
+        return ShareTensor(std::move(tensor));
+      }
+      tensors_.erase(it);
+    }
+  }
+  // The load runs unlocked, so the layers of a model load in parallel.
+  auto loaded = std::make_shared<core::Tensor>(load());
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &entry = tensors_[key];
+  if (auto tensor = entry.lock()) {
+    return ShareTensor(std::move(tensor));
+  }
+  entry = loaded;
+  return ShareTensor(std::move(loaded));
+}
+
+bool WeightStore::Contains(const std::string &source, const std::string &name,
+                           DLDeviceType device, int device_id) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = tensors_.find(Key(source, name, device, device_id));
+  return it != tensors_.end() && !it->second.expired();
+}
+
+static std::string SharedWeightFileName(const std::string &filename) {
+  struct stat st;
+  TT_ENFORCE(stat(filename.c_str(), &st) == 0, "Cannot find the file %s",
+             filename);
+  char path[PATH_MAX];
+  std::string id = realpath(filename.c_str(), path) ? path : filename;
+  id += ":" + std::to_string(st.st_size) + ":" + std::to_string(st.st_mtime);
+  char name[64];
+  std::snprintf(name, sizeof(name), "/turbo_transformers_%016llx.ttw",
+                static_cast<unsigned long long>(Fingerprint(id)));
+  return kSharedMemoryDir + std::string(name);
+}
+
+std::string SharedWeightFile(const std::string &filename) {
+  auto shared = SharedWeightFileName(filename);
+  if (WeightFile::IsWeightFile(shared)) {
+    return shared;
+  }
+  auto npz = cnpy::npz_load(filename);
+  std::list<core::Tensor> views;
+  std::vector<std::pair<std::string, const core::Tensor *>> tensors;
+  for (auto &item : npz) {
+    auto &array = item.second;
+    TT_ENFORCE_EQ(array.word_size, sizeof(float),
+                  "Only the float arrays of %s can be shared, not %s",
+                  filename, item.first);
+    std::vector<int64_t> shape(array.shape.begin(), array.shape.end());
+    views.emplace_back(
+        core::NewDLPackTensorViewT<float>(array.data<float>(), shape));
+    tensors.emplace_back(item.first, &views.back());
+  }
+  // The processes converting the archive at once write files of their own,
+  // the complete file replaces the shared one atomically.
+  auto temp = shared + "." + std::to_string(getpid());
+  SaveWeightFile(temp, tensors);
+  TT_ENFORCE(std::rename(temp.c_str(), shared.c_str()) == 0,
+             "Cannot create the shared weight file %s", shared);
+  return shared;
+}
+
+void RemoveSharedWeightFile(const std::string &filename) {
+  std::remove(SharedWeightFileName(filename).c_str());
+}
+
+}  // namespace loaders
+}  // namespace turbo_transformers
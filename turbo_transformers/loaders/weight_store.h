@@ -0,0 +1,77 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+#include "turbo_transformers/core/macros.h"
+#include "turbo_transformers/core/tensor.h"
+
+namespace turbo_transformers {
+namespace loaders {
+
+// Shares the weights among the models of a process. Once enabled, the
+// models loading a weight of the same file onto the same device get views of
+// a single tensor, which lives as long as one of them does, so N replicas of
+// a model hold one copy of its weights. The weights must therefore not be
+// modified after loading. An npz archive is also converted once to a weight
+// file in shared memory, see SharedWeightFile, which the sibling processes
+// map instead of reading the archive; a WeightFile is shared through the
+// page cache already. Sharing is off by default, as the replicas bound to
+// different NUMA nodes want copies of their own.
+class WeightStore {
+ public:
+  static WeightStore &GetInstance() {
+    static WeightStore instance;
+    return instance;
+  }
+
+  void set_enabled(bool enabled);
+  bool enabled() const;
+
+  // The weight `name` of the file `source` on the device, loaded by `load`
+  // unless a model holds it. Threads loading the same weight at once may
+  // both call `load`, only the tensor of the first one is kept.
+  core::Tensor Get(const std::string &source, const std::string &name,
+                   DLDeviceType device, int device_id,
+                   const std::function<core::Tensor()> &load);
+
+  // Whether a model holds the weight.
+  bool Contains(const std::string &source, const std::string &name,
+                DLDeviceType device, int device_id) const;
+
+ private:
+  WeightStore() = default;
+
+  using Key = std::tuple<std::string, std::string, int, int>;
+  mutable std::mutex mutex_;
+  bool enabled_{false};
+  std::map<Key, std::weak_ptr<core::Tensor>> tensors_;
+  DISABLE_COPY_AND_ASSIGN(WeightStore);
+};
+
+// The weight file in shared memory holding the arrays of the npz archive
+// `filename`, which is written by the first process asking for it. It is
+// named after the path, the size and the modification time of the archive,
+// so a changed archive is converted again. The file lives until
+// RemoveSharedWeightFile or a reboot.
+std::string SharedWeightFile(const std::string &filename);
+void RemoveSharedWeightFile(const std::string &filename);
+
+}  // namespace loaders
+}  // namespace turbo_transformers
@@ -0,0 +1,87 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/loaders/weight_store.h"
+
+#include <cstdio>
+#include <string>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/loaders/npz_load.h"
+
+namespace turbo_transformers {
+namespace loaders {
+
+static core::Tensor MakeWeight(float value) {
+  core::Tensor weight(nullptr);
+  auto *data = weight.Reshape<float>({2, 3}, kDLCPU, 0);
+  for (int i = 0; i < 6; ++i) {
+    data[i] = value;
+  }
+  return weight;
+}
+
+TEST_CASE("weight-store-shares-live-weights", "[weight_store]") {
+  auto &store = WeightStore::GetInstance();
+  int n_loads = 0;
+  auto load = [&] {
+    ++n_loads;
+    return MakeWeight(n_loads);
+  };
+  REQUIRE(!store.Contains("model", "w", kDLCPU, 0));
+  {
+    auto a = store.Get("model", "w", kDLCPU, 0, load);
+    auto b = store.Get("model", "w", kDLCPU, 0, load);
+    REQUIRE(n_loads == 1);
+    REQUIRE(a.data<float>() == b.data<float>());
+    REQUIRE(b.shape(1) == 3);
+    REQUIRE(store.Contains("model", "w", kDLCPU, 0));
+    // Another file or device has weights of its own.
+    auto c = store.Get("other", "w", kDLCPU, 0, load);
+    auto d = store.Get("model", "w", kDLCPU, 1, load);
+    REQUIRE(n_loads == 3);
+    REQUIRE(c.data<float>() != a.data<float>());
+    REQUIRE(d.data<float>()[0] == 3.0f);
+  }
+  // The weights are freed with the last model holding them.
+  REQUIRE(!store.Contains("model", "w", kDLCPU, 0));
+  auto e = store.Get("model", "w", kDLCPU, 0, load);
+  REQUIRE(n_loads == 4);
+  REQUIRE(e.data<float>()[0] == 4.0f);
+}
+
+TEST_CASE("weight-store-loader", "[weight_store]") {
+  std::string filename = "weight_store_test.bin";
+  auto weight = MakeWeight(0.5f);
+  SaveWeightFile(filename, {{"layer.weight", &weight}});
+  auto &store = WeightStore::GetInstance();
+  cnpy::npz_t npz;
+  auto load = [&] {
+    return NPZLoader(OpenWeights(filename, &npz), kDLCPU)["layer.weight"];
+  };
+  {
+    auto unshared = load();
+    store.set_enabled(true);
+    auto a = load();
+    auto b = load();
+    store.set_enabled(false);
+    // Every mapping of the file has an address of its own.
+    REQUIRE(unshared.data<float>() != a.data<float>());
+    REQUIRE(a.data<float>() == b.data<float>());
+    REQUIRE(b.data<float>()[5] == 0.5f);
+  }
+  std::remove(filename.c_str());
+}
+
+}  // namespace loaders
+}  // namespace turbo_transformers
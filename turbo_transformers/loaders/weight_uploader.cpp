@@ -0,0 +1,155 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/loaders/weight_uploader.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+
+#include "turbo_transformers/core/cuda_device_context.h"
+#include "turbo_transformers/core/cuda_host_allocator.h"
+#include "turbo_transformers/core/enforce.h"
+#include "turbo_transformers/core/memory.h"
+
+namespace turbo_transformers {
+namespace loaders {
+
+struct WeightUploader::Impl {
+  // A pinned buffer, refilled once the copy recorded by `copied` is done.
+  struct Buffer {
+    explicit Buffer(int device_id) : copied(device_id) {}
+    void *data{nullptr};
+    core::CUDAEvent copied;
+  };
+
+  Impl(int device_id, size_t capacity, size_t n_buffers, size_t buffer_size)
+      : device_id_(device_id),
+        capacity_(capacity),
+        buffer_size_(buffer_size),
+        memory_(std::make_shared<core::Tensor>(
+            core::NewDLPackTensorT<uint8_t>(
+                {static_cast<int64_t>(std::max<size_t>(capacity, 1))},
+                kDLGPU, device_id))) {
+    TT_ENFORCE(n_buffers > 0 && buffer_size > 0,
+               "The uploader needs a staging buffer at least");
+    for (size_t i = 0; i < n_buffers; ++i) {
+      buffers_.emplace_back(new Buffer(device_id));
+      buffers_.back()->data =
+          core::CUDAHostAllocator::GetInstance().allocate(buffer_size);
+      free_buffers_.push_back(buffers_.back().get());
+    }
+  }
+
+  ~Impl() {
+    Finish();
+    for (auto &buffer : buffers_) {
+      core::CUDAHostAllocator::GetInstance().free(buffer->data);
+    }
+  }
+
+  // Takes the buffers round-robin, waiting while all are being filled.
+  Buffer *AcquireBuffer() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return !free_buffers_.empty(); });
+    auto *buffer = free_buffers_.front();
+    free_buffers_.pop_front();
+    return buffer;
+  }
+
+  void ReleaseBuffer(Buffer *buffer) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      free_buffers_.push_back(buffer);
+    }
+    cv_.notify_one();
+  }
+
+  // Copies `size` bytes from the host `src` to the device `dst` through the
+  // buffers.
+  void Copy(char *dst, const char *src, size_t size) {
+    for (size_t begin = 0; begin < size; begin += buffer_size_) {
+      size_t n = std::min(buffer_size_, size - begin);
+      auto *buffer = AcquireBuffer();
+      try {
+        buffer->copied.Synchronize();
+        std::memcpy(buffer->data, src + begin, n);
+        core::CUDAStreamGuard guard(device_id_, kUploadStreamId);
+        core::MemcpyAsync(dst + begin, buffer->data, n,
+                          core::MemcpyFlag::kCPU2GPU, device_id_);
+        buffer->copied.Record();
+      } catch (...) {
+        ReleaseBuffer(buffer);
+        throw;
+      }
+      ReleaseBuffer(buffer);
+    }
+  }
+
+  void Finish() {
+    core::CUDAStreamGuard guard(device_id_, kUploadStreamId);
+    core::CUDADeviceContext::GetInstance().Wait();
+  }
+
+  static constexpr int kUploadStreamId =
+      core::CUDADeviceContext::kUploadStreamId;
+
+  int device_id_;
+  size_t capacity_;
+  size_t buffer_size_;
+  // The allocation of all the weights, a tensor so that it is tracked as
+  // the weights loaded one by one are.
+  std::shared_ptr<core::Tensor> memory_;
+  size_t used_{0};
+  std::vector<std::unique_ptr<Buffer>> buffers_;
+  std::deque<Buffer *> free_buffers_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+};
+
+WeightUploader::WeightUploader(int device_id, size_t capacity,
+                               size_t n_buffers, size_t buffer_size)
+    : m_(new Impl(device_id, capacity, n_buffers, buffer_size)) {}
+
+WeightUploader::~WeightUploader() = default;
+
+core::Tensor WeightUploader::Upload(const void *data,
+                                    const std::vector<int64_t> &shape,
+                                    uint8_t data_type_code, size_t bits) {
+  size_t size = bits / 8;
+  for (auto dim : shape) {
+    size *= dim;
+  }
+  size_t offset;
+  {
+    std::lock_guard<std::mutex> lock(m_->mutex_);
+    offset = m_->used_;
+    TT_ENFORCE_LE(offset + AlignedSize(size), m_->capacity_,
+                  "The weights exceed the %d bytes of the uploader",
+                  m_->capacity_);
+    m_->used_ += AlignedSize(size);
+  }
+  auto *dst = m_->memory_->mutableData<uint8_t>() + offset;
+  m_->Copy(reinterpret_cast<char *>(dst), static_cast<const char *>(data),
+           size);
+  return core::Tensor(core::NewDLPackTensorView(
+      dst, shape, kDLGPU, m_->device_id_, data_type_code, bits, 1,
+      m_->memory_));
+}
+
+void WeightUploader::Finish() { m_->Finish(); }
+
+}  // namespace loaders
+}  // namespace turbo_transformers
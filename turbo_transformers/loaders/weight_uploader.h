@@ -0,0 +1,72 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "turbo_transformers/core/macros.h"
+#include "turbo_transformers/core/tensor.h"
+
+namespace turbo_transformers {
+namespace loaders {
+
+// Uploads the weights of a model to a GPU. The weights share one device
+// allocation of `capacity` bytes instead of a block of core::CUDAAllocator
+// each, and go through a ring of pinned host buffers, from which they are
+// copied asynchronously on the stream kUploadStreamId of the device, so
+// filling a buffer overlaps with the copies of the others.
+//
+// Upload is safe to call from several threads, e.g. loading the layers of a
+// model in parallel, whose copies into the buffers then run concurrently,
+// which also reads the pages of a mapped WeightFile in parallel. The uploaded
+// tensors must not be used before Finish.
+class WeightUploader {
+ public:
+  // Every weight starts at a multiple of kAlignment bytes of the allocation.
+  static constexpr size_t kAlignment = 256;
+
+  WeightUploader(int device_id, size_t capacity, size_t n_buffers = 4,
+                 size_t buffer_size = 4 << 20);
+  // Waits for the uploads.
+  ~WeightUploader();
+
+  // The bytes a weight of `size` bytes takes of the capacity.
+  static size_t AlignedSize(size_t size) {
+    return (size + kAlignment - 1) / kAlignment * kAlignment;
+  }
+
+  // Queues the copy of the host `data` of `shape` and returns its device
+  // tensor, which keeps the allocation alive.
+  core::Tensor Upload(const void *data, const std::vector<int64_t> &shape,
+                      uint8_t data_type_code, size_t bits);
+
+  template <typename T>
+  core::Tensor UploadT(const T *data, const std::vector<int64_t> &shape) {
+    return Upload(data, shape, core::details::DataTypeTrait<T>::DLPackTypeCode,
+                  sizeof(T) * 8);
+  }
+
+  // Blocks until the uploaded tensors are on the device.
+  void Finish();
+
+ private:
+  struct Impl;
+  std::unique_ptr<Impl> m_;
+  DISABLE_COPY_AND_ASSIGN(WeightUploader);
+};
+
+}  // namespace loaders
+}  // namespace turbo_transformers
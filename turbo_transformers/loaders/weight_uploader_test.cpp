@@ -0,0 +1,56 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/loaders/weight_uploader.h"
+
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/core/memory.h"
+
+namespace turbo_transformers {
+namespace loaders {
+
+TEST_CASE("weight-uploader-gpu", "[weight_uploader]") {
+  // Small buffers, so the weights are copied in several chunks.
+  std::vector<float> weight(1000);
+  for (size_t i = 0; i < weight.size(); ++i) {
+    weight[i] = i * 0.25f;
+  }
+  std::vector<int64_t> ids{3, -1, 7};
+  size_t capacity = WeightUploader::AlignedSize(weight.size() * sizeof(float)) +
+                    WeightUploader::AlignedSize(ids.size() * sizeof(int64_t));
+  WeightUploader uploader(0, capacity, 2, 256);
+  auto gpu_weight = uploader.UploadT(weight.data(), {10, 100});
+  auto gpu_ids = uploader.UploadT(ids.data(), {3});
+  REQUIRE_THROWS(uploader.UploadT(ids.data(), {3}));
+  uploader.Finish();
+
+  REQUIRE(gpu_weight.device_type() == kDLGPU);
+  REQUIRE(gpu_weight.shape(0) == 10);
+  REQUIRE(gpu_ids.IsType<int64_t>());
+  REQUIRE(reinterpret_cast<uintptr_t>(gpu_ids.data<int64_t>()) %
+              WeightUploader::kAlignment ==
+          0);
+  std::vector<float> weight_back(weight.size());
+  core::Memcpy(weight_back.data(), gpu_weight.data<float>(),
+               weight.size() * sizeof(float), core::MemcpyFlag::kGPU2CPU);
+  REQUIRE(weight_back == weight);
+  std::vector<int64_t> ids_back(ids.size());
+  core::Memcpy(ids_back.data(), gpu_ids.data<int64_t>(),
+               ids.size() * sizeof(int64_t), core::MemcpyFlag::kGPU2CPU);
+  REQUIRE(ids_back == ids);
+}
+
+}  // namespace loaders
+}  // namespace turbo_transformers
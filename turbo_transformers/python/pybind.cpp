@@ -11,18 +11,39 @@
 // permissions and limitations under the License.
 // See the AUTHORS file for names of contributors.
 
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <vector>
+
 #include "absl/memory/memory.h"
 #include "loguru.hpp"
 #include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
 #include "turbo_transformers/core/blas.h"
 #include "turbo_transformers/core/config.h"
+#include "turbo_transformers/core/cpu_allocator.h"
+#ifdef TT_WITH_CUDA
+#include "turbo_transformers/core/cuda_allocator.h"
+#include "turbo_transformers/core/cuda_device_context.h"
+#include "turbo_transformers/layers/kernels/gpu_gemm_tuner.h"
+#endif
+#include "turbo_transformers/core/memory_tracker.h"
+#include "turbo_transformers/core/metrics.h"
 #include "turbo_transformers/core/profiler.h"
 #include "turbo_transformers/core/tensor.h"
+#include "turbo_transformers/core/workspace.h"
 #include "turbo_transformers/layers/bert_attention.h"
 #include "turbo_transformers/layers/bert_embedding.h"
+#include "turbo_transformers/layers/bert_encoder.h"
 #include "turbo_transformers/layers/bert_intermediate.h"
+#include "turbo_transformers/layers/bert_layer.h"
+#include "turbo_transformers/layers/bert_model.h"
 #include "turbo_transformers/layers/bert_output.h"
 #include "turbo_transformers/layers/bert_pooler.h"
+#include "turbo_transformers/layers/kernels/fused_bert_layer.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+#include "turbo_transformers/layers/kernels/seq_pool.h"
 #include "turbo_transformers/layers/prepare_bert_masks.h"
 #include "turbo_transformers/layers/sequence_pool.h"
 
@@ -44,6 +65,30 @@ static void DLPack_Capsule_Destructor(PyObject *data) {
   }
 }
 
+// The memory tags pushed by the Python code of the calling thread.
+static std::vector<std::unique_ptr<core::MemoryTagGuard>> &PythonMemoryTags() {
+  thread_local std::vector<std::unique_ptr<core::MemoryTagGuard>> tags;
+  return tags;
+}
+
+// The layers release the GIL while they compute, so that the calls of
+// several Python threads run in parallel. A layer may be shared by the
+// threads once it is built and quantized, since its calls hold no mutable
+// state, while a Workspace and the output tensors belong to one call at a
+// time.
+using ReleaseGIL = py::call_guard<py::gil_scoped_release>;
+
+// Wraps a layer method taking a core::Workspace* last, so that two threads
+// passing the same workspace at once raise instead of racing on it.
+template <typename Layer, typename... Args>
+static auto GuardWorkspace(void (Layer::*method)(Args...) const) {
+  return [method](const Layer &layer, Args... args) {
+    core::Workspace::UseGuard guard(
+        std::get<sizeof...(Args) - 1>(std::forward_as_tuple(args...)));
+    (layer.*method)(args...);
+  };
+}
+
 static void BindConfig(py::module &m) {
   py::enum_<core::BlasProvider>(m, "BlasProvider")
       .value("MKL", core::BlasProvider::MKL)
@@ -53,6 +98,63 @@ static void BindConfig(py::module &m) {
       .def("get_blas_provider", &core::GetBlasProvider);
 }
 
+#ifdef TT_WITH_CUDA
+static void BindCUDAAllocator(py::module &m) {
+  py::class_<core::CUDAAllocatorConfig>(m, "CUDAAllocatorConfig")
+      .def(py::init())
+      .def_readwrite("bin_growth", &core::CUDAAllocatorConfig::bin_growth)
+      .def_readwrite("min_bin", &core::CUDAAllocatorConfig::min_bin)
+      .def_readwrite("max_bin", &core::CUDAAllocatorConfig::max_bin)
+      .def_readwrite("max_cached_bytes",
+                     &core::CUDAAllocatorConfig::max_cached_bytes)
+      .def_readwrite("memory_limit", &core::CUDAAllocatorConfig::memory_limit);
+
+  py::class_<core::CUDAMemoryStats>(m, "CUDAMemoryStats")
+      .def_readonly("allocated_bytes", &core::CUDAMemoryStats::allocated_bytes)
+      .def_readonly("cached_bytes", &core::CUDAMemoryStats::cached_bytes)
+      .def_readonly("peak_allocated_bytes",
+                    &core::CUDAMemoryStats::peak_allocated_bytes)
+      .def_readonly("num_device_allocs",
+                    &core::CUDAMemoryStats::num_device_allocs);
+
+  m.def("set_cuda_allocator_config", [](const core::CUDAAllocatorConfig &c) {
+    core::CUDAAllocator::GetInstance().set_config(c);
+  });
+  m.def("get_cuda_allocator_config",
+        [] { return core::CUDAAllocator::GetInstance().config(); });
+  m.def("cuda_memory_stats", [](int device_id) {
+    return core::CUDAAllocator::GetInstance().stats(device_id);
+  });
+  m.def("reset_cuda_peak_memory_stats", [](int device_id) {
+    core::CUDAAllocator::GetInstance().reset_peak_stats(device_id);
+  });
+  m.def("empty_cuda_cache",
+        [] { core::CUDAAllocator::GetInstance().free_all_cache(); });
+  m.def("load_gemm_algo_cache", &layers::kernels::LoadGemmAlgoCache);
+  m.def("save_gemm_algo_cache", &layers::kernels::SaveGemmAlgoCache);
+}
+
+// The streams pushed by the Python code of the calling thread.
+static std::vector<std::unique_ptr<core::CUDAStreamGuard>> &PythonStreams() {
+  thread_local std::vector<std::unique_ptr<core::CUDAStreamGuard>> streams;
+  return streams;
+}
+
+static void BindCUDAStreams(py::module &m) {
+  // `stream` is the handle of a stream of another library, e.g.
+  // torch.cuda.Stream.cuda_stream, see core::CUDADeviceContext.
+  m.def("push_cuda_stream", [](int device_id, uintptr_t stream) {
+    PythonStreams().emplace_back(new core::CUDAStreamGuard(
+        device_id, reinterpret_cast<cudaStream_t>(stream)));
+  });
+  m.def("pop_cuda_stream", [] {
+    auto &streams = PythonStreams();
+    TT_ENFORCE(!streams.empty(), "No CUDA stream to pop");
+    streams.pop_back();
+  });
+}
+#endif
+
 PYBIND11_MODULE(turbo_transformers_cxx, m) {
   char *argv[] = {strdup("turbo_transformers_cxx"), nullptr};
   int argc = 1;
@@ -67,7 +169,85 @@ PYBIND11_MODULE(turbo_transformers_cxx, m) {
         [](int v) { loguru::g_stderr_verbosity = v; });
   m.def("enable_gperf", &core::EnableGperf);
   m.def("disable_gperf", &core::DisableGperf);
+  m.def("enable_profiler", &core::EnableProfiler);
+  m.def("disable_profiler", &core::DisableProfiler);
+  m.def("reset_profiler", &core::ResetProfiler);
+  m.def("get_profile_report", &core::GetProfileReport, ReleaseGIL());
+  m.def("enable_nvtx", &core::EnableNVTX);
+  m.def("disable_nvtx", &core::DisableNVTX);
+  m.def("get_metrics", [] {
+    auto metrics = core::GetMetrics();
+    py::dict result;
+    result["batches"] = metrics.batches;
+    result["sequences"] = metrics.sequences;
+    result["tokens"] = metrics.tokens;
+    result["padded_tokens"] = metrics.padded_tokens;
+    result["allocator_hits"] = metrics.allocator_hits;
+    result["allocator_misses"] = metrics.allocator_misses;
+    result["allocated_bytes"] = metrics.allocated_bytes;
+    result["gemm_flops"] = metrics.gemm_flops;
+    result["predicted_batch_splits"] = metrics.predicted_batch_splits;
+    result["out_of_memory_batch_splits"] = metrics.out_of_memory_batch_splits;
+    result["huge_page_bytes"] = metrics.huge_page_bytes;
+    result["preempting_batches"] = metrics.preempting_batches;
+    result["spilled_batches"] = metrics.spilled_batches;
+    py::dict layer_times;
+    for (auto &layer : metrics.layer_times) {
+      py::dict time;
+      time["calls"] = layer.second.calls;
+      time["total_ms"] = layer.second.total_ms;
+      layer_times[py::str(layer.first)] = time;
+    }
+    result["layer_times"] = layer_times;
+    return result;
+  });
+  m.def("reset_metrics", &core::ResetMetrics);
   m.def("set_num_threads", &core::SetNumThreads);
+  m.def("set_min_parallel_work", &core::SetMinParallelWork);
+  m.def("enable_fused_bert_layer", &layers::kernels::EnableFusedBertLayer);
+  m.def("enable_packing_shared_weights",
+        &layers::kernels::EnablePackingSharedWeights);
+  m.def(
+      "set_huge_pages",
+      [](bool enable, size_t min_bytes) {
+        core::CPUAllocator::GetInstance().set_huge_pages(enable, min_bytes);
+      },
+      py::arg("enable") = true,
+      py::arg("min_bytes") = core::CPUAllocator::kHugePageBytes);
+  m.def("enable_memory_tracking", &core::EnableMemoryTracking);
+  m.def("disable_memory_tracking", &core::DisableMemoryTracking);
+  m.def("reset_memory_tracking", &core::ResetMemoryTracking);
+  m.def("get_memory_report", &core::GetMemoryReport);
+  m.def("get_memory_usages", [] {
+    py::list usages;
+    for (auto &usage : core::GetMemoryUsages()) {
+      py::dict item;
+      item["tag"] = usage.tag;
+      item["device_type"] = usage.device_type == kDLGPU
+                                ? "gpu"
+                                : usage.device_type == kDLCPUPinned
+                                      ? "cpu_pinned"
+                                      : "cpu";
+      item["device_id"] = usage.device_id;
+      item["live_bytes"] = usage.live_bytes;
+      item["peak_live_bytes"] = usage.peak_live_bytes;
+      item["num_allocs"] = usage.num_allocs;
+      usages.append(item);
+    }
+    return usages;
+  });
+  m.def("push_memory_tag", [](const std::string &tag) {
+    PythonMemoryTags().emplace_back(new core::MemoryTagGuard(tag));
+  });
+  m.def("pop_memory_tag", [] {
+    auto &tags = PythonMemoryTags();
+    TT_ENFORCE(!tags.empty(), "No memory tag to pop");
+    tags.pop_back();
+  });
+#ifdef TT_WITH_CUDA
+  BindCUDAAllocator(m);
+  BindCUDAStreams(m);
+#endif
 
   py::class_<core::Tensor>(m, "Tensor")
       .def_static("from_dlpack",
@@ -81,12 +261,25 @@ PYBIND11_MODULE(turbo_transformers_cxx, m) {
              auto *dlpack = tensor.ToDLPack();
              return py::capsule(dlpack, "dltensor", DLPack_Capsule_Destructor);
            })
+      .def("to_dlpack_view",
+           [](const core::Tensor &tensor) -> py::capsule {
+             auto *dlpack = tensor.ToDLPackView();
+             return py::capsule(dlpack, "dltensor", DLPack_Capsule_Destructor);
+           })
+      .def("to_shared_dlpack",
+           [](core::Tensor &tensor) -> py::capsule {
+             auto *dlpack = tensor.ToSharedDLPack();
+             return py::capsule(dlpack, "dltensor", DLPack_Capsule_Destructor);
+           })
       .def("n_dim", &core::Tensor::n_dim)
       .def("shape", &core::Tensor::shape)
       .def("float_data", &core::Tensor::data<float>)
       .def_static("create_empty", [] { return core::Tensor(nullptr); });
 
-  py::class_<layers::BERTEmbedding>(m, "BERTEmbedding")
+  py::class_<core::Workspace>(m, "Workspace").def(py::init());
+
+  py::class_<layers::BERTEmbedding, std::shared_ptr<layers::BERTEmbedding>>(
+      m, "BERTEmbedding")
       .def(py::init(
           [](core::Tensor &word_embeddings, core::Tensor &position_embeddings,
              core::Tensor &token_type_embeddings,
@@ -97,9 +290,14 @@ PYBIND11_MODULE(turbo_transformers_cxx, m) {
                 std::move(token_type_embeddings), std::move(layer_norm_weights),
                 std::move(layer_norm_bias));
           }))
-      .def("__call__", &layers::BERTEmbedding::operator());
+      .def("__call__", &layers::BERTEmbedding::operator(), ReleaseGIL());
+
+  py::enum_<layers::kernels::WeightOnlyType>(m, "WeightOnlyType")
+      .value("FP16", layers::kernels::WeightOnlyType::kFP16)
+      .value("Int8", layers::kernels::WeightOnlyType::kInt8);
 
-  py::class_<layers::BertAttention>(m, "BertAttention")
+  py::class_<layers::BertAttention, std::shared_ptr<layers::BertAttention>>(
+      m, "BertAttention")
       .def(py::init([](core::Tensor &qkv_weight, core::Tensor &qkv_bias,
                        core::Tensor &dense_weight, core::Tensor &dense_bias,
                        core::Tensor &layer_norm_weight,
@@ -110,17 +308,37 @@ PYBIND11_MODULE(turbo_transformers_cxx, m) {
             std::move(dense_bias), std::move(layer_norm_weight),
             std::move(layer_norm_bias), num_attention_heads);
       }))
-      .def("__call__", &layers::BertAttention::operator());
+      .def("__call__", GuardWorkspace(&layers::BertAttention::operator()),
+           py::arg("input_tensor"), py::arg("attention_mask"),
+           py::arg("output"), py::arg("workspace") = nullptr, ReleaseGIL())
+      .def("run_with_seq_lens",
+           GuardWorkspace(&layers::BertAttention::RunWithSeqLens),
+           py::arg("input_tensor"), py::arg("seq_lens"), py::arg("output"),
+           py::arg("workspace") = nullptr, ReleaseGIL())
+      .def("run_packed", GuardWorkspace(&layers::BertAttention::RunPacked),
+           py::arg("input_tensor"), py::arg("seq_offsets"), py::arg("output"),
+           py::arg("workspace") = nullptr, ReleaseGIL())
+      .def("quantize", &layers::BertAttention::Quantize)
+      .def("convert_to_bf16", &layers::BertAttention::ConvertToBF16)
+      .def("compress_weights", &layers::BertAttention::CompressWeights,
+           py::arg("type"));
 
-  py::class_<layers::BertIntermediate>(m, "BertIntermediate")
+  py::class_<layers::BertIntermediate,
+             std::shared_ptr<layers::BertIntermediate>>(m,
+                                                        "BertIntermediate")
       .def(py::init([](core::Tensor &dense_weight,
                        core::Tensor &dense_bias) -> layers::BertIntermediate * {
         return new layers::BertIntermediate(std::move(dense_weight),
                                             std::move(dense_bias));
       }))
-      .def("__call__", &layers::BertIntermediate::operator());
+      .def("__call__", &layers::BertIntermediate::operator(), ReleaseGIL())
+      .def("quantize", &layers::BertIntermediate::Quantize)
+      .def("convert_to_bf16", &layers::BertIntermediate::ConvertToBF16)
+      .def("compress_weights", &layers::BertIntermediate::CompressWeights,
+           py::arg("type"));
 
-  py::class_<layers::BertOutput>(m, "BertOutput")
+  py::class_<layers::BertOutput, std::shared_ptr<layers::BertOutput>>(
+      m, "BertOutput")
       .def(py::init([](core::Tensor &dense_weight, core::Tensor &dense_bias,
                        core::Tensor &layer_norm_weight,
                        core::Tensor &layer_norm_bias) -> layers::BertOutput * {
@@ -128,13 +346,126 @@ PYBIND11_MODULE(turbo_transformers_cxx, m) {
             std::move(dense_weight), std::move(dense_bias),
             std::move(layer_norm_weight), std::move(layer_norm_bias));
       }))
-      .def("__call__", &layers::BertOutput::operator());
+      .def("__call__", &layers::BertOutput::operator(), ReleaseGIL())
+      .def("quantize", &layers::BertOutput::Quantize)
+      .def("convert_to_bf16", &layers::BertOutput::ConvertToBF16)
+      .def("compress_weights", &layers::BertOutput::CompressWeights,
+           py::arg("type"));
+
+  py::class_<layers::BertLayer, std::shared_ptr<layers::BertLayer>>(
+      m, "BertLayer")
+      .def(py::init<std::shared_ptr<layers::BertAttention>,
+                    std::shared_ptr<layers::BertIntermediate>,
+                    std::shared_ptr<layers::BertOutput>>())
+      .def("__call__", GuardWorkspace(&layers::BertLayer::operator()),
+           py::arg("input_tensor"), py::arg("attention_mask"),
+           py::arg("output"), py::arg("seq_offsets") = nullptr,
+           py::arg("workspace") = nullptr, ReleaseGIL())
+      .def("quantize", &layers::BertLayer::Quantize)
+      .def("convert_to_bf16", &layers::BertLayer::ConvertToBF16)
+      .def("compress_weights", &layers::BertLayer::CompressWeights,
+           py::arg("type"));
+
+  py::class_<layers::BertEncoder, std::shared_ptr<layers::BertEncoder>>(
+      m, "BertEncoder")
+      .def(py::init<std::vector<std::shared_ptr<layers::BertLayer>>>())
+      .def("__call__", GuardWorkspace(&layers::BertEncoder::operator()),
+           py::arg("input_tensor"), py::arg("attention_mask"),
+           py::arg("output"), py::arg("seq_offsets") = nullptr,
+           py::arg("workspace") = nullptr, ReleaseGIL())
+      .def("quantize", &layers::BertEncoder::Quantize)
+      .def("convert_to_bf16", &layers::BertEncoder::ConvertToBF16)
+      .def("compress_weights", &layers::BertEncoder::CompressWeights,
+           py::arg("type"));
+
+  py::class_<layers::BertModel>(m, "BertModel")
+      .def(py::init<std::shared_ptr<layers::BERTEmbedding>,
+                    std::shared_ptr<layers::BertEncoder>>())
+      .def(
+          "__call__",
+          [](const layers::BertModel &model, const core::Tensor &input_ids,
+             core::Tensor &attention_mask, core::Tensor &token_type_ids,
+             core::Tensor &position_ids, const std::string &pool_type,
+             core::Tensor &hidden, core::Tensor &output,
+             const core::Tensor *seq_offsets, core::Workspace *workspace) {
+            core::Workspace::UseGuard guard(workspace);
+            model(input_ids, &attention_mask, &token_type_ids, &position_ids,
+                  layers::kernels::GetPoolType(pool_type), &hidden, &output,
+                  seq_offsets, workspace);
+          },
+          py::arg("input_ids"), py::arg("attention_mask"),
+          py::arg("token_type_ids"), py::arg("position_ids"),
+          py::arg("pool_type"), py::arg("hidden"), py::arg("output"),
+          py::arg("seq_offsets") = nullptr, py::arg("workspace") = nullptr,
+          ReleaseGIL())
+      .def(
+          "run_packed",
+          [](const layers::BertModel &model,
+             const std::vector<int64_t> &input_ids,
+             const std::vector<int64_t> &seq_offsets,
+             const std::string &pool_type, core::Tensor &hidden,
+             core::Tensor &output, core::Workspace *workspace) {
+            core::Workspace::UseGuard guard(workspace);
+            model.RunPacked(input_ids, seq_offsets,
+                            layers::kernels::GetPoolType(pool_type), &hidden,
+                            &output, workspace);
+          },
+          py::arg("input_ids"), py::arg("seq_offsets"), py::arg("pool_type"),
+          py::arg("hidden"), py::arg("output"), py::arg("workspace") = nullptr,
+          ReleaseGIL())
+      .def(
+          "run_packed",
+          [](const layers::BertModel &model,
+             const std::vector<std::vector<int64_t>> &sequences,
+             const std::string &pool_type, core::Tensor &hidden,
+             core::Tensor &output, core::Workspace *workspace) {
+            core::Workspace::UseGuard guard(workspace);
+            std::vector<int64_t> input_ids, seq_offsets{0};
+            for (auto &ids : sequences) {
+              input_ids.insert(input_ids.end(), ids.begin(), ids.end());
+              seq_offsets.push_back(static_cast<int64_t>(input_ids.size()));
+            }
+            model.RunPacked(input_ids, seq_offsets,
+                            layers::kernels::GetPoolType(pool_type), &hidden,
+                            &output, workspace);
+          },
+          py::arg("sequences"), py::arg("pool_type"), py::arg("hidden"),
+          py::arg("output"), py::arg("workspace") = nullptr, ReleaseGIL())
+      .def(
+          "warm_up",
+          [](const layers::BertModel &model,
+             const std::vector<std::pair<int64_t, int64_t>> &shapes,
+             const std::string &pool_type, core::Workspace *workspace) {
+            core::Workspace::UseGuard guard(workspace);
+            model.WarmUp(shapes, layers::kernels::GetPoolType(pool_type),
+                         workspace);
+          },
+          py::arg("shapes"), py::arg("pool_type") = "First",
+          py::arg("workspace") = nullptr, ReleaseGIL())
+      .def(
+          "reserve",
+          [](const layers::BertModel &model, int64_t max_batch_size,
+             int64_t max_seq_len, core::Workspace *workspace) {
+            core::Workspace::UseGuard guard(workspace);
+            model.Reserve(max_batch_size, max_seq_len, workspace);
+          },
+          py::arg("max_batch_size"), py::arg("max_seq_len"),
+          py::arg("workspace") = nullptr, ReleaseGIL())
+      .def("quantize", &layers::BertModel::Quantize)
+      .def("convert_to_bf16", &layers::BertModel::ConvertToBF16)
+      .def("compress_weights", &layers::BertModel::CompressWeights,
+           py::arg("type"));
 
   py::class_<layers::SequencePool>(m, "SequencePool")
       .def(py::init([](const std::string &pool_type) -> layers::SequencePool * {
         return new layers::SequencePool(pool_type);
       }))
-      .def("__call__", &layers::SequencePool::operator());
+      .def("__call__", &layers::SequencePool::operator(),
+           py::arg("input_tensor"), py::arg("output"),
+           py::arg("seq_lens") = nullptr, ReleaseGIL())
+      .def("run_packed", &layers::SequencePool::RunPacked,
+           py::arg("input_tensor"), py::arg("seq_offsets"), py::arg("output"),
+           ReleaseGIL());
 
   py::class_<layers::BertPooler>(m, "BertPooler")
       .def(py::init([](core::Tensor &dense_weight,
@@ -142,11 +473,11 @@ PYBIND11_MODULE(turbo_transformers_cxx, m) {
         return new layers::BertPooler(std::move(dense_weight),
                                       std::move(dense_bias));
       }))
-      .def("__call__", &layers::BertPooler::operator());
+      .def("__call__", &layers::BertPooler::operator(), ReleaseGIL());
 
   py::class_<layers::PrepareBertMasks>(m, "PrepareBertMasks")
       .def(py::init())
-      .def("__call__", &layers::PrepareBertMasks::operator());
+      .def("__call__", &layers::PrepareBertMasks::operator(), ReleaseGIL());
 }
 
 }  // namespace python
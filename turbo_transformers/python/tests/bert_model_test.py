@@ -101,6 +101,60 @@ class TestBertModel(unittest.TestCase):
                            atol=atol,
                            rtol=rtol))
 
+    def check_ragged(self, use_cuda):
+        self.init_data(use_cuda)
+        sequences = [[
+            int(i) for i in torch.randint(
+                low=0, high=self.cfg.vocab_size - 1, size=(length, ))
+        ] for length in (7, 3, 12)]
+        ragged_output, _ = self.turbo_model.run_ragged(sequences)
+        for b, ids in enumerate(sequences):
+            input_ids = torch.tensor([ids],
+                                     dtype=torch.long,
+                                     device=self.test_device)
+            output, _ = self.turbo_model(input_ids)
+            self.assertTrue(
+                numpy.allclose(ragged_output[b].cpu().numpy(),
+                               output[0].cpu().numpy(),
+                               atol=1e-3))
+
+    def check_warm_up(self, use_cuda):
+        self.init_data(use_cuda)
+        input_ids = torch.randint(low=0,
+                                  high=self.cfg.vocab_size - 1,
+                                  size=(2, 10),
+                                  dtype=torch.long,
+                                  device=self.test_device)
+        expected, _ = self.turbo_model(input_ids)
+        self.turbo_model.warm_up([(1, 10), (3, 16)])
+        self.turbo_model.reserve(4, 20)
+        output, _ = self.turbo_model(input_ids)
+        self.assertTrue(
+            numpy.allclose(expected.cpu().numpy(),
+                           output.cpu().numpy(),
+                           atol=1e-5))
+
+    def check_cuda_stream(self):
+        self.init_data(use_cuda=True)
+        input_ids = torch.randint(low=0,
+                                  high=self.cfg.vocab_size - 1,
+                                  size=(2, 16),
+                                  dtype=torch.long,
+                                  device=self.test_device)
+        expected, _ = self.turbo_model(input_ids)
+        expected = expected.cpu().numpy()
+        # torch writes the input, and reads the output, on the stream the
+        # model runs on, without a synchronization in between.
+        stream = torch.cuda.Stream()
+        with torch.cuda.stream(stream), \
+                turbo_transformers.cuda_stream_guard():
+            stream_input_ids = input_ids.clone()
+            output, _ = self.turbo_model(stream_input_ids)
+            doubled = output * 2
+        stream.synchronize()
+        self.assertTrue(
+            numpy.allclose(expected * 2, doubled.cpu().numpy(), atol=1e-5))
+
     def test_bert_model(self):
         if torch.cuda.is_available() and \
             turbo_transformers.config.is_compiled_with_cuda():
@@ -109,6 +163,23 @@ class TestBertModel(unittest.TestCase):
         self.check_torch_and_turbo(use_cuda=False, use_pooler=False)
         self.check_torch_and_turbo(use_cuda=False, use_pooler=True)
 
+    def test_ragged(self):
+        if torch.cuda.is_available() and \
+            turbo_transformers.config.is_compiled_with_cuda():
+            self.check_ragged(use_cuda=True)
+        self.check_ragged(use_cuda=False)
+
+    def test_cuda_stream(self):
+        if torch.cuda.is_available() and \
+            turbo_transformers.config.is_compiled_with_cuda():
+            self.check_cuda_stream()
+
+    def test_warm_up(self):
+        if torch.cuda.is_available() and \
+            turbo_transformers.config.is_compiled_with_cuda():
+            self.check_warm_up(use_cuda=True)
+        self.check_warm_up(use_cuda=False)
+
 
 if __name__ == '__main__':
     unittest.main()
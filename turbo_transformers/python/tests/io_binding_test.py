@@ -0,0 +1,92 @@
+# Copyright (C) 2020 THL A29 Limited, a Tencent company.
+# All rights reserved.
+# Licensed under the BSD 3-Clause License (the "License"); you may
+# not use this file except in compliance with the License. You may
+# obtain a copy of the License at
+# https://opensource.org/licenses/BSD-3-Clause
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" basis,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+# implied. See the License for the specific language governing
+# permissions and limitations under the License.
+# See the AUTHORS file for names of contributors.
+
+import unittest
+import torch
+from transformers.modeling_bert import BertModel, BertConfig
+import numpy
+import turbo_transformers
+
+
+class TestIOBinding(unittest.TestCase):
+    def check_io_binding(self, use_cuda):
+        torch.set_grad_enabled(False)
+        test_device = torch.device('cuda:0') if use_cuda else \
+            torch.device('cpu:0')
+        cfg = BertConfig(num_hidden_layers=2)
+        torch_model = BertModel(cfg)
+        torch_model.eval()
+        torch_model.to(test_device)
+        turbo_model = turbo_transformers.BertModel.from_torch(
+            torch_model, test_device)
+
+        input_ids = torch.randint(low=0,
+                                  high=cfg.vocab_size - 1,
+                                  size=(2, 16),
+                                  dtype=torch.long,
+                                  device=test_device)
+        binding = turbo_transformers.IOBinding(turbo_model)
+        binding.bind_inputs(input_ids)
+        output, hidden = binding.run()
+        expected_output, expected_hidden = turbo_model(input_ids)
+        self.assertTrue(
+            numpy.allclose(output.cpu().numpy(),
+                           expected_output.cpu().numpy(),
+                           atol=1e-5))
+
+        # New ids in the bound input run in the same output memory.
+        input_ids.copy_(torch.randint_like(input_ids, cfg.vocab_size - 1))
+        data_ptr = output.data_ptr()
+        output2, hidden2 = binding.run()
+        self.assertEqual(output2.data_ptr(), data_ptr)
+        self.assertEqual(hidden2.data_ptr(), hidden.data_ptr())
+        expected_output, expected_hidden = turbo_model(input_ids)
+        self.assertTrue(
+            numpy.allclose(hidden2.cpu().numpy(),
+                           expected_hidden.cpu().numpy(),
+                           atol=1e-5))
+
+        # Larger inputs reallocate the outputs, the views of the previous
+        # runs keep their memory.
+        kept_output = output2.clone()
+        larger_ids = torch.randint(low=0,
+                                   high=cfg.vocab_size - 1,
+                                   size=(4, 32),
+                                   dtype=torch.long,
+                                   device=test_device)
+        binding.bind_inputs(larger_ids)
+        output3, hidden3 = binding.run()
+        self.assertEqual(tuple(hidden3.shape), (4, 32, cfg.hidden_size))
+        self.assertTrue(torch.equal(output2, kept_output))
+        expected_output, expected_hidden = turbo_model(larger_ids)
+        self.assertTrue(
+            numpy.allclose(output3.cpu().numpy(),
+                           expected_output.cpu().numpy(),
+                           atol=1e-5))
+
+        # The views outlive the binding.
+        del binding
+        self.assertTrue(
+            numpy.allclose(hidden3.cpu().numpy(),
+                           expected_hidden.cpu().numpy(),
+                           atol=1e-5))
+
+    def test_io_binding(self):
+        if torch.cuda.is_available() and \
+            turbo_transformers.config.is_compiled_with_cuda():
+            self.check_io_binding(use_cuda=True)
+        self.check_io_binding(use_cuda=False)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -14,6 +14,7 @@
 from .modeling_bert import BertEmbeddings, BertIntermediate, BertOutput, BertAttention, BertLayer, SequencePool, \
     BertEncoder, BertModel, PoolingType, BertPooler, BertModelWithPooler
 from .return_type import ReturnType
+from .io_binding import IOBinding
 
 __all__ = [
     'BertEmbeddings',
@@ -28,4 +29,5 @@ __all__ = [
     'SequencePool',
     'PoolingType',
     'BertModelWithPooler',
+    'IOBinding',
 ]
@@ -0,0 +1,103 @@
+# Copyright (C) 2020 THL A29 Limited, a Tencent company.
+# All rights reserved.
+# Licensed under the BSD 3-Clause License (the "License"); you may
+# not use this file except in compliance with the License. You may
+# obtain a copy of the License at
+# https://opensource.org/licenses/BSD-3-Clause
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" basis,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+# implied. See the License for the specific language governing
+# permissions and limitations under the License.
+# See the AUTHORS file for names of contributors.
+
+try:
+    # `turbo_transformers_cxxd` is the name on debug mode
+    import turbo_transformers.turbo_transformers_cxxd as cxx
+except ImportError:
+    import turbo_transformers.turbo_transformers_cxx as cxx
+from typing import Optional, Sequence
+import torch
+import torch.utils.dlpack as dlpack
+import numpy as np
+
+from .modeling_bert import BertModel, PoolingType, PoolingMap, AnyTensor, \
+    _try_convert, _create_empty_if_none
+from .return_type import ReturnType
+
+__all__ = ['IOBinding']
+
+
+# Persistent input and output buffers of a BertModel. The inputs are bound
+# once and used in place, so the caller updates their contents between the
+# runs, e.g. by `copy_`. Every run writes the outputs into the same memory and
+# returns torch views of it, so a run of the bound shapes neither allocates
+# nor converts a tensor. The views are overwritten by the next run, clone()
+# keeps them. The views share the ownership of the memory, so they stay
+# valid once a run of larger shapes reallocates the outputs or the binding is
+# collected. A binding owns the workspace of its runs, so it belongs to one
+# thread at a time.
+class IOBinding:
+    def __init__(self,
+                 model: BertModel,
+                 pooling_type: PoolingType = PoolingType.FIRST):
+        self.model = model
+        self._pool_type = PoolingMap[pooling_type]
+        self._workspace = cxx.Workspace()
+        self._output = cxx.Tensor.create_empty()
+        self._hidden = cxx.Tensor.create_empty()
+        self._inputs = None
+        self._seq_offsets = None
+        self._views = {}
+
+    def bind_inputs(self,
+                    inputs: AnyTensor,
+                    attention_masks: Optional[AnyTensor] = None,
+                    token_type_ids: Optional[AnyTensor] = None,
+                    position_ids: Optional[AnyTensor] = None,
+                    seq_lens: Optional[Sequence[int]] = None):
+        # The unbound masks, token types and positions take their defaults at
+        # the first run and keep them. seq_lens binds packed sequences, see
+        # BertModel.
+        if seq_lens is not None:
+            self._seq_offsets = _try_convert(
+                torch.tensor(np.cumsum([0] + [int(l) for l in seq_lens]),
+                             dtype=torch.int64))
+            inputs = inputs.reshape(1, -1)
+            attention_masks = None
+        else:
+            self._seq_offsets = None
+        # The converted tensors share the memory of the torch ones.
+        self._inputs = [
+            _try_convert(_create_empty_if_none(t))
+            for t in (inputs, attention_masks, token_type_ids, position_ids)
+        ]
+
+    def run(self, return_type: Optional[ReturnType] = None):
+        if self._inputs is None:
+            raise RuntimeError("No inputs are bound")
+        input_ids, attention_masks, token_type_ids, position_ids = \
+            self._inputs
+        self.model.model(input_ids,
+                         attention_masks,
+                         token_type_ids,
+                         position_ids,
+                         self._pool_type,
+                         self._hidden,
+                         self._output,
+                         seq_offsets=self._seq_offsets,
+                         workspace=self._workspace)
+        if return_type == ReturnType.turbo_transformers:
+            return self._output, self._hidden
+        return self._view('output', self._output), \
+            self._view('hidden', self._hidden)
+
+    # A torch view of an output, created again only once a run reshaped it,
+    # since an output is reallocated only for more elements.
+    def _view(self, name: str, tensor: cxx.Tensor) -> torch.Tensor:
+        shape = tuple(tensor.shape(i) for i in range(tensor.n_dim()))
+        cached = self._views.get(name)
+        if cached is None or cached[0] != shape:
+            cached = (shape, dlpack.from_dlpack(tensor.to_shared_dlpack()))
+            self._views[name] = cached
+        return cached[1]
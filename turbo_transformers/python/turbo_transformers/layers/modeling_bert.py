@@ -39,6 +39,11 @@ __all__ = [
     'BertPooler', 'BertModelWithPooler'
 ]
 
+# The layers release the GIL while they run natively, so the threads of a
+# server may share a model and call it in parallel. Each thread passes output
+# tensors and workspaces of its own, a workspace used by two calls at once
+# raises. A model is quantized before it is shared.
+
 
 def _try_convert(t):
     if isinstance(t, torch.Tensor):
@@ -68,6 +73,20 @@ def _create_empty_if_none(output):
     return output if output is not None else cxx.Tensor.create_empty()
 
 
+def _get_weight_only_type(weight_type: str):
+    types = {'fp16': cxx.WeightOnlyType.FP16, 'int8': cxx.WeightOnlyType.Int8}
+    if weight_type not in types:
+        raise ValueError("weight_type should be 'fp16' or 'int8', not '%s'" %
+                         weight_type)
+    return types[weight_type]
+
+
+def _to_id_list(ids):
+    if isinstance(ids, (torch.Tensor, np.ndarray)):
+        return ids.tolist()
+    return ids
+
+
 AnyTensor = Union[cxx.Tensor, torch.Tensor]
 
 
@@ -119,7 +138,8 @@ class BertIntermediate(cxx.BertIntermediate):
     @staticmethod
     def from_torch(intermediate: TorchBertIntermediate):
         intermediate_params = _to_param_dict_naive(intermediate)
-        weight = torch.clone(torch.t(intermediate_params["dense.weight"]))
+        # The transposed weight is passed as a strided view, without a copy.
+        weight = torch.t(intermediate_params["dense.weight"])
         return BertIntermediate(
             convert2tt_tensor(weight),
             convert2tt_tensor(intermediate_params['dense.bias']))
@@ -150,8 +170,7 @@ class BertOutput(cxx.BertOutput):
     @staticmethod
     def from_torch(output: TorchBertOutput):
         params = _to_param_dict_naive(output)
-        weight = convert2tt_tensor(torch.clone(torch.t(
-            params["dense.weight"])))
+        weight = convert2tt_tensor(torch.t(params["dense.weight"]))
         return BertOutput(weight, convert2tt_tensor(params["dense.bias"]),
                           convert2tt_tensor(params["LayerNorm.weight"]),
                           convert2tt_tensor(params["LayerNorm.bias"]))
@@ -173,12 +192,22 @@ class BertAttention(cxx.BertAttention):
                  input_tensor: AnyTensor,
                  attention_mask: AnyTensor,
                  return_type: Optional[ReturnType] = None,
-                 output: Optional[cxx.Tensor] = None):
+                 output: Optional[cxx.Tensor] = None,
+                 workspace: Optional[cxx.Workspace] = None,
+                 seq_offsets: Optional[AnyTensor] = None):
+        # seq_offsets: for the packed tokens [1, total_tokens, hidden_size] of
+        # several sequences without padding, the int64 CPU prefix sums of
+        # their lengths [batch_size + 1]. The attention_mask is unused then.
         input_tensor = _try_convert(input_tensor)
-        attention_mask = _try_convert(attention_mask)
         output = _create_empty_if_none(output)
+        if seq_offsets is not None:
+            super(BertAttention,
+                  self).run_packed(input_tensor, _try_convert(seq_offsets),
+                                   output, workspace)
+            return convert_returns_as_type(output, return_type)
+        attention_mask = _try_convert(attention_mask)
         super(BertAttention, self).__call__(input_tensor, attention_mask,
-                                            output)
+                                            output, workspace)
         return convert_returns_as_type(output, return_type)
 
     @staticmethod
@@ -187,16 +216,15 @@ class BertAttention(cxx.BertAttention):
 
         with torch.no_grad():
             # merge self.query.weight, self.query.weight and self.query.weight together as qkv.weight
-            qkv_weight = torch.clone(
-                torch.t(
-                    torch.cat((params['self.query.weight'],
-                               params['self.key.weight'],
-                               params['self.value.weight']), 0)))
+            qkv_weight = torch.t(
+                torch.cat((params['self.query.weight'],
+                           params['self.key.weight'],
+                           params['self.value.weight']), 0))
             qkv_bias = torch.cat(
                 (params['self.query.bias'], params['self.key.bias'],
                  params['self.value.bias']), 0)
 
-            output_weight = torch.clone(torch.t(params['output.dense.weight']))
+            output_weight = torch.t(params['output.dense.weight'])
             att = BertAttention(
                 convert2tt_tensor(qkv_weight), convert2tt_tensor(qkv_bias),
                 convert2tt_tensor(output_weight),
@@ -210,8 +238,14 @@ class BertAttention(cxx.BertAttention):
     @staticmethod
     def from_npz(file_name: str, layer_num: int, num_attention_heads: int):
         f = np.load(file_name)
+        qkv_weight = f[f'encoder.layer.{layer_num}.attention.qkv.weight']
+        # num_attention_heads are the heads of an unpruned layer, a head-pruned
+        # layer keeps the heads left in its qkv weight.
+        hidden_size = qkv_weight.shape[0]
+        size_per_head = hidden_size // num_attention_heads
+        num_attention_heads = qkv_weight.shape[1] // 3 // size_per_head
         return BertAttention(
-            _try_convert(f[f'encoder.layer.{layer_num}.attention.qkv.weight']),
+            _try_convert(qkv_weight),
             _try_convert(f[f'encoder.layer.{layer_num}.attention.qkv.bias']),
             _try_convert(
                 f[f'encoder.layer.{layer_num}.attention.output.dense.weight']),
@@ -225,9 +259,24 @@ class BertAttention(cxx.BertAttention):
             ), num_attention_heads)
 
 
-class BertLayer:
+def _run_native_layer(layer, hidden_states: AnyTensor,
+                      attention_mask: Optional[AnyTensor],
+                      return_type: Optional[ReturnType],
+                      output: Optional[cxx.Tensor],
+                      seq_offsets: Optional[AnyTensor]):
+    hidden_states = _try_convert(hidden_states)
+    attention_mask = _try_convert(_create_empty_if_none(attention_mask))
+    output = _create_empty_if_none(output)
+    if seq_offsets is not None:
+        seq_offsets = _try_convert(seq_offsets)
+    layer.__call__(hidden_states, attention_mask, output, seq_offsets)
+    return convert_returns_as_type(output, return_type)
+
+
+class BertLayer(cxx.BertLayer):
     def __init__(self, attention: BertAttention,
                  intermediate: BertIntermediate, output: BertOutput):
+        super(BertLayer, self).__init__(attention, intermediate, output)
         self.attention = attention
         self.intermediate = intermediate
         self.output = output
@@ -238,20 +287,30 @@ class BertLayer:
                  return_type: Optional[ReturnType] = None,
                  attention_output: Optional[cxx.Tensor] = None,
                  intermediate_output: Optional[cxx.Tensor] = None,
-                 output: Optional[cxx.Tensor] = None):
-        attention_output = self.attention(
-            hidden_states,
-            attention_mask,
-            return_type=ReturnType.turbo_transformers,
-            output=attention_output)
-        intermediate_output = self.intermediate(
-            attention_output,
-            return_type=ReturnType.turbo_transformers,
-            output=intermediate_output)
-        return self.output(intermediate_output,
-                           attention_output,
-                           return_type=return_type,
-                           output=output)
+                 output: Optional[cxx.Tensor] = None,
+                 seq_offsets: Optional[AnyTensor] = None):
+        # The whole layer runs natively on the intermediate tensors of a
+        # workspace, attention_output and intermediate_output are unused.
+        return _run_native_layer(super(BertLayer, self), hidden_states,
+                                 attention_mask, return_type, output,
+                                 seq_offsets)
+
+    # Run the GEMMs of the layer on int8 weights. On the GPU it needs CUDA 11
+    # and a GPU with int8 tensor cores.
+    def quantize(self):
+        super(BertLayer, self).quantize()
+
+    # Run the GEMMs of a float CPU layer on bfloat16 weights, on the AMX or
+    # AVX512-BF16 instructions of the CPUs having them.
+    def convert_to_bf16(self):
+        super(BertLayer, self).convert_to_bf16()
+
+    # Store the weights of a float CPU layer as 'fp16' or per channel 'int8',
+    # which the GEMMs convert back to float as they multiply. The activations
+    # stay in float, so it is faster for few tokens only.
+    def compress_weights(self, weight_type: str = 'fp16'):
+        super(BertLayer, self).compress_weights(
+            _get_weight_only_type(weight_type))
 
     @staticmethod
     def from_torch(layer: TorchBertLayer):
@@ -268,8 +327,9 @@ class BertLayer:
             BertOutput.from_npz(file_name, layer_num))
 
 
-class BertEncoder:
+class BertEncoder(cxx.BertEncoder):
     def __init__(self, layer: Sequence[BertLayer]):
+        super(BertEncoder, self).__init__(list(layer))
         self.layer = layer
 
     def __call__(self,
@@ -278,25 +338,22 @@ class BertEncoder:
                  return_type: Optional[ReturnType] = None,
                  attention_output: Optional[cxx.Tensor] = None,
                  intermediate_output: Optional[cxx.Tensor] = None,
-                 output: Optional[cxx.Tensor] = None):
-        attention_output = _create_empty_if_none(attention_output)
-        intermediate_output = _create_empty_if_none(intermediate_output)
-        output = _create_empty_if_none(output)
-        first = True
-        for l in self.layer:
-            if first:
-                input_states = hidden_states
-                first = False
-            else:
-                input_states = output
-
-            output = l(hidden_states=input_states,
-                       attention_mask=attention_mask,
-                       return_type=ReturnType.turbo_transformers,
-                       attention_output=attention_output,
-                       intermediate_output=intermediate_output,
-                       output=output)
-        return convert_returns_as_type(output, return_type)
+                 output: Optional[cxx.Tensor] = None,
+                 seq_offsets: Optional[AnyTensor] = None):
+        # See BertLayer, the layers run one after another in a single call.
+        return _run_native_layer(super(BertEncoder, self), hidden_states,
+                                 attention_mask, return_type, output,
+                                 seq_offsets)
+
+    def quantize(self):
+        super(BertEncoder, self).quantize()
+
+    def convert_to_bf16(self):
+        super(BertEncoder, self).convert_to_bf16()
+
+    def compress_weights(self, weight_type: str = 'fp16'):
+        super(BertEncoder, self).compress_weights(
+            _get_weight_only_type(weight_type))
 
     @staticmethod
     def from_torch(encoder: TorchBertEncoder):
@@ -318,10 +375,24 @@ class SequencePool(cxx.SequencePool):
     def __call__(self,
                  input_tensor: AnyTensor,
                  return_type: Optional[ReturnType] = None,
-                 output_tensor: Optional[cxx.Tensor] = None):
+                 output_tensor: Optional[cxx.Tensor] = None,
+                 seq_lens: Optional[AnyTensor] = None,
+                 seq_offsets: Optional[AnyTensor] = None):
+        # seq_lens: the valid length of each sequence, an int64 tensor on
+        # the device of input_tensor. The padded positions are not pooled.
+        # seq_offsets: the int64 CPU offsets of packed sequences, see
+        # BertAttention.
         input_tensor = _try_convert(input_tensor)
         output_tensor = _create_empty_if_none(output_tensor)
-        super(SequencePool, self).__call__(input_tensor, output_tensor)
+        if seq_offsets is not None:
+            super(SequencePool,
+                  self).run_packed(input_tensor, _try_convert(seq_offsets),
+                                   output_tensor)
+            return convert_returns_as_type(output_tensor, return_type)
+        if seq_lens is not None:
+            seq_lens = _try_convert(seq_lens)
+        super(SequencePool, self).__call__(input_tensor, output_tensor,
+                                           seq_lens)
         return convert_returns_as_type(output_tensor, return_type)
 
 
@@ -344,7 +415,8 @@ class BertModel:
     def __init__(self, embeddings: BertEmbeddings, encoder: BertEncoder):
         self.embeddings = embeddings
         self.encoder = encoder
-        self.prepare = cxx.PrepareBertMasks()
+        # The embedding, the encoder and the pooling run in one native call.
+        self.model = cxx.BertModel(embeddings, encoder)
 
     def __call__(self,
                  inputs: AnyTensor,
@@ -354,35 +426,108 @@ class BertModel:
                  pooling_type: PoolingType = PoolingType.FIRST,
                  hidden_cache: Optional[AnyTensor] = None,
                  output: Optional[AnyTensor] = None,
-                 return_type: Optional[ReturnType] = None):
+                 return_type: Optional[ReturnType] = None,
+                 seq_lens: Optional[Sequence[int]] = None):
+        # seq_lens: the lengths of the sequences packed back to back in
+        # `inputs`, a torch tensor of shape [1, sum(seq_lens)]. The layers run
+        # on the valid tokens only, and the attention_masks are unused.
+        if seq_lens is not None:
+            return self._run_packed(inputs, seq_lens, token_type_ids,
+                                    position_ids, pooling_type, hidden_cache,
+                                    output, return_type)
         attention_masks = _try_convert(_create_empty_if_none(attention_masks))
         token_type_ids = _try_convert(_create_empty_if_none(token_type_ids))
         position_ids = _try_convert(_create_empty_if_none(position_ids))
         inputs = _try_convert(inputs)
-        extended_attention_masks = cxx.Tensor.create_empty()
         output = _create_empty_if_none(output)
         hidden_cache = _create_empty_if_none(hidden_cache)
 
-        self.prepare(inputs, attention_masks, token_type_ids, position_ids,
-                     extended_attention_masks)
-
-        hidden_cache = self.embeddings(
-            inputs,
-            position_ids=position_ids,
-            token_type_ids=token_type_ids,
-            output=hidden_cache,
-            return_type=ReturnType.turbo_transformers)
-
-        hidden_cache = self.encoder(hidden_states=hidden_cache,
-                                    attention_mask=extended_attention_masks,
-                                    return_type=ReturnType.turbo_transformers,
-                                    output=hidden_cache)
+        self.model(inputs, attention_masks, token_type_ids, position_ids,
+                   PoolingMap[pooling_type], hidden_cache, output)
+        return convert_returns_as_type(output, return_type), \
+            convert_returns_as_type(hidden_cache, return_type)
+
+    def _run_packed(self, inputs: torch.Tensor, seq_lens: Sequence[int],
+                    token_type_ids: Optional[AnyTensor],
+                    position_ids: Optional[AnyTensor],
+                    pooling_type: PoolingType,
+                    hidden_cache: Optional[AnyTensor],
+                    output: Optional[AnyTensor],
+                    return_type: Optional[ReturnType]):
+        seq_lens = [int(l) for l in seq_lens]
+        seq_offsets = torch.tensor(np.cumsum([0] + seq_lens),
+                                   dtype=torch.int64)
+        inputs = _try_convert(inputs.reshape(1, -1))
+        # The default positions restart at every sequence, natively.
+        token_type_ids = _try_convert(_create_empty_if_none(token_type_ids))
+        position_ids = _try_convert(_create_empty_if_none(position_ids))
+        output = _create_empty_if_none(output)
+        hidden_cache = _create_empty_if_none(hidden_cache)
 
-        self.seq_pool = SequencePool(PoolingMap[pooling_type])
-        output = self.seq_pool(input_tensor=hidden_cache,
-                               return_type=return_type,
-                               output_tensor=output)
-        return output, convert_returns_as_type(hidden_cache, return_type)
+        self.model(inputs,
+                   cxx.Tensor.create_empty(),
+                   token_type_ids,
+                   position_ids,
+                   PoolingMap[pooling_type],
+                   hidden_cache,
+                   output,
+                   seq_offsets=_try_convert(seq_offsets))
+        return convert_returns_as_type(output, return_type), \
+            convert_returns_as_type(hidden_cache, return_type)
+
+    # Run a ragged batch without padding it. `sequences` are the ids of every
+    # sequence, or `input_ids` the ids of all the sequences back to back and
+    # `seq_offsets` the prefix sums of their lengths [batch_size + 1]. The
+    # ids are uploaded by the native code and the sequences run packed, see
+    # seq_lens of __call__.
+    def run_ragged(self,
+                   sequences: Optional[Sequence[Sequence[int]]] = None,
+                   input_ids: Optional[Sequence[int]] = None,
+                   seq_offsets: Optional[Sequence[int]] = None,
+                   pooling_type: PoolingType = PoolingType.FIRST,
+                   hidden_cache: Optional[cxx.Tensor] = None,
+                   output: Optional[cxx.Tensor] = None,
+                   return_type: Optional[ReturnType] = None):
+        output = _create_empty_if_none(output)
+        hidden_cache = _create_empty_if_none(hidden_cache)
+        if sequences is not None:
+            self.model.run_packed([_to_id_list(ids) for ids in sequences],
+                                  PoolingMap[pooling_type], hidden_cache,
+                                  output)
+        elif input_ids is not None and seq_offsets is not None:
+            self.model.run_packed(_to_id_list(input_ids),
+                                  _to_id_list(seq_offsets),
+                                  PoolingMap[pooling_type], hidden_cache,
+                                  output)
+        else:
+            raise ValueError(
+                "Either sequences or input_ids and seq_offsets are needed")
+        return convert_returns_as_type(output, return_type), \
+            convert_returns_as_type(hidden_cache, return_type)
+
+    # Run the model once on dummy inputs of every (batch_size, seq_len) of
+    # `shapes`, so that the first requests of these shapes run at their
+    # steady latency: the workspaces of the calling thread grow to their
+    # largest size, and the GEMMs of every shape are tuned.
+    def warm_up(self,
+                shapes: Sequence[Sequence[int]],
+                pooling_type: PoolingType = PoolingType.FIRST):
+        self.model.warm_up([(int(b), int(s)) for b, s in shapes],
+                           PoolingMap[pooling_type])
+
+    # Only the largest shape of warm_up, which leaves the workspaces large
+    # enough for any batch within (max_batch_size, max_seq_len).
+    def reserve(self, max_batch_size: int, max_seq_len: int):
+        self.model.reserve(max_batch_size, max_seq_len)
+
+    def quantize(self):
+        self.model.quantize()
+
+    def convert_to_bf16(self):
+        self.model.convert_to_bf16()
+
+    def compress_weights(self, weight_type: str = 'fp16'):
+        self.model.compress_weights(_get_weight_only_type(weight_type))
 
     @staticmethod
     def from_torch(model: TorchBertModel,
@@ -425,7 +570,7 @@ class BertPooler(cxx.BertPooler):
     @staticmethod
     def from_torch(pooler: TorchBertPooler):
         pooler_params = _to_param_dict_naive(pooler)
-        weight = torch.clone(torch.t(pooler_params['dense.weight']))
+        weight = torch.t(pooler_params['dense.weight'])
         return BertPooler(convert2tt_tensor(weight),
                           convert2tt_tensor(pooler_params['dense.bias']))
 
@@ -449,7 +594,8 @@ class BertModelWithPooler:
                  pooling_type: PoolingType = PoolingType.FIRST,
                  hidden_cache: Optional[AnyTensor] = None,
                  pooler_output: Optional[AnyTensor] = None,
-                 return_type: Optional[ReturnType] = None):
+                 return_type: Optional[ReturnType] = None,
+                 seq_lens: Optional[Sequence[int]] = None):
         encoder_output, hidden_cache = self.bertmodel(
             inputs,
             attention_masks,
@@ -458,12 +604,52 @@ class BertModelWithPooler:
             pooling_type,
             hidden_cache,
             output=None,
+            return_type=ReturnType.turbo_transformers,
+            seq_lens=seq_lens)
+        pooler_output = self.pooler(encoder_output, return_type, pooler_output)
+        return pooler_output, convert_returns_as_type(
+            encoder_output,
+            return_type), convert_returns_as_type(hidden_cache, return_type)
+
+    # See BertModel.run_ragged.
+    def run_ragged(self,
+                   sequences: Optional[Sequence[Sequence[int]]] = None,
+                   input_ids: Optional[Sequence[int]] = None,
+                   seq_offsets: Optional[Sequence[int]] = None,
+                   pooling_type: PoolingType = PoolingType.FIRST,
+                   hidden_cache: Optional[cxx.Tensor] = None,
+                   pooler_output: Optional[cxx.Tensor] = None,
+                   return_type: Optional[ReturnType] = None):
+        encoder_output, hidden_cache = self.bertmodel.run_ragged(
+            sequences,
+            input_ids,
+            seq_offsets,
+            pooling_type,
+            hidden_cache,
             return_type=ReturnType.turbo_transformers)
         pooler_output = self.pooler(encoder_output, return_type, pooler_output)
         return pooler_output, convert_returns_as_type(
             encoder_output,
             return_type), convert_returns_as_type(hidden_cache, return_type)
 
+    # See BertModel.warm_up, the pooler is not warmed up.
+    def warm_up(self,
+                shapes: Sequence[Sequence[int]],
+                pooling_type: PoolingType = PoolingType.FIRST):
+        self.bertmodel.warm_up(shapes, pooling_type)
+
+    def reserve(self, max_batch_size: int, max_seq_len: int):
+        self.bertmodel.reserve(max_batch_size, max_seq_len)
+
+    def quantize(self):
+        self.bertmodel.quantize()
+
+    def convert_to_bf16(self):
+        self.bertmodel.convert_to_bf16()
+
+    def compress_weights(self, weight_type: str = 'fp16'):
+        self.bertmodel.compress_weights(weight_type)
+
     @staticmethod
     def from_torch(model: TorchBertModel,
                    device: Optional[torch.device] = None):
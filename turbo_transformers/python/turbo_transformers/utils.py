@@ -18,9 +18,40 @@ except ImportError:
     import turbo_transformers.turbo_transformers_cxx as cxx
 import contextlib
 
-__all__ = ['gperf_guard', 'set_num_threads']
+__all__ = [
+    'gperf_guard', 'profiler_guard', 'profile_report', 'nvtx_guard',
+    'metrics', 'reset_metrics',
+    'set_num_threads', 'set_min_parallel_work', 'set_huge_pages',
+    'enable_fused_bert_layer', 'enable_packing_shared_weights',
+    'set_cuda_allocator_config',
+    'cuda_memory_stats', 'reset_cuda_peak_memory_stats', 'empty_cuda_cache',
+    'memory_tracking_guard', 'memory_tag', 'memory_usages', 'memory_report',
+    'cuda_stream_guard',
+    'load_gemm_algo_cache', 'save_gemm_algo_cache'
+]
 
 set_num_threads = cxx.set_num_threads
+# The least work of a thread of the CPU kernels, which run the loops of
+# small, e.g. batch-1, inputs on fewer threads. 0 always uses all of them.
+set_min_parallel_work = cxx.set_min_parallel_work
+# Run the BERT layers of up to 32 tokens on the GPU as a single persistent
+# kernel, experimental and off by default unless TT_FUSED_BERT_LAYER=1.
+enable_fused_bert_layer = cxx.enable_fused_bert_layer
+# Pack the CPU weights of mapped files and of the weight store for MKL too,
+# which doubles their memory, off by default unless TT_PACK_SHARED_WEIGHTS=1.
+# It applies to the models loaded afterwards.
+enable_packing_shared_weights = cxx.enable_packing_shared_weights
+
+
+def set_huge_pages(enable: bool = True, min_bytes: int = 2 << 20):
+    """
+    Back the host allocations of at least min_bytes, e.g. the weights and the
+    activation arena, by 2 MB pages: those reserved by vm.nr_hugepages if
+    any, or else the transparent huge pages. Enable it before loading the
+    models, the tensors allocated earlier keep their pages.
+    metrics()['huge_page_bytes'] counts the bytes backed.
+    """
+    cxx.set_huge_pages(enable, min_bytes)
 
 
 @contextlib.contextmanager
@@ -28,3 +59,174 @@ def gperf_guard(filename: str):
     cxx.enable_gperf(filename)
     yield
     cxx.disable_gperf()
+
+
+@contextlib.contextmanager
+def memory_tracking_guard(reset: bool = True):
+    """
+    Track the tensors allocated by turbo_transformers within the scope, see
+    memory_report and memory_usages.
+    """
+    cxx.enable_memory_tracking()
+    if reset:
+        cxx.reset_memory_tracking()
+    try:
+        yield
+    finally:
+        cxx.disable_memory_tracking()
+
+
+@contextlib.contextmanager
+def profiler_guard(reset: bool = True):
+    """
+    Time the layers and the kernels run within the scope, see profile_report.
+    """
+    cxx.enable_profiler()
+    if reset:
+        cxx.reset_profiler()
+    try:
+        yield
+    finally:
+        cxx.disable_profiler()
+
+
+def profile_report() -> str:
+    """
+    The call tree of the ops timed by profiler_guard, with the count, total,
+    mean and p99 milliseconds per op and input shape.
+    """
+    return cxx.get_profile_report()
+
+
+def metrics() -> dict:
+    """
+    A snapshot of the counters of the runtime since the start or the last
+    reset_metrics: the batches, sequences, tokens and padded tokens run, the
+    allocator hits and misses, the bytes of the tensors allocated and of the
+    host blocks on huge pages, the GEMM flops, the batches split, the ones
+    run between the layers of a lower priority batch and the ones spilled to
+    the CPU by the C++ batcher, and the calls and host milliseconds per layer
+    type in 'layer_times'. The rates are the differences of two snapshots.
+    """
+    return cxx.get_metrics()
+
+
+def reset_metrics():
+    cxx.reset_metrics()
+
+
+@contextlib.contextmanager
+def nvtx_guard():
+    """
+    Push NVTX ranges for the layers and the kernels run within the scope, which
+    name them on the timelines of Nsight Systems. turbo_transformers must be
+    built with -DWITH_NVTX=ON.
+    """
+    cxx.enable_nvtx()
+    try:
+        yield
+    finally:
+        cxx.disable_nvtx()
+
+
+@contextlib.contextmanager
+def memory_tag(tag: str):
+    """
+    Tag the tensors allocated by the current thread within the scope, nested
+    tags are joined by dots, e.g. "encoder.layer.3.attention".
+    """
+    cxx.push_memory_tag(tag)
+    try:
+        yield
+    finally:
+        cxx.pop_memory_tag()
+
+
+@contextlib.contextmanager
+def cuda_stream_guard(stream=None):
+    """
+    Run the GPU kernels of the current thread within the scope on `stream`, a
+    torch.cuda.Stream, by default torch.cuda.current_stream(), instead of the
+    private streams of turbo_transformers. The kernels are then ordered with
+    the torch ops queued on the stream, so turbo and torch ops interleave
+    without torch.cuda.synchronize() between them, and the torch events of the
+    stream time both. The stream must stay alive while the kernels run.
+    """
+    import torch
+    if stream is None:
+        stream = torch.cuda.current_stream()
+    cxx.push_cuda_stream(stream.device.index, stream.cuda_stream)
+    try:
+        yield
+    finally:
+        cxx.pop_cuda_stream()
+
+
+def memory_usages() -> list:
+    """
+    The live and peak bytes by device and tag, the usages with an empty tag
+    count all the tensors of a device.
+    """
+    return cxx.get_memory_usages()
+
+
+def memory_report() -> str:
+    return cxx.get_memory_report()
+
+
+def set_cuda_allocator_config(bin_growth: int = None,
+                              min_bin: int = None,
+                              max_bin: int = None,
+                              max_cached_bytes: int = None,
+                              memory_limit: int = None):
+    """
+    Change the caching policy of the GPU memory, the options left to None
+    keep their current values. The cached blocks are freed.
+    Requests are rounded up to bin_growth ** k bytes, min_bin <= k <= max_bin.
+    max_cached_bytes bounds the freed bytes kept for reuse per device, and
+    memory_limit the allocated plus cached bytes per device (0 for no limit).
+    """
+    config = cxx.get_cuda_allocator_config()
+    for name, value in [('bin_growth', bin_growth), ('min_bin', min_bin),
+                        ('max_bin', max_bin),
+                        ('max_cached_bytes', max_cached_bytes),
+                        ('memory_limit', memory_limit)]:
+        if value is not None:
+            setattr(config, name, value)
+    cxx.set_cuda_allocator_config(config)
+
+
+def cuda_memory_stats(device_id: int = 0) -> dict:
+    """
+    The allocated, cached and peak allocated bytes of a GPU, in the sizes of
+    the blocks, and the number of allocations not served by the cache.
+    """
+    stats = cxx.cuda_memory_stats(device_id)
+    return {
+        'allocated_bytes': stats.allocated_bytes,
+        'cached_bytes': stats.cached_bytes,
+        'peak_allocated_bytes': stats.peak_allocated_bytes,
+        'num_device_allocs': stats.num_device_allocs
+    }
+
+
+def reset_cuda_peak_memory_stats(device_id: int = 0):
+    cxx.reset_cuda_peak_memory_stats(device_id)
+
+
+def empty_cuda_cache():
+    cxx.empty_cuda_cache()
+
+
+def load_gemm_algo_cache(path: str):
+    """
+    Load the GEMM algorithms tuned on the GPU by a previous process, which
+    saves benchmarking them again the first time each shape is seen. Setting
+    the environment variable TT_GEMM_ALGO_CACHE to a file loads it at startup
+    and appends the new winners, too.
+    """
+    cxx.load_gemm_algo_cache(path)
+
+
+def save_gemm_algo_cache(path: str):
+    cxx.save_gemm_algo_cache(path)
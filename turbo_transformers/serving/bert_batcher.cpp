@@ -0,0 +1,360 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/serving/bert_batcher.h"
+
+#include <algorithm>
+#include <exception>
+#include <numeric>
+#include <utility>
+
+#include "turbo_transformers/core/config.h"
+#include "turbo_transformers/core/enforce.h"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/numa.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+namespace {
+// The weight of the batches measured so far against the next one.
+constexpr double kCostDecay = 0.9;
+}  // namespace
+
+void BertBatcher::CostModel::Add(double tokens, double ms) {
+  n_ = n_ * kCostDecay + 1;
+  sum_x_ = sum_x_ * kCostDecay + tokens;
+  sum_y_ = sum_y_ * kCostDecay + ms;
+  sum_xx_ = sum_xx_ * kCostDecay + tokens * tokens;
+  sum_xy_ = sum_xy_ * kCostDecay + tokens * ms;
+}
+
+double BertBatcher::CostModel::Estimate(double tokens) const {
+  if (n_ == 0) {
+    return -1;
+  }
+  double mean_x = sum_x_ / n_, mean_y = sum_y_ / n_;
+  double var_x = sum_xx_ / n_ - mean_x * mean_x;
+  double slope = var_x > 1e-3 * mean_x * mean_x
+                     ? (sum_xy_ / n_ - mean_x * mean_y) / var_x
+                     : -1;
+  if (slope < 0 || mean_y - slope * mean_x < 0) {
+    // The batches were of one size so far, or too noisy to tell the cost of
+    // a batch from the cost of its tokens: scale by the tokens only.
+    return mean_x > 0 ? mean_y / mean_x * tokens : mean_y;
+  }
+  return mean_y + slope * (tokens - mean_x);
+}
+
+BertBatcher::BertBatcher(std::vector<std::shared_ptr<BertModel>> models,
+                         Options options)
+    : models_(std::move(models)),
+      options_(std::move(options)),
+      buckets_(options_.length_buckets.size() + 1) {
+  TT_ENFORCE(!models_.empty(), "The batcher needs a model to run on");
+  TT_ENFORCE_GT(options_.max_batch_size, 0,
+                "The max batch size should be positive");
+  TT_ENFORCE(std::is_sorted(options_.length_buckets.begin(),
+                            options_.length_buckets.end()),
+             "The length buckets should be ascending");
+  TT_ENFORCE(options_.worker_cpus.empty() ||
+                 options_.worker_cpus.size() == models_.size(),
+             "The %d models need as many CPU lists, got %d", models_.size(),
+             options_.worker_cpus.size());
+  worker_states_.resize(models_.size());
+  if (options_.spillover) {
+    size_t n_spill = 0;
+    for (size_t i = 0; i < models_.size(); ++i) {
+      worker_states_[i].spill = models_[i]->device_type() == kDLCPU;
+      n_spill += worker_states_[i].spill;
+    }
+    TT_ENFORCE(n_spill > 0 && n_spill < models_.size(),
+               "The spillover needs both CPU and GPU models");
+  }
+  if (!options_.length_buckets.empty()) {
+    for (auto &model : models_) {
+      model->PlanMemory(options_.max_batch_size,
+                        options_.length_buckets.back());
+    }
+  }
+  for (size_t i = 0; i < models_.size(); ++i) {
+    workers_.emplace_back(
+        &BertBatcher::WorkerLoop, this, i,
+        options_.worker_cpus.empty() ? std::vector<int>()
+                                     : options_.worker_cpus[i]);
+  }
+}
+
+std::vector<std::shared_ptr<BertModel>> BertBatcher::LoadPerNumaNode(
+    const std::function<std::shared_ptr<BertModel>()> &load,
+    Options *options) {
+  auto nodes = core::GetNumaNodeCPUs();
+  std::vector<std::shared_ptr<BertModel>> models(nodes.size());
+  std::vector<std::exception_ptr> errors(nodes.size());
+  std::vector<std::thread> loaders;
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    loaders.emplace_back([&, i] {
+      try {
+        core::BindThreadToCPUs(nodes[i]);
+        core::SetLocalNumThreads(nodes[i].size());
+        models[i] = load();
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    });
+  }
+  for (auto &loader : loaders) {
+    loader.join();
+  }
+  for (auto &error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+  options->worker_cpus = std::move(nodes);
+  return models;
+}
+
+BertBatcher::~BertBatcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  cv_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+std::future<std::vector<float>> BertBatcher::Submit(
+    std::vector<int64_t> input_ids, std::vector<int64_t> position_ids,
+    std::vector<int64_t> segment_ids) {
+  TT_ENFORCE(!input_ids.empty(), "The input ids should not be empty");
+  std::unique_ptr<Request> request(new Request());
+  request->input_ids = std::move(input_ids);
+  request->position_ids = std::move(position_ids);
+  request->segment_ids = std::move(segment_ids);
+  request->arrival = std::chrono::steady_clock::now();
+  auto result = request->result.get_future();
+  auto bucket = BucketOf(request->input_ids.size());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    TT_ENFORCE(!stopped_, "The batcher is stopped");
+    buckets_[bucket].emplace_back(std::move(request));
+  }
+  Notify();
+  return result;
+}
+
+void BertBatcher::Notify() {
+  // A spill worker should see every change of the queue, as it leaves the
+  // ready batches to the GPU workers unless they are behind.
+  if (options_.spillover) {
+    cv_.notify_all();
+  } else {
+    cv_.notify_one();
+  }
+}
+
+size_t BertBatcher::BucketOf(size_t seq_len) const {
+  auto &bounds = options_.length_buckets;
+  return std::lower_bound(bounds.begin(), bounds.end(),
+                          static_cast<int64_t>(seq_len)) -
+         bounds.begin();
+}
+
+BertBatcher::Batch BertBatcher::PopReadyBatch(
+    size_t worker, std::chrono::steady_clock::time_point now,
+    std::chrono::steady_clock::time_point *deadline) {
+  // Among the ready buckets, the one with the oldest request goes first.
+  std::vector<std::deque<std::unique_ptr<Request>> *> ready_buckets;
+  *deadline = std::chrono::steady_clock::time_point::max();
+  for (auto &bucket : buckets_) {
+    if (bucket.empty()) {
+      continue;
+    }
+    auto timeout = bucket.front()->arrival + options_.max_queue_delay;
+    if (stopped_ || bucket.size() >= options_.max_batch_size ||
+        timeout <= now) {
+      ready_buckets.push_back(&bucket);
+    } else {
+      *deadline = std::min(*deadline, timeout);
+    }
+  }
+  std::sort(ready_buckets.begin(), ready_buckets.end(),
+            [](const std::deque<std::unique_ptr<Request>> *a,
+               const std::deque<std::unique_ptr<Request>> *b) {
+              return a->front()->arrival < b->front()->arrival;
+            });
+  std::deque<std::unique_ptr<Request>> *ready = nullptr;
+  if (!worker_states_[worker].spill) {
+    ready = ready_buckets.empty() ? nullptr : ready_buckets.front();
+  } else {
+    double ahead_ms = 0;
+    for (auto *bucket : ready_buckets) {
+      if (ShouldSpill(worker, *bucket,
+                      std::min(bucket->size(), options_.max_batch_size), now,
+                      &ahead_ms)) {
+        ready = bucket;
+        break;
+      }
+    }
+  }
+  Batch batch;
+  if (ready != nullptr) {
+    auto n = std::min(ready->size(), options_.max_batch_size);
+    for (size_t i = 0; i < n; ++i) {
+      batch.emplace_back(std::move(ready->front()));
+      ready->pop_front();
+    }
+  }
+  return batch;
+}
+
+bool BertBatcher::ShouldSpill(
+    size_t worker, const std::deque<std::unique_ptr<Request>> &bucket,
+    size_t batch_size, std::chrono::steady_clock::time_point now,
+    double *ahead_ms) const {
+  size_t max_seq_len = 0;
+  for (size_t i = 0; i < batch_size; ++i) {
+    max_seq_len = std::max(max_seq_len, bucket[i]->input_ids.size());
+  }
+  double tokens = static_cast<double>(batch_size * max_seq_len);
+  // The GPU model to free up first runs the batch.
+  double gpu_free_ms = -1, gpu_ms = -1;
+  size_t n_gpus = 0;
+  for (auto &state : worker_states_) {
+    if (state.spill) {
+      continue;
+    }
+    ++n_gpus;
+    double estimate = state.cost.Estimate(tokens);
+    if (estimate < 0) {
+      // Nothing to compare with before the GPU ran a batch.
+      return false;
+    }
+    double free_ms =
+        state.busy ? std::max(0.0, std::chrono::duration<double, std::milli>(
+                                       state.busy_until - now)
+                                       .count())
+                   : 0.0;
+    if (gpu_free_ms < 0 || free_ms < gpu_free_ms) {
+      gpu_free_ms = free_ms;
+      gpu_ms = estimate;
+    }
+  }
+  double gpu_done_ms = gpu_free_ms + *ahead_ms / n_gpus + gpu_ms;
+  // The first batch of the CPU model runs to measure it.
+  double cpu_ms = std::max(0.0, worker_states_[worker].cost.Estimate(tokens));
+  if (static_cast<int64_t>(max_seq_len) <= options_.spill_max_seq_len &&
+      cpu_ms < gpu_done_ms) {
+    return true;
+  }
+  *ahead_ms += gpu_ms;
+  return false;
+}
+
+void BertBatcher::RunBatch(BertModel &model, Batch batch) const {
+  std::vector<std::vector<int64_t>> input_ids, position_ids, segment_ids;
+  bool has_positions = false, has_segments = false;
+  for (auto &request : batch) {
+    input_ids.emplace_back(std::move(request->input_ids));
+    has_positions |= !request->position_ids.empty();
+    has_segments |= !request->segment_ids.empty();
+  }
+  // The model takes the ids of all or none of the sequences, the missing ones
+  // get the defaults of the model.
+  for (size_t i = 0; i < batch.size(); ++i) {
+    auto seq_len = input_ids[i].size();
+    if (has_positions) {
+      position_ids.emplace_back(std::move(batch[i]->position_ids));
+      if (position_ids.back().empty()) {
+        position_ids.back().resize(seq_len);
+        std::iota(position_ids.back().begin(), position_ids.back().end(), 0);
+      }
+    }
+    if (has_segments) {
+      segment_ids.emplace_back(std::move(batch[i]->segment_ids));
+      if (segment_ids.back().empty()) {
+        segment_ids.back().assign(seq_len, 0);
+      }
+    }
+  }
+
+  try {
+    auto output = model(input_ids, position_ids, segment_ids,
+                        options_.pooling, options_.use_pooler);
+    auto row_size = output.size() / batch.size();
+    for (size_t i = 0; i < batch.size(); ++i) {
+      batch[i]->result.set_value(
+          std::vector<float>(output.begin() + i * row_size,
+                             output.begin() + (i + 1) * row_size));
+    }
+  } catch (...) {
+    for (auto &request : batch) {
+      request->result.set_exception(std::current_exception());
+    }
+  }
+}
+
+void BertBatcher::WorkerLoop(size_t worker, std::vector<int> cpus) {
+  if (!cpus.empty()) {
+    // The OpenMP pool of the worker starts on the bound CPUs.
+    core::BindThreadToCPUs(cpus);
+    core::SetLocalNumThreads(cpus.size());
+  }
+  auto &model = *models_[worker];
+  auto &state = worker_states_[worker];
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point deadline;
+    auto batch = PopReadyBatch(worker, now, &deadline);
+    if (!batch.empty()) {
+      size_t max_seq_len = 0;
+      for (auto &request : batch) {
+        max_seq_len = std::max(max_seq_len, request->input_ids.size());
+      }
+      double tokens = static_cast<double>(batch.size() * max_seq_len);
+      state.busy = true;
+      state.busy_until =
+          now + std::chrono::microseconds(static_cast<int64_t>(
+                    1000 * std::max(0.0, state.cost.Estimate(tokens))));
+      lock.unlock();
+      // Another worker may take the rest of the queue meanwhile.
+      Notify();
+      if (state.spill) {
+        core::AddToCounter(core::Counter::kSpilledBatches, 1);
+      }
+      RunBatch(model, std::move(batch));
+      auto ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - now)
+                    .count();
+      lock.lock();
+      state.busy = false;
+      state.cost.Add(tokens, ms);
+      continue;
+    }
+    if (stopped_) {
+      return;
+    }
+    if (deadline == std::chrono::steady_clock::time_point::max()) {
+      cv_.wait(lock);
+    } else {
+      cv_.wait_until(lock, deadline);
+    }
+  }
+}
+
+}  // namespace serving
+}  // namespace turbo_transformers
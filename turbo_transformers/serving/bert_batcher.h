@@ -0,0 +1,152 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "turbo_transformers/serving/bert_model.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+// Batches the requests of concurrent callers before running them on the
+// models. A request waits in the queue of its length bucket until the bucket
+// holds `max_batch_size` requests or its oldest request has waited for
+// `max_queue_delay`. Each model, e.g. one per device, is driven by a worker
+// thread of its own, which takes the next ready batch.
+//
+// Batching by length keeps the padding of a batch small, and limits the
+// shapes a model sees to a few per bucket, which is what the CUDA graphs of
+// BertModel::EnableCUDAGraph need.
+//
+// On a host of several NUMA nodes, LoadPerNumaNode loads a replica per node
+// and binds the worker of each replica to the CPUs of its node, so that a
+// replica runs on the memory of its node only.
+//
+// On a GPU host, a replica on the CPU can take the overflow of the GPU
+// replicas, see Options::spillover.
+class BertBatcher {
+ public:
+  struct Options {
+    size_t max_batch_size{32};
+    std::chrono::microseconds max_queue_delay{2000};
+    // The upper bounds of the sequence lengths of the buckets, ascending.
+    // Longer sequences share a bucket of their own. If given, the memory of
+    // the models is planned for max_batch_size x the last bound.
+    std::vector<int64_t> length_buckets;
+    PoolType pooling{PoolType::kFirst};
+    bool use_pooler{false};
+    // The CPUs the worker of each model is bound to, which also sets the
+    // OpenMP threads of the worker to their number. Empty, or an empty list
+    // of a model, leaves its worker unbound.
+    std::vector<std::vector<int>> worker_cpus;
+    // Run a ready batch on a CPU model only if its sequences are at most
+    // `spill_max_seq_len` long and the CPU model would finish it before the
+    // GPU models, that is, if the batches running and queued ahead of it
+    // keep the GPUs busy for longer than the CPU takes to run it. The
+    // estimates follow the throughput measured on the batches of each model.
+    // The models should include both device types.
+    bool spillover{false};
+    int64_t spill_max_seq_len{128};
+  };
+
+  // Calls `load` once per NUMA node, on a thread bound to the CPUs of the
+  // node, so that the weights of each replica are first touched, and thus
+  // placed, in the memory of its node. Sets the worker CPUs of `options` to
+  // the nodes of the replicas.
+  static std::vector<std::shared_ptr<BertModel>> LoadPerNumaNode(
+      const std::function<std::shared_ptr<BertModel>()> &load,
+      Options *options);
+
+  BertBatcher(std::vector<std::shared_ptr<BertModel>> models,
+              Options options);
+  // Runs the queued requests before it returns.
+  ~BertBatcher();
+
+  // The result is the pooled output of the sequence. `position_ids` and
+  // `segment_ids` may be empty, as for BertModel::operator().
+  std::future<std::vector<float>> Submit(std::vector<int64_t> input_ids,
+                                         std::vector<int64_t> position_ids = {},
+                                         std::vector<int64_t> segment_ids = {});
+
+ private:
+  struct Request {
+    std::vector<int64_t> input_ids;
+    std::vector<int64_t> position_ids;
+    std::vector<int64_t> segment_ids;
+    std::chrono::steady_clock::time_point arrival;
+    std::promise<std::vector<float>> result;
+  };
+  using Batch = std::vector<std::unique_ptr<Request>>;
+
+  // The milliseconds a model takes to run a batch of `tokens` padded tokens,
+  // fitted as a cost per batch plus a cost per token to the batches it ran,
+  // the recent ones weighing the most.
+  class CostModel {
+   public:
+    void Add(double tokens, double ms);
+    // Negative until a batch was added.
+    double Estimate(double tokens) const;
+
+   private:
+    double n_{0}, sum_x_{0}, sum_y_{0}, sum_xx_{0}, sum_xy_{0};
+  };
+
+  struct WorkerState {
+    // A CPU model under spillover.
+    bool spill{false};
+    bool busy{false};
+    // The estimated end of the running batch.
+    std::chrono::steady_clock::time_point busy_until;
+    CostModel cost;
+  };
+
+  size_t BucketOf(size_t seq_len) const;
+  // Pops a batch for the worker `worker` if a bucket is ready, otherwise
+  // returns the time at which the oldest request times out in `deadline`.
+  // Called with mutex_ held.
+  Batch PopReadyBatch(size_t worker, std::chrono::steady_clock::time_point now,
+                      std::chrono::steady_clock::time_point *deadline);
+  // Whether the spill worker `worker` runs the first `batch_size` requests
+  // of `bucket`. `ahead_ms` holds the GPU time of the ready batches older
+  // than it, and gets the GPU time of this one added if it is not spilled.
+  bool ShouldSpill(size_t worker,
+                   const std::deque<std::unique_ptr<Request>> &bucket,
+                   size_t batch_size, std::chrono::steady_clock::time_point now,
+                   double *ahead_ms) const;
+  void Notify();
+  void RunBatch(BertModel &model, Batch batch) const;
+  void WorkerLoop(size_t worker, std::vector<int> cpus);
+
+  std::vector<std::shared_ptr<BertModel>> models_;
+  Options options_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::deque<std::unique_ptr<Request>>> buckets_;
+  std::vector<WorkerState> worker_states_;
+  bool stopped_{false};
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace serving
+}  // namespace turbo_transformers
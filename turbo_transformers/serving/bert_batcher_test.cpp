@@ -0,0 +1,132 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/serving/bert_batcher.h"
+
+#include <cmath>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/core/config.h"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/serving/test_model.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+TEST_CASE("Bert-batcher", "Cpp interface") {
+  auto model = std::make_shared<BertModel>(
+      TestModelFile(), DLDeviceType::kDLCPU, kTestLayers, kTestHeads);
+  std::vector<std::vector<int64_t>> inputs{{12166, 10699, 16752, 4454},
+                                           {5342, 16471, 817, 16022},
+                                           {12166, 10699},
+                                           {5342}};
+  std::vector<std::vector<float>> expected;
+  for (auto &input : inputs) {
+    expected.emplace_back((*model)({input}, {}, {}, PoolType::kFirst, true));
+  }
+  BertBatcher::Options options;
+  options.max_batch_size = 2;
+  options.length_buckets = {2, 4};
+  options.use_pooler = true;
+  BertBatcher batcher({model}, options);
+  std::vector<std::future<std::vector<float>>> results;
+  for (int round = 0; round < 3; ++round) {
+    for (auto &input : inputs) {
+      results.emplace_back(batcher.Submit(input));
+    }
+  }
+  for (size_t i = 0; i < results.size(); ++i) {
+    auto vec = results[i].get();
+    auto &ref = expected[i % inputs.size()];
+    REQUIRE(vec.size() == ref.size());
+    for (size_t j = 0; j < vec.size(); ++j) {
+      REQUIRE(fabs(vec[j] - ref[j]) < 1e-4);
+    }
+  }
+}
+
+TEST_CASE("Bert-batcher-numa", "Cpp interface") {
+  std::vector<int64_t> input{12166, 10699, 16752, 4454};
+  BertBatcher::Options options;
+  auto models = BertBatcher::LoadPerNumaNode(
+      [] {
+        return std::make_shared<BertModel>(
+            TestModelFile(), DLDeviceType::kDLCPU, kTestLayers, kTestHeads);
+      },
+      &options);
+  REQUIRE(options.worker_cpus.size() == models.size());
+  auto expected = (*models.front())({input}, {}, {}, PoolType::kFirst, false);
+  BertBatcher batcher(models, options);
+  std::vector<std::future<std::vector<float>>> results;
+  for (size_t i = 0; i < 2 * models.size(); ++i) {
+    results.emplace_back(batcher.Submit(input));
+  }
+  for (auto &result : results) {
+    auto vec = result.get();
+    REQUIRE(vec.size() == expected.size());
+    for (size_t j = 0; j < vec.size(); ++j) {
+      REQUIRE(fabs(vec[j] - expected[j]) < 1e-4);
+    }
+  }
+}
+
+TEST_CASE("Bert-batcher-spillover", "Cpp interface") {
+  auto cpu_model = std::make_shared<BertModel>(
+      TestModelFile(), DLDeviceType::kDLCPU, kTestLayers, kTestHeads);
+  BertBatcher::Options options;
+  options.max_batch_size = 2;
+  options.use_pooler = true;
+  options.spillover = true;
+  // There is no GPU model to spill over from.
+  REQUIRE_THROWS(BertBatcher({cpu_model}, options));
+  if (!core::IsCompiledWithCUDA()) {
+    return;
+  }
+  auto gpu_model = std::make_shared<BertModel>(
+      TestModelFile(), DLDeviceType::kDLGPU, kTestLayers, kTestHeads);
+  std::vector<std::vector<int64_t>> inputs{{12166, 10699, 16752, 4454},
+                                           {5342, 16471, 817, 16022},
+                                           {12166, 10699},
+                                           {5342}};
+  std::vector<std::vector<float>> expected;
+  for (auto &input : inputs) {
+    expected.emplace_back(
+        (*cpu_model)({input}, {}, {}, PoolType::kFirst, true));
+  }
+  auto spilled = core::GetMetrics().spilled_batches;
+  std::vector<std::future<std::vector<float>>> results;
+  {
+    BertBatcher batcher({gpu_model, cpu_model}, options);
+    for (int round = 0; round < 16; ++round) {
+      for (auto &input : inputs) {
+        results.emplace_back(batcher.Submit(input));
+      }
+    }
+  }
+  REQUIRE(core::GetMetrics().spilled_batches >= spilled);
+  for (size_t i = 0; i < results.size(); ++i) {
+    // Either model may have run the batch.
+    auto vec = results[i].get();
+    auto &ref = expected[i % inputs.size()];
+    REQUIRE(vec.size() == ref.size());
+    for (size_t j = 0; j < vec.size(); ++j) {
+      REQUIRE(fabs(vec[j] - ref[j]) < 1e-3);
+    }
+  }
+}
+
+}  // namespace serving
+}  // namespace turbo_transformers
@@ -0,0 +1,2999 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/serving/bert_model.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <set>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+#include "cnpy.h"
+#include "loguru.hpp"
+#include "turbo_transformers/serving/model_registry.h"
+#include "turbo_transformers/serving/tokenizer.h"
+#ifdef TT_WITH_CUDA
+#include "turbo_transformers/core/cuda_allocator.h"
+#include "turbo_transformers/core/cuda_device_context.h"
+#include "turbo_transformers/core/cuda_enforce.cuh"
+#endif
+#include "turbo_transformers/core/config.h"
+#include "turbo_transformers/core/macros.h"
+#include "turbo_transformers/core/memory.h"
+#include "turbo_transformers/core/memory_planner.h"
+#include "turbo_transformers/core/memory_tracker.h"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/core/profiler.h"
+#include "turbo_transformers/core/tensor_copy.h"
+#include "turbo_transformers/core/workspace.h"
+#include "turbo_transformers/layers/bert_attention.h"
+#include "turbo_transformers/layers/bert_embedding.h"
+#include "turbo_transformers/layers/bert_intermediate.h"
+#include "turbo_transformers/layers/bert_layer.h"
+#include "turbo_transformers/layers/bert_output.h"
+#include "turbo_transformers/layers/bert_pooler.h"
+#include "turbo_transformers/layers/kernels/activation.h"
+#include "turbo_transformers/layers/kernels/common.h"
+#include "turbo_transformers/layers/kernels/layer_norm.h"
+#include "turbo_transformers/layers/kernels/mat_mul.h"
+#include "turbo_transformers/layers/kernels/prepare_inputs.h"
+#include "turbo_transformers/layers/kernels/window_merge.h"
+#include "turbo_transformers/layers/prepare_bert_masks.h"
+#include "turbo_transformers/layers/sequence_pool.h"
+#include "turbo_transformers/layers/tensor_parallel_bert_layer.h"
+#include "turbo_transformers/loaders/npz_load.h"
+#include "turbo_transformers/loaders/weight_file.h"
+#include "turbo_transformers/loaders/weight_uploader.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+using namespace turbo_transformers::loaders;
+
+static std::unique_ptr<layers::BERTEmbedding> LoadEmbedding(
+    NPZMapView npz, DLDeviceType dev, int dev_id,
+    WeightUploader *uploader = nullptr) {
+  NPZLoader params(std::move(npz), dev, dev_id, uploader);
+
+  return std::unique_ptr<layers::BERTEmbedding>(new layers::BERTEmbedding(
+      params["word_embeddings.weight"], params["position_embeddings.weight"],
+      params["token_type_embeddings.weight"], params["LayerNorm.weight"],
+      params["LayerNorm.bias"]));
+}
+
+static std::unique_ptr<layers::BertPooler> LoadPooler(
+    NPZMapView npz, DLDeviceType dev, int dev_id,
+    WeightUploader *uploader = nullptr) {
+  NPZLoader params(std::move(npz), dev, dev_id, uploader);
+
+  return std::unique_ptr<layers::BertPooler>(
+      new layers::BertPooler(params["dense.weight"], params["dense.bias"]));
+}
+
+// The bytes of the weights a model of `n_layers` loads from `root`, each
+// taking a multiple of `alignment` bytes, see WeightUploader.
+static size_t ModelBytes(NPZMapView &root, size_t n_layers, bool is_albert,
+                         size_t alignment) {
+  size_t bytes = root.Sub("embeddings").ByteSize(alignment) +
+                 root.Sub("encoder.embedding_hidden_mapping_in")
+                     .ByteSize(alignment) +
+                 root.Sub("pooler").ByteSize(alignment);
+  if (is_albert) {
+    return bytes + root.Sub("encoder.albert_layer").ByteSize(alignment);
+  }
+  for (size_t i = 0; i < n_layers; ++i) {
+    bytes += root.Sub("encoder.layer." + std::to_string(i)).ByteSize(alignment);
+  }
+  return bytes;
+}
+
+// The threads loading the layers of a model uploaded to the GPU.
+static constexpr size_t kLoadThreads = 4;
+
+// Runs fn(0), ..., fn(n - 1) on up to `n_threads` threads, and rethrows the
+// first exception of them. A single thread is the calling one.
+static void ParallelFor(size_t n, size_t n_threads,
+                        const std::function<void(size_t)> &fn) {
+  if (n_threads <= 1) {
+    for (size_t i = 0; i < n; ++i) {
+      fn(i);
+    }
+    return;
+  }
+  std::atomic<size_t> next(0);
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < std::min(n, n_threads); ++t) {
+    threads.emplace_back([&] {
+      for (size_t i = next++; i < n; i = next++) {
+        try {
+          fn(i);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(error_mutex);
+          if (error == nullptr) {
+            error = std::current_exception();
+          }
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  if (error != nullptr) {
+    std::rethrow_exception(error);
+  }
+}
+
+static constexpr const char *kEmbeddingOut = "BertModel/embedding_out";
+static constexpr const char *kHidden = "BertModel/hidden";
+static constexpr const char *kExtendedMask = "BertModel/extended_mask";
+static constexpr const char *kAttentionOut = "BertModel/attention_out";
+static constexpr const char *kIntermediateOut = "BertModel/intermediate_out";
+static constexpr const char *kPoolingOut = "BertModel/pooling_out";
+static constexpr const char *kPoolerOut = "BertModel/pooler_out";
+static constexpr const char *kExitLogits = "BertModel/exit_logits";
+static constexpr const char *kTaskPooled = "BertModel/task_pooled";
+static constexpr const char *kTaskLogits = "BertModel/task_logits";
+static constexpr const char *kMergedOut = "BertModel/merged_out";
+
+struct BERTLayer {
+  explicit BERTLayer(NPZLoader params, int64_t n_heads) {
+    hidden_size_ = params["output.LayerNorm.weight"].shape(0);
+    intermediate_size_ = params["intermediate.dense.weight"].shape(1);
+    // The pruned heads of a layer are removed from its qkv weight, the
+    // remaining ones keep the size of the unpruned heads.
+    auto qkv_weight = params["attention.qkv.weight"];
+    int64_t size_per_head = hidden_size_ / n_heads;
+    int64_t layer_heads = qkv_weight.shape(1) / 3 / size_per_head;
+    // define layer network here
+    attention_.reset(new layers::BertAttention(
+        std::move(qkv_weight), params["attention.qkv.bias"],
+        params["attention.output.dense.weight"],
+        params["attention.output.dense.bias"],
+        params["attention.output.LayerNorm.weight"],
+        params["attention.output.LayerNorm.bias"], layer_heads));
+    intermediate_.reset(
+        new layers::BertIntermediate(params["intermediate.dense.weight"],
+                                     params["intermediate.dense.bias"]));
+    output_.reset(new layers::BertOutput(
+        params["output.dense.weight"], params["output.dense.bias"],
+        params["output.LayerNorm.weight"], params["output.LayerNorm.bias"]));
+  }
+
+  // The attention takes the float `mask`, the lengths of the padded
+  // sequences, or the offsets of the packed ones, whichever is not null, see
+  // layers::BertAttention. A few masked tokens on the GPU run as a single
+  // kernel, see layers::RunFusedBertLayer.
+  void operator()(core::Tensor &hidden, const core::Tensor *mask,
+                  const core::Tensor *seq_lens,
+                  const core::Tensor *seq_offsets,
+                  core::Tensor *attention_out, core::Tensor *intermediate_out,
+                  core::Tensor *output, core::Workspace *workspace) {
+    if (seq_offsets == nullptr && seq_lens == nullptr) {
+      core::MemoryTagGuard tag("fused_layer");
+      if (layers::RunFusedBertLayer(*attention_, *intermediate_, *output_,
+                                    hidden, *mask, output, workspace)) {
+        return;
+      }
+    }
+    {
+      core::MemoryTagGuard tag("attention");
+      if (seq_offsets != nullptr) {
+        attention_->RunPacked(hidden, *seq_offsets, attention_out, workspace);
+      } else if (seq_lens != nullptr) {
+        attention_->RunWithSeqLens(hidden, *seq_lens, attention_out,
+                                   workspace);
+      } else {
+        (*attention_)(hidden, *mask, attention_out, workspace);
+      }
+    }
+    {
+      core::MemoryTagGuard tag("intermediate");
+      (*intermediate_)(*attention_out, intermediate_out);
+    }
+    core::MemoryTagGuard tag("output");
+    (*output_)(*intermediate_out, *attention_out, output);
+  }
+
+  // Compute the output of the query `row` of every sequence only, [batch_size,
+  // 1, hidden_size], so the intermediate and the output layers multiply a
+  // row per sequence, see layers::BertAttention::RunOnRow.
+  void RunOnRow(core::Tensor &hidden, const core::Tensor *mask,
+                const core::Tensor *seq_lens, int64_t row,
+                core::Tensor *attention_out, core::Tensor *intermediate_out,
+                core::Tensor *output, core::Workspace *workspace) {
+    {
+      core::MemoryTagGuard tag("attention");
+      attention_->RunOnRow(hidden, mask, seq_lens, row, attention_out,
+                           workspace);
+    }
+    {
+      core::MemoryTagGuard tag("intermediate");
+      (*intermediate_)(*attention_out, intermediate_out);
+    }
+    core::MemoryTagGuard tag("output");
+    (*output_)(*intermediate_out, *attention_out, output);
+  }
+
+  // Returns the index of the last operator of this layer, which writes the
+  // output hidden states.
+  int64_t PlanMemory(core::MemoryPlanner *planner, int64_t batch_size,
+                     int64_t seq_len, int64_t op) const {
+    op = attention_->PlanMemory(planner, batch_size, seq_len, op);
+    size_t n_tokens = batch_size * seq_len;
+    planner->AddUsage(kAttentionOut, n_tokens * hidden_size_ * sizeof(float),
+                      op, op + 2);
+    planner->AddUsage(kIntermediateOut,
+                      n_tokens * intermediate_size_ * sizeof(float), op + 1,
+                      op + 2);
+    return op + 2;
+  }
+
+  std::unique_ptr<layers::BertAttention> attention_;
+  std::unique_ptr<layers::BertIntermediate> intermediate_;
+  std::unique_ptr<layers::BertOutput> output_;
+  int64_t hidden_size_;
+  int64_t intermediate_size_;
+};
+
+// An early-exit classifier after an encoder layer, a pooler on the [CLS]
+// row followed by a linear layer.
+struct ExitHead {
+  ExitHead() : classifier_weight(nullptr) {}
+  std::unique_ptr<layers::BertPooler> pooler;
+  // [hidden_size, n_labels]
+  core::Tensor classifier_weight;
+  std::vector<float> classifier_bias;
+};
+
+// The heads of BertModel::LoadTaskHeads, merged so that those of a kind run
+// as a single GEMM: the poolers of the sequence heads side by side, their
+// classifiers block-diagonally on the pooled rows, and the classifiers of the
+// token heads side by side.
+struct TaskHeads {
+  TaskHeads()
+      : pooler_weight(nullptr),
+        pooler_bias(nullptr),
+        classifier_weight(nullptr),
+        token_weight(nullptr) {}
+  std::vector<BertModel::TaskHead> heads;
+  // The first column of each head among the logits of its kind, and its
+  // labels.
+  std::vector<int64_t> offsets;
+  std::vector<int64_t> n_labels;
+  // [hidden_size, n_sequence_heads * hidden_size] and its bias.
+  core::Tensor pooler_weight;
+  core::Tensor pooler_bias;
+  // [n_sequence_heads * hidden_size, n_sequence_labels]
+  core::Tensor classifier_weight;
+  // [hidden_size, n_token_labels]
+  core::Tensor token_weight;
+  // The biases are added to the logits on the host, per kind.
+  std::vector<float> classifier_bias;
+  std::vector<float> token_bias;
+};
+
+#ifdef TT_WITH_CUDA
+// A contiguous range of the encoder layers on one GPU of a pipeline, with the
+// activations of the micro-batch it runs.
+struct PipelineStage {
+  explicit PipelineStage(int device_id)
+      : device_id(device_id), computed(device_id), received(device_id) {}
+  int device_id;
+  size_t begin{0};
+  size_t end{0};
+  core::Workspace workspace;
+  // Recorded on the stream of the stage once it wrote the hidden states of a
+  // micro-batch, and once it copied them from the previous stage.
+  core::CUDAEvent computed;
+  core::CUDAEvent received;
+};
+
+// A GPU of a tensor-parallel model, with the activations of the batch it
+// runs.
+struct TensorParallelShard {
+  explicit TensorParallelShard(int device_id) : device_id(device_id) {}
+  int device_id;
+  core::Workspace workspace;
+};
+#endif
+
+struct BertModel::Impl {
+  // The layers are split into stages on the GPUs `pipeline_devices` unless
+  // it is empty, see the pipeline constructor of BertModel, or sharded over
+  // the GPUs `shard_devices`, see the tensor-parallel one.
+  explicit Impl(const std::string &filename, DLDeviceType device_type,
+                size_t n_layers, int64_t n_heads, int device_id,
+                const std::vector<int> &pipeline_devices = {},
+                int64_t micro_batch_size = 0,
+                const std::vector<int> &shard_devices = {})
+      : device_type_(device_type), device_id_(device_id) {
+    std::vector<int> layer_devices(n_layers, device_id);
+    if (!pipeline_devices.empty()) {
+      InitPipeline(pipeline_devices, micro_batch_size, &layer_devices);
+    }
+    cnpy::npz_t npz;
+    auto root = OpenWeights(filename, &npz);
+    bool is_albert = root.IsExist("encoder.albert_layer.");
+    weight_bytes_ = ModelBytes(root, n_layers, is_albert, 1);
+
+    // HERE define your network model
+    core::MemoryTagGuard weights_tag("weights");
+    // On a single GPU, the weights are uploaded into one allocation through
+    // pinned buffers, and the layers are loaded in parallel, so that reading
+    // the weights overlaps with their copies. The weights another model
+    // shares through the WeightStore are not uploaded again.
+    WeightUploader *uploader = nullptr;
+#ifdef TT_WITH_CUDA
+    std::unique_ptr<WeightUploader> gpu_uploader;
+    bool is_shared = WeightStore::GetInstance().enabled() &&
+                     WeightStore::GetInstance().Contains(
+                         root.source(), "embeddings.word_embeddings.weight",
+                         device_type, device_id);
+    if (device_type == DLDeviceType::kDLGPU && pipeline_devices.empty() &&
+        shard_devices.empty() && !is_shared) {
+      gpu_uploader.reset(new WeightUploader(
+          device_id, ModelBytes(root, n_layers, is_albert,
+                                WeightUploader::kAlignment)));
+      uploader = gpu_uploader.get();
+    }
+#endif
+    {
+      core::MemoryTagGuard tag("embeddings");
+      embedding_ = LoadEmbedding(root.Sub("embeddings"), device_type,
+                                 device_id, uploader);
+    }
+
+    // ALBERT shares the weights of one layer among all the layers, and
+    // projects its smaller embeddings to the hidden size.
+    if (root.IsExist("encoder.embedding_hidden_mapping_in.")) {
+      core::MemoryTagGuard tag("embeddings");
+      NPZLoader params(root.Sub("encoder.embedding_hidden_mapping_in"),
+                       device_type, device_id, uploader);
+      projection_weight_ = params["weight"];
+      projection_bias_ = params["bias"];
+      packed_projection_weight_ =
+          layers::kernels::PackLayerWeight(projection_weight_);
+    }
+    for (size_t i = 0; i < n_layers; ++i) {
+      layer_tags_.push_back("encoder.layer." + std::to_string(i));
+    }
+    if (shard_devices.empty()) {
+      LoadEncoders(root, n_heads, is_albert, layer_devices, uploader);
+    } else {
+      InitTensorParallel(root, n_heads, is_albert, shard_devices);
+    }
+
+    if (root.IsExist("pooler")) {
+      core::MemoryTagGuard tag("pooler");
+      pooler_ = LoadPooler(root.Sub("pooler"), device_type,
+                           layer_devices.empty() ? device_id
+                                                 : layer_devices.back(),
+                           uploader);
+    }
+#ifdef TT_WITH_CUDA
+    if (gpu_uploader != nullptr) {
+      gpu_uploader->Finish();
+    }
+#endif
+  }
+
+  // Runs the submitted batches before it returns.
+  ~Impl() {
+    {
+      std::lock_guard<std::mutex> lock(async_mutex_);
+      async_stopped_ = true;
+    }
+    async_cv_.notify_all();
+    if (async_worker_.joinable()) {
+      async_worker_.join();
+    }
+  }
+
+  // Load the layers of `layer_tags_`, each on its device of `layer_devices`.
+  void LoadEncoders(NPZMapView &root, int64_t n_heads, bool is_albert,
+                    const std::vector<int> &layer_devices,
+                    WeightUploader *uploader) {
+    size_t n_layers = layer_tags_.size();
+    // The shared layer is loaded once on every device of the layers.
+    std::map<int, std::shared_ptr<BERTLayer>> shared_layers;
+    encoders_.resize(n_layers);
+    for (size_t i = 0; i < n_layers; ++i) {
+      if (is_albert) {
+        auto &shared_layer = shared_layers[layer_devices[i]];
+        if (shared_layer == nullptr) {
+          core::MemoryTagGuard tag("encoder.albert_layer");
+          NPZLoader params(root.Sub("encoder.albert_layer"), device_type_,
+                           layer_devices[i], uploader);
+          shared_layer =
+              std::make_shared<BERTLayer>(std::move(params), n_heads);
+        }
+        encoders_[i] = shared_layer;
+      }
+    }
+    auto load_layer = [&](size_t i) {
+      core::MemoryTagGuard tag(layer_tags_[i]);
+      NPZLoader params(root.Sub(layer_tags_[i]), device_type_,
+                       layer_devices[i], uploader);
+      encoders_[i] = std::make_shared<BERTLayer>(std::move(params), n_heads);
+    };
+    if (!is_albert) {
+      ParallelFor(n_layers, uploader != nullptr ? kLoadThreads : 1,
+                  load_layer);
+    }
+  }
+
+  // Split the layers into a stage per device, and set the device of every
+  // layer in `layer_devices`. The embedding runs on the first device, which
+  // is `device_id_`, and the pooler on the last one.
+  void InitPipeline(const std::vector<int> &devices, int64_t micro_batch_size,
+                    std::vector<int> *layer_devices) {
+    TT_ENFORCE(device_type_ == DLDeviceType::kDLGPU,
+               "The pipeline runs on GPUs only");
+    TT_ENFORCE(devices.size() <= layer_devices->size(),
+               "The %d layers can not be split into %d stages",
+               layer_devices->size(), devices.size());
+    TT_ENFORCE_GT(micro_batch_size, 0,
+                  "The micro-batches should take a sequence at least");
+#ifdef TT_WITH_CUDA
+    micro_batch_size_ = micro_batch_size;
+    size_t n_layers = layer_devices->size();
+    for (size_t s = 0; s < devices.size(); ++s) {
+      std::unique_ptr<PipelineStage> stage(new PipelineStage(devices[s]));
+      stage->begin = s * n_layers / devices.size();
+      stage->end = (s + 1) * n_layers / devices.size();
+      std::fill(layer_devices->begin() + stage->begin,
+                layer_devices->begin() + stage->end, devices[s]);
+      if (s > 0) {
+        // The next stage reads the hidden states of the previous one.
+        core::EnablePeerAccess(devices[s], devices[s - 1]);
+      }
+      stages_.push_back(std::move(stage));
+    }
+#else
+    TT_THROW("TurboTransformers is built without CUDA");
+#endif
+  }
+
+  bool pipelined() const {
+#ifdef TT_WITH_CUDA
+    return !stages_.empty();
+#else
+    return false;
+#endif
+  }
+
+  // Shard every layer over `devices`, see the tensor-parallel constructor of
+  // BertModel. The layers are read on the host, and each GPU receives its
+  // slices only. The first device is `device_id_`.
+  void InitTensorParallel(NPZMapView &root, int64_t n_heads, bool is_albert,
+                          const std::vector<int> &devices) {
+    TT_ENFORCE(device_type_ == DLDeviceType::kDLGPU,
+               "The tensor-parallel layers run on GPUs only");
+#ifdef TT_WITH_CUDA
+    for (int device : devices) {
+      shards_.emplace_back(new TensorParallelShard(device));
+    }
+    for (size_t i = 0; i < layer_tags_.size(); ++i) {
+      if (is_albert && i > 0) {
+        tensor_parallel_layers_.push_back(tensor_parallel_layers_.front());
+        continue;
+      }
+      std::string tag = is_albert ? "encoder.albert_layer" : layer_tags_[i];
+      core::MemoryTagGuard tag_guard(tag);
+      NPZLoader params(root.Sub(tag), DLDeviceType::kDLCPU);
+      layers::BertLayerWeights weights;
+      weights.qkv_weight = params["attention.qkv.weight"];
+      weights.qkv_bias = params["attention.qkv.bias"];
+      weights.attention_dense_weight = params["attention.output.dense.weight"];
+      weights.attention_dense_bias = params["attention.output.dense.bias"];
+      weights.attention_layer_norm_weight =
+          params["attention.output.LayerNorm.weight"];
+      weights.attention_layer_norm_bias =
+          params["attention.output.LayerNorm.bias"];
+      weights.intermediate_weight = params["intermediate.dense.weight"];
+      weights.intermediate_bias = params["intermediate.dense.bias"];
+      weights.output_dense_weight = params["output.dense.weight"];
+      weights.output_dense_bias = params["output.dense.bias"];
+      weights.output_layer_norm_weight = params["output.LayerNorm.weight"];
+      weights.output_layer_norm_bias = params["output.LayerNorm.bias"];
+      int64_t hidden_size = weights.output_dense_weight.shape(1);
+      int64_t all_head_size = weights.qkv_weight.shape(1) / 3;
+      int64_t layer_heads = all_head_size / (hidden_size / n_heads);
+      tensor_parallel_layers_.emplace_back(new layers::TensorParallelBertLayer(
+          weights, layer_heads, device_type_, devices));
+    }
+#else
+    TT_THROW("TurboTransformers is built without CUDA");
+#endif
+  }
+
+  bool tensor_parallel() const {
+#ifdef TT_WITH_CUDA
+    return !shards_.empty();
+#else
+    return false;
+#endif
+  }
+
+  // The layers run on several GPUs, as a pipeline or sharded, which the
+  // features of a single device do not support.
+  bool multi_gpu() const { return pipelined() || tensor_parallel(); }
+
+  core::MemoryPlan MakeMemoryPlan(int64_t batch_size, int64_t seq_len) const {
+    TT_ENFORCE(!encoders_.empty(), "The model has no encoder layer");
+    core::MemoryPlanner planner;
+    int64_t hidden_size = encoders_.front()->hidden_size_;
+    size_t n_tokens = batch_size * seq_len;
+    // op 0 is the embedding, followed by the encoder layers, the sequence
+    // pooling and the pooler.
+    int64_t op = 0;
+    if (!projection_weight_.is_null()) {
+      planner.AddUsage(kEmbeddingOut,
+                       n_tokens * projection_weight_.shape(0) * sizeof(float),
+                       0, 0);
+    }
+    for (auto &layer : encoders_) {
+      op = layer->PlanMemory(&planner, batch_size, seq_len, op + 1);
+    }
+    planner.AddUsage(kHidden, n_tokens * hidden_size * sizeof(float), 0,
+                     op + 1);
+    planner.AddUsage(kExtendedMask, n_tokens * sizeof(float), 0, op);
+    planner.AddUsage(kPoolingOut, batch_size * hidden_size * sizeof(float),
+                     op + 1, op + 2);
+    planner.AddUsage(kPoolerOut, batch_size * hidden_size * sizeof(float),
+                     op + 2, op + 2);
+    return planner.Plan();
+  }
+
+  void PlanMemory(int64_t max_batch_size, int64_t max_seq_len) {
+    TT_ENFORCE(!multi_gpu(), "A model on several GPUs plans no memory");
+    auto plan = MakeMemoryPlan(max_batch_size, max_seq_len);
+    std::lock_guard<std::mutex> lock(workspace_mutex_);
+    memory_plan_ = std::move(plan);
+    memory_planned_ = true;
+    idle_workspaces_.clear();
+    LOG_S(1) << "The planned activation memory takes "
+             << memory_plan_.total_size << " bytes";
+  }
+
+  void WarmUp(const std::vector<std::pair<int64_t, int64_t>> &shapes,
+              PoolType pooling, bool use_pooler) {
+    auto sorted_shapes = shapes;
+    std::sort(sorted_shapes.begin(), sorted_shapes.end(),
+              [](const std::pair<int64_t, int64_t> &a,
+                 const std::pair<int64_t, int64_t> &b) {
+                return a.first * a.second > b.first * b.second;
+              });
+    for (auto &shape : sorted_shapes) {
+      TT_ENFORCE(shape.first > 0 && shape.second > 0,
+                 "The warm up shape [%d, %d] is empty", shape.first,
+                 shape.second);
+      std::vector<std::vector<int64_t>> inputs(
+          shape.first, std::vector<int64_t>(shape.second, 0));
+      RunUncached(inputs, {}, {}, pooling, use_pooler);
+    }
+  }
+
+  // Concurrent calls each run in a workspace of their own, the idle ones are
+  // kept so that their arenas are reused.
+  std::unique_ptr<core::Workspace> AcquireWorkspace() {
+    std::lock_guard<std::mutex> lock(workspace_mutex_);
+    if (workspace_pool_ != nullptr) {
+      return workspace_pool_->Acquire(memory_planned_ ? &memory_plan_ : nullptr,
+                                      device_type_, device_id_);
+    }
+    if (!idle_workspaces_.empty()) {
+      auto workspace = std::move(idle_workspaces_.back());
+      idle_workspaces_.pop_back();
+      return workspace;
+    }
+    std::unique_ptr<core::Workspace> workspace(new core::Workspace());
+    if (memory_planned_) {
+      core::MemoryTagGuard tag("workspace");
+      workspace->Reserve(memory_plan_, device_type_, device_id_);
+    }
+    return workspace;
+  }
+
+  void ReleaseWorkspace(std::unique_ptr<core::Workspace> workspace) {
+    std::lock_guard<std::mutex> lock(workspace_mutex_);
+    if (workspace_pool_ != nullptr) {
+      workspace_pool_->Release(std::move(workspace));
+      return;
+    }
+    idle_workspaces_.emplace_back(std::move(workspace));
+  }
+
+  // preprocess helper function, `device_type` is a host device.
+  template <typename T>
+  void PadTensor(const std::vector<std::vector<T>> &data_array, int64_t n,
+                 int64_t m, T pad_val, DLDeviceType device_type,
+                 core::Tensor *output_tensor) {
+    if (m == 0 || n == 0 || data_array.size() == 0) {
+      return;
+    }
+    T *tensor_data_ptr =
+        output_tensor->Reshape<T>({n, m}, device_type, device_id_);
+    for (int64_t i = 0; i < n; ++i, tensor_data_ptr += m) {
+      auto &line = data_array[i];
+      if (line.size() > 0) {
+        core::Copy(line.data(), line.size(), DLDeviceType::kDLCPU,
+                   DLDeviceType::kDLCPU, tensor_data_ptr);
+      }
+      if (line.size() != static_cast<size_t>(m)) {
+        layers::kernels::common::Fill(tensor_data_ptr + line.size(),
+                                      static_cast<size_t>(m) - line.size(),
+                                      pad_val, DLDeviceType::kDLCPU);
+      }
+    }
+  }
+
+  // Copy a host input into `device_tensor` on the current stream. A null
+  // input stays null, so that PrepareBertMasks fills in its default.
+  void CopyInputToDevice(const core::Tensor &host_tensor,
+                         core::Tensor *device_tensor) {
+    if (host_tensor.is_null()) {
+      return;
+    }
+    device_tensor->Reshape<int64_t>(
+        {host_tensor.shape(0), host_tensor.shape(1)}, DLDeviceType::kDLGPU,
+        device_id_);
+    core::CopyAsync<int64_t>(host_tensor, *device_tensor);
+  }
+
+  // Copy the result back to the host. The inputs are copied to the device
+  // asynchronously, so this is the only point where the host waits for the
+  // device.
+  std::vector<float> CopyResultToHost(const core::Tensor &result) {
+    std::vector<float> vec(result.numel());
+    if (device_type_ == DLDeviceType::kDLGPU) {
+#ifdef TT_WITH_CUDA
+      core::Tensor host_result(nullptr);
+      auto *host_ptr = host_result.Reshape<float>(
+          {result.numel()}, DLDeviceType::kDLCPUPinned, device_id_);
+      core::CopyAsync<float>(result, host_result);
+      core::CUDADeviceContext::GetInstance(device_id_).Wait();
+      std::copy(host_ptr, host_ptr + result.numel(), vec.begin());
+#endif
+    } else {
+      core::Copy(result, vec);
+    }
+    return vec;
+  }
+
+  // Look up the embeddings of the tokens into `hidden`, projected to the
+  // hidden size if the model has smaller embeddings.
+  void Embed(const core::Tensor &input_ids, const core::Tensor &position_ids,
+             const core::Tensor &segment_ids, core::Tensor *hidden,
+             core::Workspace *workspace) {
+    core::MemoryTagGuard tag("embeddings");
+    if (projection_weight_.is_null()) {
+      (*embedding_)(input_ids, position_ids, segment_ids, hidden);
+      return;
+    }
+    auto &embedding_out = workspace->GetTensor<float>(
+        kEmbeddingOut,
+        {input_ids.shape(0), input_ids.shape(1), projection_weight_.shape(0)},
+        device_type_, device_id_);
+    (*embedding_)(input_ids, position_ids, segment_ids, &embedding_out);
+    if (!packed_projection_weight_.is_null()) {
+      layers::kernels::MatMul(embedding_out, packed_projection_weight_,
+                              *hidden, 0.0);
+    } else {
+      layers::kernels::MatMul(embedding_out, false, projection_weight_, false,
+                              1.0, *hidden, 0.0);
+    }
+    layers::kernels::AddBiasAct<float,
+                                layers::kernels::ActivationType::Identity>(
+        projection_bias_, hidden);
+  }
+
+  // Run the network on inputs which are already on the device of the model.
+  // Returns the output, a tensor of `workspace`. If the int64 CPU `seq_lens`
+  // are given, the attention skips the padding by the lengths instead of
+  // masking it, and `masks` are unused. If `inputs_prepared`, the segment ids
+  // and the extended mask of `workspace` are already filled in, see
+  // RunPackedAsPadded. `after_layer` is called after every layer but the
+  // last, see RunEncoders.
+  core::Tensor &Forward(core::Tensor &input_ids, core::Tensor &masks,
+                        core::Tensor &position_ids, core::Tensor &segment_ids,
+                        PoolType pooling, bool use_pooler,
+                        core::Workspace *workspace,
+                        const core::Tensor *seq_lens = nullptr,
+                        bool inputs_prepared = false,
+                        const std::function<void()> *after_layer = nullptr) {
+    core::MemoryTagGuard activations_tag("activations");
+    if (pooled_rows_only_ &&
+        (pooling == PoolType::kFirst || pooling == PoolType::kLast)) {
+      core::Tensor *mask = nullptr;
+      auto &hidden =
+          Encode(input_ids, masks, position_ids, segment_ids, workspace,
+                 seq_lens, inputs_prepared, after_layer,
+                 encoders_.size() - 1, &mask);
+      if (after_layer != nullptr && encoders_.size() > 1) {
+        (*after_layer)();
+      }
+      return RunLastLayerOnRow(hidden, mask, seq_lens, pooling, use_pooler,
+                               workspace);
+    }
+    auto &hidden =
+        Encode(input_ids, masks, position_ids, segment_ids, workspace,
+               seq_lens, inputs_prepared, after_layer, encoders_.size());
+    return Pool(hidden, pooling, use_pooler, workspace);
+  }
+
+  // The first part of Forward: the hidden states [batch_size, seq_len,
+  // hidden_size] after the layers [0, end), a tensor of `workspace`. The
+  // extended mask the layers ran with is returned in `mask` if not null,
+  // null if they ran by `seq_lens`. The caller tags the activations.
+  core::Tensor &Encode(core::Tensor &input_ids, core::Tensor &masks,
+                       core::Tensor &position_ids, core::Tensor &segment_ids,
+                       core::Workspace *workspace,
+                       const core::Tensor *seq_lens, bool inputs_prepared,
+                       const std::function<void()> *after_layer, size_t end,
+                       core::Tensor **mask = nullptr) {
+    int64_t batch_size = input_ids.shape(0);
+    int64_t seq_len = input_ids.shape(1);
+    core::Tensor *extendedAttentionMask = nullptr;
+    if (seq_lens == nullptr) {
+      extendedAttentionMask = &workspace->GetTensor<float>(
+          kExtendedMask, {batch_size, 1, 1, seq_len}, device_type_,
+          device_id_);
+    }
+    // The embedding generates the default positions on the fly.
+    if (!inputs_prepared) {
+      layers::PrepareBertMasks()(
+          input_ids, seq_lens == nullptr ? &masks : nullptr, &segment_ids,
+          position_ids.is_null() ? nullptr : &position_ids,
+          extendedAttentionMask);
+    }
+
+    // start inference the BERT
+    int64_t hidden_size = encoders_.front()->hidden_size_;
+    auto &hidden = workspace->GetTensor<float>(
+        kHidden, {batch_size, seq_len, hidden_size}, device_type_, device_id_);
+    Embed(input_ids, position_ids, segment_ids, &hidden, workspace);
+    RunEncoders(0, end, extendedAttentionMask, seq_lens, nullptr, &hidden,
+                workspace, after_layer);
+    if (mask != nullptr) {
+      *mask = extendedAttentionMask;
+    }
+    return hidden;
+  }
+
+  // Run the last layer on the row `pooling` takes of every sequence, whose
+  // output is the pooled one, then the pooler on it if `use_pooler`. The
+  // padded sequences pool the rows SequencePool does, see Pool.
+  core::Tensor &RunLastLayerOnRow(core::Tensor &hidden,
+                                  const core::Tensor *mask,
+                                  const core::Tensor *seq_lens,
+                                  PoolType pooling, bool use_pooler,
+                                  core::Workspace *workspace) {
+    int64_t batch_size = hidden.shape(0);
+    int64_t seq_len = hidden.shape(1);
+    int64_t hidden_size = hidden.shape(2);
+    int device_id = hidden.device_id();
+    size_t i = encoders_.size() - 1;
+    auto &layer = *encoders_[i];
+    core::MemoryTagGuard tag(layer_tags_[i]);
+    core::ProfileScope layer_scope("Layer", hidden, static_cast<int>(i));
+    auto &attOut = workspace->GetTensor<float>(
+        kAttentionOut, {batch_size, 1, hidden_size}, device_type_, device_id);
+    auto &intermediateOut = workspace->GetTensor<float>(
+        kIntermediateOut, {batch_size, 1, layer.intermediate_size_},
+        device_type_, device_id);
+    auto &poolingOutput = workspace->GetTensor<float>(
+        kPoolingOut, {batch_size, 1, hidden_size}, device_type_, device_id);
+    layer.RunOnRow(hidden, mask, seq_lens,
+                   pooling == PoolType::kFirst ? 0 : seq_len - 1, &attOut,
+                   &intermediateOut, &poolingOutput, workspace);
+    poolingOutput.Reshape<float>({batch_size, hidden_size}, device_type_,
+                                 device_id);
+    if (!use_pooler) {
+      return poolingOutput;
+    }
+    auto &output = workspace->GetTensor<float>(
+        kPoolerOut, {batch_size, hidden_size}, device_type_, device_id);
+    (*pooler_)(poolingOutput, &output);
+    return output;
+  }
+
+  // Run the layers [begin, end) on `hidden`, which is passed to the attention
+  // with `mask`, `seq_lens` and `seq_offsets`, see BERTLayer. The
+  // activations are on the device of `hidden`. `after_layer`, if given, is
+  // called between two layers.
+  void RunEncoders(size_t begin, size_t end, const core::Tensor *mask,
+                   const core::Tensor *seq_lens,
+                   const core::Tensor *seq_offsets, core::Tensor *hidden,
+                   core::Workspace *workspace,
+                   const std::function<void()> *after_layer = nullptr) {
+    int64_t batch_size = hidden->shape(0);
+    int64_t seq_len = hidden->shape(1);
+    int64_t hidden_size = hidden->shape(2);
+    int device_id = hidden->device_id();
+    for (size_t i = begin; i < end; ++i) {
+      auto &layer = *encoders_[i];
+      core::MemoryTagGuard tag(layer_tags_[i]);
+      core::ProfileScope layer_scope("Layer", *hidden, static_cast<int>(i));
+      auto &attOut = workspace->GetTensor<float>(
+          kAttentionOut, {batch_size, seq_len, hidden_size}, device_type_,
+          device_id);
+      auto &intermediateOut = workspace->GetTensor<float>(
+          kIntermediateOut, {batch_size, seq_len, layer.intermediate_size_},
+          device_type_, device_id);
+      if (after_layer != nullptr && i > begin) {
+        (*after_layer)();
+      }
+      layer(*hidden, mask, seq_lens, seq_offsets, &attOut, &intermediateOut,
+            hidden, workspace);
+    }
+  }
+
+  // Pool the padded `hidden` states, then run the pooler if `use_pooler`.
+  core::Tensor &Pool(const core::Tensor &hidden, PoolType pooling,
+                     bool use_pooler, core::Workspace *workspace) {
+    int64_t batch_size = hidden.shape(0);
+    int64_t hidden_size = hidden.shape(2);
+    auto &poolingOutput = workspace->GetTensor<float>(
+        kPoolingOut, {batch_size, hidden_size}, device_type_,
+        hidden.device_id());
+    layers::SequencePool(static_cast<layers::types::PoolType>(pooling))(
+        hidden, &poolingOutput);
+    if (!use_pooler) {
+      return poolingOutput;
+    }
+    auto &output = workspace->GetTensor<float>(
+        kPoolerOut, {batch_size, hidden_size}, device_type_,
+        hidden.device_id());
+    (*pooler_)(poolingOutput, &output);
+    return output;
+  }
+
+  // The last hidden states [1, total_tokens, hidden_size] of the packed
+  // tokens, see ForwardPacked.
+  core::Tensor &EncodePacked(core::Tensor &input_ids,
+                             core::Tensor &position_ids,
+                             core::Tensor &segment_ids,
+                             const core::Tensor &seq_offsets,
+                             core::Workspace *workspace) {
+    int64_t total_tokens = input_ids.shape(1);
+    core::MemoryTagGuard activations_tag("activations");
+    int64_t hidden_size = encoders_.front()->hidden_size_;
+    auto &hidden = workspace->GetTensor<float>(
+        kHidden, {1, total_tokens, hidden_size}, device_type_, device_id_);
+    Embed(input_ids, position_ids, segment_ids, &hidden, workspace);
+    RunEncoders(0, encoders_.size(), nullptr, nullptr, &seq_offsets, &hidden,
+                workspace);
+    return hidden;
+  }
+
+  // Run the network on the packed tokens [1, total_tokens] of the sequences
+  // between `seq_offsets`, which are already on the device of the model. The
+  // packed tokens take at most the planned memory of the padded batch.
+  core::Tensor &ForwardPacked(core::Tensor &input_ids,
+                              core::Tensor &position_ids,
+                              core::Tensor &segment_ids,
+                              const core::Tensor &seq_offsets,
+                              PoolType pooling, bool use_pooler,
+                              core::Workspace *workspace) {
+    int64_t batch_size = seq_offsets.numel() - 1;
+    int64_t hidden_size = encoders_.front()->hidden_size_;
+    auto &hidden = EncodePacked(input_ids, position_ids, segment_ids,
+                                seq_offsets, workspace);
+    core::MemoryTagGuard activations_tag("activations");
+    auto &poolingOutput = workspace->GetTensor<float>(
+        kPoolingOut, {batch_size, hidden_size}, device_type_, device_id_);
+    layers::SequencePool(static_cast<layers::types::PoolType>(pooling))
+        .RunPacked(hidden, seq_offsets, &poolingOutput);
+    if (!use_pooler) {
+      return poolingOutput;
+    }
+    auto &output = workspace->GetTensor<float>(
+        kPoolerOut, {batch_size, hidden_size}, device_type_, device_id_);
+    (*pooler_)(poolingOutput, &output);
+    return output;
+  }
+
+  // Concatenate the sequences without padding. The positions restart at
+  // every sequence unless they are given.
+  // As PadTensor, a given line shorter than its input is padded with 0.
+  static void CopyLine(const std::vector<int64_t> &line, size_t len,
+                       int64_t *dst) {
+    auto n = std::min(line.size(), len);
+    std::copy(line.begin(), line.begin() + n, dst);
+    std::fill(dst + n, dst + len, 0);
+  }
+
+  std::vector<float> RunPacked(
+      const std::vector<std::vector<int64_t>> &inputs,
+      const std::vector<std::vector<int64_t>> &poistion_ids,
+      const std::vector<std::vector<int64_t>> &segment_ids, PoolType pooling,
+      bool use_pooler) {
+    int64_t batch_size = inputs.size();
+    TT_ENFORCE(poistion_ids.empty() ||
+                   poistion_ids.size() == static_cast<size_t>(batch_size),
+               "Position ids should have the same batch size as ibout ids");
+    TT_ENFORCE(segment_ids.empty() ||
+                   segment_ids.size() == static_cast<size_t>(batch_size),
+               "Segment ids should have the same batch size as ibout ids");
+    core::Tensor seq_offsets(nullptr);
+    auto *offsets = seq_offsets.Reshape<int64_t>({batch_size + 1},
+                                                 DLDeviceType::kDLCPU, 0);
+    offsets[0] = 0;
+    for (int64_t i = 0; i < batch_size; ++i) {
+      TT_ENFORCE(!inputs[i].empty(), "The input %d is empty", i);
+      offsets[i + 1] = offsets[i] + inputs[i].size();
+    }
+    int64_t total_tokens = offsets[batch_size];
+    core::RecordBatch(batch_size, total_tokens, 0);
+
+    auto host_device = device_type_ == DLDeviceType::kDLGPU
+                           ? DLDeviceType::kDLCPUPinned
+                           : DLDeviceType::kDLCPU;
+    core::Tensor inputs_tensor(nullptr);
+    core::Tensor positionIds(nullptr);
+    core::Tensor seqType(nullptr);
+    auto *iptr = inputs_tensor.Reshape<int64_t>({1, total_tokens},
+                                                host_device, device_id_);
+    auto *pptr = positionIds.Reshape<int64_t>({1, total_tokens}, host_device,
+                                              device_id_);
+    auto *sptr =
+        seqType.Reshape<int64_t>({1, total_tokens}, host_device, device_id_);
+    for (int64_t i = 0; i < batch_size; ++i) {
+      auto len = inputs[i].size();
+      std::copy(inputs[i].begin(), inputs[i].end(), iptr + offsets[i]);
+      if (poistion_ids.empty()) {
+        std::iota(pptr + offsets[i], pptr + offsets[i + 1], 0);
+      } else {
+        CopyLine(poistion_ids[i], len, pptr + offsets[i]);
+      }
+      if (segment_ids.empty()) {
+        std::fill(sptr + offsets[i], sptr + offsets[i + 1], 0);
+      } else {
+        CopyLine(segment_ids[i], len, sptr + offsets[i]);
+      }
+    }
+
+    return RunPackedOnHost(inputs_tensor, positionIds, seqType, seq_offsets,
+                           pooling, use_pooler);
+  }
+
+  // Run the packed host inputs [1, total_tokens] of the sequences between
+  // the CPU `seq_offsets`, uploaded first on the GPU, see ForwardPacked.
+  std::vector<float> RunPackedOnHost(core::Tensor &inputs_tensor,
+                                     core::Tensor &positionIds,
+                                     core::Tensor &seqType,
+                                     const core::Tensor &seq_offsets,
+                                     PoolType pooling, bool use_pooler) {
+    auto workspace = AcquireWorkspace();
+    std::vector<float> vec;
+    if (device_type_ == DLDeviceType::kDLCPU) {
+      vec = CopyResultToHost(ForwardPacked(inputs_tensor, positionIds,
+                                           seqType, seq_offsets, pooling,
+                                           use_pooler, workspace.get()));
+    } else {
+      core::Tensor gpuInputs_tensor{nullptr};
+      core::Tensor gpuPositionIds{nullptr};
+      core::Tensor gpuSeqType{nullptr};
+      CopyInputToDevice(inputs_tensor, &gpuInputs_tensor);
+      CopyInputToDevice(positionIds, &gpuPositionIds);
+      CopyInputToDevice(seqType, &gpuSeqType);
+      vec = CopyResultToHost(ForwardPacked(gpuInputs_tensor, gpuPositionIds,
+                                           gpuSeqType, seq_offsets, pooling,
+                                           use_pooler, workspace.get()));
+    }
+    ReleaseWorkspace(std::move(workspace));
+    return vec;
+  }
+
+#ifdef TT_WITH_CUDA
+  // The inputs and the activations of a graph live in buffers of its own,
+  // since the captured kernels always access the same addresses.
+  struct CUDAGraph {
+    CUDAGraph() = default;
+    ~CUDAGraph() {
+      if (exec != nullptr) {
+        cudaGraphExecDestroy(exec);
+      }
+    }
+
+    std::mutex mutex;
+    core::Workspace workspace;
+    core::Tensor input_ids{nullptr};
+    core::Tensor masks{nullptr};
+    core::Tensor position_ids{nullptr};
+    core::Tensor segment_ids{nullptr};
+    core::Tensor *output{nullptr};
+    cudaGraphExec_t exec{nullptr};
+    DISABLE_COPY_AND_ASSIGN(CUDAGraph);
+  };
+
+  // batch size, sequence length, pooling, use_pooler, and whether the
+  // position and the segment ids are given.
+  using CUDAGraphKey = std::tuple<int64_t, int64_t, int, bool, bool, bool>;
+
+  // Capture the network for the shapes of the given inputs. The pooling
+  // reads the padded positions, so a graph serves only the exact shape it was
+  // captured with, rather than a range of shapes.
+  std::unique_ptr<CUDAGraph> CaptureCUDAGraph(
+      const core::Tensor &input_ids, const core::Tensor &masks,
+      const core::Tensor &position_ids, const core::Tensor &segment_ids,
+      PoolType pooling, bool use_pooler) {
+    std::unique_ptr<CUDAGraph> graph(new CUDAGraph());
+    graph->workspace.Reserve(
+        MakeMemoryPlan(input_ids.shape(0), input_ids.shape(1)), device_type_,
+        device_id_);
+
+    // Other threads must not enqueue into the capturing stream, so all the
+    // captures of the process share one stream.
+    static std::mutex capture_mutex;
+    std::lock_guard<std::mutex> lock(capture_mutex);
+    core::CUDAStreamGuard guard(device_id_,
+                                core::CUDADeviceContext::kCaptureStreamId);
+    auto &context = core::CUDADeviceContext::GetInstance(device_id_);
+    CopyInputToDevice(input_ids, &graph->input_ids);
+    CopyInputToDevice(masks, &graph->masks);
+    CopyInputToDevice(position_ids, &graph->position_ids);
+    CopyInputToDevice(segment_ids, &graph->segment_ids);
+
+    // The warm up run allocates every tensor which is not planned, and the
+    // default masks and segment ids, which keep their values afterwards.
+    // Nothing is allocated while capturing.
+    Forward(graph->input_ids, graph->masks, graph->position_ids,
+            graph->segment_ids, pooling, use_pooler, &graph->workspace);
+    context.Wait();
+
+    cudaGraph_t cuda_graph;
+    TT_ENFORCE_CUDA_SUCCESS(cudaStreamBeginCapture(
+        context.stream(), cudaStreamCaptureModeThreadLocal));
+    graph->output = &Forward(graph->input_ids, graph->masks,
+                             graph->position_ids, graph->segment_ids, pooling,
+                             use_pooler, &graph->workspace);
+    TT_ENFORCE_CUDA_SUCCESS(
+        cudaStreamEndCapture(context.stream(), &cuda_graph));
+    auto status =
+        cudaGraphInstantiate(&graph->exec, cuda_graph, nullptr, nullptr, 0);
+    TT_ENFORCE_CUDA_SUCCESS(cudaGraphDestroy(cuda_graph));
+    TT_ENFORCE_CUDA_SUCCESS(status);
+    LOG_S(1) << "Captured a CUDA graph for the inputs of shape ["
+             << input_ids.shape(0) << ", " << input_ids.shape(1) << "]";
+    return graph;
+  }
+
+  CUDAGraph &GetCUDAGraph(const core::Tensor &input_ids,
+                          const core::Tensor &masks,
+                          const core::Tensor &position_ids,
+                          const core::Tensor &segment_ids, PoolType pooling,
+                          bool use_pooler) {
+    CUDAGraphKey key(input_ids.shape(0), input_ids.shape(1),
+                     static_cast<int>(pooling), use_pooler,
+                     !position_ids.is_null(), !segment_ids.is_null());
+    {
+      std::lock_guard<std::mutex> lock(graph_mutex_);
+      auto iter = graphs_.find(key);
+      if (iter != graphs_.end()) {
+        return *iter->second;
+      }
+    }
+    auto graph = CaptureCUDAGraph(input_ids, masks, position_ids, segment_ids,
+                                  pooling, use_pooler);
+    std::lock_guard<std::mutex> lock(graph_mutex_);
+    // Another thread may have captured the same key in the meantime.
+    auto &slot = graphs_[key];
+    if (slot == nullptr) {
+      slot = std::move(graph);
+    }
+    return *slot;
+  }
+
+  std::vector<float> RunCUDAGraph(const core::Tensor &input_ids,
+                                  const core::Tensor &masks,
+                                  const core::Tensor &position_ids,
+                                  const core::Tensor &segment_ids,
+                                  PoolType pooling, bool use_pooler) {
+    auto &graph = GetCUDAGraph(input_ids, masks, position_ids, segment_ids,
+                               pooling, use_pooler);
+    // The buffers of a graph are shared by its replays.
+    std::lock_guard<std::mutex> lock(graph.mutex);
+    CopyInputToDevice(input_ids, &graph.input_ids);
+    CopyInputToDevice(masks, &graph.masks);
+    CopyInputToDevice(position_ids, &graph.position_ids);
+    CopyInputToDevice(segment_ids, &graph.segment_ids);
+    TT_ENFORCE_CUDA_SUCCESS(cudaGraphLaunch(
+        graph.exec, core::CUDADeviceContext::GetInstance(device_id_).stream()));
+    return CopyResultToHost(*graph.output);
+  }
+#endif
+
+  // do inference
+  std::vector<float> operator()(
+      const std::vector<std::vector<int64_t>> &inputs,
+      const std::vector<std::vector<int64_t>> &poistion_ids,
+      const std::vector<std::vector<int64_t>> &segment_ids, PoolType pooling,
+      bool use_pooler) {
+    if (result_cache_ != nullptr) {
+      return RunCached(inputs, poistion_ids, segment_ids, pooling, use_pooler);
+    }
+    return RunUncached(inputs, poistion_ids, segment_ids, pooling, use_pooler);
+  }
+
+  // Run the batch, in halves if it is predicted not to fit in the workspace
+  // budget or if it runs out of memory, see EnableBatchSplitting.
+  std::vector<float> RunUncached(
+      const std::vector<std::vector<int64_t>> &inputs,
+      const std::vector<std::vector<int64_t>> &poistion_ids,
+      const std::vector<std::vector<int64_t>> &segment_ids, PoolType pooling,
+      bool use_pooler) {
+    if (!batch_splitting_ || inputs.size() < 2 || pipelined()) {
+      return RunUnsplit(inputs, poistion_ids, segment_ids, pooling,
+                        use_pooler);
+    }
+    if (max_workspace_bytes_ != 0) {
+      int64_t max_seq_len = 0;
+      for (auto &input : inputs) {
+        max_seq_len = std::max(max_seq_len, static_cast<int64_t>(input.size()));
+      }
+      if (MakeMemoryPlan(inputs.size(), max_seq_len).total_size >
+          max_workspace_bytes_) {
+        core::AddToCounter(core::Counter::kPredictedBatchSplits, 1);
+        return RunHalves(inputs, poistion_ids, segment_ids, pooling,
+                         use_pooler);
+      }
+    }
+    try {
+      return RunUnsplit(inputs, poistion_ids, segment_ids, pooling,
+                        use_pooler);
+    } catch (const core::OutOfMemory &e) {
+#ifdef TT_WITH_CUDA
+      // A capture interrupted by the error leaves its stream unusable.
+      if (cuda_graph_enabled_) {
+        throw;
+      }
+      core::CUDAAllocator::GetInstance().free_all_cache();
+#endif
+      LOG_S(WARNING) << "A batch of " << inputs.size()
+                     << " sequences ran out of memory, splitting it: "
+                     << e.what();
+      core::AddToCounter(core::Counter::kOutOfMemoryBatchSplits, 1);
+    }
+    return RunHalves(inputs, poistion_ids, segment_ids, pooling, use_pooler);
+  }
+
+  std::vector<float> RunHalves(
+      const std::vector<std::vector<int64_t>> &inputs,
+      const std::vector<std::vector<int64_t>> &poistion_ids,
+      const std::vector<std::vector<int64_t>> &segment_ids, PoolType pooling,
+      bool use_pooler) {
+    size_t half = inputs.size() / 2;
+    auto slice = [](const std::vector<std::vector<int64_t>> &lines,
+                    size_t begin, size_t end) {
+      if (lines.empty()) {
+        return lines;
+      }
+      return std::vector<std::vector<int64_t>>(lines.begin() + begin,
+                                               lines.begin() + end);
+    };
+    auto vec = RunUncached(slice(inputs, 0, half),
+                           slice(poistion_ids, 0, half),
+                           slice(segment_ids, 0, half), pooling, use_pooler);
+    auto second = RunUncached(
+        slice(inputs, half, inputs.size()),
+        slice(poistion_ids, half, inputs.size()),
+        slice(segment_ids, half, inputs.size()), pooling, use_pooler);
+    vec.insert(vec.end(), second.begin(), second.end());
+    return vec;
+  }
+
+  std::vector<float> RunUnsplit(
+      const std::vector<std::vector<int64_t>> &inputs,
+      const std::vector<std::vector<int64_t>> &poistion_ids,
+      const std::vector<std::vector<int64_t>> &segment_ids, PoolType pooling,
+      bool use_pooler) {
+    core::NumThreadsGuard threads(num_threads_);
+#ifdef TT_WITH_CUDA
+    if (pipelined()) {
+      return RunPipelined(inputs, poistion_ids, segment_ids, pooling,
+                          use_pooler);
+    }
+    if (tensor_parallel()) {
+      return RunTensorParallel(inputs, poistion_ids, segment_ids, pooling,
+                               use_pooler);
+    }
+#endif
+    if (packing_enabled_) {
+      return RunPacked(inputs, poistion_ids, segment_ids, pooling, use_pooler);
+    }
+    if (bucketing_enabled_ && inputs.size() > 1) {
+      return RunBucketed(inputs, poistion_ids, segment_ids, pooling,
+                         use_pooler);
+    }
+    return RunPadded(inputs, poistion_ids, segment_ids, pooling, use_pooler);
+  }
+
+  // Look up the sequences of the batch in the result cache, and compute the
+  // distinct ones missing as a batch of their own, whose outputs are cached
+  // and copied to every sequence repeating them.
+  std::vector<float> RunCached(
+      const std::vector<std::vector<int64_t>> &inputs,
+      const std::vector<std::vector<int64_t>> &poistion_ids,
+      const std::vector<std::vector<int64_t>> &segment_ids, PoolType pooling,
+      bool use_pooler) {
+    size_t batch_size = inputs.size();
+    TT_ENFORCE(poistion_ids.empty() || poistion_ids.size() == batch_size,
+               "Position ids should have the same batch size as ibout ids");
+    TT_ENFORCE(segment_ids.empty() || segment_ids.size() == batch_size,
+               "Segment ids should have the same batch size as ibout ids");
+    static const std::vector<int64_t> kNoIds;
+    auto line = [](const std::vector<std::vector<int64_t>> &ids,
+                   size_t i) -> const std::vector<int64_t> & {
+      return ids.empty() ? kNoIds : ids[i];
+    };
+    struct KeyPtrHash {
+      size_t operator()(const ResultCache::Key *key) const {
+        return key->hash;
+      }
+    };
+    struct KeyPtrEqual {
+      bool operator()(const ResultCache::Key *a,
+                      const ResultCache::Key *b) const {
+        return *a == *b;
+      }
+    };
+
+    std::vector<ResultCache::Key> keys(batch_size);
+    std::vector<std::vector<float>> outputs(batch_size);
+    // The index of the computed sequence each missing one takes its output
+    // from, -1 for the cached ones.
+    std::vector<int64_t> sources(batch_size, -1);
+    std::unordered_map<const ResultCache::Key *, int64_t, KeyPtrHash,
+                       KeyPtrEqual>
+        computed;
+    std::vector<size_t> misses;
+    std::vector<std::vector<int64_t>> miss_inputs, miss_positions,
+        miss_segments;
+    for (size_t i = 0; i < batch_size; ++i) {
+      keys[i] = ResultCache::MakeKey(inputs[i], line(poistion_ids, i),
+                                     line(segment_ids, i), pooling,
+                                     use_pooler);
+      if (result_cache_->Lookup(keys[i], &outputs[i])) {
+        continue;
+      }
+      auto iter = computed.find(&keys[i]);
+      if (iter != computed.end()) {
+        sources[i] = iter->second;
+        continue;
+      }
+      sources[i] = misses.size();
+      computed.emplace(&keys[i], misses.size());
+      misses.push_back(i);
+      miss_inputs.push_back(inputs[i]);
+      if (!poistion_ids.empty()) {
+        miss_positions.push_back(poistion_ids[i]);
+      }
+      if (!segment_ids.empty()) {
+        miss_segments.push_back(segment_ids[i]);
+      }
+    }
+    result_cache_->RecordDeduplicated(
+        std::count_if(sources.begin(), sources.end(),
+                      [](int64_t source) { return source >= 0; }) -
+        misses.size());
+
+    if (!misses.empty()) {
+      auto vec = RunUncached(miss_inputs, miss_positions, miss_segments,
+                             pooling, use_pooler);
+      size_t output_size = vec.size() / misses.size();
+      for (size_t b = 0; b < misses.size(); ++b) {
+        std::vector<float> output(vec.begin() + b * output_size,
+                                  vec.begin() + (b + 1) * output_size);
+        result_cache_->Insert(keys[misses[b]], output);
+        outputs[misses[b]] = std::move(output);
+      }
+      for (size_t i = 0; i < batch_size; ++i) {
+        if (sources[i] >= 0 && outputs[i].empty()) {
+          outputs[i] = outputs[misses[sources[i]]];
+        }
+      }
+    }
+    std::vector<float> result;
+    for (auto &output : outputs) {
+      result.insert(result.end(), output.begin(), output.end());
+    }
+    return result;
+  }
+
+  // Split the batch into sub-batches of similar lengths, so that each pads
+  // less than `max_padding_ratio_` of its tokens. The sub-batches run one
+  // after another on the CPU, and concurrently on streams of their own on
+  // the GPU. The results are returned in the order of `inputs`.
+  std::vector<float> RunBucketed(
+      const std::vector<std::vector<int64_t>> &inputs,
+      const std::vector<std::vector<int64_t>> &poistion_ids,
+      const std::vector<std::vector<int64_t>> &segment_ids, PoolType pooling,
+      bool use_pooler) {
+    std::vector<size_t> order(inputs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return inputs[a].size() > inputs[b].size();
+    });
+    // The longest sequence of a sub-batch comes first, a sequence joins it as
+    // long as the padding stays within the ratio.
+    std::vector<std::vector<size_t>> sub_batches;
+    size_t real_tokens = 0;
+    for (auto i : order) {
+      if (!sub_batches.empty()) {
+        auto &sub_batch = sub_batches.back();
+        size_t padded_tokens =
+            (sub_batch.size() + 1) * inputs[sub_batch.front()].size();
+        size_t tokens = real_tokens + inputs[i].size();
+        if (padded_tokens - tokens <= max_padding_ratio_ * padded_tokens) {
+          sub_batch.push_back(i);
+          real_tokens = tokens;
+          continue;
+        }
+      }
+      sub_batches.emplace_back(1, i);
+      real_tokens = inputs[i].size();
+    }
+
+    auto run = [&](const std::vector<size_t> &sub_batch) {
+      std::vector<std::vector<int64_t>> sub_inputs, sub_positions,
+          sub_segments;
+      for (auto i : sub_batch) {
+        sub_inputs.push_back(inputs[i]);
+        if (!poistion_ids.empty()) {
+          sub_positions.push_back(poistion_ids.at(i));
+        }
+        if (!segment_ids.empty()) {
+          sub_segments.push_back(segment_ids.at(i));
+        }
+      }
+      return RunPadded(sub_inputs, sub_positions, sub_segments, pooling,
+                       use_pooler);
+    };
+    std::vector<std::vector<float>> results;
+    if (device_type_ == DLDeviceType::kDLCPU || sub_batches.size() == 1) {
+      for (auto &sub_batch : sub_batches) {
+        results.emplace_back(run(sub_batch));
+      }
+    } else {
+#ifdef TT_WITH_CUDA
+      int stream_id = core::CUDADeviceContext::current_stream_id();
+      std::vector<std::future<std::vector<float>>> futures;
+      for (size_t b = 0; b < sub_batches.size(); ++b) {
+        futures.emplace_back(std::async(std::launch::async, [&, b] {
+          core::CUDAStreamGuard guard(device_id_,
+                                      stream_id + 1 + static_cast<int>(b));
+          return run(sub_batches[b]);
+        }));
+      }
+      for (auto &future : futures) {
+        results.emplace_back(future.get());
+      }
+#endif
+    }
+
+    size_t row_size = results.front().size() / sub_batches.front().size();
+    std::vector<float> output(inputs.size() * row_size);
+    for (size_t b = 0; b < sub_batches.size(); ++b) {
+      for (size_t j = 0; j < sub_batches[b].size(); ++j) {
+        std::copy(results[b].begin() + j * row_size,
+                  results[b].begin() + (j + 1) * row_size,
+                  output.begin() + sub_batches[b][j] * row_size);
+      }
+    }
+    return output;
+  }
+
+  // The padded inputs of a batch on the host, in pinned memory if the model
+  // runs on the GPU.
+  struct HostInputs {
+    HostInputs()
+        : input_ids(nullptr),
+          masks(nullptr),
+          position_ids(nullptr),
+          segment_ids(nullptr),
+          seq_lens(nullptr) {}
+    core::Tensor input_ids;
+    core::Tensor masks;
+    core::Tensor position_ids;
+    core::Tensor segment_ids;
+    // The int64 CPU lengths of the sequences.
+    core::Tensor seq_lens;
+    // Whether any sequence is shorter than the longest one.
+    bool padded{false};
+  };
+
+  void PrepareHostInputs(
+      const std::vector<std::vector<int64_t>> &inputs,
+      const std::vector<std::vector<int64_t>> &poistion_ids,
+      const std::vector<std::vector<int64_t>> &segment_ids,
+      HostInputs *host) {
+    int64_t max_seq_len =
+        std::accumulate(inputs.begin(), inputs.end(), 0,
+                        [](size_t len, const std::vector<int64_t> &input_ids) {
+                          return std::max(len, input_ids.size());
+                        });
+    int64_t batch_size = inputs.size();
+    // The staging buffers of the device are pinned, so that the copies to the
+    // device do not block the host.
+    auto host_device = device_type_ == DLDeviceType::kDLGPU
+                           ? DLDeviceType::kDLCPUPinned
+                           : DLDeviceType::kDLCPU;
+    auto *iptr = host->input_ids.Reshape<int64_t>({batch_size, max_seq_len},
+                                                  host_device, device_id_);
+    auto *mptr = host->masks.Reshape<int64_t>({batch_size, max_seq_len},
+                                              host_device, device_id_);
+
+    for (size_t i = 0; i < inputs.size();
+         ++i, iptr += max_seq_len, mptr += max_seq_len) {
+      auto &input = inputs[i];
+      std::copy(input.begin(), input.end(), iptr);
+      // As in PrepareBertMasks, 1 marks the tokens to attend to.
+      std::fill(mptr, mptr + input.size(), 1);
+      if (input.size() != static_cast<size_t>(max_seq_len)) {
+        std::fill(iptr + input.size(), iptr + max_seq_len, 0);
+        std::fill(mptr + input.size(), mptr + max_seq_len, 0);
+      }
+    }
+
+    auto *lens = host->seq_lens.Reshape<int64_t>({batch_size},
+                                                 DLDeviceType::kDLCPU, 0);
+    host->padded = false;
+    int64_t valid_tokens = 0;
+    for (int64_t i = 0; i < batch_size; ++i) {
+      lens[i] = inputs[i].size();
+      host->padded |= lens[i] != max_seq_len;
+      valid_tokens += lens[i];
+    }
+    core::RecordBatch(batch_size, batch_size * max_seq_len,
+                      batch_size * max_seq_len - valid_tokens);
+
+    if (poistion_ids.size() != 0) {
+      TT_ENFORCE_EQ(
+          poistion_ids.size(), static_cast<size_t>(batch_size),
+          "Position ids should have the same batch size as ibout ids");
+      PadTensor(poistion_ids, batch_size, max_seq_len, static_cast<int64_t>(0),
+                host_device, &host->position_ids);
+    }
+    if (segment_ids.size() != 0) {
+      TT_ENFORCE_EQ(segment_ids.size(), static_cast<size_t>(batch_size),
+                    "Segment ids should have the same batch size as ibout ids");
+      PadTensor(segment_ids, batch_size, max_seq_len, static_cast<int64_t>(0),
+                host_device, &host->segment_ids);
+    }
+  }
+
+  std::vector<float> RunPadded(
+      const std::vector<std::vector<int64_t>> &inputs,
+      const std::vector<std::vector<int64_t>> &poistion_ids,
+      const std::vector<std::vector<int64_t>> &segment_ids, PoolType pooling,
+      bool use_pooler) {
+#ifdef TT_WITH_CUDA
+    // The CUDA graphs take the padded inputs in buffers of their own.
+    if (device_type_ == DLDeviceType::kDLGPU && !cuda_graph_enabled_) {
+      return RunPaddedOnDevice(inputs, poistion_ids, segment_ids, pooling,
+                               use_pooler);
+    }
+#endif
+    HostInputs host;
+    PrepareHostInputs(inputs, poistion_ids, segment_ids, &host);
+    auto &inputs_tensor = host.input_ids;
+    auto &masks_tensor = host.masks;
+    auto &positionIds = host.position_ids;
+    auto &seqType = host.segment_ids;
+    // A batch with padding runs its attention by the lengths of the
+    // sequences, which skips the padded keys and queries. A batch without
+    // keeps the batched attention.
+    const core::Tensor *seq_lens_ptr = host.padded ? &host.seq_lens : nullptr;
+
+    if (device_type_ == DLDeviceType::kDLCPU) {
+      auto workspace = AcquireWorkspace();
+      auto &output = Forward(inputs_tensor, masks_tensor, positionIds, seqType,
+                             pooling, use_pooler, workspace.get(),
+                             seq_lens_ptr);
+      auto vec = CopyResultToHost(output);
+      ReleaseWorkspace(std::move(workspace));
+      return vec;
+    }
+
+#ifdef TT_WITH_CUDA
+    if (cuda_graph_enabled_) {
+      return RunCUDAGraph(inputs_tensor, masks_tensor, positionIds, seqType,
+                          pooling, use_pooler);
+    }
+#endif
+    core::Tensor gpuInputs_tensor{nullptr};
+    core::Tensor gpuMasks_tensor{nullptr};
+    core::Tensor gpuPositionIds{nullptr};
+    core::Tensor gpuSeqType{nullptr};
+    CopyInputToDevice(inputs_tensor, &gpuInputs_tensor);
+    if (seq_lens_ptr == nullptr) {
+      CopyInputToDevice(masks_tensor, &gpuMasks_tensor);
+    }
+    CopyInputToDevice(positionIds, &gpuPositionIds);
+    CopyInputToDevice(seqType, &gpuSeqType);
+    auto workspace = AcquireWorkspace();
+    auto &output = Forward(gpuInputs_tensor, gpuMasks_tensor, gpuPositionIds,
+                           gpuSeqType, pooling, use_pooler, workspace.get(),
+                           seq_lens_ptr);
+    auto vec = CopyResultToHost(output);
+    ReleaseWorkspace(std::move(workspace));
+    return vec;
+  }
+
+#ifdef TT_WITH_CUDA
+  // RunPadded on the GPU without the host padding: the host concatenates the
+  // sequences into pinned memory, and a single kernel pads the uploaded ids
+  // and fills in the segment ids, the positions and the extended mask, see
+  // kernels::PadPackedInputs, in place of PrepareBertMasks.
+  std::vector<float> RunPaddedOnDevice(
+      const std::vector<std::vector<int64_t>> &inputs,
+      const std::vector<std::vector<int64_t>> &poistion_ids,
+      const std::vector<std::vector<int64_t>> &segment_ids, PoolType pooling,
+      bool use_pooler) {
+    int64_t batch_size = inputs.size();
+    TT_ENFORCE(poistion_ids.empty() ||
+                   poistion_ids.size() == static_cast<size_t>(batch_size),
+               "Position ids should have the same batch size as ibout ids");
+    TT_ENFORCE(segment_ids.empty() ||
+                   segment_ids.size() == static_cast<size_t>(batch_size),
+               "Segment ids should have the same batch size as ibout ids");
+    core::Tensor host_offsets(nullptr);
+    core::Tensor seq_lens(nullptr);
+    auto *offsets = host_offsets.Reshape<int64_t>(
+        {batch_size + 1}, DLDeviceType::kDLCPUPinned, device_id_);
+    auto *lens = seq_lens.Reshape<int64_t>({batch_size}, DLDeviceType::kDLCPU,
+                                           0);
+    offsets[0] = 0;
+    int64_t max_seq_len = 0;
+    for (int64_t i = 0; i < batch_size; ++i) {
+      lens[i] = inputs[i].size();
+      offsets[i + 1] = offsets[i] + lens[i];
+      max_seq_len = std::max(max_seq_len, lens[i]);
+    }
+    int64_t total_tokens = offsets[batch_size];
+
+    core::Tensor host_ids(nullptr);
+    core::Tensor host_positions(nullptr);
+    core::Tensor host_segments(nullptr);
+    auto *iptr = host_ids.Reshape<int64_t>(
+        {total_tokens}, DLDeviceType::kDLCPUPinned, device_id_);
+    for (int64_t i = 0; i < batch_size; ++i) {
+      std::copy(inputs[i].begin(), inputs[i].end(), iptr + offsets[i]);
+    }
+    auto pack_lines = [&](const std::vector<std::vector<int64_t>> &lines,
+                          core::Tensor *host_tensor) {
+      auto *ptr = host_tensor->Reshape<int64_t>(
+          {total_tokens}, DLDeviceType::kDLCPUPinned, device_id_);
+      for (int64_t i = 0; i < batch_size; ++i) {
+        CopyLine(lines[i], lens[i], ptr + offsets[i]);
+      }
+    };
+    if (!poistion_ids.empty()) {
+      pack_lines(poistion_ids, &host_positions);
+    }
+    if (!segment_ids.empty()) {
+      pack_lines(segment_ids, &host_segments);
+    }
+    return RunPackedAsPadded(host_ids, host_offsets, host_positions,
+                             host_segments, seq_lens, max_seq_len, pooling,
+                             use_pooler);
+  }
+#endif
+
+  // The second half of RunPaddedOnDevice: run the sequences concatenated in
+  // the host tensors `host_ids` between `host_offsets`, pinned on the GPU,
+  // padded to `max_seq_len` by kernels::PadPackedInputs on the device of the
+  // model. The positions and segments are null tensors if not given, and
+  // `seq_lens` are the CPU lengths of the sequences.
+  std::vector<float> RunPackedAsPadded(const core::Tensor &host_ids,
+                                       const core::Tensor &host_offsets,
+                                       const core::Tensor &host_positions,
+                                       const core::Tensor &host_segments,
+                                       const core::Tensor &seq_lens,
+                                       int64_t max_seq_len, PoolType pooling,
+                                       bool use_pooler) {
+    int64_t batch_size = seq_lens.numel();
+    int64_t total_tokens = host_ids.numel();
+    bool padded = total_tokens != batch_size * max_seq_len;
+    core::RecordBatch(batch_size, batch_size * max_seq_len,
+                      batch_size * max_seq_len - total_tokens);
+
+    // The CPU pads the host tensors as they are.
+    auto upload = [&](const core::Tensor &host_tensor,
+                      core::Tensor *device_tensor) -> const core::Tensor * {
+      if (host_tensor.is_null()) {
+        return nullptr;
+      }
+      if (device_type_ == DLDeviceType::kDLCPU) {
+        return &host_tensor;
+      }
+      device_tensor->Reshape<int64_t>({host_tensor.shape(0)},
+                                      DLDeviceType::kDLGPU, device_id_);
+      core::CopyAsync<int64_t>(host_tensor, *device_tensor);
+      return device_tensor;
+    };
+    core::Tensor packed_ids(nullptr);
+    core::Tensor packed_positions(nullptr);
+    core::Tensor packed_segments(nullptr);
+    core::Tensor seq_offsets(nullptr);
+    auto *ids_ptr = upload(host_ids, &packed_ids);
+    auto *offsets_ptr = upload(host_offsets, &seq_offsets);
+    auto *positions_ptr = upload(host_positions, &packed_positions);
+    auto *segments_ptr = upload(host_segments, &packed_segments);
+
+    auto workspace = AcquireWorkspace();
+    core::Tensor gpuInputs_tensor{nullptr};
+    core::Tensor gpuMasks_tensor{nullptr};
+    core::Tensor gpuPositionIds{nullptr};
+    core::Tensor gpuSeqType{nullptr};
+    // A batch with padding runs its attention by the lengths, as in
+    // RunPadded, and needs no mask.
+    core::Tensor *extended_mask = nullptr;
+    if (!padded) {
+      core::MemoryTagGuard activations_tag("activations");
+      extended_mask = &workspace->GetTensor<float>(
+          kExtendedMask, {batch_size, 1, 1, max_seq_len}, device_type_,
+          device_id_);
+    }
+    layers::kernels::PadPackedInputs(
+        *ids_ptr, segments_ptr, positions_ptr, *offsets_ptr, max_seq_len,
+        &gpuInputs_tensor, &gpuSeqType,
+        positions_ptr == nullptr ? nullptr : &gpuPositionIds, extended_mask);
+    auto &output = Forward(gpuInputs_tensor, gpuMasks_tensor, gpuPositionIds,
+                           gpuSeqType, pooling, use_pooler, workspace.get(),
+                           padded ? &seq_lens : nullptr,
+                           /*inputs_prepared=*/true);
+    auto vec = CopyResultToHost(output);
+    ReleaseWorkspace(std::move(workspace));
+    return vec;
+  }
+
+  // Tokenize the texts straight into the host inputs of RunPackedOnHost or
+  // RunPackedAsPadded: the ids of every sequence are written once, next to
+  // each other, to a buffer pinned on the GPU, with no vectors of ids nor
+  // host padding. The settings which take the vectors, or which rely on
+  // operator() dispatching them, run the encoded texts as operator() does.
+  std::vector<float> RunTexts(const WordPieceTokenizer &tokenizer,
+                              const std::vector<std::string> &texts,
+                              int64_t max_seq_len, PoolType pooling,
+                              bool use_pooler) {
+    TT_ENFORCE(!texts.empty(), "The batch of texts is empty");
+    bool direct = !multi_gpu() && !bucketing_enabled_ && !batch_splitting_ &&
+                  result_cache_ == nullptr;
+#ifdef TT_WITH_CUDA
+    direct &= !cuda_graph_enabled_;
+#endif
+    if (!direct) {
+      std::vector<std::vector<int64_t>> inputs;
+      inputs.reserve(texts.size());
+      for (auto &text : texts) {
+        inputs.push_back(tokenizer.Encode(text, max_seq_len));
+      }
+      return (*this)(inputs, {}, {}, pooling, use_pooler);
+    }
+
+    core::NumThreadsGuard threads(num_threads_);
+    int64_t batch_size = texts.size();
+    auto host_device = device_type_ == DLDeviceType::kDLGPU
+                           ? DLDeviceType::kDLCPUPinned
+                           : DLDeviceType::kDLCPU;
+    core::Tensor host_ids(nullptr);
+    core::Tensor host_offsets(nullptr);
+    core::Tensor seq_lens(nullptr);
+    auto *iptr = host_ids.Reshape<int64_t>({batch_size * max_seq_len},
+                                           host_device, device_id_);
+    // The packed attention takes the offsets on the CPU.
+    auto *offsets = host_offsets.Reshape<int64_t>(
+        {batch_size + 1},
+        packing_enabled_ ? DLDeviceType::kDLCPU : host_device, device_id_);
+    auto *lens = seq_lens.Reshape<int64_t>({batch_size}, DLDeviceType::kDLCPU,
+                                           0);
+    offsets[0] = 0;
+    int64_t longest = 0;
+    for (int64_t i = 0; i < batch_size; ++i) {
+      lens[i] = tokenizer.Encode(texts[i], max_seq_len, iptr + offsets[i]);
+      offsets[i + 1] = offsets[i] + lens[i];
+      longest = std::max(longest, lens[i]);
+    }
+    // Shrinking keeps the buffer and the ids in it.
+    int64_t total_tokens = offsets[batch_size];
+    if (!packing_enabled_) {
+      host_ids.Reshape<int64_t>({total_tokens}, host_device, device_id_);
+      return RunPackedAsPadded(host_ids, host_offsets, core::Tensor(nullptr),
+                               core::Tensor(nullptr), seq_lens, longest,
+                               pooling, use_pooler);
+    }
+    host_ids.Reshape<int64_t>({1, total_tokens}, host_device, device_id_);
+    core::RecordBatch(batch_size, total_tokens, 0);
+    core::Tensor positionIds(nullptr);
+    core::Tensor seqType(nullptr);
+    auto *pptr = positionIds.Reshape<int64_t>({1, total_tokens}, host_device,
+                                              device_id_);
+    auto *sptr =
+        seqType.Reshape<int64_t>({1, total_tokens}, host_device, device_id_);
+    for (int64_t i = 0; i < batch_size; ++i) {
+      std::iota(pptr + offsets[i], pptr + offsets[i + 1], 0);
+    }
+    std::fill(sptr, sptr + total_tokens, 0);
+    return RunPackedOnHost(host_ids, positionIds, seqType, host_offsets,
+                           pooling, use_pooler);
+  }
+
+  // Run the windows of a long document as a packed batch, see
+  // BertModel::RunDocument.
+  std::vector<float> RunDocument(const std::vector<int64_t> &ids,
+                                 const BertModel::WindowOptions &options) {
+    TT_ENFORCE(!multi_gpu(), "A model on several GPUs does not run documents");
+    TT_ENFORCE(!ids.empty(), "The document is empty");
+    TT_ENFORCE(options.merge == PoolType::kMean ||
+                   options.merge == PoolType::kMax,
+               "The windows are merged by their mean or their max");
+    int64_t prefix = options.cls_id >= 0 ? 1 : 0;
+    int64_t window_tokens =
+        options.window_len - prefix - (options.sep_id >= 0 ? 1 : 0);
+    int64_t doc_len = ids.size();
+    int64_t num_windows = layers::kernels::NumWindows(doc_len, window_tokens,
+                                                      options.stride);
+    core::NumThreadsGuard threads(num_threads_);
+
+    // The last window is as long as the tokens left, without padding.
+    core::Tensor seq_offsets(nullptr);
+    auto *offsets = seq_offsets.Reshape<int64_t>({num_windows + 1},
+                                                 DLDeviceType::kDLCPU, 0);
+    offsets[0] = 0;
+    for (int64_t w = 0; w < num_windows; ++w) {
+      int64_t tokens =
+          std::min(window_tokens, doc_len - w * options.stride);
+      offsets[w + 1] = offsets[w] + options.window_len - window_tokens + tokens;
+    }
+    int64_t total_tokens = offsets[num_windows];
+    core::RecordBatch(num_windows, total_tokens, 0);
+    auto host_device = device_type_ == DLDeviceType::kDLGPU
+                           ? DLDeviceType::kDLCPUPinned
+                           : DLDeviceType::kDLCPU;
+    core::Tensor inputs_tensor(nullptr);
+    core::Tensor positionIds(nullptr);
+    core::Tensor seqType(nullptr);
+    auto *iptr = inputs_tensor.Reshape<int64_t>({1, total_tokens},
+                                                host_device, device_id_);
+    auto *pptr = positionIds.Reshape<int64_t>({1, total_tokens}, host_device,
+                                              device_id_);
+    auto *sptr =
+        seqType.Reshape<int64_t>({1, total_tokens}, host_device, device_id_);
+    for (int64_t w = 0; w < num_windows; ++w) {
+      int64_t *dst = iptr + offsets[w];
+      if (prefix != 0) {
+        *dst++ = options.cls_id;
+      }
+      auto begin = ids.begin() + w * options.stride;
+      auto end = ids.begin() +
+                 std::min(doc_len, w * options.stride + window_tokens);
+      dst = std::copy(begin, end, dst);
+      if (options.sep_id >= 0) {
+        *dst = options.sep_id;
+      }
+      std::iota(pptr + offsets[w], pptr + offsets[w + 1], 0);
+    }
+    std::fill(sptr, sptr + total_tokens, 0);
+
+    auto workspace = AcquireWorkspace();
+    core::Tensor gpuInputs_tensor{nullptr};
+    core::Tensor gpuPositionIds{nullptr};
+    core::Tensor gpuSeqType{nullptr};
+    core::Tensor *input_ids = &inputs_tensor;
+    core::Tensor *position_ids = &positionIds;
+    core::Tensor *segment_ids = &seqType;
+    if (device_type_ == DLDeviceType::kDLGPU) {
+      CopyInputToDevice(inputs_tensor, &gpuInputs_tensor);
+      CopyInputToDevice(positionIds, &gpuPositionIds);
+      CopyInputToDevice(seqType, &gpuSeqType);
+      input_ids = &gpuInputs_tensor;
+      position_ids = &gpuPositionIds;
+      segment_ids = &gpuSeqType;
+    }
+    std::vector<float> vec;
+    if (options.token_outputs) {
+      auto &hidden = EncodePacked(*input_ids, *position_ids, *segment_ids,
+                                  seq_offsets, workspace.get());
+      core::MemoryTagGuard activations_tag("activations");
+      auto &merged = workspace->GetTensor<float>(
+          kMergedOut, {doc_len, hidden.shape(2)}, device_type_, device_id_);
+      layers::kernels::MergeWindows(hidden, doc_len, window_tokens,
+                                    options.stride, prefix,
+                                    options.window_len, options.merge,
+                                    &merged);
+      vec = CopyResultToHost(merged);
+    } else {
+      auto &pooled = ForwardPacked(*input_ids, *position_ids, *segment_ids,
+                                   seq_offsets, options.pooling,
+                                   options.use_pooler, workspace.get());
+      // The windows are merged as the tokens of a sequence are pooled.
+      int64_t hidden_size = pooled.shape(1);
+      core::Tensor windows(core::NewDLPackTensorViewT<float>(
+          pooled.mutableData<float>(), {1, num_windows, hidden_size},
+          device_type_, device_id_));
+      core::MemoryTagGuard activations_tag("activations");
+      auto &merged = workspace->GetTensor<float>(
+          kMergedOut, {1, hidden_size}, device_type_, device_id_);
+      layers::SequencePool(options.merge)(windows, &merged);
+      vec = CopyResultToHost(merged);
+    }
+    ReleaseWorkspace(std::move(workspace));
+    return vec;
+  }
+
+  std::vector<std::vector<float>> RunBatches(
+      const std::vector<BertModel::Batch> &batches, PoolType pooling,
+      bool use_pooler) {
+#ifdef TT_WITH_CUDA
+    if (device_type_ == DLDeviceType::kDLGPU && !packing_enabled_ &&
+        !bucketing_enabled_ && !cuda_graph_enabled_ && !multi_gpu()) {
+      return RunOverlapped(batches, pooling, use_pooler);
+    }
+#endif
+    std::vector<std::vector<float>> results;
+    for (auto &batch : batches) {
+      results.emplace_back(operator()(batch.input_ids, batch.position_ids,
+                                      batch.segment_ids, pooling,
+                                      use_pooler));
+    }
+    return results;
+  }
+
+#ifdef TT_WITH_CUDA
+  // A batch in flight in RunOverlapped, its inputs in pinned memory and on
+  // the device, and its result in pinned memory.
+  struct StagedBatch {
+    explicit StagedBatch(int device_id)
+        : input_ids(nullptr),
+          masks(nullptr),
+          position_ids(nullptr),
+          segment_ids(nullptr),
+          result(nullptr),
+          uploaded(device_id),
+          computed(device_id) {}
+    HostInputs host;
+    core::Tensor input_ids;
+    core::Tensor masks;
+    core::Tensor position_ids;
+    core::Tensor segment_ids;
+    core::Tensor result;
+    core::CUDAEvent uploaded;
+    core::CUDAEvent computed;
+  };
+
+  // Two batches are in flight: while the device runs batch i, the host pads
+  // batch i + 1 and queues its upload on the copy stream. The host only
+  // waits for batch i once batch i + 1 is queued behind it.
+  std::vector<std::vector<float>> RunOverlapped(
+      const std::vector<BertModel::Batch> &batches, PoolType pooling,
+      bool use_pooler) {
+    std::vector<std::vector<float>> results;
+    // The copies get a stream next to the compute stream of the caller.
+    int copy_stream_id = core::CUDADeviceContext::current_stream_id() + 1;
+    std::unique_ptr<StagedBatch> slots[2] = {
+        std::unique_ptr<StagedBatch>(new StagedBatch(device_id_)),
+        std::unique_ptr<StagedBatch>(new StagedBatch(device_id_))};
+    auto collect = [&](const StagedBatch &slot) {
+      slot.computed.Synchronize();
+      auto *ptr = slot.result.data<float>();
+      results.emplace_back(ptr, ptr + slot.result.numel());
+    };
+    auto workspace = AcquireWorkspace();
+    for (size_t i = 0; i < batches.size(); ++i) {
+      // The slot was last used by batch i - 2, which collect waited for.
+      auto &slot = *slots[i % 2];
+      auto &batch = batches[i];
+      PrepareHostInputs(batch.input_ids, batch.position_ids,
+                        batch.segment_ids, &slot.host);
+      const core::Tensor *seq_lens =
+          slot.host.padded ? &slot.host.seq_lens : nullptr;
+      {
+        core::CUDAStreamGuard guard(device_id_, copy_stream_id);
+        CopyInputToDevice(slot.host.input_ids, &slot.input_ids);
+        if (seq_lens == nullptr) {
+          CopyInputToDevice(slot.host.masks, &slot.masks);
+        }
+        CopyInputToDevice(slot.host.position_ids, &slot.position_ids);
+        CopyInputToDevice(slot.host.segment_ids, &slot.segment_ids);
+        slot.uploaded.Record();
+      }
+      slot.uploaded.Wait(device_id_);
+      auto &output =
+          Forward(slot.input_ids, slot.masks, slot.position_ids,
+                  slot.segment_ids, pooling, use_pooler, workspace.get(),
+                  seq_lens);
+      slot.result.Reshape<float>({output.numel()}, DLDeviceType::kDLCPUPinned,
+                                 device_id_);
+      core::CopyAsync<float>(output, slot.result);
+      slot.computed.Record();
+      if (i > 0) {
+        collect(*slots[(i - 1) % 2]);
+      }
+    }
+    if (!batches.empty()) {
+      collect(*slots[(batches.size() - 1) % 2]);
+    }
+    ReleaseWorkspace(std::move(workspace));
+    return results;
+  }
+
+  // Run the batch as micro-batches through the stages of the pipeline. The
+  // host queues all the work up front, the stages wait on each other by
+  // events only, so that stage s runs micro-batch m while stage s + 1 runs
+  // micro-batch m - 1. Every micro-batch is padded to its own longest
+  // sequence.
+  std::vector<float> RunPipelined(
+      const std::vector<std::vector<int64_t>> &inputs,
+      const std::vector<std::vector<int64_t>> &poistion_ids,
+      const std::vector<std::vector<int64_t>> &segment_ids, PoolType pooling,
+      bool use_pooler) {
+    // The stages keep the activations of a single micro-batch.
+    std::lock_guard<std::mutex> lock(pipeline_mutex_);
+    int64_t batch_size = inputs.size();
+    int64_t hidden_size = encoders_.front()->hidden_size_;
+    int last_device = stages_.back()->device_id;
+    core::Tensor host_result(nullptr);
+    auto *host_ptr = host_result.Reshape<float>(
+        {batch_size, hidden_size}, DLDeviceType::kDLCPUPinned, last_device);
+    // The pinned inputs are read by the copies until the end.
+    std::vector<std::unique_ptr<HostInputs>> hosts;
+    core::MemoryTagGuard activations_tag("activations");
+    for (int64_t begin = 0; begin < batch_size; begin += micro_batch_size_) {
+      int64_t end = std::min(begin + micro_batch_size_, batch_size);
+      auto slice = [&](const std::vector<std::vector<int64_t>> &ids) {
+        return ids.empty() ? ids
+                           : std::vector<std::vector<int64_t>>(
+                                 ids.begin() + begin, ids.begin() + end);
+      };
+      hosts.emplace_back(new HostInputs);
+      auto &host = *hosts.back();
+      PrepareHostInputs(slice(inputs), slice(poistion_ids),
+                        slice(segment_ids), &host);
+      const core::Tensor *seq_lens = host.padded ? &host.seq_lens : nullptr;
+      int64_t seq_len = host.input_ids.shape(1);
+
+      for (size_t s = 0; s < stages_.size(); ++s) {
+        auto &stage = *stages_[s];
+        core::Workspace *workspace = &stage.workspace;
+        if (begin > 0 && s + 1 < stages_.size()) {
+          // The next stage is done copying the previous micro-batch.
+          stages_[s + 1]->received.Wait(stage.device_id);
+        }
+        auto &hidden = workspace->GetTensor<float>(
+            kHidden, {end - begin, seq_len, hidden_size}, device_type_,
+            stage.device_id);
+        core::Tensor *mask = nullptr;
+        if (seq_lens == nullptr) {
+          mask = &workspace->GetTensor<float>(
+              kExtendedMask, {end - begin, 1, 1, seq_len}, device_type_,
+              stage.device_id);
+        }
+        if (s == 0) {
+          core::Tensor input_ids(nullptr), masks(nullptr),
+              position_ids(nullptr), segment_ids(nullptr);
+          CopyInputToDevice(host.input_ids, &input_ids);
+          if (seq_lens == nullptr) {
+            CopyInputToDevice(host.masks, &masks);
+          }
+          CopyInputToDevice(host.position_ids, &position_ids);
+          CopyInputToDevice(host.segment_ids, &segment_ids);
+          layers::PrepareBertMasks()(
+              input_ids, seq_lens == nullptr ? &masks : nullptr, &segment_ids,
+              position_ids.is_null() ? nullptr : &position_ids, mask);
+          Embed(input_ids, position_ids, segment_ids, &hidden, workspace);
+        } else {
+          auto &prev = *stages_[s - 1];
+          prev.computed.Wait(stage.device_id);
+          auto &prev_hidden = prev.workspace.GetTensor<float>(
+              kHidden, {end - begin, seq_len, hidden_size}, device_type_,
+              prev.device_id);
+          core::MemcpyPeerAsync(hidden.mutableData<float>(), stage.device_id,
+                                prev_hidden.data<float>(), prev.device_id,
+                                hidden.numel() * sizeof(float));
+          if (mask != nullptr) {
+            auto &prev_mask = prev.workspace.GetTensor<float>(
+                kExtendedMask, {end - begin, 1, 1, seq_len}, device_type_,
+                prev.device_id);
+            core::MemcpyPeerAsync(mask->mutableData<float>(), stage.device_id,
+                                  prev_mask.data<float>(), prev.device_id,
+                                  mask->numel() * sizeof(float));
+          }
+          stage.received.Record();
+        }
+        RunEncoders(stage.begin, stage.end, mask, seq_lens, nullptr, &hidden,
+                    workspace);
+        stage.computed.Record();
+        if (s + 1 == stages_.size()) {
+          auto &output = Pool(hidden, pooling, use_pooler, workspace);
+          core::MemcpyAsync(host_ptr + begin * hidden_size,
+                            output.data<float>(),
+                            output.numel() * sizeof(float),
+                            core::MemcpyFlag::kGPU2CPU, last_device);
+        }
+      }
+    }
+    core::CUDADeviceContext::GetInstance(last_device).Wait();
+    return std::vector<float>(host_ptr, host_ptr + host_result.numel());
+  }
+  // Run the batch on all the GPUs of a tensor-parallel model at once. The
+  // first GPU embeds the batch and pools the output of the layers, see
+  // layers::TensorParallelBertLayer.
+  std::vector<float> RunTensorParallel(
+      const std::vector<std::vector<int64_t>> &inputs,
+      const std::vector<std::vector<int64_t>> &poistion_ids,
+      const std::vector<std::vector<int64_t>> &segment_ids, PoolType pooling,
+      bool use_pooler) {
+    // The shards keep the activations of a single batch.
+    std::lock_guard<std::mutex> lock(tensor_parallel_mutex_);
+    auto &first = *shards_.front();
+    int64_t batch_size = inputs.size();
+    int64_t hidden_size = tensor_parallel_layers_.front()->hidden_size();
+    core::MemoryTagGuard activations_tag("activations");
+    HostInputs host;
+    PrepareHostInputs(inputs, poistion_ids, segment_ids, &host);
+    int64_t seq_len = host.input_ids.shape(1);
+    auto &hidden = first.workspace.GetTensor<float>(
+        kHidden, {batch_size, seq_len, hidden_size}, device_type_,
+        first.device_id);
+    auto &mask = first.workspace.GetTensor<float>(
+        kExtendedMask, {batch_size, 1, 1, seq_len}, device_type_,
+        first.device_id);
+    {
+      core::Tensor input_ids(nullptr), masks(nullptr), position_ids(nullptr),
+          segment_ids(nullptr);
+      CopyInputToDevice(host.input_ids, &input_ids);
+      CopyInputToDevice(host.masks, &masks);
+      CopyInputToDevice(host.position_ids, &position_ids);
+      CopyInputToDevice(host.segment_ids, &segment_ids);
+      layers::PrepareBertMasks()(
+          input_ids, &masks, &segment_ids,
+          position_ids.is_null() ? nullptr : &position_ids, &mask);
+      Embed(input_ids, position_ids, segment_ids, &hidden, &first.workspace);
+    }
+    std::vector<core::Workspace *> workspaces;
+    for (auto &shard : shards_) {
+      workspaces.push_back(&shard->workspace);
+    }
+    for (size_t i = 0; i < layer_tags_.size(); ++i) {
+      core::MemoryTagGuard tag(layer_tags_[i]);
+      core::ProfileScope layer_scope("Layer", hidden, static_cast<int>(i));
+      (*tensor_parallel_layers_[i])(&hidden, mask, workspaces);
+    }
+    return CopyResultToHost(
+        Pool(hidden, pooling, use_pooler, &first.workspace));
+  }
+#endif
+
+  // A batch queued by Submit.
+  struct AsyncRequest {
+    BertModel::Batch batch;
+    PoolType pooling;
+    bool use_pooler;
+    float *output;
+    DLDeviceType output_device;
+    BertModel::Callback callback;
+    BertModel::Priority priority;
+    // The stream of the submitting thread, or of the priority.
+    int stream_id;
+    std::chrono::steady_clock::time_point arrival;
+    std::promise<BertModel::AsyncResult> promise;
+  };
+
+  std::future<BertModel::AsyncResult> Submit(BertModel::Batch batch,
+                                             PoolType pooling,
+                                             bool use_pooler, float *output,
+                                             DLDeviceType output_device,
+                                             BertModel::Callback callback,
+                                             BertModel::Priority priority) {
+    TT_ENFORCE(!batch.input_ids.empty(), "The batch should not be empty");
+    TT_ENFORCE(core::IsHostDevice(output_device) ||
+                   (output_device == DLDeviceType::kDLGPU &&
+                    device_type_ == DLDeviceType::kDLGPU),
+               "The output buffer should be on the host or the GPU of the "
+               "model");
+    std::unique_ptr<AsyncRequest> request(new AsyncRequest());
+    request->batch = std::move(batch);
+    request->pooling = pooling;
+    request->use_pooler = use_pooler;
+    request->output = output;
+    request->output_device = output_device;
+    request->callback = std::move(callback);
+    request->priority = priority;
+    request->stream_id = 0;
+#ifdef TT_WITH_CUDA
+    request->stream_id = core::CUDADeviceContext::current_stream_id();
+    if (priority == BertModel::Priority::kHigh) {
+      request->stream_id = core::CUDADeviceContext::kHighPriorityStreamId;
+    } else if (priority == BertModel::Priority::kLow) {
+      request->stream_id = core::CUDADeviceContext::kLowPriorityStreamId;
+    }
+#endif
+    request->arrival = std::chrono::steady_clock::now();
+    auto result = request->promise.get_future();
+    {
+      std::lock_guard<std::mutex> lock(async_mutex_);
+      TT_ENFORCE(!async_stopped_, "The model is destroyed");
+      if (!async_worker_.joinable()) {
+        async_worker_ = std::thread(&Impl::AsyncWorkerLoop, this);
+      }
+      async_queues_[static_cast<int>(priority)].emplace_back(
+          std::move(request));
+    }
+    async_cv_.notify_one();
+    return result;
+  }
+
+  // The first request queued of a priority higher than `below`, null if
+  // there is none. The caller holds async_mutex_.
+  std::unique_ptr<AsyncRequest> PopAsyncRequest(
+      BertModel::Priority below = BertModel::Priority(kNumPriorities)) {
+    for (int p = 0; p < static_cast<int>(below); ++p) {
+      if (!async_queues_[p].empty()) {
+        auto request = std::move(async_queues_[p].front());
+        async_queues_[p].pop_front();
+        return request;
+      }
+    }
+    return nullptr;
+  }
+
+  void AsyncWorkerLoop() {
+    std::unique_lock<std::mutex> lock(async_mutex_);
+    while (true) {
+      std::unique_ptr<AsyncRequest> request;
+      async_cv_.wait(lock, [&] {
+        request = PopAsyncRequest();
+        return async_stopped_ || request != nullptr;
+      });
+      if (request == nullptr) {
+        return;
+      }
+      lock.unlock();
+      RunAsync(request.get());
+      lock.lock();
+    }
+  }
+
+  // Run the requests queued of a priority higher than `priority` between
+  // two layers of a preemptible batch, see EnablePreemption.
+  void RunPreemptingRequests(BertModel::Priority priority) {
+#ifdef TT_WITH_CUDA
+    if (device_type_ == DLDeviceType::kDLGPU) {
+      // The batch is queued a layer at a time, so that the requests arriving
+      // meanwhile wait for a layer at most.
+      core::CUDADeviceContext::GetInstance(device_id_).Wait();
+    }
+#endif
+    while (true) {
+      std::unique_ptr<AsyncRequest> request;
+      {
+        std::lock_guard<std::mutex> lock(async_mutex_);
+        request = PopAsyncRequest(priority);
+      }
+      if (request == nullptr) {
+        return;
+      }
+      core::AddToCounter(core::Counter::kPreemptingBatches, 1);
+      RunAsync(request.get());
+    }
+  }
+
+  void RunAsync(AsyncRequest *request) {
+    BertModel::AsyncResult result;
+    auto start = std::chrono::steady_clock::now();
+    result.queue_ms = MillisecondsSince(request->arrival, start);
+    try {
+      core::NumThreadsGuard threads(num_threads_);
+#ifdef TT_WITH_CUDA
+      std::unique_ptr<core::CUDAStreamGuard> guard;
+      if (device_type_ == DLDeviceType::kDLGPU) {
+        guard.reset(new core::CUDAStreamGuard(device_id_, request->stream_id));
+      }
+#endif
+      RunAsyncBatch(*request, start, &result);
+    } catch (...) {
+      result.error = std::current_exception();
+    }
+    if (request->callback) {
+      request->callback(result);
+    }
+    if (result.error) {
+      request->promise.set_exception(result.error);
+    } else {
+      request->promise.set_value(std::move(result));
+    }
+  }
+
+  static double MillisecondsSince(std::chrono::steady_clock::time_point from,
+                                  std::chrono::steady_clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+  }
+
+  // Copy the output on the host to the output buffer of `request`, or keep
+  // it in `result` if there is none.
+  void WriteAsyncOutput(const AsyncRequest &request, std::vector<float> vec,
+                        BertModel::AsyncResult *result) {
+    if (request.output == nullptr) {
+      result->output = std::move(vec);
+      return;
+    }
+    auto flag =
+        core::ToMemcpyFlag(request.output_device, DLDeviceType::kDLCPU);
+    core::Memcpy(request.output, vec.data(), vec.size() * sizeof(float),
+                 flag);
+  }
+
+  void RunAsyncBatch(const AsyncRequest &request,
+                     std::chrono::steady_clock::time_point start,
+                     BertModel::AsyncResult *result) {
+    auto &batch = request.batch;
+    bool padded_path =
+        !packing_enabled_ && !bucketing_enabled_ && !multi_gpu();
+#ifdef TT_WITH_CUDA
+    padded_path &= !cuda_graph_enabled_;
+#endif
+    if (!padded_path) {
+      // The other paths prepare their inputs on their own.
+      auto vec = operator()(batch.input_ids, batch.position_ids,
+                            batch.segment_ids, request.pooling,
+                            request.use_pooler);
+      result->compute_ms =
+          MillisecondsSince(start, std::chrono::steady_clock::now());
+      WriteAsyncOutput(request, std::move(vec), result);
+      return;
+    }
+
+    HostInputs host;
+    PrepareHostInputs(batch.input_ids, batch.position_ids, batch.segment_ids,
+                      &host);
+    const core::Tensor *seq_lens = host.padded ? &host.seq_lens : nullptr;
+    core::Tensor input_ids(nullptr), masks(nullptr), position_ids(nullptr),
+        segment_ids(nullptr);
+    if (device_type_ == DLDeviceType::kDLGPU) {
+      CopyInputToDevice(host.input_ids, &input_ids);
+      if (seq_lens == nullptr) {
+        CopyInputToDevice(host.masks, &masks);
+      }
+      CopyInputToDevice(host.position_ids, &position_ids);
+      CopyInputToDevice(host.segment_ids, &segment_ids);
+    }
+    auto &inputs = device_type_ == DLDeviceType::kDLGPU ? input_ids
+                                                        : host.input_ids;
+    auto &input_masks =
+        device_type_ == DLDeviceType::kDLGPU ? masks : host.masks;
+    auto &positions = device_type_ == DLDeviceType::kDLGPU
+                          ? position_ids
+                          : host.position_ids;
+    auto &segments =
+        device_type_ == DLDeviceType::kDLGPU ? segment_ids : host.segment_ids;
+    auto prepared = std::chrono::steady_clock::now();
+    result->prepare_ms = MillisecondsSince(start, prepared);
+
+    std::function<void()> after_layer;
+    if (preemption_enabled_ &&
+        request.priority != BertModel::Priority::kHigh &&
+        inputs.numel() >= preemption_min_tokens_) {
+      after_layer = [&] { RunPreemptingRequests(request.priority); };
+    }
+    auto workspace = AcquireWorkspace();
+    auto &output = Forward(inputs, input_masks, positions, segments,
+                           request.pooling, request.use_pooler,
+                           workspace.get(), seq_lens, false,
+                           after_layer ? &after_layer : nullptr);
+    if (request.output != nullptr &&
+        device_type_ == DLDeviceType::kDLGPU) {
+#ifdef TT_WITH_CUDA
+      // The output is copied straight from the workspace.
+      core::MemcpyAsync(
+          request.output, output.data<float>(), output.numel() * sizeof(float),
+          core::ToMemcpyFlag(request.output_device, DLDeviceType::kDLGPU),
+          device_id_);
+      core::CUDADeviceContext::GetInstance(device_id_).Wait();
+#endif
+    } else {
+      WriteAsyncOutput(request, CopyResultToHost(output), result);
+    }
+    ReleaseWorkspace(std::move(workspace));
+    result->compute_ms =
+        MillisecondsSince(prepared, std::chrono::steady_clock::now());
+  }
+
+  void LoadExitHeads(const std::string &filename) {
+    TT_ENFORCE(!multi_gpu(), "A model on several GPUs does not run exit heads");
+    cnpy::npz_t npz;
+    auto root = OpenWeights(filename, &npz);
+    core::MemoryTagGuard weights_tag("weights");
+    std::vector<std::unique_ptr<ExitHead>> exit_heads(encoders_.size());
+    for (size_t i = 0; i < encoders_.size(); ++i) {
+      auto name = "exit." + std::to_string(i);
+      if (!root.IsExist(name)) {
+        continue;
+      }
+      core::MemoryTagGuard tag(name);
+      std::unique_ptr<ExitHead> head(new ExitHead());
+      head->pooler =
+          LoadPooler(root.Sub(name + ".pooler"), device_type_, device_id_);
+      NPZLoader params(root.Sub(name + ".classifier"), device_type_,
+                       device_id_);
+      head->classifier_weight = params["weight"];
+      // The bias is added to the logits on the host, which computes their
+      // entropy anyway.
+      NPZLoader host_params(root.Sub(name + ".classifier"),
+                            DLDeviceType::kDLCPU, 0);
+      auto bias = host_params["bias"];
+      TT_ENFORCE_EQ(head->classifier_weight.n_dim(), 2,
+                    "The classifier weight of %s must be a matrix", name);
+      TT_ENFORCE_EQ(bias.numel(), head->classifier_weight.shape(1),
+                    "The classifier weight and bias of %s mismatch", name);
+      head->classifier_bias.assign(bias.data<float>(),
+                                   bias.data<float>() + bias.numel());
+      exit_heads[i] = std::move(head);
+    }
+    TT_ENFORCE(!exit_heads.empty() && exit_heads.back() != nullptr,
+               "The last layer needs an exit head, %s has no exit.%d",
+               filename, encoders_.size() - 1);
+    exit_heads_ = std::move(exit_heads);
+  }
+
+  // The logits [batch_size, n_labels] of `head` at the [CLS] rows of
+  // `hidden`, on the host.
+  std::vector<float> ExitLogits(const ExitHead &head,
+                                const core::Tensor &hidden,
+                                core::Workspace *workspace) {
+    int64_t batch_size = hidden.shape(0);
+    int64_t hidden_size = hidden.shape(2);
+    auto &cls = workspace->GetTensor<float>(
+        kPoolingOut, {batch_size, hidden_size}, device_type_, device_id_);
+    layers::SequencePool(PoolType::kFirst)(hidden, &cls);
+    auto &pooled = workspace->GetTensor<float>(
+        kPoolerOut, {batch_size, hidden_size}, device_type_, device_id_);
+    (*head.pooler)(cls, &pooled);
+    int64_t n_labels = head.classifier_weight.shape(1);
+    auto &logits = workspace->GetTensor<float>(
+        kExitLogits, {batch_size, n_labels}, device_type_, device_id_);
+    layers::kernels::MatMul(pooled, false, head.classifier_weight, false, 1.0,
+                            logits, 0.0);
+    auto vec = CopyResultToHost(logits);
+    for (int64_t i = 0; i < batch_size; ++i) {
+      for (int64_t j = 0; j < n_labels; ++j) {
+        vec[i * n_labels + j] += head.classifier_bias[j];
+      }
+    }
+    return vec;
+  }
+
+  // The entropy of softmax(logits[0:n]).
+  static float Entropy(const float *logits, int64_t n) {
+    float max_logit = *std::max_element(logits, logits + n);
+    float sum = 0, weighted_sum = 0;
+    for (int64_t i = 0; i < n; ++i) {
+      float e = std::exp(logits[i] - max_logit);
+      sum += e;
+      weighted_sum += e * (logits[i] - max_logit);
+    }
+    // -sum(p * log(p)) with p = e / sum and log(p) = logit - max - log(sum).
+    return std::log(sum) - weighted_sum / sum;
+  }
+
+  std::vector<float> Classify(
+      const std::vector<std::vector<int64_t>> &inputs,
+      const std::vector<std::vector<int64_t>> &poistion_ids,
+      const std::vector<std::vector<int64_t>> &segment_ids,
+      float entropy_threshold, std::vector<int> *exit_layers) {
+    TT_ENFORCE(!exit_heads_.empty(),
+               "The model has no exit heads, see LoadExitHeads");
+    core::NumThreadsGuard threads(num_threads_);
+    HostInputs host;
+    PrepareHostInputs(inputs, poistion_ids, segment_ids, &host);
+    core::Tensor gpuInputs_tensor{nullptr};
+    core::Tensor gpuPositionIds{nullptr};
+    core::Tensor gpuSeqType{nullptr};
+    core::Tensor *input_ids = &host.input_ids;
+    core::Tensor *position_ids = &host.position_ids;
+    core::Tensor *segment_ids_tensor = &host.segment_ids;
+    if (device_type_ == DLDeviceType::kDLGPU) {
+      CopyInputToDevice(host.input_ids, &gpuInputs_tensor);
+      CopyInputToDevice(host.position_ids, &gpuPositionIds);
+      CopyInputToDevice(host.segment_ids, &gpuSeqType);
+      input_ids = &gpuInputs_tensor;
+      position_ids = &gpuPositionIds;
+      segment_ids_tensor = &gpuSeqType;
+    }
+
+    auto workspace = AcquireWorkspace();
+    core::MemoryTagGuard activations_tag("activations");
+    layers::PrepareBertMasks()(
+        *input_ids, nullptr, segment_ids_tensor,
+        position_ids->is_null() ? nullptr : position_ids, nullptr);
+    int64_t batch_size = input_ids->shape(0);
+    int64_t seq_len = input_ids->shape(1);
+    int64_t hidden_size = encoders_.front()->hidden_size_;
+    auto &hidden = workspace->GetTensor<float>(
+        kHidden, {batch_size, seq_len, hidden_size}, device_type_, device_id_);
+    Embed(*input_ids, *position_ids, *segment_ids_tensor, &hidden,
+          workspace.get());
+
+    // `samples` are the input indices of the rows still running, the rows of
+    // the finished samples are dropped and the others moved to the front.
+    std::vector<int64_t> samples(batch_size);
+    std::iota(samples.begin(), samples.end(), 0);
+    auto *lens = host.seq_lens.mutableData<int64_t>();
+    std::vector<float> result;
+    if (exit_layers != nullptr) {
+      exit_layers->assign(batch_size, -1);
+    }
+    int64_t row_size = seq_len * hidden_size;
+    auto flag = core::ToMemcpyFlag(device_type_, device_type_);
+    for (size_t i = 0; i < encoders_.size() && !samples.empty(); ++i) {
+      int64_t n_running = samples.size();
+      auto &layer = *encoders_[i];
+      {
+        core::MemoryTagGuard tag(layer_tags_[i]);
+        auto &attOut = workspace->GetTensor<float>(
+            kAttentionOut, {n_running, seq_len, hidden_size}, device_type_,
+            device_id_);
+        auto &intermediateOut = workspace->GetTensor<float>(
+            kIntermediateOut, {n_running, seq_len, layer.intermediate_size_},
+            device_type_, device_id_);
+        layer(hidden, nullptr, &host.seq_lens, nullptr, &attOut,
+              &intermediateOut, &hidden, workspace.get());
+      }
+      if (exit_heads_[i] == nullptr) {
+        continue;
+      }
+      auto &head = *exit_heads_[i];
+      auto logits = ExitLogits(head, hidden, workspace.get());
+      int64_t n_labels = head.classifier_weight.shape(1);
+      bool is_last = i + 1 == encoders_.size();
+      result.resize(batch_size * n_labels);
+      auto *data = hidden.mutableData<float>();
+      int64_t n_kept = 0;
+      for (int64_t j = 0; j < n_running; ++j) {
+        const float *row_logits = logits.data() + j * n_labels;
+        if (is_last || Entropy(row_logits, n_labels) < entropy_threshold) {
+          std::copy(row_logits, row_logits + n_labels,
+                    result.begin() + samples[j] * n_labels);
+          if (exit_layers != nullptr) {
+            (*exit_layers)[samples[j]] = static_cast<int>(i);
+          }
+          continue;
+        }
+        if (n_kept != j) {
+          // The rows from n_kept to j are finished, so the copy never
+          // overlaps its source.
+          core::MemcpyAsync(data + n_kept * row_size, data + j * row_size,
+                            row_size * sizeof(float), flag, device_id_);
+          samples[n_kept] = samples[j];
+          lens[n_kept] = lens[j];
+        }
+        ++n_kept;
+      }
+      samples.resize(n_kept);
+      if (n_kept != n_running && n_kept != 0) {
+        hidden.Reshape<float>({n_kept, seq_len, hidden_size}, device_type_,
+                              device_id_);
+        host.seq_lens.Reshape<int64_t>({n_kept}, DLDeviceType::kDLCPU, 0);
+      }
+    }
+    ReleaseWorkspace(std::move(workspace));
+    return result;
+  }
+
+  void LoadTaskHeads(const std::string &filename,
+                     const std::vector<BertModel::TaskHead> &heads) {
+    TT_ENFORCE(!multi_gpu(), "A model on several GPUs does not run task heads");
+    TT_ENFORCE(!heads.empty(), "There are no task heads to load");
+    cnpy::npz_t npz;
+    auto root = OpenWeights(filename, &npz);
+    int64_t hidden_size = encoders_.front()->hidden_size_;
+    std::unique_ptr<TaskHeads> tasks(new TaskHeads());
+    tasks->heads = heads;
+    // The heads are merged on the host, then uploaded.
+    std::vector<core::Tensor> poolers, pooler_biases, classifiers, biases;
+    int64_t n_sequence_labels = 0, n_token_labels = 0;
+    for (auto &head : heads) {
+      TT_ENFORCE(root.IsExist(head.name + ".classifier"),
+                 "%s has no classifier of the task %s", filename, head.name);
+      NPZLoader params(root.Sub(head.name), DLDeviceType::kDLCPU, 0);
+      classifiers.emplace_back(params["classifier.weight"]);
+      biases.emplace_back(params["classifier.bias"]);
+      auto &weight = classifiers.back();
+      TT_ENFORCE(weight.n_dim() == 2 && weight.shape(0) == hidden_size,
+                 "The classifier weight of %s must be [%d, n_labels]",
+                 head.name, hidden_size);
+      TT_ENFORCE_EQ(biases.back().numel(), weight.shape(1),
+                    "The classifier weight and bias of %s mismatch",
+                    head.name);
+      tasks->n_labels.push_back(weight.shape(1));
+      int64_t &n_labels = head.per_token ? n_token_labels : n_sequence_labels;
+      tasks->offsets.push_back(n_labels);
+      n_labels += weight.shape(1);
+      if (!head.per_token) {
+        poolers.emplace_back(params["pooler.dense.weight"]);
+        pooler_biases.emplace_back(params["pooler.dense.bias"]);
+        TT_ENFORCE(poolers.back().n_dim() == 2 &&
+                       poolers.back().shape(0) == hidden_size &&
+                       poolers.back().shape(1) == hidden_size &&
+                       pooler_biases.back().numel() == hidden_size,
+                   "The pooler of %s must be [%d, %d]", head.name,
+                   hidden_size, hidden_size);
+      }
+    }
+
+    core::MemoryTagGuard weights_tag("weights");
+    core::MemoryTagGuard tag("tasks");
+    auto upload = [&](const std::vector<float> &host,
+                      std::initializer_list<int64_t> shape,
+                      core::Tensor *tensor) {
+      tensor->Reshape<float>(shape, device_type_, device_id_);
+      core::Copy(host.data(), host.size(), DLDeviceType::kDLCPU, *tensor);
+    };
+    int64_t n_poolers = poolers.size();
+    if (n_poolers != 0) {
+      std::vector<float> pooler_weight(hidden_size * n_poolers * hidden_size);
+      std::vector<float> pooler_bias;
+      std::vector<float> classifier_weight(
+          n_poolers * hidden_size * n_sequence_labels, 0.f);
+      for (int64_t p = 0; p < n_poolers; ++p) {
+        auto *weight = poolers[p].data<float>();
+        for (int64_t r = 0; r < hidden_size; ++r) {
+          std::copy(weight + r * hidden_size, weight + (r + 1) * hidden_size,
+                    pooler_weight.begin() + (r * n_poolers + p) * hidden_size);
+        }
+        auto *bias = pooler_biases[p].data<float>();
+        pooler_bias.insert(pooler_bias.end(), bias, bias + hidden_size);
+      }
+      int64_t p = 0;
+      for (size_t i = 0; i < heads.size(); ++i) {
+        if (heads[i].per_token) {
+          continue;
+        }
+        auto *weight = classifiers[i].data<float>();
+        for (int64_t r = 0; r < hidden_size; ++r) {
+          std::copy(weight + r * tasks->n_labels[i],
+                    weight + (r + 1) * tasks->n_labels[i],
+                    classifier_weight.begin() +
+                        (p * hidden_size + r) * n_sequence_labels +
+                        tasks->offsets[i]);
+        }
+        ++p;
+      }
+      upload(pooler_weight, {hidden_size, n_poolers * hidden_size},
+             &tasks->pooler_weight);
+      upload(pooler_bias, {n_poolers * hidden_size}, &tasks->pooler_bias);
+      upload(classifier_weight, {n_poolers * hidden_size, n_sequence_labels},
+             &tasks->classifier_weight);
+    }
+    if (n_token_labels != 0) {
+      std::vector<float> token_weight(hidden_size * n_token_labels);
+      for (size_t i = 0; i < heads.size(); ++i) {
+        if (!heads[i].per_token) {
+          continue;
+        }
+        auto *weight = classifiers[i].data<float>();
+        for (int64_t r = 0; r < hidden_size; ++r) {
+          std::copy(weight + r * tasks->n_labels[i],
+                    weight + (r + 1) * tasks->n_labels[i],
+                    token_weight.begin() + r * n_token_labels +
+                        tasks->offsets[i]);
+        }
+      }
+      upload(token_weight, {hidden_size, n_token_labels},
+             &tasks->token_weight);
+    }
+    for (size_t i = 0; i < heads.size(); ++i) {
+      auto &bias = heads[i].per_token ? tasks->token_bias
+                                      : tasks->classifier_bias;
+      bias.insert(bias.end(), biases[i].data<float>(),
+                  biases[i].data<float>() + biases[i].numel());
+    }
+    task_heads_ = std::move(tasks);
+  }
+
+  std::vector<std::vector<float>> RunTasks(
+      const std::vector<std::vector<int64_t>> &inputs,
+      const std::vector<std::vector<int64_t>> &poistion_ids,
+      const std::vector<std::vector<int64_t>> &segment_ids) {
+    TT_ENFORCE(task_heads_ != nullptr,
+               "The model has no task heads, see LoadTaskHeads");
+    core::NumThreadsGuard threads(num_threads_);
+    HostInputs host;
+    PrepareHostInputs(inputs, poistion_ids, segment_ids, &host);
+    const core::Tensor *seq_lens = host.padded ? &host.seq_lens : nullptr;
+    core::Tensor gpuInputs_tensor{nullptr};
+    core::Tensor gpuMasks_tensor{nullptr};
+    core::Tensor gpuPositionIds{nullptr};
+    core::Tensor gpuSeqType{nullptr};
+    core::Tensor *input_ids = &host.input_ids;
+    core::Tensor *masks = &host.masks;
+    core::Tensor *position_ids = &host.position_ids;
+    core::Tensor *segment_ids_tensor = &host.segment_ids;
+    if (device_type_ == DLDeviceType::kDLGPU) {
+      CopyInputToDevice(host.input_ids, &gpuInputs_tensor);
+      if (seq_lens == nullptr) {
+        CopyInputToDevice(host.masks, &gpuMasks_tensor);
+      }
+      CopyInputToDevice(host.position_ids, &gpuPositionIds);
+      CopyInputToDevice(host.segment_ids, &gpuSeqType);
+      input_ids = &gpuInputs_tensor;
+      masks = &gpuMasks_tensor;
+      position_ids = &gpuPositionIds;
+      segment_ids_tensor = &gpuSeqType;
+    }
+
+    auto workspace = AcquireWorkspace();
+    core::MemoryTagGuard activations_tag("activations");
+    auto &hidden = Encode(*input_ids, *masks, *position_ids,
+                          *segment_ids_tensor, workspace.get(), seq_lens,
+                          false, nullptr, encoders_.size());
+    auto &tasks = *task_heads_;
+    int64_t batch_size = hidden.shape(0);
+    int64_t seq_len = hidden.shape(1);
+    int64_t hidden_size = hidden.shape(2);
+    std::vector<float> sequence_logits, token_logits;
+    if (!tasks.pooler_weight.is_null()) {
+      int64_t n_labels = tasks.classifier_weight.shape(1);
+      auto &cls = workspace->GetTensor<float>(
+          kPoolingOut, {batch_size, hidden_size}, device_type_, device_id_);
+      layers::SequencePool(PoolType::kFirst)(hidden, &cls);
+      auto &pooled = workspace->GetTensor<float>(
+          kTaskPooled, {batch_size, tasks.pooler_weight.shape(1)},
+          device_type_, device_id_);
+      layers::kernels::MatMul(cls, false, tasks.pooler_weight, false, 1.0,
+                              pooled, 0.0);
+      layers::kernels::AddBiasAct<float, layers::kernels::ActivationType::Tanh>(
+          tasks.pooler_bias, &pooled);
+      auto &logits = workspace->GetTensor<float>(
+          kTaskLogits, {batch_size, n_labels}, device_type_, device_id_);
+      layers::kernels::MatMul(pooled, false, tasks.classifier_weight, false,
+                              1.0, logits, 0.0);
+      sequence_logits = CopyResultToHost(logits);
+    }
+    if (!tasks.token_weight.is_null()) {
+      int64_t n_labels = tasks.token_weight.shape(1);
+      auto &logits = workspace->GetTensor<float>(
+          kTaskLogits, {batch_size, seq_len, n_labels}, device_type_,
+          device_id_);
+      layers::kernels::MatMul(hidden, false, tasks.token_weight, false, 1.0,
+                              logits, 0.0);
+      token_logits = CopyResultToHost(logits);
+    }
+    ReleaseWorkspace(std::move(workspace));
+
+    std::vector<std::vector<float>> outputs;
+    for (size_t i = 0; i < tasks.heads.size(); ++i) {
+      bool per_token = tasks.heads[i].per_token;
+      auto &logits = per_token ? token_logits : sequence_logits;
+      auto &bias = per_token ? tasks.token_bias : tasks.classifier_bias;
+      int64_t row_size = bias.size();
+      int64_t n_rows = logits.size() / row_size;
+      int64_t n_labels = tasks.n_labels[i];
+      int64_t offset = tasks.offsets[i];
+      std::vector<float> output(n_rows * n_labels);
+      for (int64_t r = 0; r < n_rows; ++r) {
+        for (int64_t j = 0; j < n_labels; ++j) {
+          output[r * n_labels + j] =
+              logits[r * row_size + offset + j] + bias[offset + j];
+        }
+      }
+      outputs.emplace_back(std::move(output));
+    }
+    return outputs;
+  }
+
+  void EnableCUDAGraph(bool enable) {
+    TT_ENFORCE(!enable || !multi_gpu(),
+               "A model on several GPUs does not run on CUDA graphs");
+    TT_ENFORCE(!enable || device_type_ == DLDeviceType::kDLGPU,
+               "CUDA graphs are only supported on the GPU");
+    TT_ENFORCE(!enable || !packing_enabled_,
+               "The packed inputs change their shape on every call, which CUDA "
+               "graphs do not support");
+#ifdef TT_WITH_CUDA
+    cuda_graph_enabled_ = enable;
+#else
+    TT_ENFORCE(!enable, "TurboTransformers is built without CUDA");
+#endif
+  }
+
+  void EnablePacking(bool enable) {
+    TT_ENFORCE(!enable || !multi_gpu(),
+               "A model on several GPUs does not run packed inputs");
+#ifdef TT_WITH_CUDA
+    TT_ENFORCE(!enable || !cuda_graph_enabled_,
+               "The packed inputs change their shape on every call, which CUDA "
+               "graphs do not support");
+#endif
+    packing_enabled_ = enable;
+  }
+
+  void EnableLengthBucketing(bool enable, float max_padding_ratio) {
+    TT_ENFORCE(!enable || !multi_gpu(),
+               "A model on several GPUs pads every batch on its own");
+    TT_ENFORCE(max_padding_ratio >= 0 && max_padding_ratio < 1,
+               "The padding ratio should be in [0, 1), got %f",
+               max_padding_ratio);
+    bucketing_enabled_ = enable;
+    max_padding_ratio_ = max_padding_ratio;
+  }
+
+  std::unique_ptr<layers::BERTEmbedding> embedding_;
+  // The [embedding_size, hidden_size] projection of the embeddings, null
+  // unless the embedding size differs from the hidden size.
+  core::Tensor projection_weight_{nullptr};
+  core::Tensor projection_bias_{nullptr};
+  layers::kernels::PackedWeight packed_projection_weight_;
+  // The layers of an ALBERT model are all the same shared layer.
+  std::vector<std::shared_ptr<BERTLayer>> encoders_;
+  // The memory tags of the encoder layers, "encoder.layer.<i>".
+  std::vector<std::string> layer_tags_;
+  std::unique_ptr<layers::BertPooler> pooler_;
+  // The exit heads of the layers, null for a layer without one.
+  std::vector<std::unique_ptr<ExitHead>> exit_heads_;
+  std::unique_ptr<TaskHeads> task_heads_;
+
+  DLDeviceType device_type_;
+  int device_id_;
+
+  std::mutex workspace_mutex_;
+  core::MemoryPlan memory_plan_;
+  bool memory_planned_{false};
+  std::vector<std::unique_ptr<core::Workspace>> idle_workspaces_;
+  std::shared_ptr<WorkspacePool> workspace_pool_;
+  size_t weight_bytes_{0};
+  // The threads of the calls on the CPU, 0 for the setting of the caller.
+  std::atomic<int> num_threads_{0};
+  bool packing_enabled_{false};
+  bool bucketing_enabled_{false};
+  float max_padding_ratio_{0.1f};
+  bool pooled_rows_only_{false};
+  bool batch_splitting_{false};
+  size_t max_workspace_bytes_{0};
+  // Null unless EnableResultCache.
+  std::unique_ptr<ResultCache> result_cache_;
+
+  std::mutex async_mutex_;
+  std::condition_variable async_cv_;
+  static constexpr int kNumPriorities = 3;
+  // A queue per BertModel::Priority.
+  std::deque<std::unique_ptr<AsyncRequest>> async_queues_[kNumPriorities];
+  bool preemption_enabled_{false};
+  int64_t preemption_min_tokens_{0};
+  bool async_stopped_{false};
+  // Started by the first Submit.
+  std::thread async_worker_;
+
+#ifdef TT_WITH_CUDA
+  bool cuda_graph_enabled_{false};
+  std::mutex graph_mutex_;
+  std::map<CUDAGraphKey, std::unique_ptr<CUDAGraph>> graphs_;
+  // The stages of a pipelined model, one per device, see InitPipeline.
+  std::vector<std::unique_ptr<PipelineStage>> stages_;
+  int64_t micro_batch_size_{0};
+  std::mutex pipeline_mutex_;
+  // The GPUs of a tensor-parallel model and its layers, which ALBERT shares,
+  // see InitTensorParallel.
+  std::vector<std::unique_ptr<TensorParallelShard>> shards_;
+  std::vector<std::shared_ptr<const layers::TensorParallelBertLayer>>
+      tensor_parallel_layers_;
+  std::mutex tensor_parallel_mutex_;
+#endif
+};
+
+BertModel::BertModel(const std::string &filename, DLDeviceType device_type,
+                     size_t n_layers, int64_t n_heads, int device_id)
+    : m_(new Impl(filename, device_type, n_layers, n_heads, device_id)) {}
+
+BertModel::BertModel(const std::string &filename, DLDeviceType device_type,
+                     int device_id) {
+  auto file = loaders::WeightFile::Open(filename);
+  TT_ENFORCE(!file->config().empty(), "%s is not a model file", filename);
+  auto it = file->config().find("model_type");
+  TT_ENFORCE(it == file->config().end() || it->second == "bert",
+             "%s holds the unsupported model %s", filename, it->second);
+  // The activation kernel is the tanh approximation of gelu, which the
+  // npz archives of "gelu" models run on as well.
+  auto &act = file->GetConfig("hidden_act");
+  TT_ENFORCE(act == "gelu" || act == "gelu_new",
+             "The activation %s is not supported", act);
+  auto n_layers = std::stoul(file->GetConfig("num_hidden_layers"));
+  auto n_heads = std::stoll(file->GetConfig("num_attention_heads"));
+  auto hidden_size = std::stoll(file->GetConfig("hidden_size"));
+  TT_ENFORCE(n_heads > 0 && hidden_size % n_heads == 0,
+             "The hidden size %d is not divisible by %d heads", hidden_size,
+             n_heads);
+  m_.reset(new Impl(filename, device_type, n_layers, n_heads, device_id));
+}
+
+BertModel::BertModel(const std::string &filename,
+                     const std::vector<int> &device_ids, size_t n_layers,
+                     int64_t n_heads, int64_t micro_batch_size)
+    : m_(new Impl(filename, DLDeviceType::kDLGPU, n_layers, n_heads,
+                  device_ids.empty() ? 0 : device_ids.front(), device_ids,
+                  micro_batch_size)) {
+  TT_ENFORCE(!device_ids.empty(), "The pipeline needs a device at least");
+}
+
+BertModel::BertModel(const std::string &filename,
+                     const std::vector<int> &device_ids, size_t n_layers,
+                     int64_t n_heads, TensorParallel)
+    : m_(new Impl(filename, DLDeviceType::kDLGPU, n_layers, n_heads,
+                  device_ids.empty() ? 0 : device_ids.front(), {}, 0,
+                  device_ids)) {
+  TT_ENFORCE(!device_ids.empty(), "The shards need a device at least");
+}
+
+std::vector<float> BertModel::operator()(
+    const std::vector<std::vector<int64_t>> &inputs,
+    const std::vector<std::vector<int64_t>> &poistion_ids,
+    const std::vector<std::vector<int64_t>> &segment_ids, PoolType pooling,
+    bool use_pooler) const {
+  return m_->operator()(inputs, poistion_ids, segment_ids, pooling, use_pooler);
+}
+
+void BertModel::PlanMemory(int64_t max_batch_size, int64_t max_seq_len) {
+  m_->PlanMemory(max_batch_size, max_seq_len);
+}
+
+void BertModel::WarmUp(const std::vector<std::pair<int64_t, int64_t>> &shapes,
+                       PoolType pooling, bool use_pooler) const {
+  m_->WarmUp(shapes, pooling, use_pooler);
+}
+
+void BertModel::Reserve(int64_t max_batch_size, int64_t max_seq_len) {
+  if (!m_->multi_gpu()) {
+    m_->PlanMemory(max_batch_size, max_seq_len);
+  }
+  m_->WarmUp({{max_batch_size, max_seq_len}}, PoolType::kFirst, false);
+}
+
+void BertModel::EnableCUDAGraph(bool enable) { m_->EnableCUDAGraph(enable); }
+
+void BertModel::LoadExitHeads(const std::string &filename) {
+  m_->LoadExitHeads(filename);
+}
+
+std::vector<float> BertModel::Classify(
+    const std::vector<std::vector<int64_t>> &inputs,
+    const std::vector<std::vector<int64_t>> &poistion_ids,
+    const std::vector<std::vector<int64_t>> &segment_ids,
+    float entropy_threshold, std::vector<int> *exit_layers) const {
+  return m_->Classify(inputs, poistion_ids, segment_ids, entropy_threshold,
+                      exit_layers);
+}
+
+void BertModel::LoadTaskHeads(const std::string &filename,
+                              const std::vector<TaskHead> &heads) {
+  m_->LoadTaskHeads(filename, heads);
+}
+
+std::vector<std::vector<float>> BertModel::RunTasks(
+    const std::vector<std::vector<int64_t>> &inputs,
+    const std::vector<std::vector<int64_t>> &poistion_ids,
+    const std::vector<std::vector<int64_t>> &segment_ids) const {
+  return m_->RunTasks(inputs, poistion_ids, segment_ids);
+}
+
+std::vector<float> BertModel::RunTexts(const WordPieceTokenizer &tokenizer,
+                                       const std::vector<std::string> &texts,
+                                       int64_t max_seq_len, PoolType pooling,
+                                       bool use_pooler) const {
+  return m_->RunTexts(tokenizer, texts, max_seq_len, pooling, use_pooler);
+}
+
+std::vector<float> BertModel::RunDocument(
+    const std::vector<int64_t> &ids, const WindowOptions &options) const {
+  return m_->RunDocument(ids, options);
+}
+
+std::vector<std::vector<float>> BertModel::RunBatches(
+    const std::vector<Batch> &batches, PoolType pooling,
+    bool use_pooler) const {
+  return m_->RunBatches(batches, pooling, use_pooler);
+}
+
+std::future<BertModel::AsyncResult> BertModel::Submit(
+    Batch batch, PoolType pooling, bool use_pooler, float *output,
+    DLDeviceType output_device, Callback callback, Priority priority) const {
+  return m_->Submit(std::move(batch), pooling, use_pooler, output,
+                    output_device, std::move(callback), priority);
+}
+
+void BertModel::EnablePreemption(bool enable, int64_t min_tokens) {
+  TT_ENFORCE_GE(min_tokens, 0, "The tokens should not be negative");
+  m_->preemption_enabled_ = enable;
+  m_->preemption_min_tokens_ = min_tokens;
+}
+
+void BertModel::SetNumThreads(int n_th) {
+  TT_ENFORCE_GE(n_th, 0, "The number of threads should not be negative");
+  m_->num_threads_ = n_th;
+}
+
+void BertModel::EnablePacking(bool enable) { m_->EnablePacking(enable); }
+
+void BertModel::EnableLengthBucketing(bool enable, float max_padding_ratio) {
+  m_->EnableLengthBucketing(enable, max_padding_ratio);
+}
+
+void BertModel::SetWorkspacePool(std::shared_ptr<WorkspacePool> pool) {
+  std::lock_guard<std::mutex> lock(m_->workspace_mutex_);
+  m_->workspace_pool_ = std::move(pool);
+  m_->idle_workspaces_.clear();
+}
+
+size_t BertModel::weight_bytes() const { return m_->weight_bytes_; }
+
+DLDeviceType BertModel::device_type() const { return m_->device_type_; }
+
+size_t BertModel::num_distinct_layers() const {
+  std::set<const void *> layers;
+  for (auto &layer : m_->encoders_) {
+    layers.insert(layer.get());
+  }
+#ifdef TT_WITH_CUDA
+  for (auto &layer : m_->tensor_parallel_layers_) {
+    layers.insert(layer.get());
+  }
+#endif
+  return layers.size();
+}
+
+size_t BertModel::workspace_bytes() const {
+  std::lock_guard<std::mutex> lock(m_->workspace_mutex_);
+  return m_->memory_planned_ ? m_->memory_plan_.total_size : 0;
+}
+
+void BertModel::EnablePooledRowsOnly(bool enable) {
+  m_->pooled_rows_only_ = enable;
+}
+
+void BertModel::EnableBatchSplitting(bool enable,
+                                     size_t max_workspace_bytes) {
+  m_->batch_splitting_ = enable;
+  m_->max_workspace_bytes_ = max_workspace_bytes;
+}
+
+void BertModel::EnableResultCache(size_t capacity, size_t num_shards) {
+  m_->result_cache_.reset(
+      capacity == 0 ? nullptr : new ResultCache(capacity, num_shards));
+}
+
+ResultCache::Stats BertModel::result_cache_stats() const {
+  return m_->result_cache_ == nullptr ? ResultCache::Stats()
+                                      : m_->result_cache_->stats();
+}
+
+BertModel::~BertModel() = default;
+
+}  // namespace serving
+}  // namespace turbo_transformers
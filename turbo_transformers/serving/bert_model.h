@@ -0,0 +1,341 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dlpack/dlpack.h"
+#include "turbo_transformers/serving/result_cache.h"
+#include "turbo_transformers/layers/types.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+using PoolType = layers::types::PoolType;
+
+class WordPieceTokenizer;
+class WorkspacePool;
+
+class BertModel {
+ public:
+  // The inputs of a batch, as for operator().
+  struct Batch {
+    std::vector<std::vector<int64_t>> input_ids;
+    std::vector<std::vector<int64_t>> position_ids;
+    std::vector<std::vector<int64_t>> segment_ids;
+  };
+
+  // The outcome of a batch run by Submit.
+  struct AsyncResult {
+    // The pooled outputs [batch_size, hidden_size], empty if they were
+    // written to the output buffer of the request.
+    std::vector<float> output;
+    // The milliseconds the request waited in the queue, spent on the host
+    // padding and uploading its inputs, and running on the device up to the
+    // copy of its output.
+    double queue_ms{0};
+    double prepare_ms{0};
+    double compute_ms{0};
+    // Set if the request failed, the future then throws it.
+    std::exception_ptr error;
+  };
+  using Callback = std::function<void(const AsyncResult &)>;
+
+  // The priority classes of Submit, e.g. online requests and offline jobs
+  // sharing a model. The queued batches of a higher class run first, and on
+  // the GPU on a stream of their priority, see core::StreamPriority: kHigh
+  // and kLow on the streams reserved for them, kNormal on the current stream
+  // of the submitting thread.
+  enum class Priority { kHigh = 0, kNormal, kLow };
+
+  // The windows of RunDocument.
+  struct WindowOptions {
+    // The ids of a window, the special ones included, at most the positions
+    // of the model, and the ids of the document between the starts of two
+    // windows, at most the ids of the document in a window.
+    int64_t window_len{512};
+    int64_t stride{384};
+    // If not negative, the ids wrapping every window, e.g. [CLS] and [SEP].
+    int64_t cls_id{-1};
+    int64_t sep_id{-1};
+    // Return the outputs of the tokens of the document [doc_len,
+    // hidden_size], or else the pooled outputs of the windows merged
+    // [hidden_size].
+    bool token_outputs{false};
+    // kMean or kMax over the windows covering a token, or over the windows.
+    PoolType merge{PoolType::kMean};
+    // The pooling of a window, unless token_outputs.
+    PoolType pooling{PoolType::kFirst};
+    bool use_pooler{false};
+  };
+
+  // On the GPU, the model runs on the current stream of the calling thread,
+  // see core::CUDAStreamGuard, so the calls of threads using different
+  // streams overlap. `n_heads` are the heads of an unpruned layer, the layers
+  // of a head-pruned model run the heads left in their qkv weights.
+  // `filename` is an npz archive, or a weight file of loaders/weight_file.h,
+  // whose weights the CPU runs on in place of copies. The models of a file
+  // share its weights once loaders::WeightStore is enabled.
+  // An ALBERT model, see tools/convert_huggingface_albert_pytorch_to_npz.py,
+  // loads its shared layer "encoder.albert_layer" once and runs it for each
+  // of the `n_layers`, with the embeddings projected to the hidden size by
+  // "encoder.embedding_hidden_mapping_in".
+  BertModel(const std::string &filename, DLDeviceType device_type,
+            size_t n_layers, int64_t n_heads, int device_id = 0);
+  // Load a model file, see
+  // tools/convert_huggingface_bert_pytorch_to_weight_file.py, which carries
+  // the layers and the heads of the model in its config.
+  BertModel(const std::string &filename, DLDeviceType device_type,
+            int device_id = 0);
+  // Split the layers into contiguous stages on the GPUs `device_ids`, the
+  // embedding runs on the first and the pooler on the last. A batch runs as
+  // micro-batches of `micro_batch_size` sequences, which the stages pass on
+  // to the next GPU, so all the GPUs are busy once the pipeline is full. The
+  // stages run on the current streams of the calling thread, and the calls
+  // run one after another. PlanMemory, CUDA graphs, packing, bucketing and
+  // exit heads are not supported.
+  BertModel(const std::string &filename, const std::vector<int> &device_ids,
+            size_t n_layers, int64_t n_heads, int64_t micro_batch_size);
+  // Selects the tensor-parallel constructor below.
+  struct TensorParallel {};
+  // Shard every layer over the GPUs `device_ids`: each GPU holds the qkv and
+  // dense weights of a range of the heads, and a range of the intermediate
+  // columns with their rows of the output weight, so the GEMMs of a layer run
+  // on all the GPUs at once, which cuts the latency of a single request of a
+  // large model. The first GPU runs the embedding and the pooler, and sums
+  // the partial outputs of the attention and the FFN over peer copies before
+  // their layer norm. The heads and the intermediate size of the layers
+  // should divide by the GPUs. The same as for the pipeline is not
+  // supported, and the calls run one after another as well.
+  BertModel(const std::string &filename, const std::vector<int> &device_ids,
+            size_t n_layers, int64_t n_heads, TensorParallel);
+  ~BertModel();
+
+  // Plan the intermediate tensors for inputs up to [max_batch_size,
+  // max_seq_len]. Afterwards every call within this bound runs on a
+  // preallocated arena instead of allocating its activations.
+  void PlanMemory(int64_t max_batch_size, int64_t max_seq_len);
+
+  // Run a batch of dummy sequences of every [batch size, sequence length] of
+  // `shapes`, the largest first, so that the first requests of these shapes
+  // run at their steady latency: the workspace grows to its largest size,
+  // the GEMMs of every shape are tuned, the kernels and the BLAS handles are
+  // loaded, and with EnableCUDAGraph the graphs of the shapes are captured.
+  // The result cache is bypassed. Warm up after the other settings, which
+  // change the kernels a batch runs, and after PlanMemory, which drops the
+  // idle workspaces.
+  void WarmUp(const std::vector<std::pair<int64_t, int64_t>> &shapes,
+              PoolType pooling = PoolType::kFirst,
+              bool use_pooler = false) const;
+  // Plan the memory for [max_batch_size, max_seq_len], see PlanMemory, then
+  // warm up that shape, so that the first request of any smaller shape finds
+  // its arena allocated. A pipeline plans no memory and warms up only.
+  void Reserve(int64_t max_batch_size, int64_t max_seq_len);
+
+  // On the GPU, capture the whole network into a CUDA graph the first time a
+  // shape is seen and replay the graph afterwards, which saves launching the
+  // kernels one by one. Every distinct (batch size, sequence length) keeps a
+  // graph and its own activations, so the caller should pad the inputs to a
+  // few fixed shapes.
+  void EnableCUDAGraph(bool enable = true);
+
+  // Run the sequences of a batch back to back instead of padding them to the
+  // longest one: the ids are concatenated and every layer runs on the valid
+  // tokens only, with the attention computed sequence by sequence. It pays
+  // off for batches of uneven lengths, and excludes the CUDA graphs, which
+  // need fixed shapes.
+  void EnablePacking(bool enable = true);
+
+  // Sort a batch of mixed lengths and run it as sub-batches of similar
+  // lengths, each padding at most `max_padding_ratio` of its tokens, and
+  // concurrently on streams of their own on the GPU. The results keep the
+  // order of the inputs. Unlike EnablePacking, it works with CUDA graphs,
+  // though every sub-batch shape gets a graph of its own. The pooling of a
+  // sub-batch sees less padding, so kMean and kLast differ from pooling the
+  // whole padded batch.
+  void EnableLengthBucketing(bool enable = true,
+                             float max_padding_ratio = 0.1f);
+
+  // With kFirst or kLast pooling, compute the last layer on the pooled row
+  // of every sequence only: the keys and values of the attention still take
+  // all the tokens, but the attention output, the intermediate and the output
+  // GEMMs shrink to a row per sequence, and their output is passed to the
+  // pooler as it is. Packed inputs and the pipeline compute all the rows.
+  void EnablePooledRowsOnly(bool enable = true);
+
+  // Run the batches which do not fit in memory as halves instead of failing
+  // them. A batch whose activations, as MakeMemoryPlan predicts them for its
+  // padded shape, exceed `max_workspace_bytes`, unless it is 0, is split
+  // before it runs, and a batch whose allocations fail is split and run
+  // again, after the cache of the GPU allocator is emptied. The halves are
+  // split further as needed, a single sequence which does not fit fails.
+  // The splits are counted in core::GetMetrics. As with bucketing, kMean
+  // and kLast see the padding of the halves. It applies to operator(), and
+  // the allocation failures of a CUDA graph capture are not retried.
+  void EnableBatchSplitting(bool enable = true,
+                            size_t max_workspace_bytes = 0);
+
+  // Cache the pooled outputs of up to `capacity` sequences, see ResultCache,
+  // which operator() looks up before running a batch. The sequences missing
+  // run as a batch of their own, each distinct one once, so with kMean and
+  // kLast their outputs see the padding of that batch, as with bucketing. 0
+  // disables the cache and drops its entries. Concurrent calls are safe, but
+  // enabling it is not, as for the other settings.
+  void EnableResultCache(size_t capacity, size_t num_shards = 16);
+  // The hits and misses since the cache was enabled.
+  ResultCache::Stats result_cache_stats() const;
+
+  // Take the activation workspaces of the calls from `pool`, which the model
+  // shares with others, instead of keeping workspaces of its own, see
+  // ModelRegistry. Null restores the workspaces of the model.
+  void SetWorkspacePool(std::shared_ptr<WorkspacePool> pool);
+  // The bytes of the weights the model loaded, and of the activations of its
+  // memory plan, 0 if it has none.
+  size_t weight_bytes() const;
+  size_t workspace_bytes() const;
+  // The device the model runs on, the GPU for a pipeline.
+  DLDeviceType device_type() const;
+  // The number of the distinct encoder layers the model loaded, one per
+  // device for ALBERT, which shares its layer among all.
+  size_t num_distinct_layers() const;
+
+  // Run the kernels and the BLAS calls of this model on the CPU with `n_th`
+  // threads, whatever the thread count of the calling thread is, so that
+  // models of their own degree of parallelism share a process. A call runs
+  // on the OpenMP pool of the calling thread, so concurrent callers of small
+  // batches, each given a few threads, do not oversubscribe the host. 0
+  // restores the thread count of the caller, see core::SetNumThreads.
+  void SetNumThreads(int n_th);
+
+  // Run the batches Submit queued below kHigh having at least `min_tokens`
+  // padded tokens layer by layer, and between two of their layers the
+  // batches of a higher priority queued meanwhile, each on a workspace of
+  // its own, so a large offline batch holds up an online request for a
+  // layer rather than for the whole batch. On the GPU, the worker waits for
+  // every layer of such a batch, at the cost of the launch gaps between its
+  // layers. The batches run in between are counted in core::GetMetrics. It
+  // applies to the batches the worker pads itself, i.e. without packing,
+  // bucketing, CUDA graphs or a pipeline.
+  void EnablePreemption(bool enable = true, int64_t min_tokens = 16384);
+
+  std::vector<float> operator()(
+      const std::vector<std::vector<int64_t>> &inputs,
+      const std::vector<std::vector<int64_t>> &poistion_ids,
+      const std::vector<std::vector<int64_t>> &segment_ids,
+      PoolType pooling = PoolType::kFirst, bool use_pooler = false) const;
+
+  // Tokenize `texts` by `tokenizer`, each truncated to `max_seq_len` ids,
+  // and run them as operator() runs the ids. Unless the batch needs the
+  // vectors of ids, i.e. with a pipeline, CUDA graphs, bucketing, batch
+  // splitting or the result cache, the ids are written straight into the
+  // packed host inputs, pinned on the GPU, which are padded on the device.
+  std::vector<float> RunTexts(const WordPieceTokenizer &tokenizer,
+                              const std::vector<std::string> &texts,
+                              int64_t max_seq_len,
+                              PoolType pooling = PoolType::kFirst,
+                              bool use_pooler = false) const;
+
+  // Run a document longer than the positions of the model as overlapping
+  // windows, `options.stride` ids apart, which all run as a single packed
+  // batch whatever EnablePacking is, so the last window is not padded. The
+  // outputs of the windows are merged on the device of the model, and the
+  // specials ids of the windows are left out of the token outputs.
+  std::vector<float> RunDocument(const std::vector<int64_t> &ids,
+                                 const WindowOptions &options) const;
+
+  // Run a stream of batches and return their outputs in order. On the GPU,
+  // the host pads the next batch into pinned memory and uploads it on a copy
+  // stream while the current one runs on the current stream of the calling
+  // thread, the compute stream waiting for the uploads by events, so the
+  // host work no longer leaves gaps between the batches. With packing,
+  // bucketing, CUDA graphs, a pipeline, or on the CPU, the batches run one
+  // after another as by operator().
+  std::vector<std::vector<float>> RunBatches(
+      const std::vector<Batch> &batches, PoolType pooling = PoolType::kFirst,
+      bool use_pooler = false) const;
+
+  // Queue a batch and return at once. A worker thread of the model runs the
+  // queued batches one after another, on the current stream of the thread
+  // which submitted them unless `priority` says otherwise, then calls
+  // `callback`, if any, on the worker thread and fulfils the future. If
+  // `output` is given, the pooled outputs are written to it instead of
+  // AsyncResult::output, which saves a copy when the caller keeps them on
+  // the GPU of the model. It must hold [batch_size, hidden_size] floats on
+  // `output_device` until then. The callback should not block, as it holds
+  // up the batches behind it. The queue is ordered by `priority`, see
+  // Priority and EnablePreemption.
+  std::future<AsyncResult> Submit(Batch batch,
+                                  PoolType pooling = PoolType::kFirst,
+                                  bool use_pooler = false,
+                                  float *output = nullptr,
+                                  DLDeviceType output_device = kDLCPU,
+                                  Callback callback = nullptr,
+                                  Priority priority = Priority::kNormal) const;
+
+  // Load the early-exit classifiers of a DeeBERT-style model, the npz keys
+  // "exit.<i>.pooler.dense.{weight,bias}" and "exit.<i>.classifier.{weight,
+  // bias}" of the layers having one. The classifier weight is [hidden_size,
+  // n_labels] as the other weights of the model. The last layer must have a
+  // classifier.
+  void LoadExitHeads(const std::string &filename);
+
+  // Classify a batch with early exits, see LoadExitHeads. After every layer
+  // having an exit head, the samples whose logits have an entropy below
+  // `entropy_threshold` stop, and the rest of the batch runs on without them.
+  // Returns the logits [batch_size, n_labels] in the order of the inputs, and
+  // the layer each sample exited at in `exit_layers` if not null.
+  std::vector<float> Classify(
+      const std::vector<std::vector<int64_t>> &inputs,
+      const std::vector<std::vector<int64_t>> &poistion_ids,
+      const std::vector<std::vector<int64_t>> &segment_ids,
+      float entropy_threshold, std::vector<int> *exit_layers = nullptr) const;
+
+  // A head of a multi-task model, the npz keys "<name>.classifier.{weight,
+  // bias}" with the weight [hidden_size, n_labels]. A sequence head runs the
+  // pooler "<name>.pooler.dense.{weight,bias}" on the [CLS] row before its
+  // classifier, a token head runs its classifier on every row.
+  struct TaskHead {
+    std::string name;
+    bool per_token{false};
+  };
+
+  // Load the heads RunTasks runs on the output of the encoder of this model,
+  // replacing the ones loaded before.
+  void LoadTaskHeads(const std::string &filename,
+                     const std::vector<TaskHead> &heads);
+
+  // Run the encoder once on a batch and all the heads of LoadTaskHeads on
+  // its output. Returns the logits of each head in the order of
+  // LoadTaskHeads, [batch_size, n_labels] of a sequence head and
+  // [batch_size, seq_len, n_labels] of a token head, `seq_len` being the
+  // longest sequence of the batch. The heads of a kind run together: the
+  // poolers as one GEMM and their classifiers as another, and the
+  // classifiers of the token heads as a third.
+  std::vector<std::vector<float>> RunTasks(
+      const std::vector<std::vector<int64_t>> &inputs,
+      const std::vector<std::vector<int64_t>> &poistion_ids,
+      const std::vector<std::vector<int64_t>> &segment_ids) const;
+
+ private:
+  struct Impl;
+  std::unique_ptr<Impl> m_;
+};
+
+}  // namespace serving
+}  // namespace turbo_transformers
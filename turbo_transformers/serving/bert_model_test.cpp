@@ -0,0 +1,749 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/serving/bert_model.h"
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include <iostream>
+#include "catch2/catch.hpp"
+#include "cnpy.h"
+#include "turbo_transformers/core/config.h"
+#include "turbo_transformers/core/macros.h"
+#include "turbo_transformers/core/metrics.h"
+#include "turbo_transformers/serving/test_model.h"
+#include "turbo_transformers/serving/tokenizer.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+// The checks of the outputs of bert-base-uncased, converted by
+// tools/convert_huggingface_bert_pytorch_to_npz.py, which run where the
+// archive is found.
+static const char *kPretrainedModel = "models/bert.npz";
+
+static bool HasPretrainedModel() {
+  return std::ifstream(kPretrainedModel).good();
+}
+
+bool CheckCppBert(bool use_cuda, bool only_input) {
+  BertModel model(kPretrainedModel,
+                  use_cuda ? DLDeviceType::kDLGPU : DLDeviceType::kDLCPU, 12,
+                  12);
+  std::vector<std::vector<int64_t>> position_ids{{1, 0, 0, 0}, {1, 1, 1, 0}};
+  std::vector<std::vector<int64_t>> segment_ids{{1, 1, 1, 0}, {1, 0, 0, 0}};
+  if (only_input) {
+    position_ids.clear();
+    segment_ids.clear();
+  }
+  auto vec = model({{12166, 10699, 16752, 4454}, {5342, 16471, 817, 16022}},
+                   position_ids, segment_ids, PoolType::kFirst, false);
+  REQUIRE(vec.size() == 768 * 2);
+  // Write a better UT
+  for (size_t i = 0; i < vec.size(); ++i) {
+    REQUIRE(!std::isnan(vec.data()[i]));
+    REQUIRE(!std::isinf(vec.data()[i]));
+  }
+  if (only_input) {
+    std::cerr << vec.data()[0] << std::endl;
+    REQUIRE(fabs(vec.data()[0] - -0.9791) < 1e-3);
+    REQUIRE(fabs(vec.data()[1] - 0.8283) < 1e-3);
+    REQUIRE(fabs(vec.data()[768] - 0.3837) < 1e-3);
+    REQUIRE(fabs(vec.data()[768 + 1] - 0.1659) < 1e-3);
+  } else {
+    REQUIRE(fabs(vec.data()[0] - -0.3760) < 1e-3);
+    REQUIRE(fabs(vec.data()[1] - 0.5674) < 1e-3);
+    REQUIRE(fabs(vec.data()[768] - -0.2701) < 1e-3);
+    REQUIRE(fabs(vec.data()[768 + 1] - 0.2676) < 1e-3);
+  }
+  return true;
+}
+
+bool CheckCppBertWithPooler(bool use_cuda, bool only_input) {
+  BertModel model(kPretrainedModel,
+                  use_cuda ? DLDeviceType::kDLGPU : DLDeviceType::kDLCPU, 12,
+                  12);
+  std::vector<std::vector<int64_t>> position_ids{{1, 0, 0, 0}, {1, 1, 1, 0}};
+  std::vector<std::vector<int64_t>> segment_ids{{1, 1, 1, 0}, {1, 0, 0, 0}};
+  if (only_input) {
+    position_ids.clear();
+    segment_ids.clear();
+  }
+  auto vec = model({{12166, 10699, 16752, 4454}, {5342, 16471, 817, 16022}},
+                   position_ids, segment_ids, PoolType::kFirst,
+                   /*use_pooler*/ true);
+  REQUIRE(vec.size() == 768 * 2);
+  // Write a better UT
+  for (size_t i = 0; i < vec.size(); ++i) {
+    REQUIRE(!std::isnan(vec.data()[i]));
+    REQUIRE(!std::isinf(vec.data()[i]));
+  }
+  if (only_input) {
+    std::cerr << vec.data()[0] << std::endl;
+    REQUIRE(fabs(vec.data()[0] - 0.9671) < 1e-3);
+    REQUIRE(fabs(vec.data()[1] - 0.9860) < 1e-3);
+    REQUIRE(fabs(vec.data()[768] - 0.9757) < 1e-3);
+    REQUIRE(fabs(vec.data()[768 + 1] - 0.9794) < 1e-3);
+  } else {
+    REQUIRE(fabs(vec.data()[0] - 0.9151) < 1e-3);
+    REQUIRE(fabs(vec.data()[1] - 0.5919) < 1e-3);
+    REQUIRE(fabs(vec.data()[768] - 0.9802) < 1e-3);
+    REQUIRE(fabs(vec.data()[768 + 1] - 0.9321) < 1e-3);
+  }
+  return true;
+}
+
+TEST_CASE("Bert", "Cpp interface") {
+  if (!HasPretrainedModel()) {
+    return;
+  }
+  CheckCppBert(false /*use_cuda*/, true /* only_input*/);
+  CheckCppBert(false /*use_cuda*/, false /* only_input*/);
+  if (core::IsCompiledWithCUDA()) {
+    CheckCppBert(true /*use_cuda*/, true /* only_input*/);
+    CheckCppBert(true /*use_cuda*/, false /* only_input*/);
+  }
+}
+
+TEST_CASE("BertWithPooler", "Cpp interface") {
+  if (!HasPretrainedModel()) {
+    return;
+  }
+  CheckCppBertWithPooler(false /*use_cuda*/, false /* only_input*/);
+  CheckCppBertWithPooler(false /*use_cuda*/, true /* only_input*/);
+  if (core::IsCompiledWithCUDA()) {
+    CheckCppBertWithPooler(true /*use_cuda*/, false /* only_input*/);
+    CheckCppBertWithPooler(true /*use_cuda*/, true /* only_input*/);
+  }
+}
+
+TEST_CASE("Bert-cuda-graph", "Cpp interface") {
+  if (!core::IsCompiledWithCUDA()) {
+    return;
+  }
+  BertModel model(TestModelFile(), DLDeviceType::kDLGPU, kTestLayers,
+                  kTestHeads);
+  std::vector<std::vector<std::vector<int64_t>>> inputs{
+      {{12166, 10699, 16752, 4454}, {5342, 16471, 817, 16022}},
+      {{5342, 16471, 817, 16022}, {12166, 10699, 16752}},
+      {{12166, 10699}}};
+  std::vector<std::vector<float>> expected;
+  for (auto &input : inputs) {
+    expected.emplace_back(model(input, {}, {}, PoolType::kMean, true));
+  }
+  model.EnableCUDAGraph();
+  // The first call of each shape captures its graph, the second replays it.
+  for (int replay = 0; replay < 2; ++replay) {
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      auto vec = model(inputs[i], {}, {}, PoolType::kMean, true);
+      REQUIRE(vec.size() == expected[i].size());
+      for (size_t j = 0; j < vec.size(); ++j) {
+        REQUIRE(fabs(vec[j] - expected[i][j]) < 1e-4);
+      }
+    }
+  }
+}
+
+TEST_CASE("Bert-packed", "Cpp interface") {
+  std::vector<DLDeviceType> devices{DLDeviceType::kDLCPU};
+  if (core::IsCompiledWithCUDA()) {
+    devices.push_back(DLDeviceType::kDLGPU);
+  }
+  std::vector<std::vector<int64_t>> inputs{
+      {12166, 10699, 16752, 4454}, {5342, 16471, 817}, {12166}};
+  for (auto device : devices) {
+    BertModel model(TestModelFile(), device, kTestLayers, kTestHeads);
+    for (auto pooling : {PoolType::kFirst, PoolType::kMean}) {
+      // Each sequence alone has no padding to attend to.
+      std::vector<float> expected;
+      for (auto &input : inputs) {
+        auto vec = model({input}, {}, {}, pooling, true);
+        expected.insert(expected.end(), vec.begin(), vec.end());
+      }
+      model.EnablePacking();
+      auto vec = model(inputs, {}, {}, pooling, true);
+      model.EnablePacking(false);
+      REQUIRE(vec.size() == expected.size());
+      for (size_t i = 0; i < vec.size(); ++i) {
+        REQUIRE(fabs(vec[i] - expected[i]) < 1e-3);
+      }
+    }
+  }
+}
+
+TEST_CASE("Bert-length-bucketing", "Cpp interface") {
+  std::vector<DLDeviceType> devices{DLDeviceType::kDLCPU};
+  if (core::IsCompiledWithCUDA()) {
+    devices.push_back(DLDeviceType::kDLGPU);
+  }
+  std::vector<std::vector<int64_t>> inputs{{12166, 10699},
+                                           {12166, 10699, 16752, 4454},
+                                           {5342},
+                                           {5342, 16471, 817, 16022},
+                                           {5342, 16471}};
+  for (auto device : devices) {
+    BertModel model(TestModelFile(), device, kTestLayers, kTestHeads);
+    auto expected = model(inputs, {}, {}, PoolType::kFirst, true);
+    model.EnableLengthBucketing(true, 0.2f);
+    auto vec = model(inputs, {}, {}, PoolType::kFirst, true);
+    REQUIRE(vec.size() == expected.size());
+    for (size_t i = 0; i < vec.size(); ++i) {
+      REQUIRE(fabs(vec[i] - expected[i]) < 1e-4);
+    }
+  }
+}
+
+TEST_CASE("Bert-pooled-rows-only", "Cpp interface") {
+  std::vector<DLDeviceType> devices{DLDeviceType::kDLCPU};
+  if (core::IsCompiledWithCUDA()) {
+    devices.push_back(DLDeviceType::kDLGPU);
+  }
+  std::vector<std::vector<int64_t>> inputs{{12166, 10699, 16752, 4454},
+                                           {5342, 16471, 817},
+                                           {12166}};
+  for (auto device : devices) {
+    BertModel model(TestModelFile(), device, kTestLayers, kTestHeads);
+    for (auto pooling : {PoolType::kFirst, PoolType::kLast}) {
+      for (bool use_pooler : {false, true}) {
+        model.EnablePooledRowsOnly(false);
+        auto expected = model(inputs, {}, {}, pooling, use_pooler);
+        model.EnablePooledRowsOnly(true);
+        auto vec = model(inputs, {}, {}, pooling, use_pooler);
+        REQUIRE(vec.size() == expected.size());
+        for (size_t i = 0; i < vec.size(); ++i) {
+          REQUIRE(fabs(vec[i] - expected[i]) < 1e-4);
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("Bert-result-cache", "Cpp interface") {
+  std::vector<std::vector<int64_t>> inputs{{12166, 10699},
+                                           {5342, 16471, 817, 16022},
+                                           {12166, 10699},
+                                           {5342}};
+  BertModel model(TestModelFile(), DLDeviceType::kDLCPU, kTestLayers,
+                  kTestHeads);
+  auto expected = model(inputs, {}, {}, PoolType::kFirst, true);
+  model.EnableResultCache(16, 2);
+  for (int round = 0; round < 2; ++round) {
+    auto vec = model(inputs, {}, {}, PoolType::kFirst, true);
+    REQUIRE(vec.size() == expected.size());
+    for (size_t i = 0; i < vec.size(); ++i) {
+      REQUIRE(fabs(vec[i] - expected[i]) < 1e-4);
+    }
+  }
+  // The repeated sequence is computed once, and the second round hits.
+  auto stats = model.result_cache_stats();
+  REQUIRE(stats.misses == 4);
+  REQUIRE(stats.deduplicated == 1);
+  REQUIRE(stats.hits == 4);
+  REQUIRE(stats.entries == 3);
+}
+
+TEST_CASE("Bert-warm-up", "Cpp interface") {
+  std::vector<DLDeviceType> devices{DLDeviceType::kDLCPU};
+  if (core::IsCompiledWithCUDA()) {
+    devices.push_back(DLDeviceType::kDLGPU);
+  }
+  std::vector<std::vector<int64_t>> inputs{{12166, 10699, 16752, 4454},
+                                           {5342, 16471}};
+  for (auto device : devices) {
+    BertModel reference(TestModelFile(), device, kTestLayers, kTestHeads);
+    auto expected = reference(inputs, {}, {}, PoolType::kFirst, true);
+
+    BertModel model(TestModelFile(), device, kTestLayers, kTestHeads);
+    model.EnableResultCache(16);
+    model.Reserve(4, 8);
+    model.WarmUp({{1, 4}, {2, 4}}, PoolType::kFirst, true);
+    // The dummy batches are not cached.
+    REQUIRE(model.result_cache_stats().entries == 0);
+    REQUIRE(model.workspace_bytes() > 0);
+    auto vec = model(inputs, {}, {}, PoolType::kFirst, true);
+    REQUIRE(vec.size() == expected.size());
+    for (size_t i = 0; i < vec.size(); ++i) {
+      REQUIRE(fabs(vec[i] - expected[i]) < 1e-4);
+    }
+    REQUIRE_THROWS(model.WarmUp({{0, 4}}));
+  }
+}
+
+TEST_CASE("Bert-batch-splitting", "Cpp interface") {
+  std::vector<std::vector<int64_t>> inputs{{12166, 10699, 16752, 4454},
+                                           {5342, 16471, 817, 16022},
+                                           {12166, 10699, 16752},
+                                           {5342, 16471}};
+  BertModel model(TestModelFile(), DLDeviceType::kDLCPU, kTestLayers,
+                  kTestHeads);
+  auto expected = model(inputs, {}, {}, PoolType::kFirst, true);
+  // The budget of the activations of two sequences.
+  model.PlanMemory(2, 4);
+  model.EnableBatchSplitting(true, model.workspace_bytes());
+  auto splits = core::GetMetrics().predicted_batch_splits;
+  auto vec = model(inputs, {}, {}, PoolType::kFirst, true);
+  REQUIRE(core::GetMetrics().predicted_batch_splits == splits + 1);
+  REQUIRE(vec.size() == expected.size());
+  for (size_t i = 0; i < vec.size(); ++i) {
+    REQUIRE(fabs(vec[i] - expected[i]) < 1e-4);
+  }
+}
+
+TEST_CASE("Bert-run-batches", "Cpp interface") {
+  std::vector<DLDeviceType> devices{DLDeviceType::kDLCPU};
+  if (core::IsCompiledWithCUDA()) {
+    devices.push_back(DLDeviceType::kDLGPU);
+  }
+  std::vector<BertModel::Batch> batches{
+      {{{12166, 10699, 16752, 4454}, {5342, 16471, 817}}, {}, {}},
+      {{{5342, 16471, 817, 16022}}, {{1, 0, 0, 0}}, {{1, 1, 1, 0}}},
+      {{{12166, 10699}, {5342}, {16471, 817}}, {}, {}}};
+  for (auto device : devices) {
+    BertModel model(TestModelFile(), device, kTestLayers, kTestHeads);
+    auto results = model.RunBatches(batches, PoolType::kFirst, true);
+    REQUIRE(results.size() == batches.size());
+    for (size_t b = 0; b < batches.size(); ++b) {
+      auto expected = model(batches[b].input_ids, batches[b].position_ids,
+                            batches[b].segment_ids, PoolType::kFirst, true);
+      REQUIRE(results[b].size() == expected.size());
+      for (size_t i = 0; i < expected.size(); ++i) {
+        REQUIRE(fabs(results[b][i] - expected[i]) < 1e-4);
+      }
+    }
+  }
+}
+
+TEST_CASE("Bert-async", "Cpp interface") {
+  std::vector<DLDeviceType> devices{DLDeviceType::kDLCPU};
+  if (core::IsCompiledWithCUDA()) {
+    devices.push_back(DLDeviceType::kDLGPU);
+  }
+  BertModel::Batch batch{
+      {{12166, 10699, 16752, 4454}, {5342, 16471, 817}}, {}, {}};
+  for (auto device : devices) {
+    BertModel model(TestModelFile(), device, kTestLayers, kTestHeads);
+    auto expected = model(batch.input_ids, {}, {}, PoolType::kFirst, true);
+    auto future = model.Submit(batch, PoolType::kFirst, true);
+    // The callback runs before the future is ready.
+    std::vector<float> output(expected.size());
+    bool called = false;
+    auto in_place = model.Submit(
+        batch, PoolType::kFirst, true, output.data(), kDLCPU,
+        [&](const BertModel::AsyncResult &result) {
+          called = result.error == nullptr && result.output.empty();
+        });
+    auto result = future.get();
+    REQUIRE(result.prepare_ms >= 0);
+    REQUIRE(result.compute_ms >= 0);
+    in_place.get();
+    REQUIRE(called);
+    REQUIRE(result.output.size() == expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      REQUIRE(fabs(result.output[i] - expected[i]) < 1e-4);
+      REQUIRE(fabs(output[i] - expected[i]) < 1e-4);
+    }
+    REQUIRE_THROWS(model.Submit(BertModel::Batch()).get());
+  }
+}
+
+TEST_CASE("Bert-async-priority", "Cpp interface") {
+  std::vector<DLDeviceType> devices{DLDeviceType::kDLCPU};
+  if (core::IsCompiledWithCUDA()) {
+    devices.push_back(DLDeviceType::kDLGPU);
+  }
+  BertModel::Batch offline{{{12166, 10699, 16752, 4454, 5342, 16471, 817},
+                            {5342, 16471, 817, 16022},
+                            {12166, 10699}},
+                           {},
+                           {}};
+  BertModel::Batch online{{{5342, 16471, 817}}, {}, {}};
+  for (auto device : devices) {
+    BertModel model(TestModelFile(), device, kTestLayers, kTestHeads);
+    auto expected_offline =
+        model(offline.input_ids, {}, {}, PoolType::kFirst, true);
+    auto expected_online =
+        model(online.input_ids, {}, {}, PoolType::kFirst, true);
+    model.EnablePreemption(true, 0);
+    auto preempting = core::GetMetrics().preempting_batches;
+    // The online batch either runs first or between two offline layers.
+    std::vector<BertModel::Priority> finished;
+    auto record = [&](BertModel::Priority priority) {
+      return [&finished, priority](const BertModel::AsyncResult &) {
+        finished.push_back(priority);
+      };
+    };
+    auto low = model.Submit(offline, PoolType::kFirst, true, nullptr, kDLCPU,
+                            record(BertModel::Priority::kLow),
+                            BertModel::Priority::kLow);
+    auto high = model.Submit(online, PoolType::kFirst, true, nullptr, kDLCPU,
+                             record(BertModel::Priority::kHigh),
+                             BertModel::Priority::kHigh);
+    auto low_result = low.get();
+    auto high_result = high.get();
+    REQUIRE(finished.size() == 2);
+    REQUIRE(finished[0] == BertModel::Priority::kHigh);
+    REQUIRE(core::GetMetrics().preempting_batches >= preempting);
+    REQUIRE(low_result.output.size() == expected_offline.size());
+    for (size_t i = 0; i < expected_offline.size(); ++i) {
+      REQUIRE(fabs(low_result.output[i] - expected_offline[i]) < 1e-4);
+    }
+    REQUIRE(high_result.output.size() == expected_online.size());
+    for (size_t i = 0; i < expected_online.size(); ++i) {
+      REQUIRE(fabs(high_result.output[i] - expected_online[i]) < 1e-4);
+    }
+    REQUIRE_THROWS(model.EnablePreemption(true, -1));
+  }
+}
+
+TEST_CASE("Bert-pipeline", "Cpp interface") {
+  if (!core::IsCompiledWithCUDA()) {
+    return;
+  }
+  std::vector<std::vector<int64_t>> inputs{{12166, 10699, 16752, 4454},
+                                           {5342, 16471, 817},
+                                           {12166, 10699},
+                                           {5342, 16471, 817, 16022},
+                                           {5342}};
+  BertModel model(TestModelFile(), DLDeviceType::kDLGPU, kTestLayers,
+                  kTestHeads);
+  auto expected = model(inputs, {}, {}, PoolType::kFirst, true);
+  // Both stages share a GPU, which runs the same code as distinct GPUs.
+  BertModel pipeline(TestModelFile(), {0, 0}, kTestLayers, kTestHeads, 2);
+  auto vec = pipeline(inputs, {}, {}, PoolType::kFirst, true);
+  REQUIRE(vec.size() == expected.size());
+  for (size_t i = 0; i < vec.size(); ++i) {
+    REQUIRE(fabs(vec[i] - expected[i]) < 1e-4);
+  }
+  REQUIRE_THROWS(pipeline.EnablePacking());
+}
+
+TEST_CASE("Bert-tensor-parallel", "Cpp interface") {
+  if (!core::IsCompiledWithCUDA()) {
+    return;
+  }
+  std::vector<std::vector<int64_t>> inputs{{12166, 10699, 16752, 4454},
+                                           {5342, 16471, 817},
+                                           {5342}};
+  BertModel model(TestModelFile(), DLDeviceType::kDLGPU, kTestLayers,
+                  kTestHeads);
+  auto expected = model(inputs, {}, {}, PoolType::kFirst, true);
+  // The shards share a GPU, which runs the same copies and reductions as
+  // distinct GPUs.
+  for (std::vector<int> devices : {std::vector<int>{0},
+                                   std::vector<int>{0, 0},
+                                   std::vector<int>{0, 0, 0, 0}}) {
+    BertModel sharded(TestModelFile(), devices, kTestLayers, kTestHeads,
+                      BertModel::TensorParallel());
+    auto vec = sharded(inputs, {}, {}, PoolType::kFirst, true);
+    REQUIRE(vec.size() == expected.size());
+    for (size_t i = 0; i < vec.size(); ++i) {
+      REQUIRE(fabs(vec[i] - expected[i]) < 1e-4);
+    }
+    REQUIRE_THROWS(sharded.EnablePacking());
+    REQUIRE_THROWS(sharded.PlanMemory(4, 16));
+  }
+  // 4 heads do not split into 3 shards.
+  REQUIRE_THROWS(BertModel(TestModelFile(), {0, 0, 0}, kTestLayers,
+                           kTestHeads, BertModel::TensorParallel()));
+}
+
+TEST_CASE("Bert-albert", "Cpp interface") {
+  std::vector<DLDeviceType> devices{DLDeviceType::kDLCPU};
+  if (core::IsCompiledWithCUDA()) {
+    devices.push_back(DLDeviceType::kDLGPU);
+  }
+  std::vector<std::vector<int64_t>> inputs{{12166, 10699, 16752, 4454},
+                                           {5342, 16471, 817}};
+  for (auto device : devices) {
+    BertModel albert(TestAlbertModelFile(), device, kTestLayers, kTestHeads);
+    BertModel bert(TestAlbertAsBertModelFile(), device, kTestLayers,
+                   kTestHeads);
+    // The layers of the ALBERT share the one loaded.
+    REQUIRE(albert.num_distinct_layers() == 1);
+    REQUIRE(bert.num_distinct_layers() == kTestLayers);
+    REQUIRE(albert.weight_bytes() < bert.weight_bytes());
+    for (bool use_pooler : {false, true}) {
+      auto vec = albert(inputs, {}, {}, PoolType::kFirst, use_pooler);
+      auto expected = bert(inputs, {}, {}, PoolType::kFirst, use_pooler);
+      REQUIRE(vec.size() == expected.size());
+      for (size_t i = 0; i < vec.size(); ++i) {
+        REQUIRE(fabs(vec[i] - expected[i]) < 1e-4);
+      }
+    }
+  }
+}
+
+TEST_CASE("Bert-num-threads", "Cpp interface") {
+  BertModel model(TestModelFile(), DLDeviceType::kDLCPU, kTestLayers,
+                  kTestHeads);
+  std::vector<std::vector<int64_t>> inputs{{12166, 10699, 16752, 4454},
+                                           {5342, 16471, 817}};
+  auto expected = model(inputs, {}, {}, PoolType::kFirst, true);
+  int n_th = core::GetLocalNumThreads();
+  model.SetNumThreads(1);
+  auto vec = model(inputs, {}, {}, PoolType::kFirst, true);
+  // The thread count of the caller is restored after the call.
+  REQUIRE(core::GetLocalNumThreads() == n_th);
+  REQUIRE(vec.size() == expected.size());
+  for (size_t i = 0; i < vec.size(); ++i) {
+    REQUIRE(fabs(vec[i] - expected[i]) < 1e-4);
+  }
+  REQUIRE_THROWS(model.SetNumThreads(-1));
+}
+
+TEST_CASE("Bert-early-exit", "Cpp interface") {
+  BertModel model(TestModelFile(), DLDeviceType::kDLCPU, kTestLayers,
+                  kTestHeads);
+  std::vector<std::vector<int64_t>> inputs{{12166, 10699, 16752, 4454},
+                                           {5342, 16471, 817}};
+  REQUIRE_THROWS(model.Classify(inputs, {}, {}, 0.5f));
+  // The plain BERT model has no classifier to exit at.
+  REQUIRE_THROWS(model.LoadExitHeads(TestModelFile()));
+}
+
+TEST_CASE("Bert-task-heads", "Cpp interface") {
+  std::vector<DLDeviceType> devices{DLDeviceType::kDLCPU};
+  if (core::IsCompiledWithCUDA()) {
+    devices.push_back(DLDeviceType::kDLGPU);
+  }
+  // Two sequence heads on the pooler of the model and a token head.
+  auto npz = cnpy::npz_load(TestModelFile());
+  auto &pooler_weight = npz["pooler.dense.weight"];
+  auto &pooler_bias = npz["pooler.dense.bias"];
+  size_t hidden_size = pooler_weight.shape[0];
+  std::string filename = "task_heads_test.npz";
+  std::vector<std::pair<std::string, size_t>> classifiers{
+      {"intent", 3}, {"topic", 2}, {"ner", 5}};
+  std::vector<std::vector<float>> weights, biases;
+  for (auto &classifier : classifiers) {
+    auto &name = classifier.first;
+    auto n_labels = classifier.second;
+    weights.emplace_back(hidden_size * n_labels);
+    biases.emplace_back(n_labels);
+    for (size_t i = 0; i < weights.back().size(); ++i) {
+      weights.back()[i] = std::sin(i + n_labels) * 0.1f;
+    }
+    for (size_t i = 0; i < n_labels; ++i) {
+      biases.back()[i] = 0.01f * i;
+    }
+    cnpy::npz_save(filename, name + ".classifier.weight",
+                   weights.back().data(), {hidden_size, n_labels},
+                   weights.size() == 1 ? "w" : "a");
+    cnpy::npz_save(filename, name + ".classifier.bias", biases.back().data(),
+                   {n_labels}, "a");
+    if (name != "ner") {
+      cnpy::npz_save(filename, name + ".pooler.dense.weight",
+                     pooler_weight.data<float>(), pooler_weight.shape, "a");
+      cnpy::npz_save(filename, name + ".pooler.dense.bias",
+                     pooler_bias.data<float>(), pooler_bias.shape, "a");
+    }
+  }
+
+  std::vector<std::vector<int64_t>> inputs{{12166, 10699, 16752, 4454},
+                                           {5342, 16471, 817}};
+  int64_t seq_len = 4;
+  for (auto device : devices) {
+    BertModel model(TestModelFile(), device, kTestLayers, kTestHeads);
+    REQUIRE_THROWS(model.RunTasks(inputs, {}, {}));
+    REQUIRE_THROWS(model.LoadTaskHeads(filename, {{"sentiment", false}}));
+    model.LoadTaskHeads(filename,
+                        {{"intent", false}, {"topic", false}, {"ner", true}});
+    auto outputs = model.RunTasks(inputs, {}, {});
+    REQUIRE(outputs.size() == classifiers.size());
+    auto pooled = model(inputs, {}, {}, PoolType::kFirst, true);
+    auto cls = model(inputs, {}, {}, PoolType::kFirst, false);
+    for (size_t h = 0; h < classifiers.size(); ++h) {
+      bool per_token = classifiers[h].first == "ner";
+      size_t n_labels = classifiers[h].second;
+      auto &rows = per_token ? cls : pooled;
+      REQUIRE(outputs[h].size() ==
+              inputs.size() * n_labels * (per_token ? seq_len : 1));
+      for (size_t b = 0; b < inputs.size(); ++b) {
+        // The token head is checked on the [CLS] rows.
+        size_t row = per_token ? b * seq_len : b;
+        for (size_t j = 0; j < n_labels; ++j) {
+          float expected = biases[h][j];
+          for (size_t k = 0; k < hidden_size; ++k) {
+            expected +=
+                rows[b * hidden_size + k] * weights[h][k * n_labels + j];
+          }
+          REQUIRE(fabs(outputs[h][row * n_labels + j] - expected) < 1e-3);
+        }
+      }
+    }
+  }
+  std::remove(filename.c_str());
+}
+
+TEST_CASE("Bert-document", "Cpp interface") {
+  BertModel model(TestModelFile(), DLDeviceType::kDLCPU, kTestLayers,
+                  kTestHeads);
+  std::vector<int64_t> ids{12166, 10699, 16752, 4454, 5342,
+                           16471, 817,   16022, 2003,  1037};
+  BertModel::WindowOptions options;
+  options.window_len = 6;
+  options.stride = 2;
+  options.cls_id = 101;
+  options.sep_id = 102;
+  // The windows [0, 4), [2, 6), [4, 8) and [6, 10) of the ids.
+  std::vector<std::vector<int64_t>> windows;
+  for (size_t begin = 0; begin + 4 <= ids.size(); begin += 2) {
+    std::vector<int64_t> window{101};
+    window.insert(window.end(), ids.begin() + begin, ids.begin() + begin + 4);
+    window.push_back(102);
+    windows.push_back(window);
+  }
+  auto pooled = model(windows, {}, {}, PoolType::kFirst, false);
+  auto vec = model.RunDocument(ids, options);
+  size_t hidden_size = vec.size();
+  REQUIRE(pooled.size() == windows.size() * hidden_size);
+  for (size_t h = 0; h < hidden_size; ++h) {
+    float mean = 0;
+    for (size_t w = 0; w < windows.size(); ++w) {
+      mean += pooled[w * hidden_size + h] / windows.size();
+    }
+    REQUIRE(fabs(vec[h] - mean) < 1e-4);
+  }
+
+  // A window of the whole document is its outputs, whose mean is the kMean
+  // pooling.
+  options.cls_id = options.sep_id = -1;
+  options.window_len = ids.size();
+  options.token_outputs = true;
+  auto tokens = model.RunDocument(ids, options);
+  REQUIRE(tokens.size() == ids.size() * hidden_size);
+  auto mean = model({ids}, {}, {}, PoolType::kMean, false);
+  for (size_t h = 0; h < hidden_size; ++h) {
+    float sum = 0;
+    for (size_t t = 0; t < ids.size(); ++t) {
+      sum += tokens[t * hidden_size + h];
+    }
+    REQUIRE(fabs(sum / ids.size() - mean[h]) < 1e-4);
+  }
+  // The first tokens are covered by the first window only.
+  options.window_len = 4;
+  auto first = model.RunDocument({ids.begin(), ids.begin() + 4}, options);
+  options.merge = PoolType::kMax;
+  tokens = model.RunDocument(ids, options);
+  REQUIRE(tokens.size() == ids.size() * hidden_size);
+  for (size_t i = 0; i < 2 * hidden_size; ++i) {
+    REQUIRE(fabs(tokens[i] - first[i]) < 1e-4);
+  }
+  options.merge = PoolType::kFirst;
+  REQUIRE_THROWS(model.RunDocument(ids, options));
+}
+
+TEST_CASE("Bert-run-texts", "Cpp interface") {
+  auto filename = WriteTestVocab();
+  WordPieceTokenizer tokenizer(filename);
+  std::remove(filename.c_str());
+  BertModel model(TestModelFile(), DLDeviceType::kDLCPU, kTestLayers,
+                  kTestHeads);
+  for (std::vector<std::string> texts :
+       {std::vector<std::string>{"Hello, world!", "unaffable cafe", "turbo"},
+        std::vector<std::string>{"hello world", "turbo cafe"}}) {
+    std::vector<std::vector<int64_t>> inputs;
+    for (auto &text : texts) {
+      inputs.push_back(tokenizer.Encode(text, 6));
+    }
+    for (bool packing : {false, true}) {
+      model.EnablePacking(packing);
+      auto expected = model(inputs, {}, {}, PoolType::kFirst, true);
+      auto vec = model.RunTexts(tokenizer, texts, 6, PoolType::kFirst, true);
+      REQUIRE(vec.size() == expected.size());
+      for (size_t i = 0; i < vec.size(); ++i) {
+        REQUIRE(fabs(vec[i] - expected[i]) < 1e-4);
+      }
+    }
+  }
+}
+
+static std::vector<float> CallBackFunction(
+    const std::shared_ptr<BertModel> model,
+    const std::vector<std::vector<int64_t>> input_ids,
+    const std::vector<std::vector<int64_t>> position_ids,
+    const std::vector<std::vector<int64_t>> segment_ids, PoolType pooltype,
+    bool use_pooler) {
+  return model->operator()(input_ids, position_ids, segment_ids, pooltype,
+                           use_pooler);
+}
+
+static bool test_multiple_threads(bool only_input, int n_threads) {
+  std::shared_ptr<BertModel> model_ptr = std::make_shared<BertModel>(
+      kPretrainedModel, DLDeviceType::kDLCPU, 12, 12);
+  std::vector<std::vector<int64_t>> input_ids{{12166, 10699, 16752, 4454},
+                                              {5342, 16471, 817, 16022}};
+  std::vector<std::vector<int64_t>> position_ids{{1, 0, 0, 0}, {1, 1, 1, 0}};
+  std::vector<std::vector<int64_t>> segment_ids{{1, 1, 1, 0}, {1, 0, 0, 0}};
+  if (only_input) {
+    position_ids.clear();
+    segment_ids.clear();
+  }
+  std::vector<std::thread> threads;
+  threads.reserve(n_threads);
+
+  std::vector<std::future<std::vector<float>>> result_list;
+  result_list.reserve(n_threads);
+  for (int i = 0; i < n_threads; ++i) {
+    std::packaged_task<std::vector<float>(
+        const std::shared_ptr<BertModel>,
+        const std::vector<std::vector<int64_t>> &,
+        const std::vector<std::vector<int64_t>> &,
+        const std::vector<std::vector<int64_t>> &, PoolType, bool)>
+        task(CallBackFunction);
+    result_list.emplace_back(task.get_future());
+    threads.emplace_back(std::thread(std::move(task), model_ptr, input_ids,
+                                     position_ids, segment_ids,
+                                     PoolType::kFirst, true));
+  }
+
+  for (int i = 0; i < n_threads; ++i) {
+    auto vec = result_list[i].get();
+    assert(vec.size() == 768 * 2);
+
+    for (size_t i = 0; i < vec.size(); ++i) {
+      assert(!std::isnan(vec.data()[i]));
+      assert(!std::isinf(vec.data()[i]));
+    }
+    if (only_input) {
+      assert(fabs(vec.data()[0] - 0.9671) < 1e-3);
+      assert(fabs(vec.data()[1] - 0.9860) < 1e-3);
+      assert(fabs(vec.data()[768] - 0.9757) < 1e-3);
+      assert(fabs(vec.data()[768 + 1] - 0.9794) < 1e-3);
+    } else {
+      assert(fabs(vec.data()[0] - 0.9151) < 1e-3);
+      assert(fabs(vec.data()[1] - 0.5919) < 1e-3);
+      assert(fabs(vec.data()[768] - 0.9802) < 1e-3);
+      assert(fabs(vec.data()[768 + 1] - 0.9321) < 1e-3);
+    }
+  }
+
+  for (int i = 0; i < n_threads; ++i) {
+    threads[i].join();
+  }
+  return true;
+}
+TEST_CASE("Bert-multiple-thread", "Cpp interface") {
+  if (!HasPretrainedModel()) {
+    return;
+  }
+  test_multiple_threads(false, 10);
+  test_multiple_threads(true, 10);
+}
+
+}  // namespace serving
+}  // namespace turbo_transformers
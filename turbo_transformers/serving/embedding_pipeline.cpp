@@ -0,0 +1,440 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/serving/embedding_pipeline.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <utility>
+
+#include "turbo_transformers/core/enforce.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+namespace {
+constexpr char kTokenIdMagic[8] = {'T', 'T', 'T', 'O', 'K', 'I', 'D', 'S'};
+constexpr char kEmbeddingMagic[8] = {'T', 'T', 'E', 'M', 'B', 'E', 'D', 'S'};
+constexpr uint32_t kVersion = 1;
+// The magic, the version, the padding or the hidden size, and the number of
+// sequences.
+constexpr size_t kHeaderSize = 8 + 4 + 4 + 8;
+
+template <typename T>
+void Write(std::ofstream &out, T value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+T Read(std::ifstream &in) {
+  T value;
+  in.read(reinterpret_cast<char *>(&value), sizeof(T));
+  return value;
+}
+
+void WriteAt(int fd, const void *data, size_t bytes, uint64_t offset,
+             const std::string &filename) {
+  auto *ptr = static_cast<const char *>(data);
+  while (bytes > 0) {
+    auto written = pwrite(fd, ptr, bytes, offset);
+    TT_ENFORCE(written > 0, "Can not write to %s: %s", filename,
+               std::strerror(errno));
+    ptr += written;
+    bytes -= written;
+    offset += written;
+  }
+}
+
+// A queue between two stages. Push blocks while the queue is full, Pop while
+// it is empty and open.
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+  // False if the queue is closed.
+  bool Push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock,
+                   [&] { return closed_ || items_.size() < capacity_; });
+    if (closed_) {
+      return false;
+    }
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  // False once the queue is closed and empty.
+  bool Pop(T *item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [&] { return closed_ || !items_.empty(); });
+    return PopLocked(item);
+  }
+
+  // False if the queue is empty.
+  bool TryPop(T *item) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return PopLocked(item);
+  }
+
+  // No more items are pushed, the ones queued are still popped, unless
+  // `discard`.
+  void Close(bool discard = false) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    if (discard) {
+      items_.clear();
+    }
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+ private:
+  bool PopLocked(T *item) {
+    if (items_.empty()) {
+      return false;
+    }
+    *item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  size_t capacity_;
+  std::mutex mutex_;
+  std::condition_variable not_full_, not_empty_;
+  std::deque<T> items_;
+  bool closed_{false};
+};
+
+// The sequences [begin, begin + ids.size()) of the input.
+struct Window {
+  size_t begin{0};
+  std::vector<std::vector<int64_t>> ids;
+};
+
+// A batch and the rows of its sequences in the input.
+struct WorkItem {
+  std::vector<size_t> rows;
+  BertModel::Batch batch;
+};
+
+struct Result {
+  std::vector<size_t> rows;
+  std::vector<float> output;
+};
+}  // namespace
+
+TokenIdFile::TokenIdFile(const std::string &filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  TT_ENFORCE_NE(fd, -1, "Can not open the token id file %s", filename);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    TT_THROW("Can not stat the token id file %s", filename);
+  }
+  bytes_ = st.st_size;
+  data_ = bytes_ < kHeaderSize
+              ? MAP_FAILED
+              : mmap(nullptr, bytes_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  TT_ENFORCE(data_ != MAP_FAILED, "%s is no token id file", filename);
+  // The reader walks the sequences in order.
+  madvise(data_, bytes_, MADV_SEQUENTIAL);
+  try {
+    auto *bytes = static_cast<const char *>(data_);
+    uint32_t version;
+    uint64_t size;
+    std::memcpy(&version, bytes + 8, sizeof(version));
+    std::memcpy(&size, bytes + 16, sizeof(size));
+    TT_ENFORCE(std::memcmp(bytes, kTokenIdMagic, sizeof(kTokenIdMagic)) == 0,
+               "%s is no token id file", filename);
+    TT_ENFORCE_EQ(version, kVersion,
+                  "The token id file %s has the unsupported version %d",
+                  filename, version);
+    TT_ENFORCE((bytes_ - kHeaderSize) / sizeof(int64_t) > size,
+               "The token id file %s is truncated", filename);
+    size_ = size;
+    offsets_ = reinterpret_cast<const int64_t *>(bytes + kHeaderSize);
+    auto ids_offset = kHeaderSize + (size_ + 1) * sizeof(int64_t);
+    ids_ = reinterpret_cast<const int32_t *>(bytes + ids_offset);
+    for (size_t i = 0; i < size_; ++i) {
+      TT_ENFORCE(offsets_[i] <= offsets_[i + 1],
+                 "The offsets of the token id file %s are corrupted",
+                 filename);
+    }
+    TT_ENFORCE(offsets_[0] == 0 &&
+                   static_cast<uint64_t>(offsets_[size_]) <=
+                       (bytes_ - ids_offset) / sizeof(int32_t),
+               "The token id file %s is truncated", filename);
+  } catch (...) {
+    munmap(data_, bytes_);
+    throw;
+  }
+}
+
+TokenIdFile::~TokenIdFile() { munmap(data_, bytes_); }
+
+void SaveTokenIdFile(const std::string &filename,
+                     const std::vector<std::vector<int64_t>> &sequences) {
+  std::ofstream out(filename, std::ios::binary);
+  TT_ENFORCE(out.good(), "Can not create the token id file %s", filename);
+  out.write(kTokenIdMagic, sizeof(kTokenIdMagic));
+  Write<uint32_t>(out, kVersion);
+  Write<uint32_t>(out, 0);
+  Write<uint64_t>(out, sequences.size());
+  int64_t offset = 0;
+  Write<int64_t>(out, offset);
+  for (auto &ids : sequences) {
+    offset += ids.size();
+    Write<int64_t>(out, offset);
+  }
+  for (auto &ids : sequences) {
+    for (auto id : ids) {
+      TT_ENFORCE(id >= 0 && id <= std::numeric_limits<int32_t>::max(),
+                 "The id %d does not fit in the token id file", id);
+      Write<int32_t>(out, static_cast<int32_t>(id));
+    }
+  }
+  TT_ENFORCE(out.good(), "Can not write the token id file %s", filename);
+}
+
+std::vector<float> LoadEmbeddingFile(const std::string &filename,
+                                     int64_t *hidden_size) {
+  std::ifstream in(filename, std::ios::binary);
+  char magic[sizeof(kEmbeddingMagic)];
+  in.read(magic, sizeof(magic));
+  TT_ENFORCE(in.good() && std::memcmp(magic, kEmbeddingMagic,
+                                      sizeof(kEmbeddingMagic)) == 0,
+             "%s is no embedding file", filename);
+  auto version = Read<uint32_t>(in);
+  TT_ENFORCE_EQ(version, kVersion,
+                "The embedding file %s has the unsupported version %d",
+                filename, version);
+  *hidden_size = Read<uint32_t>(in);
+  auto size = Read<uint64_t>(in);
+  std::vector<float> embeddings(size * *hidden_size);
+  in.read(reinterpret_cast<char *>(embeddings.data()),
+          embeddings.size() * sizeof(float));
+  TT_ENFORCE(in.good(), "The embedding file %s is truncated", filename);
+  return embeddings;
+}
+
+EmbeddingPipeline::EmbeddingPipeline(
+    std::vector<std::shared_ptr<BertModel>> models, Options options)
+    : models_(std::move(models)), options_(std::move(options)) {
+  TT_ENFORCE(!models_.empty(), "The pipeline needs a model");
+  TT_ENFORCE(options_.max_batch_size > 0 && options_.sort_window > 0 &&
+                 options_.batches_per_call > 0 && options_.queue_capacity > 0,
+             "The sizes of the batches, windows and queues should be "
+             "positive");
+}
+
+EmbeddingPipeline::Stats EmbeddingPipeline::Run(
+    const std::string &input_file, const std::string &output_file) const {
+  auto start = std::chrono::steady_clock::now();
+  TokenIdFile input(input_file);
+  int fd = open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  TT_ENFORCE_NE(fd, -1, "Can not create the embedding file %s", output_file);
+
+  BoundedQueue<Window> windows(options_.queue_capacity);
+  BoundedQueue<WorkItem> batches(options_.queue_capacity);
+  BoundedQueue<Result> results(options_.queue_capacity);
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  // Keeps the first error and stops every stage.
+  auto fail = [&](std::exception_ptr e) {
+    {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error) {
+        error = e;
+      }
+    }
+    windows.Close(true);
+    batches.Close(true);
+    results.Close(true);
+  };
+  Stats stats;
+  stats.sequences = input.size();
+
+  std::vector<std::thread> threads;
+  threads.emplace_back([&] {
+    try {
+      for (size_t begin = 0; begin < input.size();
+           begin += options_.sort_window) {
+        Window window;
+        window.begin = begin;
+        auto end = std::min(input.size(), begin + options_.sort_window);
+        for (size_t i = begin; i < end; ++i) {
+          TT_ENFORCE_GT(input.length(i), 0, "The sequence %d of %s is empty",
+                        i, input_file);
+          auto *ids = input.ids(i);
+          window.ids.emplace_back(
+              ids, ids + std::min(input.length(i), options_.max_seq_len));
+        }
+        if (!windows.Push(std::move(window))) {
+          return;
+        }
+      }
+      windows.Close();
+    } catch (...) {
+      fail(std::current_exception());
+    }
+  });
+
+  threads.emplace_back([&] {
+    try {
+      Window window;
+      while (windows.Pop(&window)) {
+        std::vector<size_t> order(window.ids.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+          return window.ids[a].size() < window.ids[b].size();
+        });
+        WorkItem item;
+        int64_t seq_len = 0;
+        auto flush = [&] {
+          stats.batches += 1;
+          stats.padded_tokens += seq_len * item.rows.size();
+          return batches.Push(std::move(item));
+        };
+        for (auto i : order) {
+          // The sequences are ascending, the last one sets the padding.
+          int64_t len = window.ids[i].size();
+          int64_t n = item.rows.size();
+          if (n > 0 && (n == static_cast<int64_t>(options_.max_batch_size) ||
+                        (n + 1) * len > options_.max_batch_tokens)) {
+            if (!flush()) {
+              return;
+            }
+            item = WorkItem();
+          }
+          stats.tokens += len;
+          seq_len = len;
+          item.rows.push_back(window.begin + i);
+          item.batch.input_ids.push_back(std::move(window.ids[i]));
+        }
+        if (!item.rows.empty() && !flush()) {
+          return;
+        }
+      }
+      batches.Close();
+    } catch (...) {
+      fail(std::current_exception());
+    }
+  });
+
+  std::atomic<size_t> running_models(models_.size());
+  for (auto &model : models_) {
+    threads.emplace_back([&, model] {
+      try {
+        WorkItem item;
+        while (batches.Pop(&item)) {
+          std::vector<WorkItem> items;
+          items.push_back(std::move(item));
+          while (items.size() < options_.batches_per_call &&
+                 batches.TryPop(&item)) {
+            items.push_back(std::move(item));
+          }
+          std::vector<BertModel::Batch> inputs;
+          for (auto &it : items) {
+            inputs.push_back(std::move(it.batch));
+          }
+          auto outputs = model->RunBatches(inputs, options_.pooling,
+                                           options_.use_pooler);
+          for (size_t i = 0; i < items.size(); ++i) {
+            if (!results.Push({std::move(items[i].rows),
+                               std::move(outputs[i])})) {
+              return;
+            }
+          }
+        }
+        if (--running_models == 0) {
+          results.Close();
+        }
+      } catch (...) {
+        fail(std::current_exception());
+      }
+    });
+  }
+
+  threads.emplace_back([&] {
+    try {
+      int64_t hidden_size = -1;
+      auto write_header = [&] {
+        char header[kHeaderSize];
+        std::memcpy(header, kEmbeddingMagic, sizeof(kEmbeddingMagic));
+        uint32_t version = kVersion;
+        uint32_t hidden = std::max<int64_t>(hidden_size, 0);
+        uint64_t size = input.size();
+        std::memcpy(header + 8, &version, sizeof(version));
+        std::memcpy(header + 12, &hidden, sizeof(hidden));
+        std::memcpy(header + 16, &size, sizeof(size));
+        WriteAt(fd, header, kHeaderSize, 0, output_file);
+      };
+      Result result;
+      while (results.Pop(&result)) {
+        if (hidden_size < 0) {
+          hidden_size = result.output.size() / result.rows.size();
+          write_header();
+        }
+        TT_ENFORCE_EQ(result.output.size(), result.rows.size() * hidden_size,
+                      "The outputs of a batch should be [batch_size, %d]",
+                      hidden_size);
+        for (size_t i = 0; i < result.rows.size(); ++i) {
+          WriteAt(fd, result.output.data() + i * hidden_size,
+                  hidden_size * sizeof(float),
+                  kHeaderSize + result.rows[i] * hidden_size * sizeof(float),
+                  output_file);
+        }
+      }
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (hidden_size < 0 && !error) {
+        write_header();
+      }
+    } catch (...) {
+      fail(std::current_exception());
+    }
+  });
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  close(fd);
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  return stats;
+}
+
+}  // namespace serving
+}  // namespace turbo_transformers
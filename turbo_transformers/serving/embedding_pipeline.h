@@ -0,0 +1,110 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "turbo_transformers/serving/bert_model.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+// A file of pre-tokenized sequences, mapped into memory instead of being
+// read. It starts with the magic "TTTOKIDS", the uint32 version, 4 bytes of
+// padding and the uint64 number of sequences n, followed by the int64
+// offsets [n + 1] of the sequences in the ids, then by the int32 ids of all
+// the sequences back to back. All numbers are little endian. See
+// SaveTokenIdFile and tools/token_id_file.py.
+class TokenIdFile {
+ public:
+  explicit TokenIdFile(const std::string &filename);
+  ~TokenIdFile();
+  TokenIdFile(const TokenIdFile &) = delete;
+  TokenIdFile &operator=(const TokenIdFile &) = delete;
+
+  size_t size() const { return size_; }
+  int64_t length(size_t i) const { return offsets_[i + 1] - offsets_[i]; }
+  const int32_t *ids(size_t i) const { return ids_ + offsets_[i]; }
+
+ private:
+  void *data_{nullptr};
+  size_t bytes_{0};
+  size_t size_{0};
+  const int64_t *offsets_{nullptr};
+  const int32_t *ids_{nullptr};
+};
+
+void SaveTokenIdFile(const std::string &filename,
+                     const std::vector<std::vector<int64_t>> &sequences);
+
+// The output of EmbeddingPipeline: the magic "TTEMBEDS", the uint32 version,
+// the uint32 hidden size and the uint64 number of sequences n, followed by
+// the float embeddings [n, hidden_size] in the order of the sequences.
+// Returns the embeddings and sets `hidden_size`.
+std::vector<float> LoadEmbeddingFile(const std::string &filename,
+                                     int64_t *hidden_size);
+
+// Embeds a token id file into an embedding file in three stages connected by
+// bounded queues, so that the models never wait for the I/O or the batching:
+// a reader thread copies windows of `sort_window` sequences out of the
+// mapped input, a batcher thread sorts every window by length and cuts it
+// into batches of similar lengths, and a writer thread writes the pooled
+// outputs of the batches at the rows of their sequences. A compute thread
+// per model, e.g. one per device, takes the next `batches_per_call` batches
+// and runs them by BertModel::RunBatches, which overlaps the uploads with
+// the compute on the GPU, so the faster models take more of the batches.
+// The models should be planned for max_batch_size x max_seq_len, see
+// BertModel::PlanMemory.
+class EmbeddingPipeline {
+ public:
+  struct Options {
+    size_t max_batch_size{64};
+    // The padded tokens of a batch at most, unless a sequence alone has more.
+    int64_t max_batch_tokens{16384};
+    // Longer sequences are truncated.
+    int64_t max_seq_len{512};
+    size_t sort_window{8192};
+    size_t batches_per_call{4};
+    // The items each queue holds at most, windows or batches.
+    size_t queue_capacity{16};
+    PoolType pooling{PoolType::kFirst};
+    bool use_pooler{false};
+  };
+
+  struct Stats {
+    size_t sequences{0};
+    size_t batches{0};
+    int64_t tokens{0};
+    int64_t padded_tokens{0};
+    double seconds{0};
+  };
+
+  EmbeddingPipeline(std::vector<std::shared_ptr<BertModel>> models,
+                    Options options);
+
+  // Runs the stages to the end, and throws the first error of any of them
+  // once all of them stopped.
+  Stats Run(const std::string &input_file,
+            const std::string &output_file) const;
+
+ private:
+  std::vector<std::shared_ptr<BertModel>> models_;
+  Options options_;
+};
+
+}  // namespace serving
+}  // namespace turbo_transformers
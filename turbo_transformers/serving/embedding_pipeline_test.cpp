@@ -0,0 +1,77 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/serving/embedding_pipeline.h"
+
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/serving/test_model.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+TEST_CASE("Bert-embedding-pipeline", "Cpp interface") {
+  auto model = std::make_shared<BertModel>(
+      TestModelFile(), DLDeviceType::kDLCPU, kTestLayers, kTestHeads);
+  std::vector<std::vector<int64_t>> inputs{{12166, 10699, 16752, 4454},
+                                           {5342},
+                                           {5342, 16471, 817, 16022, 9916},
+                                           {12166, 10699},
+                                           {817, 16022, 4454},
+                                           {16752}};
+  std::string input_file = "embedding_pipeline_test.ids";
+  std::string output_file = "embedding_pipeline_test.embeds";
+  SaveTokenIdFile(input_file, inputs);
+  {
+    TokenIdFile file(input_file);
+    REQUIRE(file.size() == inputs.size());
+    REQUIRE(file.length(2) == 5);
+    REQUIRE(file.ids(2)[4] == 9916);
+  }
+  EmbeddingPipeline::Options options;
+  options.max_batch_size = 2;
+  options.max_batch_tokens = 6;
+  options.sort_window = 4;
+  options.batches_per_call = 2;
+  options.queue_capacity = 1;
+  options.use_pooler = true;
+  EmbeddingPipeline pipeline({model, model}, options);
+  auto stats = pipeline.Run(input_file, output_file);
+  REQUIRE(stats.sequences == inputs.size());
+  REQUIRE(stats.tokens == 16);
+  REQUIRE(stats.padded_tokens >= stats.tokens);
+
+  int64_t hidden_size;
+  auto embeddings = LoadEmbeddingFile(output_file, &hidden_size);
+  REQUIRE(embeddings.size() == inputs.size() * hidden_size);
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    auto ref = (*model)({inputs[i]}, {}, {}, PoolType::kFirst, true);
+    REQUIRE(ref.size() == static_cast<size_t>(hidden_size));
+    for (int64_t j = 0; j < hidden_size; ++j) {
+      REQUIRE(fabs(embeddings[i * hidden_size + j] - ref[j]) < 1e-4);
+    }
+  }
+  // An empty sequence fails the run, and no thread is left behind.
+  SaveTokenIdFile(input_file, {{5342}, {}});
+  REQUIRE_THROWS(pipeline.Run(input_file, output_file));
+  std::remove(input_file.c_str());
+  std::remove(output_file.c_str());
+}
+
+}  // namespace serving
+}  // namespace turbo_transformers
@@ -0,0 +1,308 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/serving/model_registry.h"
+
+#include <algorithm>
+#include <exception>
+#include <utility>
+
+#include "turbo_transformers/serving/bert_model.h"
+#include "loguru.hpp"
+#include "turbo_transformers/core/enforce.h"
+#include "turbo_transformers/core/memory_tracker.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+using turbo_transformers::core::MemoryPlan;
+using turbo_transformers::core::Workspace;
+
+static bool SamePlan(const MemoryPlan &a, const MemoryPlan &b) {
+  return a.total_size == b.total_size && a.blocks.size() == b.blocks.size() &&
+         std::equal(a.blocks.begin(), a.blocks.end(), b.blocks.begin(),
+                    [](const std::pair<const std::string, core::MemoryBlock> &x,
+                       const std::pair<const std::string, core::MemoryBlock>
+                           &y) {
+                      return x.first == y.first &&
+                             x.second.offset == y.second.offset &&
+                             x.second.size == y.second.size;
+                    });
+}
+
+std::unique_ptr<Workspace> WorkspacePool::Acquire(const MemoryPlan *plan,
+                                                  DLDeviceType device_type,
+                                                  int device_id) {
+  std::unique_ptr<Workspace> workspace;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // A workspace reserved for the plan already is taken first, then the
+    // one of the largest arena, which is the likeliest to fit.
+    auto it = std::find_if(idle_.begin(), idle_.end(), [&](const auto &w) {
+      return plan != nullptr && SamePlan(w->plan(), *plan);
+    });
+    if (it == idle_.end()) {
+      it = std::max_element(idle_.begin(), idle_.end(),
+                            [](const auto &a, const auto &b) {
+                              return a->arena_capacity() < b->arena_capacity();
+                            });
+    }
+    if (it != idle_.end()) {
+      workspace = std::move(*it);
+      idle_.erase(it);
+    } else {
+      workspace.reset(new Workspace());
+      ++num_workspaces_;
+    }
+  }
+  if (plan != nullptr && !SamePlan(workspace->plan(), *plan)) {
+    core::MemoryTagGuard tag("workspace");
+    workspace->Reserve(*plan, device_type, device_id);
+  }
+  return workspace;
+}
+
+void WorkspacePool::Release(std::unique_ptr<Workspace> workspace) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  idle_.emplace_back(std::move(workspace));
+}
+
+size_t WorkspacePool::idle_bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t bytes = 0;
+  for (auto &workspace : idle_) {
+    bytes += workspace->arena_capacity();
+  }
+  return bytes;
+}
+
+size_t WorkspacePool::num_workspaces() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_workspaces_;
+}
+
+ModelRegistry::ModelRegistry(DLDeviceType device_type, int device_id,
+                             size_t weight_budget)
+    : device_type_(device_type),
+      device_id_(device_id),
+      weight_budget_(weight_budget),
+      workspace_pool_(std::make_shared<WorkspacePool>()),
+      loader_([this] { LoaderLoop(); }) {}
+
+ModelRegistry::~ModelRegistry() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  load_cv_.notify_all();
+  loader_.join();
+}
+
+void ModelRegistry::Register(const std::string &name,
+                             const std::string &filename, Setup setup) {
+  Entry entry;
+  auto device_type = device_type_;
+  int device_id = device_id_;
+  entry.create = [=] {
+    return std::unique_ptr<BertModel>(
+        new BertModel(filename, device_type, device_id));
+  };
+  entry.setup = std::move(setup);
+  AddEntry(name, std::move(entry));
+}
+
+void ModelRegistry::Register(const std::string &name,
+                             const std::string &filename, size_t n_layers,
+                             int64_t n_heads, Setup setup) {
+  Entry entry;
+  auto device_type = device_type_;
+  int device_id = device_id_;
+  entry.create = [=] {
+    return std::unique_ptr<BertModel>(
+        new BertModel(filename, device_type, n_layers, n_heads, device_id));
+  };
+  entry.setup = std::move(setup);
+  AddEntry(name, std::move(entry));
+}
+
+void ModelRegistry::AddEntry(const std::string &name, Entry entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  TT_ENFORCE(entries_.count(name) == 0, "The model %s is registered already",
+             name);
+  entries_.emplace(name, std::move(entry));
+}
+
+ModelRegistry::Entry &ModelRegistry::Find(const std::string &name) {
+  auto it = entries_.find(name);
+  TT_ENFORCE(it != entries_.end(), "The model %s is not registered", name);
+  return it->second;
+}
+
+std::shared_ptr<const BertModel> ModelRegistry::Get(const std::string &name) {
+  std::vector<std::shared_ptr<BertModel>> evicted;
+  std::shared_future<std::shared_ptr<BertModel>> loading;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &entry = Find(name);
+    entry.last_use = ++clock_;
+    if (entry.model != nullptr) {
+      return entry.model;
+    }
+    loading = entry.loading.valid()
+                  ? entry.loading
+                  : StartLoading(name, &entry, &evicted);
+  }
+  evicted.clear();
+  return loading.get();
+}
+
+void ModelRegistry::Prefetch(const std::string &name) {
+  std::vector<std::shared_ptr<BertModel>> evicted;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &entry = Find(name);
+  if (entry.model == nullptr && !entry.loading.valid()) {
+    StartLoading(name, &entry, &evicted);
+  }
+}
+
+std::shared_future<std::shared_ptr<BertModel>> ModelRegistry::StartLoading(
+    const std::string &name, Entry *entry,
+    std::vector<std::shared_ptr<BertModel>> *evicted) {
+  // The size of a model is known after its first load, which therefore
+  // makes room afterwards.
+  Evict(entry->weight_bytes, name, evicted);
+  entry->charged_bytes = entry->weight_bytes;
+  resident_bytes_ += entry->charged_bytes;
+  entry->promise = std::promise<std::shared_ptr<BertModel>>();
+  entry->loading = entry->promise.get_future().share();
+  load_queue_.push_back(name);
+  load_cv_.notify_one();
+  return entry->loading;
+}
+
+void ModelRegistry::Evict(size_t bytes, const std::string &keep,
+                          std::vector<std::shared_ptr<BertModel>> *evicted) {
+  while (resident_bytes_ + bytes > weight_budget_) {
+    Entry *lru = nullptr;
+    for (auto &kv : entries_) {
+      auto &entry = kv.second;
+      // A model is idle if only the registry holds it.
+      if (kv.first == keep || entry.model == nullptr ||
+          entry.model.use_count() > 1) {
+        continue;
+      }
+      if (lru == nullptr || entry.last_use < lru->last_use) {
+        lru = &entry;
+      }
+    }
+    if (lru == nullptr) {
+      LOG_S(WARNING) << "The models in use take " << resident_bytes_
+                     << " bytes, over the budget of " << weight_budget_;
+      return;
+    }
+    evicted->push_back(std::move(lru->model));
+    resident_bytes_ -= lru->charged_bytes;
+    lru->charged_bytes = 0;
+  }
+}
+
+void ModelRegistry::LoaderLoop() {
+  while (true) {
+    std::string name;
+    std::function<std::unique_ptr<BertModel>()> create;
+    Setup setup;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      load_cv_.wait(lock, [&] { return stopped_ || !load_queue_.empty(); });
+      if (stopped_) {
+        // The loads which have not started fail.
+        for (auto &queued : load_queue_) {
+          try {
+            TT_THROW("The registry of the model %s is destroyed", queued);
+          } catch (...) {
+            entries_.at(queued).promise.set_exception(
+                std::current_exception());
+          }
+        }
+        return;
+      }
+      name = std::move(load_queue_.front());
+      load_queue_.pop_front();
+      auto &entry = entries_.at(name);
+      create = entry.create;
+      setup = entry.setup;
+    }
+
+    std::shared_ptr<BertModel> model;
+    std::exception_ptr error;
+    try {
+      model = create();
+      model->SetWorkspacePool(workspace_pool_);
+      if (setup) {
+        setup(model.get());
+      }
+    } catch (...) {
+      error = std::current_exception();
+      model.reset();
+    }
+
+    std::vector<std::shared_ptr<BertModel>> evicted;
+    std::promise<std::shared_ptr<BertModel>> promise;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto &entry = entries_.at(name);
+      promise = std::move(entry.promise);
+      entry.loading = {};
+      resident_bytes_ -= entry.charged_bytes;
+      entry.charged_bytes = 0;
+      if (model != nullptr) {
+        entry.model = model;
+        entry.weight_bytes = model->weight_bytes();
+        entry.workspace_bytes = model->workspace_bytes();
+        entry.charged_bytes = entry.weight_bytes;
+        resident_bytes_ += entry.charged_bytes;
+        ++entry.loads;
+        Evict(0, name, &evicted);
+      }
+    }
+    evicted.clear();
+    if (model != nullptr) {
+      promise.set_value(std::move(model));
+    } else {
+      promise.set_exception(error);
+    }
+  }
+}
+
+std::vector<ModelRegistry::Usage> ModelRegistry::usages() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<Usage> usages;
+  for (auto &kv : entries_) {
+    Usage usage;
+    usage.name = kv.first;
+    usage.weight_bytes = kv.second.weight_bytes;
+    usage.workspace_bytes = kv.second.workspace_bytes;
+    usage.resident = kv.second.model != nullptr;
+    usage.loads = kv.second.loads;
+    usages.push_back(std::move(usage));
+  }
+  return usages;
+}
+
+size_t ModelRegistry::resident_bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return resident_bytes_;
+}
+
+}  // namespace serving
+}  // namespace turbo_transformers
@@ -0,0 +1,158 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dlpack/dlpack.h"
+#include "turbo_transformers/core/memory_planner.h"
+#include "turbo_transformers/core/workspace.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+class BertModel;
+
+// The activation workspaces of the models of a device, of which only as many
+// run at once as there are callers, e.g. one per stream, so that the models
+// take turns on a few workspaces instead of keeping their own. A workspace is
+// reserved for the memory plan of the model acquiring it, on the arena of the
+// largest plan it has taken, see core::Workspace::Reserve.
+class WorkspacePool {
+ public:
+  // An idle workspace reserved for `plan`, or unplanned if it is null.
+  std::unique_ptr<turbo_transformers::core::Workspace> Acquire(
+      const turbo_transformers::core::MemoryPlan *plan,
+      DLDeviceType device_type, int device_id);
+  void Release(std::unique_ptr<turbo_transformers::core::Workspace> workspace);
+
+  // The bytes of the arenas of the idle workspaces, and the workspaces
+  // created.
+  size_t idle_bytes() const;
+  size_t num_workspaces() const;
+
+ private:
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<turbo_transformers::core::Workspace>> idle_;
+  size_t num_workspaces_{0};
+};
+
+// Hosts many models on a device, whose resident weights take up to a budget
+// of bytes. The models are loaded when they are first used, or prefetched,
+// by a loader thread, so the calls of the resident models go on meanwhile.
+// The least recently used models nobody holds are evicted to make room for
+// the next one: their device weights are freed, and reloaded from their
+// files, which the host keeps in its page cache, through the pinned buffers
+// of loaders::WeightUploader. All the models run on the workspaces of one
+// WorkspacePool.
+class ModelRegistry {
+ public:
+  // Applied to a model every time it is loaded, e.g. to plan its memory.
+  using Setup = std::function<void(BertModel *)>;
+
+  struct Usage {
+    std::string name;
+    // The bytes of the weights on the device, 0 until the model is loaded
+    // once, and of the plan of its activations, which it shares with the
+    // other models.
+    size_t weight_bytes{0};
+    size_t workspace_bytes{0};
+    bool resident{false};
+    int64_t loads{0};
+  };
+
+  ModelRegistry(DLDeviceType device_type, int device_id,
+                size_t weight_budget);
+  // Waits for the loads in progress.
+  ~ModelRegistry();
+
+  // Registers the model `name` of a model file, or of an npz archive or a
+  // weight file without a config if `n_layers` is given, see BertModel.
+  void Register(const std::string &name, const std::string &filename,
+                Setup setup = nullptr);
+  void Register(const std::string &name, const std::string &filename,
+                size_t n_layers, int64_t n_heads, Setup setup = nullptr);
+
+  // The model `name`, waiting for it to be loaded if it is not resident.
+  // It stays resident as long as the returned pointer, or a copy of it,
+  // lives. Throws if the model is unknown or fails to load.
+  std::shared_ptr<const BertModel> Get(const std::string &name);
+  // Starts loading the model `name` in the background unless it is resident
+  // or loading.
+  void Prefetch(const std::string &name);
+
+  // The usages of the models in the order of their names.
+  std::vector<Usage> usages() const;
+  // The bytes of the weights of the resident and the loading models.
+  size_t resident_bytes() const;
+  const std::shared_ptr<WorkspacePool> &workspace_pool() const {
+    return workspace_pool_;
+  }
+
+ private:
+  struct Entry {
+    std::function<std::unique_ptr<BertModel>()> create;
+    Setup setup;
+    std::shared_ptr<BertModel> model;
+    // Valid while the model is queued or loading.
+    std::shared_future<std::shared_ptr<BertModel>> loading;
+    std::promise<std::shared_ptr<BertModel>> promise;
+    size_t weight_bytes{0};
+    size_t workspace_bytes{0};
+    // The bytes counted against the budget.
+    size_t charged_bytes{0};
+    uint64_t last_use{0};
+    int64_t loads{0};
+  };
+
+  void AddEntry(const std::string &name, Entry entry);
+  Entry &Find(const std::string &name);
+  // Queues the load of `entry` and returns its future. Requires mutex_.
+  std::shared_future<std::shared_ptr<BertModel>> StartLoading(
+      const std::string &name, Entry *entry,
+      std::vector<std::shared_ptr<BertModel>> *evicted);
+  // Evicts the least recently used idle models but `keep` until `bytes` more
+  // fit the budget, and moves them to `evicted`, to be destroyed once
+  // mutex_ is released. Requires mutex_.
+  void Evict(size_t bytes, const std::string &keep,
+             std::vector<std::shared_ptr<BertModel>> *evicted);
+  void LoaderLoop();
+
+  DLDeviceType device_type_;
+  int device_id_;
+  size_t weight_budget_;
+  std::shared_ptr<WorkspacePool> workspace_pool_;
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Entry> entries_;
+  size_t resident_bytes_{0};
+  uint64_t clock_{0};
+  std::deque<std::string> load_queue_;
+  std::condition_variable load_cv_;
+  bool stopped_{false};
+  std::thread loader_;
+};
+
+}  // namespace serving
+}  // namespace turbo_transformers
@@ -0,0 +1,92 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/serving/model_registry.h"
+
+#include <cmath>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/serving/bert_model.h"
+#include "turbo_transformers/serving/test_model.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+TEST_CASE("Bert-workspace-pool", "Cpp interface") {
+  WorkspacePool pool;
+  auto first = pool.Acquire(nullptr, DLDeviceType::kDLCPU, 0);
+  auto second = pool.Acquire(nullptr, DLDeviceType::kDLCPU, 0);
+  REQUIRE(pool.num_workspaces() == 2);
+  auto *released = first.get();
+  pool.Release(std::move(first));
+  // An idle workspace is taken again rather than a new one.
+  auto third = pool.Acquire(nullptr, DLDeviceType::kDLCPU, 0);
+  REQUIRE(third.get() == released);
+  REQUIRE(pool.num_workspaces() == 2);
+  pool.Release(std::move(second));
+  pool.Release(std::move(third));
+  REQUIRE(pool.idle_bytes() == 0);
+}
+
+TEST_CASE("Bert-model-registry", "Cpp interface") {
+  std::vector<std::vector<int64_t>> inputs{{12166, 10699, 16752, 4454},
+                                           {5342, 16471}};
+  BertModel reference(TestModelFile(), DLDeviceType::kDLCPU, kTestLayers,
+                      kTestHeads);
+  auto expected = reference(inputs, {}, {}, PoolType::kFirst, true);
+  size_t model_bytes = reference.weight_bytes();
+  REQUIRE(model_bytes > 0);
+
+  // Two models fit the budget.
+  ModelRegistry registry(DLDeviceType::kDLCPU, 0, 2 * model_bytes);
+  auto setup = [](BertModel *model) { model->PlanMemory(2, 8); };
+  for (auto name : {"a", "b", "c"}) {
+    registry.Register(name, TestModelFile(), kTestLayers, kTestHeads, setup);
+  }
+  REQUIRE_THROWS(
+      registry.Register("a", TestModelFile(), kTestLayers, kTestHeads));
+  REQUIRE_THROWS(registry.Get("d"));
+
+  registry.Prefetch("b");
+  for (auto name : {"a", "b", "c", "a"}) {
+    auto model = registry.Get(name);
+    auto vec = (*model)(inputs, {}, {}, PoolType::kFirst, true);
+    REQUIRE(vec.size() == expected.size());
+    for (size_t i = 0; i < vec.size(); ++i) {
+      REQUIRE(fabs(vec[i] - expected[i]) < 1e-4);
+    }
+    REQUIRE(registry.resident_bytes() <= 2 * model_bytes);
+  }
+  // "c" evicted "a", the least recently used, which was loaded again, and
+  // the models took turns on one workspace.
+  auto usages = registry.usages();
+  REQUIRE(usages.size() == 3);
+  REQUIRE(usages[0].loads == 2);
+  REQUIRE(usages[0].resident);
+  REQUIRE(usages[0].weight_bytes == model_bytes);
+  REQUIRE(usages[0].workspace_bytes > 0);
+  REQUIRE(!usages[1].resident);
+  REQUIRE(usages[2].loads == 1);
+  REQUIRE(registry.workspace_pool()->num_workspaces() == 1);
+
+  // A model in use is not evicted.
+  auto held = registry.Get("c");
+  registry.Get("b");
+  REQUIRE(registry.usages()[2].resident);
+}
+
+}  // namespace serving
+}  // namespace turbo_transformers
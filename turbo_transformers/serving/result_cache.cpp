@@ -0,0 +1,125 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/serving/result_cache.h"
+
+#include <algorithm>
+
+#include "turbo_transformers/core/enforce.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+namespace {
+// FNV-1a over the ids, marking the end of every sequence so that the ids
+// can not shift from one sequence to the next without changing the hash.
+void HashIds(const std::vector<int64_t> &ids, uint64_t *hash) {
+  constexpr uint64_t kPrime = 1099511628211ULL;
+  for (auto id : ids) {
+    *hash = (*hash ^ static_cast<uint64_t>(id)) * kPrime;
+  }
+  *hash = (*hash ^ ids.size()) * kPrime;
+}
+}  // namespace
+
+bool ResultCache::Key::operator==(const Key &other) const {
+  return hash == other.hash && pooling == other.pooling &&
+         use_pooler == other.use_pooler && input_ids == other.input_ids &&
+         position_ids == other.position_ids &&
+         segment_ids == other.segment_ids;
+}
+
+ResultCache::Key ResultCache::MakeKey(
+    const std::vector<int64_t> &input_ids,
+    const std::vector<int64_t> &position_ids,
+    const std::vector<int64_t> &segment_ids,
+    turbo_transformers::layers::types::PoolType pooling, bool use_pooler) {
+  uint64_t hash = 14695981039346656037ULL;
+  HashIds(input_ids, &hash);
+  HashIds(position_ids, &hash);
+  HashIds(segment_ids, &hash);
+  hash = (hash ^ (static_cast<uint64_t>(pooling) << 1 | use_pooler)) *
+         1099511628211ULL;
+  return Key{input_ids,  position_ids, segment_ids,
+             pooling,    use_pooler,   static_cast<size_t>(hash)};
+}
+
+ResultCache::ResultCache(size_t capacity, size_t num_shards) {
+  TT_ENFORCE_GT(capacity, 0, "The result cache needs a capacity");
+  num_shards = std::max<size_t>(std::min(num_shards, capacity), 1);
+  shard_capacity_ = (capacity + num_shards - 1) / num_shards;
+  for (size_t i = 0; i < num_shards; ++i) {
+    shards_.emplace_back(new Shard());
+  }
+}
+
+bool ResultCache::Lookup(const Key &key, std::vector<float> *output) {
+  auto &shard = GetShard(key);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto iter = shard.entries.find(key);
+    if (iter != shard.entries.end()) {
+      shard.lru.splice(shard.lru.begin(), shard.lru, iter->second.lru_pos);
+      *output = iter->second.output;
+      ++hits_;
+      return true;
+    }
+  }
+  ++misses_;
+  return false;
+}
+
+void ResultCache::Insert(const Key &key, std::vector<float> output) {
+  auto &shard = GetShard(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto iter = shard.entries.find(key);
+  if (iter != shard.entries.end()) {
+    // Computed by a concurrent call as well.
+    iter->second.output = std::move(output);
+    shard.lru.splice(shard.lru.begin(), shard.lru, iter->second.lru_pos);
+    return;
+  }
+  if (shard.entries.size() >= shard_capacity_) {
+    shard.entries.erase(shard.entries.find(*shard.lru.back()));
+    shard.lru.pop_back();
+  }
+  iter = shard.entries.emplace(key, Entry{std::move(output), {}}).first;
+  shard.lru.push_front(&iter->first);
+  iter->second.lru_pos = shard.lru.begin();
+}
+
+ResultCache::Stats ResultCache::stats() const {
+  Stats stats;
+  stats.hits = hits_;
+  stats.misses = misses_;
+  stats.deduplicated = deduplicated_;
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    stats.entries += shard->entries.size();
+  }
+  return stats;
+}
+
+void ResultCache::Clear() {
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    shard->entries.clear();
+    shard->lru.clear();
+  }
+  hits_ = 0;
+  misses_ = 0;
+  deduplicated_ = 0;
+}
+
+}  // namespace serving
+}  // namespace turbo_transformers
@@ -0,0 +1,104 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "turbo_transformers/layers/types.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+// A bounded cache of the pooled outputs of sequences, for the traffic which
+// repeats, e.g. popular queries, retries and duplicated experiments. An entry
+// is keyed by the ids of a sequence and the pooling of the output, and the
+// least recently used entry of a shard makes room for a new one. The entries
+// are spread over shards of their own locks, so that concurrent callers
+// rarely wait for each other.
+class ResultCache {
+ public:
+  struct Key {
+    std::vector<int64_t> input_ids;
+    std::vector<int64_t> position_ids;
+    std::vector<int64_t> segment_ids;
+    turbo_transformers::layers::types::PoolType pooling;
+    bool use_pooler;
+    size_t hash;
+
+    bool operator==(const Key &other) const;
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &key) const { return key.hash; }
+  };
+
+  struct Stats {
+    int64_t hits{0};
+    int64_t misses{0};
+    // The misses of a batch which repeat an earlier sequence of the batch,
+    // computed once and counted as misses as well.
+    int64_t deduplicated{0};
+    int64_t entries{0};
+  };
+
+  static Key MakeKey(const std::vector<int64_t> &input_ids,
+                     const std::vector<int64_t> &position_ids,
+                     const std::vector<int64_t> &segment_ids,
+                     turbo_transformers::layers::types::PoolType pooling,
+                     bool use_pooler);
+
+  // Holds up to `capacity` outputs in `num_shards` shards of equal shares.
+  ResultCache(size_t capacity, size_t num_shards);
+
+  // Copies the cached output of `key` into `output` and returns true, or
+  // returns false if it is not cached.
+  bool Lookup(const Key &key, std::vector<float> *output);
+  void Insert(const Key &key, std::vector<float> output);
+  void RecordDeduplicated(int64_t n) { deduplicated_ += n; }
+
+  Stats stats() const;
+  void Clear();
+
+ private:
+  struct Entry {
+    std::vector<float> output;
+    // The position of the entry in the LRU list of its shard.
+    std::list<const Key *>::iterator lru_pos;
+  };
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<Key, Entry, KeyHash> entries;
+    // The keys of the entries, the most recently used first.
+    std::list<const Key *> lru;
+  };
+
+  Shard &GetShard(const Key &key) const {
+    return *shards_[(key.hash >> 16) % shards_.size()];
+  }
+
+  size_t shard_capacity_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<int64_t> hits_{0};
+  std::atomic<int64_t> misses_{0};
+  std::atomic<int64_t> deduplicated_{0};
+};
+
+}  // namespace serving
+}  // namespace turbo_transformers
@@ -0,0 +1,82 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/serving/result_cache.h"
+
+#include <vector>
+
+#include "catch2/catch.hpp"
+
+namespace turbo_transformers {
+namespace serving {
+
+using PoolType = layers::types::PoolType;
+
+TEST_CASE("result_cache-lru", "[result_cache]") {
+  // A single shard of two entries.
+  ResultCache cache(2, 1);
+  auto a = ResultCache::MakeKey({1, 2}, {}, {}, PoolType::kFirst, true);
+  auto b = ResultCache::MakeKey({1}, {2}, {}, PoolType::kFirst, true);
+  auto c = ResultCache::MakeKey({1, 2}, {}, {}, PoolType::kMean, true);
+  REQUIRE(!(a == b));
+  REQUIRE(!(a == c));
+  std::vector<float> output;
+  REQUIRE(!cache.Lookup(a, &output));
+  cache.Insert(a, {1.f});
+  cache.Insert(b, {2.f});
+  REQUIRE(cache.Lookup(a, &output));
+  REQUIRE(output == std::vector<float>{1.f});
+  // b is the least recently used.
+  cache.Insert(c, {3.f});
+  REQUIRE(!cache.Lookup(b, &output));
+  REQUIRE(cache.Lookup(c, &output));
+  REQUIRE(output == std::vector<float>{3.f});
+  cache.Insert(c, {4.f});
+  REQUIRE(cache.Lookup(c, &output));
+  REQUIRE(output == std::vector<float>{4.f});
+
+  auto stats = cache.stats();
+  REQUIRE(stats.hits == 3);
+  REQUIRE(stats.misses == 2);
+  REQUIRE(stats.entries == 2);
+  cache.Clear();
+  stats = cache.stats();
+  REQUIRE(stats.hits == 0);
+  REQUIRE(stats.entries == 0);
+  REQUIRE_THROWS(ResultCache(0, 1));
+}
+
+TEST_CASE("result_cache-shards", "[result_cache]") {
+  ResultCache cache(64, 4);
+  for (int64_t i = 0; i < 64; ++i) {
+    cache.Insert(ResultCache::MakeKey({i}, {}, {}, PoolType::kFirst, false),
+                 {static_cast<float>(i)});
+  }
+  // Every key is found in its shard, or made room for a later one there.
+  int64_t found = 0;
+  for (int64_t i = 0; i < 64; ++i) {
+    std::vector<float> output;
+    if (cache.Lookup(
+            ResultCache::MakeKey({i}, {}, {}, PoolType::kFirst, false),
+            &output)) {
+      REQUIRE(output == std::vector<float>{static_cast<float>(i)});
+      ++found;
+    }
+  }
+  REQUIRE(found == cache.stats().entries);
+  REQUIRE(found > 0);
+  REQUIRE(found <= 64);
+}
+
+}  // namespace serving
+}  // namespace turbo_transformers
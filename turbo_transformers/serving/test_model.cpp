@@ -0,0 +1,209 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/serving/test_model.h"
+
+#include <fstream>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "cnpy.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+namespace {
+constexpr size_t kIntermediateSize = 4 * kTestHiddenSize;
+constexpr size_t kVocabSize = 17000;
+constexpr size_t kMaxPositions = 64;
+
+// The archives and the names a tensor is saved under.
+using Targets = std::vector<std::pair<std::string, std::string>>;
+
+std::vector<float> Random(const std::vector<size_t> &shape, float scale,
+                          float bias, std::mt19937 *gen) {
+  size_t size = 1;
+  for (auto dim : shape) {
+    size *= dim;
+  }
+  std::uniform_real_distribution<float> dist(bias - scale, bias + scale);
+  std::vector<float> data(size);
+  for (auto &value : data) {
+    value = dist(*gen);
+  }
+  return data;
+}
+
+void Save(const Targets &targets, const std::vector<float> &data,
+          const std::vector<size_t> &shape, bool first) {
+  for (auto &target : targets) {
+    cnpy::npz_save(target.first, target.second, data.data(), shape,
+                   first ? "w" : "a");
+  }
+}
+
+// Appends a tensor of `shape` to each of `targets`, uniform in
+// [bias - scale, bias + scale].
+void SaveRandom(const Targets &targets, const std::vector<size_t> &shape,
+                float scale, float bias, std::mt19937 *gen,
+                bool first = false) {
+  Save(targets, Random(shape, scale, bias, gen), shape, first);
+}
+
+Targets WithSuffix(const Targets &prefixes, const std::string &suffix) {
+  Targets targets;
+  for (auto &prefix : prefixes) {
+    targets.emplace_back(prefix.first, prefix.second + suffix);
+  }
+  return targets;
+}
+
+// Appends the word, position and token type embeddings to `targets`.
+void SaveRandomEmbeddings(const Targets &targets, std::mt19937 *gen) {
+  const size_t hidden = kTestHiddenSize;
+  SaveRandom(WithSuffix(targets, "word_embeddings.weight"),
+             {kVocabSize, hidden}, 0.5f, 0, gen, true);
+  SaveRandom(WithSuffix(targets, "position_embeddings.weight"),
+             {kMaxPositions, hidden}, 0.5f, 0, gen);
+  SaveRandom(WithSuffix(targets, "token_type_embeddings.weight"), {2, hidden},
+             0.5f, 0, gen);
+}
+
+// Appends the weights of one encoder layer to each of `targets`, which name
+// the archive and the prefix of the layer.
+void SaveRandomLayer(const Targets &targets, std::mt19937 *gen) {
+  const size_t hidden = kTestHiddenSize;
+  SaveRandom(WithSuffix(targets, "attention.qkv.weight"), {hidden, 3 * hidden},
+             0.2f, 0, gen);
+  SaveRandom(WithSuffix(targets, "attention.qkv.bias"), {3 * hidden}, 0.1f, 0,
+             gen);
+  SaveRandom(WithSuffix(targets, "attention.output.dense.weight"),
+             {hidden, hidden}, 0.2f, 0, gen);
+  SaveRandom(WithSuffix(targets, "attention.output.dense.bias"), {hidden},
+             0.1f, 0, gen);
+  SaveRandom(WithSuffix(targets, "attention.output.LayerNorm.weight"),
+             {hidden}, 0.1f, 1, gen);
+  SaveRandom(WithSuffix(targets, "attention.output.LayerNorm.bias"), {hidden},
+             0.1f, 0, gen);
+  SaveRandom(WithSuffix(targets, "intermediate.dense.weight"),
+             {hidden, kIntermediateSize}, 0.2f, 0, gen);
+  SaveRandom(WithSuffix(targets, "intermediate.dense.bias"),
+             {kIntermediateSize}, 0.1f, 0, gen);
+  SaveRandom(WithSuffix(targets, "output.dense.weight"),
+             {kIntermediateSize, hidden}, 0.1f, 0, gen);
+  SaveRandom(WithSuffix(targets, "output.dense.bias"), {hidden}, 0.1f, 0, gen);
+  SaveRandom(WithSuffix(targets, "output.LayerNorm.weight"), {hidden}, 0.1f, 1,
+             gen);
+  SaveRandom(WithSuffix(targets, "output.LayerNorm.bias"), {hidden}, 0.1f, 0,
+             gen);
+}
+
+void SaveRandomPooler(const Targets &targets, std::mt19937 *gen) {
+  const size_t hidden = kTestHiddenSize;
+  SaveRandom(WithSuffix(targets, "pooler.dense.weight"), {hidden, hidden},
+             0.2f, 0, gen);
+  SaveRandom(WithSuffix(targets, "pooler.dense.bias"), {hidden}, 0.1f, 0, gen);
+}
+
+std::string WriteTestModel() {
+  std::string filename = "serving_test_model.npz";
+  std::mt19937 gen(1234);
+  const size_t hidden = kTestHiddenSize;
+  SaveRandomEmbeddings({{filename, "embeddings."}}, &gen);
+  SaveRandom({{filename, "embeddings.LayerNorm.weight"}}, {hidden}, 0.1f, 1,
+             &gen);
+  SaveRandom({{filename, "embeddings.LayerNorm.bias"}}, {hidden}, 0.1f, 0,
+             &gen);
+  for (size_t l = 0; l < kTestLayers; ++l) {
+    SaveRandomLayer({{filename, "encoder.layer." + std::to_string(l) + "."}},
+                    &gen);
+  }
+  SaveRandomPooler({{filename, ""}}, &gen);
+  return filename;
+}
+
+// Writes the ALBERT of TestAlbertModelFile and its BERT equivalent, and
+// returns their filenames.
+std::pair<std::string, std::string> WriteTestAlbertModels() {
+  std::string albert = "serving_test_albert_model.npz";
+  std::string bert = "serving_test_albert_as_bert_model.npz";
+  std::mt19937 gen(4321);
+  const size_t hidden = kTestHiddenSize;
+  SaveRandomEmbeddings({{albert, "embeddings."}, {bert, "embeddings."}}, &gen);
+  // The projection y = x diag(d) + b of the ALBERT, whose embeddings have the
+  // hidden size, folds into the LayerNorm before it: gamma d and beta d + b.
+  auto gamma = Random({hidden}, 0.1f, 1, &gen);
+  auto beta = Random({hidden}, 0.1f, 0, &gen);
+  auto d = Random({hidden}, 0.5f, 1, &gen);
+  auto b = Random({hidden}, 0.1f, 0, &gen);
+  Save({{albert, "embeddings.LayerNorm.weight"}}, gamma, {hidden}, false);
+  Save({{albert, "embeddings.LayerNorm.bias"}}, beta, {hidden}, false);
+  std::vector<float> projection(hidden * hidden, 0);
+  for (size_t i = 0; i < hidden; ++i) {
+    projection[i * hidden + i] = d[i];
+  }
+  Save({{albert, "encoder.embedding_hidden_mapping_in.weight"}}, projection,
+       {hidden, hidden}, false);
+  Save({{albert, "encoder.embedding_hidden_mapping_in.bias"}}, b, {hidden},
+       false);
+  std::vector<float> folded_gamma(hidden), folded_beta(hidden);
+  for (size_t i = 0; i < hidden; ++i) {
+    folded_gamma[i] = gamma[i] * d[i];
+    folded_beta[i] = beta[i] * d[i] + b[i];
+  }
+  Save({{bert, "embeddings.LayerNorm.weight"}}, folded_gamma, {hidden}, false);
+  Save({{bert, "embeddings.LayerNorm.bias"}}, folded_beta, {hidden}, false);
+  // The layers of the BERT are copies of the one ALBERT shares.
+  Targets layers{{albert, "encoder.albert_layer."}};
+  for (size_t l = 0; l < kTestLayers; ++l) {
+    layers.emplace_back(bert, "encoder.layer." + std::to_string(l) + ".");
+  }
+  SaveRandomLayer(layers, &gen);
+  SaveRandomPooler({{albert, ""}, {bert, ""}}, &gen);
+  return {albert, bert};
+}
+
+const std::pair<std::string, std::string> &TestAlbertModelFiles() {
+  static const auto filenames = WriteTestAlbertModels();
+  return filenames;
+}
+}  // namespace
+
+const std::string &TestModelFile() {
+  static const std::string filename = WriteTestModel();
+  return filename;
+}
+
+const std::string &TestAlbertModelFile() {
+  return TestAlbertModelFiles().first;
+}
+
+const std::string &TestAlbertAsBertModelFile() {
+  return TestAlbertModelFiles().second;
+}
+
+std::string WriteTestVocab() {
+  std::string filename = "tokenizer_test_vocab.txt";
+  std::ofstream file(filename);
+  for (const char *token :
+       {"[PAD]", "[UNK]", "[CLS]", "[SEP]", "hello", "world", ",", "!", "un",
+        "##aff", "##able", "cafe", "\xe4\xb8\xad", "##s", "turbo",
+        "##turbo"}) {
+    file << token << "\n";
+  }
+  return filename;
+}
+
+}  // namespace serving
+}  // namespace turbo_transformers
@@ -0,0 +1,44 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace turbo_transformers {
+namespace serving {
+
+// The shape of the model of TestModelFile.
+constexpr size_t kTestLayers = 2;
+constexpr int64_t kTestHeads = 4;
+constexpr size_t kTestHiddenSize = 64;
+
+// The npz archive of a small BERT of random weights, written once per
+// process, which the tests of the serving library load in place of a
+// pretrained model. Its vocabulary covers the ids the tests run.
+const std::string &TestModelFile();
+
+// The npz archive of a small ALBERT of random weights and the shape of
+// TestModelFile, whose layers share the weights of encoder.albert_layer and
+// whose embeddings pass through encoder.embedding_hidden_mapping_in, and
+// that of the BERT computing the same: its layers are copies of the shared
+// layer and the projection is folded into its embedding LayerNorm.
+const std::string &TestAlbertModelFile();
+const std::string &TestAlbertAsBertModelFile();
+
+// Writes the vocabulary of the tokenizer tests and returns its filename.
+std::string WriteTestVocab();
+
+}  // namespace serving
+}  // namespace turbo_transformers
@@ -0,0 +1,437 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/serving/tokenizer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <utility>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "turbo_transformers/core/enforce.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+namespace {
+// As the max_input_chars_per_word of HuggingFace.
+constexpr int64_t kMaxCharsPerWord = 100;
+// The bytes of the longest word split into pieces, whose characters take up
+// to 4 bytes of UTF-8.
+constexpr size_t kMaxWordBytes = 4 * kMaxCharsPerWord;
+// The bytes written past the end of a run by LowerAlnumRun.
+constexpr size_t kRunSlack = 16;
+
+bool IsAsciiAlnum(uint8_t c) {
+  return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z');
+}
+
+bool IsAsciiPunctuation(uint8_t c) {
+  return (c >= 33 && c <= 47) || (c >= 58 && c <= 64) ||
+         (c >= 91 && c <= 96) || (c >= 123 && c <= 126);
+}
+
+// The Unicode classes of BasicTokenizer of HuggingFace, by the ranges of the
+// code points of the categories it tests.
+bool IsWhitespace(uint32_t cp) {
+  return cp == 0xA0 || cp == 0x1680 || (cp >= 0x2000 && cp <= 0x200A) ||
+         cp == 0x202F || cp == 0x205F || cp == 0x3000;
+}
+
+bool IsControl(uint32_t cp) {
+  return (cp >= 0x80 && cp <= 0x9F) || cp == 0xAD ||
+         (cp >= 0x200B && cp <= 0x200F) || (cp >= 0x202A && cp <= 0x202E) ||
+         (cp >= 0x2060 && cp <= 0x2064) || cp == 0xFEFF || cp == 0xFFFD;
+}
+
+bool IsPunctuation(uint32_t cp) {
+  return cp == 0xA1 || cp == 0xA7 || cp == 0xAB || cp == 0xB6 ||
+         cp == 0xB7 || cp == 0xBB || cp == 0xBF ||
+         (cp >= 0x2010 && cp <= 0x2027) || (cp >= 0x2030 && cp <= 0x205E) ||
+         (cp >= 0x3001 && cp <= 0x3003) || (cp >= 0x3008 && cp <= 0x3011) ||
+         (cp >= 0x3014 && cp <= 0x301F) || (cp >= 0xFF01 && cp <= 0xFF0F) ||
+         (cp >= 0xFF1A && cp <= 0xFF20) || (cp >= 0xFF3B && cp <= 0xFF40) ||
+         (cp >= 0xFF5B && cp <= 0xFF65);
+}
+
+// The CJK characters, which are words of their own.
+bool IsCJK(uint32_t cp) {
+  return (cp >= 0x4E00 && cp <= 0x9FFF) || (cp >= 0x3400 && cp <= 0x4DBF) ||
+         (cp >= 0x20000 && cp <= 0x2A6DF) ||
+         (cp >= 0x2A700 && cp <= 0x2CEAF) || (cp >= 0xF900 && cp <= 0xFAFF) ||
+         (cp >= 0x2F800 && cp <= 0x2FA1F);
+}
+
+// The lowercase of the capitals of Latin-1, Greek and Cyrillic.
+uint32_t ToLower(uint32_t cp) {
+  if ((cp >= 0xC0 && cp <= 0xDE && cp != 0xD7) ||
+      (cp >= 0x391 && cp <= 0x3A9 && cp != 0x3A2) ||
+      (cp >= 0x410 && cp <= 0x42F)) {
+    return cp + 0x20;
+  }
+  if (cp >= 0x400 && cp <= 0x40F) {
+    return cp + 0x50;
+  }
+  return cp;
+}
+
+// The ASCII letters of the lowercase letters of Latin-1 [0xE0, 0xFF] without
+// their accents, or 0 for those which have none.
+const char kLatin1Unaccented[33] = "aaaaaa\0ceeeeiiii\0nooooo\0\0uuuuy\0y";
+
+// Decodes the code point at the start of `s`, of `*n` bytes. An invalid
+// sequence is a single byte of 0xFFFD.
+uint32_t DecodeUTF8(const uint8_t *s, size_t len, size_t *n) {
+  *n = 1;
+  uint32_t cp;
+  size_t extra;
+  if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+    cp = s[0] & 0x07;
+    extra = 3;
+  } else if (s[0] >= 0xE0 && s[0] <= 0xEF) {
+    cp = s[0] & 0x0F;
+    extra = 2;
+  } else if (s[0] >= 0xC2 && s[0] < 0xE0) {
+    cp = s[0] & 0x1F;
+    extra = 1;
+  } else {
+    return 0xFFFD;
+  }
+  if (extra >= len) {
+    return 0xFFFD;
+  }
+  for (size_t i = 1; i <= extra; ++i) {
+    if ((s[i] & 0xC0) != 0x80) {
+      return 0xFFFD;
+    }
+    cp = (cp << 6) | (s[i] & 0x3F);
+  }
+  *n = extra + 1;
+  return cp;
+}
+
+size_t EncodeUTF8(uint32_t cp, char *out) {
+  if (cp < 0x80) {
+    out[0] = static_cast<char>(cp);
+    return 1;
+  }
+  if (cp < 0x800) {
+    out[0] = static_cast<char>(0xC0 | (cp >> 6));
+    out[1] = static_cast<char>(0x80 | (cp & 0x3F));
+    return 2;
+  }
+  if (cp < 0x10000) {
+    out[0] = static_cast<char>(0xE0 | (cp >> 12));
+    out[1] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out[2] = static_cast<char>(0x80 | (cp & 0x3F));
+    return 3;
+  }
+  out[0] = static_cast<char>(0xF0 | (cp >> 18));
+  out[1] = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+  out[2] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+  out[3] = static_cast<char>(0x80 | (cp & 0x3F));
+  return 4;
+}
+
+// Copies the ASCII letters and digits at the start of `src`, lowercased if
+// `lower`, to `dst` and returns their number. Up to kRunSlack bytes past
+// them are written as well.
+size_t LowerAlnumRun(const char *src, size_t len, bool lower, char *dst) {
+  size_t n = 0;
+#ifdef __SSE2__
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  while (n + 16 <= len) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + n));
+    // The bytes of 0x80 and above are negative, neither letters nor digits.
+    __m128i folded = _mm_or_si128(v, case_bit);
+    __m128i alpha =
+        _mm_and_si128(_mm_cmpgt_epi8(folded, _mm_set1_epi8('a' - 1)),
+                      _mm_cmplt_epi8(folded, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    int mask = _mm_movemask_epi8(_mm_or_si128(alpha, digit));
+    __m128i out = lower ? _mm_or_si128(v, _mm_and_si128(alpha, case_bit)) : v;
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + n), out);
+    if (mask != 0xFFFF) {
+      return n + __builtin_ctz(~mask);
+    }
+    n += 16;
+  }
+#endif
+  for (; n < len && IsAsciiAlnum(src[n]); ++n) {
+    dst[n] = lower && src[n] >= 'A' && src[n] <= 'Z' ? src[n] | 0x20 : src[n];
+  }
+  return n;
+}
+
+// The node of `piece` in a trie of sorted `pieces`, built depth first with
+// the children of a node next to each other.
+template <typename Trie, typename Node, typename Edge>
+uint32_t BuildNode(const std::vector<std::pair<std::string, int64_t>> &pieces,
+                   size_t begin, size_t end, size_t depth, Trie *trie) {
+  uint32_t node = trie->nodes.size();
+  trie->nodes.emplace_back();
+  // A duplicate of the vocabulary takes the id of its last line, as the
+  // vocabulary dict of HuggingFace.
+  while (begin < end && pieces[begin].first.size() == depth) {
+    trie->nodes[node].id = pieces[begin].second;
+    ++begin;
+  }
+  std::vector<Edge> children;
+  while (begin < end) {
+    auto byte = static_cast<uint8_t>(pieces[begin].first[depth]);
+    size_t next = begin;
+    while (next < end &&
+           static_cast<uint8_t>(pieces[next].first[depth]) == byte) {
+      ++next;
+    }
+    children.push_back(
+        {byte, BuildNode<Trie, Node, Edge>(pieces, begin, next, depth + 1,
+                                           trie)});
+    begin = next;
+  }
+  trie->nodes[node].first_edge = trie->edges.size();
+  trie->nodes[node].num_edges = children.size();
+  trie->edges.insert(trie->edges.end(), children.begin(), children.end());
+  return node;
+}
+}  // namespace
+
+void WordPieceTokenizer::BuildTrie(const std::vector<std::string> &pieces,
+                                   const std::vector<int64_t> &ids,
+                                   Trie *trie) {
+  std::vector<std::pair<std::string, int64_t>> sorted;
+  for (size_t i = 0; i < pieces.size(); ++i) {
+    sorted.emplace_back(pieces[i], ids[i]);
+  }
+  // Stable, so that the duplicates keep the order of their lines.
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const std::pair<std::string, int64_t> &a,
+                      const std::pair<std::string, int64_t> &b) {
+                     return a.first < b.first;
+                   });
+  trie->nodes.clear();
+  trie->edges.clear();
+  BuildNode<Trie, Node, Edge>(sorted, 0, sorted.size(), 0, trie);
+  std::fill(std::begin(trie->root_children), std::end(trie->root_children), 0);
+  const Node &root = trie->nodes[0];
+  for (uint32_t e = root.first_edge; e < root.first_edge + root.num_edges;
+       ++e) {
+    trie->root_children[trie->edges[e].byte] = trie->edges[e].child;
+  }
+}
+
+uint32_t WordPieceTokenizer::Trie::Child(uint32_t node, uint8_t byte) const {
+  if (node == 0) {
+    return root_children[byte];
+  }
+  const Node &parent = nodes[node];
+  for (uint32_t e = parent.first_edge;
+       e < parent.first_edge + parent.num_edges; ++e) {
+    if (edges[e].byte >= byte) {
+      return edges[e].byte == byte ? edges[e].child : 0;
+    }
+  }
+  return 0;
+}
+
+int64_t WordPieceTokenizer::Trie::Find(absl::string_view piece) const {
+  if (piece.empty()) {
+    return -1;
+  }
+  uint32_t node = 0;
+  for (char c : piece) {
+    node = Child(node, static_cast<uint8_t>(c));
+    if (node == 0) {
+      return -1;
+    }
+  }
+  return nodes[node].id;
+}
+
+WordPieceTokenizer::WordPieceTokenizer(const std::string &vocab_file,
+                                       bool do_lower_case)
+    : do_lower_case_(do_lower_case) {
+  std::ifstream file(vocab_file);
+  TT_ENFORCE(file.good(), "Can not open the vocabulary %s",
+             vocab_file.c_str());
+  std::vector<std::string> start_pieces, continuation_pieces;
+  std::vector<int64_t> start_ids, continuation_ids;
+  std::string line;
+  for (; std::getline(file, line); ++vocab_size_) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.size() > 2 && line.compare(0, 2, "##") == 0) {
+      continuation_pieces.push_back(line.substr(2));
+      continuation_ids.push_back(vocab_size_);
+    } else if (!line.empty()) {
+      start_pieces.push_back(line);
+      start_ids.push_back(vocab_size_);
+    }
+  }
+  BuildTrie(start_pieces, start_ids, &word_start_);
+  BuildTrie(continuation_pieces, continuation_ids, &word_continuation_);
+  unk_id_ = TokenId("[UNK]");
+  cls_id_ = TokenId("[CLS]");
+  sep_id_ = TokenId("[SEP]");
+  TT_ENFORCE(unk_id_ >= 0 && cls_id_ >= 0 && sep_id_ >= 0,
+             "The vocabulary %s misses [UNK], [CLS] or [SEP]",
+             vocab_file.c_str());
+}
+
+int64_t WordPieceTokenizer::TokenId(absl::string_view token) const {
+  if (token.size() > 2 && token.substr(0, 2) == "##") {
+    return word_continuation_.Find(token.substr(2));
+  }
+  return word_start_.Find(token);
+}
+
+bool WordPieceTokenizer::EncodeWord(const char *word, size_t len,
+                                    int64_t num_chars, int64_t max_pieces,
+                                    int64_t *ids, int64_t *count) const {
+  if (num_chars == 0) {
+    return *count < max_pieces;
+  }
+  if (num_chars > kMaxCharsPerWord) {
+    ids[(*count)++] = unk_id_;
+    return *count < max_pieces;
+  }
+  // The pieces of a word are found first, as a word of no split is a single
+  // [UNK] even where its first pieces would fill `ids`.
+  int64_t pieces[kMaxWordBytes];
+  int64_t n_pieces = 0;
+  for (size_t begin = 0; begin < len;) {
+    const Trie &trie = begin == 0 ? word_start_ : word_continuation_;
+    uint32_t node = 0;
+    int64_t best_id = -1;
+    size_t best_end = begin;
+    for (size_t i = begin; i < len; ++i) {
+      node = trie.Child(node, static_cast<uint8_t>(word[i]));
+      if (node == 0) {
+        break;
+      }
+      if (trie.nodes[node].id >= 0) {
+        best_id = trie.nodes[node].id;
+        best_end = i + 1;
+      }
+    }
+    if (best_id < 0) {
+      pieces[0] = unk_id_;
+      n_pieces = 1;
+      break;
+    }
+    pieces[n_pieces++] = best_id;
+    begin = best_end;
+  }
+  int64_t n = std::min(n_pieces, max_pieces - *count);
+  std::copy(pieces, pieces + n, ids + *count);
+  *count += n;
+  return *count < max_pieces;
+}
+
+int64_t WordPieceTokenizer::Encode(absl::string_view text, int64_t max_len,
+                                   int64_t *ids) const {
+  TT_ENFORCE_GE(max_len, 2, "The ids need room for [CLS] and [SEP].");
+  int64_t count = 0;
+  ids[count++] = cls_id_;
+  int64_t max_pieces = max_len - 1;
+  char word[kMaxWordBytes + kRunSlack];
+  size_t len = 0;
+  int64_t num_chars = 0;
+  bool room = true;
+  auto flush = [&]() {
+    room = room && EncodeWord(word, len, num_chars, max_pieces, ids, &count);
+    len = 0;
+    num_chars = 0;
+  };
+  auto append = [&](const char *bytes, size_t n) {
+    if (len + n <= kMaxWordBytes) {
+      std::copy(bytes, bytes + n, word + len);
+      len += n;
+    }
+    ++num_chars;
+  };
+
+  const auto *s = reinterpret_cast<const uint8_t *>(text.data());
+  size_t size = text.size();
+  for (size_t i = 0; i < size && room;) {
+    uint8_t c = s[i];
+    if (c < 0x80) {
+      if (IsAsciiAlnum(c) && len < kMaxWordBytes) {
+        size_t n = LowerAlnumRun(text.data() + i,
+                                 std::min(size - i, kMaxWordBytes - len),
+                                 do_lower_case_, word + len);
+        len += n;
+        num_chars += n;
+        i += n;
+        continue;
+      }
+      char ch = static_cast<char>(c);
+      if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        flush();
+      } else if (c == 0 || c < 0x20 || c == 0x7F) {
+        // A control character is dropped.
+      } else if (IsAsciiPunctuation(c)) {
+        flush();
+        append(&ch, 1);
+        flush();
+      } else {
+        if (do_lower_case_ && c >= 'A' && c <= 'Z') {
+          ch = static_cast<char>(c | 0x20);
+        }
+        append(&ch, 1);
+      }
+      ++i;
+      continue;
+    }
+
+    size_t n;
+    uint32_t cp = DecodeUTF8(s + i, size - i, &n);
+    if (IsWhitespace(cp)) {
+      flush();
+    } else if (IsControl(cp)) {
+    } else if (IsPunctuation(cp) || IsCJK(cp)) {
+      flush();
+      append(text.data() + i, n);
+      flush();
+    } else if (do_lower_case_) {
+      cp = ToLower(cp);
+      char bytes[4];
+      if (cp >= 0xE0 && cp <= 0xFF && kLatin1Unaccented[cp - 0xE0] != 0) {
+        bytes[0] = kLatin1Unaccented[cp - 0xE0];
+        append(bytes, 1);
+      } else {
+        append(bytes, EncodeUTF8(cp, bytes));
+      }
+    } else {
+      append(text.data() + i, n);
+    }
+    i += n;
+  }
+  flush();
+  ids[count++] = sep_id_;
+  return count;
+}
+
+std::vector<int64_t> WordPieceTokenizer::Encode(absl::string_view text,
+                                                int64_t max_len) const {
+  std::vector<int64_t> ids(std::max<int64_t>(max_len, 2));
+  ids.resize(Encode(text, max_len, ids.data()));
+  return ids;
+}
+
+}  // namespace serving
+}  // namespace turbo_transformers
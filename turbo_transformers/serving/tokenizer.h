@@ -0,0 +1,93 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+// The WordPiece tokenizer of BERT, which turns raw UTF-8 text into the ids
+// of a vocab.txt, one token per line, as the "BertTokenizer" of HuggingFace
+// does: the text is split on whitespace, punctuation and CJK characters,
+// lowercased if `do_lower_case`, then every word is split into its longest
+// pieces of the vocabulary, the later ones looked up with their "##"
+// prefix, and a word of no such split, or of more than 100 characters, is
+// [UNK]. The accents stripped by the lowercasing are those of Latin-1, other
+// non-ASCII letters are kept as they are, which the Unicode tables of the
+// Python tokenizers would lowercase or decompose.
+//
+// The pieces are matched on two byte tries of the vocabulary, and the ASCII
+// runs of letters and digits are lowercased 16 bytes at a time. Encode
+// writes the ids to the caller's buffer, e.g. the pinned input of a model,
+// see BertModel::RunTexts. A tokenizer is immutable once loaded, so it can
+// be shared by threads.
+class WordPieceTokenizer {
+ public:
+  explicit WordPieceTokenizer(const std::string &vocab_file,
+                              bool do_lower_case = true);
+
+  // Writes the ids of `text`, [CLS] first and [SEP] last, to `ids`, which
+  // has room for `max_len` >= 2 of them, and returns their number. The
+  // pieces past `max_len` - 2 are dropped, as HuggingFace truncates them.
+  int64_t Encode(absl::string_view text, int64_t max_len, int64_t *ids) const;
+  std::vector<int64_t> Encode(absl::string_view text, int64_t max_len) const;
+
+  // The id of a token of the vocabulary, e.g "##ing" or "[PAD]", or -1.
+  int64_t TokenId(absl::string_view token) const;
+  int64_t vocab_size() const { return vocab_size_; }
+
+ private:
+  struct Node {
+    int64_t id{-1};
+    uint32_t first_edge{0};
+    uint32_t num_edges{0};
+  };
+  struct Edge {
+    uint8_t byte;
+    uint32_t child;
+  };
+  // The tries of the pieces starting a word, and of the "##" pieces without
+  // their prefix. Their roots look up their children by a table of bytes.
+  struct Trie {
+    std::vector<Node> nodes;
+    std::vector<Edge> edges;
+    uint32_t root_children[256];
+
+    int64_t Find(absl::string_view piece) const;
+    // The child of `node` for `byte`, 0 if none, which is the root.
+    uint32_t Child(uint32_t node, uint8_t byte) const;
+  };
+
+  static void BuildTrie(const std::vector<std::string> &pieces,
+                        const std::vector<int64_t> &ids, Trie *trie);
+  // Appends the pieces of the word `word` of `num_chars` code points to
+  // `ids` from `*count`, up to `max_pieces`. Returns false once full.
+  bool EncodeWord(const char *word, size_t len, int64_t num_chars,
+                  int64_t max_pieces, int64_t *ids, int64_t *count) const;
+
+  bool do_lower_case_;
+  int64_t vocab_size_{0};
+  int64_t unk_id_{-1};
+  int64_t cls_id_{-1};
+  int64_t sep_id_{-1};
+  Trie word_start_;
+  Trie word_continuation_;
+};
+
+}  // namespace serving
+}  // namespace turbo_transformers
@@ -0,0 +1,85 @@
+// Copyright (C) 2020 THL A29 Limited, a Tencent company.
+// All rights reserved.
+// Licensed under the BSD 3-Clause License (the "License"); you may
+// not use this file except in compliance with the License. You may
+// obtain a copy of the License at
+// https://opensource.org/licenses/BSD-3-Clause
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the License.
+// See the AUTHORS file for names of contributors.
+
+#include "turbo_transformers/serving/tokenizer.h"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "turbo_transformers/serving/test_model.h"
+
+namespace turbo_transformers {
+namespace serving {
+
+TEST_CASE("Bert-tokenizer", "Cpp interface") {
+  auto filename = WriteTestVocab();
+  WordPieceTokenizer tokenizer(filename);
+  REQUIRE(tokenizer.vocab_size() == 16);
+  REQUIRE(tokenizer.TokenId("##aff") == 9);
+  REQUIRE(tokenizer.TokenId("aff") == -1);
+  REQUIRE(tokenizer.Encode("Hello,World!", 16) ==
+          std::vector<int64_t>{2, 4, 6, 5, 7, 3});
+  REQUIRE(tokenizer.Encode(" unaffable\tunx ", 16) ==
+          std::vector<int64_t>{2, 8, 9, 10, 1, 3});
+  // The accents are stripped, and a CJK character is a word of its own.
+  REQUIRE(tokenizer.Encode("Caf\xc3\xa9 \xe4\xb8\xad\xe6\x96\x87", 16) ==
+          std::vector<int64_t>{2, 11, 12, 1, 3});
+  // A word longer than 16 bytes.
+  REQUIRE(tokenizer.Encode("TurboTURBOturboTurbos", 16) ==
+          std::vector<int64_t>{2, 14, 15, 15, 15, 13, 3});
+  REQUIRE(tokenizer.Encode(std::string(101, 'a'), 16) ==
+          std::vector<int64_t>{2, 1, 3});
+  // The pieces past max_len - 2 are dropped.
+  REQUIRE(tokenizer.Encode("hello unaffable", 4) ==
+          std::vector<int64_t>{2, 4, 8, 3});
+  REQUIRE_THROWS(tokenizer.Encode("hello", 1));
+  WordPieceTokenizer cased(filename, false);
+  REQUIRE(cased.Encode("Hello hello", 16) == std::vector<int64_t>{2, 1, 4, 3});
+  REQUIRE_THROWS(WordPieceTokenizer("no_such_vocab.txt"));
+  // A lead byte past 0xF4 is an invalid byte, dropped as the bytes after it.
+  REQUIRE(tokenizer.Encode("\xf5\x80\x80hello", 16) ==
+          std::vector<int64_t>{2, 4, 3});
+  REQUIRE(tokenizer.Encode("\xff\xbf\xbfworld", 16) ==
+          std::vector<int64_t>{2, 5, 3});
+  std::remove(filename.c_str());
+}
+
+TEST_CASE("Bert-tokenizer-long-word", "Cpp interface") {
+  std::string filename = "tokenizer_test_long_vocab.txt";
+  {
+    std::ofstream file(filename);
+    for (const char *token : {"[UNK]", "[CLS]", "[SEP]", "a", "##a"}) {
+      file << token << "\n";
+    }
+  }
+  WordPieceTokenizer tokenizer(filename);
+  std::remove(filename.c_str());
+  // A word of 100 characters splits into its pieces.
+  auto ids = tokenizer.Encode(std::string(100, 'a'), 1024);
+  REQUIRE(ids.size() == 102);
+  REQUIRE(ids[1] == 3);
+  REQUIRE(ids[100] == 4);
+  // A longer one is a single [UNK], however many bytes it has.
+  for (size_t len : {101, 400, 4000}) {
+    REQUIRE(tokenizer.Encode(std::string(len, 'a'), 1024) ==
+            std::vector<int64_t>{1, 0, 2});
+    REQUIRE(tokenizer.Encode("a " + std::string(len, 'a') + " a", 1024) ==
+            std::vector<int64_t>{1, 3, 0, 3, 2});
+  }
+}
+
+}  // namespace serving
+}  // namespace turbo_transformers